@@ -15,18 +15,27 @@
 #ifndef PEACALM_LUAW_H_
 #define PEACALM_LUAW_H_
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <deque>
 #include <forward_list>
+#include <fstream>
 #include <functional>
 #include <initializer_list>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <typeinfo>
@@ -38,6 +47,31 @@
 // This comment to avoid clang-format mix includes before sort
 #include <lua.hpp>
 
+// Used by the bytecode cache. On platforms other than POSIX and Windows,
+// cache files are read by std::ifstream, and their directory is neither
+// checked nor created.
+#if defined(__unix__) || defined(__APPLE__)
+#define PEACALM_LUAW_USE_MMAP true
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define PEACALM_LUAW_USE_MMAP false
+#if defined(_WIN32)
+#include <direct.h>
+#include <sys/stat.h>
+#endif
+#endif
+
+// Used by the columnar evaluator. Define PEACALM_LUAW_NO_SIMD to disable.
+#if defined(__AVX2__) && !defined(PEACALM_LUAW_NO_SIMD)
+#define PEACALM_LUAW_USE_AVX2 true
+#include <immintrin.h>
+#else
+#define PEACALM_LUAW_USE_AVX2 false
+#endif
+
 static_assert(LUA_VERSION_NUM >= 504, "Lua version at least 5.4");
 
 #ifdef PEACALM_LUAW_ASSERT_OFF
@@ -74,6 +108,10 @@ static_assert(
 #define PEACAML_LUAW_IF_CONSTEXPR
 #endif
 
+#if PEACALM_LUAW_SUPPORT_CPP17
+#include <string_view>
+#endif
+
 namespace peacalm {
 
 namespace luaexf {  // Useful extended functions for Lua
@@ -218,5101 +256,10010 @@ template <typename Class, typename F>
 using c_function_to_const_member_function_t =
     typename c_function_to_const_member_function<Class, F>::type;
 
-}  // namespace luaw_detail
+// LRU cache for compiled chunks keyed by their source text.
+// Chunks are stored in LUA_REGISTRYINDEX, this only keeps their ref ids.
+class chunk_cache {
+  using lru_list_t = std::list<const std::string*>;
+
+  struct entry {
+    int                  ref;
+    lru_list_t::iterator pos;
+    // Free global names of the chunk, memoized by users like prefetch.
+    std::shared_ptr<const std::vector<std::string>> globals;
+    // Bytecode of the chunk, memoized by users like eval_with_env.
+    std::shared_ptr<const std::string> bytecode;
+  };
 
-// The luaw family.
-class luaw;
-class fakeluaw;
-class subluaw;
+  size_t                                 capacity_;
+  std::unordered_map<std::string, entry> map_;
+  lru_list_t                             lru_;  // most recently used first
+  std::string                            key_;  // buffer for lookup
+  size_t                                 hits_      = 0;
+  size_t                                 misses_    = 0;
+  size_t                                 evictions_ = 0;
 
-/// Basic Lua wrapper class.
-class luaw {
-  using self_t = luaw;
+  void evict_one(lua_State* L) {
+    auto it = map_.find(*lru_.back());
+    PEACALM_LUAW_ASSERT(it != map_.end());
+    luaL_unref(L, LUA_REGISTRYINDEX, it->second.ref);
+    lru_.pop_back();
+    map_.erase(it);
+    ++evictions_;
+  }
 
-  // The path where registered member operations stored:
-  // LUA_REGISTRYINDEX -> (void*)(&typeid(T)) -> this enum field
-  enum member_info_fields {
-    member_function = 1,
-    member_getter,
-    member_setter,
-    dynamic_member_getter,
-    dynamic_member_setter,
-    const_member,
-    nonconst_member_function,
-    nonvolatile_member_function
-  };
+public:
+  explicit chunk_cache(size_t capacity) : capacity_(capacity) {}
+
+  size_t capacity() const { return capacity_; }
+  size_t size() const { return map_.size(); }
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+  size_t evictions() const { return evictions_; }
+
+  // Set a new capacity, evict the least recently used ones if necessary.
+  void capacity(lua_State* L, size_t capacity) {
+    capacity_ = capacity;
+    while (map_.size() > capacity_) evict_one(L);
+  }
+
+  // Return ref id of the cached chunk or LUA_NOREF if not found.
+  int find(const char* s, size_t len) {
+    key_.assign(s, len);
+    auto it = map_.find(key_);
+    if (it == map_.end()) {
+      ++misses_;
+      return LUA_NOREF;
+    }
+    ++hits_;
+    lru_.splice(lru_.begin(), lru_, it->second.pos);
+    return it->second.ref;
+  }
 
-  // std::tuple as one Lua table, like std::pair
-  template <typename T, typename = void>
-  struct pusher;
-  template <typename T, typename = void>
-  struct convertor;
+  // Take ownership of the ref id of a chunk compiled from the source.
+  void insert(lua_State* L, const char* s, size_t len, int ref) {
+    if (capacity_ == 0) {
+      luaL_unref(L, LUA_REGISTRYINDEX, ref);
+      return;
+    }
+    auto it = map_.find(std::string(s, len));
+    if (it != map_.end()) {
+      luaL_unref(L, LUA_REGISTRYINDEX, it->second.ref);
+      it->second.ref = ref;
+      it->second.globals.reset();
+      it->second.bytecode.reset();
+      lru_.splice(lru_.begin(), lru_, it->second.pos);
+      return;
+    }
+    while (map_.size() >= capacity_) evict_one(L);
+    it = map_.emplace(std::string(s, len), entry{ref, lru_.end(), nullptr, nullptr})
+             .first;
+    lru_.push_front(&it->first);
+    it->second.pos = lru_.begin();
+  }
+
+  // Get the free global names memoized for the cached chunk of the source, or
+  // nullptr if not memoized. Not counted as a hit or miss.
+  // Shared since the entry may be evicted while the names are being used.
+  std::shared_ptr<const std::vector<std::string>> free_globals(const char* s,
+                                                               size_t len) {
+    key_.assign(s, len);
+    auto it = map_.find(key_);
+    return it == map_.end() ? nullptr : it->second.globals;
+  }
+
+  // Get the bytecode memoized for the cached chunk of the source, or nullptr
+  // if not memoized. Counted as a hit if found.
+  std::shared_ptr<const std::string> bytecode(const char* s, size_t len) {
+    key_.assign(s, len);
+    auto it = map_.find(key_);
+    if (it == map_.end() || !it->second.bytecode) return nullptr;
+    ++hits_;
+    lru_.splice(lru_.begin(), lru_, it->second.pos);
+    return it->second.bytecode;
+  }
+
+  // Memoize bytecode for the cached chunk of the source. Ignored if the source
+  // is not cached.
+  void bytecode(const char*                        s,
+                size_t                             len,
+                std::shared_ptr<const std::string> b) {
+    key_.assign(s, len);
+    auto it = map_.find(key_);
+    if (it != map_.end()) it->second.bytecode = std::move(b);
+  }
+
+  // Memoize free global names for the cached chunk of the source. Ignored if
+  // the source is not cached.
+  void free_globals(const char* s, size_t len, std::vector<std::string> names) {
+    key_.assign(s, len);
+    auto it = map_.find(key_);
+    if (it == map_.end()) return;
+    it->second.globals =
+        std::make_shared<const std::vector<std::string>>(std::move(names));
+  }
+
+  // Release all cached chunks.
+  void clear(lua_State* L) {
+    for (const auto& e : map_) luaL_unref(L, LUA_REGISTRYINDEX, e.second.ref);
+    map_.clear();
+    lru_.clear();
+  }
+};
 
-  // std::tuple as multi value in stack
-  template <typename T>
-  struct pusher_for_return;
-  template <typename T>
-  struct convertor_for_return;
+// 64-bit FNV-1a hash.
+inline uint64_t fnv1a64(const void* data,
+                        size_t      len,
+                        uint64_t    h = 14695981039346656037ULL) {
+  auto p = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < len; ++i) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
 
-  // Implementation for registering members of classes
-  template <typename T>
-  struct register_ctor_impl;
-  template <typename T, typename = void>
-  struct registrar;
-  // Used for registrar sepcialication for registering member ptr/ref.
-  struct registrar_tag_for_member_ptr;
+// 32-bit FNV-1a hash, usable at compile time.
+constexpr uint32_t fnv1a32(const char* s, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= static_cast<unsigned char>(s[i]);
+    h *= 16777619u;
+  }
+  return h;
+}
 
-  // Mock std::mem_fn by a function or callable object whose first argument
-  // must be a raw pointer of a class.
-  // Then can call this class by reference, raw pointer or smart pointers
-  // (std::shared_ptr and std::unique_ptr) of the class.
-  // Also can accept a real member pointer, then it is just like std::mem_fn.
-  template <typename T, typename = void>
-  class mock_mem_fn;
+constexpr size_t constexpr_strlen(const char* s) {
+  size_t n = 0;
+  while (s[n]) ++n;
+  return n;
+}
 
-  // Mock non-member to be a class's member.
-  // Behaves like std::mem_fn, accepts a first argument representing the class's
-  // instance, but this one would drop it, it's just a placeholder, non-member
-  // variables/functions don't need it after all.
-  // Can accept variable pointer or function pointer.
-  template <typename T, typename = void>
-  class static_mem_fn;
+// Read only view of a whole file, mapped into memory if possible.
+class file_view {
+  const char* data_      = nullptr;
+  size_t      size_      = 0;
+  int64_t     mtime_sec_ = 0, mtime_nsec_ = 0;
+  bool        ok_        = false;
+#if PEACALM_LUAW_USE_MMAP
+  void* map_ = nullptr;
+#else
+  std::string buf_;
+#endif
 
-  lua_State* L_;
+#if PEACALM_LUAW_USE_MMAP
+  void set_mtime(const struct stat& st) {
+    mtime_sec_ = static_cast<int64_t>(st.st_mtime);
+#if defined(__APPLE__)
+    mtime_nsec_ = static_cast<int64_t>(st.st_mtimespec.tv_nsec);
+#else
+    mtime_nsec_ = static_cast<int64_t>(st.st_mtim.tv_nsec);
+#endif
+  }
+#endif
 
 public:
-  using lua_cfunction_t = lua_CFunction;  // int (*)(lua_State *L)
-  using lua_number_t    = lua_Number;     // double as default
-  using lua_integer_t   = lua_Integer;    // long long as default
-
-  /// To generate shared/exclusive metatable of type T.
-  template <typename T, typename = void>
-  struct metatable_factory;
+  explicit file_view(const char* path) {
+#if PEACALM_LUAW_USE_MMAP
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+      ::close(fd);
+      return;
+    }
+    set_mtime(st);
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+      void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        return;
+      }
+      map_  = p;
+      data_ = static_cast<const char*>(p);
+    } else {
+      data_ = "";
+    }
+    ::close(fd);
+    ok_ = true;
+#else
+#if defined(_WIN32)
+    struct _stat st;
+    if (::_stat(path, &st) != 0 || !(st.st_mode & _S_IFREG)) return;
+    mtime_sec_ = static_cast<int64_t>(st.st_mtime);
+#endif
+    std::ifstream f(path, std::ios::in | std::ios::binary);
+    if (!f) return;
+    buf_.assign(std::istreambuf_iterator<char>(f),
+                std::istreambuf_iterator<char>());
+    if (f.bad()) return;
+    data_ = buf_.data();
+    size_ = buf_.size();
+    ok_   = true;
+#endif
+  }
 
-  /// A callable wrapper for Lua functions. Like std::function and can convert
-  /// to std::function, but contains more status information. Used within method
-  /// get.
-  template <typename T>
-  class function;
+  file_view(const file_view&)            = delete;
+  file_view& operator=(const file_view&) = delete;
 
-  /// Used as hint type for set/push/setkv, indicate the value is a class
-  /// object.
-  struct class_tag {};
+  ~file_view() {
+#if PEACALM_LUAW_USE_MMAP
+    if (map_) ::munmap(map_, size_);
+#endif
+  }
 
-  /// Used as hint type for set/push/setkv, indicate the value is a function or
-  /// a callable object used as a function.
-  struct function_tag {};
+  bool        ok() const { return ok_; }
+  const char* data() const { return data_; }
+  size_t      size() const { return size_; }
+  int64_t     mtime_sec() const { return mtime_sec_; }
+  int64_t     mtime_nsec() const { return mtime_nsec_; }
+};
 
-  /// Used as a value for set/push/setkv, indicate that should set/push a new
-  /// empty table to Lua.
-  struct newtable_tag {};
+// Whether "path" is a directory, create it first if not exists. Its parent
+// directory must exist. Always true on platforms other than POSIX and Windows,
+// where it's neither checked nor created.
+inline bool make_dir(const char* path) {
+#if PEACALM_LUAW_USE_MMAP
+  struct stat st;
+  if (::stat(path, &st) != 0) {
+    ::mkdir(path, 0755);
+    if (::stat(path, &st) != 0) return false;
+  }
+  return S_ISDIR(st.st_mode);
+#elif defined(_WIN32)
+  struct _stat st;
+  if (::_stat(path, &st) != 0) {
+    ::_mkdir(path);
+    if (::_stat(path, &st) != 0) return false;
+  }
+  return (st.st_mode & _S_IFDIR) != 0;
+#else
+  (void)path;
+  return true;
+#endif
+}
 
-  /// Used as a key for seek/touchtb/setkv/lset, indicate that we're
-  /// getting/setting a value's metatable.
-  /// "tname" is used for touchtb to create a new metatable with this given name
-  /// if the value doesn't have a metatable.
-  struct metatable_tag {
-    const char* tname;
-    metatable_tag(const char* name = nullptr) : tname(name) {}
+// Persistent cache for bytecode of Lua script files.
+// A cache file consists of a header, the source file's path, and the bytecode
+// dumped by lua_dump.
+class bytecode_cache {
+  struct header {
+    char     magic[8];
+    uint32_t lua_version;
+    uint32_t path_size;
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+    uint64_t source_size;
+    uint64_t source_hash;
+    uint64_t bytecode_size;
+    uint64_t bytecode_hash;
   };
 
-  /// Indicate that convert a Lua value to nothing, the Lua value is useless.
-  /// Any Lua value can convert to this.
-  /// Maybe used as a C++ function formal parameter.
-  struct placeholder_tag {};
+  static constexpr const char* magic() { return "LUAWBC1"; }
 
-  /// Represent a Lua value in stack by index.
-  class luavalueidx {
-    lua_State* L_;
-    int        idx_;
+  static uint32_t lua_version() {
+#ifdef LUA_VERSION_RELEASE_NUM
+    return LUA_VERSION_RELEASE_NUM;
+#else
+    return LUA_VERSION_NUM;
+#endif
+  }
 
-  public:
-    luavalueidx(lua_State* L = nullptr, int idx = 0) : L_(L), idx_(idx) {}
+  std::string dir_;
+  size_t      hits_   = 0;
+  size_t      misses_ = 0;
+  size_t      writes_ = 0;
+
+  // Whether the cache file is valid for the source, return the bytecode.
+  static bool check(const file_view& c,
+                    const char*      fname,
+                    const header&    expected,
+                    const char**     bytecode) {
+    if (c.size() < sizeof(header)) return false;
+    header h;
+    std::memcpy(&h, c.data(), sizeof(header));
+    if (std::memcmp(h.magic, expected.magic, sizeof(h.magic)) != 0 ||
+        h.lua_version != expected.lua_version ||
+        h.path_size != expected.path_size ||
+        h.mtime_sec != expected.mtime_sec ||
+        h.mtime_nsec != expected.mtime_nsec ||
+        h.source_size != expected.source_size ||
+        h.source_hash != expected.source_hash) {
+      return false;
+    }
+    if (c.size() != sizeof(header) + h.path_size + h.bytecode_size) {
+      return false;
+    }
+    const char* path = c.data() + sizeof(header);
+    if (std::memcmp(path, fname, h.path_size) != 0) return false;
+    *bytecode = path + h.path_size;
+    return fnv1a64(*bytecode, h.bytecode_size) == h.bytecode_hash;
+  }
 
-    lua_State* L() const { return L_; }
+  static int writer(lua_State*, const void* p, size_t sz, void* ud) {
+    static_cast<std::string*>(ud)->append(static_cast<const char*>(p), sz);
+    return 0;
+  }
 
-    int idx() const { return idx_; }
+  bool write(const std::string& cpath,
+             header             h,
+             const char*        fname,
+             const std::string& bytecode) {
+    h.bytecode_size = bytecode.size();
+    h.bytecode_hash = fnv1a64(bytecode.data(), bytecode.size());
+    // Write to a temporary file then rename, so readers never see a partial
+    // cache file. The name is unique among processes by pid and among threads
+    // by a process-wide sequence number.
+    static std::atomic<uint64_t> seq{0};
+    std::string                  tmp = cpath + ".tmp";
+#if PEACALM_LUAW_USE_MMAP
+    tmp += std::to_string(::getpid());
+    tmp += '.';
+#endif
+    tmp += std::to_string(seq.fetch_add(1, std::memory_order_relaxed));
+    {
+      std::ofstream f(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+      if (!f) return false;
+      f.write(reinterpret_cast<const char*>(&h), sizeof(header));
+      f.write(fname, h.path_size);
+      f.write(bytecode.data(), bytecode.size());
+      if (!f) {
+        f.close();
+        std::remove(tmp.c_str());
+        return false;
+      }
+    }
+#if !PEACALM_LUAW_USE_MMAP
+    std::remove(cpath.c_str());
+#endif
+    if (std::rename(tmp.c_str(), cpath.c_str()) != 0) {
+      std::remove(tmp.c_str());
+      return false;
+    }
+    ++writes_;
+    return true;
+  }
 
-    bool valid() const {
-      return L_ && std::abs(idx_) >= 1 && std::abs(idx_) <= lua_gettop(L_);
+public:
+  explicit bytecode_cache(std::string dir) : dir_(std::move(dir)) {}
+
+  const std::string& dir() const { return dir_; }
+  size_t             hits() const { return hits_; }
+  size_t             misses() const { return misses_; }
+  size_t             writes() const { return writes_; }
+
+  // Path of the cache file for the given script file.
+  std::string cache_file(const char* fname) const {
+    char buf[17];
+    snprintf(buf,
+             sizeof(buf),
+             "%016llx",
+             static_cast<unsigned long long>(fnv1a64(fname, strlen(fname))));
+    return dir_ + "/" + buf + ".luac";
+  }
+
+  // Load a script file as a function on top of stack, just like
+  // luaL_loadfile.
+  int load(lua_State* L, const char* fname) {
+    file_view src(fname);
+    // Let luaL_loadfile report the error.
+    if (!src.ok()) return luaL_loadfile(L, fname);
+
+    header h;
+    std::memset(&h, 0, sizeof(header));
+    std::memcpy(h.magic, magic(), sizeof(h.magic));
+    h.lua_version = lua_version();
+    h.path_size   = static_cast<uint32_t>(strlen(fname));
+    h.mtime_sec   = src.mtime_sec();
+    h.mtime_nsec  = src.mtime_nsec();
+    h.source_size = src.size();
+    h.source_hash = fnv1a64(src.data(), src.size());
+
+    std::string chunkname = std::string("@") + fname;
+    std::string cpath     = cache_file(fname);
+    {
+      file_view   c(cpath.c_str());
+      const char* bytecode = nullptr;
+      if (c.ok() && check(c, fname, h, &bytecode)) {
+        header ch;
+        std::memcpy(&ch, c.data(), sizeof(header));
+        if (luaL_loadbufferx(L,
+                             bytecode,
+                             static_cast<size_t>(ch.bytecode_size),
+                             chunkname.c_str(),
+                             "b") == LUA_OK) {
+          ++hits_;
+          return LUA_OK;
+        }
+        lua_pop(L, 1);
+      }
+    }
+    ++misses_;
+
+    // Compile the content already read, skip the optional UTF-8 BOM and the
+    // first line if it starts with '#', just like luaL_loadfile does.
+    const char* p = src.data();
+    const char* e = p + src.size();
+    if (e - p >= 3 && std::memcmp(p, "\xEF\xBB\xBF", 3) == 0) p += 3;
+    if (p < e && *p == '#') {
+      // Keep the line break to keep line numbers.
+      while (p < e && *p != '\n') ++p;
+      if (e - p >= 2 && p[1] == LUA_SIGNATURE[0]) ++p;
     }
+    if (p < e && *p == LUA_SIGNATURE[0]) {
+      // Precompiled file, needn't cache.
+      return luaL_loadfile(L, fname);
+    }
+    int retcode = luaL_loadbufferx(
+        L, p, static_cast<size_t>(e - p), chunkname.c_str(), "t");
+    if (retcode != LUA_OK) return retcode;
+    std::string bytecode;
+    if (lua_dump(L, writer, &bytecode, 0) == 0) {
+      write(cpath, h, fname, bytecode);
+    }
+    return LUA_OK;
+  }
+};
 
-    lua_State* main_thread() const { return luaw::get_main_thread_of(L_); }
+// Native evaluator for pure arithmetic Lua expressions.
+//
+// It recognizes a subset of Lua expressions: numerals, true/false/nil,
+// variables, parentheses, arithmetic (+ - * / // % ^ unary -), comparisons
+// (== ~= < <= > >=), logical operators (and/or/not) and the extended function
+// IF, and compiles them into a tape of instructions for a small stack machine.
+// Results follow exactly Lua 5.4's semantics, including integer/float
+// subtypes, integer wrap around and mixed integer/float comparisons.
+namespace native {
+
+using lua_unsigned_t = std::make_unsigned_t<lua_Integer>;
+
+struct value {
+  enum type_t : char { nil, boolean, integer, number };
+
+  type_t type = nil;
+  union {
+    bool        b;
+    lua_Integer i;
+    lua_Number  n;
   };
 
-  /// Make a luavalueidx to represent the value at given index.
-  luavalueidx make_luavalueidx(int idx) const { return luavalueidx(L_, idx); }
+  value() : i(0) {}
 
-  /// A reference of some Lua value in LUA_REGISTRYINDEX.
-  class luavalueref {
-    lua_State*                 L_;
-    std::shared_ptr<const int> ref_sptr_;
+  static value make_bool(bool v) {
+    value ret;
+    ret.type = boolean;
+    ret.b    = v;
+    return ret;
+  }
+  static value make_integer(lua_Integer v) {
+    value ret;
+    ret.type = integer;
+    ret.i    = v;
+    return ret;
+  }
+  static value make_number(lua_Number v) {
+    value ret;
+    ret.type = number;
+    ret.n    = v;
+    return ret;
+  }
 
-  public:
-    /// Make a reference of the value at index "idx" in the stack "L".
-    luavalueref(lua_State* L = nullptr, int idx = -1) : L_(L) {
-      if (L && std::abs(idx) >= 1 && std::abs(idx) <= lua_gettop(L)) {
-        lua_pushvalue(L, idx);  // make a copy
-        // pops the value on top and returns its ref_id.
-        const int ref_id = luaL_ref(L, LUA_REGISTRYINDEX);
-        ref_sptr_.reset(new int(ref_id), [L](const int* p) {
-          luaL_unref(L, LUA_REGISTRYINDEX, *p);  // release the ref_id
-          delete p;
-        });
-      }
+  bool is_number() const { return type == integer || type == number; }
+  bool truthy() const { return !(type == nil || (type == boolean && !b)); }
+  lua_Number to_number() const {
+    return type == integer ? static_cast<lua_Number>(i) : n;
+  }
+
+  /// Read a value from Lua stack. Return false if it's not nil, boolean or
+  /// number.
+  bool from_lua(lua_State* L, int idx) {
+    switch (lua_type(L, idx)) {
+      case LUA_TNIL:
+        type = nil;
+        return true;
+      case LUA_TBOOLEAN:
+        *this = make_bool(lua_toboolean(L, idx));
+        return true;
+      case LUA_TNUMBER:
+        if (lua_isinteger(L, idx)) {
+          *this = make_integer(lua_tointeger(L, idx));
+        } else {
+          *this = make_number(lua_tonumber(L, idx));
+        }
+        return true;
+      default:
+        return false;
     }
+  }
 
-    lua_State* L() const { return L_; }
+  void push(lua_State* L) const {
+    switch (type) {
+      case nil: lua_pushnil(L); break;
+      case boolean: lua_pushboolean(L, b); break;
+      case integer: lua_pushinteger(L, i); break;
+      case number: lua_pushnumber(L, n); break;
+    }
+  }
+};
 
-    int ref_id() const { return ref_sptr_ ? *ref_sptr_ : LUA_NOREF; }
+enum opcode : unsigned char {
+  op_const,  // push consts[arg]
+  op_var,    // push value of variable slot arg
+  op_neg,
+  op_not,
+  op_add,
+  op_sub,
+  op_mul,
+  op_div,
+  op_mod,
+  op_pow,
+  op_idiv,
+  op_eq,
+  op_ne,
+  op_lt,
+  op_le,
+  op_gt,
+  op_ge,
+  op_and,  // if top is false jump to arg, else pop
+  op_or,   // if top is true jump to arg, else pop
+  op_if    // IF with arg arguments
+};
 
-    bool valid() const { return L_ && ref_sptr_ && *ref_sptr_ != LUA_NOREF; }
+struct instruction {
+  opcode op;
+  int    arg;
+};
 
-    bool as_nil() const { return !valid() || (ref_id() == LUA_REFNIL); }
+//////////////////////// Lua 5.4 number semantics //////////////////////////////
 
-    lua_State* main_thread() const { return luaw::get_main_thread_of(L_); }
+inline lua_Integer intop_add(lua_Integer a, lua_Integer b) {
+  return static_cast<lua_Integer>(static_cast<lua_unsigned_t>(a) +
+                                  static_cast<lua_unsigned_t>(b));
+}
+inline lua_Integer intop_sub(lua_Integer a, lua_Integer b) {
+  return static_cast<lua_Integer>(static_cast<lua_unsigned_t>(a) -
+                                  static_cast<lua_unsigned_t>(b));
+}
+inline lua_Integer intop_mul(lua_Integer a, lua_Integer b) {
+  return static_cast<lua_Integer>(static_cast<lua_unsigned_t>(a) *
+                                  static_cast<lua_unsigned_t>(b));
+}
 
-    void unref() { ref_sptr_.reset(); }
+// Same as luaV_idiv, return false if divided by zero.
+inline bool int_idiv(lua_Integer m, lua_Integer n, lua_Integer& ret) {
+  if (static_cast<lua_unsigned_t>(n) + 1u <= 1u) {  // -1 or 0
+    if (n == 0) return false;
+    ret = intop_sub(0, m);  // avoid overflow with 0x80000...//-1
+    return true;
+  }
+  ret = m / n;
+  if ((m ^ n) < 0 && m % n != 0) ret -= 1;
+  return true;
+}
 
-    /// Set the referenced value to a global variable with given name.
-    /// Equivalent to luaw::set(name, this luavalueref).
-    void setglobal(const char* name) const {
-      PEACALM_LUAW_ASSERT(name);
-      lua_rawgeti(L_, LUA_REGISTRYINDEX, ref_id());
-      lua_setglobal(L_, name);
-    }
+// Same as luaV_mod, return false if divided by zero.
+inline bool int_mod(lua_Integer m, lua_Integer n, lua_Integer& ret) {
+  if (static_cast<lua_unsigned_t>(n) + 1u <= 1u) {  // -1 or 0
+    if (n == 0) return false;
+    ret = 0;  // avoid overflow with 0x80000...%-1
+    return true;
+  }
+  ret = m % n;
+  if (ret != 0 && (ret ^ n) < 0) ret += n;
+  return true;
+}
 
-    /// Push the value referenced on top of this stack.
-    void pushvalue() const {
-      PEACALM_LUAW_ASSERT(L_);
-      lua_rawgeti(L_, LUA_REGISTRYINDEX, ref_id());
-    }
+// Same as luai_nummod.
+inline lua_Number num_mod(lua_Number a, lua_Number b) {
+  lua_Number m = std::fmod(a, b);
+  if ((m > 0) ? b < 0 : (m < 0 && b != m)) m += b;
+  return m;
+}
 
-    void pop(int n = 1) { lua_pop(L_, n); }
-    int  gettop() const { return lua_gettop(L_); }
-    void settop(int idx) { lua_settop(L_, idx); }
-    void cleartop() { settop(0); }
-  };
+// Same as luai_numidiv.
+inline lua_Number num_idiv(lua_Number a, lua_Number b) {
+  return std::floor(a / b);
+}
 
-  /// Make a reference for the value at given index.
-  luavalueref make_luavalueref(int idx = -1) const {
-    return luavalueref(L_, idx);
-  }
+// Same as luai_numpow.
+inline lua_Number num_pow(lua_Number a, lua_Number b) {
+  return b == 2 ? a * a : std::pow(a, b);
+}
 
-  /// Stack balance guarder.
-  /// Automatically set stack to a specific size when destruct.
-  class guarder {
-    lua_State* L_;
-    int        topsz_;
+// Whether an integer fits in a float without loss, like l_intfitsf.
+inline bool int_fits_float(lua_Integer i) {
+  constexpr int nbm = std::numeric_limits<lua_Number>::digits;
+  constexpr int nbi = std::numeric_limits<lua_unsigned_t>::digits;
+  if (nbm >= nbi) return true;
+  const lua_unsigned_t maxfits = lua_unsigned_t(1) << (nbm < nbi ? nbm : 0);
+  return static_cast<lua_unsigned_t>(i) + maxfits <= 2 * maxfits;
+}
 
-  public:
-    guarder(lua_State* L, int topsz) : L_(L), topsz_(topsz) {}
-    ~guarder() { lua_settop(L_, topsz_); }
-  };
+enum f2i_mode { f2i_eq, f2i_floor, f2i_ceil };
 
-  guarder make_guarder() const { return guarder(L_, gettop()); }
-  guarder make_guarder(int sz) const { return guarder(L_, sz); }
-  guarder make_guarder(lua_State* L, int sz) const { return guarder(L, sz); }
+// Float to integer, like luaV_flttointns.
+inline bool float_to_int(lua_Number n, lua_Integer& ret, f2i_mode mode) {
+  lua_Number f = std::floor(n);
+  if (n != f) {
+    if (mode == f2i_eq) return false;
+    if (mode == f2i_ceil) f += 1;
+  }
+  return lua_numbertointeger(f, &ret);
+}
 
-  /// Initialization options for luaw.
-  class opt {
-    enum libopt : char { ignore = 0, load = 1, preload = 2 };
+inline bool lt_int_float(lua_Integer i, lua_Number f) {
+  if (int_fits_float(i)) return static_cast<lua_Number>(i) < f;
+  lua_Integer fi;
+  if (float_to_int(f, fi, f2i_ceil)) return i < fi;
+  return f > 0;
+}
 
-  public:
-    opt() {}
+inline bool le_int_float(lua_Integer i, lua_Number f) {
+  if (int_fits_float(i)) return static_cast<lua_Number>(i) <= f;
+  lua_Integer fi;
+  if (float_to_int(f, fi, f2i_floor)) return i <= fi;
+  return f > 0;
+}
 
-    /// Ignore all standard libs.
-    opt& ignore_libs() {
-      libopt_ = ignore;
-      return *this;
-    }
-    /// Load all standard libs.
-    opt& load_libs() {
-      libopt_ = load;
-      return *this;
-    }
-    /// Preload all standard libs.
-    opt& preload_libs() {
-      libopt_ = preload;
-      return *this;
-    }
-
-    /// Register extended functions.
-    opt& register_exfunctions(bool r) {
-      exfunc_ = r;
-      return *this;
-    }
-
-    /// Use already existed lua_State.
-    opt& use_state(lua_State* L) {
-      PEACALM_LUAW_ASSERT(L);
-      L_ = L;
-      return *this;
-    }
-
-    /// Load user specified libs.
-    opt& custom_load(const std::vector<luaL_Reg>& l) {
-      libs_load_ = l;
-      return *this;
-    }
-    opt& custom_load(std::vector<luaL_Reg>&& l) {
-      libs_load_ = std::move(l);
-      return *this;
-    }
+inline bool lt_float_int(lua_Number f, lua_Integer i) {
+  if (int_fits_float(i)) return f < static_cast<lua_Number>(i);
+  lua_Integer fi;
+  if (float_to_int(f, fi, f2i_floor)) return fi < i;
+  return f < 0;
+}
 
-    /// Preload user specified libs.
-    opt& custom_preload(const std::vector<luaL_Reg>& l) {
-      libs_preload_ = l;
-      return *this;
-    }
-    opt& custom_preload(std::vector<luaL_Reg>&& l) {
-      libs_preload_ = std::move(l);
-      return *this;
-    }
+inline bool le_float_int(lua_Number f, lua_Integer i) {
+  if (int_fits_float(i)) return f <= static_cast<lua_Number>(i);
+  lua_Integer fi;
+  if (float_to_int(f, fi, f2i_ceil)) return fi <= i;
+  return f < 0;
+}
 
-  private:
-    libopt                libopt_ = load;
-    bool                  exfunc_ = true;
-    lua_State*            L_      = nullptr;
-    std::vector<luaL_Reg> libs_load_;
-    std::vector<luaL_Reg> libs_preload_;
-    friend class luaw;
-  };
+// Raw equality, like luaV_rawequalobj.
+inline bool equal(const value& a, const value& b) {
+  if (a.type != b.type) {
+    if (!a.is_number() || !b.is_number()) return false;
+    lua_Integer i1, i2;
+    return (a.type == value::integer ? (i1 = a.i, true)
+                                     : float_to_int(a.n, i1, f2i_eq)) &&
+           (b.type == value::integer ? (i2 = b.i, true)
+                                     : float_to_int(b.n, i2, f2i_eq)) &&
+           i1 == i2;
+  }
+  switch (a.type) {
+    case value::nil: return true;
+    case value::boolean: return a.b == b.b;
+    case value::integer: return a.i == b.i;
+    default: return a.n == b.n;
+  }
+}
 
-  // Default constructor
-  luaw(const opt& o = opt{}) { init(o); }
+// Return false if not comparable.
+inline bool less_than(const value& a, const value& b, bool& ret) {
+  if (!a.is_number() || !b.is_number()) return false;
+  if (a.type == value::integer) {
+    ret = b.type == value::integer ? a.i < b.i : lt_int_float(a.i, b.n);
+  } else {
+    ret = b.type == value::number ? a.n < b.n : lt_float_int(a.n, b.i);
+  }
+  return true;
+}
 
-  luaw(lua_State* L) : L_(L) {}
+// Return false if not comparable.
+inline bool less_equal(const value& a, const value& b, bool& ret) {
+  if (!a.is_number() || !b.is_number()) return false;
+  if (a.type == value::integer) {
+    ret = b.type == value::integer ? a.i <= b.i : le_int_float(a.i, b.n);
+  } else {
+    ret = b.type == value::number ? a.n <= b.n : le_float_int(a.n, b.i);
+  }
+  return true;
+}
 
-  // Not copyable
-  luaw(const luaw&) = delete;
+// Binary operation, return false if raises an error in Lua.
+inline bool binary(opcode op, const value& a, const value& b, value& ret) {
+  bool c;
+  switch (op) {
+    case op_eq: ret = value::make_bool(equal(a, b)); return true;
+    case op_ne: ret = value::make_bool(!equal(a, b)); return true;
+    case op_lt:
+      if (!less_than(a, b, c)) return false;
+      ret = value::make_bool(c);
+      return true;
+    case op_le:
+      if (!less_equal(a, b, c)) return false;
+      ret = value::make_bool(c);
+      return true;
+    case op_gt:
+      if (!less_than(b, a, c)) return false;
+      ret = value::make_bool(c);
+      return true;
+    case op_ge:
+      if (!less_equal(b, a, c)) return false;
+      ret = value::make_bool(c);
+      return true;
+    default: break;
+  }
+  if (!a.is_number() || !b.is_number()) return false;
+  const bool ints = a.type == value::integer && b.type == value::integer;
+  lua_Integer i;
+  switch (op) {
+    case op_add:
+      ret = ints ? value::make_integer(intop_add(a.i, b.i))
+                 : value::make_number(a.to_number() + b.to_number());
+      return true;
+    case op_sub:
+      ret = ints ? value::make_integer(intop_sub(a.i, b.i))
+                 : value::make_number(a.to_number() - b.to_number());
+      return true;
+    case op_mul:
+      ret = ints ? value::make_integer(intop_mul(a.i, b.i))
+                 : value::make_number(a.to_number() * b.to_number());
+      return true;
+    case op_div:
+      ret = value::make_number(a.to_number() / b.to_number());
+      return true;
+    case op_pow:
+      ret = value::make_number(num_pow(a.to_number(), b.to_number()));
+      return true;
+    case op_idiv:
+      if (!ints) {
+        ret = value::make_number(num_idiv(a.to_number(), b.to_number()));
+        return true;
+      }
+      if (!int_idiv(a.i, b.i, i)) return false;
+      ret = value::make_integer(i);
+      return true;
+    case op_mod:
+      if (!ints) {
+        ret = value::make_number(num_mod(a.to_number(), b.to_number()));
+        return true;
+      }
+      if (!int_mod(a.i, b.i, i)) return false;
+      ret = value::make_integer(i);
+      return true;
+    default: return false;
+  }
+}
 
-  // Movable
-  luaw(luaw&& l) : L_(l.release()) {}
+//////////////////////// tape //////////////////////////////////////////////////
 
-  luaw& operator=(const luaw&) = delete;
+// Compiled instructions of an expression.
+struct tape {
+  std::vector<instruction> code;
+  std::vector<value>       consts;
+  std::vector<std::string> names;  // names of variable slots
+  int                      max_stack = 0;
+  bool                     uses_if   = false;  // the extended function IF
 
-  luaw& operator=(luaw&& r) {
-    if (this == &r) {
-      // do nothing
-    } else if (L_ == r.L()) {
-      r.L(nullptr);
-    } else {
-      close();
-      L(r.release());
+  /**
+   * @brief Run the instructions.
+   *
+   * @param [in] fetch Callable as bool(int slot, value& v) to get value of a
+   * variable slot, return false to abort.
+   * @param [in] stack Working space, whose size is at least max_stack.
+   * @param [out] result The result.
+   * @return False if fetch failed or it would raise an error in Lua.
+   */
+  template <typename Fetch>
+  bool run(Fetch&& fetch, value* stack, value& result) const {
+    value*       top = stack;  // next free position
+    const size_t n   = code.size();
+    for (size_t pc = 0; pc < n; ++pc) {
+      const instruction& ins = code[pc];
+      switch (ins.op) {
+        case op_const: *top++ = consts[ins.arg]; break;
+        case op_var:
+          if (!fetch(ins.arg, *top)) return false;
+          ++top;
+          break;
+        case op_neg: {
+          value& v = top[-1];
+          if (v.type == value::integer) {
+            v.i = intop_sub(0, v.i);
+          } else if (v.type == value::number) {
+            v.n = -v.n;
+          } else {
+            return false;
+          }
+          break;
+        }
+        case op_not: top[-1] = value::make_bool(!top[-1].truthy()); break;
+        case op_and:
+          if (!top[-1].truthy()) {
+            pc = static_cast<size_t>(ins.arg) - 1;
+          } else {
+            --top;
+          }
+          break;
+        case op_or:
+          if (top[-1].truthy()) {
+            pc = static_cast<size_t>(ins.arg) - 1;
+          } else {
+            --top;
+          }
+          break;
+        case op_if: {
+          value* args = top - ins.arg;
+          value* r    = top - 1;
+          for (int i = 0; i + 1 < ins.arg; i += 2) {
+            if (args[i].truthy()) {
+              r = args + i + 1;
+              break;
+            }
+          }
+          *args = *r;
+          top   = args + 1;
+          break;
+        }
+        default: {
+          --top;
+          value v;
+          if (!binary(ins.op, top[-1], *top, v)) return false;
+          top[-1] = v;
+        }
+      }
     }
-    return *this;
+    result = stack[0];
+    return true;
   }
+};
 
-  ~luaw() { close(); }
-
-  void init(const opt& o = opt{}) {
-    // Initialize lua_State
-    if (o.L_) {
-      L_ = o.L_;
-    } else {
-      L_ = luaL_newstate();
-    }
+//////////////////////// parser ////////////////////////////////////////////////
 
-    // Initialize standard libs
-    if (o.libopt_ == opt::libopt::load) {
-      // Load all libs, which is costly
-      luaL_openlibs(L_);
-    } else if (o.libopt_ == opt::libopt::preload) {
-      // Preload all libs, which is light
-      preload_libs();
-    }
+// Compile an expression like "return a + b * 2" to a tape.
+class parser {
+  enum token_t { tk_eof, tk_name, tk_number, tk_op, tk_error };
 
-    // Register extended functions
-    if (o.exfunc_) { register_exfunctions(); }
+  struct binop {
+    opcode op;
+    int    left, right;  // priority
+  };
 
-    // Load user specified libs
-    if (!o.libs_load_.empty()) {
-      for (const luaL_Reg& l : o.libs_load_) {
-        luaL_requiref(L_, l.name, l.func, 1);
-        pop();
+  static constexpr int unary_priority = 12;
+  static constexpr int max_level      = 200;  // like LUAI_MAXCCALLS
+
+  lua_State*  L_;
+  const char* p_;
+  const char* end_;
+  tape        tape_;
+  int         depth_ = 0;  // current stack depth when running the tape
+  int         level_ = 0;  // nesting level of subexpr
+
+  token_t     tk_ = tk_eof;
+  std::string tk_str_;
+  value       tk_value_;
+
+  static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' ||
+           c == '\v';
+  }
+  static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+  static bool is_alpha(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+  }
+  static bool is_alnum(char c) { return is_alpha(c) || is_digit(c); }
+  static bool is_xdigit(char c) {
+    return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+  }
+
+  static bool is_reserved(const std::string& s) {
+    static const std::unordered_set<std::string> words{
+        "and",   "break", "do",     "else", "elseif", "end",
+        "false", "for",   "function", "goto", "if",   "in",
+        "local", "nil",   "not",    "or",   "repeat", "return",
+        "then",  "true",  "until",  "while"};
+    return words.count(s) > 0;
+  }
+
+  void next() {
+    for (;;) {
+      while (p_ < end_ && is_space(*p_)) ++p_;
+      if (end_ - p_ >= 2 && p_[0] == '-' && p_[1] == '-') {
+        // Long comments are not supported.
+        if (end_ - p_ >= 3 && p_[2] == '[') {
+          tk_ = tk_error;
+          return;
+        }
+        while (p_ < end_ && *p_ != '\n' && *p_ != '\r') ++p_;
+        continue;
       }
+      break;
     }
-
-    // Preload user specified libs
-    if (!o.libs_preload_.empty()) {
-      // Should load base and package first for any preload.
-      luaL_requiref(L_, LUA_GNAME, luaopen_base, 1);
-      luaL_requiref(L_, LUA_LOADLIBNAME, luaopen_package, 1);
-      getfield(-1, "preload");
-      for (const luaL_Reg& l : o.libs_preload_) {
-        pushcfunction(l.func);
-        setfield(-2, l.name);
+    tk_str_.clear();
+    if (p_ >= end_) {
+      tk_ = tk_eof;
+      return;
+    }
+    const char c = *p_;
+    if (is_alpha(c)) {
+      while (p_ < end_ && is_alnum(*p_)) tk_str_ += *p_++;
+      tk_ = tk_name;
+      return;
+    }
+    if (is_digit(c) || (c == '.' && end_ - p_ >= 2 && is_digit(p_[1]))) {
+      read_numeral();
+      return;
+    }
+    static const char* const ops[] = {"//", "==", "~=", "<=", ">=", "+",
+                                      "-",  "*",  "/",  "%",  "^",  "<",
+                                      ">",  "(",  ")",  ",",  ";"};
+    for (const char* op : ops) {
+      size_t len = strlen(op);
+      if (static_cast<size_t>(end_ - p_) >= len &&
+          std::memcmp(p_, op, len) == 0) {
+        // Exclude ".." and bitwise operators "<<", ">>", "~".
+        if (len == 1 && (c == '<' || c == '>') && end_ - p_ >= 2 &&
+            p_[1] == c) {
+          break;
+        }
+        tk_str_.assign(op, len);
+        p_ += len;
+        tk_ = tk_op;
+        return;
       }
-      pop(3);
     }
+    tk_ = tk_error;
   }
 
-  void close() {
-    if (L_) {
-      lua_close(L_);
-      L_ = nullptr;
+  // Same as Lua's lexer.
+  void read_numeral() {
+    const char* expo = "Ee";
+    if (*p_ == '0' && end_ - p_ >= 2 && (p_[1] == 'x' || p_[1] == 'X')) {
+      expo = "Pp";
+      tk_str_ += *p_++;
+      tk_str_ += *p_++;
+    }
+    while (p_ < end_) {
+      if (*p_ == expo[0] || *p_ == expo[1]) {
+        tk_str_ += *p_++;
+        if (p_ < end_ && (*p_ == '+' || *p_ == '-')) tk_str_ += *p_++;
+      } else if (is_xdigit(*p_) || *p_ == '.') {
+        tk_str_ += *p_++;
+      } else {
+        break;
+      }
+    }
+    if (p_ < end_ && is_alnum(*p_)) {
+      tk_ = tk_error;
+      return;
+    }
+    if (lua_stringtonumber(L_, tk_str_.c_str()) == 0) {
+      tk_ = tk_error;
+      return;
     }
+    tk_value_.from_lua(L_, -1);
+    lua_pop(L_, 1);
+    tk_ = tk_number;
   }
 
-  void reset(const opt& o = opt{}) {
-    close();
-    init(o);
+  bool test_op(const char* op) const { return tk_ == tk_op && tk_str_ == op; }
+  bool test_name(const char* name) const {
+    return tk_ == tk_name && tk_str_ == name;
   }
 
-  void preload_libs() {
-    // Should load base and package first for any preload.
-    luaL_requiref(L_, LUA_GNAME, luaopen_base, 1);
-    luaL_requiref(L_, LUA_LOADLIBNAME, luaopen_package, 1);
-    getfield(-1, "preload");
-    static const luaL_Reg preloadlibs[] = {{LUA_COLIBNAME, luaopen_coroutine},
-                                           {LUA_TABLIBNAME, luaopen_table},
-                                           {LUA_IOLIBNAME, luaopen_io},
-                                           {LUA_OSLIBNAME, luaopen_os},
-                                           {LUA_STRLIBNAME, luaopen_string},
-                                           {LUA_MATHLIBNAME, luaopen_math},
-                                           {LUA_UTF8LIBNAME, luaopen_utf8},
-                                           {LUA_DBLIBNAME, luaopen_debug},
-                                           {NULL, NULL}};
-    for (const luaL_Reg* p = preloadlibs; p->func; ++p) {
-      pushcfunction(p->func);
-      setfield(-2, p->name);
-    }
-    pop(3);
+  void emit(opcode op, int arg, int stack_change) {
+    tape_.code.push_back(instruction{op, arg});
+    depth_ += stack_change;
+    if (depth_ > tape_.max_stack) tape_.max_stack = depth_;
   }
 
-  /// Register a global function. Equivalent to `set(fname, f)`.
-  void register_gf(const char* fname, lua_cfunction_t f) {
-    PEACALM_LUAW_ASSERT(fname);
-    lua_register(L_, fname, f);
+  void emit_const(const value& v) {
+    tape_.consts.push_back(v);
+    emit(op_const, static_cast<int>(tape_.consts.size()) - 1, 1);
   }
 
-  /// Register extended functions.
-  void register_exfunctions() {
-    register_gf("IF", luaexf::IF);
-    register_gf("SET", luaexf::SET);
-    register_gf("COUNTER", luaexf::COUNTER);
-    register_gf("COUNTER0", luaexf::COUNTER0);
+  void emit_var(const std::string& name) {
+    auto& names = tape_.names;
+    auto  it    = std::find(names.begin(), names.end(), name);
+    if (it == names.end()) it = names.insert(names.end(), name);
+    emit(op_var, static_cast<int>(it - names.begin()), 1);
   }
 
-  /// Release the ownership of contained Lua State.
-  /// The caller is responsible for closing the Lua State.
-  lua_State* release() {
-    lua_State* ret = L_;
-    L_             = nullptr;
-    return ret;
+  bool get_binop(binop& b) const {
+    if (tk_ == tk_name) {
+      if (tk_str_ == "or") {
+        b = {op_or, 1, 1};
+        return true;
+      }
+      if (tk_str_ == "and") {
+        b = {op_and, 2, 2};
+        return true;
+      }
+      return false;
+    }
+    if (tk_ != tk_op) return false;
+    static const std::unordered_map<std::string, binop> ops{
+        {"==", {op_eq, 3, 3}},    {"~=", {op_ne, 3, 3}},
+        {"<", {op_lt, 3, 3}},     {"<=", {op_le, 3, 3}},
+        {">", {op_gt, 3, 3}},     {">=", {op_ge, 3, 3}},
+        {"+", {op_add, 10, 10}},  {"-", {op_sub, 10, 10}},
+        {"*", {op_mul, 11, 11}},  {"/", {op_div, 11, 11}},
+        {"//", {op_idiv, 11, 11}}, {"%", {op_mod, 11, 11}},
+        {"^", {op_pow, 14, 13}}};
+    auto it = ops.find(tk_str_);
+    if (it == ops.end()) return false;
+    b = it->second;
+    return true;
+  }
+
+  // Like subexpr in Lua's parser.
+  bool subexpr(int limit) {
+    if (++level_ > max_level) return false;
+    if (test_name("not") || test_op("-")) {
+      const opcode op = tk_ == tk_name ? op_not : op_neg;
+      next();
+      if (!subexpr(unary_priority)) return false;
+      emit(op, 0, 0);
+    } else if (!simpleexp()) {
+      return false;
+    }
+    binop b;
+    while (get_binop(b) && b.left > limit) {
+      next();
+      if (b.op == op_and || b.op == op_or) {
+        const size_t jump = tape_.code.size();
+        emit(b.op, 0, -1);
+        if (!subexpr(b.right)) return false;
+        tape_.code[jump].arg = static_cast<int>(tape_.code.size());
+      } else {
+        if (!subexpr(b.right)) return false;
+        emit(b.op, 0, -1);
+      }
+    }
+    --level_;
+    return true;
   }
 
-  // Get and set lua_State.
-  lua_State* L() const { return L_; }
-  void       L(lua_State* L) { L_ = L; }
-  void       clearL() { L_ = nullptr; }
+  // Whether IF is the extended function, it could be overwritten by user.
+  bool is_native_if() {
+    lua_getglobal(L_, "IF");
+    const bool ret = lua_tocfunction(L_, -1) == luaexf::IF;
+    lua_pop(L_, 1);
+    return ret;
+  }
 
-  /// Generate a subluaw by a new thread and a ref_id to it.
-  subluaw make_subluaw();
+  bool simpleexp() {
+    if (tk_ == tk_number) {
+      emit_const(tk_value_);
+      next();
+    } else if (test_op("(")) {
+      next();
+      if (!subexpr(0) || !test_op(")")) return false;
+      next();
+    } else if (tk_ == tk_name) {
+      const std::string name = tk_str_;
+      next();
+      if (name == "true" || name == "false") {
+        emit_const(value::make_bool(name == "true"));
+      } else if (name == "nil") {
+        emit_const(value());
+      } else if (is_reserved(name)) {
+        return false;
+      } else if (test_op("(")) {
+        if (name != "IF" || !is_native_if()) return false;
+        next();
+        int nargs = 0;
+        do {
+          if (nargs > 0) next();  // skip ','
+          if (!subexpr(0)) return false;
+          ++nargs;
+        } while (test_op(","));
+        if (!test_op(")")) return false;
+        next();
+        if (nargs < 3 || nargs % 2 == 0) return false;
+        emit(op_if, nargs, 1 - nargs);
+        tape_.uses_if = true;
+      } else {
+        emit_var(name);
+      }
+    } else {
+      return false;
+    }
+    // Call, index or method call on the result is not supported.
+    return !test_op("(");
+  }
 
-  /// Convert given index to absolute index of stack. It won't change idx's
-  /// value if abs(idx) > topsize, this is different with lua_absindex.
-  /// e.g. abs_index(LUA_REGISTRYINDEX) -> LUA_REGISTRYINDEX.
-  int abs_index(int idx) {
-    return idx < 0 && -idx <= gettop() ? gettop() + idx + 1 : idx;
+public:
+  parser(lua_State* L, const char* expr, size_t len)
+      : L_(L), p_(expr), end_(expr + len) {}
+
+  /// Return nullptr if the expression is not supported.
+  std::shared_ptr<const tape> parse() {
+    next();
+    if (!test_name("return")) return nullptr;
+    next();
+    if (!subexpr(0)) return nullptr;
+    if (test_op(";")) next();
+    if (tk_ != tk_eof) return nullptr;
+    PEACALM_LUAW_ASSERT(depth_ == 1);
+    return std::make_shared<tape>(std::move(tape_));
   }
+};
 
-  // Stack operations
-  void pop(int n = 1) { lua_pop(L_, n); }
-  int  gettop() const { return lua_gettop(L_); }
-  void settop(int idx) { lua_settop(L_, idx); }
-  void cleartop() { settop(0); }
 
-  /// Whether enough for at least n extra elements.
-  bool checkstack(int n) { return lua_checkstack(L_, n); }
+//////////////////////// columnar //////////////////////////////////////////////
 
-  // clang-format off
-  int loadstring(const char*        s)   { return luaL_loadstring(L_, s); }
-  int loadstring(const std::string& s)   { return loadstring(s.c_str()); }
-  int dostring(const char*        s)     { return luaL_dostring(L_, s); }
-  int dostring(const std::string& s)     { return dostring(s.c_str()); }
-  int loadfile(const char*        fname) { return luaL_loadfile(L_, fname); }
-  int loadfile(const std::string& fname) { return loadfile(fname.c_str()); }
-  int dofile(const char*        fname)   { return luaL_dofile(L_, fname); }
-  int dofile(const std::string& fname)   { return dofile(fname.c_str()); }
-  // clang-format on
+// Kernels over arrays of doubles, vectorized by AVX2 if available. Booleans
+// are represented as 1.0 and 0.0.
+namespace kernel {
 
-  // clang-format off
-  bool isstring(int idx = -1)        const { return lua_isstring(L_, idx); }
-  bool isnumber(int idx = -1)        const { return lua_isnumber(L_, idx); }
-  bool isinteger(int idx = -1)       const { return lua_isinteger(L_, idx); }
-  bool isboolean(int idx = -1)       const { return lua_isboolean(L_, idx); }
-  bool isnil(int idx = -1)           const { return lua_isnil(L_, idx); }
-  bool isnone(int idx = -1)          const { return lua_isnone(L_, idx); }
-  bool isnoneornil(int idx = -1)     const { return lua_isnoneornil(L_, idx); }
-  bool istable(int idx = -1)         const { return lua_istable(L_, idx); }
-  bool iscfunction(int idx = -1)     const { return lua_iscfunction(L_, idx); }
-  bool isfunction(int idx = -1)      const { return lua_isfunction(L_, idx); }
-  bool isuserdata(int idx = -1)      const { return lua_isuserdata(L_, idx); }
-  bool islightuserdata(int idx = -1) const { return lua_islightuserdata(L_, idx); }
-  bool isthread(int idx = -1)        const { return lua_isthread(L_, idx); }
-  // clang-format on
+struct add_op {
+  static double scalar(double x, double y) { return x + y; }
+#if PEACALM_LUAW_USE_AVX2
+  static __m256d vector(__m256d x, __m256d y) { return _mm256_add_pd(x, y); }
+#endif
+};
 
-  // clang-format off
-  bool is_type_none(int idx = -1)          const { return lua_type(L_, idx) == LUA_TNONE; }
-  bool is_type_nil(int idx = -1)           const { return lua_type(L_, idx) == LUA_TNIL; }
-  bool is_type_boolean(int idx = -1)       const { return lua_type(L_, idx) == LUA_TBOOLEAN; }
-  bool is_type_lightuserdata(int idx = -1) const { return lua_type(L_, idx) == LUA_TLIGHTUSERDATA; }
-  bool is_type_number(int idx = -1)        const { return lua_type(L_, idx) == LUA_TNUMBER; }
-  bool is_type_string(int idx = -1)        const { return lua_type(L_, idx) == LUA_TSTRING; }
-  bool is_type_table(int idx = -1)         const { return lua_type(L_, idx) == LUA_TTABLE; }
-  bool is_type_function(int idx = -1)      const { return lua_type(L_, idx) == LUA_TFUNCTION; }
-  bool is_type_userdata(int idx = -1)      const { return lua_type(L_, idx) == LUA_TUSERDATA; }
-  bool is_type_thread(int idx = -1)        const { return lua_type(L_, idx) == LUA_TTHREAD; }
-  // clang-format on
+struct sub_op {
+  static double scalar(double x, double y) { return x - y; }
+#if PEACALM_LUAW_USE_AVX2
+  static __m256d vector(__m256d x, __m256d y) { return _mm256_sub_pd(x, y); }
+#endif
+};
 
-  int         type(int idx = -1) const { return lua_type(L_, idx); }
-  const char* type_name(int idx = -1) const {
-    return lua_typename(L_, type(idx));
+struct mul_op {
+  static double scalar(double x, double y) { return x * y; }
+#if PEACALM_LUAW_USE_AVX2
+  static __m256d vector(__m256d x, __m256d y) { return _mm256_mul_pd(x, y); }
+#endif
+};
+
+struct div_op {
+  static double scalar(double x, double y) { return x / y; }
+#if PEACALM_LUAW_USE_AVX2
+  static __m256d vector(__m256d x, __m256d y) { return _mm256_div_pd(x, y); }
+#endif
+};
+
+struct idiv_op {
+  static double scalar(double x, double y) { return num_idiv(x, y); }
+#if PEACALM_LUAW_USE_AVX2
+  static __m256d vector(__m256d x, __m256d y) {
+    return _mm256_floor_pd(_mm256_div_pd(x, y));
   }
+#endif
+};
 
-  // getxxx: return the type of the value pushed.
-  int gettable(int idx) { return lua_gettable(L_, idx); }
-  int geti(int idx, lua_integer_t n) { return lua_geti(L_, idx, n); }
-  int getp(int idx, const void* p) {
-    pushlightuserdata(p);
-    return gettable(idx);
+// No SIMD version, to get exactly the same results as Lua.
+struct pow_op {
+  static double scalar(double x, double y) { return num_pow(x, y); }
+};
+
+// No SIMD version, to get exactly the same results as Lua.
+struct mod_op {
+  static double scalar(double x, double y) { return num_mod(x, y); }
+};
+
+#if PEACALM_LUAW_USE_AVX2
+#define PEACALM_LUAW_CMP_OP(name, cmp, pred)                           \
+  struct name {                                                        \
+    static double scalar(double x, double y) { return x cmp y; }       \
+    static __m256d vector(__m256d x, __m256d y) {                      \
+      return _mm256_and_pd(_mm256_cmp_pd(x, y, pred),                  \
+                           _mm256_set1_pd(1.0));                       \
+    }                                                                  \
+  };
+#else
+#define PEACALM_LUAW_CMP_OP(name, cmp, pred)                     \
+  struct name {                                                  \
+    static double scalar(double x, double y) { return x cmp y; } \
+  };
+#endif
+
+PEACALM_LUAW_CMP_OP(lt_op, <, _CMP_LT_OQ)
+PEACALM_LUAW_CMP_OP(le_op, <=, _CMP_LE_OQ)
+PEACALM_LUAW_CMP_OP(eq_op, ==, _CMP_EQ_OQ)
+PEACALM_LUAW_CMP_OP(ne_op, !=, _CMP_NEQ_UQ)
+
+#undef PEACALM_LUAW_CMP_OP
+
+template <typename Op>
+void binary(double* d, const double* a, const double* b, size_t n) {
+  size_t i = 0;
+#if PEACALM_LUAW_USE_AVX2
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(
+        d + i, Op::vector(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
   }
-  int getfield(int idx, const char* k) {
-    PEACALM_LUAW_ASSERT(k);
-    return lua_getfield(L_, idx, k);
+#endif
+  for (; i < n; ++i) d[i] = Op::scalar(a[i], b[i]);
+}
+
+template <typename Op>
+void binary_scalar(double* d, const double* a, const double* b, size_t n) {
+  for (size_t i = 0; i < n; ++i) d[i] = Op::scalar(a[i], b[i]);
+}
+
+inline void neg(double* d, const double* a, size_t n) {
+  size_t i = 0;
+#if PEACALM_LUAW_USE_AVX2
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(d + i, _mm256_xor_pd(_mm256_loadu_pd(a + i), sign));
   }
+#endif
+  for (; i < n; ++i) d[i] = -a[i];
+}
 
-  void settable(int idx) { lua_settable(L_, idx); }
-  void seti(int idx, lua_integer_t n) { lua_seti(L_, idx, n); }
-  void setp(int idx, const void* p) {
-    int aidx = abs(idx);
-    pushlightuserdata(p);
-    pushvalue(-2);
-    settable(aidx);
-    pop();
+inline void logical_not(double* d, const double* a, size_t n) {
+  size_t i = 0;
+#if PEACALM_LUAW_USE_AVX2
+  const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1.0);
+  for (; i + 4 <= n; i += 4) {
+    __m256d m = _mm256_cmp_pd(_mm256_loadu_pd(a + i), zero, _CMP_EQ_OQ);
+    _mm256_storeu_pd(d + i, _mm256_and_pd(m, one));
   }
-  void setfield(int idx, const char* k) {
-    PEACALM_LUAW_ASSERT(k);
-    lua_setfield(L_, idx, k);
+#endif
+  for (; i < n; ++i) d[i] = a[i] == 0;
+}
+
+// d = c ? x : y
+inline void select(double*       d,
+                   const double* c,
+                   const double* x,
+                   const double* y,
+                   size_t        n) {
+  size_t i = 0;
+#if PEACALM_LUAW_USE_AVX2
+  const __m256d zero = _mm256_setzero_pd();
+  for (; i + 4 <= n; i += 4) {
+    __m256d m = _mm256_cmp_pd(_mm256_loadu_pd(c + i), zero, _CMP_NEQ_UQ);
+    _mm256_storeu_pd(
+        d + i,
+        _mm256_blendv_pd(_mm256_loadu_pd(y + i), _mm256_loadu_pd(x + i), m));
   }
+#endif
+  for (; i < n; ++i) d[i] = c[i] != 0 ? x[i] : y[i];
+}
 
-  int rawget(int idx) { return lua_rawget(L_, idx); }
-  int rawgeti(int idx, lua_integer_t n) { return lua_rawgeti(L_, idx, n); }
-  int rawgetp(int idx, const void* p) { return lua_rawgetp(L_, idx, p); }
-  int rawgetfield(int idx, const char* k) {
-    pushstring(k);
-    return rawget(idx);
+}  // namespace kernel
+
+// Operand of instructions of columnar.
+struct operand {
+  enum kind_t : char { reg, column, constant };
+  kind_t kind  = constant;
+  int    index = 0;
+};
+
+// Evaluate a tape over columns of doubles, block by block and instruction by
+// instruction. It's built by abstract interpretation of the tape, where every
+// variable given by a column is a float and others are constants, so each
+// intermediate value is either a constant, a column of floats or a column of
+// booleans. Expressions whose intermediate values could be of different types
+// in different rows are not supported, except the common idiom "c and x or y".
+class columnar {
+public:
+  static constexpr size_t block_size = 256;
+
+private:
+  enum vop : unsigned char {
+    v_add,
+    v_sub,
+    v_mul,
+    v_div,
+    v_pow,
+    v_mod,
+    v_idiv,
+    v_lt,
+    v_le,
+    v_eq,
+    v_ne,
+    v_neg,
+    v_not,
+    v_select,  // a ? b : c
+    v_copy
+  };
+
+  struct vinstr {
+    vop     op;
+    int     dst;  // register
+    operand a, b, c;
+  };
+
+  enum kind_t : char {
+    k_const,
+    k_number,           // floats
+    k_integer,          // numbers which may be integers in Lua
+    k_bool,             // booleans
+    k_false_or_number,  // "c and x" where c is boolean and x is number
+  };
+
+  // Abstract value
+  struct avalue {
+    kind_t  kind = k_const;
+    value   v;                // for k_const
+    operand loc;              // the boolean for k_false_or_number
+    operand loc2;             // the number for k_false_or_number
+    bool    maybe_int = false;  // whether loc2 may be integers
+    // Whether integers in it (or in loc2) may be 0 or the min integer, whose
+    // negation differs from that of floats.
+    bool int_edge = false;
+  };
+
+  const tape&               tape_;
+  const std::vector<int>&   slot_columns_;
+  const std::vector<value>& slot_values_;
+  std::vector<vinstr>       code_;
+  std::vector<double>       consts_;
+  int                       nregs_ = 0;
+  avalue                    result_;
+
+  static avalue make_const(const value& v) {
+    avalue ret;
+    ret.v = v;
+    return ret;
   }
 
-  void rawset(int idx) { lua_rawset(L_, idx); }
-  void rawseti(int idx, lua_integer_t n) { lua_rawseti(L_, idx, n); }
-  void rawsetp(int idx, const void* p) { lua_rawsetp(L_, idx, p); }
-  void rawsetfield(int idx, const char* k) {
-    int aidx = abs(idx);
-    pushstring(k);
-    pushvalue(-2);
-    rawset(aidx);
-    pop();
+  operand const_operand(double d) {
+    consts_.push_back(d);
+    operand ret;
+    ret.kind  = operand::constant;
+    ret.index = static_cast<int>(consts_.size()) - 1;
+    return ret;
   }
 
-  /// Return whether the value at idx has a metatable, if true push the
-  /// metatable on top, otherwise push nothing and return false.
-  bool getmetatable(int idx) { return lua_getmetatable(L_, idx); }
+  static bool is_numeric(const avalue& a) {
+    return a.kind == k_number || a.kind == k_integer ||
+           (a.kind == k_const && a.v.is_number());
+  }
 
-  /// Pop a table or nil and set it as metatable for value at idx.
-  void setmetatable(int idx) { lua_setmetatable(L_, idx); }
+  static bool is_float(const avalue& a) {
+    return a.kind == k_number ||
+           (a.kind == k_const && a.v.type == value::number);
+  }
 
-  /// Push the metatable in regristry with name "tname" onto stack, if not
-  /// exists, create one. Return whether created a new metatable.
-  bool gtouchmetatb(const char* tname) { return luaL_newmetatable(L_, tname); }
+  static bool maybe_int(const avalue& a) {
+    return a.kind == k_integer ||
+           (a.kind == k_const && a.v.type == value::integer);
+  }
 
-  void       newtable() { lua_newtable(L_); }
-  void*      newuserdata(size_t size) { return lua_newuserdata(L_, size); }
-  lua_State* newthread() { return lua_newthread(L_); }
+  static bool may_be_int_edge(const avalue& a) {
+    if (a.kind == k_integer) return a.int_edge;
+    return a.kind == k_const && a.v.type == value::integer &&
+           (a.v.i == 0 || a.v.i == std::numeric_limits<lua_Integer>::min());
+  }
 
-  /// Get main thread of a given thread.
-  static lua_State* get_main_thread_of(lua_State* L) {
-    if (!L) return nullptr;
-    lua_geti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
-    lua_State* ret = lua_tothread(L, -1);
-    lua_pop(L, 1);
+  static bool is_boolean(const avalue& a) {
+    return a.kind == k_bool || (a.kind == k_const && a.v.type == value::boolean);
+  }
+
+  // Integers are converted to floats just like Lua does in arithmetic, but
+  // should be exact for comparisons and selections.
+  bool as_number(const avalue& a, operand& o, bool exact = false) {
+    if (a.kind == k_number || a.kind == k_integer) {
+      o = a.loc;
+      return true;
+    }
+    if (a.kind != k_const || !a.v.is_number()) return false;
+    if (exact && a.v.type == value::integer && !int_fits_float(a.v.i)) {
+      return false;
+    }
+    o = const_operand(a.v.to_number());
+    return true;
+  }
+
+  bool as_bool(const avalue& a, operand& o) {
+    if (a.kind == k_bool) {
+      o = a.loc;
+      return true;
+    }
+    if (a.kind != k_const || a.v.type != value::boolean) return false;
+    o = const_operand(a.v.b ? 1 : 0);
+    return true;
+  }
+
+  avalue emit(vop            op,
+              int            dst,
+              kind_t         kind,
+              const operand& a,
+              const operand& b = operand(),
+              const operand& c = operand()) {
+    code_.push_back(vinstr{op, dst, a, b, c});
+    if (dst >= nregs_) nregs_ = dst + 1;
+    avalue ret;
+    ret.kind      = kind;
+    ret.loc.kind  = operand::reg;
+    ret.loc.index = dst;
     return ret;
   }
 
-  /// Get main thread.
-  lua_State* main_thread() const { return get_main_thread_of(L_); }
+  // Make sure a value in register is at the register of its stack position.
+  void settle(avalue& a, int pos) {
+    if (a.kind != k_const && a.loc.kind == operand::reg && a.loc.index != pos) {
+      const bool edge = a.int_edge;
+      a               = emit(v_copy, pos, a.kind, a.loc);
+      a.int_edge      = edge;
+    }
+  }
 
-  /// Push onto the stack the global value with given name.
-  /// Return the type of that value.
-  int getglobal(const char* name) {
-    PEACALM_LUAW_ASSERT(name);
-    return lua_getglobal(L_, name);
+  bool unary(opcode op, std::vector<avalue>& st) {
+    avalue    a = st.back();
+    const int p = static_cast<int>(st.size()) - 1;
+    st.pop_back();
+    if (a.kind == k_const) {
+      value v = a.v;
+      if (op == op_not) {
+        v = value::make_bool(!v.truthy());
+      } else if (v.type == value::integer) {
+        v.i = intop_sub(0, v.i);
+      } else if (v.type == value::number) {
+        v.n = -v.n;
+      } else {
+        return false;
+      }
+      st.push_back(make_const(v));
+    } else if (a.kind == k_false_or_number) {
+      return false;
+    } else if (op == op_not) {
+      // Numbers are always true
+      st.push_back(a.kind == k_bool ? emit(v_not, p, k_bool, a.loc)
+                                    : make_const(value::make_bool(false)));
+    } else {
+      if (a.kind == k_bool) return false;
+      // Float rows need -x (-0.0 for 0.0), while integer rows need 0 - x (0
+      // for 0, wraps for the min integer). They differ only if integers may
+      // be 0 or the min integer, in which case rows are not distinguishable.
+      if (a.kind == k_integer && a.int_edge) return false;
+      st.push_back(emit(v_neg, p, a.kind, a.loc));
+    }
+    return true;
+  }
+
+  bool binary(opcode op, std::vector<avalue>& st) {
+    avalue b = st.back();
+    st.pop_back();
+    avalue a = st.back();
+    st.pop_back();
+    const int p = static_cast<int>(st.size());
+    if (a.kind == k_const && b.kind == k_const) {
+      value v;
+      if (!native::binary(op, a.v, b.v, v)) return false;
+      st.push_back(make_const(v));
+      return true;
+    }
+    if (a.kind == k_false_or_number || b.kind == k_false_or_number) {
+      return false;
+    }
+    operand oa, ob;
+    if (op == op_eq || op == op_ne) {
+      const vop vo = op == op_eq ? v_eq : v_ne;
+      if (is_numeric(a) && is_numeric(b)) {
+        if (!as_number(a, oa, true) || !as_number(b, ob, true)) return false;
+      } else if (is_boolean(a) && is_boolean(b)) {
+        if (!as_bool(a, oa) || !as_bool(b, ob)) return false;
+      } else {
+        // Values of different types are never equal
+        st.push_back(make_const(value::make_bool(op == op_ne)));
+        return true;
+      }
+      st.push_back(emit(vo, p, k_bool, oa, ob));
+      return true;
+    }
+    const bool cmp = op == op_lt || op == op_le || op == op_gt || op == op_ge;
+    if (!as_number(a, oa, cmp) || !as_number(b, ob, cmp)) return false;
+    // Integer arithmetic is not supported, at least one should be float.
+    if (!cmp && op != op_div && op != op_pow && !is_float(a) && !is_float(b)) {
+      return false;
+    }
+    switch (op) {
+      case op_lt: st.push_back(emit(v_lt, p, k_bool, oa, ob)); break;
+      case op_le: st.push_back(emit(v_le, p, k_bool, oa, ob)); break;
+      case op_gt: st.push_back(emit(v_lt, p, k_bool, ob, oa)); break;
+      case op_ge: st.push_back(emit(v_le, p, k_bool, ob, oa)); break;
+      case op_add: st.push_back(emit(v_add, p, k_number, oa, ob)); break;
+      case op_sub: st.push_back(emit(v_sub, p, k_number, oa, ob)); break;
+      case op_mul: st.push_back(emit(v_mul, p, k_number, oa, ob)); break;
+      case op_div: st.push_back(emit(v_div, p, k_number, oa, ob)); break;
+      case op_mod: st.push_back(emit(v_mod, p, k_number, oa, ob)); break;
+      case op_idiv: st.push_back(emit(v_idiv, p, k_number, oa, ob)); break;
+      case op_pow:
+        if (b.kind == k_const && b.v.to_number() == 2) {
+          st.push_back(emit(v_mul, p, k_number, oa, oa));
+        } else {
+          st.push_back(emit(v_pow, p, k_number, oa, ob));
+        }
+        break;
+      default: return false;
+    }
+    return true;
+  }
+
+  bool logical(const instruction& ins, size_t pc, std::vector<avalue>& st) {
+    const avalue a      = st.back();
+    const bool   is_and = ins.op == op_and;
+    if (a.kind == k_false_or_number) {
+      // "c and x or y", which uses registers p and p + 1.
+      if (is_and) return false;
+      st.push_back(avalue());
+      if (!build(pc + 1, ins.arg, st)) return false;
+      const avalue b = st.back();
+      st.resize(st.size() - 3);
+      operand ob;
+      if (!as_number(b, ob, true)) return false;
+      const int    p    = static_cast<int>(st.size());
+      const kind_t kind = a.maybe_int || maybe_int(b) ? k_integer : k_number;
+      avalue       r    = emit(v_select, p, kind, a.loc, a.loc2, ob);
+      r.int_edge        = a.int_edge || may_be_int_edge(b);
+      st.push_back(r);
+      return true;
+    }
+    if (a.kind != k_bool) {
+      // Result is "a" or the right operand.
+      const bool truthy = a.kind != k_const || a.v.truthy();
+      if (is_and != truthy) return true;
+      st.pop_back();
+      return build(pc + 1, ins.arg, st);
+    }
+    if (!build(pc + 1, ins.arg, st)) return false;
+    const avalue b = st.back();
+    st.pop_back();
+    st.pop_back();
+    const int p = static_cast<int>(st.size());
+    operand   ob;
+    if (is_and && is_numeric(b)) {
+      avalue ret;
+      ret.kind      = k_false_or_number;
+      ret.loc       = a.loc;
+      ret.maybe_int = maybe_int(b);
+      ret.int_edge  = may_be_int_edge(b);
+      if (!as_number(b, ret.loc2, true)) return false;
+      st.push_back(ret);
+      return true;
+    }
+    if (!as_bool(b, ob)) return false;
+    st.push_back(is_and ? emit(v_select, p, k_bool, a.loc, ob, a.loc)
+                        : emit(v_select, p, k_bool, a.loc, a.loc, ob));
+    return true;
+  }
+
+  bool if_function(int nargs, std::vector<avalue>& st) {
+    const int           p = static_cast<int>(st.size()) - nargs;
+    std::vector<avalue> args(st.begin() + p, st.end());
+    st.resize(p);
+    for (const avalue& a : args) {
+      if (a.kind == k_false_or_number) return false;
+    }
+    avalue r = args[nargs - 1];
+    for (int i = nargs - 3; i >= 0; i -= 2) {
+      const avalue& c = args[i];
+      const avalue& v = args[i + 1];
+      if (c.kind != k_bool) {
+        if (c.kind != k_const || c.v.truthy()) r = v;
+        continue;
+      }
+      operand ov, orr;
+      kind_t  kind;
+      bool    edge = false;
+      if (is_numeric(v) && is_numeric(r)) {
+        if (!as_number(v, ov, true) || !as_number(r, orr, true)) return false;
+        kind = maybe_int(v) || maybe_int(r) ? k_integer : k_number;
+        edge = may_be_int_edge(v) || may_be_int_edge(r);
+      } else if (is_boolean(v) && is_boolean(r)) {
+        if (!as_bool(v, ov) || !as_bool(r, orr)) return false;
+        kind = k_bool;
+      } else {
+        return false;
+      }
+      r          = emit(v_select, p + nargs, kind, c.loc, ov, orr);
+      r.int_edge = edge;
+    }
+    settle(r, p);
+    st.push_back(r);
+    return true;
+  }
+
+  // Build instructions in [begin, end) of the tape.
+  bool build(size_t begin, size_t end, std::vector<avalue>& st) {
+    for (size_t pc = begin; pc < end; ++pc) {
+      const instruction& ins = tape_.code[pc];
+      switch (ins.op) {
+        case op_const: st.push_back(make_const(tape_.consts[ins.arg])); break;
+        case op_var:
+          if (slot_columns_[ins.arg] >= 0) {
+            avalue a;
+            a.kind      = k_number;
+            a.loc.kind  = operand::column;
+            a.loc.index = slot_columns_[ins.arg];
+            st.push_back(a);
+          } else {
+            st.push_back(make_const(slot_values_[ins.arg]));
+          }
+          break;
+        case op_neg:
+        case op_not:
+          if (!unary(ins.op, st)) return false;
+          break;
+        case op_and:
+        case op_or:
+          if (!logical(ins, pc, st)) return false;
+          pc = static_cast<size_t>(ins.arg) - 1;
+          break;
+        case op_if:
+          if (!if_function(ins.arg, st)) return false;
+          break;
+        default:
+          if (!binary(ins.op, st)) return false;
+      }
+    }
+    return true;
   }
 
-  /// Pop a value from the stack and set it as the new value of global "name".
-  void setglobal(const char* name) {
-    PEACALM_LUAW_ASSERT(name);
-    lua_setglobal(L_, name);
+public:
+  /**
+   * @param [in] t The tape.
+   * @param [in] slot_columns Index of input column for each variable slot,
+   * or -1 if the slot is not given by columns.
+   * @param [in] slot_values Values of slots not given by columns.
+   */
+  columnar(const tape&               t,
+           const std::vector<int>&   slot_columns,
+           const std::vector<value>& slot_values)
+      : tape_(t), slot_columns_(slot_columns), slot_values_(slot_values) {}
+
+  /// Build the program, return false if not supported.
+  bool build() {
+    std::vector<avalue> st;
+    if (!build(0, tape_.code.size(), st)) return false;
+    PEACALM_LUAW_ASSERT(st.size() == 1);
+    result_ = st.back();
+    return is_numeric(result_);
+  }
+
+  /// Run over the input columns, write results of all rows to "out".
+  void run(const double* const* inputs, size_t rows, double* out) const {
+    constexpr size_t    B = block_size;
+    std::vector<double> regs(nregs_ * B);
+    std::vector<double> consts(consts_.size() * B);
+    for (size_t i = 0; i < consts_.size(); ++i) {
+      std::fill(consts.begin() + i * B, consts.begin() + (i + 1) * B,
+                consts_[i]);
+    }
+    for (size_t start = 0; start < rows; start += B) {
+      const size_t n   = std::min(B, rows - start);
+      auto         ptr = [&](const operand& o) -> const double* {
+        switch (o.kind) {
+          case operand::reg: return regs.data() + o.index * B;
+          case operand::column: return inputs[o.index] + start;
+          default: return consts.data() + o.index * B;
+        }
+      };
+      for (const vinstr& ins : code_) {
+        double*       d = regs.data() + ins.dst * B;
+        const double* a = ptr(ins.a);
+        const double* b = ptr(ins.b);
+        switch (ins.op) {
+          case v_add: kernel::binary<kernel::add_op>(d, a, b, n); break;
+          case v_sub: kernel::binary<kernel::sub_op>(d, a, b, n); break;
+          case v_mul: kernel::binary<kernel::mul_op>(d, a, b, n); break;
+          case v_div: kernel::binary<kernel::div_op>(d, a, b, n); break;
+          case v_idiv: kernel::binary<kernel::idiv_op>(d, a, b, n); break;
+          case v_pow: kernel::binary_scalar<kernel::pow_op>(d, a, b, n); break;
+          case v_mod: kernel::binary_scalar<kernel::mod_op>(d, a, b, n); break;
+          case v_lt: kernel::binary<kernel::lt_op>(d, a, b, n); break;
+          case v_le: kernel::binary<kernel::le_op>(d, a, b, n); break;
+          case v_eq: kernel::binary<kernel::eq_op>(d, a, b, n); break;
+          case v_ne: kernel::binary<kernel::ne_op>(d, a, b, n); break;
+          case v_neg: kernel::neg(d, a, n); break;
+          case v_not: kernel::logical_not(d, a, n); break;
+          case v_select: kernel::select(d, a, b, ptr(ins.c), n); break;
+          case v_copy: std::copy(a, a + n, d); break;
+        }
+      }
+      if (result_.kind == k_const) {
+        std::fill(out + start, out + start + n, result_.v.to_number());
+      } else {
+        const double* r = ptr(result_.loc);
+        std::copy(r, r + n, out + start);
+      }
+    }
   }
+};
 
-  int pcall(int narg, int nret, int f) { return lua_pcall(L_, narg, nret, f); }
+}  // namespace native
 
-  /// Whether the value at idx is indexable.
-  bool indexable(int idx = -1) const {
-    if (istable(idx)) return true;
-    if (lua_getmetatable(L_, idx) == 0) return false;
-    auto _g = make_guarder(gettop() - 1);
-    lua_getfield(L_, -1, "__index");
-    // if __index exists, then regard as indexable
-    bool ret = !isnoneornil(-1);
-    // maybe more checks?
+// Analyzer of Lua 5.4 binary chunks made by lua_dump, to find out global
+// variables a function references before running it.
+namespace bytecode {
+
+// Append chunk pieces from lua_dump into a std::string.
+inline int string_writer(lua_State*, const void* p, size_t sz, void* ud) {
+  static_cast<std::string*>(ud)->append(static_cast<const char*>(p), sz);
+  return 0;
+}
+
+// Sequential reader of a binary chunk. Any read out of range makes it bad.
+class reader {
+  const unsigned char* p_;
+  const unsigned char* end_;
+  bool                 ok_ = true;
+
+public:
+  reader(const char* data, size_t len)
+      : p_(reinterpret_cast<const unsigned char*>(data)), end_(p_ + len) {}
+
+  bool ok() const { return ok_; }
+
+  const unsigned char* skip(size_t n) {
+    if (!ok_ || static_cast<size_t>(end_ - p_) < n) {
+      ok_ = false;
+      return nullptr;
+    }
+    const unsigned char* ret = p_;
+    p_ += n;
     return ret;
   }
 
-  /// Whether the value at idx is newindexable.
-  bool newindexable(int idx = -1) const {
-    if (istable(idx)) return true;
-    if (!lua_getmetatable(L_, idx)) return false;
-    auto _g = make_guarder(gettop() - 1);
-    lua_getfield(L_, -1, "__newindex");
-    // if __newindex exists, then regard as newindexable
-    bool ret = !isnoneornil(-1);
-    // maybe more checks?
-    return ret;
+  unsigned byte() {
+    const unsigned char* b = skip(1);
+    return b ? *b : 0;
   }
 
-  /// Whether the value at idx is indexable and newindexable.
-  bool indexable_and_newindexable(int idx = -1) const {
-    if (istable(idx)) return true;
-    if (!lua_getmetatable(L_, idx)) return false;
-    auto _g = make_guarder(gettop() - 1);
-    lua_getfield(L_, -1, "__index");
-    lua_getfield(L_, -2, "__newindex");
-    // if both __index and __newindex exists
-    bool ret = !isnoneornil(-1) && !isnoneornil(-2);
-    // maybe more checks?
-    return ret;
+  // Unsigned integer in 7-bit groups, MSB first, the last group has 0x80 set.
+  size_t varint() {
+    size_t x = 0;
+    for (int i = 0; ok_ && i < 10; ++i) {
+      unsigned b = byte();
+      x          = (x << 7) | (b & 0x7f);
+      if (b & 0x80) return x;
+    }
+    ok_ = false;
+    return 0;
   }
 
-  /// Whether the value at idx is callable.
-  bool callable(int idx = -1) const {
-    if (isfunction(idx)) return true;
-    if (!lua_getmetatable(L_, idx)) return false;
-    auto _g = make_guarder(gettop() - 1);
-    lua_getfield(L_, -1, "__call");
-    bool ret = !isnoneornil(-1);
-    return ret;
+  // A string is its size plus 1 followed by its bytes, or 0 for NULL.
+  bool string(const char*& s, size_t& len) {
+    size_t sz = varint();
+    if (sz == 0) {
+      s   = nullptr;
+      len = 0;
+      return ok_;
+    }
+    len = sz - 1;
+    s   = reinterpret_cast<const char*>(skip(len));
+    return ok_;
   }
+};
 
-  ///////////////////////// type conversions ///////////////////////////////////
+// Find global variables (keys of the _ENV upvalue) read and written by a
+// function and its nested functions.
+class free_globals {
+  // Opcodes in Lua 5.4 (lopcodes.h).
+  // GETTABUP A B C: R[A] := UpValue[B][K[C]:shortstring]
+  // SETTABUP A B C: UpValue[A][K[B]:shortstring] := RK(C)
+  // If the name is a long string or its constant index is greater than 255,
+  // _ENV is got into a register by GETUPVAL, the name by LOADK or LOADKX, then
+  // accessed by GETTABLE or SETTABLE.
+  static constexpr unsigned op_loadk    = 3;   // R[A] := K[Bx]
+  static constexpr unsigned op_loadkx   = 4;   // R[A] := K[extra arg]
+  static constexpr unsigned op_getupval = 9;   // R[A] := UpValue[B]
+  static constexpr unsigned op_gettabup = 11;
+  static constexpr unsigned op_gettable = 12;  // R[A] := R[B][R[C]]
+  static constexpr unsigned op_getfield = 14;  // R[A] := R[B][K[C]]
+  static constexpr unsigned op_settabup = 15;
+  static constexpr unsigned op_settable = 16;  // R[A][R[B]] := RK(C)
+  static constexpr unsigned op_setfield = 18;  // R[A][K[B]] := RK(C)
+  static constexpr unsigned op_extraarg = 82;  // Ax
+
+  // Type tags of constants in Lua 5.4 (lobject.h).
+  enum : unsigned {
+    tag_nil    = 0,
+    tag_false  = 1,
+    tag_true   = 17,
+    tag_int    = 3,
+    tag_float  = 19,
+    tag_shrstr = 4,
+    tag_lngstr = 20
+  };
 
-  // NOTICE: Value conversions from Lua to C++ may be different with that in
-  // Lua!
-  //
-  // Conversion process: Firstly convert value in Lua to C++'s value with
-  // corresponding type, e.g. boolean to bool, integer to long long, number to
-  // double, string to string, then cast it to target type by C++'s type
-  // conversion strategy. Note that number in Lua is also string, and
-  // number-literal-string is also number.
-  //
-  // This lib mainly uses C++'s value conversion strategy, in addition, a
-  // implicitly conversion strategy between number and number-literal-string,
-  // which is supported by Lua.
-  //
-  // In total, this lib makes value conversions behave more like C++.
-  //
-  // Details:
-  // 1. Implicitly conversion between integer, number, boolean using
-  //    C++'s static_cast
-  // 2. Implicitly conversion between number and number-literal-string by Lua
-  // 3. When convert number 0 to boolean, will get false (not true as Lua does)
-  // 4. NONE and NIL won't convert to any value, default value (user given or
-  //    initial value of target type) will be returned
-  // 5. Non-number-literal-string, including empty string, can't convert to any
-  //    other types, default value will be returned (can't convert to true as
-  //    Lua does)
-  // 6. Integer's precision won't be lost if its value is representable by 64bit
-  //    signed integer type, i.e. between [-2^63, 2^63 -1], which is
-  //    [-9223372036854775808, 9223372036854775807]
-  //
-  // Examples:
-  // * number 2.5 -> string "2.5" (By Lua)
-  // * number 3 -> string "3.0" (By Lua)
-  // * integer 3 -> string "3" (By Lua)
-  // * string "2.5" -> double 2.5 (By Lua)
-  // * number 2.5 -> int 2 (By C++)
-  // * string "2.5" -> int 2 (Firstly "2.5"->2.5 by lua, then 2.5->2 by C++)
-  // * boolean true -> int 1 (By C++)
-  // * boolean false -> int 0 (By C++)
-  // * integer 0 -> bool false (By C++)
-  // * number 2.5 -> bool true (By C++)
-  // * string "2.5" -> bool true ("2.5"->2.5 by Lua, then 2.5->true by C++)
-  // * string "0" -> bool false ("0"->0 by Lua, then 0->false by C++)
+  struct name_ref {
+    const char* s;
+    size_t      len;
+  };
 
-  /**
-   * @brief Convert a value in Lua stack to C++ simple type value.
-   *
-   * @param [in] idx Index of Lua stack where the value in.
-   * @param [in] def The default value returned if conversion fails.
-   * @param [in] disable_log Whether print a log when exception occurs.
-   * @param [out] failed Will be set whether the convertion is failed if this
-   * pointer is not nullptr.
-   * @param [out] exists Will be set whether the value at given index exists if
-   * this pointer is not nullptr. Regard none and nil as not exists.
-   *
-   * @{
-   */
+  size_t                          int_size_ = 0;
+  size_t                          num_size_ = 0;
+  std::vector<std::string>        reads_;
+  std::unordered_set<std::string> read_set_;
+  std::unordered_set<std::string> writes_;
+
+  void add_read(const name_ref* k) {
+    if (!k) return;
+    std::string name(k->s, k->len);
+    if (read_set_.insert(name).second) reads_.push_back(std::move(name));
+  }
+
+  void add_write(const name_ref* k) {
+    if (k) writes_.emplace(k->s, k->len);
+  }
+
+  bool header(reader& r) {
+    const unsigned char* sig = r.skip(4);
+    if (!sig || std::memcmp(sig, LUA_SIGNATURE, 4) != 0) return false;
+    if (r.byte() != 0x54 || r.byte() != 0) return false;  // version, format
+    const unsigned char* data = r.skip(6);
+    if (!data || std::memcmp(data, "\x19\x93\r\n\x1a\n", 6) != 0) return false;
+    if (r.byte() != 4) return false;  // sizeof(Instruction)
+    int_size_ = r.byte();
+    num_size_ = r.byte();
+    r.skip(int_size_ + num_size_);  // LUAC_INT and LUAC_NUM
+    return r.ok();
+  }
+
+  // "penv" tells whether each upvalue of the enclosing function is _ENV, or
+  // whether each upvalue of this function is _ENV if it's the top function.
+  bool function(reader& r, const std::vector<bool>& penv, bool top) {
+    const char* s;
+    size_t      len;
+    r.string(s, len);  // source
+    r.varint();        // linedefined
+    r.varint();        // lastlinedefined
+    r.skip(3);         // numparams, is_vararg, maxstacksize
+
+    size_t               ncode = r.varint();
+    const unsigned char* code  = r.skip(ncode * 4);
+
+    size_t                nk = r.varint();
+    std::vector<name_ref> k(r.ok() ? nk : 0, name_ref{nullptr, 0});
+    for (size_t i = 0; r.ok() && i < nk; ++i) {
+      switch (r.byte()) {
+        case tag_nil:
+        case tag_false:
+        case tag_true:
+          break;
+        case tag_int:
+          r.skip(int_size_);
+          break;
+        case tag_float:
+          r.skip(num_size_);
+          break;
+        case tag_shrstr:
+        case tag_lngstr:
+          r.string(k[i].s, k[i].len);
+          break;
+        default:
+          return false;
+      }
+    }
 
-#define DEFINE_TYPE_CONVERSION(typename, type, default)        \
-  type to_##typename(int   idx         = -1,                   \
-                     type  def         = default,              \
-                     bool  disable_log = false,                \
-                     bool* failed      = nullptr,              \
-                     bool* exists      = nullptr) {                 \
-    if (exists) *exists = !isnoneornil(idx);                   \
-    /* check integer before number to avoid precision lost. */ \
-    if (isinteger(idx)) {                                      \
-      if (failed) *failed = false;                             \
-      return static_cast<type>(lua_tointeger(L_, idx));        \
-    }                                                          \
-    if (isnumber(idx)) {                                       \
-      if (failed) *failed = false;                             \
-      /* try integer first to avoid precision lost */          \
-      long long t = lua_tointeger(L_, idx);                    \
-      if (t != 0) return t;                                    \
-      return static_cast<type>(lua_tonumber(L_, idx));         \
-    }                                                          \
-    if (isboolean(idx)) {                                      \
-      if (failed) *failed = false;                             \
-      return static_cast<type>(lua_toboolean(L_, idx));        \
-    }                                                          \
-    if (isnoneornil(idx)) {                                    \
-      if (failed) *failed = false;                             \
-      return def;                                              \
-    }                                                          \
-    if (failed) *failed = true;                                \
-    if (!disable_log) log_type_convert_error(idx, #type);      \
-    return def;                                                \
-  }
+    // The top function's upvalues are given. Otherwise an upvalue is _ENV if
+    // it refers to an _ENV upvalue of the enclosing function.
+    size_t            nup = r.varint();
+    std::vector<bool> env(r.ok() ? nup : 0, false);
+    for (size_t i = 0; r.ok() && i < nup; ++i) {
+      unsigned instack = r.byte();
+      unsigned idx     = r.byte();
+      r.byte();  // kind
+      if (top) {
+        env[i] = i < penv.size() && penv[i];
+      } else {
+        env[i] = !instack && idx < penv.size() && penv[idx];
+      }
+    }
+    if (!r.ok()) return false;
 
-  DEFINE_TYPE_CONVERSION(bool, bool, false)
-  DEFINE_TYPE_CONVERSION(int, int, 0)
-  DEFINE_TYPE_CONVERSION(uint, unsigned int, 0)
-  DEFINE_TYPE_CONVERSION(long, long, 0)
-  DEFINE_TYPE_CONVERSION(ulong, unsigned long, 0)
-  DEFINE_TYPE_CONVERSION(llong, long long, 0)
-  DEFINE_TYPE_CONVERSION(ullong, unsigned long long, 0)
-  DEFINE_TYPE_CONVERSION(float, float, 0)
-  DEFINE_TYPE_CONVERSION(double, double, 0)
-  DEFINE_TYPE_CONVERSION(ldouble, double, 0)
-#undef DEFINE_TYPE_CONVERSION
+    // String constants by index, or nullptr if not a string.
+    auto kstr = [&k](size_t idx) -> const name_ref* {
+      return idx < k.size() && k[idx].s ? &k[idx] : nullptr;
+    };
+    // Registers holding _ENV, and registers holding string constants.
+    // Any other instruction is taken as writing its register A.
+    std::array<bool, 256>            env_reg{};
+    std::array<const name_ref*, 256> k_reg{};
+    for (size_t pc = 0; pc < ncode; ++pc) {
+      uint32_t i;
+      std::memcpy(&i, code + pc * 4, 4);
+      unsigned op = i & 0x7f;
+      unsigned a  = (i >> 7) & 0xff;
+      unsigned b  = (i >> 16) & 0xff;
+      unsigned c  = (i >> 24) & 0xff;
+      switch (op) {
+        case op_gettabup:
+          if (b < env.size() && env[b]) add_read(kstr(c));
+          break;
+        case op_settabup:
+          if (a < env.size() && env[a]) add_write(kstr(b));
+          break;
+        case op_getupval:
+          env_reg[a] = b < env.size() && env[b];
+          k_reg[a]   = nullptr;
+          continue;
+        case op_loadk:
+          env_reg[a] = false;
+          k_reg[a]   = kstr(i >> 15);
+          continue;
+        case op_loadkx: {
+          uint32_t x = 0;
+          if (pc + 1 < ncode) std::memcpy(&x, code + (pc + 1) * 4, 4);
+          env_reg[a] = false;
+          k_reg[a]   = (x & 0x7f) == op_extraarg ? kstr(x >> 7) : nullptr;
+          ++pc;
+          continue;
+        }
+        case op_gettable:
+          if (env_reg[b]) add_read(k_reg[c]);
+          break;
+        case op_getfield:
+          if (env_reg[b]) add_read(kstr(c));
+          break;
+        case op_settable:
+          if (env_reg[a]) add_write(k_reg[b]);
+          continue;
+        case op_setfield:
+          if (env_reg[a]) add_write(kstr(b));
+          continue;
+        default:
+          break;
+      }
+      env_reg[a] = false;
+      k_reg[a]   = nullptr;
+    }
 
-  // Unsafe version.
-  // NOTICE: Lua will implicitly convert number to string
-  const char* to_c_str(int         idx         = -1,
-                       const char* def         = "",
-                       bool        disable_log = false,
-                       bool*       failed      = nullptr,
-                       bool*       exists      = nullptr) {
-    if (exists) *exists = !isnoneornil(idx);
-    if (isstring(idx)) {  // include number
-      if (failed) *failed = false;
-      return lua_tostring(L_, idx);
+    size_t np = r.varint();
+    for (size_t i = 0; r.ok() && i < np; ++i) {
+      if (!function(r, env, false)) return false;
     }
-    if (isnoneornil(idx)) {
-      if (failed) *failed = false;
-      return def;
+
+    // Debug information
+    r.skip(r.varint());  // lineinfo
+    size_t nabs = r.varint();
+    for (size_t i = 0; r.ok() && i < nabs; ++i) {
+      r.varint();
+      r.varint();
     }
-    if (failed) *failed = true;
-    if (!disable_log) log_type_convert_error(idx, "string");
-    return def;
+    size_t nloc = r.varint();
+    for (size_t i = 0; r.ok() && i < nloc; ++i) {
+      r.string(s, len);
+      r.varint();
+      r.varint();
+    }
+    size_t nupname = r.varint();
+    for (size_t i = 0; r.ok() && i < nupname; ++i) r.string(s, len);
+    return r.ok();
   }
 
-  // Safe version.
-  // Make a copy of the value before converts it to string when it is a number.
-  std::string to_string(int                idx         = -1,
-                        const std::string& def         = "",
-                        bool               disable_log = false,
-                        bool*              failed      = nullptr,
-                        bool*              exists      = nullptr) {
-    if (is_type_number(idx)) {
-      pushvalue(idx);  // make a copy
-      std::string ret = to_c_str(-1, def.c_str(), disable_log, failed, exists);
-      pop();
-      return ret;
+public:
+  // Analyze a binary chunk made by lua_dump from a main chunk, whose first
+  // upvalue is _ENV.
+  bool analyze(const char* chunk, size_t len) {
+    return analyze(chunk, len, std::vector<bool>{true});
+  }
+
+  // Analyze a binary chunk made by lua_dump from any Lua function, "env" tells
+  // whether each upvalue of the function is _ENV.
+  bool analyze(const char* chunk, size_t len, const std::vector<bool>& env) {
+#if LUA_VERSION_NUM == 504
+    reader r(chunk, len);
+    if (!header(r)) return false;
+    r.byte();  // number of upvalues of the main closure
+    return function(r, env, true);
+#else
+    (void)chunk;
+    (void)len;
+    (void)env;
+    return false;
+#endif
+  }
+
+  // Global names read but never assigned, in order of first appearance.
+  std::vector<std::string> result() const {
+    std::vector<std::string> ret;
+    for (const auto& name : reads_) {
+      if (!writes_.count(name)) ret.push_back(name);
     }
-    return std::string{to_c_str(idx, def.c_str(), disable_log, failed, exists)};
+    return ret;
   }
+};
 
-  /** @} */
+}  // namespace bytecode
 
-  /**
-   * @brief Convert a value in Lua stack to complex C++ type.
-   *
-   * Can get a C++ data type.
-   * T could be any type composited by bool, integer types, float number types,
-   * C string, std::string, std::pair, std::tuple, std::vector, std::set,
-   * std::unordered_set, std::map, std::unordered_map, std::deque, std::list,
-   * std::forward_list.
-   * Also, T could be cv-qualified, but cannot be a reference.
-   * Note that using C string "const char*" as key type of set or map is
-   * forbidden, and anytime using "const char*" is not recommended, should
-   * better us std::string instead.
-   *
-   * Can get a user defined class type.
-   *
-   * Can get a callable function like type.
-   * T could be std::function or luaw::function.
-   *
-   * Can get a pointer type.
-   *
-   * @tparam T The result type user expected.
-   * @param [in] idx value's index in stack.
-   * @param [in] disable_log Whether print a log when exception occurs.
-   * @param [out] failed Will be set whether the operation is failed if this
-   * pointer is not nullptr. If T is a container type, it regards the operation
-   * as failed if any element failed.
-   * @param [out] exists Will be set whether the value at given index exists if
-   * this pointer is not nullptr. Regard none and nil as not exists.
-   * @return Return the value on given index in type T if conversion succeeds,
-   * otherwise return initial value of T(i.e. by statement `T{}`) if T is a
-   * simple type, e.g. bool, int, double, std::string, etc. If T is a container
-   * type, the result will contain all non-nil elements whose conversion
-   * succeeded and discard elements who are nil or elements whose conversion
-   * failed.
-   */
-  template <typename T>
-  T to(int   idx         = -1,
-       bool  disable_log = false,
-       bool* failed      = nullptr,
-       bool* exists      = nullptr) {
-    static_assert(!std::is_reference<T>::value, "Should not return reference");
-    return convertor<std::decay_t<T>>::to(
-        *this, idx, disable_log, failed, exists);
-  }
+}  // namespace luaw_detail
 
-  ///////////////////////// seek fields ////////////////////////////////////////
+// The luaw family.
+class luaw;
+class fakeluaw;
+class subluaw;
+template <typename VariableProviderPointer>
+class custom_luaw;
 
-  /// Push the global environment onto the stack.
-  /// Equivalent to gseek("_G") if "_G" is not modified.
-  self_t& gseek_env() {
-    pushglobaltable();
-    return *this;
-  }
+/// Basic Lua wrapper class.
+class luaw {
+  using self_t = luaw;
 
-  /// Global Seek: Get a global value by name and push it onto the stack, or
-  /// push a nil if the name does not exist.
-  self_t& gseek(const char* name) {
-    if (name) {
-      getglobal(name);
+  // To use the compiled chunk cache
+  template <typename VariableProviderPointer>
+  friend class custom_luaw;
+
+  // To know standard libs loaded lazily
+  template <typename Derived>
+  friend class luaw_crtp;
+
+  // The path where registered member operations stored:
+  // LUA_REGISTRYINDEX -> (void*)(&typeid(T)) -> this enum field
+  enum member_info_fields {
+    // Merged table of member name -> entry used by __index, where an entry
+    // is a member function, or a member_accessor of getter, or a
+    // member_error_tags.
+    member_index = 1,
+    // Merged table of member name -> entry used by __newindex, where an entry
+    // is a member_accessor of setter, or true for const members.
+    member_newindex,
+    dynamic_member_getter,
+    dynamic_member_setter
+  };
+
+  // Entry of a member variable's getter or setter, it is a table with these
+  // fields. The accessor function is a plain C function called directly by
+  // __index or __newindex with the accessor data on top of stack.
+  enum member_accessor { accessor_function = 1, accessor_data };
+
+  // Entries for members can't be accessed by some objects.
+  enum member_error_tags {
+    nonconst_member_function_tag = 1,
+    nonvolatile_member_function_tag
+  };
+
+  // Entry installed by class_binding, which is referred by a lightuserdata in
+  // merged member tables and owned by the binding.
+  struct bound_member {
+    enum kind_t {
+      accessor,  // called like accessor function with data on top of stack
+      function,  // C function with data as the only upvalue if not null
+      callable   // "__call" of a callable object, where data is the object
+    };
+    kind_t        kind;
+    lua_CFunction fn;
+    void*         data;
+  };
+
+  // Push a bound member which is not an accessor as a function.
+  static void push_bound_function(lua_State* L, const bound_member* b) {
+    if (b->kind == bound_member::callable) {
+      lua_pushcfunction(L, b->fn);
+      lua_pushlightuserdata(L, b->data);
+      lua_pushcclosure(L, call_bound_callable, 2);
+    } else if (b->data) {
+      lua_pushlightuserdata(L, b->data);
+      lua_pushcclosure(L, b->fn, 1);
     } else {
-      pushnil();
+      lua_pushcfunction(L, b->fn);
     }
-    return *this;
   }
-  self_t& gseek(const std::string& name) { return gseek(name.c_str()); }
 
-  /// Push t[name] onto the stack where t is the value at the given index `idx`,
-  /// or push a nil if the operation fails.
-  self_t& seek(const char* name, int idx = -1) {
-    if (name && (istable(idx) || indexable(idx))) {
-      getfield(idx, name);
-    } else {
-      pushnil();
-    }
-    return *this;
+  // Call "__call" of a callable object with the object as first argument.
+  static int call_bound_callable(lua_State* L) {
+    lua_pushvalue(L, lua_upvalueindex(2));
+    lua_insert(L, 1);
+    return lua_tocfunction(L, lua_upvalueindex(1))(L);
   }
-  self_t& seek(const std::string& name, int idx = -1) {
-    return seek(name.c_str(), idx);
+
+  // Rank of the entry at "idx" in merged member tables, lower one takes
+  // precedence: member function, getter or setter, const member, error tags.
+  static int member_entry_rank(lua_State* L, int idx) {
+    switch (lua_type(L, idx)) {
+      case LUA_TFUNCTION:
+        return 0;
+      case LUA_TTABLE:
+        return 1;
+      case LUA_TLIGHTUSERDATA:
+        return static_cast<const bound_member*>(lua_touserdata(L, idx))
+                           ->kind == bound_member::accessor
+                   ? 1
+                   : 0;
+      case LUA_TBOOLEAN:
+        return 2;
+      case LUA_TNUMBER:
+        return 2 + static_cast<int>(lua_tointeger(L, idx));
+      default:
+        return std::numeric_limits<int>::max();
+    }
   }
 
-  /// Push t[n] onto the stack where t is the value at the given index `idx`, or
-  /// push a nil if the operation fails. Note that index of list in Lua starts
-  /// from 1.
-  self_t& seek(int n, int idx = -1) {
-    if (istable(idx) || indexable(idx)) {
-      lua_geti(L_, idx, n);
+  // Put the entry on top of stack into the merged member table just below it
+  // by name, unless the existing entry takes precedence. Pop the entry.
+  static void put_member_entry(lua_State* L, const char* name) {
+    lua_getfield(L, -2, name);
+    bool put = member_entry_rank(L, -2) <= member_entry_rank(L, -1);
+    lua_pop(L, 1);
+    if (put) {
+      lua_setfield(L, -2, name);
     } else {
-      pushnil();
+      lua_pop(L, 1);
     }
-    return *this;
   }
 
-  /// Push t[p] onto the stack where t is the value at the given index `idx`,
-  /// or push a nil if the operation fails.
-  self_t& seek(void* p, int idx = -1) {
-    // p could be 0
-    if (istable(idx) || indexable(idx)) {
-      int aidx = abs_index(idx);
-      pushlightuserdata(p);
-      gettable(aidx);
-    } else {
-      pushnil();
-    }
-    return *this;
-  }
+  // std::tuple as one Lua table, like std::pair
+  template <typename T, typename = void>
+  struct pusher;
+  template <typename T, typename = void>
+  struct convertor;
 
-  /// Seeking by nullptr is meanless.
-  self_t& seek(std::nullptr_t, int idx = -1) = delete;
+  // std::tuple as multi value in stack
+  template <typename T>
+  struct pusher_for_return;
+  template <typename T>
+  struct convertor_for_return;
 
-  /// Push the metatable of the value at the given index onto the stack if it
-  /// has a metatable, otherwise push a nil.
-  self_t& seek(metatable_tag, int idx = -1) {
-    if (!getmetatable(idx)) { pushnil(); }
-    return *this;
-  }
+  // Implementation for registering members of classes
+  template <typename T>
+  struct register_ctor_impl;
+  template <typename T, typename = void>
+  struct registrar;
+  // Used for registrar sepcialication for registering member ptr/ref.
+  struct registrar_tag_for_member_ptr;
+  // Access members declared by static_members for userdata of type T.
+  template <typename T, typename = void>
+  struct static_member_dispatcher;
 
-  /// Long Seek: Call gseek() for the first parameter, then call seek() for the
-  /// rest parameters.
-  template <typename T, typename... Ts>
-  self_t& lseek(const T& t, const Ts&... ts) {
-    gseek(t);
-    __lseek(ts...);
-    return *this;
-  }
+  // Mock std::mem_fn by a function or callable object whose first argument
+  // must be a raw pointer of a class.
+  // Then can call this class by reference, raw pointer or smart pointers
+  // (std::shared_ptr and std::unique_ptr) of the class.
+  // Also can accept a real member pointer, then it is just like std::mem_fn.
+  template <typename T, typename = void>
+  class mock_mem_fn;
 
-private:
-  void __lseek() {}
+  // Mock non-member to be a class's member.
+  // Behaves like std::mem_fn, accepts a first argument representing the class's
+  // instance, but this one would drop it, it's just a placeholder, non-member
+  // variables/functions don't need it after all.
+  // Can accept variable pointer or function pointer.
+  template <typename T, typename = void>
+  class static_mem_fn;
 
-  template <typename T, typename... Ts>
-  void __lseek(const T& t, const Ts&... ts) {
-    seek(t);
-    __lseek(ts...);
-  }
+  lua_State* L_;
 
 public:
-  ///////////////////////// push variables ///////////////////////////////
+  using lua_cfunction_t = lua_CFunction;  // int (*)(lua_State *L)
+  using lua_number_t    = lua_Number;     // double as default
+  using lua_integer_t   = lua_Integer;    // long long as default
 
-  /// Push a value onto stack.
+  /// To generate shared/exclusive metatable of type T.
+  template <typename T, typename = void>
+  struct metatable_factory;
+
+  /// A callable wrapper for Lua functions. Like std::function and can convert
+  /// to std::function, but contains more status information. Used within method
+  /// get.
   template <typename T>
-  int push(T&& value) {
-    return pusher<std::decay_t<T>>::push(*this, std::forward<T>(value));
-  }
+  class function;
 
-  /**
-   * @brief Push with an user given hint type.
-   *
-   * Hint specifies what type of value we want to push into Lua.
-   *
-   * If Hint is luaw::function_tag, push the value as a funcion.
-   *
-   * If Hint is luaw::class_tag, push the value as an userdata. And the value
-   * must be a class or a raw/smart pointer to class.
-   *
-   * The origin value must be convertible to Hint.
-   * So, Hint Can't be reference.
-   *
-   * Hint could have cv- property.
-   *
-   * @tparam Hint Expected type to be pushed as.
-   * @tparam T    Origin type of value.
-   * @param value The value to be pushed.
-   * @return int
-   */
-  template <typename Hint, typename T>
-  std::enable_if_t<!std::is_same<Hint, T>::value, int> push(T&& value) {
-    static_assert(!std::is_reference<Hint>::value,
-                  "Hint should not be reference");
-    return __push<Hint, T>(std::forward<T>(value), 0);
-  }
+  /// A compiled Lua expression which can be evaluated repeatedly without
+  /// compiling again. Generated by method compile.
+  class compiled_expr;
 
-private:
-  // Firstly, try pusher<DecayHint>::template push<TargetT, Y>.
-  template <typename Hint, typename T>
-  auto __push(T&& value, int)
-      -> decltype(pusher<std::decay_t<Hint>>::template push<Hint, T>(
-          *this, std::forward<T>(value))) {
-    return pusher<std::decay_t<Hint>>::template push<Hint, T>(
-        *this, std::forward<T>(value));
-  }
+  /// Member registrations of classes recorded once, which can be installed
+  /// into many states cheaply.
+  class class_binding;
 
-  // Secondly, try pusher<DecayHint>::push.
-  template <typename Hint, typename T>
-  auto __push(T&& value, ...) -> decltype(auto) {
-    return pusher<std::decay_t<Hint>>::push(*this, std::forward<T>(value));
-  }
+  /// A compiled Lua expression which could be evaluated natively in C++ if
+  /// it is pure arithmetic. Generated by method compile_native.
+  class native_expr;
 
-public:
-  /// Copy and push a value already in the stack.
-  void pushvalue(int idx = -1) { lua_pushvalue(L_, idx); }
+  /// Used as hint type for set/push/setkv, indicate the value is a class
+  /// object.
+  struct class_tag {};
 
-  /// Copy a value in stack to a global value with given name.
-  void copy_to_global(const char* name, int idx = -1) {
-    pushvalue(idx);
-    setglobal(name);
-  }
+  /// Used as hint type for set/push/setkv, indicate the value is a function or
+  /// a callable object used as a function.
+  struct function_tag {};
 
-  /// Push the global environment onto the stack.
-  void pushglobaltable() { lua_pushglobaltable(L_); }
+  /// Used as a value for set/push/setkv, indicate that should set/push a new
+  /// empty table to Lua.
+  struct newtable_tag {};
 
-  /// Push a new table onto the stack.
-  void pushnewtable() { lua_newtable(L_); }
+  /// Used as a key for seek/touchtb/setkv/lset, indicate that we're
+  /// getting/setting a value's metatable.
+  /// "tname" is used for touchtb to create a new metatable with this given name
+  /// if the value doesn't have a metatable.
+  struct metatable_tag {
+    const char* tname;
+    metatable_tag(const char* name = nullptr) : tname(name) {}
+  };
 
-  /// Push the thread represented by L onto the stack.
-  /// Returns 1 if this thread is the main thread of its state.
-  int pushthread() { return lua_pushthread(L_); }
+  /// Indicate that convert a Lua value to nothing, the Lua value is useless.
+  /// Any Lua value can convert to this.
+  /// Maybe used as a C++ function formal parameter.
+  struct placeholder_tag {};
 
-  /// Push a C closure function with n upvalues.
-  void pushcclosure(lua_cfunction_t f, int n) { lua_pushcclosure(L_, f, n); }
+  /// Represent a Lua value in stack by index.
+  class luavalueidx {
+    lua_State* L_;
+    int        idx_;
 
-  /// Push lightuserdata. Equivalent to `push(f)`.
-  void pushcfunction(lua_cfunction_t f) { lua_pushcfunction(L_, f); }
+  public:
+    luavalueidx(lua_State* L = nullptr, int idx = 0) : L_(L), idx_(idx) {}
 
-  /// Push lightuserdata. Equivalent to `push(p)`.
-  void pushlightuserdata(const void* p) { lua_pushlightuserdata(L_, (void*)p); }
+    lua_State* L() const { return L_; }
 
-  /// Push nil. Equivalent to `push(nullptr)`.
-  void pushnil() { lua_pushnil(L_); }
+    int idx() const { return idx_; }
 
-  /// Return a pointer to the internal copy of the string.
-  const char* pushstring(const char* s) {
-    PEACALM_LUAW_ASSERT(s);  // we forbit s to be NULL
-    return lua_pushstring(L_, s);
-  }
+    bool valid() const {
+      return L_ && std::abs(idx_) >= 1 && std::abs(idx_) <= lua_gettop(L_);
+    }
 
-  ///////////////////////// touch table ////////////////////////////////////////
+    lua_State* main_thread() const { return luaw::get_main_thread_of(L_); }
+  };
 
-  /// Push the table (or value indexable and newindexable) with given name onto
-  /// stack. If not exists, create one.
-  self_t& gtouchtb(const char* name) {
-    getglobal(name);
-    if (istable() || indexable_and_newindexable()) return *this;
-    pop();
-    newtable();
-    pushvalue(-1);  // make a copy
-    setglobal(name);
-    return *this;
-  }
-  self_t& gtouchtb(const std::string& name) { return gtouchtb(name.c_str()); }
+  /// Make a luavalueidx to represent the value at given index.
+  luavalueidx make_luavalueidx(int idx) const { return luavalueidx(L_, idx); }
 
-  /// Push the table (or value indexable and newindexable) t[name] onto stack,
-  /// where t is a table at given index. If t[name] is not a table, create a new
-  /// one.
-  self_t& touchtb(const char* name, int idx = -1) {
-    PEACALM_LUAW_ASSERT(name);
-    int aidx = abs_index(idx);
-    PEACALM_LUAW_INDEXABLE_ASSERT(indexable_and_newindexable(aidx));
-    getfield(aidx, name);
-    if (istable() || indexable_and_newindexable()) return *this;
-    pop();
-    newtable();
-    setfield(aidx, name);
-    getfield(aidx, name);
-    return *this;
-  }
-  self_t& touchtb(const std::string& name, int idx = -1) {
-    return touchtb(name.c_str(), idx);
-  }
+  /// A reference of some Lua value in LUA_REGISTRYINDEX.
+  class luavalueref {
+    lua_State*                 L_;
+    std::shared_ptr<const int> ref_sptr_;
 
-  /// Push the table (or value indexable and newindexable) t[n] onto stack,
-  /// where t is a table at given index. If t[n] is not a table, create a new
-  /// one.
-  self_t& touchtb(int n, int idx = -1) {
-    int aidx = abs_index(idx);
-    PEACALM_LUAW_INDEXABLE_ASSERT(indexable_and_newindexable(aidx));
-    geti(aidx, n);
-    if (istable() || indexable_and_newindexable()) return *this;
-    pop();
-    newtable();
-    seti(aidx, n);
-    geti(aidx, n);
-    return *this;
-  }
+  public:
+    /// Make a reference of the value at index "idx" in the stack "L".
+    luavalueref(lua_State* L = nullptr, int idx = -1) : L_(L) {
+      if (L && std::abs(idx) >= 1 && std::abs(idx) <= lua_gettop(L)) {
+        lua_pushvalue(L, idx);  // make a copy
+        // pops the value on top and returns its ref_id.
+        const int ref_id = luaL_ref(L, LUA_REGISTRYINDEX);
+        ref_sptr_.reset(new int(ref_id), [L](const int* p) {
+          luaL_unref(L, LUA_REGISTRYINDEX, *p);  // release the ref_id
+          delete p;
+        });
+      }
+    }
 
-  /// Push the table (or value indexable and newindexable) t[p] onto stack,
-  /// where t is a table at given index. If t[p] is not a table, create a new
-  /// one.
-  self_t& touchtb(void* p, int idx = -1) {
-    int aidx = abs_index(idx);
-    PEACALM_LUAW_INDEXABLE_ASSERT(indexable_and_newindexable(aidx));
-    pushlightuserdata(p);
-    gettable(aidx);
-    if (istable() || indexable_and_newindexable()) return *this;
-    pop();
-    newtable();
-    pushlightuserdata(p);
-    pushvalue(-2);
-    settable(aidx);
-    return *this;
-  }
+    lua_State* L() const { return L_; }
 
-  /// nullptr represents nil, using nil as key is invalid.
-  self_t& touchtb(std::nullptr_t, int idx = -1) = delete;
+    int ref_id() const { return ref_sptr_ ? *ref_sptr_ : LUA_NOREF; }
 
-  /// Push the metatable of the value at the given index onto the stack.
-  /// If the value does not have a metatable, create a new metatable for it then
-  /// push the metatable onto stack.
-  /// The way to create new metatable: If m.tname is empty, create an empty
-  /// metatable, else create a new metatable using `luaL_newmetatable(L_,
-  /// m.tname)`.
-  self_t& touchtb(metatable_tag m, int idx = -1) {
-    if (!getmetatable(idx)) {
-      int aidx = abs_index(idx);
-      if (!m.tname) {
-        newtable();
-      } else {
-        luaL_newmetatable(L_, m.tname);
-      }
-      setmetatable(aidx);
-      bool t = getmetatable(aidx);
-      PEACALM_LUAW_ASSERT(t);
-    }
-    return *this;
-  }
+    bool valid() const { return L_ && ref_sptr_ && *ref_sptr_ != LUA_NOREF; }
 
-  /// Long touchtb: Call gtouchtb() for the first parameter, then call touchtb()
-  /// for the rest parameters.
-  template <typename T, typename... Ts>
-  self_t& ltouchtb(const T& t, const Ts&... ts) {
-    gtouchtb(t);
-    __ltouchtb(ts...);
-    return *this;
-  }
+    bool as_nil() const { return !valid() || (ref_id() == LUA_REFNIL); }
 
-private:
-  void __ltouchtb() {}
+    lua_State* main_thread() const { return luaw::get_main_thread_of(L_); }
 
-  template <typename T, typename... Ts>
-  void __ltouchtb(const T& t, const Ts&... ts) {
-    touchtb(t);
-    __ltouchtb(ts...);
-  }
+    void unref() { ref_sptr_.reset(); }
 
-public:
-  ///////////////////////// set fields into a table ////////////////////////////
+    /// Set the referenced value to a global variable with given name.
+    /// Equivalent to luaw::set(name, this luavalueref).
+    void setglobal(const char* name) const {
+      PEACALM_LUAW_ASSERT(name);
+      lua_rawgeti(L_, LUA_REGISTRYINDEX, ref_id());
+      lua_setglobal(L_, name);
+    }
 
-  /// Set t[key] = value, where t is a table at given index.
-  template <typename T>
-  void setkv(const char* key, T&& value, int idx = -1) {
-    PEACALM_LUAW_ASSERT(key);
-    PEACALM_LUAW_INDEXABLE_ASSERT(newindexable(idx));
-    int aidx = abs_index(idx);
-    push(std::forward<T>(value));
-    setfield(aidx, key);
-  }
-  template <typename T>
-  void setkv(const std::string& key, T&& value, int idx = -1) {
-    setkv(key.c_str(), std::forward<T>(value), idx);
-  }
-  template <typename T>
-  void setkv(int key, T&& value, int idx = -1) {
-    PEACALM_LUAW_INDEXABLE_ASSERT(newindexable(idx));
-    int aidx = abs_index(idx);
-    push(std::forward<T>(value));
-    seti(aidx, key);
-  }
-  template <typename T>
-  void setkv(void* key, T&& value, int idx = -1) {
-    PEACALM_LUAW_INDEXABLE_ASSERT(newindexable(idx));
-    int aidx = abs_index(idx);
-    pushlightuserdata(key);
-    push(std::forward<T>(value));
-    settable(aidx);
-  }
+    /// Push the value referenced on top of this stack.
+    void pushvalue() const {
+      PEACALM_LUAW_ASSERT(L_);
+      lua_rawgeti(L_, LUA_REGISTRYINDEX, ref_id());
+    }
 
-  /// Set field with an user given hint type.
-  template <typename Hint, typename T>
-  std::enable_if_t<!std::is_same<Hint, T>::value> setkv(const char* key,
-                                                        T&&         value,
-                                                        int         idx = -1) {
-    PEACALM_LUAW_ASSERT(key);
-    PEACALM_LUAW_INDEXABLE_ASSERT(newindexable(idx));
-    int aidx = abs_index(idx);
-    push<Hint>(std::forward<T>(value));
-    setfield(aidx, key);
-  }
-  template <typename Hint, typename T>
-  std::enable_if_t<!std::is_same<Hint, T>::value> setkv(const std::string& key,
-                                                        T&& value,
-                                                        int idx = -1) {
-    setkv<Hint>(key.c_str(), std::forward<T>(value), idx);
-  }
-  template <typename Hint, typename T>
-  std::enable_if_t<!std::is_same<Hint, T>::value> setkv(int key,
-                                                        T&& value,
-                                                        int idx = -1) {
-    PEACALM_LUAW_INDEXABLE_ASSERT(newindexable(idx));
-    int aidx = abs_index(idx);
-    push<Hint>(std::forward<T>(value));
-    seti(aidx, key);
-  }
-  template <typename Hint, typename T>
-  std::enable_if_t<!std::is_same<Hint, T>::value> setkv(void* key,
-                                                        T&&   value,
-                                                        int   idx = -1) {
-    PEACALM_LUAW_INDEXABLE_ASSERT(newindexable(idx));
-    int aidx = abs_index(idx);
-    pushlightuserdata(key);
-    push<Hint>(std::forward<T>(value));
-    settable(aidx);
-  }
+    void pop(int n = 1) { lua_pop(L_, n); }
+    int  gettop() const { return lua_gettop(L_); }
+    void settop(int idx) { lua_settop(L_, idx); }
+    void cleartop() { settop(0); }
+  };
 
-  /// Set the parameter value as metatable for the value at given index.
-  /// Setting nullptr as metatable means setting nil to metatable.
-  template <typename T>
-  void setkv(metatable_tag, T&& value, int idx = -1) {
-    int aidx = abs_index(idx);
-    push(std::forward<T>(value));
-    setmetatable(aidx);
-  }
-  template <typename Hint, typename T>
-  std::enable_if_t<!std::is_same<Hint, T>::value> setkv(metatable_tag,
-                                                        T&& value,
-                                                        int idx = -1) {
-    int aidx = abs_index(idx);
-    push<Hint>(std::forward<T>(value));
-    setmetatable(aidx);
+  /// Make a reference for the value at given index.
+  luavalueref make_luavalueref(int idx = -1) const {
+    return luavalueref(L_, idx);
   }
 
-  /// Using nullptr as key is invalid.
-  template <typename T>
-  void setkv(std::nullptr_t, T&& value, int idx = -1) = delete;
-  template <typename Hint, typename T>
-  void setkv(std::nullptr_t, T&& value, int idx = -1) = delete;
-
-  ///////////////////////// set global variables ///////////////////////////////
-
   /**
-   * @brief Set a global variable to Lua.
-   *
-   * T could be data type, pointer type, C function, lambda, std::function and
-   * user defined class types.
-   *
-   * set(name, nullptr) means set nil to "name".
-   * set(name, luaw::newtable_tag) means set a new empty table to "name".
+   * @brief A zero-copy view of a Lua string.
    *
+   * The Lua string is kept alive by a reference in LUA_REGISTRYINDEX until the
+   * last copy of the view is destructed, so the view is valid no matter how
+   * the stack changes. It should not outlive the Lua state.
+   * It could also view a C string not in Lua (e.g. the default value returned
+   * when conversion failed), which should outlive the view then.
    */
-  template <typename T>
-  void set(const char* name, T&& value) {
-    push(std::forward<T>(value));
-    setglobal(name);
-  }
-  template <typename T>
-  void set(const std::string& name, T&& value) {
-    set(name.c_str(), std::forward<T>(value));
-  }
-
-  /// Set a global variable with an user given hint type.
-  template <typename Hint, typename T>
-  std::enable_if_t<!std::is_same<Hint, T>::value> set(const char* name,
-                                                      T&&         value) {
-    push<Hint>(std::forward<T>(value));
-    setglobal(name);
-  }
-  template <typename Hint, typename T>
-  std::enable_if_t<!std::is_same<Hint, T>::value> set(const std::string& name,
-                                                      T&& value) {
-    set<Hint>(name.c_str(), std::forward<T>(value));
-  }
+  class scoped_string_view {
+    std::shared_ptr<const int> ref_sptr_;
+    const char*                data_ = "";
+    size_t                     size_ = 0;
 
-  /// Recursively set fields. The last element in path is the key for value,
-  /// other elements in path are nested tables.
-  template <typename T>
-  void set(const std::initializer_list<const char*>& path, T&& value) {
-    __set<T>(path.begin(), path.end(), std::forward<T>(value));
-  }
-  template <typename T>
-  void set(const std::initializer_list<std::string>& path, T&& value) {
-    __set<T>(path.begin(), path.end(), std::forward<T>(value));
-  }
-  template <typename T>
-  void set(const std::vector<const char*>& path, T&& value) {
-    __set<T>(path.begin(), path.end(), std::forward<T>(value));
-  }
-  template <typename T>
-  void set(const std::vector<std::string>& path, T&& value) {
-    __set<T>(path.begin(), path.end(), std::forward<T>(value));
-  }
+  public:
+    scoped_string_view() {}
 
-  /// Recursively set fields with hint type
-  template <typename Hint, typename T>
-  std::enable_if_t<!std::is_same<Hint, T>::value> set(
-      const std::initializer_list<const char*>& path, T&& value) {
-    __set<Hint>(path.begin(), path.end(), std::forward<T>(value));
-  }
-  template <typename Hint, typename T>
-  std::enable_if_t<!std::is_same<Hint, T>::value> set(
-      const std::initializer_list<std::string>& path, T&& value) {
-    __set<Hint>(path.begin(), path.end(), std::forward<T>(value));
-  }
-  template <typename Hint, typename T>
-  std::enable_if_t<!std::is_same<Hint, T>::value> set(
-      const std::vector<const char*>& path, T&& value) {
-    __set<Hint>(path.begin(), path.end(), std::forward<T>(value));
-  }
-  template <typename Hint, typename T>
-  std::enable_if_t<!std::is_same<Hint, T>::value> set(
-      const std::vector<std::string>& path, T&& value) {
-    __set<Hint>(path.begin(), path.end(), std::forward<T>(value));
-  }
+    /// View a C string, which should outlive the view.
+    scoped_string_view(const char* s) : data_(s), size_(strlen(s)) {
+      PEACALM_LUAW_ASSERT(s);
+    }
 
-  /// Long set. The last argument is value, the rest arguments are indexes and
-  /// sub-indexes, where could contain luaw::metatable_tag.
-  template <typename... Args>
-  void lset(Args&&... args) {
-    constexpr size_t N = sizeof...(Args);
-    static_assert(N >= 2, "lset needs at least two arguments");
-    auto _g = make_guarder();
-    gseek_env();
-    using T = std::tuple_element_t<N - 1, std::tuple<Args...>>;
-    __lset<T>(std::forward<Args>(args)...);
-  }
+    /// View the string (or number converted to string) at index "idx" in the
+    /// stack "L". The value on stack is not changed.
+    scoped_string_view(lua_State* L, int idx) {
+      PEACALM_LUAW_ASSERT(L && lua_isstring(L, idx));
+      lua_pushvalue(L, idx);  // make a copy, numbers are converted in place
+      data_            = lua_tolstring(L, -1, &size_);
+      const int ref_id = luaL_ref(L, LUA_REGISTRYINDEX);
+      ref_sptr_.reset(new int(ref_id), [L](const int* p) {
+        luaL_unref(L, LUA_REGISTRYINDEX, *p);
+        delete p;
+      });
+    }
 
-  /// Long set with a hint type.
-  template <typename Hint, typename... Args>
-  void lset(Args&&... args) {
-    static_assert(sizeof...(Args) >= 2, "lset needs at least two arguments");
-    auto _g = make_guarder();
-    gseek_env();
-    __lset<Hint>(std::forward<Args>(args)...);
-  }
+    /// Pointer to the string, which is always NUL-terminated.
+    const char* data() const { return data_; }
+    const char* c_str() const { return data_; }
+    size_t      size() const { return size_; }
+    bool        empty() const { return size_ == 0; }
 
-private:
-  template <typename Hint, typename First, typename Second>
-  void __lset(First&& f, Second&& s) {
-    setkv<Hint>(std::forward<First>(f), std::forward<Second>(s));
-  }
+    /// Whether viewing a string in Lua.
+    bool in_lua() const { return ref_sptr_ != nullptr; }
 
-  template <typename Hint, typename First, typename Second, typename... Rests>
-  void __lset(First&& f, Second&& s, Rests&&... rs) {
-    touchtb(std::forward<First>(f));
-    __lset<Hint>(std::forward<Second>(s), std::forward<Rests>(rs)...);
-  }
+    /// Make a copy as std::string.
+    std::string str() const { return std::string(data_, size_); }
 
-  template <typename Hint, typename Iterator, typename T>
-  void __set(Iterator b, Iterator e, T&& value) {
-    if (b == e) return;
-    auto _g = make_guarder();
-    gseek_env();
+#if PEACALM_LUAW_SUPPORT_CPP17
+    std::string_view view() const { return std::string_view(data_, size_); }
+    operator std::string_view() const { return view(); }
+#endif
+  };
 
-    auto it = b;
-    while (true) {
-      auto nx = std::next(it, 1);
-      if (nx == e) {
-        setkv<Hint>(*it, std::forward<T>(value));
-        break;
-      } else {
-        touchtb(*it);
-        it = nx;
-      }
-    }
-  }
+  /// Stack balance guarder.
+  /// Automatically set stack to a specific size when destruct.
+  class guarder {
+    lua_State* L_;
+    int        topsz_;
 
-public:
-  // set for simple types
+  public:
+    guarder(lua_State* L, int topsz) : L_(L), topsz_(topsz) {}
+    ~guarder() { lua_settop(L_, topsz_); }
+  };
 
-  void set_integer(const char* name, long long value) {
-    lua_pushinteger(L_, value);
-    setglobal(name);
-  }
-  void set_integer(const std::string& name, long long value) {
-    set_integer(name.c_str(), value);
-  }
+  guarder make_guarder() const { return guarder(L_, gettop()); }
+  guarder make_guarder(int sz) const { return guarder(L_, sz); }
+  guarder make_guarder(lua_State* L, int sz) const { return guarder(L, sz); }
 
-  void set_number(const char* name, double value) {
-    lua_pushnumber(L_, value);
-    setglobal(name);
-  }
-  void set_number(const std::string& name, double value) {
-    set_number(name.c_str(), value);
-  }
+  /// Initialization options for luaw.
+  class opt {
+    enum libopt : char { ignore = 0, load = 1, preload = 2, lazy = 3 };
 
-  void set_boolean(const char* name, bool value) {
-    lua_pushboolean(L_, static_cast<int>(value));
-    setglobal(name);
-  }
-  void set_boolean(const std::string& name, bool value) {
-    set_boolean(name.c_str(), value);
-  }
+  public:
+    opt() {}
 
-  void set_nil(const char* name) {
-    pushnil();
-    setglobal(name);
-  }
-  void set_nil(const std::string& name) { set_nil(name.c_str()); }
+    /// Ignore all standard libs.
+    opt& ignore_libs() {
+      libopt_ = ignore;
+      return *this;
+    }
+    /// Load all standard libs.
+    opt& load_libs() {
+      libopt_ = load;
+      return *this;
+    }
+    /// Preload all standard libs.
+    opt& preload_libs() {
+      libopt_ = preload;
+      return *this;
+    }
+    /// Load the base lib, and other standard libs on first access.
+    opt& lazy_load_libs() {
+      libopt_ = lazy;
+      return *this;
+    }
 
-  void set_string(const char* name, const char* value) {
-    lua_pushstring(L_, value);
-    setglobal(name);
-  }
-  void set_string(const std::string& name, const char* value) {
-    set_string(name.c_str(), value);
-  }
+    /// Register extended functions.
+    opt& register_exfunctions(bool r) {
+      exfunc_ = r;
+      return *this;
+    }
 
-  void set_string(const char* name, const std::string& value) {
-    set_string(name, value.c_str());
-  }
-  void set_string(const std::string& name, const std::string& value) {
-    set_string(name.c_str(), value.c_str());
-  }
+    /// Use already existed lua_State.
+    opt& use_state(lua_State* L) {
+      PEACALM_LUAW_ASSERT(L);
+      L_ = L;
+      return *this;
+    }
 
-  ///////////////////////// set raw pointer by wrapper /////////////////////////
+    /// Load user specified libs.
+    opt& custom_load(const std::vector<luaL_Reg>& l) {
+      libs_load_ = l;
+      return *this;
+    }
+    opt& custom_load(std::vector<luaL_Reg>&& l) {
+      libs_load_ = std::move(l);
+      return *this;
+    }
 
-  /// Pointer wrapper type
-  template <typename T>
-  using ptrw = const std::shared_ptr<T>;
+    /// Preload user specified libs.
+    opt& custom_preload(const std::vector<luaL_Reg>& l) {
+      libs_preload_ = l;
+      return *this;
+    }
+    opt& custom_preload(std::vector<luaL_Reg>&& l) {
+      libs_preload_ = std::move(l);
+      return *this;
+    }
 
-  /// Make a wrapper for a raw pointer.
-  /// (The raw pointer can't be pointer of smart ptr)
-  template <typename T>
-  static ptrw<T> make_ptrw(T* p);
+  private:
+    libopt                libopt_ = load;
+    bool                  exfunc_ = true;
+    lua_State*            L_      = nullptr;
+    std::vector<luaL_Reg> libs_load_;
+    std::vector<luaL_Reg> libs_preload_;
+    friend class luaw;
+  };
 
-  /**
-   * @brief Set a raw pointer by a wrapper (full userdata)
-   *
-   * A raw pointer in Lua is a light userdata, and it doesn't have per-value
-   * metatable. But a pointer wrapper is a full userdata, and it has per-value
-   * metatable.
-   *
-   * This method makes a wrapper for a raw pointer first, then set the wrapper
-   * into Lua. The pointer wrapper can access all members registered just like
-   * the raw pointer.
-   *
-   * It's user's responsibility to make sure the raw pointer is valid while
-   * using it in Lua. Otherwize the behavior is undefined.
-   *
-   * @tparam T The type that the raw pointer points to. Can't be smart pointers.
-   * @param name The pointer wrapper's name used in Lua.
-   * @param p The raw pointer.
-   */
-  template <typename T>
-  void set_ptr_by_wrapper(const char* name, T* p) {
-    set(name, make_ptrw<T>(p));
-  }
-  template <typename T>
-  void set_ptr_by_wrapper(const std::string& name, T* p) {
-    set_ptr_by_wrapper<T>(name.c_str(), p);
-  }
+  // Default constructor
+  luaw(const opt& o = opt{}) { init(o); }
 
-  ///////////////////////// get global variables ///////////////////////////////
+  luaw(lua_State* L) : L_(L) {}
 
-  /**
-   * @brief Get a global variable in Lua and convert it to simple C++ type.
-   *
-   * @param [in] name The variable's name.
-   * @param [in] def The default value returned if failed or target does not
-   * exist.
-   * @param [in] disable_log Whether print a log when exception occurs.
-   * @param [out] failed Will be set whether the operation is failed if this
-   * pointer is not nullptr.
-   * @param [out] exists Set whether the variable exists. Regard none and nil as
-   * not exists.
-   * @return Return the variable's value if the variable exists and conversion
-   * succeeded.
-   *
-   * @{
-   */
+  // Not copyable
+  luaw(const luaw&) = delete;
 
-#define DEFINE_GLOBAL_GET(typename, type, default)                         \
-  type get_##typename(const char* name,                                    \
-                      const type& def         = default,                   \
-                      bool        disable_log = false,                     \
-                      bool*       failed      = nullptr,                   \
-                      bool*       exists      = nullptr) {                            \
-    getglobal(name);                                                       \
-    type ret = to_##typename(-1, def, disable_log, failed, exists);        \
-    pop();                                                                 \
-    return ret;                                                            \
-  }                                                                        \
-  type get_##typename(const std::string& name,                             \
-                      const type&        def         = default,            \
-                      bool               disable_log = false,              \
-                      bool*              failed      = nullptr,            \
-                      bool*              exists      = nullptr) {                            \
-    return get_##typename(name.c_str(), def, disable_log, failed, exists); \
-  }
+  // Movable
+  luaw(luaw&& l) : L_(l.release()) {}
 
-  DEFINE_GLOBAL_GET(bool, bool, false)
-  DEFINE_GLOBAL_GET(int, int, 0)
-  DEFINE_GLOBAL_GET(uint, unsigned int, 0)
-  DEFINE_GLOBAL_GET(long, long, 0)
-  DEFINE_GLOBAL_GET(ulong, unsigned long, 0)
-  DEFINE_GLOBAL_GET(llong, long long, 0)
-  DEFINE_GLOBAL_GET(ullong, unsigned long long, 0)
-  DEFINE_GLOBAL_GET(float, float, 0)
-  DEFINE_GLOBAL_GET(double, double, 0)
-  DEFINE_GLOBAL_GET(ldouble, long double, 0)
-  DEFINE_GLOBAL_GET(string, std::string, "")
-#undef DEFINE_GLOBAL_GET
+  luaw& operator=(const luaw&) = delete;
 
-  // NO POP! Because the c_str body is in stack.
-  // Caller is responsible for popping stack.
-  // You'd better use get_string unless you know the difference.
-  const char* get_c_str(const char* name,
-                        const char* def         = "",
-                        bool        disable_log = false,
-                        bool*       failed      = nullptr,
-                        bool*       exists      = nullptr) {
-    getglobal(name);
-    return to_c_str(-1, def, disable_log, failed, exists);
-  }
-  const char* get_c_str(const std::string& name,
-                        const char*        def         = "",
-                        bool               disable_log = false,
-                        bool*              failed      = nullptr,
-                        bool*              exists      = nullptr) {
-    return get_c_str(name.c_str(), def, disable_log, failed, exists);
+  luaw& operator=(luaw&& r) {
+    if (this == &r) {
+      // do nothing
+    } else if (L_ == r.L()) {
+      r.L(nullptr);
+    } else {
+      close();
+      L(r.release());
+    }
+    return *this;
   }
 
-  /** @} */
+  ~luaw() { close(); }
 
-  /**
-   * @brief Get a global variable in Lua and convert it to complex C++ type.
-   *
-   * @sa method "to"
-   *
-   * @tparam T The result type user expected.
-   * @param [in] name The variable's name.
-   * @param [in] disable_log Whether print a log when exception occurs.
-   * @param [out] failed Will be set whether the operation is failed if this
-   * pointer is not nullptr. If T is a container type, it regards the operation
-   * as failed if any element failed.
-   * @param [out] exists Set whether the variable exists. Regard none and nil as
-   * not exists.
-   * @return Return the value with given name in type T if conversion succeeds,
-   * otherwise, if T is a simple type (e.g. bool, int, double, std::string,
-   * etc), return initial value of T(i.e. by statement `T{}`), if T is a
-   * container type, the result will contain all non-nil elements whose
-   * conversion succeeded and discard elements who are nil or elements whose
-   * conversion failed.
-   *
-   */
-  template <typename T>
-  T get(const char* name,
-        bool        disable_log = false,
-        bool*       failed      = nullptr,
-        bool*       exists      = nullptr) {
-    auto _g = make_guarder();
-    getglobal(name);
-    return to<T>(-1, disable_log, failed, exists);
-  }
-  template <typename T>
-  T get(const std::string& name,
-        bool               disable_log = false,
-        bool*              failed      = nullptr,
-        bool*              exists      = nullptr) {
-    return get<T>(name.c_str(), disable_log, failed, exists);
+  void init(const opt& o = opt{}) {
+    // Initialize lua_State
+    if (o.L_) {
+      L_ = o.L_;
+    } else {
+      L_ = luaL_newstate();
+    }
+
+    // Initialize standard libs
+    if (o.libopt_ == opt::libopt::load) {
+      // Load all libs, which is costly
+      luaL_openlibs(L_);
+    } else if (o.libopt_ == opt::libopt::preload) {
+      // Preload all libs, which is light
+      preload_libs();
+    } else if (o.libopt_ == opt::libopt::lazy) {
+      // Load libs on first access, which is light
+      lazy_load_libs();
+    }
+
+    // Register extended functions
+    if (o.exfunc_) { register_exfunctions(); }
+
+    // Load user specified libs
+    if (!o.libs_load_.empty()) {
+      for (const luaL_Reg& l : o.libs_load_) {
+        luaL_requiref(L_, l.name, l.func, 1);
+        pop();
+      }
+    }
+
+    // Preload user specified libs
+    if (!o.libs_preload_.empty()) {
+      // Should load base and package first for any preload.
+      luaL_requiref(L_, LUA_GNAME, luaopen_base, 1);
+      luaL_requiref(L_, LUA_LOADLIBNAME, luaopen_package, 1);
+      getfield(-1, "preload");
+      for (const luaL_Reg& l : o.libs_preload_) {
+        pushcfunction(l.func);
+        setfield(-2, l.name);
+      }
+      pop(3);
+    }
   }
 
-/**
- * @brief Recursively get values in Lua and convert it to simple C++ type.
- *
- * @param [in] path The first key in path should be a Lua global variable,
- * the last key in path should be a value which can convert to expected type,
- * excpet for the last key, all other keys in path should be Lua table.
- * @param [in] def The default value returned if failed or target does not
- * exist.
- * @param [in] disable_log Whether print a log when exception occurs.
- * @param [out] failed Will be set whether the operation is failed if this
- * pointer is not nullptr. If T is a container type, it regards the operation
- * as failed if any element failed.
- * @param [out] exists Set whether the variable exists. Regard none and nil as
- * not exists.
- *
- * @{
- */
-#define DEFINE_RECURSIVE_GET_SIMPLE_TYPE(typename, type, default)              \
-  type get_##typename(const std::initializer_list<const char*>& path,          \
-                      const type&                               def = default, \
-                      bool  disable_log                             = false,   \
-                      bool* failed                                  = nullptr, \
-                      bool* exists                                  = nullptr) {                                \
-    return __get<type>(                                                        \
-        path.begin(), path.end(), def, disable_log, failed, exists);           \
-  }                                                                            \
-  type get_##typename(const std::initializer_list<std::string>& path,          \
-                      const type&                               def = default, \
-                      bool  disable_log                             = false,   \
-                      bool* failed                                  = nullptr, \
-                      bool* exists                                  = nullptr) {                                \
-    return __get<type>(                                                        \
-        path.begin(), path.end(), def, disable_log, failed, exists);           \
-  }                                                                            \
-  type get_##typename(const std::vector<const char*>& path,                    \
-                      const type&                     def         = default,   \
-                      bool                            disable_log = false,     \
-                      bool*                           failed      = nullptr,   \
-                      bool*                           exists      = nullptr) {                                \
-    return __get<type>(                                                        \
-        path.begin(), path.end(), def, disable_log, failed, exists);           \
-  }                                                                            \
-  type get_##typename(const std::vector<std::string>& path,                    \
-                      const type&                     def         = default,   \
-                      bool                            disable_log = false,     \
-                      bool*                           failed      = nullptr,   \
-                      bool*                           exists      = nullptr) {                                \
-    return __get<type>(                                                        \
-        path.begin(), path.end(), def, disable_log, failed, exists);           \
+  void close() {
+    if (L_) {
+      lua_close(L_);
+      L_ = nullptr;
+    }
   }
 
-  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(bool, bool, false)
-  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(int, int, 0)
-  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(uint, unsigned int, 0)
-  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(long, long, 0)
-  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(ulong, unsigned long, 0)
-  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(llong, long long, 0)
-  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(ullong, unsigned long long, 0)
-  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(float, float, 0)
-  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(double, double, 0)
-  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(ldouble, long double, 0)
-  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(string, std::string, "")
-#undef DEFINE_RECURSIVE_GET_SIMPLE_TYPE
+  void reset(const opt& o = opt{}) {
+    close();
+    init(o);
+  }
 
-  /** @} */
+  void preload_libs() {
+    // Should load base and package first for any preload.
+    luaL_requiref(L_, LUA_GNAME, luaopen_base, 1);
+    luaL_requiref(L_, LUA_LOADLIBNAME, luaopen_package, 1);
+    getfield(-1, "preload");
+    static const luaL_Reg preloadlibs[] = {{LUA_COLIBNAME, luaopen_coroutine},
+                                           {LUA_TABLIBNAME, luaopen_table},
+                                           {LUA_IOLIBNAME, luaopen_io},
+                                           {LUA_OSLIBNAME, luaopen_os},
+                                           {LUA_STRLIBNAME, luaopen_string},
+                                           {LUA_MATHLIBNAME, luaopen_math},
+                                           {LUA_UTF8LIBNAME, luaopen_utf8},
+                                           {LUA_DBLIBNAME, luaopen_debug},
+                                           {NULL, NULL}};
+    for (const luaL_Reg* p = preloadlibs; p->func; ++p) {
+      pushcfunction(p->func);
+      setfield(-2, p->name);
+    }
+    pop(3);
+  }
 
   /**
-   * @brief Recursively get values in Lua and convert it to complex C++ type.
-   *
-   * No default value provided. If T is not a container type, it will return T's
-   * initial value if operation fails or target does not exist. If T is a
-   * container type, the result will contain elements that successfully
-   * converted and discard elements fails or not exists. Regard none and nil as
-   * not exists.
-   *
-   * @param [in] path The first key in path should be a Lua global variable,
-   * the last key in path should be a value which can convert to expected type,
-   * excpet for the last key, all other keys in path should be Lua table.
-   * @param [in] disable_log Whether print a log when exception occurs.
-   * @param [out] failed Will be set whether the operation is failed if this
-   * pointer is not nullptr. If T is a container type, it regards the operation
-   * as failed if any element failed.
-   * @param [out] exists Set whether the variable exists. Regard none and nil as
-   * not exists.
+   * @brief Load the base lib now, and other standard libs on first access.
    *
-   * @{
+   * Set a metatable to _G whose "__index" loads a standard lib when its name
+   * is accessed (or "require" for the package lib), then sets it to _G. The
+   * string lib is also loaded when a string method is called or a string is
+   * used in arithmetic. Loading the package lib preloads others, so they can
+   * be required.
    */
-  template <typename T>
-  T get(const std::initializer_list<const char*>& path,
-        bool                                      disable_log = false,
-        bool*                                     failed      = nullptr,
-        bool*                                     exists      = nullptr) {
-    return __get<T>(path.begin(), path.end(), disable_log, failed, exists);
+  void lazy_load_libs() {
+    luaL_requiref(L_, LUA_GNAME, luaopen_base, 1);
+    pop();
+    pushglobaltable();
+    if (!getmetatable(-1)) newtable();
+    pushcfunction(lazy_libs_index);
+    setfield(-2, "__index");
+    setmetatable(-2);
+    pop();
+
+    // Strings' metatable will be replaced when loading the string lib.
+    // Arithmetic metamethods also load it, for coercion of strings to numbers.
+    pushstring("");
+    newtable();
+    pushcfunction(lazy_string_index);
+    setfield(-2, "__index");
+    for (const char* e : {"__add",
+                          "__sub",
+                          "__mul",
+                          "__mod",
+                          "__pow",
+                          "__div",
+                          "__idiv",
+                          "__unm"}) {
+      pushstring(e);
+      pushcclosure(lazy_string_arith, 1);
+      setfield(-2, e);
+    }
+    setmetatable(-2);
+    pop();
   }
-  template <typename T>
-  T get(const std::initializer_list<std::string>& path,
-        bool                                      disable_log = false,
-        bool*                                     failed      = nullptr,
-        bool*                                     exists      = nullptr) {
-    return __get<T>(path.begin(), path.end(), disable_log, failed, exists);
+
+  /// Register a global function. Equivalent to `set(fname, f)`.
+  void register_gf(const char* fname, lua_cfunction_t f) {
+    PEACALM_LUAW_ASSERT(fname);
+    lua_register(L_, fname, f);
   }
-  template <typename T>
-  T get(const std::vector<const char*>& path,
-        bool                            disable_log = false,
-        bool*                           failed      = nullptr,
-        bool*                           exists      = nullptr) {
-    return __get<T>(path.begin(), path.end(), disable_log, failed, exists);
+
+  /// Register extended functions.
+  void register_exfunctions() {
+    register_gf("IF", luaexf::IF);
+    register_gf("SET", luaexf::SET);
+    register_gf("COUNTER", luaexf::COUNTER);
+    register_gf("COUNTER0", luaexf::COUNTER0);
   }
-  template <typename T>
-  T get(const std::vector<std::string>& path,
-        bool                            disable_log = false,
-        bool*                           failed      = nullptr,
-        bool*                           exists      = nullptr) {
-    return __get<T>(path.begin(), path.end(), disable_log, failed, exists);
+
+private:
+  // Standard libs which could be loaded lazily.
+  static const luaL_Reg* lazy_libs() {
+    static const luaL_Reg libs[] = {{LUA_LOADLIBNAME, luaopen_package},
+                                    {LUA_COLIBNAME, luaopen_coroutine},
+                                    {LUA_TABLIBNAME, luaopen_table},
+                                    {LUA_IOLIBNAME, luaopen_io},
+                                    {LUA_OSLIBNAME, luaopen_os},
+                                    {LUA_STRLIBNAME, luaopen_string},
+                                    {LUA_MATHLIBNAME, luaopen_math},
+                                    {LUA_UTF8LIBNAME, luaopen_utf8},
+                                    {LUA_DBLIBNAME, luaopen_debug},
+                                    {NULL, NULL}};
+    return libs;
+  }
+
+  // If the key at index "kidx" is name of a standard lib not loaded yet, load
+  // it, push the global value of the key and return true. Otherwise push
+  // nothing and return false.
+  static bool lazy_load_lib(lua_State* L, int kidx) {
+    if (lua_type(L, kidx) != LUA_TSTRING) return false;
+    const char* name = lua_tostring(L, kidx);
+    if (strcmp(name, "require") == 0) {
+      luaL_requiref(L, LUA_LOADLIBNAME, luaopen_package, 1);
+      lazy_preload_libs(L);
+      lua_pop(L, 1);
+      lua_pushglobaltable(L);
+      lua_pushvalue(L, kidx);
+      lua_rawget(L, -2);
+      lua_remove(L, -2);
+      return true;
+    }
+    for (const luaL_Reg* p = lazy_libs(); p->func; ++p) {
+      if (strcmp(name, p->name) == 0) {
+        luaL_requiref(L, p->name, p->func, 1);
+        if (p->func == luaopen_package) lazy_preload_libs(L);
+        return true;
+      }
+    }
+    return false;
   }
 
-  /** @} */
+  // Whether the name is a global loaded lazily by lazy_load_libs, which is
+  // not a raw member of _G before loaded.
+  static bool is_lazy_lib_name(const char* name) {
+    if (strcmp(name, "require") == 0) return true;
+    for (const luaL_Reg* p = lazy_libs(); p->func; ++p) {
+      if (strcmp(name, p->name) == 0) return true;
+    }
+    return false;
+  }
 
-  /// Options used as first parameter for "lget".
-  struct lgetopt {
-    bool  disable_log;
-    bool *failed, *exists;
-    lgetopt(bool d = false, bool* f = nullptr, bool* e = nullptr)
-        : disable_log(d), failed(f), exists(e) {}
-  };
+  // Whether _G loads standard libs lazily by lazy_load_libs.
+  bool lazy_libs_enabled() const {
+    bool ret = false;
+    lua_pushglobaltable(L_);
+    if (lua_getmetatable(L_, -1)) {
+      lua_getfield(L_, -1, "__index");
+      ret = lua_tocfunction(L_, -1) == lazy_libs_index;
+      lua_pop(L_, 2);
+    }
+    lua_pop(L_, 1);
+    return ret;
+  }
 
-  /// Long get. Args is the path to get value.
-  template <typename T, typename... Args>
-  T lget(const lgetopt& o, Args&&... args) {
-    static_assert(sizeof...(Args) > 0, "lget needs at least one key in path");
-    auto _g = make_guarder();
-    lseek(std::forward<Args>(args)...);
-    return to<T>(-1, o.disable_log, o.failed, o.exists);
+  // Preload other libs into the package lib on top of stack.
+  static void lazy_preload_libs(lua_State* L) {
+    lua_getfield(L, -1, "preload");
+    for (const luaL_Reg* p = lazy_libs(); p->func; ++p) {
+      if (p->func == luaopen_package) continue;
+      lua_pushcfunction(L, p->func);
+      lua_setfield(L, -2, p->name);
+    }
+    lua_pop(L, 1);
   }
 
-private:
-  template <typename T, typename Iterator>
-  T __get(Iterator b,
-          Iterator e,
-          bool     disable_log = false,
-          bool*    failed      = nullptr,
-          bool*    exists      = nullptr) {
-    if (b == e) {
-      if (failed) *failed = false;
-      if (exists) *exists = false;
-      return T();
-    }
-    auto _g = make_guarder();
-    auto it = b;
-    gseek(*it++);
-    if (it == e) { return to<T>(-1, disable_log, failed, exists); }
-    while (it != e) {
-      if (isnoneornil()) {
-        if (failed) *failed = false;
-        if (exists) *exists = false;
-        return T();
-      }
-      if (!(istable() || indexable())) {
-        if (failed) *failed = true;
-        if (exists) *exists = true;
-        if (!disable_log)
-          log_type_convert_error(-1, "table or indexable value");
-        return T();
-      }
-      seek(*it++);
-    }
-    return to<T>(-1, disable_log, failed, exists);
+  // "__index" of _G's metatable set by lazy_load_libs.
+  static int lazy_libs_index(lua_State* L) {
+    return lazy_load_lib(L, 2) ? 1 : 0;
   }
 
-  template <typename T, typename Iterator>
-  T __get(Iterator b,
-          Iterator e,
-          const T& def,
-          bool     disable_log = false,
-          bool*    failed      = nullptr,
-          bool*    exists      = nullptr) {
-    bool tfailed, texists;
-    auto ret = __get<T>(b, e, disable_log, &tfailed, &texists);
-    if (failed) *failed = tfailed;
-    if (exists) *exists = texists;
-    if (tfailed || !texists) return def;
-    return ret;
+  // "__index" of strings' metatable set by lazy_load_libs.
+  static int lazy_string_index(lua_State* L) {
+    luaL_requiref(L, LUA_STRLIBNAME, luaopen_string, 1);
+    lua_pushvalue(L, 2);
+    lua_rawget(L, -2);
+    return 1;
   }
 
-public:
-  //////////////////////// call Lua function ///////////////////////////////////
-
-  /// Call a global Lua function specified by name using C++ parameters.
-  /// Should at least provide return type.
-  template <typename Return, typename... Args>
-  Return callf(const char* fname, const Args&... args) {
-    PEACALM_LUAW_ASSERT(fname);
-    auto f = get<luaw::function<Return(Args...)>>(fname);
-    return f(args...);
-  }
-  template <typename Return, typename... Args>
-  Return callf(const std::string& fname, const Args&... args) {
-    auto f = get<luaw::function<Return(Args...)>>(fname);
-    return f(args...);
+  // Arithmetic metamethods of strings' metatable set by lazy_load_libs, whose
+  // upvalue is the event name. Load the string lib and redispatch to the same
+  // metamethod of it.
+  static int lazy_string_arith(lua_State* L) {
+    luaL_requiref(L, LUA_STRLIBNAME, luaopen_string, 1);
+    lua_pop(L, 1);
+    lua_pushliteral(L, "");
+    luaL_getmetafield(L, -1, lua_tostring(L, lua_upvalueindex(1)));
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, 2);
+    lua_call(L, 2, 1);
+    return 1;
   }
 
-  /// Call a Lua function specified by path using C++ parameters.
-  template <typename Return, typename... Args>
-  Return callf(const std::initializer_list<const char*>& path,
-               const Args&... args) {
-    auto f = get<luaw::function<Return(Args...)>>(path);
-    return f(args...);
-  }
-  template <typename Return, typename... Args>
-  Return callf(const std::initializer_list<std::string>& path,
-               const Args&... args) {
-    auto f = get<luaw::function<Return(Args...)>>(path);
-    return f(args...);
-  }
-  template <typename Return, typename... Args>
-  Return callf(const std::vector<const char*>& path, const Args&... args) {
-    auto f = get<luaw::function<Return(Args...)>>(path);
-    return f(args...);
+public:
+  /// Release the ownership of contained Lua State.
+  /// The caller is responsible for closing the Lua State.
+  lua_State* release() {
+    lua_State* ret = L_;
+    L_             = nullptr;
+    return ret;
   }
-  template <typename Return, typename... Args>
-  Return callf(const std::vector<std::string>& path, const Args&... args) {
-    auto f = get<luaw::function<Return(Args...)>>(path);
-    return f(args...);
+
+  // Get and set lua_State.
+  lua_State* L() const { return L_; }
+  void       L(lua_State* L) { L_ = L; }
+  void       clearL() { L_ = nullptr; }
+
+  /// Generate a subluaw by a new thread and a ref_id to it.
+  subluaw make_subluaw();
+
+  /// Convert given index to absolute index of stack. It won't change idx's
+  /// value if abs(idx) > topsize, this is different with lua_absindex.
+  /// e.g. abs_index(LUA_REGISTRYINDEX) -> LUA_REGISTRYINDEX.
+  int abs_index(int idx) {
+    return idx < 0 && -idx <= gettop() ? gettop() + idx + 1 : idx;
   }
 
-  //////////////////////// register ctor/memeber for class /////////////////////
+  // Stack operations
+  void pop(int n = 1) { lua_pop(L_, n); }
+  int  gettop() const { return lua_gettop(L_); }
+  void settop(int idx) { lua_settop(L_, idx); }
+  void cleartop() { settop(0); }
+
+  /// Whether enough for at least n extra elements.
+  bool checkstack(int n) { return lua_checkstack(L_, n); }
+
+  // clang-format off
+  int loadstring(const char*        s)   { return luaL_loadstring(L_, s); }
+  int loadstring(const std::string& s)   { return __loadbuffer(s.data(), s.size(), s.c_str()); }
+  int dostring(const char*        s)     { return luaL_dostring(L_, s); }
+  int dostring(const std::string& s)     { return loadstring(s) || lua_pcall(L_, 0, LUA_MULTRET, 0); }
+  int loadfile(const char*        fname) { return __loadfile(fname); }
+  int loadfile(const std::string& fname) { return loadfile(fname.c_str()); }
+  int dofile(const char*        fname)   { return loadfile(fname) || lua_pcall(L_, 0, LUA_MULTRET, 0); }
+  int dofile(const std::string& fname)   { return dofile(fname.c_str()); }
+  // clang-format on
 
   /**
-   * @brief Register a global function to Lua who can create object.
+   * @brief Load a buffer with given length as a Lua chunk.
    *
-   * It creates a userdata in Lua, whose C++ type is specified by Return type
-   * of Ctor. e.g. register_ctor<Object(int)>("NewObject"). Then can run
-   * "o = NewObject(1)" in Lua.
+   * The buffer needn't be NUL-terminated, e.g. a slice of a larger buffer.
    *
-   * @tparam Ctor Should be a function type of "Return(Args...)".
-   * @param fname The global function name registered.
+   * @param [in] s The buffer.
+   * @param [in] len Length of the buffer.
+   * @param [in] chunkname Chunk name used in error messages. If it is nullptr,
+   * use the beginning of the buffer like loadstring does.
+   * @return Same as luaL_loadbuffer.
    */
-  template <typename Ctor>
-  void register_ctor(const char* fname) {
-    static_assert(std::is_function<Ctor>::value,
-                  "Ctor should be type of Return(Args...)");
-    PEACALM_LUAW_ASSERT(fname);
-    register_ctor_impl<std::decay_t<Ctor>>::register_ctor(*this, fname);
+  int loadstring(const char* s, size_t len, const char* chunkname = nullptr) {
+    return __loadbuffer(s, len, chunkname);
   }
-  template <typename Ctor>
-  void register_ctor(const std::string& fname) {
-    register_ctor<Ctor>(fname.c_str());
+
+  /// Load and run a buffer with given length. @sa loadstring
+  int dostring(const char* s, size_t len, const char* chunkname = nullptr) {
+    return loadstring(s, len, chunkname) || lua_pcall(L_, 0, LUA_MULTRET, 0);
   }
 
-  /**
-   * @brief Register member variables or member functions
-   *
-   * Register a real member for class, not fake members.
-   *
-   * To register overloaded member functions, the template parameter
-   * `MemberPointer` must be provided explicitly.
-   * Otherwise, when registering member variables or non-overloaded member
-   * functions, `MemberPointer` can be automatically deduced.
-   *
-   * Example:
-   *
-   * Register int member "i" for class "Obj":
-   *   `register_member("i", &Obj::i)`
-   * or explicitly provide member type:
-   *   `register_member<int Obj::*>("i", &Obj::i)`
-   *
-   * Register member function "abs" for class "Obj":
-   *   `register_member("abs", &Obj::abs)`
-   * or explicitly provide member type:
-   *   `register_member<int (Obj::*)()>("abs", &Obj::abs)`
-   *
-   * @tparam MemberPointer Member pointer type.
-   * @param name Member name to be registered.
-   * @param mp Pointer to the member to be registered.
-   * @return void
-   */
-  template <typename MemberPointer>
-  std::enable_if_t<std::is_member_pointer<MemberPointer>::value>
-  register_member(const char* name, MemberPointer mp) {
-    PEACALM_LUAW_ASSERT(name);
-    PEACALM_LUAW_ASSERT(mp);
-    registrar<std::decay_t<MemberPointer>>::register_member(
-        *this, name, std::mem_fn(mp));
+#if PEACALM_LUAW_SUPPORT_CPP17
+  int loadstring(std::string_view s, const char* chunkname = nullptr) {
+    return loadstring(s.data(), s.size(), chunkname);
   }
-  template <typename MemberPointer>
-  std::enable_if_t<std::is_member_pointer<MemberPointer>::value>
-  register_member(const std::string& name, MemberPointer mp) {
-    register_member<MemberPointer>(name.c_str(), mp);
+  int dostring(std::string_view s, const char* chunkname = nullptr) {
+    return dostring(s.data(), s.size(), chunkname);
+  }
+#endif
+
+private:
+  // Load a buffer which may be not NUL-terminated. If chunkname is nullptr,
+  // use a copy of the buffer's beginning as chunk name, which gives the same
+  // error messages as luaL_loadstring since Lua shows at most LUA_IDSIZE
+  // characters of a chunk name.
+  int __loadbuffer(const char* s, size_t len, const char* chunkname) {
+    PEACALM_LUAW_ASSERT(s || len == 0);
+    if (chunkname) return luaL_loadbufferx(L_, s, len, chunkname, nullptr);
+    char   name[LUA_IDSIZE];
+    size_t n = std::min(len, sizeof(name) - 1);
+    if (n > 0) memcpy(name, s, n);
+    name[n] = '\0';
+    return luaL_loadbufferx(L_, s, len, name, nullptr);
   }
 
+public:
+
+  /// Statistics of the bytecode cache for loadfile/dofile.
+  struct bytecode_cache_stats {
+    size_t hits   = 0;
+    size_t misses = 0;
+    size_t writes = 0;
+  };
+
   /**
-   * @brief Register a fake member variable or fake member function.
-   *
-   * Fake members are members who are not directly explicitly defined as members
-   * in a C++ class, but used in Lua and by some way they can reach to values or
-   * functions in C++.
-   *
-   * The values reached by fake members could be real members, or temporary
-   * values generated by some method, or even variables outside the calss, e.g.
-   * some global variables.
+   * @brief Enable a persistent bytecode cache for loadfile and dofile.
    *
-   * In particular, we can fake members by class's static members.
-   *
-   * To register a fake member, we must provide a Hint type to indicate the
-   * mermber's type to be faked, and a callable object to describe the member's
-   * behavior. The first argument of the callable object must represent the
-   * class which the members faked belong to, usually we use a pointer to the
-   * class.
-   *
-   * For example:
-   *
-   * Register a const member "id" with type void* for class Obj to get its
-   * instance's address:
-   *     `register_member<void* const Obj::*>("id", [](const Obj* p) {
-   *         return (void*)p; });`
-   *
-   * Register a member function "plus" for class Obj:
-   *     `register_member<void (Obj::*)(int)>("plus", [](Obj* p, int d) {
-   *         p->value += d; })`
-   *
-   * Register a const member function "getvalue" for class Obj:
-   *     `register_member<int (Obj::*)() const>("getvalue", [](const Obj* p) {
-   *         return p->value; })`
+   * When loading a script file, its compiled bytecode is dumped into a cache
+   * file in the given directory. Later loadings of the same file, even by
+   * other Lua states or processes, load the bytecode directly instead of
+   * compiling again, if path, modification time and content hash of the
+   * source file are all unchanged, and the cache file passes version and
+   * integrity checks. Otherwise it falls back to the source file.
    *
-   * @tparam Hint The member type wanted to fake.
-   * @tparam F C function type or lambda or std::function or any callable type.
-   * @param name The member name.
-   * @param f The function whose first parameter is a pointer to the class.
-   * @return void.
+   * @param [in] dir Directory to store cache files. On POSIX and Windows, it
+   * will be created if not exists, but its parent directory must exist. On
+   * other platforms it must exist, since it's neither checked nor created.
+   * @return Whether the directory is available.
    */
-  template <typename Hint, typename F>
-  std::enable_if_t<std::is_member_pointer<Hint>::value &&
-                   !std::is_same<Hint, F>::value>
-  register_member(const char* name, F&& f) {
-    PEACALM_LUAW_ASSERT(name);
-    registrar<std::decay_t<Hint>>::register_member(
-        *this, name, mock_mem_fn<F>(std::forward<F>(f)));
+  bool enable_bytecode_cache(const std::string& dir) {
+    PEACALM_LUAW_ASSERT(!dir.empty());
+    if (!luaw_detail::make_dir(dir.c_str())) return false;
+    __new_registry_object<luaw_detail::bytecode_cache>(bytecode_cache_key(),
+                                                       dir);
+    return true;
+  }
+
+  /// Disable the bytecode cache. Cache files are kept.
+  void disable_bytecode_cache() {
+    __delete_registry_object(bytecode_cache_key());
+  }
+
+  /// Whether the bytecode cache is enabled.
+  bool bytecode_cache_enabled() const { return get_bytecode_cache(); }
+
+  /// Get statistics of the bytecode cache. All zero if not enabled.
+  bytecode_cache_stats get_bytecode_cache_stats() const {
+    bytecode_cache_stats          ret;
+    luaw_detail::bytecode_cache* c = get_bytecode_cache();
+    if (c) {
+      ret.hits   = c->hits();
+      ret.misses = c->misses();
+      ret.writes = c->writes();
+    }
+    return ret;
   }
-  template <typename Hint, typename F>
-  std::enable_if_t<std::is_member_pointer<Hint>::value &&
-                   !std::is_same<Hint, F>::value>
-  register_member(const std::string& name, F&& f) {
-    register_member<Hint, F>(name.c_str(), std::forward<F>(f));
+
+  /// Get path of the cache file for a script file. Empty if not enabled.
+  std::string get_bytecode_cache_file(const std::string& fname) const {
+    luaw_detail::bytecode_cache* c = get_bytecode_cache();
+    return c ? c->cache_file(fname.c_str()) : std::string();
   }
 
-  /**
-   * @brief Register a static member by providing class type.
-   *
-   * Can register static member variables or functions.
-   * Also can register global functions or global variables or local variables
-   * (should better be static) to be members of an object in Lua.
-   *
-   * When registering a function it will register it as a const member function
-   * of object in Lua.
-   * When registering a variable it will register it as an usual member variable
-   * of object in Lua. In particular, the member can not be modified by a const
-   * object (this is different with that in C++).
-   *
-   * Should register the member by it's name and address.
-   *
-   * For example:
-   *
-   * Register static member `Obj::si` of type `int` to Obj in Lua:
-   * `register_static_member<Obj>("si", &Obj::si)`
-   *
-   * Register static member function `static int sf(int)` to Obj:
-   * `register_static_member<Obj>("sf", &Obj::sf)`
-   * or do not use "&" to get function's address is also ok:
-   * `register_static_member<Obj>("sf", Obj::sf)`
-   *
-   * @tparam Class The class whom the static member will belong to.
-   * @tparam Member The static member's type.
-   * @param name The static member's name.
-   * @param m The static member's pointer.
-   * @return void
-   */
-  template <typename Class, typename Member>
-  std::enable_if_t<std::is_class<Class>::value> register_static_member(
-      const char* name, Member* m) {
-    static_assert(std::is_same<Class, std::decay_t<Class>>::value,
-                  "Class type should be decayed");
-    PEACALM_LUAW_ASSERT(name);
-    PEACALM_LUAW_ASSERT(m);
+private:
+  static const void* bytecode_cache_key() {
+    return &typeid(luaw_detail::bytecode_cache);
+  }
 
-    // add const member property for function
-    using MemberPointer = std::conditional_t<
-        std::is_member_function_pointer<Member Class::*>::value,
-        luaw_detail::c_function_to_const_member_function_t<Class, Member>,
-        Member Class::*>;
+  luaw_detail::bytecode_cache* get_bytecode_cache() const {
+    return __get_registry_object<luaw_detail::bytecode_cache>(
+        bytecode_cache_key());
+  }
 
-    register_static_member<MemberPointer>(name, m);
+  int __loadfile(const char* fname) {
+    luaw_detail::bytecode_cache* c = fname ? get_bytecode_cache() : nullptr;
+    return c ? c->load(L_, fname) : luaL_loadfile(L_, fname);
   }
-  template <typename Class, typename Member>
-  std::enable_if_t<std::is_class<Class>::value> register_static_member(
-      const std::string& name, Member* m) {
-    register_static_member<Class, Member>(name.c_str(), m);
+
+public:
+
+  // clang-format off
+  bool isstring(int idx = -1)        const { return lua_isstring(L_, idx); }
+  bool isnumber(int idx = -1)        const { return lua_isnumber(L_, idx); }
+  bool isinteger(int idx = -1)       const { return lua_isinteger(L_, idx); }
+  bool isboolean(int idx = -1)       const { return lua_isboolean(L_, idx); }
+  bool isnil(int idx = -1)           const { return lua_isnil(L_, idx); }
+  bool isnone(int idx = -1)          const { return lua_isnone(L_, idx); }
+  bool isnoneornil(int idx = -1)     const { return lua_isnoneornil(L_, idx); }
+  bool istable(int idx = -1)         const { return lua_istable(L_, idx); }
+  bool iscfunction(int idx = -1)     const { return lua_iscfunction(L_, idx); }
+  bool isfunction(int idx = -1)      const { return lua_isfunction(L_, idx); }
+  bool isuserdata(int idx = -1)      const { return lua_isuserdata(L_, idx); }
+  bool islightuserdata(int idx = -1) const { return lua_islightuserdata(L_, idx); }
+  bool isthread(int idx = -1)        const { return lua_isthread(L_, idx); }
+  // clang-format on
+
+  // clang-format off
+  bool is_type_none(int idx = -1)          const { return lua_type(L_, idx) == LUA_TNONE; }
+  bool is_type_nil(int idx = -1)           const { return lua_type(L_, idx) == LUA_TNIL; }
+  bool is_type_boolean(int idx = -1)       const { return lua_type(L_, idx) == LUA_TBOOLEAN; }
+  bool is_type_lightuserdata(int idx = -1) const { return lua_type(L_, idx) == LUA_TLIGHTUSERDATA; }
+  bool is_type_number(int idx = -1)        const { return lua_type(L_, idx) == LUA_TNUMBER; }
+  bool is_type_string(int idx = -1)        const { return lua_type(L_, idx) == LUA_TSTRING; }
+  bool is_type_table(int idx = -1)         const { return lua_type(L_, idx) == LUA_TTABLE; }
+  bool is_type_function(int idx = -1)      const { return lua_type(L_, idx) == LUA_TFUNCTION; }
+  bool is_type_userdata(int idx = -1)      const { return lua_type(L_, idx) == LUA_TUSERDATA; }
+  bool is_type_thread(int idx = -1)        const { return lua_type(L_, idx) == LUA_TTHREAD; }
+  // clang-format on
+
+  int         type(int idx = -1) const { return lua_type(L_, idx); }
+  const char* type_name(int idx = -1) const {
+    return lua_typename(L_, type(idx));
   }
 
-  /**
-   * @brief Register a static member by providing full fake member pointer type.
-   *
-   * This API can add const/volatile property to member, which the origin static
-   * member may not have.
-   *
-   * Others all same as that API providing class.
-   *
-   * For example:
-   *
-   * Register static member `Obj::si` of type `int` to be a const member of Obj
-   * in Lua with type `const int`:
-   * `register_static_member<const int Obj::*>("si", &Obj::si)`
-   *
-   * Register static member function `static int sf(int)` as a const member
-   * function to Obj:
-   * `register_static_member<int(Obj::*)(int) const>("sf", &Obj::sf)`
-   *
-   * @tparam MemberPointer What kind of member type to let the static member
-   * behaves like in Lua.
-   * @tparam Member The static member's type.
-   * @param name The static member's name.
-   * @param m The static member's pointer.
-   * @return void
-   */
-  template <typename MemberPointer, typename Member>
-  std::enable_if_t<std::is_member_pointer<MemberPointer>::value>
-  register_static_member(const char* name, Member* m) {
-    PEACALM_LUAW_ASSERT(name);
-    PEACALM_LUAW_ASSERT(m);
-    static_assert(
-        std::is_same<MemberPointer, std::decay_t<MemberPointer>>::value,
-        "MemberPointer should be decayed");
-    registrar<std::decay_t<MemberPointer>>::register_member(
-        *this, name, static_mem_fn<Member*>(m));
+  // getxxx: return the type of the value pushed.
+  int gettable(int idx) { return lua_gettable(L_, idx); }
+  int geti(int idx, lua_integer_t n) { return lua_geti(L_, idx, n); }
+  int getp(int idx, const void* p) {
+    pushlightuserdata(p);
+    return gettable(idx);
   }
-  template <typename MemberPointer, typename Member>
-  std::enable_if_t<std::is_member_pointer<MemberPointer>::value>
-  register_static_member(const std::string& name, Member* m) {
-    register_static_member<MemberPointer, Member>(name.c_str(), m);
+  int getfield(int idx, const char* k) {
+    PEACALM_LUAW_ASSERT(k);
+    return lua_getfield(L_, idx, k);
   }
 
-  /**
-   * @brief Register dynamic members
-   *
-   * Dynamic members are members whose names (and also values) are dynamically
-   * defined at run time, such as keys of a table in Lua.
-   * So we can't register them in advance.
-   *
-   * To register dynamic members for a C++ class, it should have a place to
-   * store the members first, usually we can define a map in the class to store
-   * the dynamic members.
-   *
-   * Then we should provide two callable objects, getter and setter, which
-   * introduces Lua how to get and set a dynamic member separately.
-   *
-   * The getter's proto type must be: `Value(const Class*, Key)`
-   * The setter's proto type must be: `void(Class*, Key, Value)`
-   *
-   * Where `Key` type could be `const std::string&` or 'const char*', the former
-   * is recommended. `Value` type could be number, string, bool,
-   * luaw::luavalueidx, luaw::luavalueref, etc.
-   *
-   * @tparam Getter Must be a callable type, e.g. C function or lambda.
-   * @tparam Setter Must be a callable type, e.g. C function or lambda.
-   * @param getter A method to get a member by name.
-   * @param setter A method to set a member's value.
-   */
-  template <typename Getter, typename Setter>
-  void register_dynamic_member(Getter&& getter, Setter&& setter) {
-    register_dynamic_member_getter(std::forward<Getter>(getter));
-    register_dynamic_member_setter(std::forward<Setter>(setter));
+  void settable(int idx) { lua_settable(L_, idx); }
+  void seti(int idx, lua_integer_t n) { lua_seti(L_, idx, n); }
+  void setp(int idx, const void* p) {
+    int aidx = abs(idx);
+    pushlightuserdata(p);
+    pushvalue(-2);
+    settable(aidx);
+    pop();
   }
-  template <typename Getter>
-  void register_dynamic_member_getter(Getter&& getter);
-  template <typename Setter>
-  void register_dynamic_member_setter(Setter&& setter);
-
-  /**
-   * @brief Register a member's pointer into Lua.
-   *
-   * Register a fake member into Lua, the fake member is a pointer of a class's
-   * real member.
-   *
-   * Since when getting a member, it will return a copy of the member. So we
-   * can't modify or access efficiently members of the member.
-   *
-   * This feature is used to modify or access efficiently members'
-   * members by getting a member's pointer first then modify or access members
-   * of the member by the pointer.
-   *
-   * The fake member, namely the member's pointer, is always top-level const.
-   *
-   * When using a member's pointer, it is the user's responsibility to make
-   * sure the member is alive, which means the object which holds the member is
-   * alive. Using a pointer to an already recycled member is dangerous, the
-   * behavior is undefined.
-   *
-   *
-   * @tparam Class Should be decayed class type.
-   * @tparam Member Can't be raw pointer or smart pointer type.
-   * @param name The member's pointer name used in Lua.
-   * @param mp Member pointer value.
-   */
-  template <typename Class, typename Member>
-  void register_member_ptr(const char* name, Member Class::*mp) {
-    static_assert(std::is_same<Class, std::decay_t<Class>>::value,
-                  "Class must be decayed");
-    PEACALM_LUAW_ASSERT(name);
-    PEACALM_LUAW_ASSERT(mp);
-    registrar<Member Class::*, luaw::registrar_tag_for_member_ptr>::
-        register_member_ptr(*this, name, [=](auto& o) { return &(o.*mp); });
+  void setfield(int idx, const char* k) {
+    PEACALM_LUAW_ASSERT(k);
+    lua_setfield(L_, idx, k);
   }
-  template <typename Class, typename Member>
-  void register_member_ptr(const std::string& name, Member Class::*mp) {
-    register_member_ptr<Class, Member>(name.c_str(), mp);
+
+  int rawget(int idx) { return lua_rawget(L_, idx); }
+  int rawgeti(int idx, lua_integer_t n) { return lua_rawgeti(L_, idx, n); }
+  int rawgetp(int idx, const void* p) { return lua_rawgetp(L_, idx, p); }
+  int rawgetfield(int idx, const char* k) {
+    pushstring(k);
+    return rawget(idx);
   }
 
-  /**
-   * @brief Register a member's low-level const pointer into Lua.
-   *
-   * No matter whether the member is already const, this can always register a
-   * low-level const pointer of the member into Lua. (Of course the pointer is
-   * top-level const too.)
-   *
-   * This feature is used to access member of member, can't modify.
-   * Others are similar to "register_member_ptr"
-   *
-   * @sa "register_member_ptr"
-   */
-  template <typename Class, typename Member>
-  void register_member_cptr(const char* name, Member Class::*mp) {
-    register_member_ptr<Class, const Member>(name, mp);
+  void rawset(int idx) { lua_rawset(L_, idx); }
+  void rawseti(int idx, lua_integer_t n) { lua_rawseti(L_, idx, n); }
+  void rawsetp(int idx, const void* p) { lua_rawsetp(L_, idx, p); }
+  void rawsetfield(int idx, const char* k) {
+    int aidx = abs(idx);
+    pushstring(k);
+    pushvalue(-2);
+    rawset(aidx);
+    pop();
   }
-  template <typename Class, typename Member>
-  void register_member_cptr(const std::string& name, Member Class::*mp) {
-    register_member_cptr<Class, Member>(name.c_str(), mp);
+
+  /// Return whether the value at idx has a metatable, if true push the
+  /// metatable on top, otherwise push nothing and return false.
+  bool getmetatable(int idx) { return lua_getmetatable(L_, idx); }
+
+  /// Pop a table or nil and set it as metatable for value at idx.
+  void setmetatable(int idx) { lua_setmetatable(L_, idx); }
+
+  /// Push the metatable in regristry with name "tname" onto stack, if not
+  /// exists, create one. Return whether created a new metatable.
+  bool gtouchmetatb(const char* tname) { return luaL_newmetatable(L_, tname); }
+
+  void       newtable() { lua_newtable(L_); }
+  void*      newuserdata(size_t size) { return lua_newuserdata(L_, size); }
+  lua_State* newthread() { return lua_newthread(L_); }
+
+  /// Get main thread of a given thread.
+  static lua_State* get_main_thread_of(lua_State* L) {
+    if (!L) return nullptr;
+    lua_geti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+    lua_State* ret = lua_tothread(L, -1);
+    lua_pop(L, 1);
+    return ret;
   }
 
-  /**
-   * @brief Register a member's reference into Lua.
-   *
-   * When registering a member's pointer into Lua using "register_member_ptr",
-   * it registers a member's raw pointer, which is a light userdata, so it does
-   * not have an exclusive metatable, and it is very dangerous to use a light
-   * userdata with a wrong metatable.
-   *
-   * So this feature is to register a member's reference which can access and
-   * modify efficiently the member, just like "register_member_ptr", and have
-   * an exclusive metatable.
-   *
-   * Currently the reference is implimented by a std::shared_ptr holding a raw
-   * member's pointer and without deleter. So it is a full userdata and has
-   * per-value metatables.
-   *
-   * The member's reference is also a fake member, and is also always top-level
-   * const like member's pointer.
-   *
-   * When using a member's reference, it is the user's responsibility to make
-   * sure the member is alive, which means the object which holds the member is
-   * alive. Using a reference to an already recycled member is dangerous, the
-   * behavior is undefined.
-   *
-   * @tparam Class Should be decayed class type.
-   * @tparam Member Can't be raw pointer or smart pointer type.
-   * @param name The member's reference name used in Lua.
-   * @param mp Member pointer value.
-   * @sa "register_member_ptr"
-   */
-  template <typename Class, typename Member>
-  void register_member_ref(const char* name, Member Class::*mp) {
-    static_assert(std::is_same<Class, std::decay_t<Class>>::value,
-                  "Class must be decayed");
+  /// Get main thread.
+  lua_State* main_thread() const { return get_main_thread_of(L_); }
+
+  /// Push onto the stack the global value with given name.
+  /// Return the type of that value.
+  int getglobal(const char* name) {
     PEACALM_LUAW_ASSERT(name);
-    PEACALM_LUAW_ASSERT(mp);
-    registrar<Member Class::*, luaw::registrar_tag_for_member_ptr>::
-        register_member_ref(*this, name, std::mem_fn(mp));
+    return lua_getglobal(L_, name);
   }
-  template <typename Class, typename Member>
-  void register_member_ref(const std::string& name, Member Class::*mp) {
-    register_member_ref<Class, Member>(name.c_str(), mp);
+
+  /// Pop a value from the stack and set it as the new value of global "name".
+  void setglobal(const char* name) {
+    PEACALM_LUAW_ASSERT(name);
+    lua_setglobal(L_, name);
   }
 
-  /**
-   * @brief Register a member's low-level const reference into Lua.
-   *
-   * Like "register_member_ref", but this will register a low-level const
-   * reference (Of course it is also top-level const). The const reference can
-   * only be used to access members, can not modify.
-   *
-   * @sa "register_member_ref"
-   */
-  template <typename Class, typename Member>
-  void register_member_cref(const char* name, Member Class::*mp) {
-    register_member_ref<Class, const Member>(name, mp);
+  int pcall(int narg, int nret, int f) { return lua_pcall(L_, narg, nret, f); }
+
+  /// Whether the value at idx is indexable.
+  bool indexable(int idx = -1) const {
+    if (istable(idx)) return true;
+    if (lua_getmetatable(L_, idx) == 0) return false;
+    auto _g = make_guarder(gettop() - 1);
+    lua_getfield(L_, -1, "__index");
+    // if __index exists, then regard as indexable
+    bool ret = !isnoneornil(-1);
+    // maybe more checks?
+    return ret;
   }
-  template <typename Class, typename Member>
-  void register_member_cref(const std::string& name, Member Class::*mp) {
-    register_member_cref<Class, Member>(name.c_str(), mp);
+
+  /// Whether the value at idx is newindexable.
+  bool newindexable(int idx = -1) const {
+    if (istable(idx)) return true;
+    if (!lua_getmetatable(L_, idx)) return false;
+    auto _g = make_guarder(gettop() - 1);
+    lua_getfield(L_, -1, "__newindex");
+    // if __newindex exists, then regard as newindexable
+    bool ret = !isnoneornil(-1);
+    // maybe more checks?
+    return ret;
+  }
+
+  /// Whether the value at idx is indexable and newindexable.
+  bool indexable_and_newindexable(int idx = -1) const {
+    if (istable(idx)) return true;
+    if (!lua_getmetatable(L_, idx)) return false;
+    auto _g = make_guarder(gettop() - 1);
+    lua_getfield(L_, -1, "__index");
+    lua_getfield(L_, -2, "__newindex");
+    // if both __index and __newindex exists
+    bool ret = !isnoneornil(-1) && !isnoneornil(-2);
+    // maybe more checks?
+    return ret;
+  }
+
+  /// Whether the value at idx is callable.
+  bool callable(int idx = -1) const {
+    if (isfunction(idx)) return true;
+    if (!lua_getmetatable(L_, idx)) return false;
+    auto _g = make_guarder(gettop() - 1);
+    lua_getfield(L_, -1, "__call");
+    bool ret = !isnoneornil(-1);
+    return ret;
   }
 
+  ///////////////////////// type conversions ///////////////////////////////////
+
+  // NOTICE: Value conversions from Lua to C++ may be different with that in
+  // Lua!
+  //
+  // Conversion process: Firstly convert value in Lua to C++'s value with
+  // corresponding type, e.g. boolean to bool, integer to long long, number to
+  // double, string to string, then cast it to target type by C++'s type
+  // conversion strategy. Note that number in Lua is also string, and
+  // number-literal-string is also number.
+  //
+  // This lib mainly uses C++'s value conversion strategy, in addition, a
+  // implicitly conversion strategy between number and number-literal-string,
+  // which is supported by Lua.
+  //
+  // In total, this lib makes value conversions behave more like C++.
+  //
+  // Details:
+  // 1. Implicitly conversion between integer, number, boolean using
+  //    C++'s static_cast
+  // 2. Implicitly conversion between number and number-literal-string by Lua
+  // 3. When convert number 0 to boolean, will get false (not true as Lua does)
+  // 4. NONE and NIL won't convert to any value, default value (user given or
+  //    initial value of target type) will be returned
+  // 5. Non-number-literal-string, including empty string, can't convert to any
+  //    other types, default value will be returned (can't convert to true as
+  //    Lua does)
+  // 6. Integer's precision won't be lost if its value is representable by 64bit
+  //    signed integer type, i.e. between [-2^63, 2^63 -1], which is
+  //    [-9223372036854775808, 9223372036854775807]
+  //
+  // Examples:
+  // * number 2.5 -> string "2.5" (By Lua)
+  // * number 3 -> string "3.0" (By Lua)
+  // * integer 3 -> string "3" (By Lua)
+  // * string "2.5" -> double 2.5 (By Lua)
+  // * number 2.5 -> int 2 (By C++)
+  // * string "2.5" -> int 2 (Firstly "2.5"->2.5 by lua, then 2.5->2 by C++)
+  // * boolean true -> int 1 (By C++)
+  // * boolean false -> int 0 (By C++)
+  // * integer 0 -> bool false (By C++)
+  // * number 2.5 -> bool true (By C++)
+  // * string "2.5" -> bool true ("2.5"->2.5 by Lua, then 2.5->true by C++)
+  // * string "0" -> bool false ("0"->0 by Lua, then 0->false by C++)
+
   /**
-   * @brief Register a static member's pointer into Lua.
+   * @brief Convert a value in Lua stack to C++ simple type value.
    *
-   * @sa "register_static_member"
-   * @sa "register_member_ptr"
+   * @param [in] idx Index of Lua stack where the value in.
+   * @param [in] def The default value returned if conversion fails.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the convertion is failed if this
+   * pointer is not nullptr.
+   * @param [out] exists Will be set whether the value at given index exists if
+   * this pointer is not nullptr. Regard none and nil as not exists.
    *
-   * @tparam Class The class whom the static member will belong to. Must be a
-   * decayed class type.
-   * @tparam Member Type of the static member.
-   * @param name Name of the member's pointer used in Lua.
-   * @param mp The static member's pointer value.
+   * @{
    */
-  template <typename Class, typename Member>
-  void register_static_member_ptr(const char* name, Member* mp) {
-    static_assert(std::is_class<Class>::value,
-                  "Static members must belong to a class type");
-    static_assert(std::is_same<Class, std::decay_t<Class>>::value,
-                  "Class must be decayed");
-    PEACALM_LUAW_ASSERT(name);
-    PEACALM_LUAW_ASSERT(mp);
-    registrar<Member Class::*, luaw::registrar_tag_for_member_ptr>::
-        register_member_ptr(*this, name, [=](auto&) { return mp; });
+
+#define DEFINE_TYPE_CONVERSION(typename, type, default)        \
+  type to_##typename(int   idx         = -1,                   \
+                     type  def         = default,              \
+                     bool  disable_log = false,                \
+                     bool* failed      = nullptr,              \
+                     bool* exists      = nullptr) {                 \
+    if (exists) *exists = !isnoneornil(idx);                   \
+    /* check integer before number to avoid precision lost. */ \
+    if (isinteger(idx)) {                                      \
+      if (failed) *failed = false;                             \
+      return static_cast<type>(lua_tointeger(L_, idx));        \
+    }                                                          \
+    if (isnumber(idx)) {                                       \
+      if (failed) *failed = false;                             \
+      /* try integer first to avoid precision lost */          \
+      long long t = lua_tointeger(L_, idx);                    \
+      if (t != 0) return t;                                    \
+      return static_cast<type>(lua_tonumber(L_, idx));         \
+    }                                                          \
+    if (isboolean(idx)) {                                      \
+      if (failed) *failed = false;                             \
+      return static_cast<type>(lua_toboolean(L_, idx));        \
+    }                                                          \
+    if (isnoneornil(idx)) {                                    \
+      if (failed) *failed = false;                             \
+      return def;                                              \
+    }                                                          \
+    if (failed) *failed = true;                                \
+    if (!disable_log) log_type_convert_error(idx, #type);      \
+    return def;                                                \
   }
-  template <typename Class, typename Member>
-  void register_static_member_ptr(const std::string& name, Member* mp) {
-    register_static_member_ptr<Class, Member>(name.c_str(), mp);
+
+  DEFINE_TYPE_CONVERSION(bool, bool, false)
+  DEFINE_TYPE_CONVERSION(int, int, 0)
+  DEFINE_TYPE_CONVERSION(uint, unsigned int, 0)
+  DEFINE_TYPE_CONVERSION(long, long, 0)
+  DEFINE_TYPE_CONVERSION(ulong, unsigned long, 0)
+  DEFINE_TYPE_CONVERSION(llong, long long, 0)
+  DEFINE_TYPE_CONVERSION(ullong, unsigned long long, 0)
+  DEFINE_TYPE_CONVERSION(float, float, 0)
+  DEFINE_TYPE_CONVERSION(double, double, 0)
+  DEFINE_TYPE_CONVERSION(ldouble, double, 0)
+#undef DEFINE_TYPE_CONVERSION
+
+  // Unsafe version.
+  // NOTICE: Lua will implicitly convert number to string
+  const char* to_c_str(int         idx         = -1,
+                       const char* def         = "",
+                       bool        disable_log = false,
+                       bool*       failed      = nullptr,
+                       bool*       exists      = nullptr) {
+    if (exists) *exists = !isnoneornil(idx);
+    if (isstring(idx)) {  // include number
+      if (failed) *failed = false;
+      return lua_tostring(L_, idx);
+    }
+    if (isnoneornil(idx)) {
+      if (failed) *failed = false;
+      return def;
+    }
+    if (failed) *failed = true;
+    if (!disable_log) log_type_convert_error(idx, "string");
+    return def;
   }
 
-  /**
-   * @brief Register a static member's low-level const pointer into Lua.
-   *
-   * @sa "register_static_member_ptr"
-   */
-  template <typename Class, typename Member>
-  void register_static_member_cptr(const char* name, Member* mp) {
-    register_static_member_ptr<Class, const Member>(name, mp);
-  }
-  template <typename Class, typename Member>
-  void register_static_member_cptr(const std::string& name, Member* mp) {
-    register_static_member_cptr<Class, Member>(name.c_str(), mp);
-  }
+  // Safe version.
+  // Make a copy of the value before converts it to string when it is a number.
+  std::string to_string(int                idx         = -1,
+                        const std::string& def         = "",
+                        bool               disable_log = false,
+                        bool*              failed      = nullptr,
+                        bool*              exists      = nullptr) {
+    if (is_type_number(idx)) {
+      pushvalue(idx);  // make a copy
+      std::string ret = to_c_str(-1, def.c_str(), disable_log, failed, exists);
+      pop();
+      return ret;
+    }
+    return std::string{to_c_str(idx, def.c_str(), disable_log, failed, exists)};
+  }
+
+  // Zero-copy and safe version. The value on stack is not changed.
+  // The result views "def" if conversion failed, so "def" should outlive it.
+  scoped_string_view to_string_view(int         idx         = -1,
+                                    const char* def         = "",
+                                    bool        disable_log = false,
+                                    bool*       failed      = nullptr,
+                                    bool*       exists      = nullptr) {
+    if (exists) *exists = !isnoneornil(idx);
+    if (isstring(idx)) {  // include number
+      if (failed) *failed = false;
+      return scoped_string_view(L_, idx);
+    }
+    if (isnoneornil(idx)) {
+      if (failed) *failed = false;
+      return scoped_string_view(def);
+    }
+    if (failed) *failed = true;
+    if (!disable_log) log_type_convert_error(idx, "string");
+    return scoped_string_view(def);
+  }
+
+  /** @} */
+
+  /**
+   * @brief Convert a value in Lua stack to complex C++ type.
+   *
+   * Can get a C++ data type.
+   * T could be any type composited by bool, integer types, float number types,
+   * C string, std::string, std::pair, std::tuple, std::vector, std::set,
+   * std::unordered_set, std::map, std::unordered_map, std::deque, std::list,
+   * std::forward_list.
+   * Also, T could be cv-qualified, but cannot be a reference.
+   * Note that using C string "const char*" as key type of set or map is
+   * forbidden, and anytime using "const char*" is not recommended, should
+   * better us std::string instead.
+   *
+   * Can get a user defined class type.
+   *
+   * Can get a callable function like type.
+   * T could be std::function or luaw::function.
+   *
+   * Can get a pointer type.
+   *
+   * @tparam T The result type user expected.
+   * @param [in] idx value's index in stack.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the operation is failed if this
+   * pointer is not nullptr. If T is a container type, it regards the operation
+   * as failed if any element failed.
+   * @param [out] exists Will be set whether the value at given index exists if
+   * this pointer is not nullptr. Regard none and nil as not exists.
+   * @return Return the value on given index in type T if conversion succeeds,
+   * otherwise return initial value of T(i.e. by statement `T{}`) if T is a
+   * simple type, e.g. bool, int, double, std::string, etc. If T is a container
+   * type, the result will contain all non-nil elements whose conversion
+   * succeeded and discard elements who are nil or elements whose conversion
+   * failed.
+   */
+  template <typename T>
+  T to(int   idx         = -1,
+       bool  disable_log = false,
+       bool* failed      = nullptr,
+       bool* exists      = nullptr) {
+    static_assert(!std::is_reference<T>::value, "Should not return reference");
+    return convertor<std::decay_t<T>>::to(
+        *this, idx, disable_log, failed, exists);
+  }
+
+  ///////////////////////// seek fields ////////////////////////////////////////
+
+  /// Push the global environment onto the stack.
+  /// Equivalent to gseek("_G") if "_G" is not modified.
+  self_t& gseek_env() {
+    pushglobaltable();
+    return *this;
+  }
+
+  /// Global Seek: Get a global value by name and push it onto the stack, or
+  /// push a nil if the name does not exist.
+  self_t& gseek(const char* name) {
+    if (name) {
+      getglobal(name);
+    } else {
+      pushnil();
+    }
+    return *this;
+  }
+  self_t& gseek(const std::string& name) { return gseek(name.c_str()); }
+
+  /// Push t[name] onto the stack where t is the value at the given index `idx`,
+  /// or push a nil if the operation fails.
+  self_t& seek(const char* name, int idx = -1) {
+    if (name && (istable(idx) || indexable(idx))) {
+      getfield(idx, name);
+    } else {
+      pushnil();
+    }
+    return *this;
+  }
+  self_t& seek(const std::string& name, int idx = -1) {
+    return seek(name.c_str(), idx);
+  }
+
+  /// Push t[n] onto the stack where t is the value at the given index `idx`, or
+  /// push a nil if the operation fails. Note that index of list in Lua starts
+  /// from 1.
+  self_t& seek(int n, int idx = -1) {
+    if (istable(idx) || indexable(idx)) {
+      lua_geti(L_, idx, n);
+    } else {
+      pushnil();
+    }
+    return *this;
+  }
+
+  /// Push t[p] onto the stack where t is the value at the given index `idx`,
+  /// or push a nil if the operation fails.
+  self_t& seek(void* p, int idx = -1) {
+    // p could be 0
+    if (istable(idx) || indexable(idx)) {
+      int aidx = abs_index(idx);
+      pushlightuserdata(p);
+      gettable(aidx);
+    } else {
+      pushnil();
+    }
+    return *this;
+  }
+
+  /// Seeking by nullptr is meanless.
+  self_t& seek(std::nullptr_t, int idx = -1) = delete;
+
+  /// Push the metatable of the value at the given index onto the stack if it
+  /// has a metatable, otherwise push a nil.
+  self_t& seek(metatable_tag, int idx = -1) {
+    if (!getmetatable(idx)) { pushnil(); }
+    return *this;
+  }
+
+  /// Long Seek: Call gseek() for the first parameter, then call seek() for the
+  /// rest parameters.
+  template <typename T, typename... Ts>
+  self_t& lseek(const T& t, const Ts&... ts) {
+    gseek(t);
+    __lseek(ts...);
+    return *this;
+  }
+
+private:
+  void __lseek() {}
+
+  template <typename T, typename... Ts>
+  void __lseek(const T& t, const Ts&... ts) {
+    seek(t);
+    __lseek(ts...);
+  }
+
+public:
+  ///////////////////////// push variables ///////////////////////////////
+
+  /// Push a value onto stack.
+  template <typename T>
+  int push(T&& value) {
+    return pusher<std::decay_t<T>>::push(*this, std::forward<T>(value));
+  }
+
+  /**
+   * @brief Push with an user given hint type.
+   *
+   * Hint specifies what type of value we want to push into Lua.
+   *
+   * If Hint is luaw::function_tag, push the value as a funcion.
+   *
+   * If Hint is luaw::class_tag, push the value as an userdata. And the value
+   * must be a class or a raw/smart pointer to class.
+   *
+   * The origin value must be convertible to Hint.
+   * So, Hint Can't be reference.
+   *
+   * Hint could have cv- property.
+   *
+   * @tparam Hint Expected type to be pushed as.
+   * @tparam T    Origin type of value.
+   * @param value The value to be pushed.
+   * @return int
+   */
+  template <typename Hint, typename T>
+  std::enable_if_t<!std::is_same<Hint, T>::value, int> push(T&& value) {
+    static_assert(!std::is_reference<Hint>::value,
+                  "Hint should not be reference");
+    return __push<Hint, T>(std::forward<T>(value), 0);
+  }
+
+private:
+  // Firstly, try pusher<DecayHint>::template push<TargetT, Y>.
+  template <typename Hint, typename T>
+  auto __push(T&& value, int)
+      -> decltype(pusher<std::decay_t<Hint>>::template push<Hint, T>(
+          *this, std::forward<T>(value))) {
+    return pusher<std::decay_t<Hint>>::template push<Hint, T>(
+        *this, std::forward<T>(value));
+  }
+
+  // Secondly, try pusher<DecayHint>::push.
+  template <typename Hint, typename T>
+  auto __push(T&& value, ...) -> decltype(auto) {
+    return pusher<std::decay_t<Hint>>::push(*this, std::forward<T>(value));
+  }
+
+public:
+  /// Copy and push a value already in the stack.
+  void pushvalue(int idx = -1) { lua_pushvalue(L_, idx); }
+
+  /// Copy a value in stack to a global value with given name.
+  void copy_to_global(const char* name, int idx = -1) {
+    pushvalue(idx);
+    setglobal(name);
+  }
+
+  /// Push the global environment onto the stack.
+  void pushglobaltable() { lua_pushglobaltable(L_); }
+
+  /// Push a new table onto the stack.
+  void pushnewtable() { lua_newtable(L_); }
+
+  /// Push the thread represented by L onto the stack.
+  /// Returns 1 if this thread is the main thread of its state.
+  int pushthread() { return lua_pushthread(L_); }
+
+  /// Push a C closure function with n upvalues.
+  void pushcclosure(lua_cfunction_t f, int n) { lua_pushcclosure(L_, f, n); }
+
+  /// Push lightuserdata. Equivalent to `push(f)`.
+  void pushcfunction(lua_cfunction_t f) { lua_pushcfunction(L_, f); }
+
+  /// Push lightuserdata. Equivalent to `push(p)`.
+  void pushlightuserdata(const void* p) { lua_pushlightuserdata(L_, (void*)p); }
+
+  /// Push nil. Equivalent to `push(nullptr)`.
+  void pushnil() { lua_pushnil(L_); }
+
+  /// Return a pointer to the internal copy of the string.
+  const char* pushstring(const char* s) {
+    PEACALM_LUAW_ASSERT(s);  // we forbit s to be NULL
+    return lua_pushstring(L_, s);
+  }
+
+  /// Push a string with given length, which may contain embedded zeros and
+  /// needn't be NUL-terminated. Return a pointer to the internal copy.
+  const char* pushlstring(const char* s, size_t len) {
+    PEACALM_LUAW_ASSERT(s || len == 0);
+    return lua_pushlstring(L_, s, len);
+  }
+
+  ///////////////////////// touch table ////////////////////////////////////////
+
+  /// Push the table (or value indexable and newindexable) with given name onto
+  /// stack. If not exists, create one.
+  self_t& gtouchtb(const char* name) {
+    getglobal(name);
+    if (istable() || indexable_and_newindexable()) return *this;
+    pop();
+    newtable();
+    pushvalue(-1);  // make a copy
+    setglobal(name);
+    return *this;
+  }
+  self_t& gtouchtb(const std::string& name) { return gtouchtb(name.c_str()); }
+
+  /// Push the table (or value indexable and newindexable) t[name] onto stack,
+  /// where t is a table at given index. If t[name] is not a table, create a new
+  /// one.
+  self_t& touchtb(const char* name, int idx = -1) {
+    PEACALM_LUAW_ASSERT(name);
+    int aidx = abs_index(idx);
+    PEACALM_LUAW_INDEXABLE_ASSERT(indexable_and_newindexable(aidx));
+    getfield(aidx, name);
+    if (istable() || indexable_and_newindexable()) return *this;
+    pop();
+    newtable();
+    setfield(aidx, name);
+    getfield(aidx, name);
+    return *this;
+  }
+  self_t& touchtb(const std::string& name, int idx = -1) {
+    return touchtb(name.c_str(), idx);
+  }
+
+  /// Push the table (or value indexable and newindexable) t[n] onto stack,
+  /// where t is a table at given index. If t[n] is not a table, create a new
+  /// one.
+  self_t& touchtb(int n, int idx = -1) {
+    int aidx = abs_index(idx);
+    PEACALM_LUAW_INDEXABLE_ASSERT(indexable_and_newindexable(aidx));
+    geti(aidx, n);
+    if (istable() || indexable_and_newindexable()) return *this;
+    pop();
+    newtable();
+    seti(aidx, n);
+    geti(aidx, n);
+    return *this;
+  }
+
+  /// Push the table (or value indexable and newindexable) t[p] onto stack,
+  /// where t is a table at given index. If t[p] is not a table, create a new
+  /// one.
+  self_t& touchtb(void* p, int idx = -1) {
+    int aidx = abs_index(idx);
+    PEACALM_LUAW_INDEXABLE_ASSERT(indexable_and_newindexable(aidx));
+    pushlightuserdata(p);
+    gettable(aidx);
+    if (istable() || indexable_and_newindexable()) return *this;
+    pop();
+    newtable();
+    pushlightuserdata(p);
+    pushvalue(-2);
+    settable(aidx);
+    return *this;
+  }
+
+  /// nullptr represents nil, using nil as key is invalid.
+  self_t& touchtb(std::nullptr_t, int idx = -1) = delete;
+
+  /// Push the metatable of the value at the given index onto the stack.
+  /// If the value does not have a metatable, create a new metatable for it then
+  /// push the metatable onto stack.
+  /// The way to create new metatable: If m.tname is empty, create an empty
+  /// metatable, else create a new metatable using `luaL_newmetatable(L_,
+  /// m.tname)`.
+  self_t& touchtb(metatable_tag m, int idx = -1) {
+    if (!getmetatable(idx)) {
+      int aidx = abs_index(idx);
+      if (!m.tname) {
+        newtable();
+      } else {
+        luaL_newmetatable(L_, m.tname);
+      }
+      setmetatable(aidx);
+      bool t = getmetatable(aidx);
+      PEACALM_LUAW_ASSERT(t);
+    }
+    return *this;
+  }
+
+  /// Long touchtb: Call gtouchtb() for the first parameter, then call touchtb()
+  /// for the rest parameters.
+  template <typename T, typename... Ts>
+  self_t& ltouchtb(const T& t, const Ts&... ts) {
+    gtouchtb(t);
+    __ltouchtb(ts...);
+    return *this;
+  }
+
+private:
+  void __ltouchtb() {}
+
+  template <typename T, typename... Ts>
+  void __ltouchtb(const T& t, const Ts&... ts) {
+    touchtb(t);
+    __ltouchtb(ts...);
+  }
+
+public:
+  ///////////////////////// set fields into a table ////////////////////////////
+
+  /// Set t[key] = value, where t is a table at given index.
+  template <typename T>
+  void setkv(const char* key, T&& value, int idx = -1) {
+    PEACALM_LUAW_ASSERT(key);
+    PEACALM_LUAW_INDEXABLE_ASSERT(newindexable(idx));
+    int aidx = abs_index(idx);
+    push(std::forward<T>(value));
+    setfield(aidx, key);
+  }
+  template <typename T>
+  void setkv(const std::string& key, T&& value, int idx = -1) {
+    setkv(key.c_str(), std::forward<T>(value), idx);
+  }
+#if PEACALM_LUAW_SUPPORT_CPP17
+  template <typename T>
+  void setkv(std::string_view key, T&& value, int idx = -1) {
+    PEACALM_LUAW_INDEXABLE_ASSERT(newindexable(idx));
+    int aidx = abs_index(idx);
+    pushlstring(key.data(), key.size());
+    push(std::forward<T>(value));
+    settable(aidx);
+  }
+#endif
+  template <typename T>
+  void setkv(int key, T&& value, int idx = -1) {
+    PEACALM_LUAW_INDEXABLE_ASSERT(newindexable(idx));
+    int aidx = abs_index(idx);
+    push(std::forward<T>(value));
+    seti(aidx, key);
+  }
+  template <typename T>
+  void setkv(void* key, T&& value, int idx = -1) {
+    PEACALM_LUAW_INDEXABLE_ASSERT(newindexable(idx));
+    int aidx = abs_index(idx);
+    pushlightuserdata(key);
+    push(std::forward<T>(value));
+    settable(aidx);
+  }
+
+  /// Set field with an user given hint type.
+  template <typename Hint, typename T>
+  std::enable_if_t<!std::is_same<Hint, T>::value> setkv(const char* key,
+                                                        T&&         value,
+                                                        int         idx = -1) {
+    PEACALM_LUAW_ASSERT(key);
+    PEACALM_LUAW_INDEXABLE_ASSERT(newindexable(idx));
+    int aidx = abs_index(idx);
+    push<Hint>(std::forward<T>(value));
+    setfield(aidx, key);
+  }
+  template <typename Hint, typename T>
+  std::enable_if_t<!std::is_same<Hint, T>::value> setkv(const std::string& key,
+                                                        T&& value,
+                                                        int idx = -1) {
+    setkv<Hint>(key.c_str(), std::forward<T>(value), idx);
+  }
+#if PEACALM_LUAW_SUPPORT_CPP17
+  template <typename Hint, typename T>
+  std::enable_if_t<!std::is_same<Hint, T>::value> setkv(std::string_view key,
+                                                        T&& value,
+                                                        int idx = -1) {
+    PEACALM_LUAW_INDEXABLE_ASSERT(newindexable(idx));
+    int aidx = abs_index(idx);
+    pushlstring(key.data(), key.size());
+    push<Hint>(std::forward<T>(value));
+    settable(aidx);
+  }
+#endif
+  template <typename Hint, typename T>
+  std::enable_if_t<!std::is_same<Hint, T>::value> setkv(int key,
+                                                        T&& value,
+                                                        int idx = -1) {
+    PEACALM_LUAW_INDEXABLE_ASSERT(newindexable(idx));
+    int aidx = abs_index(idx);
+    push<Hint>(std::forward<T>(value));
+    seti(aidx, key);
+  }
+  template <typename Hint, typename T>
+  std::enable_if_t<!std::is_same<Hint, T>::value> setkv(void* key,
+                                                        T&&   value,
+                                                        int   idx = -1) {
+    PEACALM_LUAW_INDEXABLE_ASSERT(newindexable(idx));
+    int aidx = abs_index(idx);
+    pushlightuserdata(key);
+    push<Hint>(std::forward<T>(value));
+    settable(aidx);
+  }
+
+  /// Set the parameter value as metatable for the value at given index.
+  /// Setting nullptr as metatable means setting nil to metatable.
+  template <typename T>
+  void setkv(metatable_tag, T&& value, int idx = -1) {
+    int aidx = abs_index(idx);
+    push(std::forward<T>(value));
+    setmetatable(aidx);
+  }
+  template <typename Hint, typename T>
+  std::enable_if_t<!std::is_same<Hint, T>::value> setkv(metatable_tag,
+                                                        T&& value,
+                                                        int idx = -1) {
+    int aidx = abs_index(idx);
+    push<Hint>(std::forward<T>(value));
+    setmetatable(aidx);
+  }
+
+  /// Using nullptr as key is invalid.
+  template <typename T>
+  void setkv(std::nullptr_t, T&& value, int idx = -1) = delete;
+  template <typename Hint, typename T>
+  void setkv(std::nullptr_t, T&& value, int idx = -1) = delete;
+
+  ///////////////////////// set global variables ///////////////////////////////
+
+  /**
+   * @brief Set a global variable to Lua.
+   *
+   * T could be data type, pointer type, C function, lambda, std::function and
+   * user defined class types.
+   *
+   * set(name, nullptr) means set nil to "name".
+   * set(name, luaw::newtable_tag) means set a new empty table to "name".
+   *
+   */
+  template <typename T>
+  void set(const char* name, T&& value) {
+    push(std::forward<T>(value));
+    setglobal(name);
+  }
+  template <typename T>
+  void set(const std::string& name, T&& value) {
+    set(name.c_str(), std::forward<T>(value));
+  }
+
+  /// Set a global variable with an user given hint type.
+  template <typename Hint, typename T>
+  std::enable_if_t<!std::is_same<Hint, T>::value> set(const char* name,
+                                                      T&&         value) {
+    push<Hint>(std::forward<T>(value));
+    setglobal(name);
+  }
+  template <typename Hint, typename T>
+  std::enable_if_t<!std::is_same<Hint, T>::value> set(const std::string& name,
+                                                      T&& value) {
+    set<Hint>(name.c_str(), std::forward<T>(value));
+  }
+
+  /// Recursively set fields. The last element in path is the key for value,
+  /// other elements in path are nested tables.
+  template <typename T>
+  void set(const std::initializer_list<const char*>& path, T&& value) {
+    __set<T>(path.begin(), path.end(), std::forward<T>(value));
+  }
+  template <typename T>
+  void set(const std::initializer_list<std::string>& path, T&& value) {
+    __set<T>(path.begin(), path.end(), std::forward<T>(value));
+  }
+  template <typename T>
+  void set(const std::vector<const char*>& path, T&& value) {
+    __set<T>(path.begin(), path.end(), std::forward<T>(value));
+  }
+  template <typename T>
+  void set(const std::vector<std::string>& path, T&& value) {
+    __set<T>(path.begin(), path.end(), std::forward<T>(value));
+  }
+
+  /// Recursively set fields with hint type
+  template <typename Hint, typename T>
+  std::enable_if_t<!std::is_same<Hint, T>::value> set(
+      const std::initializer_list<const char*>& path, T&& value) {
+    __set<Hint>(path.begin(), path.end(), std::forward<T>(value));
+  }
+  template <typename Hint, typename T>
+  std::enable_if_t<!std::is_same<Hint, T>::value> set(
+      const std::initializer_list<std::string>& path, T&& value) {
+    __set<Hint>(path.begin(), path.end(), std::forward<T>(value));
+  }
+  template <typename Hint, typename T>
+  std::enable_if_t<!std::is_same<Hint, T>::value> set(
+      const std::vector<const char*>& path, T&& value) {
+    __set<Hint>(path.begin(), path.end(), std::forward<T>(value));
+  }
+  template <typename Hint, typename T>
+  std::enable_if_t<!std::is_same<Hint, T>::value> set(
+      const std::vector<std::string>& path, T&& value) {
+    __set<Hint>(path.begin(), path.end(), std::forward<T>(value));
+  }
+
+  /// Long set. The last argument is value, the rest arguments are indexes and
+  /// sub-indexes, where could contain luaw::metatable_tag.
+  template <typename... Args>
+  void lset(Args&&... args) {
+    constexpr size_t N = sizeof...(Args);
+    static_assert(N >= 2, "lset needs at least two arguments");
+    auto _g = make_guarder();
+    gseek_env();
+    using T = std::tuple_element_t<N - 1, std::tuple<Args...>>;
+    __lset<T>(std::forward<Args>(args)...);
+  }
+
+  /// Long set with a hint type.
+  template <typename Hint, typename... Args>
+  void lset(Args&&... args) {
+    static_assert(sizeof...(Args) >= 2, "lset needs at least two arguments");
+    auto _g = make_guarder();
+    gseek_env();
+    __lset<Hint>(std::forward<Args>(args)...);
+  }
+
+private:
+  template <typename Hint, typename First, typename Second>
+  void __lset(First&& f, Second&& s) {
+    setkv<Hint>(std::forward<First>(f), std::forward<Second>(s));
+  }
+
+  template <typename Hint, typename First, typename Second, typename... Rests>
+  void __lset(First&& f, Second&& s, Rests&&... rs) {
+    touchtb(std::forward<First>(f));
+    __lset<Hint>(std::forward<Second>(s), std::forward<Rests>(rs)...);
+  }
+
+  template <typename Hint, typename Iterator, typename T>
+  void __set(Iterator b, Iterator e, T&& value) {
+    if (b == e) return;
+    auto _g = make_guarder();
+    gseek_env();
+
+    auto it = b;
+    while (true) {
+      auto nx = std::next(it, 1);
+      if (nx == e) {
+        setkv<Hint>(*it, std::forward<T>(value));
+        break;
+      } else {
+        touchtb(*it);
+        it = nx;
+      }
+    }
+  }
+
+public:
+  // set for simple types
+
+  void set_integer(const char* name, long long value) {
+    lua_pushinteger(L_, value);
+    setglobal(name);
+  }
+  void set_integer(const std::string& name, long long value) {
+    set_integer(name.c_str(), value);
+  }
+
+  void set_number(const char* name, double value) {
+    lua_pushnumber(L_, value);
+    setglobal(name);
+  }
+  void set_number(const std::string& name, double value) {
+    set_number(name.c_str(), value);
+  }
+
+  void set_boolean(const char* name, bool value) {
+    lua_pushboolean(L_, static_cast<int>(value));
+    setglobal(name);
+  }
+  void set_boolean(const std::string& name, bool value) {
+    set_boolean(name.c_str(), value);
+  }
+
+  void set_nil(const char* name) {
+    pushnil();
+    setglobal(name);
+  }
+  void set_nil(const std::string& name) { set_nil(name.c_str()); }
+
+  void set_string(const char* name, const char* value) {
+    lua_pushstring(L_, value);
+    setglobal(name);
+  }
+  void set_string(const std::string& name, const char* value) {
+    set_string(name.c_str(), value);
+  }
+
+  void set_string(const char* name, const std::string& value) {
+    set_string(name, value.data(), value.size());
+  }
+  void set_string(const std::string& name, const std::string& value) {
+    set_string(name.c_str(), value);
+  }
+
+  /// Set a string with given length, which needn't be NUL-terminated.
+  void set_string(const char* name, const char* value, size_t len) {
+    pushlstring(value, len);
+    setglobal(name);
+  }
+  void set_string(const std::string& name, const char* value, size_t len) {
+    set_string(name.c_str(), value, len);
+  }
+
+#if PEACALM_LUAW_SUPPORT_CPP17
+  void set_string(const char* name, std::string_view value) {
+    set_string(name, value.data(), value.size());
+  }
+  void set_string(const std::string& name, std::string_view value) {
+    set_string(name.c_str(), value.data(), value.size());
+  }
+#endif
+
+  ///////////////////////// set raw pointer by wrapper /////////////////////////
+
+  /// Pointer wrapper type
+  template <typename T>
+  using ptrw = const std::shared_ptr<T>;
+
+  /// Make a wrapper for a raw pointer.
+  /// (The raw pointer can't be pointer of smart ptr)
+  template <typename T>
+  static ptrw<T> make_ptrw(T* p);
+
+  /**
+   * @brief Set a raw pointer by a wrapper (full userdata)
+   *
+   * A raw pointer in Lua is a light userdata, and it doesn't have per-value
+   * metatable. But a pointer wrapper is a full userdata, and it has per-value
+   * metatable.
+   *
+   * This method makes a wrapper for a raw pointer first, then set the wrapper
+   * into Lua. The pointer wrapper can access all members registered just like
+   * the raw pointer.
+   *
+   * It's user's responsibility to make sure the raw pointer is valid while
+   * using it in Lua. Otherwize the behavior is undefined.
+   *
+   * @tparam T The type that the raw pointer points to. Can't be smart pointers.
+   * @param name The pointer wrapper's name used in Lua.
+   * @param p The raw pointer.
+   */
+  template <typename T>
+  void set_ptr_by_wrapper(const char* name, T* p) {
+    set(name, make_ptrw<T>(p));
+  }
+  template <typename T>
+  void set_ptr_by_wrapper(const std::string& name, T* p) {
+    set_ptr_by_wrapper<T>(name.c_str(), p);
+  }
+
+  ///////////////////////// get global variables ///////////////////////////////
+
+  /**
+   * @brief Get a global variable in Lua and convert it to simple C++ type.
+   *
+   * @param [in] name The variable's name.
+   * @param [in] def The default value returned if failed or target does not
+   * exist.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the operation is failed if this
+   * pointer is not nullptr.
+   * @param [out] exists Set whether the variable exists. Regard none and nil as
+   * not exists.
+   * @return Return the variable's value if the variable exists and conversion
+   * succeeded.
+   *
+   * @{
+   */
+
+#define DEFINE_GLOBAL_GET(typename, type, default)                         \
+  type get_##typename(const char* name,                                    \
+                      const type& def         = default,                   \
+                      bool        disable_log = false,                     \
+                      bool*       failed      = nullptr,                   \
+                      bool*       exists      = nullptr) {                            \
+    getglobal(name);                                                       \
+    type ret = to_##typename(-1, def, disable_log, failed, exists);        \
+    pop();                                                                 \
+    return ret;                                                            \
+  }                                                                        \
+  type get_##typename(const std::string& name,                             \
+                      const type&        def         = default,            \
+                      bool               disable_log = false,              \
+                      bool*              failed      = nullptr,            \
+                      bool*              exists      = nullptr) {                            \
+    return get_##typename(name.c_str(), def, disable_log, failed, exists); \
+  }
+
+  DEFINE_GLOBAL_GET(bool, bool, false)
+  DEFINE_GLOBAL_GET(int, int, 0)
+  DEFINE_GLOBAL_GET(uint, unsigned int, 0)
+  DEFINE_GLOBAL_GET(long, long, 0)
+  DEFINE_GLOBAL_GET(ulong, unsigned long, 0)
+  DEFINE_GLOBAL_GET(llong, long long, 0)
+  DEFINE_GLOBAL_GET(ullong, unsigned long long, 0)
+  DEFINE_GLOBAL_GET(float, float, 0)
+  DEFINE_GLOBAL_GET(double, double, 0)
+  DEFINE_GLOBAL_GET(ldouble, long double, 0)
+  DEFINE_GLOBAL_GET(string, std::string, "")
+#undef DEFINE_GLOBAL_GET
+
+  // NO POP! Because the c_str body is in stack.
+  // Caller is responsible for popping stack.
+  // You'd better use get_string unless you know the difference.
+  const char* get_c_str(const char* name,
+                        const char* def         = "",
+                        bool        disable_log = false,
+                        bool*       failed      = nullptr,
+                        bool*       exists      = nullptr) {
+    getglobal(name);
+    return to_c_str(-1, def, disable_log, failed, exists);
+  }
+  const char* get_c_str(const std::string& name,
+                        const char*        def         = "",
+                        bool               disable_log = false,
+                        bool*              failed      = nullptr,
+                        bool*              exists      = nullptr) {
+    return get_c_str(name.c_str(), def, disable_log, failed, exists);
+  }
+
+  // Zero-copy and safe version. Stack is balanced.
+  scoped_string_view get_string_view(const char* name,
+                                     const char* def         = "",
+                                     bool        disable_log = false,
+                                     bool*       failed      = nullptr,
+                                     bool*       exists      = nullptr) {
+    getglobal(name);
+    scoped_string_view ret = to_string_view(-1, def, disable_log, failed, exists);
+    pop();
+    return ret;
+  }
+  scoped_string_view get_string_view(const std::string& name,
+                                     const char*        def         = "",
+                                     bool               disable_log = false,
+                                     bool*              failed      = nullptr,
+                                     bool*              exists = nullptr) {
+    return get_string_view(name.c_str(), def, disable_log, failed, exists);
+  }
+
+  /** @} */
+
+  /**
+   * @brief Get a global variable in Lua and convert it to complex C++ type.
+   *
+   * @sa method "to"
+   *
+   * @tparam T The result type user expected.
+   * @param [in] name The variable's name.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the operation is failed if this
+   * pointer is not nullptr. If T is a container type, it regards the operation
+   * as failed if any element failed.
+   * @param [out] exists Set whether the variable exists. Regard none and nil as
+   * not exists.
+   * @return Return the value with given name in type T if conversion succeeds,
+   * otherwise, if T is a simple type (e.g. bool, int, double, std::string,
+   * etc), return initial value of T(i.e. by statement `T{}`), if T is a
+   * container type, the result will contain all non-nil elements whose
+   * conversion succeeded and discard elements who are nil or elements whose
+   * conversion failed.
+   *
+   */
+  template <typename T>
+  T get(const char* name,
+        bool        disable_log = false,
+        bool*       failed      = nullptr,
+        bool*       exists      = nullptr) {
+    auto _g = make_guarder();
+    getglobal(name);
+    return to<T>(-1, disable_log, failed, exists);
+  }
+  template <typename T>
+  T get(const std::string& name,
+        bool               disable_log = false,
+        bool*              failed      = nullptr,
+        bool*              exists      = nullptr) {
+    return get<T>(name.c_str(), disable_log, failed, exists);
+  }
+
+/**
+ * @brief Recursively get values in Lua and convert it to simple C++ type.
+ *
+ * @param [in] path The first key in path should be a Lua global variable,
+ * the last key in path should be a value which can convert to expected type,
+ * excpet for the last key, all other keys in path should be Lua table.
+ * @param [in] def The default value returned if failed or target does not
+ * exist.
+ * @param [in] disable_log Whether print a log when exception occurs.
+ * @param [out] failed Will be set whether the operation is failed if this
+ * pointer is not nullptr. If T is a container type, it regards the operation
+ * as failed if any element failed.
+ * @param [out] exists Set whether the variable exists. Regard none and nil as
+ * not exists.
+ *
+ * @{
+ */
+#define DEFINE_RECURSIVE_GET_SIMPLE_TYPE(typename, type, default)              \
+  type get_##typename(const std::initializer_list<const char*>& path,          \
+                      const type&                               def = default, \
+                      bool  disable_log                             = false,   \
+                      bool* failed                                  = nullptr, \
+                      bool* exists                                  = nullptr) {                                \
+    return __get<type>(                                                        \
+        path.begin(), path.end(), def, disable_log, failed, exists);           \
+  }                                                                            \
+  type get_##typename(const std::initializer_list<std::string>& path,          \
+                      const type&                               def = default, \
+                      bool  disable_log                             = false,   \
+                      bool* failed                                  = nullptr, \
+                      bool* exists                                  = nullptr) {                                \
+    return __get<type>(                                                        \
+        path.begin(), path.end(), def, disable_log, failed, exists);           \
+  }                                                                            \
+  type get_##typename(const std::vector<const char*>& path,                    \
+                      const type&                     def         = default,   \
+                      bool                            disable_log = false,     \
+                      bool*                           failed      = nullptr,   \
+                      bool*                           exists      = nullptr) {                                \
+    return __get<type>(                                                        \
+        path.begin(), path.end(), def, disable_log, failed, exists);           \
+  }                                                                            \
+  type get_##typename(const std::vector<std::string>& path,                    \
+                      const type&                     def         = default,   \
+                      bool                            disable_log = false,     \
+                      bool*                           failed      = nullptr,   \
+                      bool*                           exists      = nullptr) {                                \
+    return __get<type>(                                                        \
+        path.begin(), path.end(), def, disable_log, failed, exists);           \
+  }
+
+  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(bool, bool, false)
+  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(int, int, 0)
+  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(uint, unsigned int, 0)
+  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(long, long, 0)
+  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(ulong, unsigned long, 0)
+  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(llong, long long, 0)
+  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(ullong, unsigned long long, 0)
+  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(float, float, 0)
+  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(double, double, 0)
+  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(ldouble, long double, 0)
+  DEFINE_RECURSIVE_GET_SIMPLE_TYPE(string, std::string, "")
+#undef DEFINE_RECURSIVE_GET_SIMPLE_TYPE
+
+  /** @} */
+
+  /**
+   * @brief Recursively get values in Lua and convert it to complex C++ type.
+   *
+   * No default value provided. If T is not a container type, it will return T's
+   * initial value if operation fails or target does not exist. If T is a
+   * container type, the result will contain elements that successfully
+   * converted and discard elements fails or not exists. Regard none and nil as
+   * not exists.
+   *
+   * @param [in] path The first key in path should be a Lua global variable,
+   * the last key in path should be a value which can convert to expected type,
+   * excpet for the last key, all other keys in path should be Lua table.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the operation is failed if this
+   * pointer is not nullptr. If T is a container type, it regards the operation
+   * as failed if any element failed.
+   * @param [out] exists Set whether the variable exists. Regard none and nil as
+   * not exists.
+   *
+   * @{
+   */
+  template <typename T>
+  T get(const std::initializer_list<const char*>& path,
+        bool                                      disable_log = false,
+        bool*                                     failed      = nullptr,
+        bool*                                     exists      = nullptr) {
+    return __get<T>(path.begin(), path.end(), disable_log, failed, exists);
+  }
+  template <typename T>
+  T get(const std::initializer_list<std::string>& path,
+        bool                                      disable_log = false,
+        bool*                                     failed      = nullptr,
+        bool*                                     exists      = nullptr) {
+    return __get<T>(path.begin(), path.end(), disable_log, failed, exists);
+  }
+  template <typename T>
+  T get(const std::vector<const char*>& path,
+        bool                            disable_log = false,
+        bool*                           failed      = nullptr,
+        bool*                           exists      = nullptr) {
+    return __get<T>(path.begin(), path.end(), disable_log, failed, exists);
+  }
+  template <typename T>
+  T get(const std::vector<std::string>& path,
+        bool                            disable_log = false,
+        bool*                           failed      = nullptr,
+        bool*                           exists      = nullptr) {
+    return __get<T>(path.begin(), path.end(), disable_log, failed, exists);
+  }
+
+  /** @} */
+
+  /// Options used as first parameter for "lget".
+  struct lgetopt {
+    bool  disable_log;
+    bool *failed, *exists;
+    lgetopt(bool d = false, bool* f = nullptr, bool* e = nullptr)
+        : disable_log(d), failed(f), exists(e) {}
+  };
+
+  /// Long get. Args is the path to get value.
+  template <typename T, typename... Args>
+  T lget(const lgetopt& o, Args&&... args) {
+    static_assert(sizeof...(Args) > 0, "lget needs at least one key in path");
+    auto _g = make_guarder();
+    lseek(std::forward<Args>(args)...);
+    return to<T>(-1, o.disable_log, o.failed, o.exists);
+  }
+
+private:
+  template <typename T, typename Iterator>
+  T __get(Iterator b,
+          Iterator e,
+          bool     disable_log = false,
+          bool*    failed      = nullptr,
+          bool*    exists      = nullptr) {
+    if (b == e) {
+      if (failed) *failed = false;
+      if (exists) *exists = false;
+      return T();
+    }
+    auto _g = make_guarder();
+    auto it = b;
+    gseek(*it++);
+    if (it == e) { return to<T>(-1, disable_log, failed, exists); }
+    while (it != e) {
+      if (isnoneornil()) {
+        if (failed) *failed = false;
+        if (exists) *exists = false;
+        return T();
+      }
+      if (!(istable() || indexable())) {
+        if (failed) *failed = true;
+        if (exists) *exists = true;
+        if (!disable_log)
+          log_type_convert_error(-1, "table or indexable value");
+        return T();
+      }
+      seek(*it++);
+    }
+    return to<T>(-1, disable_log, failed, exists);
+  }
+
+  template <typename T, typename Iterator>
+  T __get(Iterator b,
+          Iterator e,
+          const T& def,
+          bool     disable_log = false,
+          bool*    failed      = nullptr,
+          bool*    exists      = nullptr) {
+    bool tfailed, texists;
+    auto ret = __get<T>(b, e, disable_log, &tfailed, &texists);
+    if (failed) *failed = tfailed;
+    if (exists) *exists = texists;
+    if (tfailed || !texists) return def;
+    return ret;
+  }
+
+public:
+  //////////////////////// call Lua function ///////////////////////////////////
+
+  /// Call a global Lua function specified by name using C++ parameters.
+  /// Should at least provide return type.
+  template <typename Return, typename... Args>
+  Return callf(const char* fname, const Args&... args) {
+    PEACALM_LUAW_ASSERT(fname);
+    auto f = get<luaw::function<Return(Args...)>>(fname);
+    return f(args...);
+  }
+  template <typename Return, typename... Args>
+  Return callf(const std::string& fname, const Args&... args) {
+    auto f = get<luaw::function<Return(Args...)>>(fname);
+    return f(args...);
+  }
+
+  /// Call a Lua function specified by path using C++ parameters.
+  template <typename Return, typename... Args>
+  Return callf(const std::initializer_list<const char*>& path,
+               const Args&... args) {
+    auto f = get<luaw::function<Return(Args...)>>(path);
+    return f(args...);
+  }
+  template <typename Return, typename... Args>
+  Return callf(const std::initializer_list<std::string>& path,
+               const Args&... args) {
+    auto f = get<luaw::function<Return(Args...)>>(path);
+    return f(args...);
+  }
+  template <typename Return, typename... Args>
+  Return callf(const std::vector<const char*>& path, const Args&... args) {
+    auto f = get<luaw::function<Return(Args...)>>(path);
+    return f(args...);
+  }
+  template <typename Return, typename... Args>
+  Return callf(const std::vector<std::string>& path, const Args&... args) {
+    auto f = get<luaw::function<Return(Args...)>>(path);
+    return f(args...);
+  }
+
+  //////////////////////// register ctor/memeber for class /////////////////////
+
+  /**
+   * @brief Register a global function to Lua who can create object.
+   *
+   * It creates a userdata in Lua, whose C++ type is specified by Return type
+   * of Ctor. e.g. register_ctor<Object(int)>("NewObject"). Then can run
+   * "o = NewObject(1)" in Lua.
+   *
+   * @tparam Ctor Should be a function type of "Return(Args...)".
+   * @param fname The global function name registered.
+   */
+  template <typename Ctor>
+  void register_ctor(const char* fname) {
+    static_assert(std::is_function<Ctor>::value,
+                  "Ctor should be type of Return(Args...)");
+    PEACALM_LUAW_ASSERT(fname);
+    register_ctor_impl<std::decay_t<Ctor>>::register_ctor(*this, fname);
+  }
+  template <typename Ctor>
+  void register_ctor(const std::string& fname) {
+    register_ctor<Ctor>(fname.c_str());
+  }
+
+  /// A member variable declared at compile time by `static_members`.
+  template <typename MemberPointer>
+  struct static_member_t {
+    static_assert(std::is_member_object_pointer<MemberPointer>::value,
+                  "Only member variables could be declared statically");
+    using member_pointer_type = MemberPointer;
+
+    const char*   name;
+    size_t        size;
+    MemberPointer mp;
+    uint32_t      hash;
+  };
+
+  /// Make a `static_member_t` whose name's hash is computed at compile time.
+  template <typename MemberPointer>
+  static constexpr static_member_t<MemberPointer> static_member(
+      const char* name, MemberPointer mp) {
+    return {name,
+            luaw_detail::constexpr_strlen(name),
+            mp,
+            luaw_detail::fnv1a32(name, luaw_detail::constexpr_strlen(name))};
+  }
+
+  /**
+   * @brief Declare member variables of a class at compile time.
+   *
+   * Specialize this with a static constexpr function `value()` returning a
+   * std::tuple of `static_member`, then members are accessed in Lua without
+   * any registration. The generated "__index" and "__newindex" dispatch by a
+   * compile-time hash of member names, before members registered at runtime.
+   *
+   * @code
+   * namespace peacalm {
+   * template <>
+   * struct luaw::static_members<Point> {
+   *   static constexpr auto value() {
+   *     return std::make_tuple(luaw::static_member("x", &Point::x),
+   *                            luaw::static_member("y", &Point::y));
+   *   }
+   * };
+   * }  // namespace peacalm
+   * @endcode
+   *
+   * Member functions still need `register_member`.
+   */
+  template <typename Class>
+  struct static_members {};
+
+  /**
+   * @brief Register member variables or member functions
+   *
+   * Register a real member for class, not fake members.
+   *
+   * To register overloaded member functions, the template parameter
+   * `MemberPointer` must be provided explicitly.
+   * Otherwise, when registering member variables or non-overloaded member
+   * functions, `MemberPointer` can be automatically deduced.
+   *
+   * Example:
+   *
+   * Register int member "i" for class "Obj":
+   *   `register_member("i", &Obj::i)`
+   * or explicitly provide member type:
+   *   `register_member<int Obj::*>("i", &Obj::i)`
+   *
+   * Register member function "abs" for class "Obj":
+   *   `register_member("abs", &Obj::abs)`
+   * or explicitly provide member type:
+   *   `register_member<int (Obj::*)()>("abs", &Obj::abs)`
+   *
+   * @tparam MemberPointer Member pointer type.
+   * @param name Member name to be registered.
+   * @param mp Pointer to the member to be registered.
+   * @return void
+   */
+  template <typename MemberPointer>
+  std::enable_if_t<std::is_member_pointer<MemberPointer>::value>
+  register_member(const char* name, MemberPointer mp) {
+    PEACALM_LUAW_ASSERT(name);
+    PEACALM_LUAW_ASSERT(mp);
+    registrar<std::decay_t<MemberPointer>>::register_member(
+        *this, name, std::mem_fn(mp));
+  }
+  template <typename MemberPointer>
+  std::enable_if_t<std::is_member_pointer<MemberPointer>::value>
+  register_member(const std::string& name, MemberPointer mp) {
+    register_member<MemberPointer>(name.c_str(), mp);
+  }
+
+  /**
+   * @brief Register a fake member variable or fake member function.
+   *
+   * Fake members are members who are not directly explicitly defined as members
+   * in a C++ class, but used in Lua and by some way they can reach to values or
+   * functions in C++.
+   *
+   * The values reached by fake members could be real members, or temporary
+   * values generated by some method, or even variables outside the calss, e.g.
+   * some global variables.
+   *
+   * In particular, we can fake members by class's static members.
+   *
+   * To register a fake member, we must provide a Hint type to indicate the
+   * mermber's type to be faked, and a callable object to describe the member's
+   * behavior. The first argument of the callable object must represent the
+   * class which the members faked belong to, usually we use a pointer to the
+   * class.
+   *
+   * For example:
+   *
+   * Register a const member "id" with type void* for class Obj to get its
+   * instance's address:
+   *     `register_member<void* const Obj::*>("id", [](const Obj* p) {
+   *         return (void*)p; });`
+   *
+   * Register a member function "plus" for class Obj:
+   *     `register_member<void (Obj::*)(int)>("plus", [](Obj* p, int d) {
+   *         p->value += d; })`
+   *
+   * Register a const member function "getvalue" for class Obj:
+   *     `register_member<int (Obj::*)() const>("getvalue", [](const Obj* p) {
+   *         return p->value; })`
+   *
+   * @tparam Hint The member type wanted to fake.
+   * @tparam F C function type or lambda or std::function or any callable type.
+   * @param name The member name.
+   * @param f The function whose first parameter is a pointer to the class.
+   * @return void.
+   */
+  template <typename Hint, typename F>
+  std::enable_if_t<std::is_member_pointer<Hint>::value &&
+                   !std::is_same<Hint, F>::value>
+  register_member(const char* name, F&& f) {
+    PEACALM_LUAW_ASSERT(name);
+    registrar<std::decay_t<Hint>>::register_member(
+        *this, name, mock_mem_fn<F>(std::forward<F>(f)));
+  }
+  template <typename Hint, typename F>
+  std::enable_if_t<std::is_member_pointer<Hint>::value &&
+                   !std::is_same<Hint, F>::value>
+  register_member(const std::string& name, F&& f) {
+    register_member<Hint, F>(name.c_str(), std::forward<F>(f));
+  }
+
+  /**
+   * @brief Register a static member by providing class type.
+   *
+   * Can register static member variables or functions.
+   * Also can register global functions or global variables or local variables
+   * (should better be static) to be members of an object in Lua.
+   *
+   * When registering a function it will register it as a const member function
+   * of object in Lua.
+   * When registering a variable it will register it as an usual member variable
+   * of object in Lua. In particular, the member can not be modified by a const
+   * object (this is different with that in C++).
+   *
+   * Should register the member by it's name and address.
+   *
+   * For example:
+   *
+   * Register static member `Obj::si` of type `int` to Obj in Lua:
+   * `register_static_member<Obj>("si", &Obj::si)`
+   *
+   * Register static member function `static int sf(int)` to Obj:
+   * `register_static_member<Obj>("sf", &Obj::sf)`
+   * or do not use "&" to get function's address is also ok:
+   * `register_static_member<Obj>("sf", Obj::sf)`
+   *
+   * @tparam Class The class whom the static member will belong to.
+   * @tparam Member The static member's type.
+   * @param name The static member's name.
+   * @param m The static member's pointer.
+   * @return void
+   */
+  template <typename Class, typename Member>
+  std::enable_if_t<std::is_class<Class>::value> register_static_member(
+      const char* name, Member* m) {
+    static_assert(std::is_same<Class, std::decay_t<Class>>::value,
+                  "Class type should be decayed");
+    PEACALM_LUAW_ASSERT(name);
+    PEACALM_LUAW_ASSERT(m);
+
+    // add const member property for function
+    using MemberPointer = std::conditional_t<
+        std::is_member_function_pointer<Member Class::*>::value,
+        luaw_detail::c_function_to_const_member_function_t<Class, Member>,
+        Member Class::*>;
+
+    register_static_member<MemberPointer>(name, m);
+  }
+  template <typename Class, typename Member>
+  std::enable_if_t<std::is_class<Class>::value> register_static_member(
+      const std::string& name, Member* m) {
+    register_static_member<Class, Member>(name.c_str(), m);
+  }
+
+  /**
+   * @brief Register a static member by providing full fake member pointer type.
+   *
+   * This API can add const/volatile property to member, which the origin static
+   * member may not have.
+   *
+   * Others all same as that API providing class.
+   *
+   * For example:
+   *
+   * Register static member `Obj::si` of type `int` to be a const member of Obj
+   * in Lua with type `const int`:
+   * `register_static_member<const int Obj::*>("si", &Obj::si)`
+   *
+   * Register static member function `static int sf(int)` as a const member
+   * function to Obj:
+   * `register_static_member<int(Obj::*)(int) const>("sf", &Obj::sf)`
+   *
+   * @tparam MemberPointer What kind of member type to let the static member
+   * behaves like in Lua.
+   * @tparam Member The static member's type.
+   * @param name The static member's name.
+   * @param m The static member's pointer.
+   * @return void
+   */
+  template <typename MemberPointer, typename Member>
+  std::enable_if_t<std::is_member_pointer<MemberPointer>::value>
+  register_static_member(const char* name, Member* m) {
+    PEACALM_LUAW_ASSERT(name);
+    PEACALM_LUAW_ASSERT(m);
+    static_assert(
+        std::is_same<MemberPointer, std::decay_t<MemberPointer>>::value,
+        "MemberPointer should be decayed");
+    registrar<std::decay_t<MemberPointer>>::register_member(
+        *this, name, static_mem_fn<Member*>(m));
+  }
+  template <typename MemberPointer, typename Member>
+  std::enable_if_t<std::is_member_pointer<MemberPointer>::value>
+  register_static_member(const std::string& name, Member* m) {
+    register_static_member<MemberPointer, Member>(name.c_str(), m);
+  }
+
+  /**
+   * @brief Register dynamic members
+   *
+   * Dynamic members are members whose names (and also values) are dynamically
+   * defined at run time, such as keys of a table in Lua.
+   * So we can't register them in advance.
+   *
+   * To register dynamic members for a C++ class, it should have a place to
+   * store the members first, usually we can define a map in the class to store
+   * the dynamic members.
+   *
+   * Then we should provide two callable objects, getter and setter, which
+   * introduces Lua how to get and set a dynamic member separately.
+   *
+   * The getter's proto type must be: `Value(const Class*, Key)`
+   * The setter's proto type must be: `void(Class*, Key, Value)`
+   *
+   * Where `Key` type could be `const std::string&` or 'const char*', the former
+   * is recommended. `Value` type could be number, string, bool,
+   * luaw::luavalueidx, luaw::luavalueref, etc.
+   *
+   * @tparam Getter Must be a callable type, e.g. C function or lambda.
+   * @tparam Setter Must be a callable type, e.g. C function or lambda.
+   * @param getter A method to get a member by name.
+   * @param setter A method to set a member's value.
+   */
+  template <typename Getter, typename Setter>
+  void register_dynamic_member(Getter&& getter, Setter&& setter) {
+    register_dynamic_member_getter(std::forward<Getter>(getter));
+    register_dynamic_member_setter(std::forward<Setter>(setter));
+  }
+  template <typename Getter>
+  void register_dynamic_member_getter(Getter&& getter);
+  template <typename Setter>
+  void register_dynamic_member_setter(Setter&& setter);
+
+  /**
+   * @brief Register a member's pointer into Lua.
+   *
+   * Register a fake member into Lua, the fake member is a pointer of a class's
+   * real member.
+   *
+   * Since when getting a member, it will return a copy of the member. So we
+   * can't modify or access efficiently members of the member.
+   *
+   * This feature is used to modify or access efficiently members'
+   * members by getting a member's pointer first then modify or access members
+   * of the member by the pointer.
+   *
+   * The fake member, namely the member's pointer, is always top-level const.
+   *
+   * When using a member's pointer, it is the user's responsibility to make
+   * sure the member is alive, which means the object which holds the member is
+   * alive. Using a pointer to an already recycled member is dangerous, the
+   * behavior is undefined.
+   *
+   *
+   * @tparam Class Should be decayed class type.
+   * @tparam Member Can't be raw pointer or smart pointer type.
+   * @param name The member's pointer name used in Lua.
+   * @param mp Member pointer value.
+   */
+  template <typename Class, typename Member>
+  void register_member_ptr(const char* name, Member Class::*mp) {
+    static_assert(std::is_same<Class, std::decay_t<Class>>::value,
+                  "Class must be decayed");
+    PEACALM_LUAW_ASSERT(name);
+    PEACALM_LUAW_ASSERT(mp);
+    registrar<Member Class::*, luaw::registrar_tag_for_member_ptr>::
+        register_member_ptr(*this, name, [=](auto& o) { return &(o.*mp); });
+  }
+  template <typename Class, typename Member>
+  void register_member_ptr(const std::string& name, Member Class::*mp) {
+    register_member_ptr<Class, Member>(name.c_str(), mp);
+  }
+
+  /**
+   * @brief Register a member's low-level const pointer into Lua.
+   *
+   * No matter whether the member is already const, this can always register a
+   * low-level const pointer of the member into Lua. (Of course the pointer is
+   * top-level const too.)
+   *
+   * This feature is used to access member of member, can't modify.
+   * Others are similar to "register_member_ptr"
+   *
+   * @sa "register_member_ptr"
+   */
+  template <typename Class, typename Member>
+  void register_member_cptr(const char* name, Member Class::*mp) {
+    register_member_ptr<Class, const Member>(name, mp);
+  }
+  template <typename Class, typename Member>
+  void register_member_cptr(const std::string& name, Member Class::*mp) {
+    register_member_cptr<Class, Member>(name.c_str(), mp);
+  }
+
+  /**
+   * @brief Register a member's reference into Lua.
+   *
+   * When registering a member's pointer into Lua using "register_member_ptr",
+   * it registers a member's raw pointer, which is a light userdata, so it does
+   * not have an exclusive metatable, and it is very dangerous to use a light
+   * userdata with a wrong metatable.
+   *
+   * So this feature is to register a member's reference which can access and
+   * modify efficiently the member, just like "register_member_ptr", and have
+   * an exclusive metatable.
+   *
+   * Currently the reference is implimented by a std::shared_ptr holding a raw
+   * member's pointer and without deleter. So it is a full userdata and has
+   * per-value metatables.
+   *
+   * The member's reference is also a fake member, and is also always top-level
+   * const like member's pointer.
+   *
+   * When using a member's reference, it is the user's responsibility to make
+   * sure the member is alive, which means the object which holds the member is
+   * alive. Using a reference to an already recycled member is dangerous, the
+   * behavior is undefined.
+   *
+   * @tparam Class Should be decayed class type.
+   * @tparam Member Can't be raw pointer or smart pointer type.
+   * @param name The member's reference name used in Lua.
+   * @param mp Member pointer value.
+   * @sa "register_member_ptr"
+   */
+  template <typename Class, typename Member>
+  void register_member_ref(const char* name, Member Class::*mp) {
+    static_assert(std::is_same<Class, std::decay_t<Class>>::value,
+                  "Class must be decayed");
+    PEACALM_LUAW_ASSERT(name);
+    PEACALM_LUAW_ASSERT(mp);
+    registrar<Member Class::*, luaw::registrar_tag_for_member_ptr>::
+        register_member_ref(*this, name, std::mem_fn(mp));
+  }
+  template <typename Class, typename Member>
+  void register_member_ref(const std::string& name, Member Class::*mp) {
+    register_member_ref<Class, Member>(name.c_str(), mp);
+  }
+
+  /**
+   * @brief Register a member's low-level const reference into Lua.
+   *
+   * Like "register_member_ref", but this will register a low-level const
+   * reference (Of course it is also top-level const). The const reference can
+   * only be used to access members, can not modify.
+   *
+   * @sa "register_member_ref"
+   */
+  template <typename Class, typename Member>
+  void register_member_cref(const char* name, Member Class::*mp) {
+    register_member_ref<Class, const Member>(name, mp);
+  }
+  template <typename Class, typename Member>
+  void register_member_cref(const std::string& name, Member Class::*mp) {
+    register_member_cref<Class, Member>(name.c_str(), mp);
+  }
+
+  /**
+   * @brief Register a static member's pointer into Lua.
+   *
+   * @sa "register_static_member"
+   * @sa "register_member_ptr"
+   *
+   * @tparam Class The class whom the static member will belong to. Must be a
+   * decayed class type.
+   * @tparam Member Type of the static member.
+   * @param name Name of the member's pointer used in Lua.
+   * @param mp The static member's pointer value.
+   */
+  template <typename Class, typename Member>
+  void register_static_member_ptr(const char* name, Member* mp) {
+    static_assert(std::is_class<Class>::value,
+                  "Static members must belong to a class type");
+    static_assert(std::is_same<Class, std::decay_t<Class>>::value,
+                  "Class must be decayed");
+    PEACALM_LUAW_ASSERT(name);
+    PEACALM_LUAW_ASSERT(mp);
+    registrar<Member Class::*, luaw::registrar_tag_for_member_ptr>::
+        register_member_ptr(*this, name, [=](auto&) { return mp; });
+  }
+  template <typename Class, typename Member>
+  void register_static_member_ptr(const std::string& name, Member* mp) {
+    register_static_member_ptr<Class, Member>(name.c_str(), mp);
+  }
+
+  /**
+   * @brief Register a static member's low-level const pointer into Lua.
+   *
+   * @sa "register_static_member_ptr"
+   */
+  template <typename Class, typename Member>
+  void register_static_member_cptr(const char* name, Member* mp) {
+    register_static_member_ptr<Class, const Member>(name, mp);
+  }
+  template <typename Class, typename Member>
+  void register_static_member_cptr(const std::string& name, Member* mp) {
+    register_static_member_cptr<Class, Member>(name.c_str(), mp);
+  }
+
+  /**
+   * @brief Register a static member's reference into Lua.
+   *
+   * @sa "register_static_member"
+   * @sa "register_member_ref"
+   */
+  template <typename Class, typename Member>
+  void register_static_member_ref(const char* name, Member* mp) {
+    static_assert(std::is_class<Class>::value,
+                  "Static members must belong to a class type");
+    static_assert(std::is_same<Class, std::decay_t<Class>>::value,
+                  "Class must be decayed");
+    PEACALM_LUAW_ASSERT(name);
+    PEACALM_LUAW_ASSERT(mp);
+    registrar<Member Class::*, luaw::registrar_tag_for_member_ptr>::
+        register_member_ref(*this, name, static_mem_fn<Member*>(mp));
+  }
+  template <typename Class, typename Member>
+  void register_static_member_ref(const std::string& name, Member* mp) {
+    register_static_member_ref<Class, Member>(name.c_str(), mp);
+  }
+
+  /**
+   * @brief Register a static member's low-level const reference into Lua.
+   *
+   * @sa "register_static_member_ref"
+   */
+  template <typename Class, typename Member>
+  void register_static_member_cref(const char* name, Member* mp) {
+    register_static_member_ref<Class, const Member>(name, mp);
+  }
+  template <typename Class, typename Member>
+  void register_static_member_cref(const std::string& name, Member* mp) {
+    register_static_member_cref<Class, Member>(name.c_str(), mp);
+  }
+
+  //////////////////////// compiled chunk cache for eval ////////////////////////
+
+  /// Statistics of the compiled chunk cache for eval.
+  struct eval_cache_stats {
+    size_t capacity  = 0;
+    size_t size      = 0;
+    size_t hits      = 0;
+    size_t misses    = 0;
+    size_t evictions = 0;
+  };
+
+  /**
+   * @brief Enable a bounded LRU cache of compiled chunks for eval.
+   *
+   * Once enabled, eval_* and eval<T> compile an expression only at its first
+   * evaluation, then reuse the compiled function stored in LUA_REGISTRYINDEX.
+   * The least recently used ones are evicted when the cache is full.
+   * The cache belongs to the Lua state, so it is shared by all luaw objects
+   * (including fakeluaw and subluaw) working on the same state.
+   * If already enabled, only the capacity is changed.
+   *
+   * @param [in] capacity Max number of compiled chunks to keep.
+   */
+  void enable_eval_cache(size_t capacity = 1024) {
+    luaw_detail::chunk_cache* c = get_eval_cache();
+    if (c) {
+      c->capacity(L_, capacity);
+      return;
+    }
+    __new_registry_object<luaw_detail::chunk_cache>(eval_cache_key(),
+                                                    capacity);
+  }
+
+  /// Disable the compiled chunk cache and release all cached chunks.
+  void disable_eval_cache() {
+    luaw_detail::chunk_cache* c = get_eval_cache();
+    if (!c) return;
+    c->clear(L_);
+    __delete_registry_object(eval_cache_key());
+  }
+
+  /// Whether the compiled chunk cache for eval is enabled.
+  bool eval_cache_enabled() const { return get_eval_cache() != nullptr; }
+
+  /// Release all cached chunks but keep the cache enabled.
+  void clear_eval_cache() {
+    luaw_detail::chunk_cache* c = get_eval_cache();
+    if (c) c->clear(L_);
+  }
+
+  /// Get statistics of the compiled chunk cache. All zero if not enabled.
+  eval_cache_stats get_eval_cache_stats() const {
+    eval_cache_stats          ret;
+    luaw_detail::chunk_cache* c = get_eval_cache();
+    if (c) {
+      ret.capacity  = c->capacity();
+      ret.size      = c->size();
+      ret.hits      = c->hits();
+      ret.misses    = c->misses();
+      ret.evictions = c->evictions();
+    }
+    return ret;
+  }
+
+private:
+  // Make a C++ object of type T in a full userdata, which is kept in
+  // LUA_REGISTRYINDEX by given key, and destructed when collected.
+  template <typename T, typename... Args>
+  T* __new_registry_object(const void* key, Args&&... args) {
+    void* p = lua_newuserdatauv(L_, sizeof(T), 0);
+    T*    o = new (p) T(std::forward<Args>(args)...);
+    newtable();
+    pushcfunction([](lua_State* L) -> int {
+      auto o = static_cast<T*>(lua_touserdata(L, 1));
+      PEACALM_LUAW_ASSERT(o);
+      o->~T();
+      return 0;
+    });
+    setfield(-2, "__gc");
+    setmetatable(-2);
+    lua_rawsetp(L_, LUA_REGISTRYINDEX, key);
+    return o;
+  }
+
+  // Get the C++ object made by __new_registry_object, or nullptr.
+  template <typename T>
+  T* __get_registry_object(const void* key) const {
+    lua_rawgetp(L_, LUA_REGISTRYINDEX, key);
+    auto o = static_cast<T*>(lua_touserdata(L_, -1));
+    lua_pop(L_, 1);
+    return o;
+  }
+
+  void __delete_registry_object(const void* key) {
+    lua_pushnil(L_);
+    lua_rawsetp(L_, LUA_REGISTRYINDEX, key);
+  }
+
+  static const void* eval_cache_key() {
+    return &typeid(luaw_detail::chunk_cache);
+  }
+
+  luaw_detail::chunk_cache* get_eval_cache() const {
+    return __get_registry_object<luaw_detail::chunk_cache>(eval_cache_key());
+  }
+
+  // Load an expression as a function on top of stack, by the compiled chunk
+  // cache if enabled. Return value is the same as luaL_loadstring.
+  // The expression needn't be NUL-terminated, @sa __loadbuffer for chunkname.
+  int __load_expr(const char* expr, size_t len, const char* chunkname) {
+    luaw_detail::chunk_cache* c = get_eval_cache();
+    if (!c) return __loadbuffer(expr, len, chunkname);
+    int ref = c->find(expr, len);
+    if (ref != LUA_NOREF) {
+      lua_rawgeti(L_, LUA_REGISTRYINDEX, ref);
+      return LUA_OK;
+    }
+    int retcode = __loadbuffer(expr, len, chunkname);
+    if (retcode == LUA_OK) {
+      pushvalue(-1);
+      c->insert(L_, expr, len, luaL_ref(L_, LUA_REGISTRYINDEX));
+    }
+    return retcode;
+  }
+
+  // Like dostring but by the compiled chunk cache if enabled.
+  int __do_expr(const char* expr, size_t len, const char* chunkname) {
+    return __load_expr(expr, len, chunkname) ||
+           lua_pcall(L_, 0, LUA_MULTRET, 0);
+  }
+  int __do_expr(const char* expr) {
+    PEACALM_LUAW_ASSERT(expr);
+    return __do_expr(expr, strlen(expr), expr);
+  }
+
+  compiled_expr __compile(const char* expr,
+                          size_t      len,
+                          const char* chunkname,
+                          bool        disable_log,
+                          bool*       failed);
+
+public:
+  /**
+   * @brief Get names of global variables a Lua function may read, by
+   * analyzing its bytecode without running it.
+   *
+   * Names are keys of _ENV read by the function and its nested functions,
+   * excluding those assigned anywhere in them, in order of first appearance
+   * (the function's own code goes before its nested functions).
+   * Globals accessed by constant names are recognized, including long names
+   * (more than 40 bytes) and names with constant indices greater than 255,
+   * which are accessed by GETUPVAL and GETTABLE instead of GETTABUP.
+   * Not recognized are globals accessed by dynamic keys (e.g. _ENV[k] or
+   * _G[k]), by tables other than the upvalue _ENV (e.g. a local _ENV or a
+   * local alias of _ENV), or by code that is not in the function (e.g. made by
+   * load).
+   * The function could be any Lua function, not only a main chunk: its _ENV
+   * upvalue is found by name. If its debug information is stripped, its
+   * first upvalue is taken as _ENV as for a main chunk.
+   *
+   * @param [in] idx Index of the function on stack.
+   * @param [out] failed Will be set whether the analysis is failed (e.g. not
+   * a Lua function) if this pointer is not nullptr.
+   * @return Global names.
+   */
+  std::vector<std::string> get_free_globals(int   idx    = -1,
+                                            bool* failed = nullptr) {
+    std::string       chunk;
+    std::vector<bool> env;
+    bool              ok = false;
+    if (isfunction(idx) && !iscfunction(idx)) {
+      pushvalue(idx);
+      ok = lua_dump(L_, luaw_detail::bytecode::string_writer, &chunk, 1) == 0;
+      const char* name;
+      for (int i = 1; (name = lua_getupvalue(L_, -1, i)) != nullptr; ++i) {
+        pop();
+        env.push_back(strcmp(name, "_ENV") == 0 ||
+                      (i == 1 && strcmp(name, "(no name)") == 0));
+      }
+      pop();
+    }
+    luaw_detail::bytecode::free_globals fg;
+    ok = ok && fg.analyze(chunk.data(), chunk.size(), env);
+    if (failed) *failed = !ok;
+    return ok ? fg.result() : std::vector<std::string>{};
+  }
+
+  /**
+   * @brief Compile a Lua expression into a handle which can be evaluated
+   * repeatedly.
+   *
+   * @param [in] expr Lua expression, same as that used by eval.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the compilation is failed if this
+   * pointer is not nullptr.
+   * @return A compiled_expr. It's invalid if compilation failed.
+   */
+  compiled_expr compile(const char* expr,
+                        bool        disable_log = false,
+                        bool*       failed      = nullptr);
+  compiled_expr compile(const std::string& expr,
+                        bool               disable_log = false,
+                        bool*              failed      = nullptr);
+#if PEACALM_LUAW_SUPPORT_CPP17
+  compiled_expr compile(std::string_view expr,
+                        bool             disable_log = false,
+                        bool*            failed      = nullptr);
+#endif
+
+  /**
+   * @brief Fuse many Lua expressions into one compiled_expr, which returns
+   * results of all expressions in order, one result for each expression.
+   *
+   * All expressions are evaluated in one protected call, so it fails as a
+   * whole if any expression fails. Get the results by compiled_expr's
+   * eval<std::tuple<...>> or eval_all<T>.
+   * Limited by Lua's register number, it could fuse at most about 250
+   * expressions.
+   *
+   * @param [in] exprs Lua expressions, each is like that used by eval.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the compilation is failed if this
+   * pointer is not nullptr.
+   * @return A compiled_expr. It's invalid if compilation failed.
+   */
+  compiled_expr compile_fused(const std::vector<std::string>& exprs,
+                              bool                            disable_log = false,
+                              bool*                           failed = nullptr);
+
+  /**
+   * @brief Compile a Lua expression which could be evaluated natively in C++
+   * without Lua VM if possible.
+   *
+   * Supported expressions are like "return a + b * 2 >= c and IF(d, e, f)",
+   * which consist of only numerals, true/false/nil, variables, parentheses,
+   * arithmetic operators (+ - * / // % ^), comparisons (== ~= < <= > >=),
+   * logical operators (and/or/not) and the extended function IF. Results are
+   * exactly the same as those evaluated by Lua. Other expressions are
+   * evaluated by Lua transparently.
+   *
+   * @param [in] expr Lua expression, same as that used by eval.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the compilation is failed if this
+   * pointer is not nullptr.
+   * @return A native_expr. It's invalid if compilation failed.
+   */
+  native_expr compile_native(const char* expr,
+                             bool        disable_log = false,
+                             bool*       failed      = nullptr);
+  native_expr compile_native(const std::string& expr,
+                             bool               disable_log = false,
+                             bool*              failed      = nullptr);
+
+  //////////////////////// evaluate expression /////////////////////////////////
+
+  /**
+   * @brief Evaluate a Lua expression and get the result in simple C++ type.
+   *
+   * The compiled expression is reused if the eval cache is enabled.
+   * @sa enable_eval_cache.
+   *
+   * @param [in] expr Lua expression, which must have a return value. Only the
+   * first one is used if multiple values returned.
+   * @param [in] def The default value returned if failed.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the operation is failed if this
+   * pointer is not nullptr.
+   *
+   * @{
+   */
+
+#if PEACALM_LUAW_SUPPORT_CPP17
+#define DEFINE_EVAL_STRING_VIEW(typename, type, default)                      \
+  type eval_##typename(std::string_view expr,                                 \
+                       const type&      def         = default,                \
+                       bool             disable_log = false,                  \
+                       bool*            failed      = nullptr) {                          \
+    return __eval_##typename(                                                 \
+        expr.data(), expr.size(), nullptr, def, disable_log, failed);         \
+  }
+#else
+#define DEFINE_EVAL_STRING_VIEW(typename, type, default)
+#endif
+
+#define DEFINE_EVAL(typename, type, default)                                  \
+private:                                                                      \
+  type __eval_##typename(const char* expr,                                    \
+                         size_t      len,                                     \
+                         const char* chunkname,                               \
+                         const type& def,                                     \
+                         bool        disable_log,                             \
+                         bool*       failed) {                                \
+    int  sz = gettop();                                                       \
+    auto _g = make_guarder();                                                 \
+    if (__do_expr(expr, len, chunkname) != LUA_OK) {                          \
+      if (failed) *failed = true;                                             \
+      if (!disable_log) log_error_in_stack();                                 \
+      return def;                                                             \
+    }                                                                         \
+    PEACALM_LUAW_ASSERT(gettop() >= sz);                                      \
+    if (gettop() <= sz) {                                                     \
+      if (failed) *failed = true;                                             \
+      if (!disable_log) log_error("No return");                               \
+      return def;                                                             \
+    }                                                                         \
+    type ret = to_##typename(sz + 1, def, disable_log, failed);               \
+    return ret;                                                               \
+  }                                                                           \
+                                                                              \
+public:                                                                       \
+  type eval_##typename(const char* expr,                                      \
+                       const type& def         = default,                     \
+                       bool        disable_log = false,                       \
+                       bool*       failed      = nullptr) {                              \
+    PEACALM_LUAW_ASSERT(expr);                                                \
+    return __eval_##typename(                                                 \
+        expr, strlen(expr), expr, def, disable_log, failed);                  \
+  }                                                                           \
+  type eval_##typename(const std::string& expr,                               \
+                       const type&        def         = default,              \
+                       bool               disable_log = false,                \
+                       bool*              failed      = nullptr) {                              \
+    return __eval_##typename(                                                 \
+        expr.data(), expr.size(), expr.c_str(), def, disable_log, failed);    \
+  }                                                                           \
+  DEFINE_EVAL_STRING_VIEW(typename, type, default)
+
+  DEFINE_EVAL(bool, bool, false)
+  DEFINE_EVAL(int, int, 0)
+  DEFINE_EVAL(uint, unsigned int, 0)
+  DEFINE_EVAL(long, long, 0)
+  DEFINE_EVAL(ulong, unsigned long, 0)
+  DEFINE_EVAL(llong, long long, 0)
+  DEFINE_EVAL(ullong, unsigned long long, 0)
+  DEFINE_EVAL(float, float, 0)
+  DEFINE_EVAL(double, double, 0)
+  DEFINE_EVAL(ldouble, long double, 0)
+  DEFINE_EVAL(string, std::string, "")
+#undef DEFINE_EVAL
+#undef DEFINE_EVAL_STRING_VIEW
+
+  // Caller is responsible for popping stack if succeeds
+  const char* eval_c_str(const char* expr,
+                         const char* def         = "",
+                         bool        disable_log = false,
+                         bool*       failed      = nullptr) {
+    int sz = gettop();
+    if (__do_expr(expr) != LUA_OK) {
+      if (failed) *failed = true;
+      if (!disable_log) log_error_in_stack();
+      settop(sz);
+      return def;
+    }
+    PEACALM_LUAW_ASSERT(gettop() >= sz);
+    if (gettop() <= sz) {
+      if (failed) *failed = true;
+      if (!disable_log) log_error("No return");
+      return def;
+    }
+    return to_c_str(sz + 1, def, disable_log, failed);
+  }
+  const char* eval_c_str(const std::string& expr,
+                         const char*        def         = "",
+                         bool               disable_log = false,
+                         bool*              failed      = nullptr) {
+    return eval_c_str(expr.c_str(), def, disable_log, failed);
+  }
+
+  // Zero-copy and safe version. Stack is balanced.
+  // The result views "def" if failed, so "def" should outlive it.
+  scoped_string_view eval_string_view(const char* expr,
+                                      const char* def         = "",
+                                      bool        disable_log = false,
+                                      bool*       failed      = nullptr) {
+    PEACALM_LUAW_ASSERT(expr);
+    return __eval_string_view(
+        expr, strlen(expr), expr, def, disable_log, failed);
+  }
+  scoped_string_view eval_string_view(const std::string& expr,
+                                      const char*        def         = "",
+                                      bool               disable_log = false,
+                                      bool*              failed = nullptr) {
+    return __eval_string_view(
+        expr.data(), expr.size(), expr.c_str(), def, disable_log, failed);
+  }
+#if PEACALM_LUAW_SUPPORT_CPP17
+  scoped_string_view eval_string_view(std::string_view expr,
+                                      const char*      def         = "",
+                                      bool             disable_log = false,
+                                      bool*            failed      = nullptr) {
+    return __eval_string_view(
+        expr.data(), expr.size(), nullptr, def, disable_log, failed);
+  }
+#endif
+
+  /** @} */
+
+private:
+  scoped_string_view __eval_string_view(const char* expr,
+                                        size_t      len,
+                                        const char* chunkname,
+                                        const char* def,
+                                        bool        disable_log,
+                                        bool*       failed) {
+    int  sz = gettop();
+    auto _g = make_guarder();
+    if (__do_expr(expr, len, chunkname) != LUA_OK) {
+      if (failed) *failed = true;
+      if (!disable_log) log_error_in_stack();
+      return scoped_string_view(def);
+    }
+    PEACALM_LUAW_ASSERT(gettop() >= sz);
+    if (gettop() <= sz) {
+      if (failed) *failed = true;
+      if (!disable_log) log_error("No return");
+      return scoped_string_view(def);
+    }
+    return to_string_view(sz + 1, def, disable_log, failed);
+  }
+
+public:
+
+  /**
+   * @brief Evaluate a Lua expression and get result in complex C++ type.
+   *
+   * @sa method "to".
+   * But more, T could be void or std::tuple<> to represent the expression has
+   * no return, or we'll discard all it's returns.
+   * Besides, T could be std::tuple to accept multiple returns of the
+   * expression. If T is a nested std::tuple, only the outmost level std::tuple
+   * is mapped to multiple values of return, any inner std::tuple is mapped to a
+   * Lua table.
+   *
+   * @tparam T The result type user expected.
+   * @param [in] expr Lua expression, which can have no return, one return or
+   * multiple returns.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the operation is failed if this
+   * pointer is not nullptr. If T is a container type, it regards the operation
+   * as failed if any element failed.
+   * @return The expression's result in type T. If T is not void or
+   * std::tuple<>, the expression must provide return values.
+   */
+  template <typename T>
+  T eval(const char* expr, bool disable_log = false, bool* failed = nullptr) {
+    PEACALM_LUAW_ASSERT(expr);
+    return __eval<T>(expr, strlen(expr), expr, disable_log, failed);
+  }
+  template <typename T>
+  T eval(const std::string& expr,
+         bool               disable_log = false,
+         bool*              failed      = nullptr) {
+    return __eval<T>(
+        expr.data(), expr.size(), expr.c_str(), disable_log, failed);
+  }
+#if PEACALM_LUAW_SUPPORT_CPP17
+  template <typename T>
+  T eval(std::string_view expr,
+         bool             disable_log = false,
+         bool*            failed      = nullptr) {
+    return __eval<T>(expr.data(), expr.size(), nullptr, disable_log, failed);
+  }
+#endif
+
+private:
+  template <typename T>
+  T __eval(const char* expr,
+           size_t      len,
+           const char* chunkname,
+           bool        disable_log,
+           bool*       failed) {
+    auto _g = make_guarder();
+    int  sz = gettop();
+    if (__do_expr(expr, len, chunkname) != LUA_OK) {
+      if (failed) *failed = true;
+      if (!disable_log) log_error_in_stack();
+      return T();
+    }
+    PEACALM_LUAW_ASSERT(gettop() >= sz);
+    if (gettop() <= sz && !std::is_same<std::decay_t<T>, std::tuple<>>::value &&
+        !std::is_same<std::decay_t<T>, void>::value) {
+      if (failed) *failed = true;
+      if (!disable_log) log_error("No return");
+      return T();
+    }
+    return convertor_for_return<std::decay_t<T>>::to(
+        *this, sz + 1, disable_log, failed);
+  }
+
+public:
+  /**
+   * @brief Evaluate a Lua expression against a given environment table
+   * instead of the global table.
+   *
+   * Each evaluation runs a fresh function of the expression whose _ENV
+   * upvalue is the environment table, so assignments to global variables in
+   * the expression never leak into _G, and nested evaluations (e.g. by a
+   * provider) of the same expression never see each other's environment.
+   * Functions created by the expression keep the environment.
+   * If the compiled chunk cache is enabled, the fresh function is loaded from
+   * bytecode memoized with the cached chunk instead of the source.
+   *
+   * @tparam T The result type user expected. Same as eval<T>.
+   * @param [in] expr Lua expression.
+   * @param [in] env_idx Index of the environment table on stack. It could be
+   * any value to be used as _ENV, usually a table with a metatable whose
+   * "__index" is _G to make global functions accessible.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the operation is failed if this
+   * pointer is not nullptr.
+   * @return The expression's result in type T.
+   */
+  template <typename T>
+  T eval_with_env(const char* expr,
+                  int         env_idx,
+                  bool        disable_log = false,
+                  bool*       failed      = nullptr) {
+    PEACALM_LUAW_ASSERT(expr);
+    return __eval_with_env<T>(
+        expr, strlen(expr), expr, env_idx, disable_log, failed);
+  }
+  template <typename T>
+  T eval_with_env(const std::string& expr,
+                  int                env_idx,
+                  bool               disable_log = false,
+                  bool*              failed      = nullptr) {
+    return __eval_with_env<T>(
+        expr.data(), expr.size(), expr.c_str(), env_idx, disable_log, failed);
+  }
+#if PEACALM_LUAW_SUPPORT_CPP17
+  template <typename T>
+  T eval_with_env(std::string_view expr,
+                  int              env_idx,
+                  bool             disable_log = false,
+                  bool*            failed      = nullptr) {
+    return __eval_with_env<T>(
+        expr.data(), expr.size(), nullptr, env_idx, disable_log, failed);
+  }
+#endif
+
+  /**
+   * @brief Evaluate a Lua expression against a new environment made by
+   * given bindings.
+   *
+   * The new environment contains the bindings as variables, and falls back to
+   * _G for other variables by a shared metatable (so a custom_luaw still
+   * provides variables missing in bindings). Nothing leaks into _G.
+   *
+   * @sa eval_with_env by environment table.
+   */
+  template <typename T, typename V, typename... Args>
+  T eval_with_env(const char*                              expr,
+                  const std::map<std::string, V, Args...>& bindings,
+                  bool                                     disable_log = false,
+                  bool*                                    failed = nullptr) {
+    PEACALM_LUAW_ASSERT(expr);
+    return __eval_with_bindings<T>(
+        expr, strlen(expr), expr, bindings, disable_log, failed);
+  }
+  template <typename T, typename V, typename... Args>
+  T eval_with_env(const std::string&                       expr,
+                  const std::map<std::string, V, Args...>& bindings,
+                  bool                                     disable_log = false,
+                  bool*                                    failed = nullptr) {
+    return __eval_with_bindings<T>(
+        expr.data(), expr.size(), expr.c_str(), bindings, disable_log, failed);
+  }
+  template <typename T, typename V, typename... Args>
+  T eval_with_env(const char*                                        expr,
+                  const std::unordered_map<std::string, V, Args...>& bindings,
+                  bool  disable_log = false,
+                  bool* failed      = nullptr) {
+    PEACALM_LUAW_ASSERT(expr);
+    return __eval_with_bindings<T>(
+        expr, strlen(expr), expr, bindings, disable_log, failed);
+  }
+  template <typename T, typename V, typename... Args>
+  T eval_with_env(const std::string&                                 expr,
+                  const std::unordered_map<std::string, V, Args...>& bindings,
+                  bool  disable_log = false,
+                  bool* failed      = nullptr) {
+    return __eval_with_bindings<T>(
+        expr.data(), expr.size(), expr.c_str(), bindings, disable_log, failed);
+  }
+#if PEACALM_LUAW_SUPPORT_CPP17
+  template <typename T, typename V, typename... Args>
+  T eval_with_env(std::string_view                         expr,
+                  const std::map<std::string, V, Args...>& bindings,
+                  bool                                     disable_log = false,
+                  bool*                                    failed = nullptr) {
+    return __eval_with_bindings<T>(
+        expr.data(), expr.size(), nullptr, bindings, disable_log, failed);
+  }
+  template <typename T, typename V, typename... Args>
+  T eval_with_env(std::string_view                                   expr,
+                  const std::unordered_map<std::string, V, Args...>& bindings,
+                  bool  disable_log = false,
+                  bool* failed      = nullptr) {
+    return __eval_with_bindings<T>(
+        expr.data(), expr.size(), nullptr, bindings, disable_log, failed);
+  }
+#endif
+
+  /**
+   * @brief Push a new empty environment table whose metatable falls back to
+   * _G, which could be used by eval_with_env.
+   *
+   * The metatable is created once and shared for each Lua state.
+   */
+  void push_env_table(int narr = 0, int nrec = 0) {
+    lua_createtable(L_, narr, nrec);
+    if (luaL_newmetatable(L_, "luaw_env_mt")) {
+      lua_pushglobaltable(L_);
+      lua_setfield(L_, -2, "__index");
+    }
+    lua_setmetatable(L_, -2);
+  }
+
+private:
+  // Index of the upvalue named _ENV of the function at "fidx", or 0.
+  // A main chunk loaded from stripped binary has no upvalue names, but its
+  // first upvalue is always _ENV.
+  static int __env_upvalue_index(lua_State* L, int fidx) {
+    const char* name;
+    for (int i = 1; (name = lua_getupvalue(L, fidx, i)) != nullptr; ++i) {
+      lua_pop(L, 1);
+      if (strcmp(name, "_ENV") == 0) return i;
+      if (i == 1 && strcmp(name, "(no name)") == 0) return 1;
+    }
+    return 0;
+  }
+
+  // Load a main chunk from bytecode as a fresh function on top of stack, with
+  // its _ENV upvalue set to the value at "env_idx" (an absolute index).
+  // Return value is the same as luaL_loadbuffer.
+  static int __load_bytecode_with_env(lua_State*         L,
+                                      const std::string& bytecode,
+                                      int                env_idx) {
+    int retcode = luaL_loadbufferx(
+        L, bytecode.data(), bytecode.size(), "=(bytecode)", "b");
+    if (retcode != LUA_OK) return retcode;
+    const int i = __env_upvalue_index(L, lua_gettop(L));
+    if (i > 0) {
+      lua_pushvalue(L, env_idx);
+      lua_setupvalue(L, -2, i);
+    }
+    return LUA_OK;
+  }
+
+  // Dump the function on top of stack with debug information.
+  static std::shared_ptr<const std::string> __dump_function(lua_State* L) {
+    std::string b;
+    if (lua_dump(L, luaw_detail::bytecode::string_writer, &b, 0) != 0) {
+      return nullptr;
+    }
+    return std::make_shared<const std::string>(std::move(b));
+  }
+
+  // Load an expression as a fresh function on top of stack with its _ENV
+  // upvalue set to the value at "env_idx" (an absolute index). It's never a
+  // function shared with other evaluations, e.g. one in the compiled chunk
+  // cache, so evaluations never see each other's environment. If the cache is
+  // enabled, the function is loaded from bytecode memoized with the cached
+  // chunk. Return value is the same as luaL_loadstring.
+  int __load_expr_with_env(const char* expr,
+                           size_t      len,
+                           const char* chunkname,
+                           int         env_idx) {
+    luaw_detail::chunk_cache* c = get_eval_cache();
+    if (!c) {
+      int retcode = __loadbuffer(expr, len, chunkname);
+      if (retcode == LUA_OK) {
+        const int i = __env_upvalue_index(L_, gettop());
+        if (i > 0) {
+          pushvalue(env_idx);
+          lua_setupvalue(L_, -2, i);
+        }
+      }
+      return retcode;
+    }
+    std::shared_ptr<const std::string> b = c->bytecode(expr, len);
+    if (!b) {
+      int retcode = __load_expr(expr, len, chunkname);
+      if (retcode != LUA_OK) return retcode;
+      b = __dump_function(L_);
+      pop();
+      if (!b) {
+        pushstring("Failed to dump the compiled chunk");
+        return LUA_ERRERR;
+      }
+      c->bytecode(expr, len, b);
+    }
+    return __load_bytecode_with_env(L_, *b, env_idx);
+  }
+
+  template <typename T>
+  T __eval_with_env(const char* expr,
+                    size_t      len,
+                    const char* chunkname,
+                    int         env_idx,
+                    bool        disable_log,
+                    bool*       failed) {
+    auto _g = make_guarder();
+    int  sz = gettop();
+    env_idx = abs_index(env_idx);
+    if (__load_expr_with_env(expr, len, chunkname, env_idx) != LUA_OK ||
+        lua_pcall(L_, 0, LUA_MULTRET, 0) != LUA_OK) {
+      if (failed) *failed = true;
+      if (!disable_log) log_error_in_stack();
+      return T();
+    }
+    PEACALM_LUAW_ASSERT(gettop() >= sz);
+    if (gettop() <= sz && !std::is_same<std::decay_t<T>, std::tuple<>>::value &&
+        !std::is_same<std::decay_t<T>, void>::value) {
+      if (failed) *failed = true;
+      if (!disable_log) log_error("No return");
+      return T();
+    }
+    return convertor_for_return<std::decay_t<T>>::to(
+        *this, sz + 1, disable_log, failed);
+  }
+
+  template <typename T, typename Bindings>
+  T __eval_with_bindings(const char*     expr,
+                         size_t          len,
+                         const char*     chunkname,
+                         const Bindings& bindings,
+                         bool            disable_log,
+                         bool*           failed) {
+    auto _g = make_guarder();
+    push_env_table(0, static_cast<int>(bindings.size()));
+    for (const auto& kv : bindings) {
+      push(kv.second);
+      lua_setfield(L_, -2, kv.first.c_str());
+    }
+    return __eval_with_env<T>(
+        expr, len, chunkname, -1, disable_log, failed);
+  }
+
+public:
+  /// A named column of values, used as input of eval_batch.
+  /// It doesn't copy the values, so the values must outlive it.
+  class batch_column {
+  public:
+    enum kind_t : char { number, integer, string };
+
+    batch_column(const std::string& name, const double* data, size_t size)
+        : name_(name), kind_(number), size_(size), data_(data) {}
+    batch_column(const std::string& name, const std::vector<double>& v)
+        : batch_column(name, v.data(), v.size()) {}
+
+    batch_column(const std::string& name, const int* data, size_t size)
+        : name_(name), kind_(integer), size_(size), data_(data) {}
+    batch_column(const std::string& name, const std::vector<int>& v)
+        : batch_column(name, v.data(), v.size()) {}
+
+    batch_column(const std::string&   name,
+                 const lua_integer_t* data,
+                 size_t               size)
+        : name_(name), kind_(integer), size_(size), data_(data), wide_(true) {}
+    batch_column(const std::string& name, const std::vector<lua_integer_t>& v)
+        : batch_column(name, v.data(), v.size()) {}
+
+    batch_column(const std::string& name, const std::string* data, size_t size)
+        : name_(name), kind_(string), size_(size), data_(data) {}
+    batch_column(const std::string& name, const std::vector<std::string>& v)
+        : batch_column(name, v.data(), v.size()) {}
+
+    const std::string& name() const { return name_; }
+    kind_t             kind() const { return kind_; }
+    size_t             size() const { return size_; }
+    const void*        data() const { return data_; }
+
+    /// Push the value at given row onto stack.
+    void push(lua_State* L, size_t row) const {
+      PEACALM_LUAW_ASSERT(row < size_);
+      if (kind_ == number) {
+        lua_pushnumber(L, static_cast<const double*>(data_)[row]);
+      } else if (kind_ == integer) {
+        if (wide_) {
+          lua_pushinteger(L, static_cast<const lua_integer_t*>(data_)[row]);
+        } else {
+          lua_pushinteger(L, static_cast<const int*>(data_)[row]);
+        }
+      } else {
+        const std::string& v = static_cast<const std::string*>(data_)[row];
+        lua_pushlstring(L, v.data(), v.size());
+      }
+    }
+
+  private:
+    std::string name_;
+    kind_t      kind_;
+    size_t      size_;
+    const void* data_;
+    bool        wide_ = false;
+  };
+
+  /**
+   * @brief Evaluate one Lua expression over many rows of variables.
+   *
+   * The expression is compiled once (or got from the eval cache if enabled).
+   * For each row, every column's value at that row is set to a global variable
+   * named by the column by raw access, then the expression is evaluated.
+   * All columns should have the same size, which is the number of rows.
+   * The variables of the last row are left in global table after evaluation.
+   *
+   * @tparam T The result type of each row, same as that of eval<T>.
+   * @param [in] expr Lua expression.
+   * @param [in] columns Input values of variables in columns.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the operation is failed if this
+   * pointer is not nullptr. It's failed if any row failed.
+   * @return Results of all rows. A failed row gets a value-initialized T.
+   */
+  template <typename T>
+  std::vector<T> eval_batch(const char*                      expr,
+                            const std::vector<batch_column>& columns,
+                            bool                             disable_log = false,
+                            bool*                            failed = nullptr) {
+    PEACALM_LUAW_ASSERT(expr);
+    std::vector<T> ret;
+    if (failed) *failed = false;
+    size_t rows = columns.empty() ? 0 : columns.front().size();
+    for (const auto& c : columns) {
+      if (c.size() != rows) {
+        if (failed) *failed = true;
+        if (!disable_log) log_error("Columns have different sizes");
+        return ret;
+      }
+    }
+    auto _g = make_guarder();
+    if (__load_expr(expr, strlen(expr), expr) != LUA_OK) {
+      if (failed) *failed = true;
+      if (!disable_log) log_error_in_stack();
+      return ret;
+    }
+    const int fidx = gettop();
+    if (!checkstack(static_cast<int>(columns.size()) + 3)) {
+      if (failed) *failed = true;
+      if (!disable_log) log_error("Too many columns");
+      return ret;
+    }
+    lua_pushglobaltable(L_);
+    const int gidx = gettop();
+    for (const auto& c : columns) pushstring(c.name().c_str());
+    const int sz = gettop();
+    ret.reserve(rows);
+    for (size_t r = 0; r < rows; ++r) {
+      for (size_t i = 0; i < columns.size(); ++i) {
+        pushvalue(gidx + 1 + static_cast<int>(i));
+        columns[i].push(L_, r);
+        rawset(gidx);
+      }
+      pushvalue(fidx);
+      if (pcall(0, LUA_MULTRET, 0) != LUA_OK) {
+        if (failed) *failed = true;
+        if (!disable_log) log_error_in_stack();
+        settop(sz);
+        ret.emplace_back();
+        continue;
+      }
+      if (gettop() <= sz &&
+          !std::is_same<std::decay_t<T>, std::tuple<>>::value) {
+        if (failed) *failed = true;
+        if (!disable_log) log_error("No return");
+        ret.emplace_back();
+        continue;
+      }
+      bool row_failed = false;
+      ret.push_back(convertor_for_return<std::decay_t<T>>::to(
+          *this, sz + 1, disable_log, &row_failed));
+      if (row_failed && failed) *failed = true;
+      settop(sz);
+    }
+    return ret;
+  }
+  template <typename T>
+  std::vector<T> eval_batch(const std::string&               expr,
+                            const std::vector<batch_column>& columns,
+                            bool                             disable_log = false,
+                            bool*                            failed = nullptr) {
+    return eval_batch<T>(expr.c_str(), columns, disable_log, failed);
+  }
+
+  ///////////////////////// metatable for lightuserdata ////////////////////////
+
+  /**
+   * @brief Set lightuserdata's metatable by a pointer type.
+   *
+   * Light userdata (unlike heavy userdata) have no per-value metatables. All
+   * light userdata share the same metatable, which by default is not set (nil).
+   *
+   * This method builds a metatable by a pointer type then set it to all light
+   * userdata.
+   *
+   * Behavior of light userdata with wrong type's metatable is undefined!
+   *
+   * @tparam T A pointer type indicates whose metatable lightuserdata use.
+   */
+  template <typename T>
+  void set_lightuserdata_metatable() {
+    static_assert(std::is_pointer<T>::value,
+                  "Should provide a pointer type for lightuserdata");
+    auto _g = make_guarder();
+    pushlightuserdata(static_cast<void*>(0));
+    metatable_factory<T>::push_shared_metatable(*this);
+    setmetatable(-2);
+  }
+
+  /// Remove lightuserdata's metatable, i.e. set nil as metatable.
+  void clear_lightuserdata_metatable() {
+    auto _g = make_guarder();
+    pushlightuserdata(static_cast<void*>(0));
+    pushnil();
+    setmetatable(-2);
+  }
+
+  /// Tell whether lightuserdata has metatable (not nil).
+  bool lightuserdata_has_metatable() {
+    auto _g = make_guarder();
+    pushlightuserdata(static_cast<void*>(0));
+    bool has = getmetatable(-1);
+    return has;
+  }
+
+  /**
+   * @brief Get lightuserdata's metatable name
+   *
+   * @param [in] def Value returned if lightuserdata doesn't have metatable or
+   * "__name" doesn't exist in it's metatable or the value in metatable paired
+   * to "__name" can't convert to string.
+   * @param [out] has_metatable Will be set whether lightuserdata has metatable.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether converting the value paired to
+   * "__name" in lightuserdata's metatable to string failed.
+   * @param [out] exists Will be set whether "__name" exists in lightuserdata's
+   * metatable.
+   * @return std::string
+   */
+  std::string get_lightuserdata_metatable_name(const std::string& def = "",
+                                               bool* has_metatable    = nullptr,
+                                               bool  disable_log      = false,
+                                               bool* failed           = nullptr,
+                                               bool* exists = nullptr) {
+    auto _g = make_guarder();
+    pushlightuserdata(static_cast<void*>(0));
+    bool has = getmetatable(-1);
+    if (has_metatable) *has_metatable = has;
+    if (!has) return def;
+    getfield(-1, "__name");
+    return to_string(-1, def, disable_log, failed, exists);
+  }
+
+  /// Get metatable name for value at given index. (not only for light userdata)
+  std::string get_metatable_name(int                idx           = -1,
+                                 const std::string& def           = "",
+                                 bool*              has_metatable = nullptr,
+                                 bool               disable_log   = false,
+                                 bool*              failed        = nullptr,
+                                 bool*              exists        = nullptr) {
+    auto _g  = make_guarder();
+    bool has = getmetatable(idx);
+    if (has_metatable) *has_metatable = has;
+    if (!has) return def;
+    getfield(-1, "__name");
+    return to_string(-1, def, disable_log, failed, exists);
+  }
+
+  /// Get a global variable's metatable name.
+  std::string get_metatable_name(const char*        name,
+                                 const std::string& def           = "",
+                                 bool*              has_metatable = nullptr,
+                                 bool               disable_log   = false,
+                                 bool*              failed        = nullptr,
+                                 bool*              exists        = nullptr) {
+    auto _g = make_guarder();
+    getglobal(name);
+    return get_metatable_name(
+        -1, def, has_metatable, disable_log, failed, exists);
+  }
+  std::string get_metatable_name(const std::string& name,
+                                 const std::string& def           = "",
+                                 bool*              has_metatable = nullptr,
+                                 bool               disable_log   = false,
+                                 bool*              failed        = nullptr,
+                                 bool*              exists        = nullptr) {
+    return get_metatable_name(
+        name.c_str(), def, has_metatable, disable_log, failed, exists);
+  }
+
+  /// Get a variable's metatable name by a given path.
+  std::string get_metatable_name(const std::initializer_list<const char*>& path,
+                                 const std::string& def           = "",
+                                 bool*              has_metatable = nullptr,
+                                 bool               disable_log   = false,
+                                 bool*              failed        = nullptr,
+                                 bool*              exists        = nullptr) {
+    auto _g = make_guarder();
+    gseek_env();
+    for (const auto& s : path) seek(s);
+    return get_metatable_name(
+        -1, def, has_metatable, disable_log, failed, exists);
+  }
+  std::string get_metatable_name(const std::vector<const char*>& path,
+                                 const std::string&              def = "",
+                                 bool* has_metatable                 = nullptr,
+                                 bool  disable_log                   = false,
+                                 bool* failed                        = nullptr,
+                                 bool* exists = nullptr) {
+    auto _g = make_guarder();
+    gseek_env();
+    for (const auto& s : path) seek(s);
+    return get_metatable_name(
+        -1, def, has_metatable, disable_log, failed, exists);
+  }
+  std::string get_metatable_name(const std::initializer_list<std::string>& path,
+                                 const std::string& def           = "",
+                                 bool*              has_metatable = nullptr,
+                                 bool               disable_log   = false,
+                                 bool*              failed        = nullptr,
+                                 bool*              exists        = nullptr) {
+    auto _g = make_guarder();
+    gseek_env();
+    for (const auto& s : path) seek(s);
+    return get_metatable_name(
+        -1, def, has_metatable, disable_log, failed, exists);
+  }
+  std::string get_metatable_name(const std::vector<std::string>& path,
+                                 const std::string&              def = "",
+                                 bool* has_metatable                 = nullptr,
+                                 bool  disable_log                   = false,
+                                 bool* failed                        = nullptr,
+                                 bool* exists = nullptr) {
+    auto _g = make_guarder();
+    gseek_env();
+    for (const auto& s : path) seek(s);
+    return get_metatable_name(
+        -1, def, has_metatable, disable_log, failed, exists);
+  }
+  ///////////////////////// error log //////////////////////////////////////////
+
+  static void log_error(const char* s) {
+    std::cerr << "Lua: " << s << std::endl;
+  }
+
+  const char* get_error_info_in_stack(int idx = -1) const {
+    return lua_tostring(L_, idx);
+  }
+
+  /// Output the error info at given index of stack to stderr.
+  bool log_error_in_stack(int idx = -1) const {
+    const char* s = get_error_info_in_stack(idx);
+    if (s) {
+      std::cerr << "Lua: " << s << std::endl;
+      return true;
+    } else {
+      std::cerr << "No valid error info in stack at index: " << idx
+                << std::endl;
+      return false;
+    }
+  }
+
+  /// Output the error info on top of stack to stderr then pop it.
+  bool log_error_out() {
+    if (log_error_in_stack(-1)) {
+      pop();
+      return true;
+    }
+    return false;
+  }
+
+  /// Output error: Can't convert value at given index to target type.
+  void log_type_convert_error(int idx, const char* to) {
+    std::cerr << "Lua: Can't convert to " << to << " by ";
+    if (isstring(idx) || isnumber(idx) || isboolean(idx) || isinteger(idx)) {
+      std::cerr << type_name(idx) << ": ";
+    }
+    std::cerr << luaL_tolstring(L_, idx, NULL) << std::endl;
+    pop();
+  }
+
+  /// Output every value in stack in order.
+  void print_stack(const char* name = nullptr) const {
+    std::cout << "Stack";
+    if (name) std::cout << " " << name;
+    if (gettop() <= 0) {
+      std::cout << " empty." << std::endl;
+      return;
+    }
+    std::cout << ":\n";
+    for (int i = 1, n = gettop(), wn = n < 10 ? 1 : 2; i <= n; ++i) {
+      std::cout << "[" << std::setw(wn) << i << "] " << std::setw(8)
+                << type_name(i) << "(" << type(i)
+                << "): " << luaL_tolstring(L_, i, NULL) << std::endl;
+      lua_pop(L_, 1);
+    }
+  }
+};
+
+/// Wrapper for a given lua_State. Only to use methods of luaw,
+/// won't close the given lua_State when it destructs.
+class fakeluaw : public luaw {
+  using base_t = luaw;
+
+public:
+  fakeluaw(lua_State* L) : base_t(L) {}
+
+  ~fakeluaw() { base_t::clearL(); }
+};
+
+/// Wrapper for a sub thread. So it has an independent execution stack.
+/// Generated by luaw::make_subluaw().
+class subluaw : public luaw {
+  using base_t = luaw;
+  const int ref_id_;  // ref id for the sub thread (subL)
+
+public:
+  subluaw(lua_State* subL, int ref_id) : base_t(subL), ref_id_(ref_id) {}
+  subluaw(subluaw&& r) : base_t(r.release()), ref_id_(r.ref_id_) {}
+  subluaw(const subluaw&) = delete;
+
+  void init()  = delete;
+  void close() = delete;
+  void reset() = delete;
+
+  ~subluaw() {
+    if (L()) {
+      cleartop();
+      // Must unref the sub thread before "clearL".
+      luaL_unref(L(), LUA_REGISTRYINDEX, ref_id_);
+      // Sub thread shouldn't be closed, so "clearL" must be called at the end.
+      base_t::clearL();
+    }
+  }
+
+  /// Get ref id for this sub thread.
+  const int ref_id() const { return ref_id_; }
+
+  /// Push the referenced sub thread onto top of given stack.
+  void pushthread(lua_State* L) const {
+    PEACALM_LUAW_ASSERT(L);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref_id_);
+  }
+};
+
+inline subluaw luaw::make_subluaw() {
+  lua_State* subL   = newthread();
+  int        ref_id = luaL_ref(L_, LUA_REGISTRYINDEX);
+  return subluaw(subL, ref_id);
+}
+
+// Support output luaw::luavalueref by std::basic_ostream
+template <class Char, class Traits>
+std::basic_ostream<Char, Traits>& operator<<(
+    std::basic_ostream<Char, Traits>& o, const luaw::luavalueidx& r) {
+  fakeluaw l(r.L());
+  auto     _g = l.make_guarder();
+  o << "{";
+  if (l.is_type_string(r.idx()) || l.is_type_number(r.idx()) ||
+      l.is_type_boolean(r.idx())) {
+    o << l.type_name(r.idx()) << ": ";
+  }
+  o << luaL_tolstring(l.L(), r.idx(), NULL) << ", idx: " << r.idx() << "}";
+  return o;
+}
+
+// Support output luaw::luavalueref by std::basic_ostream
+template <class Char, class Traits>
+std::basic_ostream<Char, Traits>& operator<<(
+    std::basic_ostream<Char, Traits>& o, const luaw::luavalueref& r) {
+  fakeluaw l(r.L());
+  auto     _g = l.make_guarder();
+  r.pushvalue();
+  o << "{";
+  if (l.is_type_string() || l.is_type_number() || l.is_type_boolean()) {
+    o << l.type_name() << ": ";
+  }
+  o << luaL_tolstring(l.L(), -1, NULL) << ", ref_id: " << r.ref_id() << "}";
+  return o;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace luaw_detail {
+
+// void_t is defined in std since c++17
+template <typename T>
+using void_t = void;
+
+// is std::shared_ptr
+
+template <typename T>
+struct is_std_shared_ptr : std::false_type {};
+
+template <typename T>
+struct is_std_shared_ptr<std::shared_ptr<T>> : std::true_type {};
+
+// is std::unique_ptr
+
+template <typename T>
+struct is_std_unique_ptr : std::false_type {};
+
+template <typename T, typename D>
+struct is_std_unique_ptr<std::unique_ptr<T, D>> : std::true_type {};
+
+// is array version std::unique_ptr
+
+template <typename T>
+struct is_std_unique_ptr_of_array : std::false_type {};
+
+template <typename T, typename D>
+struct is_std_unique_ptr_of_array<std::unique_ptr<T[], D>> : std::true_type {};
+
+// is std::default_delete
+
+template <typename T>
+struct is_std_default_delete : std::false_type {};
+
+template <typename T>
+struct is_std_default_delete<std::default_delete<T>> : std::true_type {};
+
+// get element_type
+
+template <typename T, typename = void>
+struct get_element_type {
+  using type = void;
+};
+
+template <typename T>
+struct get_element_type<T, void_t<typename T::element_type>> {
+  using type = typename T::element_type;
+};
+
+// Get a C function pointer type by a member function pointer type
+
+template <typename T>
+struct get_cfptr_by_memfptr {
+  using type = void;
+};
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args...)> {
+  using type = Return (*)(Args...);
+};
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args...) const> {
+  using type = Return (*)(Args...);
+};
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args...) volatile> {
+  using type = Return (*)(Args...);
+};
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args...) const volatile> {
+  using type = Return (*)(Args...);
+};
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args..., ...)> {
+  using type = Return (*)(Args..., ...);
+};
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args..., ...) const> {
+  using type = Return (*)(Args..., ...);
+};
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args..., ...) volatile> {
+  using type = Return (*)(Args..., ...);
+};
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args..., ...) const volatile> {
+  using type = Return (*)(Args..., ...);
+};
+
+#if PEACALM_LUAW_SUPPORT_CPP17
+// Keep noexcept if C++17 supported
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args...) noexcept> {
+  using type = Return (*)(Args...) noexcept;
+};
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args...) const noexcept> {
+  using type = Return (*)(Args...) noexcept;
+};
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args...) volatile noexcept> {
+  using type = Return (*)(Args...) noexcept;
+};
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args...)
+                                const volatile noexcept> {
+  using type = Return (*)(Args...) noexcept;
+};
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args..., ...) noexcept> {
+  using type = Return (*)(Args..., ...) noexcept;
+};
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args..., ...) const noexcept> {
+  using type = Return (*)(Args..., ...) noexcept;
+};
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args...,
+                                               ...) volatile noexcept> {
+  using type = Return (*)(Args..., ...) noexcept;
+};
+
+template <typename Object, typename Return, typename... Args>
+struct get_cfptr_by_memfptr<Return (Object::*)(Args..., ...)
+                                const volatile noexcept> {
+  using type = Return (*)(Args..., ...) noexcept;
+};
+
+#endif
+
+template <typename T>
+using get_cfptr_by_memfptr_t = typename get_cfptr_by_memfptr<T>::type;
+
+// Detect type of callee, which is a pointer to member function operator()
+
+template <typename T, typename = void>
+struct detect_callee {
+  using type = void;
+};
+
+template <typename T>
+struct detect_callee<T, void_t<decltype(&T::operator())>> {
+  using type = decltype(&T::operator());
+};
+
+template <typename T>
+using detect_callee_t = typename detect_callee<T>::type;
+
+// Detect C function style callee type
+
+template <typename T>
+using detect_c_callee_t = get_cfptr_by_memfptr_t<detect_callee_t<T>>;
+
+// Detect whether T maybe a captureless and non-generic lambda
+
+template <typename T>
+struct maybe_lambda
+    : std::integral_constant<
+          bool,
+          !std::is_same<T, void>::value &&
+              std::is_convertible<T, detect_c_callee_t<T>>::value> {};
+
+// Detect whether decay_t<T> maybe a captureless and non-generic lambda
+
+template <typename T>
+struct decay_maybe_lambda : maybe_lambda<std::decay_t<T>> {};
+
+// Whether T has a non-template member operator()
+
+template <typename T, typename = void>
+struct is_callable_class : std::false_type {};
+
+template <typename T>
+struct is_callable_class<T, void_t<decltype(&T::operator())>> : std::true_type {
+};
+
+// whether T is C function
+
+template <typename T>
+struct is_cfunction : std::false_type {};
+
+template <typename Return, typename... Args>
+struct is_cfunction<Return(Args...)> : std::true_type {};
+
+template <typename Return, typename... Args>
+struct is_cfunction<Return(Args..., ...)> : std::true_type {};
+
+#if PEACALM_LUAW_SUPPORT_CPP17
+
+template <typename Return, typename... Args>
+struct is_cfunction<Return(Args...) noexcept> : std::true_type {};
+
+template <typename Return, typename... Args>
+struct is_cfunction<Return(Args..., ...) noexcept> : std::true_type {};
+
+#endif
+
+// whether T is C function pointer
+
+template <typename T>
+struct is_cfunction_pointer
+    : std::integral_constant<
+          bool,
+          std::is_pointer<T>::value &&
+              is_cfunction<std::remove_pointer_t<T>>::value> {};
+
+// Whether T is C style callable: C function or C function pointer
+
+template <typename T>
+struct is_callable_c
+    : std::integral_constant<bool,
+                             is_cfunction<T>::value ||
+                                 is_cfunction_pointer<T>::value> {};
+
+// whether T is callable
+
+template <typename T>
+struct is_callable : std::integral_constant<bool,
+                                            is_callable_class<T>::value ||
+                                                is_callable_c<T>::value> {};
+
+// whether decay_t<T> is callable
+
+template <typename T>
+struct decay_is_callable : is_callable<std::decay_t<T>> {};
+
+// detect C function pointer type by a C function or a callable class
+
+template <typename T>
+using detect_callable_cfunction_t = std::conditional_t<
+    decay_is_callable<T>::value,
+    std::conditional_t<is_callable_class<std::decay_t<T>>::value,
+                       detect_c_callee_t<std::decay_t<T>>,
+                       std::decay_t<T>>,
+    void>;
+
+// remove_ptr_or_smart_ptr
+
+template <typename T>
+using remove_ptr_or_smart_ptr_t =
+    std::conditional_t<is_std_shared_ptr<std::decay_t<T>>::value ||
+                           is_std_unique_ptr<std::decay_t<T>>::value,
+                       typename get_element_type<T>::type,
+                       typename std::remove_pointer<T>::type>;
+
+}  // namespace luaw_detail
+
+//////////////////// pusher impl ///////////////////////////////////////////////
+
+// function_tag: push as a function
+template <>
+struct luaw::pusher<luaw::function_tag> {
+  static const size_t size = 1;
+
+  template <typename F>
+  static int push(luaw& l, F&& f) {
+    using DecayF = std::decay_t<F>;
+    static_assert(luaw_detail::is_callable<DecayF>::value,
+                  "Should push a callable value");
+
+    // C function pointer type
+    using CFunctionPtr =
+        std::conditional_t<luaw_detail::is_callable_class<DecayF>::value,
+                           luaw_detail::detect_c_callee_t<DecayF>,
+                           DecayF>;
+    static_assert(luaw_detail::is_cfunction_pointer<CFunctionPtr>::value,
+                  "Should get a C function pointer type");
+    return luaw::pusher<CFunctionPtr>::push(l, std::forward<F>(f));
+  }
+};
+
+// class_tag: push as an user defined custom class type.
+// Only works on class type or it's pointer.
+// Push class as full userdata, push pointer to class as light userdata.
+template <>
+struct luaw::pusher<luaw::class_tag> {
+  static const size_t size = 1;
+
+  template <typename Y>
+  static int push(luaw& l, Y&& v) {
+    using SolidY = std::remove_reference_t<Y>;
+    static_assert(std::is_class<std::remove_pointer_t<SolidY>>::value,
+                  "Only class or it's pointer");
+    __push<SolidY>(l, std::forward<Y>(v), std::is_pointer<SolidY>{});
+    return 1;
+  }
+
+  // Construct TargetT by Y at the moment of creating userdata.
+  template <typename TargetT, typename Y>
+  static std::enable_if_t<
+      !std::is_same<TargetT, Y>::value &&
+          !std::is_same<std::decay_t<TargetT>, luaw::class_tag>::value,
+      int>
+  push(luaw& l, Y&& v) {
+    static_assert(std::is_class<std::remove_pointer_t<TargetT>>::value,
+                  "Only class or it's pointer");
+    static_assert(std::is_convertible<Y, TargetT>::value,
+                  "Y should convertible to TargetT");
+    __push<TargetT>(l, std::forward<Y>(v), std::is_pointer<TargetT>{});
+    return 1;
+  }
+
+private:
+  // TargetT is pointer type
+  template <typename TargetT, typename Y>
+  static void __push(luaw& l, Y&& v, std::true_type) {
+    l.pushlightuserdata(reinterpret_cast<void*>(
+        const_cast<std::remove_cv_t<std::remove_pointer_t<TargetT>>*>(v)));
+    luaw::metatable_factory<TargetT>::push_shared_metatable(l);
+    l.setmetatable(-2);
+  }
+
+  // TargetT is not pointer type
+  template <typename TargetT, typename Y>
+  static void __push(luaw& l, Y&& v, std::false_type) {
+    void* p = l.newuserdata(sizeof(TargetT));
+    new (p) TargetT(std::forward<Y>(v));  // construct TargetT by Y
+    luaw::metatable_factory<TargetT>::push_shared_metatable(l);
+    l.setmetatable(-2);
+  }
+};
+
+// primary pusher. guess whether it may be a lambda, push as function if true,
+// otherwise push as an user defined custom object.
+template <typename T, typename>
+struct luaw::pusher {
+  static_assert(!std::is_pointer<T>::value,
+                "Never happen (Pointers should be specialized elsewhere)");
+  static_assert(std::is_same<T, std::decay_t<T>>::value, "T should be decayed");
+  static_assert(std::is_class<T>::value, "T should be a class type");
+
+  static const size_t size = 1;
+
+  // DecayY must be same as T
+  template <typename Y>
+  static int push(luaw& l, Y&& v) {
+    static_assert(std::is_same<std::decay_t<Y>, T>::value,
+                  "Decayed Y should be same type as T");
+    using SolidY = std::remove_reference_t<Y>;
+
+    // Guess whether it may be a lambda object, if it is, then push as a
+    // function, otherwise push as custom class.
+    return __push<SolidY>(
+        l, std::forward<Y>(v), luaw_detail::decay_maybe_lambda<Y>{});
+  }
+
+  // Construct TargetT by Y at the moment of creating userdata.
+  template <typename TargetT, typename Y>
+  static std::enable_if_t<!std::is_same<TargetT, Y>::value, int> push(luaw& l,
+                                                                      Y&&   v) {
+    static_assert(std::is_class<TargetT>::value &&
+                      std::is_same<std::remove_cv_t<TargetT>, T>::value,
+                  "TargetT should be class T or cv- qualified T");
+    static_assert(std::is_convertible<Y, TargetT>::value,
+                  "Y should convertible to TargetT");
+    __push<TargetT>(
+        l, std::forward<Y>(v), luaw_detail::decay_maybe_lambda<Y>{});
+    return 1;
+  }
+
+private:
+  // Push as a function.
+  template <typename _Nouse, typename Y>
+  static int __push(luaw& l, Y&& v, std::true_type) {
+    return luaw::pusher<luaw::function_tag>::push(l, std::forward<Y>(v));
+  }
+
+  // Push as a full userdata.
+  template <typename TargetT, typename Y>
+  static int __push(luaw& l, Y&& v, std::false_type) {
+    return luaw::pusher<luaw::class_tag>::template push<TargetT>(
+        l, std::forward<Y>(v));
+  }
+};
+
+// pointer to class
+template <typename T>
+struct luaw::pusher<
+    T*,
+    std::enable_if_t<!std::is_function<T>::value &&
+                     !std::is_same<T*, const char*>::value &&
+                     !luaw_detail::is_std_unique_ptr<std::decay_t<T>>::value &&
+                     std::is_class<std::decay_t<T>>::value>> {
+  static const size_t size = 1;
+
+  static int push(luaw& l, T* v) {
+    l.pushlightuserdata(
+        reinterpret_cast<void*>(const_cast<std::remove_cv_t<T>*>(v)));
+
+    luaw::metatable_factory<T*>::push_shared_metatable(l);
+    l.setmetatable(-2);
+
+    return 1;
+  }
+};
+
+// non-class pointer, as lightuserdata
+template <typename T>
+struct luaw::pusher<
+    T*,
+    std::enable_if_t<!std::is_function<T>::value &&
+                     !std::is_same<T*, const char*>::value &&
+                     !luaw_detail::is_std_unique_ptr<std::decay_t<T>>::value &&
+                     !std::is_class<std::decay_t<T>>::value>> {
+  static const size_t size = 1;
+
+  static int push(luaw& l, T* v) {
+    l.pushlightuserdata(
+        reinterpret_cast<void*>(const_cast<std::remove_cv_t<T>*>(v)));
+    return 1;
+  }
+};
+
+// pointer to std::unique_ptr<T, D>, share metatable with pointer to
+// std::unique_ptr<T>
+template <typename T>
+struct luaw::pusher<
+    T*,
+    std::enable_if_t<luaw_detail::is_std_unique_ptr<std::decay_t<T>>::value>> {
+  static const size_t size = 1;
+
+  static int push(luaw& l, T* v) {
+    using E = std::conditional_t<
+        luaw_detail::is_std_unique_ptr_of_array<std::decay_t<T>>::value,
+        typename T::element_type[],
+        typename T::element_type>;
+    using T0 = std::unique_ptr<E>;  // use default_deleter
+    using T1 =
+        std::conditional_t<std::is_const<T>::value, std::add_const_t<T0>, T0>;
+    using T2 = std::
+        conditional_t<std::is_volatile<T>::value, std::add_volatile_t<T1>, T1>;
+
+    static_assert(
+        luaw_detail::is_std_default_delete<typename T::deleter_type>::value
+            ? std::is_same<T, T2>::value
+            : true,
+        "Never happen");
 
-  /**
-   * @brief Register a static member's reference into Lua.
-   *
-   * @sa "register_static_member"
-   * @sa "register_member_ref"
-   */
-  template <typename Class, typename Member>
-  void register_static_member_ref(const char* name, Member* mp) {
-    static_assert(std::is_class<Class>::value,
-                  "Static members must belong to a class type");
-    static_assert(std::is_same<Class, std::decay_t<Class>>::value,
-                  "Class must be decayed");
-    PEACALM_LUAW_ASSERT(name);
-    PEACALM_LUAW_ASSERT(mp);
-    registrar<Member Class::*, luaw::registrar_tag_for_member_ptr>::
-        register_member_ref(*this, name, static_mem_fn<Member*>(mp));
-  }
-  template <typename Class, typename Member>
-  void register_static_member_ref(const std::string& name, Member* mp) {
-    register_static_member_ref<Class, Member>(name.c_str(), mp);
-  }
+    l.pushlightuserdata(
+        reinterpret_cast<void*>(const_cast<std::remove_cv_t<T>*>(v)));
 
-  /**
-   * @brief Register a static member's low-level const reference into Lua.
-   *
-   * @sa "register_static_member_ref"
-   */
-  template <typename Class, typename Member>
-  void register_static_member_cref(const char* name, Member* mp) {
-    register_static_member_ref<Class, const Member>(name, mp);
-  }
-  template <typename Class, typename Member>
-  void register_static_member_cref(const std::string& name, Member* mp) {
-    register_static_member_cref<Class, Member>(name.c_str(), mp);
+    luaw::metatable_factory<T2*>::push_shared_metatable(l);
+    l.setmetatable(-2);
+
+    return 1;
   }
+};
 
-  //////////////////////// evaluate expression /////////////////////////////////
+// std::unique_ptr<T, D>, not share metatable with std::unique_ptr<T>
+template <typename T>
+struct luaw::pusher<
+    T,
+    std::enable_if_t<luaw_detail::is_std_unique_ptr<std::decay_t<T>>::value>> {
+  static_assert(std::is_same<T, std::decay_t<T>>::value, "T should be decayed");
 
-  /**
-   * @brief Evaluate a Lua expression and get the result in simple C++ type.
-   *
-   * @param [in] expr Lua expression, which must have a return value. Only the
-   * first one is used if multiple values returned.
-   * @param [in] def The default value returned if failed.
-   * @param [in] disable_log Whether print a log when exception occurs.
-   * @param [out] failed Will be set whether the operation is failed if this
-   * pointer is not nullptr.
-   *
-   * @{
-   */
+  static const size_t size = 1;
 
-#define DEFINE_EVAL(typename, type, default)                        \
-  type eval_##typename(const char* expr,                            \
-                       const type& def         = default,           \
-                       bool        disable_log = false,             \
-                       bool*       failed      = nullptr) {                    \
-    int  sz = gettop();                                             \
-    auto _g = make_guarder();                                       \
-    if (dostring(expr) != LUA_OK) {                                 \
-      if (failed) *failed = true;                                   \
-      if (!disable_log) log_error_in_stack();                       \
-      return def;                                                   \
-    }                                                               \
-    PEACALM_LUAW_ASSERT(gettop() >= sz);                            \
-    if (gettop() <= sz) {                                           \
-      if (failed) *failed = true;                                   \
-      if (!disable_log) log_error("No return");                     \
-      return def;                                                   \
-    }                                                               \
-    type ret = to_##typename(sz + 1, def, disable_log, failed);     \
-    return ret;                                                     \
-  }                                                                 \
-  type eval_##typename(const std::string& expr,                     \
-                       const type&        def         = default,    \
-                       bool               disable_log = false,      \
-                       bool*              failed      = nullptr) {                    \
-    return eval_##typename(expr.c_str(), def, disable_log, failed); \
-  }
+  template <typename Y>
+  static int push(luaw& l, Y&& v) {
+    static_assert(luaw_detail::is_std_unique_ptr<std::decay_t<Y>>::value,
+                  "Decayed Y should be std::unique_ptr");
 
-  DEFINE_EVAL(bool, bool, false)
-  DEFINE_EVAL(int, int, 0)
-  DEFINE_EVAL(uint, unsigned int, 0)
-  DEFINE_EVAL(long, long, 0)
-  DEFINE_EVAL(ulong, unsigned long, 0)
-  DEFINE_EVAL(llong, long long, 0)
-  DEFINE_EVAL(ullong, unsigned long long, 0)
-  DEFINE_EVAL(float, float, 0)
-  DEFINE_EVAL(double, double, 0)
-  DEFINE_EVAL(ldouble, long double, 0)
-  DEFINE_EVAL(string, std::string, "")
-#undef DEFINE_EVAL
+    using SolidY = std::remove_reference_t<Y>;
+    using E      = std::conditional_t<
+        luaw_detail::is_std_unique_ptr_of_array<std::decay_t<T>>::value,
+        typename T::element_type[],
+        typename T::element_type>;
+    using T0 = std::unique_ptr<E>;  // use default_deleter
+    using T1 = std::
+        conditional_t<std::is_const<SolidY>::value, std::add_const_t<T0>, T0>;
+    using T2 = std::conditional_t<std::is_volatile<SolidY>::value,
+                                  std::add_volatile_t<T1>,
+                                  T1>;
 
-  // Caller is responsible for popping stack if succeeds
-  const char* eval_c_str(const char* expr,
-                         const char* def         = "",
-                         bool        disable_log = false,
-                         bool*       failed      = nullptr) {
-    int sz = gettop();
-    if (dostring(expr) != LUA_OK) {
-      if (failed) *failed = true;
-      if (!disable_log) log_error_in_stack();
-      settop(sz);
-      return def;
-    }
-    PEACALM_LUAW_ASSERT(gettop() >= sz);
-    if (gettop() <= sz) {
-      if (failed) *failed = true;
-      if (!disable_log) log_error("No return");
-      return def;
+    static_assert(
+        luaw_detail::is_std_default_delete<typename T::deleter_type>::value
+            ? std::is_same<T2, SolidY>::value
+            : true,
+        "Never happen");
+
+    void* p = l.newuserdata(sizeof(SolidY));
+    new (p) SolidY(std::forward<Y>(v));
+
+    bool first_create = luaw::metatable_factory<SolidY>::gtouchmetatb(l);
+    if (first_create) {
+      luaw::metatable_factory<T2*>::set_metamethods(l);
+      luaw::metatable_factory<SolidY>::set_gc_to_metatable(l);
     }
-    return to_c_str(sz + 1, def, disable_log, failed);
+    l.setmetatable(-2);
+
+    return 1;
   }
-  const char* eval_c_str(const std::string& expr,
-                         const char*        def         = "",
-                         bool               disable_log = false,
-                         bool*              failed      = nullptr) {
-    return eval_c_str(expr.c_str(), def, disable_log, failed);
+};
+
+// newtable_tag: push a new empty table
+template <>
+struct luaw::pusher<luaw::newtable_tag> {
+  static const size_t size = 1;
+
+  static int push(luaw& l, newtable_tag) {
+    l.newtable();
+    return 1;
   }
+};
 
-  /** @} */
+// std::function
+template <typename Return, typename... Args>
+struct luaw::pusher<std::function<Return(Args...)>> {
+  static const size_t size = 1;
 
-  /**
-   * @brief Evaluate a Lua expression and get result in complex C++ type.
-   *
-   * @sa method "to".
-   * But more, T could be void or std::tuple<> to represent the expression has
-   * no return, or we'll discard all it's returns.
-   * Besides, T could be std::tuple to accept multiple returns of the
-   * expression. If T is a nested std::tuple, only the outmost level std::tuple
-   * is mapped to multiple values of return, any inner std::tuple is mapped to a
-   * Lua table.
-   *
-   * @tparam T The result type user expected.
-   * @param [in] expr Lua expression, which can have no return, one return or
-   * multiple returns.
-   * @param [in] disable_log Whether print a log when exception occurs.
-   * @param [out] failed Will be set whether the operation is failed if this
-   * pointer is not nullptr. If T is a container type, it regards the operation
-   * as failed if any element failed.
-   * @return The expression's result in type T. If T is not void or
-   * std::tuple<>, the expression must provide return values.
-   */
-  template <typename T>
-  T eval(const char* expr, bool disable_log = false, bool* failed = nullptr) {
-    auto _g = make_guarder();
-    int  sz = gettop();
-    if (dostring(expr) != LUA_OK) {
-      if (failed) *failed = true;
-      if (!disable_log) log_error_in_stack();
-      return T();
-    }
-    PEACALM_LUAW_ASSERT(gettop() >= sz);
-    if (gettop() <= sz && !std::is_same<std::decay_t<T>, std::tuple<>>::value &&
-        !std::is_same<std::decay_t<T>, void>::value) {
-      if (failed) *failed = true;
-      if (!disable_log) log_error("No return");
-      return T();
-    }
-    return convertor_for_return<std::decay_t<T>>::to(
-        *this, sz + 1, disable_log, failed);
+  template <typename F>
+  static int push(luaw& l, F&& f) {
+    using CFunctionPtr = Return (*)(Args...);
+    return luaw::pusher<CFunctionPtr>::push(l, std::forward<F>(f));
   }
-  template <typename T>
-  T eval(const std::string& expr,
-         bool               disable_log = false,
-         bool*              failed      = nullptr) {
-    return eval<T>(expr.c_str(), disable_log, failed);
+};
+
+// Lua C functions
+template <>
+struct luaw::pusher<luaw::lua_cfunction_t> {
+  static const size_t size = 1;
+
+  static int push(luaw& l, lua_cfunction_t f) {
+    l.pushcfunction(f);
+    return 1;
   }
+};
+
+// C funtions except lua_cfunction_t, also implementation for callable objects
+template <typename Return, typename... Args>
+struct luaw::pusher<Return (*)(Args...)> {
+  static const size_t size = 1;
+
+  // function object with non-trivially destructor
+  template <typename F>
+  static std::
+      enable_if_t<!std::is_trivially_destructible<std::decay_t<F>>::value, int>
+      push(luaw& l, F&& f) {
+    using SolidF = std::remove_reference_t<F>;
+
+    luaw::lua_cfunction_t __call = [](lua_State* L) -> int {
+      PEACALM_LUAW_ASSERT(lua_gettop(L) >= 1);
+      PEACALM_LUAW_ASSERT(lua_isuserdata(L, 1));
+      auto callee = static_cast<SolidF*>(lua_touserdata(L, 1));
+      PEACALM_LUAW_ASSERT(callee);
+      luaw l(L);
+      int  ret_num = callback(l, *callee, 2, std::is_void<Return>{});
+      l.clearL();
+      return ret_num;
+    };
+
+    luaw::lua_cfunction_t __gc = [](lua_State* L) -> int {
+      PEACALM_LUAW_ASSERT(lua_gettop(L) == 1);
+      PEACALM_LUAW_ASSERT(lua_isuserdata(L, 1));
+      auto fptr = static_cast<SolidF*>(lua_touserdata(L, 1));
+      PEACALM_LUAW_ASSERT(fptr);
+      fptr->~SolidF();
+      return 0;
+    };
+
+    // object
+    auto faddr = static_cast<SolidF*>(l.newuserdata(sizeof(f)));
+    new (faddr) SolidF(std::forward<F>(f));
+
+    // build metatable
+    l.newtable();
 
-  ///////////////////////// metatable for lightuserdata ////////////////////////
+    l.pushstring("__call");
+    l.pushcfunction(__call);
+    l.rawset(-3);
 
-  /**
-   * @brief Set lightuserdata's metatable by a pointer type.
-   *
-   * Light userdata (unlike heavy userdata) have no per-value metatables. All
-   * light userdata share the same metatable, which by default is not set (nil).
-   *
-   * This method builds a metatable by a pointer type then set it to all light
-   * userdata.
-   *
-   * Behavior of light userdata with wrong type's metatable is undefined!
-   *
-   * @tparam T A pointer type indicates whose metatable lightuserdata use.
-   */
-  template <typename T>
-  void set_lightuserdata_metatable() {
-    static_assert(std::is_pointer<T>::value,
-                  "Should provide a pointer type for lightuserdata");
-    auto _g = make_guarder();
-    pushlightuserdata(static_cast<void*>(0));
-    metatable_factory<T>::push_shared_metatable(*this);
-    setmetatable(-2);
-  }
+    l.pushstring("__gc");
+    l.pushcfunction(__gc);
+    l.rawset(-3);
 
-  /// Remove lightuserdata's metatable, i.e. set nil as metatable.
-  void clear_lightuserdata_metatable() {
-    auto _g = make_guarder();
-    pushlightuserdata(static_cast<void*>(0));
-    pushnil();
-    setmetatable(-2);
-  }
+    l.setmetatable(-2);
 
-  /// Tell whether lightuserdata has metatable (not nil).
-  bool lightuserdata_has_metatable() {
-    auto _g = make_guarder();
-    pushlightuserdata(static_cast<void*>(0));
-    bool has = getmetatable(-1);
-    return has;
+    return 1;
   }
 
-  /**
-   * @brief Get lightuserdata's metatable name
-   *
-   * @param [in] def Value returned if lightuserdata doesn't have metatable or
-   * "__name" doesn't exist in it's metatable or the value in metatable paired
-   * to "__name" can't convert to string.
-   * @param [out] has_metatable Will be set whether lightuserdata has metatable.
-   * @param [in] disable_log Whether print a log when exception occurs.
-   * @param [out] failed Will be set whether converting the value paired to
-   * "__name" in lightuserdata's metatable to string failed.
-   * @param [out] exists Will be set whether "__name" exists in lightuserdata's
-   * metatable.
-   * @return std::string
-   */
-  std::string get_lightuserdata_metatable_name(const std::string& def = "",
-                                               bool* has_metatable    = nullptr,
-                                               bool  disable_log      = false,
-                                               bool* failed           = nullptr,
-                                               bool* exists = nullptr) {
-    auto _g = make_guarder();
-    pushlightuserdata(static_cast<void*>(0));
-    bool has = getmetatable(-1);
-    if (has_metatable) *has_metatable = has;
-    if (!has) return def;
-    getfield(-1, "__name");
-    return to_string(-1, def, disable_log, failed, exists);
-  }
+  // function object with trivially destructor
+  template <typename F>
+  static std::
+      enable_if_t<std::is_trivially_destructible<std::decay_t<F>>::value, int>
+      push(luaw& l, F&& f) {
+    using SolidF = std::remove_reference_t<F>;
 
-  /// Get metatable name for value at given index. (not only for light userdata)
-  std::string get_metatable_name(int                idx           = -1,
-                                 const std::string& def           = "",
-                                 bool*              has_metatable = nullptr,
-                                 bool               disable_log   = false,
-                                 bool*              failed        = nullptr,
-                                 bool*              exists        = nullptr) {
-    auto _g  = make_guarder();
-    bool has = getmetatable(idx);
-    if (has_metatable) *has_metatable = has;
-    if (!has) return def;
-    getfield(-1, "__name");
-    return to_string(-1, def, disable_log, failed, exists);
-  }
+    auto closure = [](lua_State* L) -> int {
+      auto callee =
+          static_cast<SolidF*>(lua_touserdata(L, lua_upvalueindex(1)));
+      PEACALM_LUAW_ASSERT(callee);
+      luaw l(L);
+      int  ret_num = callback(l, *callee, 1, std::is_void<Return>{});
+      l.clearL();
+      return ret_num;
+    };
 
-  /// Get a global variable's metatable name.
-  std::string get_metatable_name(const char*        name,
-                                 const std::string& def           = "",
-                                 bool*              has_metatable = nullptr,
-                                 bool               disable_log   = false,
-                                 bool*              failed        = nullptr,
-                                 bool*              exists        = nullptr) {
-    auto _g = make_guarder();
-    getglobal(name);
-    return get_metatable_name(
-        -1, def, has_metatable, disable_log, failed, exists);
-  }
-  std::string get_metatable_name(const std::string& name,
-                                 const std::string& def           = "",
-                                 bool*              has_metatable = nullptr,
-                                 bool               disable_log   = false,
-                                 bool*              failed        = nullptr,
-                                 bool*              exists        = nullptr) {
-    return get_metatable_name(
-        name.c_str(), def, has_metatable, disable_log, failed, exists);
-  }
+    auto faddr = static_cast<SolidF*>(l.newuserdata(sizeof(f)));
+    new (faddr) SolidF(std::forward<F>(f));
 
-  /// Get a variable's metatable name by a given path.
-  std::string get_metatable_name(const std::initializer_list<const char*>& path,
-                                 const std::string& def           = "",
-                                 bool*              has_metatable = nullptr,
-                                 bool               disable_log   = false,
-                                 bool*              failed        = nullptr,
-                                 bool*              exists        = nullptr) {
-    auto _g = make_guarder();
-    gseek_env();
-    for (const auto& s : path) seek(s);
-    return get_metatable_name(
-        -1, def, has_metatable, disable_log, failed, exists);
-  }
-  std::string get_metatable_name(const std::vector<const char*>& path,
-                                 const std::string&              def = "",
-                                 bool* has_metatable                 = nullptr,
-                                 bool  disable_log                   = false,
-                                 bool* failed                        = nullptr,
-                                 bool* exists = nullptr) {
-    auto _g = make_guarder();
-    gseek_env();
-    for (const auto& s : path) seek(s);
-    return get_metatable_name(
-        -1, def, has_metatable, disable_log, failed, exists);
-  }
-  std::string get_metatable_name(const std::initializer_list<std::string>& path,
-                                 const std::string& def           = "",
-                                 bool*              has_metatable = nullptr,
-                                 bool               disable_log   = false,
-                                 bool*              failed        = nullptr,
-                                 bool*              exists        = nullptr) {
-    auto _g = make_guarder();
-    gseek_env();
-    for (const auto& s : path) seek(s);
-    return get_metatable_name(
-        -1, def, has_metatable, disable_log, failed, exists);
-  }
-  std::string get_metatable_name(const std::vector<std::string>& path,
-                                 const std::string&              def = "",
-                                 bool* has_metatable                 = nullptr,
-                                 bool  disable_log                   = false,
-                                 bool* failed                        = nullptr,
-                                 bool* exists = nullptr) {
-    auto _g = make_guarder();
-    gseek_env();
-    for (const auto& s : path) seek(s);
-    return get_metatable_name(
-        -1, def, has_metatable, disable_log, failed, exists);
-  }
-  ///////////////////////// error log //////////////////////////////////////////
+    l.pushcclosure(closure, 1);
 
-  static void log_error(const char* s) {
-    std::cerr << "Lua: " << s << std::endl;
+    return 1;
   }
 
-  const char* get_error_info_in_stack(int idx = -1) const {
-    return lua_tostring(L_, idx);
+  // function pointer
+  static int push(luaw& l, Return (*f)(Args...)) {
+    auto closure = [](lua_State* L) -> int {
+      auto callee = reinterpret_cast<Return (*)(Args...)>(
+          lua_touserdata(L, lua_upvalueindex(1)));
+      PEACALM_LUAW_ASSERT(callee);
+      luaw l(L);
+      int  ret_num = callback(l, callee, 1, std::is_void<Return>{});
+      l.clearL();
+      return ret_num;
+    };
+    l.pushlightuserdata(reinterpret_cast<void*>(f));
+    l.pushcclosure(closure, 1);
+    return 1;
   }
 
-  /// Output the error info at given index of stack to stderr.
-  bool log_error_in_stack(int idx = -1) const {
-    const char* s = get_error_info_in_stack(idx);
-    if (s) {
-      std::cerr << "Lua: " << s << std::endl;
-      return true;
-    } else {
-      std::cerr << "No valid error info in stack at index: " << idx
-                << std::endl;
-      return false;
+private:
+  template <typename>
+  struct wrap {};
+
+  template <typename Callee, typename FirstArg, typename... RestArgs>
+  struct bind {
+    Callee   callee;
+    FirstArg first_arg;
+    bind(Callee&& c, FirstArg&& f)
+        : callee(std::forward<Callee>(c)),
+          first_arg(std::forward<FirstArg>(f)) {}
+
+    Return operator()(RestArgs&&... args) {
+      return callee(std::move(first_arg), std::forward<RestArgs>(args)...);
     }
+  };
+
+  // For type Return is void.
+  template <typename Callee>
+  static int callback(luaw& l, Callee&& c, int start_idx, std::true_type) {
+    do_call(l, std::forward<Callee>(c), start_idx, 1, wrap<Args>{}...);
+    return 0;
   }
 
-  /// Output the error info on top of stack to stderr then pop it.
-  bool log_error_out() {
-    if (log_error_in_stack(-1)) {
-      pop();
-      return true;
-    }
-    return false;
+  // For type Return is not void. Return the number of result.
+  template <typename Callee>
+  static int callback(luaw& l, Callee&& c, int start_idx, std::false_type) {
+    return luaw::pusher_for_return<std::decay_t<Return>>::push(
+        l, do_call(l, std::forward<Callee>(c), start_idx, 1, wrap<Args>{}...));
   }
 
-  /// Output error: Can't convert value at given index to target type.
-  void log_type_convert_error(int idx, const char* to) {
-    std::cerr << "Lua: Can't convert to " << to << " by ";
-    if (isstring(idx) || isnumber(idx) || isboolean(idx) || isinteger(idx)) {
-      std::cerr << type_name(idx) << ": ";
+  template <typename Callee, typename FirstArg, typename... RestArgs>
+  static Return do_call(luaw&          l,
+                        Callee&&       c,
+                        int            i,
+                        int            counter,
+                        wrap<FirstArg> farg,
+                        wrap<RestArgs>... args) {
+    bool failed, exists;
+    auto param = l.to<std::decay_t<FirstArg>>(i, false, &failed, &exists);
+    if (failed) {
+      luaL_error(l.L(), "The %dth argument conversion failed", counter);
+      // Never runs here.
+      PEACALM_LUAW_ASSERT(false);
+      // Do not return Return() to enable functions with reference results.
+      // return Return();
     }
-    std::cerr << luaL_tolstring(L_, idx, NULL) << std::endl;
-    pop();
+    bind<Callee, FirstArg, RestArgs...> b(std::forward<Callee>(c),
+                                          std::move(param));
+    return do_call(l, std::move(b), i + 1, counter + 1, args...);
   }
 
-  /// Output every value in stack in order.
-  void print_stack(const char* name = nullptr) const {
-    std::cout << "Stack";
-    if (name) std::cout << " " << name;
-    if (gettop() <= 0) {
-      std::cout << " empty." << std::endl;
-      return;
-    }
-    std::cout << ":\n";
-    for (int i = 1, n = gettop(), wn = n < 10 ? 1 : 2; i <= n; ++i) {
-      std::cout << "[" << std::setw(wn) << i << "] " << std::setw(8)
-                << type_name(i) << "(" << type(i)
-                << "): " << luaL_tolstring(L_, i, NULL) << std::endl;
-      lua_pop(L_, 1);
-    }
+  template <typename Callee>
+  static Return do_call(luaw& l, Callee&& c, int i, int counter) {
+    return c();
   }
 };
 
-/// Wrapper for a given lua_State. Only to use methods of luaw,
-/// won't close the given lua_State when it destructs.
-class fakeluaw : public luaw {
-  using base_t = luaw;
-
-public:
-  fakeluaw(lua_State* L) : base_t(L) {}
-
-  ~fakeluaw() { base_t::clearL(); }
+// Variadic function, not support!
+template <typename Return, typename... Args>
+struct luaw::pusher<Return (*)(Args..., ...)> {
+  // Let compile fail
+  template <typename F>
+  static int push(luaw& l, F&& f) = delete;
 };
 
-/// Wrapper for a sub thread. So it has an independent execution stack.
-/// Generated by luaw::make_subluaw().
-class subluaw : public luaw {
-  using base_t = luaw;
-  const int ref_id_;  // ref id for the sub thread (subL)
+#if PEACALM_LUAW_SUPPORT_CPP17
 
-public:
-  subluaw(lua_State* subL, int ref_id) : base_t(subL), ref_id_(ref_id) {}
-  subluaw(subluaw&& r) : base_t(r.release()), ref_id_(r.ref_id_) {}
-  subluaw(const subluaw&) = delete;
+// Function with noexcept-specification after C++17
+template <typename Return, typename... Args>
+struct luaw::pusher<Return (*)(Args...) noexcept> {
+  using Basic = luaw::pusher<Return (*)(Args...)>;
 
-  void init()  = delete;
-  void close() = delete;
-  void reset() = delete;
+  template <typename F>
+  static int push(luaw& l, F&& f) {
+    return Basic::push(l, std::forward<F>(f));
+  }
 
-  ~subluaw() {
-    if (L()) {
-      cleartop();
-      // Must unref the sub thread before "clearL".
-      luaL_unref(L(), LUA_REGISTRYINDEX, ref_id_);
-      // Sub thread shouldn't be closed, so "clearL" must be called at the end.
-      base_t::clearL();
-    }
+  // Explicitly call C function pointer version of push
+  static int push(luaw& l, Return (*f)(Args...) noexcept) {
+    return Basic::push(l, static_cast<Return (*)(Args...)>(f));
   }
+};
 
-  /// Get ref id for this sub thread.
-  const int ref_id() const { return ref_id_; }
+// Variadic function, not support
+template <typename Return, typename... Args>
+struct luaw::pusher<Return (*)(Args..., ...) noexcept> {
+  // Let compile fail
+  template <typename F>
+  static int push(luaw& l, F&& f) = delete;
+};
 
-  /// Push the referenced sub thread onto top of given stack.
-  void pushthread(lua_State* L) const {
-    PEACALM_LUAW_ASSERT(L);
-    lua_rawgeti(L, LUA_REGISTRYINDEX, ref_id_);
+#endif
+
+// bool
+template <>
+struct luaw::pusher<bool> {
+  static const size_t size = 1;
+
+  static int push(luaw& l, bool v) {
+    lua_pushboolean(l.L(), v);
+    return 1;
   }
 };
 
-inline subluaw luaw::make_subluaw() {
-  lua_State* subL   = newthread();
-  int        ref_id = luaL_ref(L_, LUA_REGISTRYINDEX);
-  return subluaw(subL, ref_id);
-}
+// integer types
+template <typename IntType>
+struct luaw::pusher<IntType,
+                    std::enable_if_t<std::is_integral<IntType>::value>> {
+  static const size_t size = 1;
 
-// Support output luaw::luavalueref by std::basic_ostream
-template <class Char, class Traits>
-std::basic_ostream<Char, Traits>& operator<<(
-    std::basic_ostream<Char, Traits>& o, const luaw::luavalueidx& r) {
-  fakeluaw l(r.L());
-  auto     _g = l.make_guarder();
-  o << "{";
-  if (l.is_type_string(r.idx()) || l.is_type_number(r.idx()) ||
-      l.is_type_boolean(r.idx())) {
-    o << l.type_name(r.idx()) << ": ";
+  static int push(luaw& l, IntType v) {
+    lua_pushinteger(l.L(), v);
+    return 1;
   }
-  o << luaL_tolstring(l.L(), r.idx(), NULL) << ", idx: " << r.idx() << "}";
-  return o;
-}
+};
 
-// Support output luaw::luavalueref by std::basic_ostream
-template <class Char, class Traits>
-std::basic_ostream<Char, Traits>& operator<<(
-    std::basic_ostream<Char, Traits>& o, const luaw::luavalueref& r) {
-  fakeluaw l(r.L());
-  auto     _g = l.make_guarder();
-  r.pushvalue();
-  o << "{";
-  if (l.is_type_string() || l.is_type_number() || l.is_type_boolean()) {
-    o << l.type_name() << ": ";
+// float number types
+template <typename FloatType>
+struct luaw::pusher<
+    FloatType,
+    std::enable_if_t<std::is_floating_point<FloatType>::value>> {
+  static const size_t size = 1;
+
+  static int push(luaw& l, FloatType v) {
+    lua_pushnumber(l.L(), v);
+    return 1;
   }
-  o << luaL_tolstring(l.L(), -1, NULL) << ", ref_id: " << r.ref_id() << "}";
-  return o;
-}
+};
 
-////////////////////////////////////////////////////////////////////////////////
+// std::string
+template <>
+struct luaw::pusher<std::string> {
+  static const size_t size = 1;
 
-namespace luaw_detail {
+  static int push(luaw& l, const std::string& v) {
+    lua_pushlstring(l.L(), v.data(), v.size());
+    return 1;
+  }
+};
 
-// void_t is defined in std since c++17
-template <typename T>
-using void_t = void;
+#if PEACALM_LUAW_SUPPORT_CPP17
+// std::string_view
+template <>
+struct luaw::pusher<std::string_view> {
+  static const size_t size = 1;
 
-// is std::shared_ptr
+  static int push(luaw& l, std::string_view v) {
+    lua_pushlstring(l.L(), v.data(), v.size());
+    return 1;
+  }
+};
+#endif
 
-template <typename T>
-struct is_std_shared_ptr : std::false_type {};
+// const char*
+template <>
+struct luaw::pusher<const char*> {
+  static const size_t size = 1;
 
-template <typename T>
-struct is_std_shared_ptr<std::shared_ptr<T>> : std::true_type {};
+  static int push(luaw& l, const char* v) {
+    // lua_pushstring will push nil if v is NULL, we forbid this
+    PEACALM_LUAW_ASSERT(v);
+    lua_pushstring(l.L(), v);
+    return 1;
+  }
+};
 
-// is std::unique_ptr
+// nullptr
+template <>
+struct luaw::pusher<std::nullptr_t> {
+  static const size_t size = 1;
 
-template <typename T>
-struct is_std_unique_ptr : std::false_type {};
+  static int push(luaw& l, std::nullptr_t) {
+    l.pushnil();
+    return 1;
+  }
+};
 
-template <typename T, typename D>
-struct is_std_unique_ptr<std::unique_ptr<T, D>> : std::true_type {};
+// void
+template <>
+struct luaw::pusher<void> {
+  static const size_t size = 0;
+  // nothing to push
+};
 
-// is array version std::unique_ptr
+// std::pair
+template <typename T, typename U>
+struct luaw::pusher<std::pair<T, U>> {
+  static const size_t size = 1;
 
-template <typename T>
-struct is_std_unique_ptr_of_array : std::false_type {};
+  static int push(luaw& l, const std::pair<T, U>& p) {
+    l.newtable();
+    l.push(p.first);
+    l.rawseti(-2, 1);
+    l.push(p.second);
+    l.rawseti(-2, 2);
+    return 1;
+  }
+};
 
-template <typename T, typename D>
-struct is_std_unique_ptr_of_array<std::unique_ptr<T[], D>> : std::true_type {};
+namespace luaw_detail {
 
-// is std::default_delete
+// Implementation for all list like containers
+template <typename Container>
+static int __push_list(luaw& l, const Container& v) {
+  l.newtable();
+  int cnt = 0;
+  for (auto b = v.begin(), e = v.end(); b != e; ++b) {
+    l.push(*b);
+    l.rawseti(-2, ++cnt);
+  }
+  return 1;
+}
 
-template <typename T>
-struct is_std_default_delete : std::false_type {};
+// Implementation for all set like containers
+// Make a Key-True table in Lua to represent set
+template <typename Container>
+static int __push_set(luaw& l, const Container& v) {
+  l.newtable();
+  for (auto b = v.begin(), e = v.end(); b != e; ++b) {
+    l.push(*b);
+    lua_pushboolean(l.L(), 1);
+    l.rawset(-3);
+  }
+  return 1;
+}
 
-template <typename T>
-struct is_std_default_delete<std::default_delete<T>> : std::true_type {};
+// Implementation for all map like containers
+template <typename Container>
+static int __push_map(luaw& l, const Container& v) {
+  l.newtable();
+  for (auto b = v.begin(), e = v.end(); b != e; ++b) {
+    l.push(b->first);
+    l.push(b->second);
+    l.rawset(-3);
+  }
+  return 1;
+}
 
-// get element_type
+}  // namespace luaw_detail
 
-template <typename T, typename = void>
-struct get_element_type {
-  using type = void;
-};
+// std::array
+template <typename T, std::size_t N>
+struct luaw::pusher<std::array<T, N>> {
+  static const size_t size = 1;
 
-template <typename T>
-struct get_element_type<T, void_t<typename T::element_type>> {
-  using type = typename T::element_type;
+  static int push(luaw& l, const std::array<T, N>& v) {
+    return luaw_detail::__push_list(l, v);
+  }
 };
 
-// Get a C function pointer type by a member function pointer type
+// std::vector
+template <typename T, typename Allocator>
+struct luaw::pusher<std::vector<T, Allocator>> {
+  static const size_t size = 1;
 
-template <typename T>
-struct get_cfptr_by_memfptr {
-  using type = void;
+  static int push(luaw& l, const std::vector<T, Allocator>& v) {
+    return luaw_detail::__push_list(l, v);
+  }
 };
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args...)> {
-  using type = Return (*)(Args...);
-};
+// std::deque
+template <typename T, typename Allocator>
+struct luaw::pusher<std::deque<T, Allocator>> {
+  static const size_t size = 1;
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args...) const> {
-  using type = Return (*)(Args...);
+  static int push(luaw& l, const std::deque<T, Allocator>& v) {
+    return luaw_detail::__push_list(l, v);
+  }
 };
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args...) volatile> {
-  using type = Return (*)(Args...);
-};
+// std::forward_list
+template <typename T, typename Allocator>
+struct luaw::pusher<std::forward_list<T, Allocator>> {
+  static const size_t size = 1;
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args...) const volatile> {
-  using type = Return (*)(Args...);
+  static int push(luaw& l, const std::forward_list<T, Allocator>& v) {
+    return luaw_detail::__push_list(l, v);
+  }
 };
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args..., ...)> {
-  using type = Return (*)(Args..., ...);
-};
+// std::list
+template <typename T, typename Allocator>
+struct luaw::pusher<std::list<T, Allocator>> {
+  static const size_t size = 1;
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args..., ...) const> {
-  using type = Return (*)(Args..., ...);
+  static int push(luaw& l, const std::list<T, Allocator>& v) {
+    return luaw_detail::__push_list(l, v);
+  }
 };
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args..., ...) volatile> {
-  using type = Return (*)(Args..., ...);
-};
+// std::set
+template <typename Key, typename Compare, typename Allocator>
+struct luaw::pusher<std::set<Key, Compare, Allocator>> {
+  static const size_t size = 1;
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args..., ...) const volatile> {
-  using type = Return (*)(Args..., ...);
+  static int push(luaw& l, const std::set<Key, Compare, Allocator>& v) {
+    return luaw_detail::__push_set(l, v);
+  }
 };
 
-#if PEACALM_LUAW_SUPPORT_CPP17
-// Keep noexcept if C++17 supported
+// std::unordered_set
+template <typename Key, typename Hash, typename KeyEqual, typename Allocator>
+struct luaw::pusher<std::unordered_set<Key, Hash, KeyEqual, Allocator>> {
+  static const size_t size = 1;
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args...) noexcept> {
-  using type = Return (*)(Args...) noexcept;
+  static int push(luaw&                                                     l,
+                  const std::unordered_set<Key, Hash, KeyEqual, Allocator>& v) {
+    return luaw_detail::__push_set(l, v);
+  }
 };
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args...) const noexcept> {
-  using type = Return (*)(Args...) noexcept;
-};
+// std::map
+template <typename Key, typename Compare, typename Allocator>
+struct luaw::pusher<std::map<Key, Compare, Allocator>> {
+  static const size_t size = 1;
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args...) volatile noexcept> {
-  using type = Return (*)(Args...) noexcept;
+  static int push(luaw& l, const std::map<Key, Compare, Allocator>& v) {
+    return luaw_detail::__push_map(l, v);
+  }
 };
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args...)
-                                const volatile noexcept> {
-  using type = Return (*)(Args...) noexcept;
-};
+// std::unordered_map
+template <typename Key, typename Hash, typename KeyEqual, typename Allocator>
+struct luaw::pusher<std::unordered_map<Key, Hash, KeyEqual, Allocator>> {
+  static const size_t size = 1;
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args..., ...) noexcept> {
-  using type = Return (*)(Args..., ...) noexcept;
+  static int push(luaw&                                                     l,
+                  const std::unordered_map<Key, Hash, KeyEqual, Allocator>& v) {
+    return luaw_detail::__push_map(l, v);
+  }
 };
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args..., ...) const noexcept> {
-  using type = Return (*)(Args..., ...) noexcept;
-};
+// std::tuple, as a table list
+template <typename... Ts>
+struct luaw::pusher<std::tuple<Ts...>> {
+  static const size_t size = 1;
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args...,
-                                               ...) volatile noexcept> {
-  using type = Return (*)(Args..., ...) noexcept;
-};
+  static int push(luaw& l, const std::tuple<Ts...>& v) {
+    l.newtable();
+    const size_t N = std::tuple_size<std::tuple<Ts...>>::value;
+    __push<0, N>(l, v, std::integral_constant<bool, 0 < N>{});
+    return 1;
+  }
 
-template <typename Object, typename Return, typename... Args>
-struct get_cfptr_by_memfptr<Return (Object::*)(Args..., ...)
-                                const volatile noexcept> {
-  using type = Return (*)(Args..., ...) noexcept;
+private:
+  template <size_t I, size_t N, typename T>
+  static void __push(luaw& l, const T& t, std::true_type) {
+    l.push(std::get<I>(t));
+    l.rawseti(-2, I + 1);
+    __push<I + 1, N>(l, t, std::integral_constant<bool, I + 1 < N>{});
+  }
+  template <size_t I, size_t N, typename T>
+  static void __push(luaw& l, const T& t, std::false_type) {}
 };
 
-#endif
-
-template <typename T>
-using get_cfptr_by_memfptr_t = typename get_cfptr_by_memfptr<T>::type;
-
-// Detect type of callee, which is a pointer to member function operator()
-
-template <typename T, typename = void>
-struct detect_callee {
-  using type = void;
-};
+template <>
+struct luaw::pusher<luaw::luavalueidx> {
+  static const size_t size = 1;
 
-template <typename T>
-struct detect_callee<T, void_t<decltype(&T::operator())>> {
-  using type = decltype(&T::operator());
+  static int push(luaw& l, const luaw::luavalueidx& r) {
+    if (!r.valid()) {
+      l.pushnil();
+    } else if (l.L() == r.L()) {
+      l.pushvalue(r.idx());
+    } else if (l.main_thread() == r.main_thread()) {
+      lua_pushvalue(r.L(), r.idx());
+      lua_xmove(r.L(), l.L(), 1);
+    } else {
+      // Can't push value from other lua_State.
+      l.pushnil();
+    }
+    return 1;
+  }
 };
 
-template <typename T>
-using detect_callee_t = typename detect_callee<T>::type;
-
-// Detect C function style callee type
-
-template <typename T>
-using detect_c_callee_t = get_cfptr_by_memfptr_t<detect_callee_t<T>>;
-
-// Detect whether T maybe a captureless and non-generic lambda
-
-template <typename T>
-struct maybe_lambda
-    : std::integral_constant<
-          bool,
-          !std::is_same<T, void>::value &&
-              std::is_convertible<T, detect_c_callee_t<T>>::value> {};
-
-// Detect whether decay_t<T> maybe a captureless and non-generic lambda
-
-template <typename T>
-struct decay_maybe_lambda : maybe_lambda<std::decay_t<T>> {};
-
-// Whether T has a non-template member operator()
-
-template <typename T, typename = void>
-struct is_callable_class : std::false_type {};
+template <>
+struct luaw::pusher<luaw::luavalueref> {
+  static const size_t size = 1;
 
-template <typename T>
-struct is_callable_class<T, void_t<decltype(&T::operator())>> : std::true_type {
+  static int push(luaw& l, const luaw::luavalueref& r) {
+    if (r.as_nil()) {
+      l.pushnil();
+    } else if (l.L() == r.L() || l.main_thread() == r.main_thread()) {
+      lua_rawgeti(l.L(), LUA_REGISTRYINDEX, r.ref_id());
+    } else {
+      // Can't push value from other lua_State.
+      l.pushnil();
+    }
+    return 1;
+  }
 };
 
-// whether T is C function
+//////////////////// pusher_for_return impl ////////////////////////////////////
 
 template <typename T>
-struct is_cfunction : std::false_type {};
-
-template <typename Return, typename... Args>
-struct is_cfunction<Return(Args...)> : std::true_type {};
-
-template <typename Return, typename... Args>
-struct is_cfunction<Return(Args..., ...)> : std::true_type {};
-
-#if PEACALM_LUAW_SUPPORT_CPP17
-
-template <typename Return, typename... Args>
-struct is_cfunction<Return(Args...) noexcept> : std::true_type {};
-
-template <typename Return, typename... Args>
-struct is_cfunction<Return(Args..., ...) noexcept> : std::true_type {};
+struct luaw::pusher_for_return : public luaw::pusher<T> {
+  static_assert(std::is_same<T, std::decay_t<T>>::value, "T should be decayed");
+};
 
-#endif
+// std::tuple
+// Push elements separately in order. One element takes one place in stack.
+template <typename... Ts>
+struct luaw::pusher_for_return<std::tuple<Ts...>> {
+  static const size_t size = std::tuple_size<std::tuple<Ts...>>::value;
 
-// whether T is C function pointer
+  static int push(luaw& l, const std::tuple<Ts...>& v) {
+    const size_t N = size;
+    int ret_num    = __push<0, N>(l, v, std::integral_constant<bool, 0 < N>{});
+    PEACALM_LUAW_ASSERT(ret_num == N);
+    return ret_num;
+  }
 
-template <typename T>
-struct is_cfunction_pointer
-    : std::integral_constant<
-          bool,
-          std::is_pointer<T>::value &&
-              is_cfunction<std::remove_pointer_t<T>>::value> {};
+private:
+  template <size_t I, size_t N, typename T>
+  static int __push(luaw& l, const T& t, std::true_type) {
+    int x = l.push(std::get<I>(t));
+    int y = __push<I + 1, N>(l, t, std::integral_constant<bool, I + 1 < N>{});
+    return x + y;
+  }
 
-// Whether T is C style callable: C function or C function pointer
+  template <size_t I, size_t N, typename T>
+  static int __push(luaw& l, const T& t, std::false_type) {
+    return 0;
+  }
+};
 
-template <typename T>
-struct is_callable_c
-    : std::integral_constant<bool,
-                             is_cfunction<T>::value ||
-                                 is_cfunction_pointer<T>::value> {};
+//////////////////// convertor impl ////////////////////////////////////////////
 
-// whether T is callable
+// NOTICE: this will return a copy of userdata with type T!
+template <typename T, typename>
+struct luaw::convertor {
+  static T to(luaw& l,
+              int   idx         = -1,
+              bool  disable_log = false,
+              bool* failed      = nullptr,
+              bool* exists      = nullptr) {
+    T* p = luaw::convertor<T*>::to(l, idx, disable_log, failed, exists);
+    if (!p) return T{};
+    return *p;
+  }
+};
 
+// convert to all type of pointers including (cv-) void* but not const char*!
 template <typename T>
-struct is_callable : std::integral_constant<bool,
-                                            is_callable_class<T>::value ||
-                                                is_callable_c<T>::value> {};
-
-// whether decay_t<T> is callable
+struct luaw::
+    convertor<T*, std::enable_if_t<!std::is_same<T*, const char*>::value>> {
+  static T* to(luaw& l,
+               int   idx         = -1,
+               bool  disable_log = false,
+               bool* failed      = nullptr,
+               bool* exists      = nullptr) {
+    if (l.isnoneornil(idx)) {
+      if (exists) *exists = false;
+      if (failed) *failed = false;
+      return nullptr;
+    }
+    if (exists) *exists = true;
+    if (l.isuserdata(idx)) {
+      if (failed) *failed = false;
+      void* p = lua_touserdata(l.L(), idx);
+      return reinterpret_cast<T*>(p);
+    }
+    if (failed) *failed = true;
+    if (!disable_log) { l.log_type_convert_error(idx, "userdata"); }
+    return nullptr;
+  }
+};
 
-template <typename T>
-struct decay_is_callable : is_callable<std::decay_t<T>> {};
+// to const char*, NOT RECOMMENDED! Should better use to std::string instead!
+// lua_tostring will change number to C string in stack, which is dangerous!
+template <>
+struct luaw::convertor<const char*> {
+  static const char* to(luaw& l,
+                        int   idx         = -1,
+                        bool  disable_log = false,
+                        bool* failed      = nullptr,
+                        bool* exists      = nullptr) {
+    if (l.isnoneornil(idx)) {
+      if (exists) *exists = false;
+      if (failed) *failed = false;
+      return nullptr;
+    }
+    if (exists) *exists = true;
+    if (l.isstring(idx)) {
+      if (failed) *failed = false;
+      const char* p = lua_tostring(l.L(), idx);
+      return p;
+    }
+    if (failed) *failed = true;
+    if (!disable_log) { l.log_type_convert_error(idx, "const char*"); }
+    return nullptr;
+  }
+};
 
-// detect C function pointer type by a C function or a callable class
+// to placeholder_tag
+template <>
+struct luaw::convertor<luaw::placeholder_tag> {
+  static luaw::placeholder_tag to(luaw& l,
+                                  int   idx         = -1,
+                                  bool  disable_log = false,
+                                  bool* failed      = nullptr,
+                                  bool* exists      = nullptr) {
+    if (failed) *failed = false;
+    if (exists) *exists = !l.isnoneornil(idx);
+    return luaw::placeholder_tag{};
+  }
+};
 
-template <typename T>
-using detect_callable_cfunction_t = std::conditional_t<
-    decay_is_callable<T>::value,
-    std::conditional_t<is_callable_class<std::decay_t<T>>::value,
-                       detect_c_callee_t<std::decay_t<T>>,
-                       std::decay_t<T>>,
-    void>;
+namespace luaw_detail {
 
-// remove_ptr_or_smart_ptr
+// Whether the type T is a std::tuple and has element of reference type.
 
 template <typename T>
-using remove_ptr_or_smart_ptr_t =
-    std::conditional_t<is_std_shared_ptr<std::decay_t<T>>::value ||
-                           is_std_unique_ptr<std::decay_t<T>>::value,
-                       typename get_element_type<T>::type,
-                       typename std::remove_pointer<T>::type>;
-
-}  // namespace luaw_detail
+struct tuple_has_ref : std::false_type {};
 
-//////////////////// pusher impl ///////////////////////////////////////////////
+template <typename T, typename... Ts>
+struct tuple_has_ref<std::tuple<T, Ts...>>
+    : public std::integral_constant<
+          bool,
+          std::is_reference<T>::value ||
+              tuple_has_ref<std::tuple<Ts...>>::value> {};
 
-// function_tag: push as a function
 template <>
-struct luaw::pusher<luaw::function_tag> {
-  static const size_t size = 1;
-
-  template <typename F>
-  static int push(luaw& l, F&& f) {
-    using DecayF = std::decay_t<F>;
-    static_assert(luaw_detail::is_callable<DecayF>::value,
-                  "Should push a callable value");
+struct tuple_has_ref<std::tuple<>> : std::false_type {};
 
-    // C function pointer type
-    using CFunctionPtr =
-        std::conditional_t<luaw_detail::is_callable_class<DecayF>::value,
-                           luaw_detail::detect_c_callee_t<DecayF>,
-                           DecayF>;
-    static_assert(luaw_detail::is_cfunction_pointer<CFunctionPtr>::value,
-                  "Should get a C function pointer type");
-    return luaw::pusher<CFunctionPtr>::push(l, std::forward<F>(f));
-  }
-};
+// Whether the type T is a std::tuple and has element of non-const lvalue
+// reference type.
 
-// class_tag: push as an user defined custom class type.
-// Only works on class type or it's pointer.
-// Push class as full userdata, push pointer to class as light userdata.
-template <>
-struct luaw::pusher<luaw::class_tag> {
-  static const size_t size = 1;
+template <typename T>
+struct tuple_has_non_const_lvalue_ref : std::false_type {};
 
-  template <typename Y>
-  static int push(luaw& l, Y&& v) {
-    using SolidY = std::remove_reference_t<Y>;
-    static_assert(std::is_class<std::remove_pointer_t<SolidY>>::value,
-                  "Only class or it's pointer");
-    __push<SolidY>(l, std::forward<Y>(v), std::is_pointer<SolidY>{});
-    return 1;
-  }
+template <typename T, typename... Ts>
+struct tuple_has_non_const_lvalue_ref<std::tuple<T, Ts...>>
+    : public std::integral_constant<
+          bool,
+          (std::is_lvalue_reference<T>::value &&
+           !std::is_const<std::remove_reference_t<T>>::value) ||
+              tuple_has_non_const_lvalue_ref<std::tuple<Ts...>>::value> {};
 
-  // Construct TargetT by Y at the moment of creating userdata.
-  template <typename TargetT, typename Y>
-  static std::enable_if_t<
-      !std::is_same<TargetT, Y>::value &&
-          !std::is_same<std::decay_t<TargetT>, luaw::class_tag>::value,
-      int>
-  push(luaw& l, Y&& v) {
-    static_assert(std::is_class<std::remove_pointer_t<TargetT>>::value,
-                  "Only class or it's pointer");
-    static_assert(std::is_convertible<Y, TargetT>::value,
-                  "Y should convertible to TargetT");
-    __push<TargetT>(l, std::forward<Y>(v), std::is_pointer<TargetT>{});
-    return 1;
-  }
+template <>
+struct tuple_has_non_const_lvalue_ref<std::tuple<>> : std::false_type {};
 
-private:
-  // TargetT is pointer type
-  template <typename TargetT, typename Y>
-  static void __push(luaw& l, Y&& v, std::true_type) {
-    l.pushlightuserdata(reinterpret_cast<void*>(
-        const_cast<std::remove_cv_t<std::remove_pointer_t<TargetT>>*>(v)));
-    luaw::metatable_factory<TargetT>::push_shared_metatable(l);
-    l.setmetatable(-2);
-  }
+// Whether have any non-const lvalue reference type in Ts
+template <typename... Ts>
+struct has_non_const_lvalue_ref
+    : public tuple_has_non_const_lvalue_ref<std::tuple<Ts...>> {};
 
-  // TargetT is not pointer type
-  template <typename TargetT, typename Y>
-  static void __push(luaw& l, Y&& v, std::false_type) {
-    void* p = l.newuserdata(sizeof(TargetT));
-    new (p) TargetT(std::forward<Y>(v));  // construct TargetT by Y
-    luaw::metatable_factory<TargetT>::push_shared_metatable(l);
-    l.setmetatable(-2);
-  }
-};
+}  // namespace luaw_detail
 
-// primary pusher. guess whether it may be a lambda, push as function if true,
-// otherwise push as an user defined custom object.
-template <typename T, typename>
-struct luaw::pusher {
-  static_assert(!std::is_pointer<T>::value,
-                "Never happen (Pointers should be specialized elsewhere)");
-  static_assert(std::is_same<T, std::decay_t<T>>::value, "T should be decayed");
-  static_assert(std::is_class<T>::value, "T should be a class type");
+template <typename Return, typename... Args>
+class luaw::function<Return(Args...)> {
+  static_assert(
+      !luaw_detail::has_non_const_lvalue_ref<Args...>::value,
+      "Do not support non-const lvalue reference as luaw::function's argument. "
+      ""
+      "If using this kind of reference, it will make a copy of the referenced "
+      "argument into Lua, won't implicitly take its address, meaning that it "
+      "will not share the same object in Lua with C++. "
+      "And this behaves differently with that in C++. This may confuse users, "
+      "so explicitly forbid it. "
+      ""
+      "If you want to share the same argument objects in Lua with C++, "
+      "so you can modify them in Lua, you can use raw pointer type if there is "
+      "only one kind of raw pointer type in all arguments, or use smart "
+      "pointer type or peacalm::luaw::ptrw type, and these two are safer and "
+      "more reassuring.");
+  static_assert(!std::is_reference<Return>::value &&
+                    !luaw_detail::tuple_has_ref<Return>::value,
+                "Do not support reference type as luaw::function's result. "
+                "Cannot make a C++ reference to a value in Lua");
 
-  static const size_t size = 1;
+  // component
+  lua_State*                 L_ = nullptr;
+  std::shared_ptr<const int> ref_sptr_;
 
-  // DecayY must be same as T
-  template <typename Y>
-  static int push(luaw& l, Y&& v) {
-    static_assert(std::is_same<std::decay_t<Y>, T>::value,
-                  "Decayed Y should be same type as T");
-    using SolidY = std::remove_reference_t<Y>;
+  // parameters put in
+  bool disable_log_ = false;
 
-    // Guess whether it may be a lambda object, if it is, then push as a
-    // function, otherwise push as custom class.
-    return __push<SolidY>(
-        l, std::forward<Y>(v), luaw_detail::decay_maybe_lambda<Y>{});
-  }
+  // states put out
+  mutable bool function_failed_ = false, function_exists_ = false,
+               result_failed_ = false, result_exists_ = false;
+  mutable int real_result_size_ = 0;
 
-  // Construct TargetT by Y at the moment of creating userdata.
-  template <typename TargetT, typename Y>
-  static std::enable_if_t<!std::is_same<TargetT, Y>::value, int> push(luaw& l,
-                                                                      Y&&   v) {
-    static_assert(std::is_class<TargetT>::value &&
-                      std::is_same<std::remove_cv_t<TargetT>, T>::value,
-                  "TargetT should be class T or cv- qualified T");
-    static_assert(std::is_convertible<Y, TargetT>::value,
-                  "Y should convertible to TargetT");
-    __push<TargetT>(
-        l, std::forward<Y>(v), luaw_detail::decay_maybe_lambda<Y>{});
-    return 1;
-  }
+public:
+  function(lua_State* L           = nullptr,
+           int        idx         = -1,
+           bool       disable_log = false,
+           bool*      failed      = nullptr,
+           bool*      exists      = nullptr)
+      : L_(L), disable_log_(disable_log) {
+    if (!L) {
+      if (failed) *failed = true;
+      if (exists) *exists = false;
+      return;
+    }
 
-private:
-  // Push as a function.
-  template <typename _Nouse, typename Y>
-  static int __push(luaw& l, Y&& v, std::true_type) {
-    return luaw::pusher<luaw::function_tag>::push(l, std::forward<Y>(v));
-  }
+    // states about convertion to function,
+    // it is states before call the function.
+    function_exists_ = !lua_isnoneornil(L_, idx);
+    if (exists) *exists = !lua_isnoneornil(L_, idx);
+    if (failed) {
+      if (lua_isnoneornil(L_, idx)) {
+        // noneornil is not callable, so we regard this (not-exists) as failed
+        // for function, which is not same as getting variabls.
+        *failed = true;
+      } else {
+        // check more whether it's callable
+        fakeluaw l(L);
+        *failed = !l.callable(idx);
+      }
+    }
 
-  // Push as a full userdata.
-  template <typename TargetT, typename Y>
-  static int __push(luaw& l, Y&& v, std::false_type) {
-    return luaw::pusher<luaw::class_tag>::template push<TargetT>(
-        l, std::forward<Y>(v));
+    lua_pushvalue(L_, idx);
+    const int ref_id = luaL_ref(L, LUA_REGISTRYINDEX);
+    ref_sptr_.reset(new int(ref_id), [L](const int* p) {
+      luaL_unref(L, LUA_REGISTRYINDEX, *p);
+      delete p;
+    });
   }
-};
 
-// pointer to class
-template <typename T>
-struct luaw::pusher<
-    T*,
-    std::enable_if_t<!std::is_function<T>::value &&
-                     !std::is_same<T*, const char*>::value &&
-                     !luaw_detail::is_std_unique_ptr<std::decay_t<T>>::value &&
-                     std::is_class<std::decay_t<T>>::value>> {
-  static const size_t size = 1;
+  /// Unref the referenced Lua function value.
+  void unref() { ref_sptr_.reset(); }
 
-  static int push(luaw& l, T* v) {
-    l.pushlightuserdata(
-        reinterpret_cast<void*>(const_cast<std::remove_cv_t<T>*>(v)));
+  /// Get the ref id for the referenced Lua function value.
+  const int ref_id() const { return ref_sptr_ ? *ref_sptr_ : LUA_NOREF; }
 
-    luaw::metatable_factory<T*>::push_shared_metatable(l);
-    l.setmetatable(-2);
+  /// Get internal lua_State.
+  lua_State* L() const { return L_; }
 
-    return 1;
+  /// Set log on-off.
+  void disable_log(bool v) { disable_log_ = v; }
+
+  /// Return a C string text message to indicate current state.
+  const char* state_msg() const {
+    if (!failed()) return "No fail";
+    if (function_failed()) return "Function failed";
+    if (!function_exists()) return "Function not exist";
+    if (result_failed()) return "Result failed";
+    if (!result_enough()) {
+      if (!result_exists()) return "Result not exist";
+      return "Result not enough";
+    }
+    return "Unknown";
   }
-};
 
-// non-class pointer, as lightuserdata
-template <typename T>
-struct luaw::pusher<
-    T*,
-    std::enable_if_t<!std::is_function<T>::value &&
-                     !std::is_same<T*, const char*>::value &&
-                     !luaw_detail::is_std_unique_ptr<std::decay_t<T>>::value &&
-                     !std::is_class<std::decay_t<T>>::value>> {
-  static const size_t size = 1;
+  // states after function call
+  // @{
 
-  static int push(luaw& l, T* v) {
-    l.pushlightuserdata(
-        reinterpret_cast<void*>(const_cast<std::remove_cv_t<T>*>(v)));
-    return 1;
+  /// Whether the whole process failed.
+  /// Any step fails the whole process fails, including running the function in
+  /// Lua and converting results to C++, and whether get enough results.
+  bool failed() const {
+    return function_failed() || !function_exists() || result_failed() ||
+           !result_enough();
   }
-};
-
-// pointer to std::unique_ptr<T, D>, share metatable with pointer to
-// std::unique_ptr<T>
-template <typename T>
-struct luaw::pusher<
-    T*,
-    std::enable_if_t<luaw_detail::is_std_unique_ptr<std::decay_t<T>>::value>> {
-  static const size_t size = 1;
 
-  static int push(luaw& l, T* v) {
-    using E = std::conditional_t<
-        luaw_detail::is_std_unique_ptr_of_array<std::decay_t<T>>::value,
-        typename T::element_type[],
-        typename T::element_type>;
-    using T0 = std::unique_ptr<E>;  // use default_deleter
-    using T1 =
-        std::conditional_t<std::is_const<T>::value, std::add_const_t<T0>, T0>;
-    using T2 = std::
-        conditional_t<std::is_volatile<T>::value, std::add_volatile_t<T1>, T1>;
+  /// Whether the function failed while running in Lua (not including function
+  /// doesn't exist)
+  bool function_failed() const { return function_failed_; }
 
-    static_assert(
-        luaw_detail::is_std_default_delete<typename T::deleter_type>::value
-            ? std::is_same<T, T2>::value
-            : true,
-        "Never happen");
+  /// Whether the function exists in Lua
+  bool function_exists() const { return function_exists_; }
 
-    l.pushlightuserdata(
-        reinterpret_cast<void*>(const_cast<std::remove_cv_t<T>*>(v)));
+  /// Whether converting the Lua function's results to C++ failed
+  bool result_failed() const { return result_failed_; }
 
-    luaw::metatable_factory<T2*>::push_shared_metatable(l);
-    l.setmetatable(-2);
+  /// Whether the Lua function returns results (whether results exist)
+  bool result_exists() const { return result_exists_; }
 
-    return 1;
+  /// Whether Lua function returns enough results.
+  /// Could return more than expect, but couldn't less.
+  bool result_enough() const {
+    return real_result_size() >= expected_result_size();
   }
-};
 
-// std::unique_ptr<T, D>, not share metatable with std::unique_ptr<T>
-template <typename T>
-struct luaw::pusher<
-    T,
-    std::enable_if_t<luaw_detail::is_std_unique_ptr<std::decay_t<T>>::value>> {
-  static_assert(std::is_same<T, std::decay_t<T>>::value, "T should be decayed");
+  /// Result number the Lua function returned
+  int real_result_size() const { return real_result_size_; }
 
-  static const size_t size = 1;
+  // @}
 
-  template <typename Y>
-  static int push(luaw& l, Y&& v) {
-    static_assert(luaw_detail::is_std_unique_ptr<std::decay_t<Y>>::value,
-                  "Decayed Y should be std::unique_ptr");
+  /// Result number we expect the Lua function should return.
+  /// Could return more, couldn't less.
+  constexpr int expected_result_size() const {
+    return luaw::pusher_for_return<std::decay_t<Return>>::size;
+  }
 
-    using SolidY = std::remove_reference_t<Y>;
-    using E      = std::conditional_t<
-        luaw_detail::is_std_unique_ptr_of_array<std::decay_t<T>>::value,
-        typename T::element_type[],
-        typename T::element_type>;
-    using T0 = std::unique_ptr<E>;  // use default_deleter
-    using T1 = std::
-        conditional_t<std::is_const<SolidY>::value, std::add_const_t<T0>, T0>;
-    using T2 = std::conditional_t<std::is_volatile<SolidY>::value,
-                                  std::add_volatile_t<T1>,
-                                  T1>;
+  Return operator()(Args... args) const {
+    // reset all states first
+    function_failed_  = false;
+    function_exists_  = false;
+    result_failed_    = false;
+    result_exists_    = false;
+    real_result_size_ = 0;
 
-    static_assert(
-        luaw_detail::is_std_default_delete<typename T::deleter_type>::value
-            ? std::is_same<T2, SolidY>::value
-            : true,
-        "Never happen");
+    if (!L_ || !ref_sptr_) {
+      function_failed_ = false;
+      function_exists_ = false;
+      if (!disable_log_) {
+        if (!L_) {
+          luaw::log_error("luaw::function has no lua_State");
+        } else if (!ref_sptr_) {
+          luaw::log_error("luaw::function refers to nothing");
+        } else {
+          PEACALM_LUAW_ASSERT(false);
+        }
+      }
+      return Return();
+    }
+
+    fakeluaw l(L_);
+    auto     _g = l.make_guarder();
+    int      sz = l.gettop();
+    l.rawgeti(LUA_REGISTRYINDEX, *ref_sptr_);
+    if (l.isnoneornil()) {
+      function_failed_ = false;
+      function_exists_ = false;
+      l.pop();
+      if (!disable_log_) { luaw::log_error("calling an inexistent function"); }
+      return Return();
+    } else {
+      function_exists_ = true;
+    }
+
+    // push args by copy or move
+    int narg = push_args(l, std::forward<Args>(args)...);
 
-    void* p = l.newuserdata(sizeof(SolidY));
-    new (p) SolidY(std::forward<Y>(v));
+    int pcall_ret = l.pcall(narg, LUA_MULTRET, 0);
+    PEACALM_LUAW_ASSERT(l.gettop() >= sz);
 
-    bool first_create = luaw::metatable_factory<SolidY>::gtouchmetatb(l);
-    if (first_create) {
-      luaw::metatable_factory<T2*>::set_metamethods(l);
-      luaw::metatable_factory<SolidY>::set_gc_to_metatable(l);
+    if (pcall_ret == LUA_OK) {
+      function_failed_  = false;
+      real_result_size_ = l.gettop() - sz;
+    } else {
+      function_failed_ = true;
+      if (!disable_log_) { l.log_error_in_stack(); }
+      l.pop();
+      return Return();
     }
-    l.setmetatable(-2);
 
-    return 1;
+    return luaw::convertor_for_return<std::decay_t<Return>>::to(
+        l, sz + 1, disable_log_, &result_failed_, &result_exists_);
   }
-};
 
-// newtable_tag: push a new empty table
-template <>
-struct luaw::pusher<luaw::newtable_tag> {
-  static const size_t size = 1;
+private:
+  static int push_args(luaw& l) { return 0; }
 
-  static int push(luaw& l, newtable_tag) {
-    l.newtable();
-    return 1;
+  template <typename FirstArg, typename... RestArgs>
+  static int push_args(luaw& l, FirstArg&& farg, RestArgs&&... rargs) {
+    int x = l.push(std::forward<FirstArg>(farg));
+    int y = push_args(l, std::forward<RestArgs>(rargs)...);
+    return x + y;
   }
 };
 
-// std::function
+// to luaw::function
 template <typename Return, typename... Args>
-struct luaw::pusher<std::function<Return(Args...)>> {
-  static const size_t size = 1;
+struct luaw::convertor<luaw::function<Return(Args...)>> {
+  using result_t = luaw::function<Return(Args...)>;
+  static result_t to(luaw& l,
+                     int   idx         = -1,
+                     bool  disable_log = false,
+                     bool* failed      = nullptr,
+                     bool* exists      = nullptr) {
+    return result_t(l.L(), idx, disable_log, failed, exists);
+  }
+};
 
-  template <typename F>
-  static int push(luaw& l, F&& f) {
-    using CFunctionPtr = Return (*)(Args...);
-    return luaw::pusher<CFunctionPtr>::push(l, std::forward<F>(f));
+// to std::function
+template <typename Return, typename... Args>
+struct luaw::convertor<std::function<Return(Args...)>> {
+  using result_t = std::function<Return(Args...)>;
+  static result_t to(luaw& l,
+                     int   idx         = -1,
+                     bool  disable_log = false,
+                     bool* failed      = nullptr,
+                     bool* exists      = nullptr) {
+    return result_t(luaw::convertor<luaw::function<Return(Args...)>>::to(
+        l, idx, disable_log, failed, exists));
   }
 };
 
-// Lua C functions
-template <>
-struct luaw::pusher<luaw::lua_cfunction_t> {
-  static const size_t size = 1;
+//////////////////// compiled_expr impl ////////////////////////////////////////
 
-  static int push(luaw& l, lua_cfunction_t f) {
-    l.pushcfunction(f);
-    return 1;
+class luaw::compiled_expr {
+  friend class luaw;
+
+  lua_State*                 L_ = nullptr;
+  std::shared_ptr<const int> ref_sptr_;
+
+  // Bytecode of a main chunk loaded as a fresh function by each eval_with_env,
+  // so evaluations never see each other's environment. It's dumped lazily
+  // from the referenced function, or set by compile_fused, whose main chunk
+  // returns the function to call.
+  mutable std::shared_ptr<const std::string> env_chunk_;
+  bool                                       env_chunk_returns_ = false;
+
+  // Get env_chunk_. Only a Lua function whose only upvalue is _ENV, like a
+  // main chunk, could be reloaded from its bytecode.
+  const std::string* __env_chunk() const {
+    if (env_chunk_) return env_chunk_.get();
+    pushvalue();
+    const int f  = lua_gettop(L_);
+    bool      ok = lua_isfunction(L_, f) && !lua_iscfunction(L_, f);
+    if (ok && lua_getupvalue(L_, f, 2)) {
+      lua_pop(L_, 1);
+      ok = false;
+    }
+    if (ok && lua_getupvalue(L_, f, 1)) {
+      lua_pop(L_, 1);
+      ok = luaw::__env_upvalue_index(L_, f) == 1;
+    }
+    if (ok) env_chunk_ = luaw::__dump_function(L_);
+    lua_pop(L_, 1);
+    return env_chunk_.get();
   }
-};
 
-// C funtions except lua_cfunction_t, also implementation for callable objects
-template <typename Return, typename... Args>
-struct luaw::pusher<Return (*)(Args...)> {
-  static const size_t size = 1;
+public:
+  /// Refer to the compiled function at given index of stack "L".
+  compiled_expr(lua_State* L = nullptr, int idx = -1) : L_(L) {
+    if (!L) return;
+    lua_pushvalue(L, idx);
+    const int ref_id = luaL_ref(L, LUA_REGISTRYINDEX);
+    ref_sptr_.reset(new int(ref_id), [L](const int* p) {
+      luaL_unref(L, LUA_REGISTRYINDEX, *p);
+      delete p;
+    });
+  }
 
-  // function object with non-trivially destructor
-  template <typename F>
-  static std::
-      enable_if_t<!std::is_trivially_destructible<std::decay_t<F>>::value, int>
-      push(luaw& l, F&& f) {
-    using SolidF = std::remove_reference_t<F>;
+  /// Get internal lua_State.
+  lua_State* L() const { return L_; }
 
-    luaw::lua_cfunction_t __call = [](lua_State* L) -> int {
-      PEACALM_LUAW_ASSERT(lua_gettop(L) >= 1);
-      PEACALM_LUAW_ASSERT(lua_isuserdata(L, 1));
-      auto callee = static_cast<SolidF*>(lua_touserdata(L, 1));
-      PEACALM_LUAW_ASSERT(callee);
-      luaw l(L);
-      int  ret_num = callback(l, *callee, 2, std::is_void<Return>{});
-      l.clearL();
-      return ret_num;
-    };
+  /// Get the ref id for the referenced compiled function.
+  int ref_id() const { return ref_sptr_ ? *ref_sptr_ : LUA_NOREF; }
 
-    luaw::lua_cfunction_t __gc = [](lua_State* L) -> int {
-      PEACALM_LUAW_ASSERT(lua_gettop(L) == 1);
-      PEACALM_LUAW_ASSERT(lua_isuserdata(L, 1));
-      auto fptr = static_cast<SolidF*>(lua_touserdata(L, 1));
-      PEACALM_LUAW_ASSERT(fptr);
-      fptr->~SolidF();
-      return 0;
-    };
+  /// Whether refers to a compiled function.
+  bool valid() const { return L_ && ref_sptr_ && *ref_sptr_ != LUA_REFNIL; }
 
-    // object
-    auto faddr = static_cast<SolidF*>(l.newuserdata(sizeof(f)));
-    new (faddr) SolidF(std::forward<F>(f));
+  /// Unref the referenced compiled function.
+  void unref() { ref_sptr_.reset(); }
 
-    // build metatable
-    l.newtable();
+  /// Push the compiled function onto stack.
+  void pushvalue() const {
+    PEACALM_LUAW_ASSERT(L_);
+    lua_rawgeti(L_, LUA_REGISTRYINDEX, ref_id());
+  }
 
-    l.pushstring("__call");
-    l.pushcfunction(__call);
-    l.rawset(-3);
+  /**
+   * @brief Evaluate the compiled expression and get result in C++ type.
+   *
+   * Same as luaw::eval but without compiling.
+   *
+   * @tparam T The result type user expected.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the operation is failed if this
+   * pointer is not nullptr.
+   * @return The expression's result in type T.
+   */
+  template <typename T>
+  T eval(bool disable_log = false, bool* failed = nullptr) const {
+    if (!valid()) {
+      if (failed) *failed = true;
+      if (!disable_log) luaw::log_error("compiled_expr refers to nothing");
+      return T();
+    }
+    fakeluaw l(L_);
+    auto     _g = l.make_guarder();
+    int      sz = l.gettop();
+    l.rawgeti(LUA_REGISTRYINDEX, *ref_sptr_);
+    if (l.pcall(0, LUA_MULTRET, 0) != LUA_OK) {
+      if (failed) *failed = true;
+      if (!disable_log) l.log_error_in_stack();
+      return T();
+    }
+    PEACALM_LUAW_ASSERT(l.gettop() >= sz);
+    if (l.gettop() <= sz &&
+        !std::is_same<std::decay_t<T>, std::tuple<>>::value &&
+        !std::is_same<std::decay_t<T>, void>::value) {
+      if (failed) *failed = true;
+      if (!disable_log) luaw::log_error("No return");
+      return T();
+    }
+    return luaw::convertor_for_return<std::decay_t<T>>::to(
+        l, sz + 1, disable_log, failed);
+  }
 
-    l.pushstring("__gc");
-    l.pushcfunction(__gc);
-    l.rawset(-3);
+  /**
+   * @brief Evaluate the compiled expression against a given environment table
+   * instead of the global table.
+   *
+   * Same as luaw::eval_with_env but without compiling. Each evaluation loads
+   * a fresh function from the bytecode dumped at the first time. It fails if
+   * the referenced function isn't made by compile or compile_fused and has
+   * upvalues other than _ENV.
+   *
+   * @param [in] env_idx Index of the environment table on stack.
+   */
+  template <typename T>
+  T eval_with_env(int   env_idx,
+                  bool  disable_log = false,
+                  bool* failed      = nullptr) const {
+    if (!valid()) {
+      if (failed) *failed = true;
+      if (!disable_log) luaw::log_error("compiled_expr refers to nothing");
+      return T();
+    }
+    fakeluaw           l(L_);
+    auto               _g    = l.make_guarder();
+    int                sz    = l.gettop();
+    const std::string* chunk = __env_chunk();
+    if (!chunk) {
+      if (failed) *failed = true;
+      if (!disable_log) {
+        luaw::log_error("compiled_expr can't be evaluated with an environment");
+      }
+      return T();
+    }
+    env_idx = l.abs_index(env_idx);
+    if (luaw::__load_bytecode_with_env(L_, *chunk, env_idx) != LUA_OK ||
+        (env_chunk_returns_ && l.pcall(0, 1, 0) != LUA_OK) ||
+        l.pcall(0, LUA_MULTRET, 0) != LUA_OK) {
+      if (failed) *failed = true;
+      if (!disable_log) l.log_error_in_stack();
+      return T();
+    }
+    PEACALM_LUAW_ASSERT(l.gettop() >= sz);
+    if (l.gettop() <= sz &&
+        !std::is_same<std::decay_t<T>, std::tuple<>>::value &&
+        !std::is_same<std::decay_t<T>, void>::value) {
+      if (failed) *failed = true;
+      if (!disable_log) luaw::log_error("No return");
+      return T();
+    }
+    return luaw::convertor_for_return<std::decay_t<T>>::to(
+        l, sz + 1, disable_log, failed);
+  }
 
-    l.setmetatable(-2);
+  /**
+   * @brief Evaluate the compiled expression and get all results in a vector.
+   *
+   * Each result is converted to T, mostly used with luaw::compile_fused.
+   *
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the operation is failed if this
+   * pointer is not nullptr. It's failed if any result failed to convert.
+   */
+  template <typename T>
+  std::vector<T> eval_all(bool disable_log = false,
+                          bool* failed     = nullptr) const {
+    std::vector<T> ret;
+    if (failed) *failed = false;
+    if (!valid()) {
+      if (failed) *failed = true;
+      if (!disable_log) luaw::log_error("compiled_expr refers to nothing");
+      return ret;
+    }
+    fakeluaw l(L_);
+    auto     _g = l.make_guarder();
+    int      sz = l.gettop();
+    l.rawgeti(LUA_REGISTRYINDEX, *ref_sptr_);
+    if (l.pcall(0, LUA_MULTRET, 0) != LUA_OK) {
+      if (failed) *failed = true;
+      if (!disable_log) l.log_error_in_stack();
+      return ret;
+    }
+    PEACALM_LUAW_ASSERT(l.gettop() >= sz);
+    ret.reserve(l.gettop() - sz);
+    for (int i = sz + 1; i <= l.gettop(); ++i) {
+      bool f = false;
+      ret.push_back(luaw::convertor_for_return<std::decay_t<T>>::to(
+          l, i, disable_log, &f));
+      if (f && failed) *failed = true;
+    }
+    return ret;
+  }
+};
 
-    return 1;
+inline luaw::compiled_expr luaw::__compile(const char* expr,
+                                           size_t      len,
+                                           const char* chunkname,
+                                           bool        disable_log,
+                                           bool*       failed) {
+  auto _g = make_guarder();
+  if (__loadbuffer(expr, len, chunkname) != LUA_OK) {
+    if (failed) *failed = true;
+    if (!disable_log) log_error_in_stack();
+    return compiled_expr();
   }
+  return compiled_expr(L_, -1);
+}
 
-  // function object with trivially destructor
-  template <typename F>
-  static std::
-      enable_if_t<std::is_trivially_destructible<std::decay_t<F>>::value, int>
-      push(luaw& l, F&& f) {
-    using SolidF = std::remove_reference_t<F>;
+inline luaw::compiled_expr luaw::compile(const char* expr,
+                                         bool        disable_log,
+                                         bool*       failed) {
+  PEACALM_LUAW_ASSERT(expr);
+  return __compile(expr, strlen(expr), expr, disable_log, failed);
+}
 
-    auto closure = [](lua_State* L) -> int {
-      auto callee =
-          static_cast<SolidF*>(lua_touserdata(L, lua_upvalueindex(1)));
-      PEACALM_LUAW_ASSERT(callee);
-      luaw l(L);
-      int  ret_num = callback(l, *callee, 1, std::is_void<Return>{});
-      l.clearL();
-      return ret_num;
-    };
+inline luaw::compiled_expr luaw::compile(const std::string& expr,
+                                         bool               disable_log,
+                                         bool*              failed) {
+  return __compile(
+      expr.data(), expr.size(), expr.c_str(), disable_log, failed);
+}
 
-    auto faddr = static_cast<SolidF*>(l.newuserdata(sizeof(f)));
-    new (faddr) SolidF(std::forward<F>(f));
+#if PEACALM_LUAW_SUPPORT_CPP17
+inline luaw::compiled_expr luaw::compile(std::string_view expr,
+                                         bool             disable_log,
+                                         bool*            failed) {
+  return __compile(expr.data(), expr.size(), nullptr, disable_log, failed);
+}
+#endif
 
-    l.pushcclosure(closure, 1);
+inline luaw::compiled_expr luaw::compile_fused(
+    const std::vector<std::string>& exprs,
+    bool                            disable_log,
+    bool*                           failed) {
+  auto _g = make_guarder();
+
+  // Load each expression alone first. Text like "return 1 end, function()
+  // return 2" is invalid alone but would be valid after fusion, making more
+  // functions than expressions and shifting the later results.
+  for (const auto& e : exprs) {
+    if (luaL_loadbufferx(L_, e.data(), e.size(), e.c_str(), "t") != LUA_OK) {
+      if (failed) *failed = true;
+      if (!disable_log) log_error_in_stack();
+      return compiled_expr();
+    }
+    pop();
+  }
 
-    return 1;
+  // Each expression becomes a function in a table, the fused chunk returns a
+  // function which calls them all and returns one result for each.
+  std::string chunk = "local __luaw_fused = {\n";
+  for (const auto& e : exprs) {
+    chunk += "function() ";
+    chunk += e;
+    chunk += "\nend,\n";
+  }
+  chunk += "}\nreturn function() return ";
+  for (size_t i = 1; i <= exprs.size(); ++i) {
+    if (i > 1) chunk += ", ";
+    chunk += "(__luaw_fused[";
+    chunk += std::to_string(i);
+    chunk += "]())";
+  }
+  chunk += " end";
+
+  if (luaL_loadbuffer(L_, chunk.data(), chunk.size(), "=fused") != LUA_OK) {
+    // Valid alone but not in a function, e.g. using "..."
+    if (failed) *failed = true;
+    if (!disable_log) log_error_in_stack();
+    return compiled_expr();
+  }
+  // The main chunk is kept for eval_with_env to make fresh functions.
+  std::shared_ptr<const std::string> main_chunk = __dump_function(L_);
+  if (pcall(0, 1, 0) != LUA_OK) {
+    if (failed) *failed = true;
+    if (!disable_log) log_error_in_stack();
+    return compiled_expr();
+  }
+  compiled_expr ret(L_, -1);
+  ret.env_chunk_         = std::move(main_chunk);
+  ret.env_chunk_returns_ = true;
+  return ret;
+}
+
+//////////////////// native_expr impl //////////////////////////////////////////
+
+class luaw::native_expr {
+  using value = luaw_detail::native::value;
+
+  compiled_expr                                    lua_expr_;
+  std::shared_ptr<const luaw_detail::native::tape> tape_;
+  std::vector<value>                               bound_values_;
+  std::vector<bool>                                bound_;
+  mutable std::vector<value>                       stack_;
+
+  // Get a global variable into "v", "ok" is whether it's convertible.
+  // _G's __index may raise errors, e.g. a provider of custom_luaw failed, so
+  // it's called by a protected call if raw access gets nil. If "kept" is not
+  // null, a value got by __index is left on top of stack and *kept is set true.
+  // Return LUA_OK, or an error code with the error message on top of stack.
+  static int __fetch_global(lua_State*         L,
+                            const std::string& name,
+                            value&             v,
+                            bool&              ok,
+                            bool*              kept = nullptr) {
+    lua_pushglobaltable(L);
+    lua_pushlstring(L, name.data(), name.size());
+    if (lua_rawget(L, -2) == LUA_TNIL && lua_getmetatable(L, -2)) {
+      lua_pop(L, 3);  // metatable, nil, _G
+      lua_pushcfunction(L, [](lua_State* L) -> int {
+        lua_pushglobaltable(L);
+        lua_pushvalue(L, 1);
+        lua_gettable(L, -2);
+        return 1;
+      });
+      lua_pushlstring(L, name.data(), name.size());
+      int retcode = lua_pcall(L, 1, 1, 0);
+      if (retcode != LUA_OK) return retcode;
+      if (kept) {
+        ok    = v.from_lua(L, -1);
+        *kept = true;
+        return LUA_OK;
+      }
+    } else {
+      lua_remove(L, -2);  // _G
+    }
+    ok = v.from_lua(L, -1);
+    lua_pop(L, 1);
+    return LUA_OK;
+  }
+
+  // Get the global variable of a slot for running the tape. A value got by
+  // __index is kept on stack after its slot number, to be handed to Lua by
+  // __set_kept_globals if falling back, so it's not got twice (e.g. the
+  // provider of custom_luaw is not called twice).
+  // Set "error" with the error message on top of stack if failed.
+  bool __fetch_slot(lua_State* L, int slot, value& v, bool& error) const {
+    const bool keep = lua_checkstack(L, 2);
+    if (keep) lua_pushinteger(L, slot);
+    bool ok = false, kept = false;
+    if (__fetch_global(L, tape_->names[slot], v, ok, keep ? &kept : nullptr) !=
+        LUA_OK) {
+      error = true;
+      return false;
+    }
+    if (keep && !kept) lua_pop(L, 1);
+    return ok;
+  }
+
+  // Set the values kept on stack above "base" by __fetch_slot to global
+  // variables by raw access, or reset them to nil if not "set". They were nil
+  // by raw access since got by __index.
+  void __set_kept_globals(int base, bool set) const {
+    lua_State* L   = lua_expr_.L();
+    const int  top = lua_gettop(L);
+    if (top <= base) return;
+    lua_pushglobaltable(L);
+    for (int i = base + 1; i + 1 <= top; i += 2) {
+      lua_pushstring(L, tape_->names[lua_tointeger(L, i)].c_str());
+      if (set) {
+        lua_pushvalue(L, i + 1);
+      } else {
+        lua_pushnil(L);
+      }
+      lua_rawset(L, -3);
+    }
+    lua_pop(L, 1);
+  }
+
+  // Whether the tape could run now: IF it uses is still the extended function.
+  // Checked by raw access to not trigger _G's __index.
+  bool __runnable() const {
+    if (!is_native()) return false;
+    if (!tape_->uses_if) return true;
+    lua_State* L = lua_expr_.L();
+    lua_pushglobaltable(L);
+    lua_pushliteral(L, "IF");
+    lua_rawget(L, -2);
+    const bool ret = lua_tocfunction(L, -1) == luaexf::IF;
+    lua_pop(L, 2);
+    return ret;
   }
 
-  // function pointer
-  static int push(luaw& l, Return (*f)(Args...)) {
-    auto closure = [](lua_State* L) -> int {
-      auto callee = reinterpret_cast<Return (*)(Args...)>(
-          lua_touserdata(L, lua_upvalueindex(1)));
-      PEACALM_LUAW_ASSERT(callee);
-      luaw l(L);
-      int  ret_num = callback(l, callee, 1, std::is_void<Return>{});
-      l.clearL();
-      return ret_num;
+  // Run the tape natively. Return 1 if done, 0 if should fall back to Lua, or
+  // -1 if failed to get a variable, with the error message on top of stack.
+  int __run(value& result) const {
+    lua_State* L     = lua_expr_.L();
+    bool       error = false;
+    auto fetch = [this, L, &error](int slot, value& v) {
+      if (bound_[slot]) {
+        v = bound_values_[slot];
+        return true;
+      }
+      return __fetch_slot(L, slot, v, error);
     };
-    l.pushlightuserdata(reinterpret_cast<void*>(f));
-    l.pushcclosure(closure, 1);
-    return 1;
+    if (tape_->run(fetch, stack_.data(), result)) return 1;
+    return error ? -1 : 0;
+  }
+
+  // Set bound values to global variables by raw access.
+  void __set_bound_globals() const {
+    if (!tape_) return;
+    lua_State* L = lua_expr_.L();
+    lua_pushglobaltable(L);
+    for (size_t i = 0; i < bound_.size(); ++i) {
+      if (!bound_[i]) continue;
+      lua_pushstring(L, tape_->names[i].c_str());
+      bound_values_[i].push(L);
+      lua_rawset(L, -3);
+    }
+    lua_pop(L, 1);
   }
 
-private:
-  template <typename>
-  struct wrap {};
+public:
+  native_expr() {}
+
+  native_expr(compiled_expr                                    lua_expr,
+              std::shared_ptr<const luaw_detail::native::tape> tape)
+      : lua_expr_(std::move(lua_expr)), tape_(std::move(tape)) {
+    if (tape_) {
+      bound_values_.resize(tape_->names.size());
+      bound_.resize(tape_->names.size(), false);
+      stack_.resize(tape_->max_stack);
+    }
+  }
 
-  template <typename Callee, typename FirstArg, typename... RestArgs>
-  struct bind {
-    Callee   callee;
-    FirstArg first_arg;
-    bind(Callee&& c, FirstArg&& f)
-        : callee(std::forward<Callee>(c)),
-          first_arg(std::forward<FirstArg>(f)) {}
+  /// Get internal lua_State.
+  lua_State* L() const { return lua_expr_.L(); }
 
-    Return operator()(RestArgs&&... args) {
-      return callee(std::move(first_arg), std::forward<RestArgs>(args)...);
-    }
-  };
+  /// Whether the expression is compiled successfully.
+  bool valid() const { return lua_expr_.valid(); }
 
-  // For type Return is void.
-  template <typename Callee>
-  static int callback(luaw& l, Callee&& c, int start_idx, std::true_type) {
-    do_call(l, std::forward<Callee>(c), start_idx, 1, wrap<Args>{}...);
-    return 0;
+  /// Whether the expression could be evaluated natively.
+  bool is_native() const { return valid() && tape_ != nullptr; }
+
+  /// The compiled Lua function, used when can't evaluate natively.
+  const compiled_expr& lua_expr() const { return lua_expr_; }
+
+  /// Number of variable slots. Always 0 if not native.
+  int slot_count() const {
+    return tape_ ? static_cast<int>(tape_->names.size()) : 0;
   }
 
-  // For type Return is not void. Return the number of result.
-  template <typename Callee>
-  static int callback(luaw& l, Callee&& c, int start_idx, std::false_type) {
-    return luaw::pusher_for_return<std::decay_t<Return>>::push(
-        l, do_call(l, std::forward<Callee>(c), start_idx, 1, wrap<Args>{}...));
+  /// Get the variable name of a slot.
+  const std::string& slot_name(int slot) const {
+    PEACALM_LUAW_ASSERT(slot >= 0 && slot < slot_count());
+    return tape_->names[slot];
   }
 
-  template <typename Callee, typename FirstArg, typename... RestArgs>
-  static Return do_call(luaw&          l,
-                        Callee&&       c,
-                        int            i,
-                        int            counter,
-                        wrap<FirstArg> farg,
-                        wrap<RestArgs>... args) {
-    bool failed, exists;
-    auto param = l.to<std::decay_t<FirstArg>>(i, false, &failed, &exists);
-    if (failed) {
-      luaL_error(l.L(), "The %dth argument conversion failed", counter);
-      // Never runs here.
-      PEACALM_LUAW_ASSERT(false);
-      // Do not return Return() to enable functions with reference results.
-      // return Return();
+  /// Get the slot of a variable by name, or -1 if not found.
+  int slot(const std::string& name) const {
+    for (int i = 0; i < slot_count(); ++i) {
+      if (tape_->names[i] == name) return i;
     }
-    bind<Callee, FirstArg, RestArgs...> b(std::forward<Callee>(c),
-                                          std::move(param));
-    return do_call(l, std::move(b), i + 1, counter + 1, args...);
+    return -1;
   }
 
-  template <typename Callee>
-  static Return do_call(luaw& l, Callee&& c, int i, int counter) {
-    return c();
+  /**
+   * @brief Bind a value to a variable slot, then the variable's value is got
+   * from the slot directly instead of global variables.
+   *
+   * @param [in] slot The variable slot, should be in [0, slot_count()).
+   * @param [in] v A boolean, integer or floating point number.
+   */
+  template <typename T>
+  std::enable_if_t<std::is_arithmetic<T>::value> bind(int slot, T v) {
+    PEACALM_LUAW_ASSERT(slot >= 0 && slot < slot_count());
+    bound_values_[slot] = __make_value(v);
+    bound_[slot]        = true;
   }
-};
 
-// Variadic function, not support!
-template <typename Return, typename... Args>
-struct luaw::pusher<Return (*)(Args..., ...)> {
-  // Let compile fail
-  template <typename F>
-  static int push(luaw& l, F&& f) = delete;
-};
+  /// Bind a value by variable name. Return false if no such variable.
+  template <typename T>
+  std::enable_if_t<std::is_arithmetic<T>::value, bool> bind(
+      const std::string& name,
+      T                  v) {
+    int i = slot(name);
+    if (i < 0) return false;
+    bind(i, v);
+    return true;
+  }
 
-#if PEACALM_LUAW_SUPPORT_CPP17
+  /// Unbind a variable slot, then its value is got from global variables.
+  void unbind(int slot) {
+    PEACALM_LUAW_ASSERT(slot >= 0 && slot < slot_count());
+    bound_[slot] = false;
+  }
 
-// Function with noexcept-specification after C++17
-template <typename Return, typename... Args>
-struct luaw::pusher<Return (*)(Args...) noexcept> {
-  using Basic = luaw::pusher<Return (*)(Args...)>;
+  /// Unbind all variable slots.
+  void unbind_all() { std::fill(bound_.begin(), bound_.end(), false); }
 
-  template <typename F>
-  static int push(luaw& l, F&& f) {
-    return Basic::push(l, std::forward<F>(f));
+  /**
+   * @brief Evaluate the expression and get result in C++ type.
+   *
+   * Evaluate natively if possible, otherwise, or if it would raise an error
+   * or meet a variable whose value is not nil, boolean or number, fall back
+   * to evaluate by Lua, then bound values are set to global variables first.
+   * Values already got by _G's __index (e.g. from the provider of
+   * custom_luaw) are handed to Lua as global variables during the fallback
+   * instead of being got again. If the extended function IF is overwritten
+   * after compilation, expressions using it are evaluated by Lua.
+   *
+   * @tparam T The result type user expected.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the operation is failed if this
+   * pointer is not nullptr.
+   * @return The expression's result in type T.
+   */
+  template <typename T>
+  T eval(bool disable_log = false, bool* failed = nullptr) const {
+    if (__runnable()) {
+      fakeluaw  l(L());
+      auto      _g   = l.make_guarder();
+      const int base = l.gettop();
+      value     v;
+      int       r = __run(v);
+      if (r > 0) {
+        v.push(l.L());
+        return luaw::convertor_for_return<std::decay_t<T>>::to(
+            l, -1, disable_log, failed);
+      }
+      if (r < 0) {
+        if (failed) *failed = true;
+        if (!disable_log) l.log_error_in_stack();
+        return T();
+      }
+      __set_bound_globals();
+      __set_kept_globals(base, true);
+      T ret = lua_expr_.template eval<T>(disable_log, failed);
+      __set_kept_globals(base, false);
+      return ret;
+    }
+    return lua_expr_.template eval<T>(disable_log, failed);
   }
 
-  // Explicitly call C function pointer version of push
-  static int push(luaw& l, Return (*f)(Args...) noexcept) {
-    return Basic::push(l, static_cast<Return (*)(Args...)>(f));
+  /**
+   * @brief Evaluate the expression over many rows of variables given by
+   * columns, and get results as doubles.
+   *
+   * Each column is named by a variable, variables not given by columns get
+   * values from bound slots or global variables like eval.
+   * If all columns are doubles, the expression is evaluated column by column
+   * with SIMD kernels (AVX2 if compiled with it), which gets exactly the same
+   * results as eval<double> for each row. Otherwise, or if intermediate
+   * values could be of different types in different rows, it's evaluated row
+   * by row, natively if possible, otherwise by Lua as eval_batch does.
+   *
+   * @param [in] columns Input values of variables in columns.
+   * @param [out] out Results of all rows, a failed row gets 0. Its size should
+   * be at least the number of rows.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @param [out] failed Will be set whether the operation is failed if this
+   * pointer is not nullptr. It's failed if any row failed.
+   * @return Whether evaluated column by column.
+   */
+  bool eval_columns(const std::vector<batch_column>& columns,
+                    double*                          out,
+                    bool                             disable_log = false,
+                    bool*                            failed = nullptr) const {
+    if (failed) *failed = false;
+    if (!valid()) {
+      if (failed) *failed = true;
+      if (!disable_log) luaw::log_error("native_expr refers to nothing");
+      return false;
+    }
+    const size_t rows = columns.empty() ? 0 : columns.front().size();
+    for (const auto& c : columns) {
+      if (c.size() != rows) {
+        if (failed) *failed = true;
+        if (!disable_log) luaw::log_error("Columns have different sizes");
+        return false;
+      }
+    }
+    fakeluaw l(L());
+    auto     _g = l.make_guarder();
+    int      r  = __eval_columns_simd(columns, out);
+    if (r > 0) return true;
+    if (r < 0) {
+      std::fill(out, out + rows, 0.0);
+      if (failed) *failed = true;
+      if (!disable_log) l.log_error_in_stack();
+      return false;
+    }
+    __eval_columns_rows(columns, out, disable_log, failed);
+    return false;
   }
-};
 
-// Variadic function, not support
-template <typename Return, typename... Args>
-struct luaw::pusher<Return (*)(Args..., ...) noexcept> {
-  // Let compile fail
-  template <typename F>
-  static int push(luaw& l, F&& f) = delete;
-};
-
-#endif
+  /// Same as above but return results in a vector.
+  std::vector<double> eval_columns(const std::vector<batch_column>& columns,
+                                   bool  disable_log = false,
+                                   bool* failed      = nullptr) const {
+    std::vector<double> ret(columns.empty() ? 0 : columns.front().size());
+    eval_columns(columns, ret.data(), disable_log, failed);
+    return ret;
+  }
 
-// bool
-template <>
-struct luaw::pusher<bool> {
-  static const size_t size = 1;
+private:
+  // Index of the column for each slot, or -1. The last one wins if
+  // duplicated, like eval_batch.
+  std::vector<int> __slot_columns(
+      const std::vector<batch_column>& columns) const {
+    std::vector<int> ret(slot_count(), -1);
+    for (size_t i = 0; i < columns.size(); ++i) {
+      int s = slot(columns[i].name());
+      if (s >= 0) ret[s] = static_cast<int>(i);
+    }
+    return ret;
+  }
 
-  static int push(luaw& l, bool v) {
-    lua_pushboolean(l.L(), v);
+  // Return 1 if done, 0 if can't evaluate column by column, or -1 if failed
+  // to get a variable, with the error message on top of stack.
+  int __eval_columns_simd(const std::vector<batch_column>& columns,
+                          double*                          out) const {
+    if (!__runnable()) return 0;
+    const std::vector<int> slot_columns = __slot_columns(columns);
+    std::vector<value>     slot_values(slot_count());
+    lua_State*             L = lua_expr_.L();
+    for (int i = 0; i < slot_count(); ++i) {
+      const int c = slot_columns[i];
+      if (c >= 0) {
+        if (columns[c].kind() != batch_column::number) return 0;
+      } else if (bound_[i]) {
+        slot_values[i] = bound_values_[i];
+      } else {
+        bool ok = false;
+        if (__fetch_global(L, tape_->names[i], slot_values[i], ok) != LUA_OK) {
+          return -1;
+        }
+        if (!ok) return 0;
+      }
+    }
+    luaw_detail::native::columnar prog(*tape_, slot_columns, slot_values);
+    if (!prog.build()) return 0;
+    std::vector<const double*> inputs;
+    inputs.reserve(columns.size());
+    for (const auto& c : columns) {
+      inputs.push_back(static_cast<const double*>(c.data()));
+    }
+    prog.run(inputs.data(), columns.empty() ? 0 : columns[0].size(), out);
     return 1;
   }
-};
 
-// integer types
-template <typename IntType>
-struct luaw::pusher<IntType,
-                    std::enable_if_t<std::is_integral<IntType>::value>> {
-  static const size_t size = 1;
+  void __eval_columns_rows(const std::vector<batch_column>& columns,
+                           double*                          out,
+                           bool                             disable_log,
+                           bool*                            failed) const {
+    lua_State*             L = lua_expr_.L();
+    fakeluaw               l(L);
+    auto                   _g           = l.make_guarder();
+    const std::vector<int> slot_columns = __slot_columns(columns);
+    const size_t rows     = columns.empty() ? 0 : columns.front().size();
+    const bool   runnable = __runnable();
+    const int    base     = l.gettop();
+    for (size_t r = 0; r < rows; ++r) {
+      bool  row_failed = false;
+      bool  error      = false;
+      value v;
+      auto  fetch = [&](int slot, value& sv) {
+        const int c = slot_columns[slot];
+        if (c < 0) {
+          if (bound_[slot]) {
+            sv = bound_values_[slot];
+            return true;
+          }
+          return __fetch_slot(L, slot, sv, error);
+        }
+        columns[c].push(L, r);
+        const bool ok = sv.from_lua(L, -1);
+        lua_pop(L, 1);
+        return ok;
+      };
+      if (runnable && tape_->run(fetch, stack_.data(), v)) {
+        v.push(L);
+        out[r] = l.to_double(-1, 0, disable_log, &row_failed);
+        l.pop();
+      } else if (error) {  // error message on top of stack
+        out[r]     = 0;
+        row_failed = true;
+        if (!disable_log) l.log_error_in_stack();
+        l.pop();
+      } else {
+        lua_pushglobaltable(L);
+        for (const auto& c : columns) {
+          lua_pushstring(L, c.name().c_str());
+          c.push(L, r);
+          lua_rawset(L, -3);
+        }
+        lua_pop(L, 1);
+        __set_bound_globals();
+        __set_kept_globals(base, true);
+        out[r] = lua_expr_.template eval<double>(disable_log, &row_failed);
+        __set_kept_globals(base, false);
+      }
+      lua_settop(L, base);
+      if (row_failed && failed) *failed = true;
+    }
+  }
 
-  static int push(luaw& l, IntType v) {
-    lua_pushinteger(l.L(), v);
-    return 1;
+private:
+  template <typename T>
+  static std::enable_if_t<std::is_same<T, bool>::value, value> __make_value(
+      T v) {
+    return value::make_bool(v);
+  }
+  template <typename T>
+  static std::enable_if_t<std::is_integral<T>::value &&
+                              !std::is_same<T, bool>::value,
+                          value>
+  __make_value(T v) {
+    return value::make_integer(static_cast<lua_integer_t>(v));
+  }
+  template <typename T>
+  static std::enable_if_t<std::is_floating_point<T>::value, value>
+  __make_value(T v) {
+    return value::make_number(static_cast<lua_number_t>(v));
   }
 };
 
-// float number types
-template <typename FloatType>
-struct luaw::pusher<
-    FloatType,
-    std::enable_if_t<std::is_floating_point<FloatType>::value>> {
-  static const size_t size = 1;
+inline luaw::native_expr luaw::compile_native(const char* expr,
+                                              bool        disable_log,
+                                              bool*       failed) {
+  PEACALM_LUAW_ASSERT(expr);
+  compiled_expr e = compile(expr, disable_log, failed);
+  if (!e.valid()) return native_expr();
+  return native_expr(
+      std::move(e),
+      luaw_detail::native::parser(L_, expr, strlen(expr)).parse());
+}
 
-  static int push(luaw& l, FloatType v) {
-    lua_pushnumber(l.L(), v);
-    return 1;
-  }
-};
+inline luaw::native_expr luaw::compile_native(const std::string& expr,
+                                              bool               disable_log,
+                                              bool*              failed) {
+  return compile_native(expr.c_str(), disable_log, failed);
+}
 
-// std::string
+// to bool
 template <>
-struct luaw::pusher<std::string> {
-  static const size_t size = 1;
+struct luaw::convertor<bool> {
+  static bool to(luaw& l,
+                 int   idx         = -1,
+                 bool  disable_log = false,
+                 bool* failed      = nullptr,
+                 bool* exists      = nullptr) {
+    return l.to_bool(idx, bool{}, disable_log, failed, exists);
+  }
+};
 
-  static int push(luaw& l, const std::string& v) {
-    lua_pushstring(l.L(), v.c_str());
-    return 1;
+// to integers
+template <typename T>
+struct luaw::convertor<T, std::enable_if_t<std::is_integral<T>::value>> {
+  static T to(luaw& l,
+              int   idx         = -1,
+              bool  disable_log = false,
+              bool* failed      = nullptr,
+              bool* exists      = nullptr) {
+    auto ret = l.to_llong(idx, 0, disable_log, failed, exists);
+    return static_cast<T>(ret);
   }
 };
 
-// const char*
+// to float numbers
 template <>
-struct luaw::pusher<const char*> {
-  static const size_t size = 1;
-
-  static int push(luaw& l, const char* v) {
-    // lua_pushstring will push nil if v is NULL, we forbid this
-    PEACALM_LUAW_ASSERT(v);
-    lua_pushstring(l.L(), v);
-    return 1;
+struct luaw::convertor<float> {
+  static float to(luaw& l,
+                  int   idx         = -1,
+                  bool  disable_log = false,
+                  bool* failed      = nullptr,
+                  bool* exists      = nullptr) {
+    return l.to_float(idx, float{}, disable_log, failed, exists);
   }
 };
-
-// nullptr
 template <>
-struct luaw::pusher<std::nullptr_t> {
-  static const size_t size = 1;
+struct luaw::convertor<double> {
+  static double to(luaw& l,
+                   int   idx         = -1,
+                   bool  disable_log = false,
+                   bool* failed      = nullptr,
+                   bool* exists      = nullptr) {
+    return l.to_double(idx, double{}, disable_log, failed, exists);
+  }
+};
+template <>
+struct luaw::convertor<long double> {
+  static long double to(luaw& l,
+                        int   idx         = -1,
+                        bool  disable_log = false,
+                        bool* failed      = nullptr,
+                        bool* exists      = nullptr) {
+    return l.to_ldouble(idx, (long double){}, disable_log, failed, exists);
+  }
+};
 
-  static int push(luaw& l, std::nullptr_t) {
-    l.pushnil();
-    return 1;
+// to std::string, safe implementation
+// To avoid implicitly modifying number to string in stack, which may cause
+// panic while doing lua_next, we copy the value first before call lua_tostring.
+template <>
+struct luaw::convertor<std::string> {
+  static std::string to(luaw& l,
+                        int   idx         = -1,
+                        bool  disable_log = false,
+                        bool* failed      = nullptr,
+                        bool* exists      = nullptr) {
+    if (exists) *exists = !l.isnoneornil(idx);
+    if (l.isstring(idx)) {
+      l.pushvalue(idx);  // make a copy, so, it's safe
+      std::string ret = lua_tostring(l.L(), -1);
+      l.pop();
+      if (failed) *failed = false;
+      return ret;
+    }
+    if (l.isnoneornil(idx)) {
+      if (failed) *failed = false;
+      return "";
+    }
+    if (failed) *failed = true;
+    if (!disable_log) l.log_type_convert_error(idx, "string");
+    return "";
   }
 };
 
-// void
+// to luaw::scoped_string_view
 template <>
-struct luaw::pusher<void> {
-  static const size_t size = 0;
-  // nothing to push
+struct luaw::convertor<luaw::scoped_string_view> {
+  static luaw::scoped_string_view to(luaw& l,
+                                     int   idx         = -1,
+                                     bool  disable_log = false,
+                                     bool* failed      = nullptr,
+                                     bool* exists      = nullptr) {
+    return l.to_string_view(idx, "", disable_log, failed, exists);
+  }
 };
 
-// std::pair
+// to std::pair by (t[1],t[2]) where t should be a table
 template <typename T, typename U>
-struct luaw::pusher<std::pair<T, U>> {
-  static const size_t size = 1;
-
-  static int push(luaw& l, const std::pair<T, U>& p) {
-    l.newtable();
-    l.push(p.first);
-    l.rawseti(-2, 1);
-    l.push(p.second);
-    l.rawseti(-2, 2);
-    return 1;
+struct luaw::convertor<std::pair<T, U>> {
+  using result_t = std::pair<T, U>;
+  static result_t to(luaw& l,
+                     int   idx         = -1,
+                     bool  disable_log = false,
+                     bool* failed      = nullptr,
+                     bool* exists      = nullptr) {
+    if (exists) *exists = !l.isnoneornil(idx);
+    if (l.isnoneornil(idx)) {
+      if (failed) *failed = false;
+      return result_t{};
+    }
+    if (!l.istable(idx)) {
+      if (failed) *failed = true;
+      if (!disable_log) l.log_type_convert_error(idx, "pair");
+      return result_t{};
+    }
+    // Allow elements do not exist, {} means a pair with initial values
+    bool ffailed, sfailed;
+    l.geti(idx, 1);
+    auto first = luaw::convertor<T>::to(l, -1, disable_log, &ffailed);
+    l.pop();
+    l.geti(idx, 2);
+    auto second = luaw::convertor<U>::to(l, -1, disable_log, &sfailed);
+    l.pop();
+    if (failed) *failed = (ffailed || sfailed);
+    return result_t{first, second};
   }
 };
 
 namespace luaw_detail {
 
-// Implementation for all list like containers
-template <typename Container>
-static int __push_list(luaw& l, const Container& v) {
-  l.newtable();
-  int cnt = 0;
-  for (auto b = v.begin(), e = v.end(); b != e; ++b) {
-    l.push(*b);
-    l.rawseti(-2, ++cnt);
+template <typename T>
+T __to_list(luaw&       l,
+            int         idx         = -1,
+            bool        disable_log = false,
+            bool*       failed      = nullptr,
+            bool*       exists      = nullptr,
+            const char* tname       = "list") {
+  using value_type = typename T::value_type;
+  if (exists) *exists = !l.isnoneornil(idx);
+  if (l.isnoneornil(idx)) {
+    if (failed) *failed = false;
+    return T{};
   }
-  return 1;
+  if (!l.istable(idx)) {
+    if (failed) *failed = true;
+    if (!disable_log) l.log_type_convert_error(idx, tname);
+    return T{};
+  }
+  T ret;
+  if (failed) *failed = false;
+  int sz = luaL_len(l.L(), idx);
+  for (int i = 1; i <= sz; ++i) {
+    l.geti(idx, i);
+    bool       subfailed, subexists;
+    value_type subret =
+        l.to<value_type>(-1, disable_log, &subfailed, &subexists);
+    // Only add elements exist and conversion succeeded
+    if (!subfailed && subexists) ret.push_back(std::move(subret));
+    if (subfailed && failed) *failed = true;
+    l.pop();
+  }
+  return ret;
 }
 
-// Implementation for all set like containers
-// Make a Key-True table in Lua to represent set
-template <typename Container>
-static int __push_set(luaw& l, const Container& v) {
-  l.newtable();
-  for (auto b = v.begin(), e = v.end(); b != e; ++b) {
-    l.push(*b);
-    lua_pushboolean(l.L(), 1);
-    l.rawset(-3);
+// Convert all keys of a Lua table into a C++ set
+template <typename T>
+T __to_set(luaw&       l,
+           int         idx         = -1,
+           bool        disable_log = false,
+           bool*       failed      = nullptr,
+           bool*       exists      = nullptr,
+           const char* tname       = "set") {
+  static_assert(!std::is_same<typename T::key_type, const char*>::value,
+                "const char* as key type of set is forbidden");
+
+  if (exists) *exists = !l.isnoneornil(idx);
+  if (l.isnoneornil(idx)) {
+    if (failed) *failed = false;
+    return T{};
   }
-  return 1;
+  if (!l.istable(idx)) {
+    if (failed) *failed = true;
+    if (!disable_log) l.log_type_convert_error(idx, tname);
+    return T{};
+  }
+  T ret;
+  if (failed) *failed = false;
+  int absidx = l.abs_index(idx);
+  l.pushnil();
+  while (lua_next(l.L(), absidx) != 0) {
+    bool kfailed, kexists;
+    auto key = l.to<typename T::key_type>(-2, disable_log, &kfailed, &kexists);
+    if (!kfailed && kexists) { ret.insert(std::move(key)); }
+    if (kfailed && failed) *failed = true;
+    l.pop();
+  }
+  return ret;
 }
 
-// Implementation for all map like containers
-template <typename Container>
-static int __push_map(luaw& l, const Container& v) {
-  l.newtable();
-  for (auto b = v.begin(), e = v.end(); b != e; ++b) {
-    l.push(b->first);
-    l.push(b->second);
-    l.rawset(-3);
+template <typename T>
+T __to_map(luaw&       l,
+           int         idx         = -1,
+           bool        disable_log = false,
+           bool*       failed      = nullptr,
+           bool*       exists      = nullptr,
+           const char* tname       = "map") {
+  static_assert(!std::is_same<typename T::key_type, const char*>::value,
+                "const char* as key type of map is forbidden");
+
+  if (exists) *exists = !l.isnoneornil(idx);
+  if (l.isnoneornil(idx)) {
+    if (failed) *failed = false;
+    return T{};
   }
-  return 1;
+  if (!l.istable(idx)) {
+    if (failed) *failed = true;
+    if (!disable_log) l.log_type_convert_error(idx, tname);
+    return T{};
+  }
+  T ret;
+  if (failed) *failed = false;
+  int absidx = l.abs_index(idx);
+  l.pushnil();
+  while (lua_next(l.L(), absidx) != 0) {
+    bool kfailed, kexists, vfailed, vexists;
+    auto key = l.to<typename T::key_type>(-2, disable_log, &kfailed, &kexists);
+    if (!kfailed && kexists) {
+      auto val =
+          l.to<typename T::mapped_type>(-1, disable_log, &vfailed, &vexists);
+      if (!vfailed && vexists) ret.insert({std::move(key), std::move(val)});
+    }
+    if ((kfailed || vfailed) && failed) *failed = true;
+    l.pop();
+  }
+  return ret;
 }
 
 }  // namespace luaw_detail
 
-// std::array
-template <typename T, std::size_t N>
-struct luaw::pusher<std::array<T, N>> {
-  static const size_t size = 1;
-
-  static int push(luaw& l, const std::array<T, N>& v) {
-    return luaw_detail::__push_list(l, v);
-  }
-};
-
-// std::vector
+// to std::vector
+// NOTICE: Discard nil in list! e.g. {1,2,nil,4} -> vector<int>{1,2,4}
 template <typename T, typename Allocator>
-struct luaw::pusher<std::vector<T, Allocator>> {
-  static const size_t size = 1;
-
-  static int push(luaw& l, const std::vector<T, Allocator>& v) {
-    return luaw_detail::__push_list(l, v);
+struct luaw::convertor<std::vector<T, Allocator>> {
+  using result_t = std::vector<T, Allocator>;
+  static result_t to(luaw& l,
+                     int   idx         = -1,
+                     bool  disable_log = false,
+                     bool* failed      = nullptr,
+                     bool* exists      = nullptr) {
+    return luaw_detail::__to_list<result_t>(
+        l, idx, disable_log, failed, exists, "vector");
   }
 };
 
-// std::deque
+// to std::deque
 template <typename T, typename Allocator>
-struct luaw::pusher<std::deque<T, Allocator>> {
-  static const size_t size = 1;
-
-  static int push(luaw& l, const std::deque<T, Allocator>& v) {
-    return luaw_detail::__push_list(l, v);
+struct luaw::convertor<std::deque<T, Allocator>> {
+  using result_t = std::deque<T, Allocator>;
+  static result_t to(luaw& l,
+                     int   idx         = -1,
+                     bool  disable_log = false,
+                     bool* failed      = nullptr,
+                     bool* exists      = nullptr) {
+    return luaw_detail::__to_list<result_t>(
+        l, idx, disable_log, failed, exists, "deque");
   }
 };
 
-// std::forward_list
+// to std::list
 template <typename T, typename Allocator>
-struct luaw::pusher<std::forward_list<T, Allocator>> {
-  static const size_t size = 1;
-
-  static int push(luaw& l, const std::forward_list<T, Allocator>& v) {
-    return luaw_detail::__push_list(l, v);
+struct luaw::convertor<std::list<T, Allocator>> {
+  using result_t = std::list<T, Allocator>;
+  static result_t to(luaw& l,
+                     int   idx         = -1,
+                     bool  disable_log = false,
+                     bool* failed      = nullptr,
+                     bool* exists      = nullptr) {
+    return luaw_detail::__to_list<result_t>(
+        l, idx, disable_log, failed, exists, "list");
   }
 };
 
-// std::list
+// to std::forward_list
 template <typename T, typename Allocator>
-struct luaw::pusher<std::list<T, Allocator>> {
-  static const size_t size = 1;
-
-  static int push(luaw& l, const std::list<T, Allocator>& v) {
-    return luaw_detail::__push_list(l, v);
+struct luaw::convertor<std::forward_list<T, Allocator>> {
+  using result_t = std::forward_list<T, Allocator>;
+  static result_t to(luaw& l,
+                     int   idx         = -1,
+                     bool  disable_log = false,
+                     bool* failed      = nullptr,
+                     bool* exists      = nullptr) {
+    auto t = luaw_detail::__to_list<std::vector<T>>(
+        l, idx, disable_log, failed, exists, "vector");
+    return result_t(t.begin(), t.end());
   }
 };
 
-// std::set
+// to std::set
 template <typename Key, typename Compare, typename Allocator>
-struct luaw::pusher<std::set<Key, Compare, Allocator>> {
-  static const size_t size = 1;
-
-  static int push(luaw& l, const std::set<Key, Compare, Allocator>& v) {
-    return luaw_detail::__push_set(l, v);
+struct luaw::convertor<std::set<Key, Compare, Allocator>> {
+  using result_t = std::set<Key, Compare, Allocator>;
+  static result_t to(luaw& l,
+                     int   idx         = -1,
+                     bool  disable_log = false,
+                     bool* failed      = nullptr,
+                     bool* exists      = nullptr) {
+    return luaw_detail::__to_set<result_t>(
+        l, idx, disable_log, failed, exists, "set");
   }
 };
 
-// std::unordered_set
+// to std::unordered_set
 template <typename Key, typename Hash, typename KeyEqual, typename Allocator>
-struct luaw::pusher<std::unordered_set<Key, Hash, KeyEqual, Allocator>> {
-  static const size_t size = 1;
-
-  static int push(luaw&                                                     l,
-                  const std::unordered_set<Key, Hash, KeyEqual, Allocator>& v) {
-    return luaw_detail::__push_set(l, v);
+struct luaw::convertor<std::unordered_set<Key, Hash, KeyEqual, Allocator>> {
+  using result_t = std::unordered_set<Key, Hash, KeyEqual, Allocator>;
+  static result_t to(luaw& l,
+                     int   idx         = -1,
+                     bool  disable_log = false,
+                     bool* failed      = nullptr,
+                     bool* exists      = nullptr) {
+    return luaw_detail::__to_set<result_t>(
+        l, idx, disable_log, failed, exists, "unordered_set");
   }
 };
 
-// std::map
+// to std::map
 template <typename Key, typename Compare, typename Allocator>
-struct luaw::pusher<std::map<Key, Compare, Allocator>> {
-  static const size_t size = 1;
-
-  static int push(luaw& l, const std::map<Key, Compare, Allocator>& v) {
-    return luaw_detail::__push_map(l, v);
+struct luaw::convertor<std::map<Key, Compare, Allocator>> {
+  using result_t = std::map<Key, Compare, Allocator>;
+  static result_t to(luaw& l,
+                     int   idx         = -1,
+                     bool  disable_log = false,
+                     bool* failed      = nullptr,
+                     bool* exists      = nullptr) {
+    return luaw_detail::__to_map<result_t>(
+        l, idx, disable_log, failed, exists, "map");
   }
 };
 
-// std::unordered_map
+// to std::unordered_map
 template <typename Key, typename Hash, typename KeyEqual, typename Allocator>
-struct luaw::pusher<std::unordered_map<Key, Hash, KeyEqual, Allocator>> {
-  static const size_t size = 1;
-
-  static int push(luaw&                                                     l,
-                  const std::unordered_map<Key, Hash, KeyEqual, Allocator>& v) {
-    return luaw_detail::__push_map(l, v);
+struct luaw::convertor<std::unordered_map<Key, Hash, KeyEqual, Allocator>> {
+  using result_t = std::unordered_map<Key, Hash, KeyEqual, Allocator>;
+  static result_t to(luaw& l,
+                     int   idx         = -1,
+                     bool  disable_log = false,
+                     bool* failed      = nullptr,
+                     bool* exists      = nullptr) {
+    return luaw_detail::__to_map<result_t>(
+        l, idx, disable_log, failed, exists, "unordered_map");
   }
 };
 
-// std::tuple, as a table list
+// to std::tuple
+// The result tuple shoule not contain any tuple any more.
 template <typename... Ts>
-struct luaw::pusher<std::tuple<Ts...>> {
-  static const size_t size = 1;
-
-  static int push(luaw& l, const std::tuple<Ts...>& v) {
-    l.newtable();
-    const size_t N = std::tuple_size<std::tuple<Ts...>>::value;
-    __push<0, N>(l, v, std::integral_constant<bool, 0 < N>{});
-    return 1;
-  }
-
-private:
-  template <size_t I, size_t N, typename T>
-  static void __push(luaw& l, const T& t, std::true_type) {
-    l.push(std::get<I>(t));
-    l.rawseti(-2, I + 1);
-    __push<I + 1, N>(l, t, std::integral_constant<bool, I + 1 < N>{});
-  }
-  template <size_t I, size_t N, typename T>
-  static void __push(luaw& l, const T& t, std::false_type) {}
-};
-
-template <>
-struct luaw::pusher<luaw::luavalueidx> {
-  static const size_t size = 1;
-
-  static int push(luaw& l, const luaw::luavalueidx& r) {
-    if (!r.valid()) {
-      l.pushnil();
-    } else if (l.L() == r.L()) {
-      l.pushvalue(r.idx());
-    } else if (l.main_thread() == r.main_thread()) {
-      lua_pushvalue(r.L(), r.idx());
-      lua_xmove(r.L(), l.L(), 1);
-    } else {
-      // Can't push value from other lua_State.
-      l.pushnil();
+struct luaw::convertor<std::tuple<Ts...>> {
+  using result_t = std::tuple<Ts...>;
+  static result_t to(luaw& l,
+                     int   idx         = -1,
+                     bool  disable_log = false,
+                     bool* failed      = nullptr,
+                     bool* exists      = nullptr) {
+    result_t ret;
+    if (l.isnoneornil(idx)) {
+      if (exists) *exists = false;
+      if (failed) *failed = false;
+      return ret;
     }
-    return 1;
-  }
-};
-
-template <>
-struct luaw::pusher<luaw::luavalueref> {
-  static const size_t size = 1;
-
-  static int push(luaw& l, const luaw::luavalueref& r) {
-    if (r.as_nil()) {
-      l.pushnil();
-    } else if (l.L() == r.L() || l.main_thread() == r.main_thread()) {
-      lua_rawgeti(l.L(), LUA_REGISTRYINDEX, r.ref_id());
-    } else {
-      // Can't push value from other lua_State.
-      l.pushnil();
+    if (exists) *exists = true;
+    if (!l.istable(idx)) {
+      if (failed) *failed = true;
+      return ret;
     }
-    return 1;
-  }
-};
 
-//////////////////// pusher_for_return impl ////////////////////////////////////
-
-template <typename T>
-struct luaw::pusher_for_return : public luaw::pusher<T> {
-  static_assert(std::is_same<T, std::decay_t<T>>::value, "T should be decayed");
-};
-
-// std::tuple
-// Push elements separately in order. One element takes one place in stack.
-template <typename... Ts>
-struct luaw::pusher_for_return<std::tuple<Ts...>> {
-  static const size_t size = std::tuple_size<std::tuple<Ts...>>::value;
-
-  static int push(luaw& l, const std::tuple<Ts...>& v) {
-    const size_t N = size;
-    int ret_num    = __push<0, N>(l, v, std::integral_constant<bool, 0 < N>{});
-    PEACALM_LUAW_ASSERT(ret_num == N);
-    return ret_num;
+    constexpr size_t N = std::tuple_size<result_t>::value;
+    __to<0, N>(ret,
+               std::integral_constant<bool, 0 < N>{},
+               l,
+               l.abs_index(idx),
+               disable_log,
+               failed);
+    return ret;
   }
 
 private:
   template <size_t I, size_t N, typename T>
-  static int __push(luaw& l, const T& t, std::true_type) {
-    int x = l.push(std::get<I>(t));
-    int y = __push<I + 1, N>(l, t, std::integral_constant<bool, I + 1 < N>{});
-    return x + y;
-  }
+  static void __to(T& ret,
+                   std::true_type,
+                   luaw& l,
+                   int   idx,
+                   bool  disable_log = false,
+                   bool* failed      = nullptr) {
+    l.seek(I + 1, idx);
 
-  template <size_t I, size_t N, typename T>
-  static int __push(luaw& l, const T& t, std::false_type) {
-    return 0;
-  }
-};
+    bool thisfailed;
+    std::get<I>(ret) =
+        l.to<std::tuple_element_t<I, T>>(-1, disable_log, &thisfailed);
 
-//////////////////// convertor impl ////////////////////////////////////////////
+    l.pop();
 
-// NOTICE: this will return a copy of userdata with type T!
-template <typename T, typename>
-struct luaw::convertor {
-  static T to(luaw& l,
-              int   idx         = -1,
-              bool  disable_log = false,
-              bool* failed      = nullptr,
-              bool* exists      = nullptr) {
-    T* p = luaw::convertor<T*>::to(l, idx, disable_log, failed, exists);
-    if (!p) return T{};
-    return *p;
+    bool restfailed;
+    __to<I + 1, N>(ret,
+                   std::integral_constant<bool, I + 1 < N>{},
+                   l,
+                   idx,
+                   disable_log,
+                   &restfailed);
+
+    if (failed) *failed = thisfailed || restfailed;
   }
-};
 
-// convert to all type of pointers including (cv-) void* but not const char*!
-template <typename T>
-struct luaw::
-    convertor<T*, std::enable_if_t<!std::is_same<T*, const char*>::value>> {
-  static T* to(luaw& l,
-               int   idx         = -1,
-               bool  disable_log = false,
-               bool* failed      = nullptr,
-               bool* exists      = nullptr) {
-    if (l.isnoneornil(idx)) {
-      if (exists) *exists = false;
-      if (failed) *failed = false;
-      return nullptr;
-    }
-    if (exists) *exists = true;
-    if (l.isuserdata(idx)) {
-      if (failed) *failed = false;
-      void* p = lua_touserdata(l.L(), idx);
-      return reinterpret_cast<T*>(p);
-    }
-    if (failed) *failed = true;
-    if (!disable_log) { l.log_type_convert_error(idx, "userdata"); }
-    return nullptr;
+  template <size_t I, size_t N, typename T>
+  static void __to(T& ret,
+                   std::false_type,
+                   luaw& l,
+                   int   idx         = -1,
+                   bool  disable_log = false,
+                   bool* failed      = nullptr) {
+    if (failed) *failed = false;
   }
 };
 
-// to const char*, NOT RECOMMENDED! Should better use to std::string instead!
-// lua_tostring will change number to C string in stack, which is dangerous!
+// to void
 template <>
-struct luaw::convertor<const char*> {
-  static const char* to(luaw& l,
-                        int   idx         = -1,
-                        bool  disable_log = false,
-                        bool* failed      = nullptr,
-                        bool* exists      = nullptr) {
-    if (l.isnoneornil(idx)) {
-      if (exists) *exists = false;
-      if (failed) *failed = false;
-      return nullptr;
-    }
-    if (exists) *exists = true;
-    if (l.isstring(idx)) {
-      if (failed) *failed = false;
-      const char* p = lua_tostring(l.L(), idx);
-      return p;
-    }
-    if (failed) *failed = true;
-    if (!disable_log) { l.log_type_convert_error(idx, "const char*"); }
-    return nullptr;
+struct luaw::convertor<void> {
+  static void to(luaw& l,
+                 int   idx         = -1,
+                 bool  disable_log = false,
+                 bool* failed      = nullptr,
+                 bool* exists      = nullptr) {
+    if (failed) *failed = false;
+    if (exists) *exists = !l.isnoneornil(idx);
+    return void();
   }
 };
 
-// to placeholder_tag
+// to luaw::luavalueidx
 template <>
-struct luaw::convertor<luaw::placeholder_tag> {
-  static luaw::placeholder_tag to(luaw& l,
-                                  int   idx         = -1,
-                                  bool  disable_log = false,
-                                  bool* failed      = nullptr,
-                                  bool* exists      = nullptr) {
+struct luaw::convertor<luaw::luavalueidx> {
+  static luaw::luavalueidx to(luaw& l,
+                              int   idx         = -1,
+                              bool  disable_log = false,
+                              bool* failed      = nullptr,
+                              bool* exists      = nullptr) {
     if (failed) *failed = false;
-    if (exists) *exists = !l.isnoneornil(idx);
-    return luaw::placeholder_tag{};
+    if (exists) *exists = !l.isnone(idx);  // only none as not exists
+    return luaw::luavalueidx(l.L(), idx);
   }
 };
 
-namespace luaw_detail {
+// to luaw::luavalueref
+template <>
+struct luaw::convertor<luaw::luavalueref> {
+  static luaw::luavalueref to(luaw& l,
+                              int   idx         = -1,
+                              bool  disable_log = false,
+                              bool* failed      = nullptr,
+                              bool* exists      = nullptr) {
+    if (failed) *failed = false;
+    if (exists) *exists = !l.isnone(idx);  // only none as not exists
+    return luaw::luavalueref(l.L(), idx);
+  }
+};
 
-// Whether the type T is a std::tuple and has element of reference type.
+//////////////////// convertor_for_return impl /////////////////////////////////
 
 template <typename T>
-struct tuple_has_ref : std::false_type {};
+struct luaw::convertor_for_return : public luaw::convertor<T> {};
 
-template <typename T, typename... Ts>
-struct tuple_has_ref<std::tuple<T, Ts...>>
-    : public std::integral_constant<
-          bool,
-          std::is_reference<T>::value ||
-              tuple_has_ref<std::tuple<Ts...>>::value> {};
+// to std::tuple, each element in tuple is converted from one index in stack.
+template <typename... Ts>
+struct luaw::convertor_for_return<std::tuple<Ts...>> {
+  using result_t = std::tuple<Ts...>;
 
-template <>
-struct tuple_has_ref<std::tuple<>> : std::false_type {};
+  static result_t to(luaw& l,
+                     int   idx         = -1,
+                     bool  disable_log = false,
+                     bool* failed      = nullptr,
+                     bool* exists      = nullptr) {
+    constexpr size_t N = std::tuple_size<result_t>::value;
+    result_t         ret;
+    __to<0, N>(ret,
+               std::integral_constant<bool, 0 < N>{},
+               l,
+               l.abs_index(idx),
+               disable_log,
+               failed,
+               exists);
+    return ret;
+  }
 
-// Whether the type T is a std::tuple and has element of non-const lvalue
-// reference type.
+private:
+  template <size_t I, size_t N, typename T>
+  static void __to(T& ret,
+                   std::true_type,
+                   luaw& l,
+                   int   idx,
+                   bool  disable_log = false,
+                   bool* failed      = nullptr,
+                   bool* exists      = nullptr) {
+    bool thisfailed, thisexists;
+    std::get<I>(ret) = l.to<std::tuple_element_t<I, T>>(
+        idx, disable_log, &thisfailed, &thisexists);
 
-template <typename T>
-struct tuple_has_non_const_lvalue_ref : std::false_type {};
+    bool restfailed, restexists;
+    __to<I + 1, N>(ret,
+                   std::integral_constant<bool, I + 1 < N>{},
+                   l,
+                   idx + 1,
+                   disable_log,
+                   &restfailed,
+                   &restexists);
 
-template <typename T, typename... Ts>
-struct tuple_has_non_const_lvalue_ref<std::tuple<T, Ts...>>
-    : public std::integral_constant<
-          bool,
-          (std::is_lvalue_reference<T>::value &&
-           !std::is_const<std::remove_reference_t<T>>::value) ||
-              tuple_has_non_const_lvalue_ref<std::tuple<Ts...>>::value> {};
+    if (failed) *failed = thisfailed || restfailed;
+    if (exists) *exists = thisexists || restexists;
+  }
 
-template <>
-struct tuple_has_non_const_lvalue_ref<std::tuple<>> : std::false_type {};
+  template <size_t I, size_t N, typename T>
+  static void __to(T& ret,
+                   std::false_type,
+                   luaw& l,
+                   int   idx         = -1,
+                   bool  disable_log = false,
+                   bool* failed      = nullptr,
+                   bool* exists      = nullptr) {
+    if (failed) *failed = false;
+    if (exists) *exists = !l.isnoneornil(idx);
+  }
+};
 
-// Whether have any non-const lvalue reference type in Ts
-template <typename... Ts>
-struct has_non_const_lvalue_ref
-    : public tuple_has_non_const_lvalue_ref<std::tuple<Ts...>> {};
+//////////////////// metatable_factory impl ////////////////////////////////////
 
-}  // namespace luaw_detail
+namespace luaw_detail {
 
-template <typename Return, typename... Args>
-class luaw::function<Return(Args...)> {
-  static_assert(
-      !luaw_detail::has_non_const_lvalue_ref<Args...>::value,
-      "Do not support non-const lvalue reference as luaw::function's argument. "
-      ""
-      "If using this kind of reference, it will make a copy of the referenced "
-      "argument into Lua, won't implicitly take its address, meaning that it "
-      "will not share the same object in Lua with C++. "
-      "And this behaves differently with that in C++. This may confuse users, "
-      "so explicitly forbid it. "
-      ""
-      "If you want to share the same argument objects in Lua with C++, "
-      "so you can modify them in Lua, you can use raw pointer type if there is "
-      "only one kind of raw pointer type in all arguments, or use smart "
-      "pointer type or peacalm::luaw::ptrw type, and these two are safer and "
-      "more reassuring.");
-  static_assert(!std::is_reference<Return>::value &&
-                    !luaw_detail::tuple_has_ref<Return>::value,
-                "Do not support reference type as luaw::function's result. "
-                "Cannot make a C++ reference to a value in Lua");
+template <typename Class, typename = void>
+struct has_static_members : std::false_type {};
 
-  // component
-  lua_State*                 L_ = nullptr;
-  std::shared_ptr<const int> ref_sptr_;
+template <typename Class>
+struct has_static_members<
+    Class,
+    void_t<decltype(luaw::static_members<Class>::value())>>
+    : std::true_type {};
 
-  // parameters put in
-  bool disable_log_ = false;
+template <typename MemberPointer>
+struct static_member_type;
 
-  // states put out
-  mutable bool function_failed_ = false, function_exists_ = false,
-               result_failed_ = false, result_exists_ = false;
-  mutable int real_result_size_ = 0;
+template <typename Class, typename Member>
+struct static_member_type<Member Class::*> {
+  using type = Member;
+};
 
-public:
-  function(lua_State* L           = nullptr,
-           int        idx         = -1,
-           bool       disable_log = false,
-           bool*      failed      = nullptr,
-           bool*      exists      = nullptr)
-      : L_(L), disable_log_(disable_log) {
-    if (!L) {
-      if (failed) *failed = true;
-      if (exists) *exists = false;
-      return;
-    }
+template <typename T>
+using static_members_class_t = std::remove_cv_t<remove_ptr_or_smart_ptr_t<T>>;
 
-    // states about convertion to function,
-    // it is states before call the function.
-    function_exists_ = !lua_isnoneornil(L_, idx);
-    if (exists) *exists = !lua_isnoneornil(L_, idx);
-    if (failed) {
-      if (lua_isnoneornil(L_, idx)) {
-        // noneornil is not callable, so we regard this (not-exists) as failed
-        // for function, which is not same as getting variabls.
-        *failed = true;
-      } else {
-        // check more whether it's callable
-        fakeluaw l(L);
-        *failed = !l.callable(idx);
-      }
-    }
 
-    lua_pushvalue(L_, idx);
-    const int ref_id = luaL_ref(L, LUA_REGISTRYINDEX);
-    ref_sptr_.reset(new int(ref_id), [L](const int* p) {
-      luaL_unref(L, LUA_REGISTRYINDEX, *p);
-      delete p;
-    });
+template <typename T, typename Derived>
+struct metatable_factory_base {
+  // Touch (push onto stack) metatable by type T, create a new metatable if it
+  // doesn't exist. Return whether created a new one.
+  static bool gtouchmetatb(luaw& l) {
+    return gtouchmetatb(l, std::is_pointer<T>{});
   }
 
-  /// Unref the referenced Lua function value.
-  void unref() { ref_sptr_.reset(); }
-
-  /// Get the ref id for the referenced Lua function value.
-  const int ref_id() const { return ref_sptr_ ? *ref_sptr_ : LUA_NOREF; }
-
-  /// Get internal lua_State.
-  lua_State* L() const { return L_; }
-
-  /// Set log on-off.
-  void disable_log(bool v) { disable_log_ = v; }
+  // For: T is pointer type
+  static bool gtouchmetatb(luaw& l, std::true_type) {
+    // Make metatable for lightuserdata have a different name with userdata.
+    auto name = std::string("&") + std::string(typeid(T).name());
+    return l.gtouchmetatb(name.c_str());
+  }
 
-  /// Return a C string text message to indicate current state.
-  const char* state_msg() const {
-    if (!failed()) return "No fail";
-    if (function_failed()) return "Function failed";
-    if (!function_exists()) return "Function not exist";
-    if (result_failed()) return "Result failed";
-    if (!result_enough()) {
-      if (!result_exists()) return "Result not exist";
-      return "Result not enough";
-    }
-    return "Unknown";
+  // For: T is not pointer type
+  static bool gtouchmetatb(luaw& l, std::false_type) {
+    // Since no-cv T and cv-qualified T have same name using typeid,
+    // so make an unique type name by their pointer.
+    return l.gtouchmetatb(typeid(T*).name());
   }
 
-  // states after function call
-  // @{
+  // Objects with same type (cv- is concerned) share a common metatable
+  static void push_shared_metatable(luaw& l) {
+    bool first_create = gtouchmetatb(l, std::is_pointer<T>{});
+    // Only build metatable once to improve performance
+    if (first_create) Derived::set_metamethods(l);
+  }
 
-  /// Whether the whole process failed.
-  /// Any step fails the whole process fails, including running the function in
-  /// Lua and converting results to C++, and whether get enough results.
-  bool failed() const {
-    return function_failed() || !function_exists() || result_failed() ||
-           !result_enough();
+  static void push_exclusive_metatable(luaw& l) {
+    l.newtable();
+    Derived::set_metamethods(l);
   }
+};
 
-  /// Whether the function failed while running in Lua (not including function
-  /// doesn't exist)
-  bool function_failed() const { return function_failed_; }
+}  // namespace luaw_detail
 
-  /// Whether the function exists in Lua
-  bool function_exists() const { return function_exists_; }
+// T: The (class) type whose member is registered.
+template <typename T>
+struct luaw::metatable_factory<T*>
+    : public luaw_detail::metatable_factory_base<T*,
+                                                 luaw::metatable_factory<T*>> {
+  // No restrict to class only anymore, user can use it if he knows what he is
+  // doing.
+  // static_assert(std::is_class<T>::value,
+  //               "Only class and it's pointer could have metatable");
 
-  /// Whether converting the Lua function's results to C++ failed
-  bool result_failed() const { return result_failed_; }
+  static void set_metamethods(luaw& l) {
+    set_index_to_metatable(l, -1);
+    set_newindex_to_metatable(l, -1);
+  }
 
-  /// Whether the Lua function returns results (whether results exist)
-  bool result_exists() const { return result_exists_; }
+  // The metamethods are closures with the per-type member info table as
+  // upvalue, so no registry lookup is needed on member access.
 
-  /// Whether Lua function returns enough results.
-  /// Could return more than expect, but couldn't less.
-  bool result_enough() const {
-    return real_result_size() >= expected_result_size();
+  static void set_index_to_metatable(luaw& l, int idx = -1) {
+    idx = l.abs_index(idx);
+    push_member_info(l);
+    l.pushcclosure(__index, 1);
+    l.setfield(idx, "__index");
   }
 
-  /// Result number the Lua function returned
-  int real_result_size() const { return real_result_size_; }
-
-  // @}
+  static void set_newindex_to_metatable(luaw& l, int idx = -1) {
+    idx = l.abs_index(idx);
+    push_member_info(l);
+    l.pushcclosure(__newindex, 1);
+    l.setfield(idx, "__newindex");
+  }
 
-  /// Result number we expect the Lua function should return.
-  /// Could return more, couldn't less.
-  constexpr int expected_result_size() const {
-    return luaw::pusher_for_return<std::decay_t<Return>>::size;
+  // Push the member info table of T* in registry, create it if not exists.
+  // Registrations later fill the same table.
+  static void push_member_info(luaw& l) {
+    void* ti =
+        reinterpret_cast<void*>(const_cast<std::type_info*>(&typeid(T*)));
+    l.touchtb(ti, LUA_REGISTRYINDEX);
   }
 
-  Return operator()(Args... args) const {
-    // reset all states first
-    function_failed_  = false;
-    function_exists_  = false;
-    result_failed_    = false;
-    result_exists_    = false;
-    real_result_size_ = 0;
+  static int __index(lua_State* L) {
+    fakeluaw l(L);
+    PEACALM_LUAW_ASSERT(l.gettop() == 2);
+    const int info = lua_upvalueindex(1);  // the member info table
 
-    if (!L_ || !ref_sptr_) {
-      function_failed_ = false;
-      function_exists_ = false;
-      if (!disable_log_) {
-        if (!L_) {
-          luaw::log_error("luaw::function has no lua_State");
-        } else if (!ref_sptr_) {
-          luaw::log_error("luaw::function refers to nothing");
-        } else {
-          PEACALM_LUAW_ASSERT(false);
+    // Members declared at compile time
+    int n = luaw::static_member_dispatcher<T>::index(L);
+    if (n >= 0) return n;
+
+    // Merged entries of member functions, getters and error tags, resolved
+    // by one lookup.
+    if (l.rawgeti(info, luaw::member_info_fields::member_index) !=
+        LUA_TTABLE) {
+      l.pop();
+    } else {
+      l.pushvalue(2);  // push the key
+      switch (l.rawget(-2)) {
+        case LUA_TFUNCTION:  // member function
+          return 1;
+        case LUA_TTABLE: {  // member variable getter
+          l.rawgeti(-1, luaw::accessor_function);
+          luaw::lua_cfunction_t getter = lua_tocfunction(L, -1);
+          l.rawgeti(-2, luaw::accessor_data);
+          return getter(L);  // errors propagate directly
         }
+        case LUA_TLIGHTUSERDATA: {  // installed by class_binding
+          auto b =
+              static_cast<const luaw::bound_member*>(lua_touserdata(L, -1));
+          if (b->kind == luaw::bound_member::accessor) {
+            l.pushlightuserdata(b->data);
+            return b->fn(L);
+          }
+          // Make the function at first access, then replace the entry by it
+          luaw::push_bound_function(L, b);
+          l.pushvalue(2);
+          l.pushvalue(-2);
+          l.rawset(-5);
+          return 1;
+        }
+        case LUA_TNUMBER:
+          return index_error(l);
+        default:
+          l.pop(2);
       }
-      return Return();
     }
 
-    fakeluaw l(L_);
-    auto     _g = l.make_guarder();
-    int      sz = l.gettop();
-    l.rawgeti(LUA_REGISTRYINDEX, *ref_sptr_);
-    if (l.isnoneornil()) {
-      function_failed_ = false;
-      function_exists_ = false;
+    // dynamic member getter
+    l.rawgeti(info, luaw::member_info_fields::dynamic_member_getter);
+    if (l.isnil(-1)) {
       l.pop();
-      if (!disable_log_) { luaw::log_error("calling an inexistent function"); }
-      return Return();
     } else {
-      function_exists_ = true;
+      l.pushvalue(1);  // push the userdata
+      l.pushvalue(2);  // push the key
+      int retcode = l.pcall(2, 1, 0);
+      if (retcode == LUA_OK) {
+        return 1;
+      } else {
+        return lua_error(l.L());
+      }
     }
 
-    // push args by copy or move
-    int narg = push_args(l, std::forward<Args>(args)...);
+    // not found handler
+    l.pushnil();
+    return 1;
+  }
 
-    int pcall_ret = l.pcall(narg, LUA_MULTRET, 0);
-    PEACALM_LUAW_ASSERT(l.gettop() >= sz);
+  static int __newindex(lua_State* L) {
+    fakeluaw l(L);
+    PEACALM_LUAW_ASSERT(l.gettop() == 3);
+    const int info = lua_upvalueindex(1);  // the member info table
 
-    if (pcall_ret == LUA_OK) {
-      function_failed_  = false;
-      real_result_size_ = l.gettop() - sz;
+    // Members declared at compile time
+    if (luaw::static_member_dispatcher<T>::newindex(L) >= 0) return 0;
+
+    // Merged entries of member variable setters and const members.
+    if (l.rawgeti(info, luaw::member_info_fields::member_newindex) !=
+        LUA_TTABLE) {
+      l.pop();
     } else {
-      function_failed_ = true;
-      if (!disable_log_) { l.log_error_in_stack(); }
+      l.pushvalue(2);  // push the key
+      int type = l.rawget(-2);
+      if (type == LUA_TTABLE) {  // member variable setter
+        l.rawgeti(-1, luaw::accessor_function);
+        luaw::lua_cfunction_t setter = lua_tocfunction(L, -1);
+        l.rawgeti(-2, luaw::accessor_data);
+        return setter(L);  // errors propagate directly
+      } else if (type == LUA_TLIGHTUSERDATA) {  // installed by class_binding
+        auto b =
+            static_cast<const luaw::bound_member*>(lua_touserdata(L, -1));
+        l.pushlightuserdata(b->data);
+        return b->fn(L);
+      } else if (type == LUA_TBOOLEAN) {  // const member, which is true
+        const char* key = l.to_c_str(2);
+        return luaL_error(l.L(), "Const member cannot be modified: %s", key);
+      } else {
+        l.pop(2);
+      }
+    }
+
+    // dynamic member setter
+    l.rawgeti(info, luaw::member_info_fields::dynamic_member_setter);
+    if (l.isnil(-1)) {
       l.pop();
-      return Return();
+    } else if (l.isboolean(-1)) {  // which is false
+      return luaL_error(l.L(), "Cannot set member to const object");
+    } else {
+      l.pushvalue(1);  // push the userdata
+      l.pushvalue(2);  // push the key
+      l.pushvalue(3);  // push the value
+      int retcode = l.pcall(3, 0, 0);
+      if (retcode == LUA_OK) {
+        return 0;
+      } else {
+        return lua_error(l.L());  // failed
+      }
     }
 
-    return luaw::convertor_for_return<std::decay_t<Return>>::to(
-        l, sz + 1, disable_log_, &result_failed_, &result_exists_);
+    // not found handler
+    const char* key = l.to_c_str(2);
+    return luaL_error(l.L(), "Not found setter: %s", key);
   }
 
 private:
-  static int push_args(luaw& l) { return 0; }
-
-  template <typename FirstArg, typename... RestArgs>
-  static int push_args(luaw& l, FirstArg&& farg, RestArgs&&... rargs) {
-    int x = l.push(std::forward<FirstArg>(farg));
-    int y = push_args(l, std::forward<RestArgs>(rargs)...);
-    return x + y;
+  // Error for the tag on top of stack.
+  static int index_error(fakeluaw& l) {
+    const char* key = l.to_c_str(2);
+    if (l.to_int(-1) == luaw::nonconst_member_function_tag) {
+      return luaL_error(l.L(), "Nonconst member function: %s", key);
+    }
+    return luaL_error(l.L(), "Nonvolatile member function: %s", key);
   }
 };
 
-// to luaw::function
-template <typename Return, typename... Args>
-struct luaw::convertor<luaw::function<Return(Args...)>> {
-  using result_t = luaw::function<Return(Args...)>;
-  static result_t to(luaw& l,
-                     int   idx         = -1,
-                     bool  disable_log = false,
-                     bool* failed      = nullptr,
-                     bool* exists      = nullptr) {
-    return result_t(l.L(), idx, disable_log, failed, exists);
-  }
-};
+template <typename T, typename>
+struct luaw::metatable_factory
+    : public luaw_detail::metatable_factory_base<T,
+                                                 luaw::metatable_factory<T>> {
+  // No restrict to class only anymore, user can use it if he knows what he is
+  // doing.
+  // static_assert(std::is_class<T>::value,
+  //               "Only class and it's pointer could have metatable");
 
-// to std::function
-template <typename Return, typename... Args>
-struct luaw::convertor<std::function<Return(Args...)>> {
-  using result_t = std::function<Return(Args...)>;
-  static result_t to(luaw& l,
-                     int   idx         = -1,
-                     bool  disable_log = false,
-                     bool* failed      = nullptr,
-                     bool* exists      = nullptr) {
-    return result_t(luaw::convertor<luaw::function<Return(Args...)>>::to(
-        l, idx, disable_log, failed, exists));
+  static void set_metamethods(luaw& l) {
+    luaw::metatable_factory<T*>::set_metamethods(l);
+    if (!std::is_trivially_destructible<T>::value) {
+      set_gc_to_metatable(l, -1);
+    }
   }
-};
 
-// to bool
-template <>
-struct luaw::convertor<bool> {
-  static bool to(luaw& l,
-                 int   idx         = -1,
-                 bool  disable_log = false,
-                 bool* failed      = nullptr,
-                 bool* exists      = nullptr) {
-    return l.to_bool(idx, bool{}, disable_log, failed, exists);
+  static void set_gc_to_metatable(luaw& l, int idx = -1) {
+    l.setkv("__gc", __gc, idx);
   }
-};
 
-// to integers
-template <typename T>
-struct luaw::convertor<T, std::enable_if_t<std::is_integral<T>::value>> {
-  static T to(luaw& l,
-              int   idx         = -1,
-              bool  disable_log = false,
-              bool* failed      = nullptr,
-              bool* exists      = nullptr) {
-    auto ret = l.to_llong(idx, 0, disable_log, failed, exists);
-    return static_cast<T>(ret);
+  static int __gc(lua_State* L) {
+    fakeluaw l(L);
+    PEACALM_LUAW_ASSERT(l.gettop() == 1);
+    T* p = l.to<T*>(1);
+    PEACALM_LUAW_ASSERT(p);
+    p->~T();
+    return 0;
   }
 };
 
-// to float numbers
-template <>
-struct luaw::convertor<float> {
-  static float to(luaw& l,
-                  int   idx         = -1,
-                  bool  disable_log = false,
-                  bool* failed      = nullptr,
-                  bool* exists      = nullptr) {
-    return l.to_float(idx, float{}, disable_log, failed, exists);
-  }
-};
-template <>
-struct luaw::convertor<double> {
-  static double to(luaw& l,
-                   int   idx         = -1,
-                   bool  disable_log = false,
-                   bool* failed      = nullptr,
-                   bool* exists      = nullptr) {
-    return l.to_double(idx, double{}, disable_log, failed, exists);
+//////////////////// register ctor impl ////////////////////////////////////////
+
+template <typename Return, typename... Args>
+struct luaw::register_ctor_impl<Return (*)(Args...)> {
+  static void register_ctor(luaw& l, const char* fname) {
+    auto ctor = [](const Args&... args) -> Return { return Return(args...); };
+    l.set<luaw::function_tag>(fname, ctor);
   }
 };
-template <>
-struct luaw::convertor<long double> {
-  static long double to(luaw& l,
-                        int   idx         = -1,
-                        bool  disable_log = false,
-                        bool* failed      = nullptr,
-                        bool* exists      = nullptr) {
-    return l.to_ldouble(idx, (long double){}, disable_log, failed, exists);
+
+//////////////////// mock_mem_fn impl //////////////////////////////////////////
+
+namespace luaw_detail {
+
+// retrieve_underlying_ptr
+
+template <typename T>
+struct __retrieve_underlying_ptr {
+  template <typename U>
+  auto operator()(U&& t) const {
+    return &t;
   }
 };
+template <typename T>
+struct __retrieve_underlying_ptr<T*> {
+  auto operator()(T* t) const { return t; }
+};
+template <typename T>
+struct __retrieve_underlying_ptr<std::shared_ptr<T>> {
+  auto operator()(const std::shared_ptr<T>& t) const { return t.get(); }
+};
+template <typename T, typename D>
+struct __retrieve_underlying_ptr<std::unique_ptr<T, D>> {
+  auto operator()(const std::unique_ptr<T, D>& t) const { return t.get(); }
+};
 
-// to std::string, safe implementation
-// To avoid implicitly modifying number to string in stack, which may cause
-// panic while doing lua_next, we copy the value first before call lua_tostring.
-template <>
-struct luaw::convertor<std::string> {
-  static std::string to(luaw& l,
-                        int   idx         = -1,
-                        bool  disable_log = false,
-                        bool* failed      = nullptr,
-                        bool* exists      = nullptr) {
-    if (exists) *exists = !l.isnoneornil(idx);
-    if (l.isstring(idx)) {
-      l.pushvalue(idx);  // make a copy, so, it's safe
-      std::string ret = lua_tostring(l.L(), -1);
-      l.pop();
-      if (failed) *failed = false;
-      return ret;
-    }
-    if (l.isnoneornil(idx)) {
-      if (failed) *failed = false;
-      return "";
-    }
-    if (failed) *failed = true;
-    if (!disable_log) l.log_type_convert_error(idx, "string");
-    return "";
-  }
+template <typename T>
+auto retrieve_underlying_ptr(T&& t) {
+  return __retrieve_underlying_ptr<std::decay_t<T>>{}(std::forward<T>(t));
+}
+
+// The object argument of registered member functions and dynamic members.
+// Conversion to it fails if the object or its underlying pointer is null, so
+// errors are raised in the calling state.
+template <typename ObjectType>
+struct object_arg {
+  ObjectType o;
 };
 
-// to std::pair by (t[1],t[2]) where t should be a table
-template <typename T, typename U>
-struct luaw::convertor<std::pair<T, U>> {
-  using result_t = std::pair<T, U>;
+}  // namespace luaw_detail
+
+template <typename ObjectType>
+struct luaw::convertor<luaw_detail::object_arg<ObjectType>> {
+  using result_t = luaw_detail::object_arg<ObjectType>;
+
   static result_t to(luaw& l,
                      int   idx         = -1,
                      bool  disable_log = false,
                      bool* failed      = nullptr,
                      bool* exists      = nullptr) {
-    if (exists) *exists = !l.isnoneornil(idx);
-    if (l.isnoneornil(idx)) {
-      if (failed) *failed = false;
-      return result_t{};
-    }
-    if (!l.istable(idx)) {
-      if (failed) *failed = true;
-      if (!disable_log) l.log_type_convert_error(idx, "pair");
-      return result_t{};
+    bool       ptrfailed;
+    ObjectType o  = l.to<ObjectType>(idx, disable_log, &ptrfailed, exists);
+    bool       ok = o && luaw_detail::retrieve_underlying_ptr(*o);
+    if (failed) *failed = !ok;
+    if (!ok && !ptrfailed && !disable_log) {
+      luaw::log_error("Calling member by null pointer or empty smart ptr.");
     }
-    // Allow elements do not exist, {} means a pair with initial values
-    bool ffailed, sfailed;
-    l.geti(idx, 1);
-    auto first = luaw::convertor<T>::to(l, -1, disable_log, &ffailed);
-    l.pop();
-    l.geti(idx, 2);
-    auto second = luaw::convertor<U>::to(l, -1, disable_log, &sfailed);
-    l.pop();
-    if (failed) *failed = (ffailed || sfailed);
-    return result_t{first, second};
+    return result_t{o};
   }
 };
 
-namespace luaw_detail {
+//////////////////// static_member_dispatcher impl /////////////////////////////
 
-template <typename T>
-T __to_list(luaw&       l,
-            int         idx         = -1,
-            bool        disable_log = false,
-            bool*       failed      = nullptr,
-            bool*       exists      = nullptr,
-            const char* tname       = "list") {
-  using value_type = typename T::value_type;
-  if (exists) *exists = !l.isnoneornil(idx);
-  if (l.isnoneornil(idx)) {
-    if (failed) *failed = false;
-    return T{};
-  }
-  if (!l.istable(idx)) {
-    if (failed) *failed = true;
-    if (!disable_log) l.log_type_convert_error(idx, tname);
-    return T{};
-  }
-  T ret;
-  if (failed) *failed = false;
-  int sz = luaL_len(l.L(), idx);
-  for (int i = 1; i <= sz; ++i) {
-    l.geti(idx, i);
-    bool       subfailed, subexists;
-    value_type subret =
-        l.to<value_type>(-1, disable_log, &subfailed, &subexists);
-    // Only add elements exist and conversion succeeded
-    if (!subfailed && subexists) ret.push_back(std::move(subret));
-    if (subfailed && failed) *failed = true;
-    l.pop();
-  }
-  return ret;
-}
+// T is the class or smart pointer to class, maybe cv- qualified.
+// Return the number of results, or -1 if the key is not a static member.
+template <typename T, typename>
+struct luaw::static_member_dispatcher {
+  static int index(lua_State* L) { return -1; }
+  static int newindex(lua_State* L) { return -1; }
+};
 
-// Convert all keys of a Lua table into a C++ set
 template <typename T>
-T __to_set(luaw&       l,
-           int         idx         = -1,
-           bool        disable_log = false,
-           bool*       failed      = nullptr,
-           bool*       exists      = nullptr,
-           const char* tname       = "set") {
-  static_assert(!std::is_same<typename T::key_type, const char*>::value,
-                "const char* as key type of set is forbidden");
+struct luaw::static_member_dispatcher<
+    T,
+    std::enable_if_t<luaw_detail::has_static_members<
+        luaw_detail::static_members_class_t<T>>::value>> {
+  using O      = luaw_detail::remove_ptr_or_smart_ptr_t<T>;
+  using Class  = std::remove_cv_t<O>;
+  using list_t = decltype(luaw::static_members<Class>::value());
+  static constexpr size_t N = std::tuple_size<list_t>::value;
 
-  if (exists) *exists = !l.isnoneornil(idx);
-  if (l.isnoneornil(idx)) {
-    if (failed) *failed = false;
-    return T{};
+  static int index(lua_State* L) {
+    return dispatch(L, false, std::make_index_sequence<N>{});
   }
-  if (!l.istable(idx)) {
-    if (failed) *failed = true;
-    if (!disable_log) l.log_type_convert_error(idx, tname);
-    return T{};
+
+  static int newindex(lua_State* L) {
+    return dispatch(L, true, std::make_index_sequence<N>{});
   }
-  T ret;
-  if (failed) *failed = false;
-  int absidx = l.abs_index(idx);
-  l.pushnil();
-  while (lua_next(l.L(), absidx) != 0) {
-    bool kfailed, kexists;
-    auto key = l.to<typename T::key_type>(-2, disable_log, &kfailed, &kexists);
-    if (!kfailed && kexists) { ret.insert(std::move(key)); }
-    if (kfailed && failed) *failed = true;
-    l.pop();
+
+private:
+  using accessor_t = int (*)(lua_State*);
+
+  template <size_t... I>
+  static int dispatch(lua_State* L, bool set, std::index_sequence<I...>) {
+    static constexpr uint32_t hashes[] = {
+        std::get<I>(luaw::static_members<Class>::value()).hash..., 0};
+    static constexpr size_t sizes[] = {
+        std::get<I>(luaw::static_members<Class>::value()).size..., 0};
+    static constexpr accessor_t getters[] = {&get<I>..., nullptr};
+    static constexpr accessor_t setters[] = {&set_member<I>..., nullptr};
+
+    if (lua_type(L, 2) != LUA_TSTRING) return -1;
+    size_t      len;
+    const char* key = lua_tolstring(L, 2, &len);
+    uint32_t    h   = luaw_detail::fnv1a32(key, len);
+    for (size_t i = 0; i < N; ++i) {
+      if (hashes[i] == h && sizes[i] == len && name_equal(i, key, len)) {
+        return set ? setters[i](L) : getters[i](L);
+      }
+    }
+    return -1;
   }
-  return ret;
-}
 
-template <typename T>
-T __to_map(luaw&       l,
-           int         idx         = -1,
-           bool        disable_log = false,
-           bool*       failed      = nullptr,
-           bool*       exists      = nullptr,
-           const char* tname       = "map") {
-  static_assert(!std::is_same<typename T::key_type, const char*>::value,
-                "const char* as key type of map is forbidden");
+  static bool name_equal(size_t i, const char* key, size_t len) {
+    return name_equal(i, key, len, std::make_index_sequence<N>{});
+  }
 
-  if (exists) *exists = !l.isnoneornil(idx);
-  if (l.isnoneornil(idx)) {
-    if (failed) *failed = false;
-    return T{};
+  template <size_t... I>
+  static bool name_equal(size_t      i,
+                         const char* key,
+                         size_t      len,
+                         std::index_sequence<I...>) {
+    static constexpr const char* names[] = {
+        std::get<I>(luaw::static_members<Class>::value()).name..., nullptr};
+    return memcmp(names[i], key, len) == 0;
   }
-  if (!l.istable(idx)) {
-    if (failed) *failed = true;
-    if (!disable_log) l.log_type_convert_error(idx, tname);
-    return T{};
+
+  template <size_t I>
+  using member_pointer_t =
+      typename std::tuple_element_t<I, list_t>::member_pointer_type;
+
+  template <size_t I>
+  using member_t =
+      typename luaw_detail::static_member_type<member_pointer_t<I>>::type;
+
+  template <size_t I>
+  static constexpr member_pointer_t<I> member_pointer() {
+    return std::get<I>(luaw::static_members<Class>::value()).mp;
   }
-  T ret;
-  if (failed) *failed = false;
-  int absidx = l.abs_index(idx);
-  l.pushnil();
-  while (lua_next(l.L(), absidx) != 0) {
-    bool kfailed, kexists, vfailed, vexists;
-    auto key = l.to<typename T::key_type>(-2, disable_log, &kfailed, &kexists);
-    if (!kfailed && kexists) {
-      auto val =
-          l.to<typename T::mapped_type>(-1, disable_log, &vfailed, &vexists);
-      if (!vfailed && vexists) ret.insert({std::move(key), std::move(val)});
+
+  template <size_t I>
+  static int get(lua_State* L) {
+    // To add same cv- property on Member as Object
+    using M0 = member_t<I>;
+    using M1 = std::conditional_t<std::is_volatile<O>::value, volatile M0, M0>;
+    using M2 = std::conditional_t<std::is_const<O>::value, const M1, M1>;
+
+    auto o = reinterpret_cast<T*>(lua_touserdata(L, 1));
+    PEACALM_LUAW_ASSERT(o);
+    auto p = luaw_detail::retrieve_underlying_ptr(*o);
+    if (!p) return luaL_error(L, "Getting member by empty smart ptr.");
+    fakeluaw l(L);
+    return luaw::pusher_for_return<std::decay_t<M2>>::push(
+        l, static_cast<M2>(p->*member_pointer<I>()));
+  }
+
+  template <size_t I>
+  static int set_member(lua_State* L) {
+    return set_member<I>(
+        L,
+        std::integral_constant<bool,
+                               !std::is_const<O>::value &&
+                                   !std::is_const<member_t<I>>::value>{});
+  }
+
+  template <size_t I>
+  static int set_member(lua_State* L, std::false_type) {
+    const char* key = lua_tostring(L, 2);
+    return luaL_error(L, "Const member cannot be modified: %s", key);
+  }
+
+  template <size_t I>
+  static int set_member(lua_State* L, std::true_type) {
+    auto o = reinterpret_cast<T*>(lua_touserdata(L, 1));
+    PEACALM_LUAW_ASSERT(o);
+    auto p = luaw_detail::retrieve_underlying_ptr(*o);
+    if (!p) return luaL_error(L, "Setting member by empty smart ptr.");
+    bool failed;
+    {
+      fakeluaw l(L);
+      auto     v = l.to<std::decay_t<member_t<I>>>(3, false, &failed);
+      if (!failed) p->*member_pointer<I>() = std::move(v);
     }
-    if ((kfailed || vfailed) && failed) *failed = true;
-    l.pop();
+    // Raise error after the converted value destructed
+    if (failed) return luaL_error(L, "The 2th argument conversion failed");
+    return 0;
   }
-  return ret;
-}
+};
 
-}  // namespace luaw_detail
+//////////////////// mock_mem_fn impl (continued) //////////////////////////////
 
-// to std::vector
-// NOTICE: Discard nil in list! e.g. {1,2,nil,4} -> vector<int>{1,2,4}
-template <typename T, typename Allocator>
-struct luaw::convertor<std::vector<T, Allocator>> {
-  using result_t = std::vector<T, Allocator>;
-  static result_t to(luaw& l,
-                     int   idx         = -1,
-                     bool  disable_log = false,
-                     bool* failed      = nullptr,
-                     bool* exists      = nullptr) {
-    return luaw_detail::__to_list<result_t>(
-        l, idx, disable_log, failed, exists, "vector");
+// The first argument of CallableObject must be raw pointer, and could be
+// `auto*` (in lambda).
+template <typename CallableObject>
+class luaw::mock_mem_fn<
+    CallableObject,
+    std::enable_if_t<!std::is_member_pointer<CallableObject>::value>> {
+  CallableObject o;
+
+public:
+  mock_mem_fn(CallableObject&& r) : o(std::forward<CallableObject>(r)) {}
+
+  template <typename FirstArg, typename... Args>
+  decltype(auto) operator()(FirstArg&& f, Args&&... args) const {
+    return o(luaw_detail::retrieve_underlying_ptr(std::forward<FirstArg>(f)),
+             std::forward<Args>(args)...);
+  }
+};
+
+template <typename MemberPointer>
+class luaw::mock_mem_fn<
+    MemberPointer,
+    std::enable_if_t<std::is_member_pointer<MemberPointer>::value>> {
+  decltype(std::mem_fn(static_cast<MemberPointer>(nullptr))) o;
+
+public:
+  mock_mem_fn(MemberPointer p) : o(std::mem_fn(p)) {}
+
+  template <typename FirstArg, typename... Args>
+  decltype(auto) operator()(FirstArg&& f, Args&&... args) const {
+    return o(luaw_detail::retrieve_underlying_ptr(std::forward<FirstArg>(f)),
+             std::forward<Args>(args)...);
+  };
+};
+
+//////////////////// static_mem_fn impl ////////////////////////////////////////
+
+// specialize for C function pointer
+template <typename T>
+class luaw::static_mem_fn<T*, std::enable_if_t<std::is_function<T>::value>> {
+  T* f;
+
+public:
+  static_mem_fn(T* t) : f(t) {
+    // Can't be null ptr, since we're required to call the function ptr
+    PEACALM_LUAW_ASSERT(f);
   }
-};
 
-// to std::deque
-template <typename T, typename Allocator>
-struct luaw::convertor<std::deque<T, Allocator>> {
-  using result_t = std::deque<T, Allocator>;
-  static result_t to(luaw& l,
-                     int   idx         = -1,
-                     bool  disable_log = false,
-                     bool* failed      = nullptr,
-                     bool* exists      = nullptr) {
-    return luaw_detail::__to_list<result_t>(
-        l, idx, disable_log, failed, exists, "deque");
+  template <typename Class, typename... Args>
+  decltype(auto) operator()(Class&&, Args&&... args) const {
+    return f(std::forward<Args>(args)...);
   }
 };
 
-// to std::list
-template <typename T, typename Allocator>
-struct luaw::convertor<std::list<T, Allocator>> {
-  using result_t = std::list<T, Allocator>;
-  static result_t to(luaw& l,
-                     int   idx         = -1,
-                     bool  disable_log = false,
-                     bool* failed      = nullptr,
-                     bool* exists      = nullptr) {
-    return luaw_detail::__to_list<result_t>(
-        l, idx, disable_log, failed, exists, "list");
+// specialize for C variable pointer
+template <typename T>
+class luaw::static_mem_fn<T*, std::enable_if_t<!std::is_function<T>::value>> {
+  T* m;
+
+public:
+  static_mem_fn(T* t) : m(t) {
+    // Can't be null ptr, since we're required to dereference the ptr
+    PEACALM_LUAW_ASSERT(m);
   }
-};
 
-// to std::forward_list
-template <typename T, typename Allocator>
-struct luaw::convertor<std::forward_list<T, Allocator>> {
-  using result_t = std::forward_list<T, Allocator>;
-  static result_t to(luaw& l,
-                     int   idx         = -1,
-                     bool  disable_log = false,
-                     bool* failed      = nullptr,
-                     bool* exists      = nullptr) {
-    auto t = luaw_detail::__to_list<std::vector<T>>(
-        l, idx, disable_log, failed, exists, "vector");
-    return result_t(t.begin(), t.end());
+  template <typename Class>
+  T& operator()(Class&&) const {
+    return *m;
   }
 };
 
-// to std::set
-template <typename Key, typename Compare, typename Allocator>
-struct luaw::convertor<std::set<Key, Compare, Allocator>> {
-  using result_t = std::set<Key, Compare, Allocator>;
-  static result_t to(luaw& l,
-                     int   idx         = -1,
-                     bool  disable_log = false,
-                     bool* failed      = nullptr,
-                     bool* exists      = nullptr) {
-    return luaw_detail::__to_set<result_t>(
-        l, idx, disable_log, failed, exists, "set");
-  }
+//////////////////// registrar impl ////////////////////////////////////////////
+
+template <typename Getter>
+void luaw::register_dynamic_member_getter(Getter&& getter) {
+  luaw::registrar<luaw_detail::detect_callable_cfunction_t<Getter>>::
+      register_dynamic_member_getter(
+          *this, luaw::mock_mem_fn<Getter>(std::forward<Getter>(getter)));
+}
+
+template <typename Setter>
+void luaw::register_dynamic_member_setter(Setter&& setter) {
+  luaw::registrar<luaw_detail::detect_callable_cfunction_t<Setter>>::
+      register_dynamic_member_setter(
+          *this, luaw::mock_mem_fn<Setter>(std::forward<Setter>(setter)));
+}
+
+// Support nothing in this basic registrar.
+// Supported features should be specialized elsewhere.
+template <typename T, typename>
+struct luaw::registrar {
+  // Explicitly delete the member functions to let compile fail for unsupported
+  // member types, such as ref- qualified member functions, or C style variadic
+  // functions.
+
+  template <typename MemberFunction>
+  static void register_member(luaw&          l,
+                              const char*    fname,
+                              MemberFunction mf) = delete;
+
+  template <typename Getter>
+  static void register_dynamic_member_getter(luaw& l, Getter&& getter) = delete;
+
+  template <typename Setter>
+  static void register_dynamic_member_setter(luaw& l, Setter&& setter) = delete;
+
+  template <typename F>
+  static void register_member_ptr(luaw& l, const char* name, F&& f) = delete;
+
+  template <typename F>
+  static void register_member_ref(luaw& l, const char* name, F&& f) = delete;
 };
 
-// to std::unordered_set
-template <typename Key, typename Hash, typename KeyEqual, typename Allocator>
-struct luaw::convertor<std::unordered_set<Key, Hash, KeyEqual, Allocator>> {
-  using result_t = std::unordered_set<Key, Hash, KeyEqual, Allocator>;
-  static result_t to(luaw& l,
-                     int   idx         = -1,
-                     bool  disable_log = false,
-                     bool* failed      = nullptr,
-                     bool* exists      = nullptr) {
-    return luaw_detail::__to_set<result_t>(
-        l, idx, disable_log, failed, exists, "unordered_set");
+/* -------------------------------------------------------------------------- */
+// Registrar specialization for dynamic member getter.
+template <typename Member, typename Class, typename Key>
+struct luaw::registrar<Member (*)(Class*, Key)> {
+  static_assert(std::is_class<Class>::value && std::is_const<Class>::value,
+                "First argument should be pointer of const class");
+  using DecayClass = std::remove_cv_t<Class>;
+  static_assert(std::is_same<DecayClass, std::decay_t<Class>>::value,
+                "Never happen");
+
+#define REGISTER_GETTER(ObjectType)                          \
+  l.touchtb((void*)(&typeid(ObjectType)), LUA_REGISTRYINDEX) \
+      .setkv<Member (*)(Class*, Key)>(                       \
+          luaw::member_info_fields::dynamic_member_getter, getter);
+
+#define REGISTER_SMART_GETTER(ObjectType)                                  \
+  l.touchtb((void*)(&typeid(ObjectType)), LUA_REGISTRYINDEX)               \
+      .setkv<Member (*)(luaw_detail::object_arg<ObjectType>, Key)>(        \
+          luaw::member_info_fields::dynamic_member_getter,                 \
+          [=](luaw_detail::object_arg<ObjectType> a, Key k) -> Member {    \
+            return getter(*luaw_detail::retrieve_underlying_ptr(*a.o), k); \
+          });
+
+  template <typename Getter>
+  static void register_dynamic_member_getter(luaw& l, Getter&& getter) {
+    auto _g = l.make_guarder();
+
+    REGISTER_GETTER(DecayClass*);
+    REGISTER_GETTER(const DecayClass*);
+
+#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+
+    if PEACAML_LUAW_IF_CONSTEXPR (std::is_volatile<Class>::value) {
+      REGISTER_GETTER(volatile DecayClass*);
+      REGISTER_GETTER(const volatile DecayClass*);
+    }
+
+#endif
+
+    // Do not support nested smart pointers, which is meaningless!
+    // DO NOT support top-level volatile for smart pointers!
+    if PEACAML_LUAW_IF_CONSTEXPR (!luaw_detail::is_std_shared_ptr<
+                                      DecayClass>::value &&
+                                  !luaw_detail::is_std_unique_ptr<
+                                      DecayClass>::value) {
+      REGISTER_SMART_GETTER(std::shared_ptr<DecayClass>*);
+      REGISTER_SMART_GETTER(const std::shared_ptr<DecayClass>*);
+      REGISTER_SMART_GETTER(std::shared_ptr<const DecayClass>*);
+      REGISTER_SMART_GETTER(const std::shared_ptr<const DecayClass>*);
+
+      REGISTER_SMART_GETTER(std::unique_ptr<DecayClass>*);
+      REGISTER_SMART_GETTER(const std::unique_ptr<DecayClass>*);
+      REGISTER_SMART_GETTER(std::unique_ptr<const DecayClass>*);
+      REGISTER_SMART_GETTER(const std::unique_ptr<const DecayClass>*);
+
+#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+
+      // for low-level volatile:
+      __register_dynamic_member_getter_for_volatile(
+          l, std::forward<Getter>(getter), std::is_volatile<Class>{});
+
+#endif
+    }
   }
-};
 
-// to std::map
-template <typename Key, typename Compare, typename Allocator>
-struct luaw::convertor<std::map<Key, Compare, Allocator>> {
-  using result_t = std::map<Key, Compare, Allocator>;
-  static result_t to(luaw& l,
-                     int   idx         = -1,
-                     bool  disable_log = false,
-                     bool* failed      = nullptr,
-                     bool* exists      = nullptr) {
-    return luaw_detail::__to_map<result_t>(
-        l, idx, disable_log, failed, exists, "map");
+  template <typename Getter>
+  static void __register_dynamic_member_getter_for_volatile(luaw&    l,
+                                                            Getter&& getter,
+                                                            std::true_type) {
+    auto _g = l.make_guarder();
+
+    REGISTER_SMART_GETTER(std::shared_ptr<volatile DecayClass>*);
+    REGISTER_SMART_GETTER(const std::shared_ptr<volatile DecayClass>*);
+    REGISTER_SMART_GETTER(std::shared_ptr<const volatile DecayClass>*);
+    REGISTER_SMART_GETTER(const std::shared_ptr<const volatile DecayClass>*);
+
+    REGISTER_SMART_GETTER(std::unique_ptr<volatile DecayClass>*);
+    REGISTER_SMART_GETTER(const std::unique_ptr<volatile DecayClass>*);
+    REGISTER_SMART_GETTER(std::unique_ptr<const volatile DecayClass>*);
+    REGISTER_SMART_GETTER(const std::unique_ptr<const volatile DecayClass>*);
   }
-};
 
-// to std::unordered_map
-template <typename Key, typename Hash, typename KeyEqual, typename Allocator>
-struct luaw::convertor<std::unordered_map<Key, Hash, KeyEqual, Allocator>> {
-  using result_t = std::unordered_map<Key, Hash, KeyEqual, Allocator>;
-  static result_t to(luaw& l,
-                     int   idx         = -1,
-                     bool  disable_log = false,
-                     bool* failed      = nullptr,
-                     bool* exists      = nullptr) {
-    return luaw_detail::__to_map<result_t>(
-        l, idx, disable_log, failed, exists, "unordered_map");
+  template <typename Getter>
+  static void __register_dynamic_member_getter_for_volatile(luaw&    l,
+                                                            Getter&& getter,
+                                                            std::false_type) {
+    // Do nothing.
+    // Since the getter user provided cannot be used for volatile objects.
+    // We donot make unnecessary troubles.
   }
+
+#undef REGISTER_SMART_GETTER
+#undef REGISTER_GETTER
 };
 
-// to std::tuple
-// The result tuple shoule not contain any tuple any more.
-template <typename... Ts>
-struct luaw::convertor<std::tuple<Ts...>> {
-  using result_t = std::tuple<Ts...>;
-  static result_t to(luaw& l,
-                     int   idx         = -1,
-                     bool  disable_log = false,
-                     bool* failed      = nullptr,
-                     bool* exists      = nullptr) {
-    result_t ret;
-    if (l.isnoneornil(idx)) {
-      if (exists) *exists = false;
-      if (failed) *failed = false;
-      return ret;
-    }
-    if (exists) *exists = true;
-    if (!l.istable(idx)) {
-      if (failed) *failed = true;
-      return ret;
+/* -------------------------------------------------------------------------- */
+// Registrar specialization for dynamic member setter.
+template <typename Class, typename Key, typename Member>
+struct luaw::registrar<void (*)(Class*, Key, Member)> {
+  static_assert(std::is_class<Class>::value && !std::is_const<Class>::value,
+                "First argument should be pointer of non-const class");
+  using DecayClass = std::remove_cv_t<Class>;
+  static_assert(std::is_same<DecayClass, std::decay_t<Class>>::value,
+                "Never happen");
+
+#define REGISTER_SETTER(ObjectType)                          \
+  l.touchtb((void*)(&typeid(ObjectType)), LUA_REGISTRYINDEX) \
+      .setkv<void (*)(Class*, Key, Member)>(                 \
+          luaw::member_info_fields::dynamic_member_setter, setter);
+
+#define REGISTER_SMART_SETTER(ObjectType)                                  \
+  l.touchtb((void*)(&typeid(ObjectType)), LUA_REGISTRYINDEX)               \
+      .setkv<void (*)(luaw_detail::object_arg<ObjectType>, Key, Member)>(  \
+          luaw::member_info_fields::dynamic_member_setter,                 \
+          [=](luaw_detail::object_arg<ObjectType> a, Key k, Member v) {    \
+            setter(*luaw_detail::retrieve_underlying_ptr(*a.o), k, v);     \
+          });
+
+#define REGISTER_SETTER_OF_CONST(ObjectType)                 \
+  l.touchtb((void*)(&typeid(ObjectType)), LUA_REGISTRYINDEX) \
+      .setkv(luaw::member_info_fields::dynamic_member_setter, false);
+
+  template <typename Setter>
+  static void register_dynamic_member_setter(luaw& l, Setter&& setter) {
+    auto _g = l.make_guarder();
+
+    REGISTER_SETTER(DecayClass*);
+    REGISTER_SETTER_OF_CONST(const DecayClass*);
+
+#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+
+    if PEACAML_LUAW_IF_CONSTEXPR (std::is_volatile<Class>::value) {
+      REGISTER_SETTER(volatile DecayClass*);
+      REGISTER_SETTER_OF_CONST(const volatile DecayClass*);
     }
 
-    constexpr size_t N = std::tuple_size<result_t>::value;
-    __to<0, N>(ret,
-               std::integral_constant<bool, 0 < N>{},
-               l,
-               l.abs_index(idx),
-               disable_log,
-               failed);
-    return ret;
-  }
+#endif
 
-private:
-  template <size_t I, size_t N, typename T>
-  static void __to(T& ret,
-                   std::true_type,
-                   luaw& l,
-                   int   idx,
-                   bool  disable_log = false,
-                   bool* failed      = nullptr) {
-    l.seek(I + 1, idx);
+    // Do not support nested smart pointers, which is meaningless!
+    // DO NOT support top-level volatile for smart pointers!
+    if PEACAML_LUAW_IF_CONSTEXPR (!luaw_detail::is_std_shared_ptr<
+                                      Class>::value &&
+                                  !luaw_detail::is_std_unique_ptr<
+                                      Class>::value) {
+      REGISTER_SMART_SETTER(std::shared_ptr<DecayClass>*);
+      REGISTER_SMART_SETTER(const std::shared_ptr<DecayClass>*);
 
-    bool thisfailed;
-    std::get<I>(ret) =
-        l.to<std::tuple_element_t<I, T>>(-1, disable_log, &thisfailed);
+      REGISTER_SETTER_OF_CONST(std::shared_ptr<const DecayClass>*);
+      REGISTER_SETTER_OF_CONST(const std::shared_ptr<const DecayClass>*);
 
-    l.pop();
+      REGISTER_SMART_SETTER(std::unique_ptr<DecayClass>*);
+      REGISTER_SMART_SETTER(const std::unique_ptr<DecayClass>*);
 
-    bool restfailed;
-    __to<I + 1, N>(ret,
-                   std::integral_constant<bool, I + 1 < N>{},
-                   l,
-                   idx,
-                   disable_log,
-                   &restfailed);
+      REGISTER_SETTER_OF_CONST(std::unique_ptr<const DecayClass>*);
+      REGISTER_SETTER_OF_CONST(const std::unique_ptr<const DecayClass>*);
 
-    if (failed) *failed = thisfailed || restfailed;
-  }
+#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
 
-  template <size_t I, size_t N, typename T>
-  static void __to(T& ret,
-                   std::false_type,
-                   luaw& l,
-                   int   idx         = -1,
-                   bool  disable_log = false,
-                   bool* failed      = nullptr) {
-    if (failed) *failed = false;
-  }
-};
+      // for low-level volatile:
+      __register_dynamic_member_setter_for_volatile(
+          l, std::forward<Setter>(setter), std::is_volatile<Class>{});
 
-// to void
-template <>
-struct luaw::convertor<void> {
-  static void to(luaw& l,
-                 int   idx         = -1,
-                 bool  disable_log = false,
-                 bool* failed      = nullptr,
-                 bool* exists      = nullptr) {
-    if (failed) *failed = false;
-    if (exists) *exists = !l.isnoneornil(idx);
-    return void();
+#endif
+    }
   }
-};
 
-// to luaw::luavalueidx
-template <>
-struct luaw::convertor<luaw::luavalueidx> {
-  static luaw::luavalueidx to(luaw& l,
-                              int   idx         = -1,
-                              bool  disable_log = false,
-                              bool* failed      = nullptr,
-                              bool* exists      = nullptr) {
-    if (failed) *failed = false;
-    if (exists) *exists = !l.isnone(idx);  // only none as not exists
-    return luaw::luavalueidx(l.L(), idx);
+  template <typename Setter>
+  static void __register_dynamic_member_setter_for_volatile(luaw&    l,
+                                                            Setter&& setter,
+                                                            std::true_type) {
+    auto _g = l.make_guarder();
+
+    REGISTER_SMART_SETTER(std::shared_ptr<volatile DecayClass>*);
+    REGISTER_SMART_SETTER(const std::shared_ptr<volatile DecayClass>*);
+
+    REGISTER_SETTER_OF_CONST(std::shared_ptr<const volatile DecayClass>*);
+    REGISTER_SETTER_OF_CONST(const std::shared_ptr<const volatile DecayClass>*);
+
+    REGISTER_SMART_SETTER(std::unique_ptr<volatile DecayClass>*);
+    REGISTER_SMART_SETTER(const std::unique_ptr<volatile DecayClass>*);
+
+    REGISTER_SETTER_OF_CONST(std::unique_ptr<const volatile DecayClass>*);
+    REGISTER_SETTER_OF_CONST(const std::unique_ptr<const volatile DecayClass>*);
   }
-};
 
-// to luaw::luavalueref
-template <>
-struct luaw::convertor<luaw::luavalueref> {
-  static luaw::luavalueref to(luaw& l,
-                              int   idx         = -1,
-                              bool  disable_log = false,
-                              bool* failed      = nullptr,
-                              bool* exists      = nullptr) {
-    if (failed) *failed = false;
-    if (exists) *exists = !l.isnone(idx);  // only none as not exists
-    return luaw::luavalueref(l.L(), idx);
+  template <typename Setter>
+  static void __register_dynamic_member_setter_for_volatile(luaw&    l,
+                                                            Setter&& setter,
+                                                            std::false_type) {
+    // Do nothing.
+    // Since the setter user provided cannot be used for volatile objects.
+    // We donot make unnecessary troubles.
   }
-};
 
-//////////////////// convertor_for_return impl /////////////////////////////////
+#undef REGISTER_SETTER_OF_CONST
+#undef REGISTER_SMART_SETTER
+#undef REGISTER_SETTER
+};
 
-template <typename T>
-struct luaw::convertor_for_return : public luaw::convertor<T> {};
+/* -------------------------------------------------------------------------- */
+// Make wrapper for raw pointer.
 
-// to std::tuple, each element in tuple is converted from one index in stack.
-template <typename... Ts>
-struct luaw::convertor_for_return<std::tuple<Ts...>> {
-  using result_t = std::tuple<Ts...>;
+namespace luaw_detail {
 
-  static result_t to(luaw& l,
-                     int   idx         = -1,
-                     bool  disable_log = false,
-                     bool* failed      = nullptr,
-                     bool* exists      = nullptr) {
-    constexpr size_t N = std::tuple_size<result_t>::value;
-    result_t         ret;
-    __to<0, N>(ret,
-               std::integral_constant<bool, 0 < N>{},
-               l,
-               l.abs_index(idx),
-               disable_log,
-               failed,
-               exists);
-    return ret;
-  }
+// A mock allocator to support volatile
+template <typename T>
+struct allocator {
+  using value_type = T;
+  using size_type  = std::size_t;
 
-private:
-  template <size_t I, size_t N, typename T>
-  static void __to(T& ret,
-                   std::true_type,
-                   luaw& l,
-                   int   idx,
-                   bool  disable_log = false,
-                   bool* failed      = nullptr,
-                   bool* exists      = nullptr) {
-    bool thisfailed, thisexists;
-    std::get<I>(ret) = l.to<std::tuple_element_t<I, T>>(
-        idx, disable_log, &thisfailed, &thisexists);
+  allocator() = default;
 
-    bool restfailed, restexists;
-    __to<I + 1, N>(ret,
-                   std::integral_constant<bool, I + 1 < N>{},
-                   l,
-                   idx + 1,
-                   disable_log,
-                   &restfailed,
-                   &restexists);
+  template <typename U>
+  allocator(const allocator<U>& r) {}
 
-    if (failed) *failed = thisfailed || restfailed;
-    if (exists) *exists = thisexists || restexists;
+  value_type* allocate(size_type n) {
+    if (n == 0) { return nullptr; }
+    if (n > max_size()) { throw std::bad_array_new_length(); }
+    void* const p = ::operator new(n * sizeof(value_type));
+    if (!p) { throw std::bad_alloc(); }
+    return static_cast<value_type*>(p);
   }
 
-  template <size_t I, size_t N, typename T>
-  static void __to(T& ret,
-                   std::false_type,
-                   luaw& l,
-                   int   idx         = -1,
-                   bool  disable_log = false,
-                   bool* failed      = nullptr,
-                   bool* exists      = nullptr) {
-    if (failed) *failed = false;
-    if (exists) *exists = !l.isnoneornil(idx);
+  void deallocate(const value_type* p, size_type n) {
+    return ::operator delete((void*)(p));
   }
+
+  size_type max_size() const { return size_type(~0) / sizeof(T); }
 };
 
-//////////////////// metatable_factory impl ////////////////////////////////////
+// To make a shared_ptr with a given pointer,
+// but never deletes the given pointer,
+// and uses an allocator who supports volatile.
+template <typename T>
+std::shared_ptr<T> mock_shared(T* p) {
+  return std::shared_ptr<T>(
+      p, [](...) {}, allocator<T>{});
+}
+
+}  // namespace luaw_detail
+
+// Make a wrapper for a raw pointer.
+// Thus the wrapped pointer will be a full userdata in Lua, not light userdata.
+template <typename T>
+luaw::ptrw<T> luaw::make_ptrw(T* p) {
+  static_assert(!luaw_detail::is_std_shared_ptr<std::decay_t<T>>::value &&
+                    !luaw_detail::is_std_unique_ptr<std::decay_t<T>>::value,
+                "No need to make wrapper for smart pointers");
+  return luaw_detail::mock_shared<T>(p);
+}
+
+/* -------------------------------------------------------------------------- */
+// Registrar specialization for register_member_ptr and register_member_ref.
+template <typename Class, typename Member>
+struct luaw::registrar<Member Class::*, luaw::registrar_tag_for_member_ptr> {
+  static_assert(std::is_member_object_pointer<Member Class::*>::value,
+                "Only member variables can be registered ptr/ref");
+
+  // Actually this static assertion won't work.
+  // C++ regards "Member cv-Class::*" as a same type as "Member Class::*".
+  // And the compiler will automatically remove cv- property for Class.
+  static_assert(std::is_same<Class, std::decay_t<Class>>::value,
+                "Never happen (Class must be decayed)");
 
-namespace luaw_detail {
+  static_assert(!std::is_pointer<Member>::value,
+                "No need to register pointer or reference for pointer members");
+  static_assert(
+      !luaw_detail::is_std_shared_ptr<std::decay_t<Member>>::value &&
+          !luaw_detail::is_std_unique_ptr<std::decay_t<Member>>::value,
+      "No need to register pointer or reference for smart pointer members");
 
-template <typename T, typename Derived>
-struct metatable_factory_base {
-  // Touch (push onto stack) metatable by type T, create a new metatable if it
-  // doesn't exist. Return whether created a new one.
-  static bool gtouchmetatb(luaw& l) {
-    return gtouchmetatb(l, std::is_pointer<T>{});
-  }
+  template <typename F>
+  static void register_member_ptr(luaw& l, const char* name, F&& f) {
+    // Member pointer should have same low-level cv- property as class pointer.
 
-  // For: T is pointer type
-  static bool gtouchmetatb(luaw& l, std::true_type) {
-    // Make metatable for lightuserdata have a different name with userdata.
-    auto name = std::string("&") + std::string(typeid(T).name());
-    return l.gtouchmetatb(name.c_str());
-  }
+    using Registrar = luaw::registrar<Member Class::*>;
 
-  // For: T is not pointer type
-  static bool gtouchmetatb(luaw& l, std::false_type) {
-    // Since no-cv T and cv-qualified T have same name using typeid,
-    // so make an unique type name by their pointer.
-    return l.gtouchmetatb(typeid(T*).name());
-  }
+    Registrar::template do_register_one_getter<Class*, Member* const>(
+        l, name, f);
+    Registrar::template do_register_one_getter<const Class*,
+                                               const Member* const>(l, name, f);
 
-  // Objects with same type (cv- is concerned) share a common metatable
-  static void push_shared_metatable(luaw& l) {
-    bool first_create = gtouchmetatb(l, std::is_pointer<T>{});
-    // Only build metatable once to improve performance
-    if (first_create) Derived::set_metamethods(l);
-  }
+#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+    Registrar::template do_register_one_getter<volatile Class*,
+                                               volatile Member* const>(
+        l, name, f);
+    Registrar::template do_register_one_getter<const volatile Class*,
+                                               const volatile Member* const>(
+        l, name, f);
+#endif
 
-  static void push_exclusive_metatable(luaw& l) {
-    l.newtable();
-    Derived::set_metamethods(l);
-  }
-};
+    Registrar::template do_register_one_getter<std::shared_ptr<Class>*,
+                                               Member* const>(l, name, f);
+    Registrar::template do_register_one_getter<std::shared_ptr<const Class>*,
+                                               const Member* const>(l, name, f);
 
-}  // namespace luaw_detail
+    Registrar::template do_register_one_getter<const std::shared_ptr<Class>*,
+                                               Member* const>(l, name, f);
+    Registrar::template do_register_one_getter<
+        const std::shared_ptr<const Class>*,
+        const Member* const>(l, name, f);
 
-// T: The (class) type whose member is registered.
-template <typename T>
-struct luaw::metatable_factory<T*>
-    : public luaw_detail::metatable_factory_base<T*,
-                                                 luaw::metatable_factory<T*>> {
-  // No restrict to class only anymore, user can use it if he knows what he is
-  // doing.
-  // static_assert(std::is_class<T>::value,
-  //               "Only class and it's pointer could have metatable");
+    Registrar::template do_register_one_getter<std::unique_ptr<Class>*,
+                                               Member* const>(l, name, f);
+    Registrar::template do_register_one_getter<std::unique_ptr<const Class>*,
+                                               const Member* const>(l, name, f);
 
-  static void set_metamethods(luaw& l) {
-    set_index_to_metatable(l, -1);
-    set_newindex_to_metatable(l, -1);
-  }
+    Registrar::template do_register_one_getter<const std::unique_ptr<Class>*,
+                                               Member* const>(l, name, f);
+    Registrar::template do_register_one_getter<
+        const std::unique_ptr<const Class>*,
+        const Member* const>(l, name, f);
 
-  static void set_index_to_metatable(luaw& l, int idx = -1) {
-    l.setkv("__index", __index, idx);
-  }
+#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+    Registrar::template do_register_one_getter<std::shared_ptr<volatile Class>*,
+                                               volatile Member* const>(
+        l, name, f);
+    Registrar::template do_register_one_getter<
+        std::shared_ptr<const volatile Class>*,
+        const volatile Member* const>(l, name, f);
 
-  static void set_newindex_to_metatable(luaw& l, int idx = -1) {
-    l.setkv("__newindex", __newindex, idx);
-  }
+    Registrar::template do_register_one_getter<
+        const std::shared_ptr<volatile Class>*,
+        volatile Member* const>(l, name, f);
+    Registrar::template do_register_one_getter<
+        const std::shared_ptr<const volatile Class>*,
+        const volatile Member* const>(l, name, f);
 
-  static int __index(lua_State* L) {
-    fakeluaw l(L);
-    PEACALM_LUAW_ASSERT(l.gettop() == 2);
-    void* ti =
-        reinterpret_cast<void*>(const_cast<std::type_info*>(&typeid(T*)));
-    l.pushlightuserdata(ti);
-    l.gettable(LUA_REGISTRYINDEX);
+    Registrar::template do_register_one_getter<std::unique_ptr<volatile Class>*,
+                                               volatile Member* const>(
+        l, name, f);
+    Registrar::template do_register_one_getter<
+        std::unique_ptr<const volatile Class>*,
+        const volatile Member* const>(l, name, f);
 
-    if (!l.istable(-1)) {
-      l.pop();
-      l.pushnil();
-      return 1;
-    }
+    Registrar::template do_register_one_getter<
+        const std::unique_ptr<volatile Class>*,
+        volatile Member* const>(l, name, f);
+    Registrar::template do_register_one_getter<
+        const std::unique_ptr<const volatile Class>*,
+        const volatile Member* const>(l, name, f);
+#endif
+  }
 
-    // member function
-    l.rawgeti(-1, luaw::member_info_fields::member_function);
-    if (!l.istable(-1)) {
-      l.pop();
-    } else {
-      l.pushvalue(2);  // push the key
-      l.rawget(-2);
-      if (!l.isnil(-1)) {  // found
-        return 1;
-      } else {
-        l.pop(2);
-      }
-    }
+  template <typename F>
+  static void register_member_ref(luaw& l, const char* name, F&& f) {
+    PEACALM_LUAW_ASSERT(name);
 
-    // member variable getter
-    l.rawgeti(-1, luaw::member_info_fields::member_getter);
-    if (!l.istable(-1)) {
-      l.pop();
-    } else {
-      l.pushvalue(2);  // push the key
-      l.rawget(-2);
-      if (!l.isnil(-1)) {  // found
-        l.pushvalue(1);    // push the userdata
-        int retcode = l.pcall(1, 1, 0);
-        if (retcode == LUA_OK) {
-          return 1;
-        } else {
-          return lua_error(l.L());  // getter failed
-        }
-      } else {
-        l.pop(2);
-      }
-    }
+    // Member reference should have same low-level cv- property as class
+    // pointer.
 
-    // whether calling nonconst member function by a const object
-    if PEACAML_LUAW_IF_CONSTEXPR (
-        (luaw_detail::is_std_shared_ptr<std::decay_t<T>>::value ||
-         luaw_detail::is_std_unique_ptr<std::decay_t<T>>::value)
-            ? std::is_const<
-                  typename luaw_detail::get_element_type<T>::type>::value
-            : std::is_const<T>::value) {
-      l.rawgeti(-1, luaw::member_info_fields::nonconst_member_function);
-      if (!l.istable(-1)) {
-        l.pop();
-      } else {
-        l.pushvalue(2);  // push the key
-        l.rawget(-2);
-        if (!l.isnil(-1)) {  // found, which is true
-          const char* key = l.to_c_str(2);
-          return luaL_error(l.L(), "Nonconst member function: %s", key);
-        } else {
-          l.pop(2);
-        }
-      }
-    }
+    using Registrar = luaw::registrar<Member Class::*>;
 
-    // whether calling nonvolatile member function by a volatile object
-    if PEACAML_LUAW_IF_CONSTEXPR (
-        (luaw_detail::is_std_shared_ptr<std::decay_t<T>>::value ||
-         luaw_detail::is_std_unique_ptr<std::decay_t<T>>::value)
-            ? std::is_volatile<
-                  typename luaw_detail::get_element_type<T>::type>::value
-            : std::is_volatile<T>::value) {
-      l.rawgeti(-1, luaw::member_info_fields::nonvolatile_member_function);
-      if (!l.istable(-1)) {
-        l.pop();
-      } else {
-        l.pushvalue(2);  // push the key
-        l.rawget(-2);
-        if (!l.isnil(-1)) {  // found, which is true
-          const char* key = l.to_c_str(2);
-          return luaL_error(l.L(), "Nonvolatile member function: %s", key);
-        } else {
-          l.pop(2);
-        }
-      }
-    }
+    Registrar::template do_register_one_getter<Class*,
+                                               const std::shared_ptr<Member>>(
+        l, name, [=](auto& p) {
+          return luaw_detail::mock_shared<Member>(&f(p));
+        });
+    Registrar::template do_register_one_getter<
+        const Class*,
+        const std::shared_ptr<const Member>>(l, name, [=](auto& p) {
+      return luaw_detail::mock_shared<const Member>(&f(p));
+    });
 
-    // dynamic member getter
-    l.rawgeti(-1, luaw::member_info_fields::dynamic_member_getter);
-    if (l.isnil(-1)) {
-      l.pop();
-    } else {
-      l.pushvalue(1);  // push the userdata
-      l.pushvalue(2);  // push the key
-      int retcode = l.pcall(2, 1, 0);
-      if (retcode == LUA_OK) {
-        return 1;
-      } else {
-        return lua_error(l.L());
-      }
-    }
+#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+    Registrar::template do_register_one_getter<
+        volatile Class*,
+        const std::shared_ptr<volatile Member>>(l, name, [=](auto& p) {
+      return luaw_detail::mock_shared<volatile Member>(&f(p));
+    });
+    Registrar::template do_register_one_getter<
+        const volatile Class*,
+        const std::shared_ptr<const volatile Member>>(l, name, [=](auto& p) {
+      return luaw_detail::mock_shared<const volatile Member>(&f(p));
+    });
+#endif
 
-    // not found handler
-    l.pushnil();
-    return 1;
-  }
+    Registrar::template do_register_one_getter<std::shared_ptr<Class>*,
+                                               const std::shared_ptr<Member>>(
+        l, name, [=](auto& p) {
+          return luaw_detail::mock_shared<Member>(&f(p));
+        });
+    Registrar::template do_register_one_getter<
+        std::shared_ptr<const Class>*,
+        const std::shared_ptr<const Member>>(l, name, [=](auto& p) {
+      return luaw_detail::mock_shared<const Member>(&f(p));
+    });
 
-  static int __newindex(lua_State* L) {
-    fakeluaw l(L);
-    PEACALM_LUAW_ASSERT(l.gettop() == 3);
-    void* ti =
-        reinterpret_cast<void*>(const_cast<std::type_info*>(&typeid(T*)));
-    l.pushlightuserdata(ti);
-    l.gettable(LUA_REGISTRYINDEX);
+    Registrar::template do_register_one_getter<const std::shared_ptr<Class>*,
+                                               const std::shared_ptr<Member>>(
+        l, name, [=](auto& p) {
+          return luaw_detail::mock_shared<Member>(&f(p));
+        });
+    Registrar::template do_register_one_getter<
+        const std::shared_ptr<const Class>*,
+        const std::shared_ptr<const Member>>(l, name, [=](auto& p) {
+      return luaw_detail::mock_shared<const Member>(&f(p));
+    });
 
-    if (!l.istable(-1)) {
-      l.pop();
-      const char* key = l.to_c_str(2);
-      return luaL_error(l.L(), "Not found setter: %s", key);
-    }
+    Registrar::template do_register_one_getter<std::unique_ptr<Class>*,
+                                               const std::shared_ptr<Member>>(
+        l, name, [=](auto& p) {
+          return luaw_detail::mock_shared<Member>(&f(p));
+        });
+    Registrar::template do_register_one_getter<
+        std::unique_ptr<const Class>*,
+        const std::shared_ptr<const Member>>(l, name, [=](auto& p) {
+      return luaw_detail::mock_shared<const Member>(&f(p));
+    });
+
+    Registrar::template do_register_one_getter<const std::unique_ptr<Class>*,
+                                               const std::shared_ptr<Member>>(
+        l, name, [=](auto& p) {
+          return luaw_detail::mock_shared<Member>(&f(p));
+        });
+    Registrar::template do_register_one_getter<
+        const std::unique_ptr<const Class>*,
+        const std::shared_ptr<const Member>>(l, name, [=](auto& p) {
+      return luaw_detail::mock_shared<const Member>(&f(p));
+    });
 
-    // member variable setter
-    l.rawgeti(-1, luaw::member_info_fields::member_setter);
-    if (!l.istable(-1)) {
-      l.pop();
-    } else {
-      l.pushvalue(2);  // push the key
-      l.rawget(-2);
-      if (!l.isnil(-1)) {  // found
-        l.pushvalue(1);    // push the userdata
-        l.pushvalue(3);    // push the value
-        int retcode = l.pcall(2, 0, 0);
-        if (retcode == LUA_OK) {
-          return 0;
-        } else {
-          return lua_error(l.L());  // failed
-        }
-      } else {
-        l.pop(2);
-      }
-    }
+#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+    Registrar::template do_register_one_getter<
+        std::shared_ptr<volatile Class>*,
+        const std::shared_ptr<volatile Member>>(l, name, [=](auto& p) {
+      return luaw_detail::mock_shared<volatile Member>(&f(p));
+    });
+    Registrar::template do_register_one_getter<
+        std::shared_ptr<const volatile Class>*,
+        const std::shared_ptr<const volatile Member>>(l, name, [=](auto& p) {
+      return luaw_detail::mock_shared<const volatile Member>(&f(p));
+    });
 
-    // const members
-    l.rawgeti(-1, luaw::member_info_fields::const_member);
-    if (!l.istable(-1)) {
-      l.pop();
-    } else {
-      l.pushvalue(2);  // push the key
-      l.rawget(-2);
-      if (!l.isnil()) {  // found, more it is a bool value true
-        const char* key = l.to_c_str(2);
-        return luaL_error(l.L(), "Const member cannot be modified: %s", key);
-      } else {
-        l.pop(2);
-      }
-    }
+    Registrar::template do_register_one_getter<
+        const std::shared_ptr<volatile Class>*,
+        const std::shared_ptr<volatile Member>>(l, name, [=](auto& p) {
+      return luaw_detail::mock_shared<volatile Member>(&f(p));
+    });
+    Registrar::template do_register_one_getter<
+        const std::shared_ptr<const volatile Class>*,
+        const std::shared_ptr<const volatile Member>>(l, name, [=](auto& p) {
+      return luaw_detail::mock_shared<const volatile Member>(&f(p));
+    });
 
-    // dynamic member setter
-    l.rawgeti(-1, luaw::member_info_fields::dynamic_member_setter);
-    if (l.isnil(-1)) {
-      l.pop();
-    } else if (l.isboolean(-1)) {  // which is false
-      return luaL_error(l.L(), "Cannot set member to const object");
-    } else {
-      l.pushvalue(1);  // push the userdata
-      l.pushvalue(2);  // push the key
-      l.pushvalue(3);  // push the value
-      int retcode = l.pcall(3, 0, 0);
-      if (retcode == LUA_OK) {
-        return 0;
-      } else {
-        return lua_error(l.L());  // failed
-      }
-    }
+    Registrar::template do_register_one_getter<
+        std::unique_ptr<volatile Class>*,
+        const std::shared_ptr<volatile Member>>(l, name, [=](auto& p) {
+      return luaw_detail::mock_shared<volatile Member>(&f(p));
+    });
+    Registrar::template do_register_one_getter<
+        std::unique_ptr<const volatile Class>*,
+        const std::shared_ptr<const volatile Member>>(l, name, [=](auto& p) {
+      return luaw_detail::mock_shared<const volatile Member>(&f(p));
+    });
 
-    // not found handler
-    const char* key = l.to_c_str(2);
-    return luaL_error(l.L(), "Not found setter: %s", key);
+    Registrar::template do_register_one_getter<
+        const std::unique_ptr<volatile Class>*,
+        const std::shared_ptr<volatile Member>>(l, name, [=](auto& p) {
+      return luaw_detail::mock_shared<volatile Member>(&f(p));
+    });
+    Registrar::template do_register_one_getter<
+        const std::unique_ptr<const volatile Class>*,
+        const std::shared_ptr<const volatile Member>>(l, name, [=](auto& p) {
+      return luaw_detail::mock_shared<const volatile Member>(&f(p));
+    });
+#endif
   }
 };
 
-template <typename T, typename>
-struct luaw::metatable_factory
-    : public luaw_detail::metatable_factory_base<T,
-                                                 luaw::metatable_factory<T>> {
-  // No restrict to class only anymore, user can use it if he knows what he is
-  // doing.
-  // static_assert(std::is_class<T>::value,
-  //               "Only class and it's pointer could have metatable");
+/* -------------------------------------------------------------------------- */
+// Registrar specialization for member variables.
+template <typename Class, typename Member>
+struct luaw::registrar<
+    Member Class::*,
+    std::enable_if_t<std::is_member_object_pointer<Member Class::*>::value>> {
+  // register a specific member
+  template <typename F>
+  static void register_member(luaw& l, const char* mname, F&& f) {
+    register_one_getter<Class*>(l, mname, std::forward<F>(f));
+    register_one_getter<const Class*>(l, mname, std::forward<F>(f));
 
-  static void set_metamethods(luaw& l) {
-    luaw::metatable_factory<T*>::set_metamethods(l);
-    if (!std::is_trivially_destructible<T>::value) {
-      set_gc_to_metatable(l, -1);
-    }
-  }
+#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
 
-  static void set_gc_to_metatable(luaw& l, int idx = -1) {
-    l.setkv("__gc", __gc, idx);
-  }
+    register_one_getter<volatile Class*>(l, mname, std::forward<F>(f));
+    register_one_getter<const volatile Class*>(l, mname, std::forward<F>(f));
 
-  static int __gc(lua_State* L) {
-    fakeluaw l(L);
-    PEACALM_LUAW_ASSERT(l.gettop() == 1);
-    T* p = l.to<T*>(1);
-    PEACALM_LUAW_ASSERT(p);
-    p->~T();
-    return 0;
-  }
-};
+#endif
 
-//////////////////// register ctor impl ////////////////////////////////////////
+    // Do not support nested smart pointers, which is meaningless!
+    // DO NOT support top-level volatile for smart pointers!
+    if PEACAML_LUAW_IF_CONSTEXPR (!luaw_detail::is_std_shared_ptr<
+                                      Class>::value &&
+                                  !luaw_detail::is_std_unique_ptr<
+                                      Class>::value) {
+      register_one_getter<std::shared_ptr<Class>*>(
+          l, mname, std::forward<F>(f));
+      register_one_getter<std::shared_ptr<const Class>*>(
+          l, mname, std::forward<F>(f));
 
-template <typename Return, typename... Args>
-struct luaw::register_ctor_impl<Return (*)(Args...)> {
-  static void register_ctor(luaw& l, const char* fname) {
-    auto ctor = [](const Args&... args) -> Return { return Return(args...); };
-    l.set<luaw::function_tag>(fname, ctor);
-  }
-};
+      register_one_getter<const std::shared_ptr<Class>*>(
+          l, mname, std::forward<F>(f));
+      register_one_getter<const std::shared_ptr<const Class>*>(
+          l, mname, std::forward<F>(f));
 
-//////////////////// mock_mem_fn impl //////////////////////////////////////////
+      register_one_getter<std::unique_ptr<Class>*>(
+          l, mname, std::forward<F>(f));
+      register_one_getter<std::unique_ptr<const Class>*>(
+          l, mname, std::forward<F>(f));
 
-namespace luaw_detail {
+      register_one_getter<const std::unique_ptr<Class>*>(
+          l, mname, std::forward<F>(f));
+      register_one_getter<const std::unique_ptr<const Class>*>(
+          l, mname, std::forward<F>(f));
 
-// retrieve_underlying_ptr
+#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+      // for low-level volatile
 
-template <typename T>
-struct __retrieve_underlying_ptr {
-  template <typename U>
-  auto operator()(U&& t) const {
-    return &t;
-  }
-};
-template <typename T>
-struct __retrieve_underlying_ptr<T*> {
-  auto operator()(T* t) const { return t; }
-};
-template <typename T>
-struct __retrieve_underlying_ptr<std::shared_ptr<T>> {
-  auto operator()(const std::shared_ptr<T>& t) const { return t.get(); }
-};
-template <typename T, typename D>
-struct __retrieve_underlying_ptr<std::unique_ptr<T, D>> {
-  auto operator()(const std::unique_ptr<T, D>& t) const { return t.get(); }
-};
+      register_one_getter<std::shared_ptr<volatile Class>*>(
+          l, mname, std::forward<F>(f));
+      register_one_getter<std::shared_ptr<const volatile Class>*>(
+          l, mname, std::forward<F>(f));
 
-template <typename T>
-auto retrieve_underlying_ptr(T&& t) {
-  return __retrieve_underlying_ptr<std::decay_t<T>>{}(std::forward<T>(t));
-}
+      register_one_getter<const std::shared_ptr<volatile Class>*>(
+          l, mname, std::forward<F>(f));
+      register_one_getter<const std::shared_ptr<const volatile Class>*>(
+          l, mname, std::forward<F>(f));
 
-}  // namespace luaw_detail
+      register_one_getter<std::unique_ptr<volatile Class>*>(
+          l, mname, std::forward<F>(f));
+      register_one_getter<std::unique_ptr<const volatile Class>*>(
+          l, mname, std::forward<F>(f));
 
-// The first argument of CallableObject must be raw pointer, and could be
-// `auto*` (in lambda).
-template <typename CallableObject>
-class luaw::mock_mem_fn<
-    CallableObject,
-    std::enable_if_t<!std::is_member_pointer<CallableObject>::value>> {
-  CallableObject o;
+      register_one_getter<const std::unique_ptr<volatile Class>*>(
+          l, mname, std::forward<F>(f));
+      register_one_getter<const std::unique_ptr<const volatile Class>*>(
+          l, mname, std::forward<F>(f));
 
-public:
-  mock_mem_fn(CallableObject&& r) : o(std::forward<CallableObject>(r)) {}
+#endif
+    }
 
-  template <typename FirstArg, typename... Args>
-  decltype(auto) operator()(FirstArg&& f, Args&&... args) const {
-    return o(luaw_detail::retrieve_underlying_ptr(std::forward<FirstArg>(f)),
-             std::forward<Args>(args)...);
+    __register_setters(l, mname, std::forward<F>(f), std::is_const<Member>{});
   }
-};
-
-template <typename MemberPointer>
-class luaw::mock_mem_fn<
-    MemberPointer,
-    std::enable_if_t<std::is_member_pointer<MemberPointer>::value>> {
-  decltype(std::mem_fn(static_cast<MemberPointer>(nullptr))) o;
-
-public:
-  mock_mem_fn(MemberPointer p) : o(std::mem_fn(p)) {}
 
-  template <typename FirstArg, typename... Args>
-  decltype(auto) operator()(FirstArg&& f, Args&&... args) const {
-    return o(luaw_detail::retrieve_underlying_ptr(std::forward<FirstArg>(f)),
-             std::forward<Args>(args)...);
-  };
-};
+  // Register a member getter for `ObjectPointer`, the member's type is same cv-
+  // qualifed with object on `Member`.
+  template <typename ObjectPointer, typename F>
+  static void register_one_getter(luaw& l, const char* mname, F&& f) {
+    static_assert(std::is_pointer<ObjectPointer>::value,
+                  "ObjectPointer should be a pointer type");
 
-//////////////////// static_mem_fn impl ////////////////////////////////////////
+    // To add same cv- property on Member as Object
+    using O = luaw_detail::remove_ptr_or_smart_ptr_t<
+        std::remove_pointer_t<ObjectPointer>>;
+    using M0 = Member;
+    using M1 = std::conditional_t<std::is_volatile<O>::value, volatile M0, M0>;
+    using M2 = std::conditional_t<std::is_const<O>::value, const M1, M1>;
 
-// specialize for C function pointer
-template <typename T>
-class luaw::static_mem_fn<T*, std::enable_if_t<std::is_function<T>::value>> {
-  T* f;
+    do_register_one_getter<ObjectPointer, M2, F>(l, mname, std::forward<F>(f));
+  }
 
-public:
-  static_mem_fn(T* t) : f(t) {
-    // Can't be null ptr, since we're required to call the function ptr
-    PEACALM_LUAW_ASSERT(f);
+  // Register a member getter for `ObjectPointer`, the member's type is
+  // `CVPossibleMember`.
+  template <typename ObjectPointer, typename CVPossibleMember, typename F>
+  static void do_register_one_getter(luaw& l, const char* mname, F&& f) {
+    static_assert(std::is_pointer<ObjectPointer>::value,
+                  "ObjectPointer should be a pointer type");
+    // The getter will return a copy of the member with type `CVPossibleMember`
+    // which is a type maybe possibly cv- qualified on `Member`. And it should
+    // have same cv- property with `ObjectPointer`'s low-level cv- property.
+    //
+    // The type `Member` maybe the member's real type, or could be sepcified by
+    // `Hint` and it could be different with the member's real type, but it must
+    // be convertible from the real type to this target member type.
+    // Thus, it enables us to register a member to another type in Lua, e.g.
+    // register a non-const member as a const member in Lua, or register a
+    // integer member as a boolean member in Lua, etc.
+    using G = std::decay_t<F>;
+    void* p = reinterpret_cast<void*>(
+        const_cast<std::type_info*>(&typeid(ObjectPointer)));
+    l.touchtb(p, LUA_REGISTRYINDEX)
+        .touchtb(luaw::member_info_fields::member_index)
+        .newtable();
+    l.pushcfunction(member_getter<ObjectPointer, CVPossibleMember, G>);
+    l.rawseti(-2, luaw::accessor_function);
+    push_accessor_data<G>(l, f);
+    l.rawseti(-2, luaw::accessor_data);
+    luaw::put_member_entry(l.L(), mname);
+    l.pop(2);
   }
 
-  template <typename Class, typename... Args>
-  decltype(auto) operator()(Class&&, Args&&... args) const {
-    return f(std::forward<Args>(args)...);
+private:
+  // Push a copy of "f" as a full userdata, destroyed by gc if needed.
+  template <typename G>
+  static void push_accessor_data(luaw& l, const G& f) {
+    new (l.newuserdata(sizeof(G))) G(f);
+    if (!std::is_trivially_destructible<G>::value) {
+      luaw::lua_cfunction_t gc = [](lua_State* L) -> int {
+        static_cast<G*>(lua_touserdata(L, 1))->~G();
+        return 0;
+      };
+      l.newtable();
+      l.pushcfunction(gc);
+      l.setfield(-2, "__gc");
+      l.setmetatable(-2);
+    }
   }
-};
 
-// specialize for C variable pointer
-template <typename T>
-class luaw::static_mem_fn<T*, std::enable_if_t<!std::is_function<T>::value>> {
-  T* m;
+  // Accessors called directly by __index and __newindex, without a protected
+  // call. The object is at index 1, the value to set is at index 3, and the
+  // accessor data is on top of stack.
 
-public:
-  static_mem_fn(T* t) : m(t) {
-    // Can't be null ptr, since we're required to dereference the ptr
-    PEACALM_LUAW_ASSERT(m);
+  template <typename ObjectPointer, typename CVPossibleMember, typename G>
+  static int member_getter(lua_State* L) {
+    auto o = reinterpret_cast<ObjectPointer>(lua_touserdata(L, 1));
+    PEACALM_LUAW_ASSERT(o);
+    auto p = luaw_detail::retrieve_underlying_ptr(*o);
+    if (!p) return luaL_error(L, "Getting member by empty smart ptr.");
+    G&       g = *static_cast<G*>(lua_touserdata(L, -1));
+    fakeluaw l(L);
+    return luaw::pusher_for_return<std::decay_t<CVPossibleMember>>::push(
+        l, static_cast<CVPossibleMember>(g(*p)));
+  }
+
+  template <typename ObjectPointer, typename G>
+  static int member_setter(lua_State* L) {
+    auto o = reinterpret_cast<ObjectPointer>(lua_touserdata(L, 1));
+    PEACALM_LUAW_ASSERT(o);
+    auto p = luaw_detail::retrieve_underlying_ptr(*o);
+    if (!p) return luaL_error(L, "Setting member by empty smart ptr.");
+    G&   g = *static_cast<G*>(lua_touserdata(L, -1));
+    bool failed;
+    {
+      fakeluaw l(L);
+      auto     v = l.to<std::decay_t<Member>>(3, false, &failed);
+      if (!failed) g(*p) = std::move(v);
+    }
+    // Raise error after the converted value destructed
+    if (failed) return luaL_error(L, "The 2th argument conversion failed");
+    return 0;
   }
 
-  template <typename Class>
-  T& operator()(Class&&) const {
-    return *m;
+  template <typename ObjectPointer, typename F>
+  static void register_one_setter(luaw& l, const char* mname, F&& f) {
+    using G = std::decay_t<F>;
+    void* p = reinterpret_cast<void*>(
+        const_cast<std::type_info*>(&typeid(ObjectPointer)));
+    l.touchtb(p, LUA_REGISTRYINDEX)
+        .touchtb(luaw::member_info_fields::member_newindex)
+        .newtable();
+    l.pushcfunction(member_setter<ObjectPointer, G>);
+    l.rawseti(-2, luaw::accessor_function);
+    push_accessor_data<G>(l, f);
+    l.rawseti(-2, luaw::accessor_data);
+    luaw::put_member_entry(l.L(), mname);
+    l.pop(2);
   }
-};
-
-//////////////////// registrar impl ////////////////////////////////////////////
 
-template <typename Getter>
-void luaw::register_dynamic_member_getter(Getter&& getter) {
-  luaw::registrar<luaw_detail::detect_callable_cfunction_t<Getter>>::
-      register_dynamic_member_getter(
-          *this, luaw::mock_mem_fn<Getter>(std::forward<Getter>(getter)));
-}
+  template <typename ObjectType>
+  static void __register_const_member(luaw& l, const char* mname) {
+    auto  _g = l.make_guarder();
+    void* p  = reinterpret_cast<void*>(
+        const_cast<std::type_info*>(&typeid(ObjectType)));
+    l.touchtb(p, LUA_REGISTRYINDEX)
+        .touchtb(luaw::member_info_fields::member_newindex)
+        .push(true);
+    luaw::put_member_entry(l.L(), mname);
+  }
 
-template <typename Setter>
-void luaw::register_dynamic_member_setter(Setter&& setter) {
-  luaw::registrar<luaw_detail::detect_callable_cfunction_t<Setter>>::
-      register_dynamic_member_setter(
-          *this, luaw::mock_mem_fn<Setter>(std::forward<Setter>(setter)));
-}
+  // Member is const
+  template <typename F>
+  static void __register_setters(luaw&       l,
+                                 const char* mname,
+                                 F&&         f,
+                                 std::true_type) {
+    __register_const_member<Class*>(l, mname);
+    __register_const_member<const Class*>(l, mname);
 
-// Support nothing in this basic registrar.
-// Supported features should be specialized elsewhere.
-template <typename T, typename>
-struct luaw::registrar {
-  // Explicitly delete the member functions to let compile fail for unsupported
-  // member types, such as ref- qualified member functions, or C style variadic
-  // functions.
+#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
 
-  template <typename MemberFunction>
-  static void register_member(luaw&          l,
-                              const char*    fname,
-                              MemberFunction mf) = delete;
+    __register_const_member<volatile Class*>(l, mname);
+    __register_const_member<const volatile Class*>(l, mname);
 
-  template <typename Getter>
-  static void register_dynamic_member_getter(luaw& l, Getter&& getter) = delete;
+#endif
 
-  template <typename Setter>
-  static void register_dynamic_member_setter(luaw& l, Setter&& setter) = delete;
+    // Do not support nested smart pointers, which is meaningless!
+    // DO NOT support top-level volatile for smart pointers!
+    if PEACAML_LUAW_IF_CONSTEXPR (!luaw_detail::is_std_shared_ptr<
+                                      Class>::value &&
+                                  !luaw_detail::is_std_unique_ptr<
+                                      Class>::value) {
+      __register_const_member<std::shared_ptr<Class>*>(l, mname);
+      __register_const_member<std::shared_ptr<const Class>*>(l, mname);
+      __register_const_member<const std::shared_ptr<Class>*>(l, mname);
+      __register_const_member<const std::shared_ptr<const Class>*>(l, mname);
 
-  template <typename F>
-  static void register_member_ptr(luaw& l, const char* name, F&& f) = delete;
+      __register_const_member<std::unique_ptr<Class>*>(l, mname);
+      __register_const_member<std::unique_ptr<const Class>*>(l, mname);
+      __register_const_member<const std::unique_ptr<Class>*>(l, mname);
+      __register_const_member<const std::unique_ptr<const Class>*>(l, mname);
 
-  template <typename F>
-  static void register_member_ref(luaw& l, const char* name, F&& f) = delete;
-};
+#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+      // for low-level volatile:
 
-/* -------------------------------------------------------------------------- */
-// Registrar specialization for dynamic member getter.
-template <typename Member, typename Class, typename Key>
-struct luaw::registrar<Member (*)(Class*, Key)> {
-  static_assert(std::is_class<Class>::value && std::is_const<Class>::value,
-                "First argument should be pointer of const class");
-  using DecayClass = std::remove_cv_t<Class>;
-  static_assert(std::is_same<DecayClass, std::decay_t<Class>>::value,
-                "Never happen");
+      __register_const_member<std::shared_ptr<volatile Class>*>(l, mname);
+      __register_const_member<std::shared_ptr<const volatile Class>*>(l, mname);
+      __register_const_member<const std::shared_ptr<volatile Class>*>(l, mname);
+      __register_const_member<const std::shared_ptr<const volatile Class>*>(
+          l, mname);
 
-#define REGISTER_GETTER(ObjectType)                          \
-  l.touchtb((void*)(&typeid(ObjectType)), LUA_REGISTRYINDEX) \
-      .setkv<Member (*)(Class*, Key)>(                       \
-          luaw::member_info_fields::dynamic_member_getter, getter);
+      __register_const_member<std::unique_ptr<volatile Class>*>(l, mname);
+      __register_const_member<std::unique_ptr<const volatile Class>*>(l, mname);
+      __register_const_member<const std::unique_ptr<volatile Class>*>(l, mname);
+      __register_const_member<const std::unique_ptr<const volatile Class>*>(
+          l, mname);
 
-#define REGISTER_SMART_GETTER(ObjectType)                                      \
-  l.touchtb((void*)(&typeid(ObjectType)), LUA_REGISTRYINDEX)                   \
-      .setkv<Member (*)(ObjectType, Key)>(                                     \
-          luaw::member_info_fields::dynamic_member_getter,                     \
-          [=, &l](ObjectType o, Key k) -> Member {                             \
-            PEACALM_LUAW_ASSERT(o);                                            \
-            auto p = luaw_detail::retrieve_underlying_ptr(*o);                 \
-            if (!p) {                                                          \
-              luaL_error(l.L(), "Getting dynamic member by empty smart ptr."); \
-              /* Never runs here */                                            \
-              PEACALM_LUAW_ASSERT(false);                                      \
-            }                                                                  \
-            return getter(*p, k);                                              \
-          });
+#endif
+    }
+  }
 
-  template <typename Getter>
-  static void register_dynamic_member_getter(luaw& l, Getter&& getter) {
-    auto _g = l.make_guarder();
+  // Member is not const
+  template <typename F>
+  static void __register_setters(luaw&       l,
+                                 const char* mname,
+                                 F&&         f,
+                                 std::false_type) {
+#define DEFINE_SETTER(ObjectType) register_one_setter<ObjectType>(l, mname, f)
 
-    REGISTER_GETTER(DecayClass*);
-    REGISTER_GETTER(const DecayClass*);
+    DEFINE_SETTER(Class*);
+    // the object is const, so member is const
+    __register_const_member<const Class*>(l, mname);
 
 #if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
 
-    if PEACAML_LUAW_IF_CONSTEXPR (std::is_volatile<Class>::value) {
-      REGISTER_GETTER(volatile DecayClass*);
-      REGISTER_GETTER(const volatile DecayClass*);
-    }
+    DEFINE_SETTER(volatile Class*);
+    __register_const_member<const volatile Class*>(l, mname);
 
 #endif
 
     // Do not support nested smart pointers, which is meaningless!
     // DO NOT support top-level volatile for smart pointers!
     if PEACAML_LUAW_IF_CONSTEXPR (!luaw_detail::is_std_shared_ptr<
-                                      DecayClass>::value &&
+                                      Class>::value &&
                                   !luaw_detail::is_std_unique_ptr<
-                                      DecayClass>::value) {
-      REGISTER_SMART_GETTER(std::shared_ptr<DecayClass>*);
-      REGISTER_SMART_GETTER(const std::shared_ptr<DecayClass>*);
-      REGISTER_SMART_GETTER(std::shared_ptr<const DecayClass>*);
-      REGISTER_SMART_GETTER(const std::shared_ptr<const DecayClass>*);
+                                      Class>::value) {
+      DEFINE_SETTER(std::shared_ptr<Class>*);
+      DEFINE_SETTER(const std::shared_ptr<Class>*);
+      __register_const_member<std::shared_ptr<const Class>*>(l, mname);
+      __register_const_member<const std::shared_ptr<const Class>*>(l, mname);
 
-      REGISTER_SMART_GETTER(std::unique_ptr<DecayClass>*);
-      REGISTER_SMART_GETTER(const std::unique_ptr<DecayClass>*);
-      REGISTER_SMART_GETTER(std::unique_ptr<const DecayClass>*);
-      REGISTER_SMART_GETTER(const std::unique_ptr<const DecayClass>*);
+      DEFINE_SETTER(std::unique_ptr<Class>*);
+      DEFINE_SETTER(const std::unique_ptr<Class>*);
+      __register_const_member<std::unique_ptr<const Class>*>(l, mname);
+      __register_const_member<const std::unique_ptr<const Class>*>(l, mname);
 
 #if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+      // for low-level volatile
 
-      // for low-level volatile:
-      __register_dynamic_member_getter_for_volatile(
-          l, std::forward<Getter>(getter), std::is_volatile<Class>{});
+      DEFINE_SETTER(std::shared_ptr<volatile Class>*);
+      DEFINE_SETTER(const std::shared_ptr<volatile Class>*);
+      __register_const_member<std::shared_ptr<const volatile Class>*>(l, mname);
+      __register_const_member<const std::shared_ptr<const volatile Class>*>(
+          l, mname);
+
+      DEFINE_SETTER(std::unique_ptr<volatile Class>*);
+      DEFINE_SETTER(const std::unique_ptr<volatile Class>*);
+      __register_const_member<std::unique_ptr<const volatile Class>*>(l, mname);
+      __register_const_member<const std::unique_ptr<const volatile Class>*>(
+          l, mname);
 
 #endif
     }
-  }
-
-  template <typename Getter>
-  static void __register_dynamic_member_getter_for_volatile(luaw&    l,
-                                                            Getter&& getter,
-                                                            std::true_type) {
-    auto _g = l.make_guarder();
-
-    REGISTER_SMART_GETTER(std::shared_ptr<volatile DecayClass>*);
-    REGISTER_SMART_GETTER(const std::shared_ptr<volatile DecayClass>*);
-    REGISTER_SMART_GETTER(std::shared_ptr<const volatile DecayClass>*);
-    REGISTER_SMART_GETTER(const std::shared_ptr<const volatile DecayClass>*);
-
-    REGISTER_SMART_GETTER(std::unique_ptr<volatile DecayClass>*);
-    REGISTER_SMART_GETTER(const std::unique_ptr<volatile DecayClass>*);
-    REGISTER_SMART_GETTER(std::unique_ptr<const volatile DecayClass>*);
-    REGISTER_SMART_GETTER(const std::unique_ptr<const volatile DecayClass>*);
-  }
 
-  template <typename Getter>
-  static void __register_dynamic_member_getter_for_volatile(luaw&    l,
-                                                            Getter&& getter,
-                                                            std::false_type) {
-    // Do nothing.
-    // Since the getter user provided cannot be used for volatile objects.
-    // We donot make unnecessary troubles.
+#undef DEFINE_SETTER
   }
-
-#undef REGISTER_SMART_GETTER
-#undef REGISTER_GETTER
 };
 
 /* -------------------------------------------------------------------------- */
-// Registrar specialization for dynamic member setter.
-template <typename Class, typename Key, typename Member>
-struct luaw::registrar<void (*)(Class*, Key, Member)> {
-  static_assert(std::is_class<Class>::value && !std::is_const<Class>::value,
-                "First argument should be pointer of non-const class");
-  using DecayClass = std::remove_cv_t<Class>;
-  static_assert(std::is_same<DecayClass, std::decay_t<Class>>::value,
-                "Never happen");
+// Registrar specialization for member functions.
+// @{
 
-#define REGISTER_SETTER(ObjectType)                          \
-  l.touchtb((void*)(&typeid(ObjectType)), LUA_REGISTRYINDEX) \
-      .setkv<void (*)(Class*, Key, Member)>(                 \
-          luaw::member_info_fields::dynamic_member_setter, setter);
+template <typename Class, typename Return, typename... Args>
+struct luaw::registrar<Return (Class::*)(Args...)> {
+  // implementations
 
-#define REGISTER_SMART_SETTER(ObjectType)                                      \
-  l.touchtb((void*)(&typeid(ObjectType)), LUA_REGISTRYINDEX)                   \
-      .setkv<void (*)(ObjectType, Key, Member)>(                               \
-          luaw::member_info_fields::dynamic_member_setter,                     \
-          [=, &l](ObjectType o, Key k, Member v) {                             \
-            PEACALM_LUAW_ASSERT(o);                                            \
-            auto p = luaw_detail::retrieve_underlying_ptr(*o);                 \
-            if (!p) {                                                          \
-              luaL_error(l.L(), "Setting dynamic member by empty smart ptr."); \
-              /* Never runs here */                                            \
-              PEACALM_LUAW_ASSERT(false);                                      \
-            }                                                                  \
-            setter(*p, k, v);                                                  \
-          });
+  template <typename ObjectType, typename MemberFunction>
+  static void register_member_function(luaw&            l,
+                                       const char*      fname,
+                                       MemberFunction&& mf) {
+    // Not capture "l", the function may be installed into other states by
+    // class_binding. Null objects fail at argument conversion.
+    auto f = [mf](luaw_detail::object_arg<ObjectType> a,
+                  Args... args) -> Return {
+      PEACALM_LUAW_ASSERT(a.o);
+      return mf(*a.o, std::move(args)...);
+    };
 
-#define REGISTER_SETTER_OF_CONST(ObjectType)                 \
-  l.touchtb((void*)(&typeid(ObjectType)), LUA_REGISTRYINDEX) \
-      .setkv(luaw::member_info_fields::dynamic_member_setter, false);
+    void* p = reinterpret_cast<void*>(
+        const_cast<std::type_info*>(&typeid(ObjectType)));
+    l.touchtb(p, LUA_REGISTRYINDEX)
+        .touchtb(luaw::member_info_fields::member_index)
+        .push<luaw::function_tag>(f);
+    luaw::put_member_entry(l.L(), fname);
+    l.pop(2);
+  }
+
+  template <typename ObjectType>
+  static void register_nonconst_member_function(luaw& l, const char* fname) {
+    void* p = reinterpret_cast<void*>(
+        const_cast<std::type_info*>(&typeid(ObjectType)));
+    l.touchtb(p, LUA_REGISTRYINDEX)
+        .touchtb(luaw::member_info_fields::member_index)
+        .push(static_cast<int>(luaw::nonconst_member_function_tag));
+    luaw::put_member_entry(l.L(), fname);
+    l.pop(2);
+  }
 
-  template <typename Setter>
-  static void register_dynamic_member_setter(luaw& l, Setter&& setter) {
-    auto _g = l.make_guarder();
+  template <typename ObjectType>
+  static void register_nonvolatile_member_function(luaw& l, const char* fname) {
+    void* p = reinterpret_cast<void*>(
+        const_cast<std::type_info*>(&typeid(ObjectType)));
+    l.touchtb(p, LUA_REGISTRYINDEX)
+        .touchtb(luaw::member_info_fields::member_index)
+        .push(static_cast<int>(luaw::nonvolatile_member_function_tag));
+    luaw::put_member_entry(l.L(), fname);
+    l.pop(2);
+  }
 
-    REGISTER_SETTER(DecayClass*);
-    REGISTER_SETTER_OF_CONST(const DecayClass*);
+  // no cv- member functions
+  template <typename MemberFunction>
+  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
+    register_member_function<Class*>(l, fname, mf);
+    register_nonconst_member_function<const Class*>(l, fname);
 
 #if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
 
-    if PEACAML_LUAW_IF_CONSTEXPR (std::is_volatile<Class>::value) {
-      REGISTER_SETTER(volatile DecayClass*);
-      REGISTER_SETTER_OF_CONST(const volatile DecayClass*);
-    }
+    register_nonvolatile_member_function<volatile Class*>(l, fname);
+    register_nonconst_member_function<const volatile Class*>(l, fname);
+    register_nonvolatile_member_function<const volatile Class*>(l, fname);
 
 #endif
 
@@ -5322,1075 +10269,2032 @@ struct luaw::registrar<void (*)(Class*, Key, Member)> {
                                       Class>::value &&
                                   !luaw_detail::is_std_unique_ptr<
                                       Class>::value) {
-      REGISTER_SMART_SETTER(std::shared_ptr<DecayClass>*);
-      REGISTER_SMART_SETTER(const std::shared_ptr<DecayClass>*);
+      register_member_function<std::shared_ptr<Class>*>(l, fname, mf);
+      register_member_function<const std::shared_ptr<Class>*>(l, fname, mf);
 
-      REGISTER_SETTER_OF_CONST(std::shared_ptr<const DecayClass>*);
-      REGISTER_SETTER_OF_CONST(const std::shared_ptr<const DecayClass>*);
+      register_nonconst_member_function<std::shared_ptr<const Class>*>(l,
+                                                                       fname);
+      register_nonconst_member_function<const std::shared_ptr<const Class>*>(
+          l, fname);
 
-      REGISTER_SMART_SETTER(std::unique_ptr<DecayClass>*);
-      REGISTER_SMART_SETTER(const std::unique_ptr<DecayClass>*);
+      register_member_function<std::unique_ptr<Class>*>(l, fname, mf);
+      register_member_function<const std::unique_ptr<Class>*>(l, fname, mf);
 
-      REGISTER_SETTER_OF_CONST(std::unique_ptr<const DecayClass>*);
-      REGISTER_SETTER_OF_CONST(const std::unique_ptr<const DecayClass>*);
+      register_nonconst_member_function<std::unique_ptr<const Class>*>(l,
+                                                                       fname);
+      register_nonconst_member_function<const std::unique_ptr<const Class>*>(
+          l, fname);
 
 #if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+      // for low-level volatile
 
-      // for low-level volatile:
-      __register_dynamic_member_setter_for_volatile(
-          l, std::forward<Setter>(setter), std::is_volatile<Class>{});
-
-#endif
-    }
-  }
+      register_nonvolatile_member_function<std::shared_ptr<volatile Class>*>(
+          l, fname);
+      register_nonvolatile_member_function<
+          const std::shared_ptr<volatile Class>*>(l, fname);
 
-  template <typename Setter>
-  static void __register_dynamic_member_setter_for_volatile(luaw&    l,
-                                                            Setter&& setter,
-                                                            std::true_type) {
-    auto _g = l.make_guarder();
+      register_nonconst_member_function<std::shared_ptr<const volatile Class>*>(
+          l, fname);
+      register_nonconst_member_function<
+          const std::shared_ptr<const volatile Class>*>(l, fname);
 
-    REGISTER_SMART_SETTER(std::shared_ptr<volatile DecayClass>*);
-    REGISTER_SMART_SETTER(const std::shared_ptr<volatile DecayClass>*);
+      register_nonvolatile_member_function<
+          std::shared_ptr<const volatile Class>*>(l, fname);
+      register_nonvolatile_member_function<
+          const std::shared_ptr<const volatile Class>*>(l, fname);
 
-    REGISTER_SETTER_OF_CONST(std::shared_ptr<const volatile DecayClass>*);
-    REGISTER_SETTER_OF_CONST(const std::shared_ptr<const volatile DecayClass>*);
+      register_nonvolatile_member_function<std::unique_ptr<volatile Class>*>(
+          l, fname);
+      register_nonvolatile_member_function<
+          const std::unique_ptr<volatile Class>*>(l, fname);
 
-    REGISTER_SMART_SETTER(std::unique_ptr<volatile DecayClass>*);
-    REGISTER_SMART_SETTER(const std::unique_ptr<volatile DecayClass>*);
+      register_nonconst_member_function<std::unique_ptr<const volatile Class>*>(
+          l, fname);
+      register_nonconst_member_function<
+          const std::unique_ptr<const volatile Class>*>(l, fname);
 
-    REGISTER_SETTER_OF_CONST(std::unique_ptr<const volatile DecayClass>*);
-    REGISTER_SETTER_OF_CONST(const std::unique_ptr<const volatile DecayClass>*);
-  }
+      register_nonvolatile_member_function<
+          std::unique_ptr<const volatile Class>*>(l, fname);
+      register_nonvolatile_member_function<
+          const std::unique_ptr<const volatile Class>*>(l, fname);
 
-  template <typename Setter>
-  static void __register_dynamic_member_setter_for_volatile(luaw&    l,
-                                                            Setter&& setter,
-                                                            std::false_type) {
-    // Do nothing.
-    // Since the setter user provided cannot be used for volatile objects.
-    // We donot make unnecessary troubles.
+#endif
+    }
   }
-
-#undef REGISTER_SETTER_OF_CONST
-#undef REGISTER_SMART_SETTER
-#undef REGISTER_SETTER
 };
 
-/* -------------------------------------------------------------------------- */
-// Make wrapper for raw pointer.
-
-namespace luaw_detail {
-
-// A mock allocator to support volatile
-template <typename T>
-struct allocator {
-  using value_type = T;
-  using size_type  = std::size_t;
+template <typename Class, typename Return, typename... Args>
+struct luaw::registrar<Return (Class::*)(Args...) const> {
+  template <typename MemberFunction>
+  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
+    using Basic = luaw::registrar<Return (Class::*)(Args...)>;
 
-  allocator() = default;
+    Basic::template register_member_function<Class*>(l, fname, mf);
+    Basic::template register_member_function<const Class*>(l, fname, mf);
 
-  template <typename U>
-  allocator(const allocator<U>& r) {}
+#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
 
-  value_type* allocate(size_type n) {
-    if (n == 0) { return nullptr; }
-    if (n > max_size()) { throw std::bad_array_new_length(); }
-    void* const p = ::operator new(n * sizeof(value_type));
-    if (!p) { throw std::bad_alloc(); }
-    return static_cast<value_type*>(p);
-  }
+    Basic::template register_nonvolatile_member_function<volatile Class*>(
+        l, fname);
+    Basic::template register_nonvolatile_member_function<const volatile Class*>(
+        l, fname);
 
-  void deallocate(const value_type* p, size_type n) {
-    return ::operator delete((void*)(p));
-  }
+#endif
 
-  size_type max_size() const { return size_type(~0) / sizeof(T); }
-};
+    // Do not support nested smart pointers, which is meaningless!
+    // DO NOT support top-level volatile for smart pointers!
+    if PEACAML_LUAW_IF_CONSTEXPR (!luaw_detail::is_std_shared_ptr<
+                                      Class>::value &&
+                                  !luaw_detail::is_std_unique_ptr<
+                                      Class>::value) {
+      Basic::template register_member_function<std::shared_ptr<Class>*>(
+          l, fname, mf);
+      Basic::template register_member_function<const std::shared_ptr<Class>*>(
+          l, fname, mf);
+      Basic::template register_member_function<std::shared_ptr<const Class>*>(
+          l, fname, mf);
+      Basic::template register_member_function<
+          const std::shared_ptr<const Class>*>(l, fname, mf);
 
-// To make a shared_ptr with a given pointer,
-// but never deletes the given pointer,
-// and uses an allocator who supports volatile.
-template <typename T>
-std::shared_ptr<T> mock_shared(T* p) {
-  return std::shared_ptr<T>(
-      p, [](...) {}, allocator<T>{});
-}
+      Basic::template register_member_function<std::unique_ptr<Class>*>(
+          l, fname, mf);
+      Basic::template register_member_function<const std::unique_ptr<Class>*>(
+          l, fname, mf);
+      Basic::template register_member_function<std::unique_ptr<const Class>*>(
+          l, fname, mf);
+      Basic::template register_member_function<
+          const std::unique_ptr<const Class>*>(l, fname, mf);
 
-}  // namespace luaw_detail
+#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+      // for low-level volatile
 
-// Make a wrapper for a raw pointer.
-// Thus the wrapped pointer will be a full userdata in Lua, not light userdata.
-template <typename T>
-luaw::ptrw<T> luaw::make_ptrw(T* p) {
-  static_assert(!luaw_detail::is_std_shared_ptr<std::decay_t<T>>::value &&
-                    !luaw_detail::is_std_unique_ptr<std::decay_t<T>>::value,
-                "No need to make wrapper for smart pointers");
-  return luaw_detail::mock_shared<T>(p);
-}
+      Basic::template register_nonvolatile_member_function<
+          std::shared_ptr<volatile Class>*>(l, fname);
+      Basic::template register_nonvolatile_member_function<
+          const std::shared_ptr<volatile Class>*>(l, fname);
+      Basic::template register_nonvolatile_member_function<
+          std::shared_ptr<const volatile Class>*>(l, fname);
+      Basic::template register_nonvolatile_member_function<
+          const std::shared_ptr<const volatile Class>*>(l, fname);
 
-/* -------------------------------------------------------------------------- */
-// Registrar specialization for register_member_ptr and register_member_ref.
-template <typename Class, typename Member>
-struct luaw::registrar<Member Class::*, luaw::registrar_tag_for_member_ptr> {
-  static_assert(std::is_member_object_pointer<Member Class::*>::value,
-                "Only member variables can be registered ptr/ref");
+      Basic::template register_nonvolatile_member_function<
+          std::unique_ptr<volatile Class>*>(l, fname);
+      Basic::template register_nonvolatile_member_function<
+          const std::unique_ptr<volatile Class>*>(l, fname);
+      Basic::template register_nonvolatile_member_function<
+          std::unique_ptr<const volatile Class>*>(l, fname);
+      Basic::template register_nonvolatile_member_function<
+          const std::unique_ptr<const volatile Class>*>(l, fname);
 
-  // Actually this static assertion won't work.
-  // C++ regards "Member cv-Class::*" as a same type as "Member Class::*".
-  // And the compiler will automatically remove cv- property for Class.
-  static_assert(std::is_same<Class, std::decay_t<Class>>::value,
-                "Never happen (Class must be decayed)");
+#endif
+    }
+  }
+};
 
-  static_assert(!std::is_pointer<Member>::value,
-                "No need to register pointer or reference for pointer members");
-  static_assert(
-      !luaw_detail::is_std_shared_ptr<std::decay_t<Member>>::value &&
-          !luaw_detail::is_std_unique_ptr<std::decay_t<Member>>::value,
-      "No need to register pointer or reference for smart pointer members");
+template <typename Class, typename Return, typename... Args>
+struct luaw::registrar<Return (Class::*)(Args...) volatile> {
+  template <typename MemberFunction>
+  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
+    using Basic = luaw::registrar<Return (Class::*)(Args...)>;
 
-  template <typename F>
-  static void register_member_ptr(luaw& l, const char* name, F&& f) {
-    // Member pointer should have same low-level cv- property as class pointer.
+    Basic::template register_member_function<Class*>(l, fname, mf);
+    Basic::template register_nonconst_member_function<const Class*>(l, fname);
 
-    using Registrar = luaw::registrar<Member Class::*>;
+#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
 
-    Registrar::template do_register_one_getter<Class*, Member* const>(
-        l, name, f);
-    Registrar::template do_register_one_getter<const Class*,
-                                               const Member* const>(l, name, f);
+    Basic::template register_member_function<volatile Class*>(l, fname, mf);
+    Basic::template register_nonconst_member_function<const volatile Class*>(
+        l, fname);
 
-#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
-    Registrar::template do_register_one_getter<volatile Class*,
-                                               volatile Member* const>(
-        l, name, f);
-    Registrar::template do_register_one_getter<const volatile Class*,
-                                               const volatile Member* const>(
-        l, name, f);
 #endif
 
-    Registrar::template do_register_one_getter<std::shared_ptr<Class>*,
-                                               Member* const>(l, name, f);
-    Registrar::template do_register_one_getter<std::shared_ptr<const Class>*,
-                                               const Member* const>(l, name, f);
+    // Do not support nested smart pointers, which is meaningless!
+    // DO NOT support top-level volatile for smart pointers!
+    if PEACAML_LUAW_IF_CONSTEXPR (!luaw_detail::is_std_shared_ptr<
+                                      Class>::value &&
+                                  !luaw_detail::is_std_unique_ptr<
+                                      Class>::value) {
+      Basic::template register_member_function<std::shared_ptr<Class>*>(
+          l, fname, mf);
+      Basic::template register_member_function<const std::shared_ptr<Class>*>(
+          l, fname, mf);
 
-    Registrar::template do_register_one_getter<const std::shared_ptr<Class>*,
-                                               Member* const>(l, name, f);
-    Registrar::template do_register_one_getter<
-        const std::shared_ptr<const Class>*,
-        const Member* const>(l, name, f);
+      Basic::template register_nonconst_member_function<
+          std::shared_ptr<const Class>*>(l, fname);
+      Basic::template register_nonconst_member_function<
+          const std::shared_ptr<const Class>*>(l, fname);
 
-    Registrar::template do_register_one_getter<std::unique_ptr<Class>*,
-                                               Member* const>(l, name, f);
-    Registrar::template do_register_one_getter<std::unique_ptr<const Class>*,
-                                               const Member* const>(l, name, f);
+      Basic::template register_member_function<std::unique_ptr<Class>*>(
+          l, fname, mf);
+      Basic::template register_member_function<const std::unique_ptr<Class>*>(
+          l, fname, mf);
 
-    Registrar::template do_register_one_getter<const std::unique_ptr<Class>*,
-                                               Member* const>(l, name, f);
-    Registrar::template do_register_one_getter<
-        const std::unique_ptr<const Class>*,
-        const Member* const>(l, name, f);
+      Basic::template register_nonconst_member_function<
+          std::unique_ptr<const Class>*>(l, fname);
+      Basic::template register_nonconst_member_function<
+          const std::unique_ptr<const Class>*>(l, fname);
 
 #if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
-    Registrar::template do_register_one_getter<std::shared_ptr<volatile Class>*,
-                                               volatile Member* const>(
-        l, name, f);
-    Registrar::template do_register_one_getter<
-        std::shared_ptr<const volatile Class>*,
-        const volatile Member* const>(l, name, f);
+      // for low-level volatile
 
-    Registrar::template do_register_one_getter<
-        const std::shared_ptr<volatile Class>*,
-        volatile Member* const>(l, name, f);
-    Registrar::template do_register_one_getter<
-        const std::shared_ptr<const volatile Class>*,
-        const volatile Member* const>(l, name, f);
+      Basic::template register_member_function<
+          std::shared_ptr<volatile Class>*>(l, fname, mf);
+      Basic::template register_member_function<
+          const std::shared_ptr<volatile Class>*>(l, fname, mf);
 
-    Registrar::template do_register_one_getter<std::unique_ptr<volatile Class>*,
-                                               volatile Member* const>(
-        l, name, f);
-    Registrar::template do_register_one_getter<
-        std::unique_ptr<const volatile Class>*,
-        const volatile Member* const>(l, name, f);
+      Basic::template register_nonconst_member_function<
+          std::shared_ptr<const volatile Class>*>(l, fname);
+      Basic::template register_nonconst_member_function<
+          const std::shared_ptr<const volatile Class>*>(l, fname);
 
-    Registrar::template do_register_one_getter<
-        const std::unique_ptr<volatile Class>*,
-        volatile Member* const>(l, name, f);
-    Registrar::template do_register_one_getter<
-        const std::unique_ptr<const volatile Class>*,
-        const volatile Member* const>(l, name, f);
-#endif
-  }
+      Basic::template register_member_function<
+          std::unique_ptr<volatile Class>*>(l, fname, mf);
+      Basic::template register_member_function<
+          const std::unique_ptr<volatile Class>*>(l, fname, mf);
 
-  template <typename F>
-  static void register_member_ref(luaw& l, const char* name, F&& f) {
-    PEACALM_LUAW_ASSERT(name);
+      Basic::template register_nonconst_member_function<
+          std::unique_ptr<const volatile Class>*>(l, fname);
+      Basic::template register_nonconst_member_function<
+          const std::unique_ptr<const volatile Class>*>(l, fname);
 
-    // Member reference should have same low-level cv- property as class
-    // pointer.
+#endif
+    }
+  }
+};
 
-    using Registrar = luaw::registrar<Member Class::*>;
+template <typename Class, typename Return, typename... Args>
+struct luaw::registrar<Return (Class::*)(Args...) const volatile> {
+  template <typename MemberFunction>
+  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
+    using Basic = luaw::registrar<Return (Class::*)(Args...)>;
 
-    Registrar::template do_register_one_getter<Class*,
-                                               const std::shared_ptr<Member>>(
-        l, name, [=](auto& p) {
-          return luaw_detail::mock_shared<Member>(&f(p));
-        });
-    Registrar::template do_register_one_getter<
-        const Class*,
-        const std::shared_ptr<const Member>>(l, name, [=](auto& p) {
-      return luaw_detail::mock_shared<const Member>(&f(p));
-    });
+    Basic::template register_member_function<Class*>(l, fname, mf);
+    Basic::template register_member_function<const Class*>(l, fname, mf);
 
 #if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
-    Registrar::template do_register_one_getter<
-        volatile Class*,
-        const std::shared_ptr<volatile Member>>(l, name, [=](auto& p) {
-      return luaw_detail::mock_shared<volatile Member>(&f(p));
-    });
-    Registrar::template do_register_one_getter<
-        const volatile Class*,
-        const std::shared_ptr<const volatile Member>>(l, name, [=](auto& p) {
-      return luaw_detail::mock_shared<const volatile Member>(&f(p));
-    });
-#endif
 
-    Registrar::template do_register_one_getter<std::shared_ptr<Class>*,
-                                               const std::shared_ptr<Member>>(
-        l, name, [=](auto& p) {
-          return luaw_detail::mock_shared<Member>(&f(p));
-        });
-    Registrar::template do_register_one_getter<
-        std::shared_ptr<const Class>*,
-        const std::shared_ptr<const Member>>(l, name, [=](auto& p) {
-      return luaw_detail::mock_shared<const Member>(&f(p));
-    });
+    Basic::template register_member_function<volatile Class*>(l, fname, mf);
+    Basic::template register_member_function<const volatile Class*>(
+        l, fname, mf);
 
-    Registrar::template do_register_one_getter<const std::shared_ptr<Class>*,
-                                               const std::shared_ptr<Member>>(
-        l, name, [=](auto& p) {
-          return luaw_detail::mock_shared<Member>(&f(p));
-        });
-    Registrar::template do_register_one_getter<
-        const std::shared_ptr<const Class>*,
-        const std::shared_ptr<const Member>>(l, name, [=](auto& p) {
-      return luaw_detail::mock_shared<const Member>(&f(p));
-    });
+#endif
 
-    Registrar::template do_register_one_getter<std::unique_ptr<Class>*,
-                                               const std::shared_ptr<Member>>(
-        l, name, [=](auto& p) {
-          return luaw_detail::mock_shared<Member>(&f(p));
-        });
-    Registrar::template do_register_one_getter<
-        std::unique_ptr<const Class>*,
-        const std::shared_ptr<const Member>>(l, name, [=](auto& p) {
-      return luaw_detail::mock_shared<const Member>(&f(p));
-    });
+    // Do not support nested smart pointers, which is meaningless!
+    // DO NOT support top-level volatile for smart pointers!
+    if PEACAML_LUAW_IF_CONSTEXPR (!luaw_detail::is_std_shared_ptr<
+                                      Class>::value &&
+                                  !luaw_detail::is_std_unique_ptr<
+                                      Class>::value) {
+      Basic::template register_member_function<std::shared_ptr<Class>*>(
+          l, fname, mf);
+      Basic::template register_member_function<const std::shared_ptr<Class>*>(
+          l, fname, mf);
+      Basic::template register_member_function<std::shared_ptr<const Class>*>(
+          l, fname, mf);
+      Basic::template register_member_function<
+          const std::shared_ptr<const Class>*>(l, fname, mf);
 
-    Registrar::template do_register_one_getter<const std::unique_ptr<Class>*,
-                                               const std::shared_ptr<Member>>(
-        l, name, [=](auto& p) {
-          return luaw_detail::mock_shared<Member>(&f(p));
-        });
-    Registrar::template do_register_one_getter<
-        const std::unique_ptr<const Class>*,
-        const std::shared_ptr<const Member>>(l, name, [=](auto& p) {
-      return luaw_detail::mock_shared<const Member>(&f(p));
-    });
+      Basic::template register_member_function<std::unique_ptr<Class>*>(
+          l, fname, mf);
+      Basic::template register_member_function<const std::unique_ptr<Class>*>(
+          l, fname, mf);
+      Basic::template register_member_function<std::unique_ptr<const Class>*>(
+          l, fname, mf);
+      Basic::template register_member_function<
+          const std::unique_ptr<const Class>*>(l, fname, mf);
 
 #if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
-    Registrar::template do_register_one_getter<
-        std::shared_ptr<volatile Class>*,
-        const std::shared_ptr<volatile Member>>(l, name, [=](auto& p) {
-      return luaw_detail::mock_shared<volatile Member>(&f(p));
-    });
-    Registrar::template do_register_one_getter<
-        std::shared_ptr<const volatile Class>*,
-        const std::shared_ptr<const volatile Member>>(l, name, [=](auto& p) {
-      return luaw_detail::mock_shared<const volatile Member>(&f(p));
-    });
+      // for low-level volatile
 
-    Registrar::template do_register_one_getter<
-        const std::shared_ptr<volatile Class>*,
-        const std::shared_ptr<volatile Member>>(l, name, [=](auto& p) {
-      return luaw_detail::mock_shared<volatile Member>(&f(p));
-    });
-    Registrar::template do_register_one_getter<
-        const std::shared_ptr<const volatile Class>*,
-        const std::shared_ptr<const volatile Member>>(l, name, [=](auto& p) {
-      return luaw_detail::mock_shared<const volatile Member>(&f(p));
-    });
+      Basic::template register_member_function<
+          std::shared_ptr<volatile Class>*>(l, fname, mf);
+      Basic::template register_member_function<
+          const std::shared_ptr<volatile Class>*>(l, fname, mf);
+      Basic::template register_member_function<
+          std::shared_ptr<const volatile Class>*>(l, fname, mf);
+      Basic::template register_member_function<
+          const std::shared_ptr<const volatile Class>*>(l, fname, mf);
 
-    Registrar::template do_register_one_getter<
-        std::unique_ptr<volatile Class>*,
-        const std::shared_ptr<volatile Member>>(l, name, [=](auto& p) {
-      return luaw_detail::mock_shared<volatile Member>(&f(p));
-    });
-    Registrar::template do_register_one_getter<
-        std::unique_ptr<const volatile Class>*,
-        const std::shared_ptr<const volatile Member>>(l, name, [=](auto& p) {
-      return luaw_detail::mock_shared<const volatile Member>(&f(p));
-    });
+      Basic::template register_member_function<
+          std::unique_ptr<volatile Class>*>(l, fname, mf);
+      Basic::template register_member_function<
+          const std::unique_ptr<volatile Class>*>(l, fname, mf);
+      Basic::template register_member_function<
+          std::unique_ptr<const volatile Class>*>(l, fname, mf);
+      Basic::template register_member_function<
+          const std::unique_ptr<const volatile Class>*>(l, fname, mf);
 
-    Registrar::template do_register_one_getter<
-        const std::unique_ptr<volatile Class>*,
-        const std::shared_ptr<volatile Member>>(l, name, [=](auto& p) {
-      return luaw_detail::mock_shared<volatile Member>(&f(p));
-    });
-    Registrar::template do_register_one_getter<
-        const std::unique_ptr<const volatile Class>*,
-        const std::shared_ptr<const volatile Member>>(l, name, [=](auto& p) {
-      return luaw_detail::mock_shared<const volatile Member>(&f(p));
-    });
 #endif
+    }
+  }
+};
+
+#if PEACALM_LUAW_SUPPORT_CPP17
+// for member functions with noexcept-specification
+
+template <typename Class, typename Return, typename... Args>
+struct luaw::registrar<Return (Class::*)(Args...) noexcept> {
+  template <typename MemberFunction>
+  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
+    using Basic = luaw::registrar<Return (Class::*)(Args...)>;
+    Basic::template register_member(l, fname, mf);
+  }
+};
+
+template <typename Class, typename Return, typename... Args>
+struct luaw::registrar<Return (Class::*)(Args...) const noexcept> {
+  template <typename MemberFunction>
+  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
+    using Basic = luaw::registrar<Return (Class::*)(Args...) const>;
+    Basic::template register_member(l, fname, mf);
   }
 };
 
-/* -------------------------------------------------------------------------- */
-// Registrar specialization for member variables.
-template <typename Class, typename Member>
-struct luaw::registrar<
-    Member Class::*,
-    std::enable_if_t<std::is_member_object_pointer<Member Class::*>::value>> {
-  // register a specific member
-  template <typename F>
-  static void register_member(luaw& l, const char* mname, F&& f) {
-    register_one_getter<Class*>(l, mname, std::forward<F>(f));
-    register_one_getter<const Class*>(l, mname, std::forward<F>(f));
-
-#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+template <typename Class, typename Return, typename... Args>
+struct luaw::registrar<Return (Class::*)(Args...) volatile noexcept> {
+  template <typename MemberFunction>
+  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
+    using Basic = luaw::registrar<Return (Class::*)(Args...) volatile>;
+    Basic::template register_member(l, fname, mf);
+  }
+};
 
-    register_one_getter<volatile Class*>(l, mname, std::forward<F>(f));
-    register_one_getter<const volatile Class*>(l, mname, std::forward<F>(f));
+template <typename Class, typename Return, typename... Args>
+struct luaw::registrar<Return (Class::*)(Args...) const volatile noexcept> {
+  template <typename MemberFunction>
+  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
+    using Basic = luaw::registrar<Return (Class::*)(Args...) const volatile>;
+    Basic::template register_member(l, fname, mf);
+  }
+};
 
 #endif
 
-    // Do not support nested smart pointers, which is meaningless!
-    // DO NOT support top-level volatile for smart pointers!
-    if PEACAML_LUAW_IF_CONSTEXPR (!luaw_detail::is_std_shared_ptr<
-                                      Class>::value &&
-                                  !luaw_detail::is_std_unique_ptr<
-                                      Class>::value) {
-      register_one_getter<std::shared_ptr<Class>*>(
-          l, mname, std::forward<F>(f));
-      register_one_getter<std::shared_ptr<const Class>*>(
-          l, mname, std::forward<F>(f));
+// @}
 
-      register_one_getter<const std::shared_ptr<Class>*>(
-          l, mname, std::forward<F>(f));
-      register_one_getter<const std::shared_ptr<const Class>*>(
-          l, mname, std::forward<F>(f));
+////////////////////////////////////////////////////////////////////////////////
 
-      register_one_getter<std::unique_ptr<Class>*>(
-          l, mname, std::forward<F>(f));
-      register_one_getter<std::unique_ptr<const Class>*>(
-          l, mname, std::forward<F>(f));
+namespace luaw_detail {
+template <typename T>
+struct __is_ptr : std::false_type {};
+template <typename T>
+struct __is_ptr<T*> : std::true_type {};
+template <typename T>
+struct __is_ptr<std::shared_ptr<T>> : std::true_type {};
+template <typename T, typename D>
+struct __is_ptr<std::unique_ptr<T, D>> : std::true_type {};
+template <typename T>
+struct is_ptr : __is_ptr<typename std::decay<T>::type> {};
 
-      register_one_getter<const std::unique_ptr<Class>*>(
-          l, mname, std::forward<F>(f));
-      register_one_getter<const std::unique_ptr<const Class>*>(
-          l, mname, std::forward<F>(f));
+// Whether Provider has a batch provide member function:
+// bool provide(luaw& l, const std::vector<const char*>& vnames)
+template <typename Provider, typename = void>
+struct has_batch_provide : std::false_type {};
+template <typename Provider>
+struct has_batch_provide<
+    Provider,
+    void_t<decltype(std::declval<Provider&>().provide(
+        std::declval<luaw&>(),
+        std::declval<const std::vector<const char*>&>()))>> : std::true_type {
+};
 
-#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
-      // for low-level volatile
+// Whether Provider has a provide member function by variable ID:
+// bool provide(luaw& l, std::uint32_t vid)
+template <typename Provider, typename = void>
+struct has_id_provide : std::false_type {};
+template <typename Provider>
+struct has_id_provide<
+    Provider,
+    void_t<decltype(std::declval<Provider&>().provide(
+        std::declval<luaw&>(), std::declval<std::uint32_t>()))>>
+    : std::true_type {};
+
+// Whether Provider has an async provide member function:
+// std::future<T> provide_async(const char* vname)
+template <typename Provider, typename = void>
+struct has_async_provide : std::false_type {};
+template <typename Provider>
+struct has_async_provide<Provider,
+                         void_t<decltype(std::declval<Provider&>().provide_async(
+                             std::declval<const char*>()))>> : std::true_type {
+};
+}  // namespace luaw_detail
 
-      register_one_getter<std::shared_ptr<volatile Class>*>(
-          l, mname, std::forward<F>(f));
-      register_one_getter<std::shared_ptr<const volatile Class>*>(
-          l, mname, std::forward<F>(f));
+/**
+ * @brief A thread-safe cache of provided values shared by many custom_luaw
+ * instances, e.g. one instance per worker thread.
+ *
+ * It holds plain values only (boolean, integer, number, string), which could
+ * be pushed into any Lua state. Readers keep a snapshot and reload it, under a
+ * short lock, only when the version changed, so most reads take no lock.
+ * Writers put values into a pending map first, and publish a new snapshot
+ * (copy-on-write) only when the pending values are at least a quarter of the
+ * snapshot, so filling a cache of N values copies O(N) values in total.
+ * Readers look up pending values under a lock only if not found (or stale) in
+ * the snapshot.
+ */
+class shared_provider_cache {
+public:
+  using clock_t = std::chrono::steady_clock;
+
+  /// A plain value.
+  struct value {
+    int         type   = LUA_TNIL;
+    bool        b      = false;
+    bool        is_int = false;
+    lua_Integer i      = 0;
+    lua_Number  n      = 0;
+    std::string s;
+
+    /// When it's put, set by put.
+    clock_t::time_point put_at;
+    /// When it expires, never by default.
+    clock_t::time_point expire_at = clock_t::time_point::max();
+  };
 
-      register_one_getter<const std::shared_ptr<volatile Class>*>(
-          l, mname, std::forward<F>(f));
-      register_one_getter<const std::shared_ptr<const volatile Class>*>(
-          l, mname, std::forward<F>(f));
+  /// Key of values. It owns the name, or only refers to a name for lookup
+  /// without allocation.
+  class key {
+  public:
+    explicit key(std::string name)
+        : s_(std::move(name)), p_(s_.data()), n_(s_.size()) {}
+    key(const char* p, size_t n) : p_(p), n_(n) {}
+    key(const key& k) : s_(k.s_), p_(k.owns() ? s_.data() : k.p_), n_(k.n_) {}
+    key& operator=(const key&) = delete;
+
+    const char* data() const { return p_; }
+    size_t      size() const { return n_; }
+    std::string str() const { return std::string(p_, n_); }
+
+    bool operator==(const key& k) const {
+      return n_ == k.n_ && memcmp(p_, k.p_, n_) == 0;
+    }
 
-      register_one_getter<std::unique_ptr<volatile Class>*>(
-          l, mname, std::forward<F>(f));
-      register_one_getter<std::unique_ptr<const volatile Class>*>(
-          l, mname, std::forward<F>(f));
+  private:
+    bool owns() const { return p_ == s_.data(); }
 
-      register_one_getter<const std::unique_ptr<volatile Class>*>(
-          l, mname, std::forward<F>(f));
-      register_one_getter<const std::unique_ptr<const volatile Class>*>(
-          l, mname, std::forward<F>(f));
+    std::string s_;
+    const char* p_;
+    size_t      n_;
+  };
 
-#endif
+  struct key_hash {
+    size_t operator()(const key& k) const {
+      return static_cast<size_t>(luaw_detail::fnv1a64(k.data(), k.size()));
     }
+  };
 
-    __register_setters(l, mname, std::forward<F>(f), std::is_const<Member>{});
-  }
+  using map_t      = std::unordered_map<key, value, key_hash>;
+  using snapshot_t = std::shared_ptr<const map_t>;
 
-  // Register a member getter for `ObjectPointer`, the member's type is same cv-
-  // qualifed with object on `Member`.
-  template <typename ObjectPointer, typename F>
-  static void register_one_getter(luaw& l, const char* mname, F&& f) {
-    static_assert(std::is_pointer<ObjectPointer>::value,
-                  "ObjectPointer should be a pointer type");
+  shared_provider_cache() : snapshot_(std::make_shared<map_t>()) {}
 
-    // To add same cv- property on Member as Object
-    using O = luaw_detail::remove_ptr_or_smart_ptr_t<
-        std::remove_pointer_t<ObjectPointer>>;
-    using M0 = Member;
-    using M1 = std::conditional_t<std::is_volatile<O>::value, volatile M0, M0>;
-    using M2 = std::conditional_t<std::is_const<O>::value, const M1, M1>;
+  shared_provider_cache(const shared_provider_cache&)            = delete;
+  shared_provider_cache& operator=(const shared_provider_cache&) = delete;
 
-    do_register_one_getter<ObjectPointer, M2, F>(l, mname, std::forward<F>(f));
-  }
+  /// Current version, changed by each write.
+  uint64_t version() const { return version_.load(std::memory_order_acquire); }
 
-  // Register a member getter for `ObjectPointer`, the member's type is
-  // `CVPossibleMember`.
-  template <typename ObjectPointer, typename CVPossibleMember, typename F>
-  static void do_register_one_getter(luaw& l, const char* mname, F&& f) {
-    static_assert(std::is_pointer<ObjectPointer>::value,
-                  "ObjectPointer should be a pointer type");
-    // The getter will return a copy of the member with type `CVPossibleMember`
-    // which is a type maybe possibly cv- qualified on `Member`. And it should
-    // have same cv- property with `ObjectPointer`'s low-level cv- property.
-    //
-    // The type `Member` maybe the member's real type, or could be sepcified by
-    // `Hint` and it could be different with the member's real type, but it must
-    // be convertible from the real type to this target member type.
-    // Thus, it enables us to register a member to another type in Lua, e.g.
-    // register a non-const member as a const member in Lua, or register a
-    // integer member as a boolean member in Lua, etc.
-    auto getter = [f, &l](ObjectPointer o) -> CVPossibleMember {
-      PEACALM_LUAW_ASSERT(o);
-      auto p = luaw_detail::retrieve_underlying_ptr(*o);
-      if (!p) {
-        luaL_error(l.L(), "Getting member by empty smart ptr.");
-        // Never runs here
-        PEACALM_LUAW_ASSERT(false);
-      }
-      return f(*p);
-    };
-    void* p = reinterpret_cast<void*>(
-        const_cast<std::type_info*>(&typeid(ObjectPointer)));
-    l.touchtb(p, LUA_REGISTRYINDEX)
-        .touchtb(luaw::member_info_fields::member_getter)
-        .setkv<luaw::function_tag>(mname, getter);
-    l.pop(2);
+  /// Get current snapshot of published values.
+  snapshot_t snapshot() const {
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    return snapshot_;
   }
 
-private:
-  template <typename ObjectType>
-  static void __register_const_member(luaw& l, const char* mname) {
-    auto  _g = l.make_guarder();
-    void* p  = reinterpret_cast<void*>(
-        const_cast<std::type_info*>(&typeid(ObjectType)));
-    l.touchtb(p, LUA_REGISTRYINDEX)
-        .touchtb(luaw::member_info_fields::const_member)
-        .setkv(mname, true);
+  /// Number of values, including pending ones.
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    size_t                      n = snapshot_->size();
+    for (const auto& kv : pending_) n += snapshot_->count(kv.first) ? 0 : 1;
+    return n;
   }
 
-  // Member is const
-  template <typename F>
-  static void __register_setters(luaw&       l,
-                                 const char* mname,
-                                 F&&         f,
-                                 std::true_type) {
-    __register_const_member<Class*>(l, mname);
-    __register_const_member<const Class*>(l, mname);
-
-#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
-
-    __register_const_member<volatile Class*>(l, mname);
-    __register_const_member<const volatile Class*>(l, mname);
+  /// Find a value in a snapshot without allocation, or nullptr if not found.
+  static const value* find(const map_t& m, const char* name, size_t len) {
+    auto it = m.find(key(name, len));
+    return it == m.end() ? nullptr : &it->second;
+  }
 
-#endif
+  /// Whether there are values not published yet.
+  bool has_pending() const {
+    return pending_size_.load(std::memory_order_acquire) > 0;
+  }
 
-    // Do not support nested smart pointers, which is meaningless!
-    // DO NOT support top-level volatile for smart pointers!
-    if PEACAML_LUAW_IF_CONSTEXPR (!luaw_detail::is_std_shared_ptr<
-                                      Class>::value &&
-                                  !luaw_detail::is_std_unique_ptr<
-                                      Class>::value) {
-      __register_const_member<std::shared_ptr<Class>*>(l, mname);
-      __register_const_member<std::shared_ptr<const Class>*>(l, mname);
-      __register_const_member<const std::shared_ptr<Class>*>(l, mname);
-      __register_const_member<const std::shared_ptr<const Class>*>(l, mname);
+  /// Copy a value not published yet to "v", return false if not found.
+  bool find_pending(const char* name, size_t len, value& v) const {
+    if (!has_pending()) return false;
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    const value*                p = find(pending_, name, len);
+    if (!p) return false;
+    v = *p;
+    return true;
+  }
 
-      __register_const_member<std::unique_ptr<Class>*>(l, mname);
-      __register_const_member<std::unique_ptr<const Class>*>(l, mname);
-      __register_const_member<const std::unique_ptr<Class>*>(l, mname);
-      __register_const_member<const std::unique_ptr<const Class>*>(l, mname);
+  /// Put a value, nil is ignored. Its put_at is set to now.
+  void put(const std::string& name, const value& v) {
+    if (v.type == LUA_TNIL) return;
+    value nv  = v;
+    nv.put_at = clock_t::now();
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    pending_.erase(key(name.data(), name.size()));
+    pending_.emplace(key(name), std::move(nv));
+    if (pending_.size() * 4 >= snapshot_->size()) {
+      flush_pending();
+    } else {
+      pending_size_.store(pending_.size(), std::memory_order_release);
+      version_.fetch_add(1, std::memory_order_release);
+    }
+  }
 
-#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
-      // for low-level volatile:
+  /// Publish all pending values now.
+  void flush() {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    flush_pending();
+  }
+
+  /// Remove a value.
+  void erase(const std::string& name) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    const key                   k(name.data(), name.size());
+    bool                        erased = pending_.erase(k) > 0;
+    pending_size_.store(pending_.size(), std::memory_order_release);
+    if (snapshot_->count(k)) {
+      auto m = std::make_shared<map_t>(*snapshot_);
+      m->erase(k);
+      publish(std::move(m));
+    } else if (erased) {
+      version_.fetch_add(1, std::memory_order_release);
+    }
+  }
 
-      __register_const_member<std::shared_ptr<volatile Class>*>(l, mname);
-      __register_const_member<std::shared_ptr<const volatile Class>*>(l, mname);
-      __register_const_member<const std::shared_ptr<volatile Class>*>(l, mname);
-      __register_const_member<const std::shared_ptr<const volatile Class>*>(
-          l, mname);
+  /// Remove all values.
+  void clear() {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    pending_.clear();
+    pending_size_.store(0, std::memory_order_release);
+    publish(std::make_shared<map_t>());
+  }
 
-      __register_const_member<std::unique_ptr<volatile Class>*>(l, mname);
-      __register_const_member<std::unique_ptr<const volatile Class>*>(l, mname);
-      __register_const_member<const std::unique_ptr<volatile Class>*>(l, mname);
-      __register_const_member<const std::unique_ptr<const volatile Class>*>(
-          l, mname);
+  /// Push a value onto the stack of L.
+  static void push(lua_State* L, const value& v) {
+    switch (v.type) {
+      case LUA_TBOOLEAN:
+        lua_pushboolean(L, v.b);
+        break;
+      case LUA_TNUMBER:
+        if (v.is_int) {
+          lua_pushinteger(L, v.i);
+        } else {
+          lua_pushnumber(L, v.n);
+        }
+        break;
+      case LUA_TSTRING:
+        lua_pushlstring(L, v.s.data(), v.s.size());
+        break;
+      default:
+        lua_pushnil(L);
+    }
+  }
 
-#endif
+  /// Convert a Lua value to a plain value. Return false if it's not plain.
+  static bool to_value(lua_State* L, int idx, value& v) {
+    v.type = lua_type(L, idx);
+    switch (v.type) {
+      case LUA_TBOOLEAN:
+        v.b = lua_toboolean(L, idx);
+        return true;
+      case LUA_TNUMBER:
+        v.is_int = lua_isinteger(L, idx);
+        if (v.is_int) {
+          v.i = lua_tointeger(L, idx);
+        } else {
+          v.n = lua_tonumber(L, idx);
+        }
+        return true;
+      case LUA_TSTRING: {
+        size_t      len;
+        const char* s = lua_tolstring(L, idx, &len);
+        v.s.assign(s, len);
+        return true;
+      }
+      default:
+        v.type = LUA_TNIL;
+        return false;
     }
   }
 
-  // Member is not const
-  template <typename F>
-  static void __register_setters(luaw&       l,
-                                 const char* mname,
-                                 F&&         f,
-                                 std::false_type) {
-#define DEFINE_SETTER(ObjectType)                                \
-  {                                                              \
-    auto setter = [=, &l](ObjectType o, Member v) {              \
-      PEACALM_LUAW_ASSERT(o);                                    \
-      auto p = luaw_detail::retrieve_underlying_ptr(*o);         \
-      if (!p) {                                                  \
-        luaL_error(l.L(), "Setting member by empty smart ptr."); \
-        /* Never runs here */                                    \
-        PEACALM_LUAW_ASSERT(false);                              \
-      }                                                          \
-      f(*p) = std::move(v);                                      \
-    };                                                           \
-    void* p = reinterpret_cast<void*>(                           \
-        const_cast<std::type_info*>(&typeid(ObjectType)));       \
-    l.touchtb(p, LUA_REGISTRYINDEX)                              \
-        .touchtb(luaw::member_info_fields::member_setter)        \
-        .setkv<luaw::function_tag>(mname, setter);               \
-    l.pop(2);                                                    \
+private:
+  // Merge pending values into a new snapshot. Called with write_mutex_ held.
+  void flush_pending() {
+    if (pending_.empty()) return;
+    auto m = std::make_shared<map_t>(*snapshot_);
+    for (auto& kv : pending_) {
+      m->erase(kv.first);
+      m->emplace(kv.first, std::move(kv.second));
+    }
+    pending_.clear();
+    pending_size_.store(0, std::memory_order_release);
+    publish(std::move(m));
   }
 
-    DEFINE_SETTER(Class*);
-    // the object is const, so member is const
-    __register_const_member<const Class*>(l, mname);
+  // Replace the snapshot. Called with write_mutex_ held.
+  void publish(std::shared_ptr<map_t>&& m) {
+    snapshot_t old(std::move(m));
+    {
+      std::lock_guard<std::mutex> lock(snapshot_mutex_);
+      snapshot_.swap(old);
+    }
+    version_.fetch_add(1, std::memory_order_release);
+  }
 
-#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+  // Only changed with write_mutex_ held, so writers read it without
+  // snapshot_mutex_.
+  snapshot_t            snapshot_;
+  map_t                 pending_;
+  std::atomic<size_t>   pending_size_{0};
+  std::atomic<uint64_t> version_{0};
+  mutable std::mutex    snapshot_mutex_;
+  mutable std::mutex    write_mutex_;
+};
 
-    DEFINE_SETTER(volatile Class*);
-    __register_const_member<const volatile Class*>(l, mname);
+/**
+ * @brief A Lua wrapper with custom variable provider.
+ *
+ * Derived from luaw, it can contain a user defined variable provider.
+ * When a global variable used in some expression does not exist in Lua,
+ * then it will seek the variable from the provider.
+ *
+ * The underlying provider type should implement a member function:
+ *
+ * * `bool provide(peacalm::luaw* l, const char* vname);`
+ *
+ * In this member function, it should push exactly one value whose name is
+ * vname onto the stack of L then return true. Otherwise return false if vname
+ * is illegal or vname doesn't have a correct value.
+ *
+ * Or instead, provide by dense integer IDs of variable names (see var_id),
+ * which is preferred if both implemented:
+ *
+ * * `bool provide(peacalm::luaw& l, custom_luaw::var_id_t vid);`
+ *
+ * Optionally, the provider type could also implement a batch version, which is
+ * used by prefetch:
+ *
+ * * `bool provide(peacalm::luaw& l, const std::vector<const char*>& vnames);`
+ *
+ * Or an async version, whose future returns a value could be pushed by luaw,
+ * or returns an invalid future if vname doesn't have a value:
+ *
+ * * `std::future<T> provide_async(const char* vname);`
+ *
+ * luaw.h doesn't include <future>, the provider's header should include it.
+ * A failed prefetch returns only after all futures started are destroyed.
+ *
+ * @tparam VariableProviderPointer Should be a raw pointer type or
+ * std::shared_ptr or std::unique_ptr.
+ */
+template <typename VariableProviderPointer>
+class custom_luaw : public luaw {
+  using base_t     = luaw;
+  using provider_t = VariableProviderPointer;
+  static_assert(luaw_detail::is_ptr<provider_t>::value,
+                "VariableProviderPointer should be pointer type");
+  using pointer_t      = custom_luaw*;
+  using clock_t        = std::chrono::steady_clock;
+  using provider_type =
+      std::remove_reference_t<decltype(*std::declval<provider_t&>())>;
+  provider_t provider_ = nullptr;
 
-#endif
+  // Whether standard libs are loaded lazily by the "__index" of _G, which is
+  // replaced by this object.
+  bool lazy_libs_ = false;
 
-    // Do not support nested smart pointers, which is meaningless!
-    // DO NOT support top-level volatile for smart pointers!
-    if PEACAML_LUAW_IF_CONSTEXPR (!luaw_detail::is_std_shared_ptr<
-                                      Class>::value &&
-                                  !luaw_detail::is_std_unique_ptr<
-                                      Class>::value) {
-      DEFINE_SETTER(std::shared_ptr<Class>*);
-      DEFINE_SETTER(const std::shared_ptr<Class>*);
-      __register_const_member<std::shared_ptr<const Class>*>(l, mname);
-      __register_const_member<const std::shared_ptr<const Class>*>(l, mname);
+public:
+  /// Dense integer ID of a variable name.
+  using var_id_t = std::uint32_t;
+
+  /// Statistics of the provider cache.
+  struct provider_cache_stats {
+    size_t generation    = 0;
+    size_t hits          = 0;
+    size_t misses        = 0;
+    size_t expired       = 0;
+    size_t negative_hits = 0;  // Hits of remembered misses, included in hits
+  };
 
-      DEFINE_SETTER(std::unique_ptr<Class>*);
-      DEFINE_SETTER(const std::unique_ptr<Class>*);
-      __register_const_member<std::unique_ptr<const Class>*>(l, mname);
-      __register_const_member<const std::unique_ptr<const Class>*>(l, mname);
+  /// Statistics of provider calls for one variable name.
+  struct provider_name_stats {
+    size_t calls    = 0;  // Calls of the per-name provide
+    size_t misses   = 0;  // Calls succeeded but provided nil
+    size_t failures = 0;  // Calls returned false
+  };
 
-#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
-      // for low-level volatile
+private:
+  struct cache_ttl {
+    clock_t::duration   ttl;
+    clock_t::time_point expire_at;
+  };
 
-      DEFINE_SETTER(std::shared_ptr<volatile Class>*);
-      DEFINE_SETTER(const std::shared_ptr<volatile Class>*);
-      __register_const_member<std::shared_ptr<const volatile Class>*>(l, mname);
-      __register_const_member<const std::shared_ptr<const volatile Class>*>(
-          l, mname);
+  // Cache of provided values, the table is referenced in LUA_REGISTRYINDEX.
+  // So are the values prefetched for current evaluation.
+  struct provider_cache {
+    int                                        ref        = LUA_NOREF;
+    int                                        prefetched = LUA_NOREF;
+    bool                                       negative   = false;
+    provider_cache_stats                       stats;
+    std::unordered_map<std::string, cache_ttl> ttls;
+
+    // Statistics of provider calls for each name
+    bool name_stats_enabled = false;
+    std::unordered_map<std::string, provider_name_stats> name_stats;
+  };
+  provider_cache cache_;
+
+  // Interned variable names. The table mapping names to IDs is referenced in
+  // LUA_REGISTRYINDEX. Names are in a deque so pointers got by var_name stay
+  // valid while more names are interned.
+  struct var_ids {
+    int                     ref = LUA_NOREF;
+    std::deque<std::string> names;
+  };
+  var_ids ids_;
+
+  // The shared cache and this reader's snapshot of it.
+  // Shared values put before "since", when the generation changed last time,
+  // are stale for this reader.
+  struct shared_cache {
+    std::shared_ptr<shared_provider_cache> cache;
+    shared_provider_cache::snapshot_t      snapshot;
+    uint64_t                               version = 0;
+    clock_t::time_point                    since   = clock_t::time_point::min();
+    // Copy of the last value found pending in the shared cache.
+    shared_provider_cache::value pending;
+  };
+  shared_cache shared_;
 
-      DEFINE_SETTER(std::unique_ptr<volatile Class>*);
-      DEFINE_SETTER(const std::unique_ptr<volatile Class>*);
-      __register_const_member<std::unique_ptr<const volatile Class>*>(l, mname);
-      __register_const_member<const std::unique_ptr<const volatile Class>*>(
-          l, mname);
+public:
+  template <typename... Args>
+  custom_luaw(Args&&... args) : base_t(std::forward<Args>(args)...) {
+    set_globale_metateble();
+  }
 
-#endif
-    }
+  // delete copy
+  custom_luaw(const custom_luaw&)            = delete;
+  custom_luaw& operator=(const custom_luaw&) = delete;
 
-#undef DEFINE_SETTER
+  // support move
+  custom_luaw(custom_luaw&& l)
+      : base_t(std::move(l)),
+        provider_(std::move(l.provider_)),
+        lazy_libs_(l.lazy_libs_),
+        cache_(std::move(l.cache_)),
+        ids_(std::move(l.ids_)),
+        shared_(std::move(l.shared_)) {
+    l.cache_.ref        = LUA_NOREF;
+    l.cache_.prefetched = LUA_NOREF;
+    l.ids_.ref          = LUA_NOREF;
+    set_globale_metateble();
+  }
+  custom_luaw& operator=(custom_luaw&& r) {
+    if (this == &r) return *this;
+    release_refs();
+    base_t::operator=(std::move(r));
+    provider_           = std::move(r.provider_);
+    lazy_libs_          = r.lazy_libs_;
+    cache_              = std::move(r.cache_);
+    ids_                = std::move(r.ids_);
+    shared_             = std::move(r.shared_);
+    r.cache_.ref        = LUA_NOREF;
+    r.cache_.prefetched = LUA_NOREF;
+    r.ids_.ref          = LUA_NOREF;
+    set_globale_metateble();
+    return *this;
   }
-};
-
-/* -------------------------------------------------------------------------- */
-// Registrar specialization for member functions.
-// @{
 
-template <typename Class, typename Return, typename... Args>
-struct luaw::registrar<Return (Class::*)(Args...)> {
-  // implementations
+  // Release what this object referenced in the registry, in case the state
+  // is not closed with this object.
+  ~custom_luaw() { release_refs(); }
 
-  template <typename ObjectType, typename MemberFunction>
-  static void register_member_function(luaw&            l,
-                                       const char*      fname,
-                                       MemberFunction&& mf) {
-    auto f = [mf, &l](ObjectType o, Args... args) -> Return {
-      if (!o) {
-        luaL_error(l.L(), "Calling member function by null pointer.");
-        // Never runs here.
-        PEACALM_LUAW_ASSERT(false);
-        // Do not return Return() to enable functions with reference results.
-        // return Return();
-      }
-      PEACALM_LUAW_ASSERT(o);
-      return mf(*o, std::move(args)...);
-    };
+  // provider getter and setter
+  void              provider(const provider_t& p) { provider_ = p; }
+  void              provider(provider_t&& p) { provider_ = std::move(p); }
+  const provider_t& provider() const { return provider_; }
+  provider_t&       provider() { return provider_; }
 
-    void* p = reinterpret_cast<void*>(
-        const_cast<std::type_info*>(&typeid(ObjectType)));
-    l.touchtb(p, LUA_REGISTRYINDEX)
-        .touchtb(luaw::member_info_fields::member_function)
-        .setkv<luaw::function_tag>(fname, f);
-    l.pop(2);
+  /**
+   * @brief Intern a variable name into a dense integer ID.
+   *
+   * IDs are 0, 1, 2... in order of interning, unique for each name in this
+   * object. Names are interned automatically when provided by ID, but could be
+   * interned in advance to get known IDs, e.g. as indices of flat arrays.
+   */
+  var_id_t var_id(const char* name) {
+    PEACALM_LUAW_ASSERT(name);
+    pushstring(name);
+    var_id_t id = intern(L(), -1);
+    pop();
+    return id;
   }
-
-  template <typename ObjectType>
-  static void register_nonconst_member_function(luaw& l, const char* fname) {
-    void* p = reinterpret_cast<void*>(
-        const_cast<std::type_info*>(&typeid(ObjectType)));
-    l.touchtb(p, LUA_REGISTRYINDEX)
-        .touchtb(luaw::member_info_fields::nonconst_member_function)
-        .setkv(fname, true);
-    l.pop(2);
+  var_id_t var_id(const std::string& name) {
+    pushlstring(name.data(), name.size());
+    var_id_t id = intern(L(), -1);
+    pop();
+    return id;
   }
 
-  template <typename ObjectType>
-  static void register_nonvolatile_member_function(luaw& l, const char* fname) {
-    void* p = reinterpret_cast<void*>(
-        const_cast<std::type_info*>(&typeid(ObjectType)));
-    l.touchtb(p, LUA_REGISTRYINDEX)
-        .touchtb(luaw::member_info_fields::nonvolatile_member_function)
-        .setkv(fname, true);
-    l.pop(2);
+  /**
+   * @brief Get the name of an interned ID, or nullptr if not interned.
+   * The result stays valid as long as this object, even if more names are
+   * interned later.
+   */
+  const char* var_name(var_id_t id) const {
+    return id < ids_.names.size() ? ids_.names[id].c_str() : nullptr;
   }
 
-  // no cv- member functions
-  template <typename MemberFunction>
-  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
-    register_member_function<Class*>(l, fname, mf);
-    register_nonconst_member_function<const Class*>(l, fname);
-
-#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
-
-    register_nonvolatile_member_function<volatile Class*>(l, fname);
-    register_nonconst_member_function<const volatile Class*>(l, fname);
-    register_nonvolatile_member_function<const volatile Class*>(l, fname);
-
-#endif
+  /// Get number of interned names.
+  size_t var_count() const { return ids_.names.size(); }
 
-    // Do not support nested smart pointers, which is meaningless!
-    // DO NOT support top-level volatile for smart pointers!
-    if PEACAML_LUAW_IF_CONSTEXPR (!luaw_detail::is_std_shared_ptr<
-                                      Class>::value &&
-                                  !luaw_detail::is_std_unique_ptr<
-                                      Class>::value) {
-      register_member_function<std::shared_ptr<Class>*>(l, fname, mf);
-      register_member_function<const std::shared_ptr<Class>*>(l, fname, mf);
+  /**
+   * @brief Enable a cache of values provided by the provider.
+   *
+   * The cache is a table owned by this object (not _G), so provided values
+   * never pollute _G and could be invalidated by
+   * bump_provider_cache_generation. Nil values are not cached.
+   * If already enabled, nothing is changed.
+   */
+  void enable_provider_cache() {
+    if (provider_cache_enabled()) return;
+    newtable();
+    cache_.ref = luaL_ref(L(), LUA_REGISTRYINDEX);
+  }
 
-      register_nonconst_member_function<std::shared_ptr<const Class>*>(l,
-                                                                       fname);
-      register_nonconst_member_function<const std::shared_ptr<const Class>*>(
-          l, fname);
+  /// Disable the provider cache and release all cached values.
+  void disable_provider_cache() {
+    if (!provider_cache_enabled()) return;
+    luaL_unref(L(), LUA_REGISTRYINDEX, cache_.ref);
+    cache_.ref   = LUA_NOREF;
+    cache_.stats = provider_cache_stats{};
+    cache_.ttls.clear();
+  }
 
-      register_member_function<std::unique_ptr<Class>*>(l, fname, mf);
-      register_member_function<const std::unique_ptr<Class>*>(l, fname, mf);
+  /// Whether the provider cache is enabled.
+  bool provider_cache_enabled() const { return cache_.ref != LUA_NOREF; }
 
-      register_nonconst_member_function<std::unique_ptr<const Class>*>(l,
-                                                                       fname);
-      register_nonconst_member_function<const std::unique_ptr<const Class>*>(
-          l, fname);
+  /**
+   * @brief Release all values in the provider cache, including remembered
+   * misses, but keep it enabled with its settings and statistics.
+   *
+   * Unlike bump_provider_cache_generation, the generation is not changed and
+   * values in the shared cache are still used.
+   */
+  void clear_provider_cache() {
+    if (!provider_cache_enabled()) return;
+    newtable();
+    lua_rawseti(L(), LUA_REGISTRYINDEX, cache_.ref);
+  }
 
-#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
-      // for low-level volatile
+  /**
+   * @brief Start a new generation of the provider cache, i.e. invalidate all
+   * cached values at once, e.g. when upstream data changed.
+   *
+   * It costs O(1) by replacing the cache table with a new empty one.
+   * @return The new generation.
+   */
+  size_t bump_provider_cache_generation() {
+    if (provider_cache_enabled()) {
+      newtable();
+      lua_rawseti(L(), LUA_REGISTRYINDEX, cache_.ref);
+    }
+    shared_.since = clock_t::now();
+    return ++cache_.stats.generation;
+  }
 
-      register_nonvolatile_member_function<std::shared_ptr<volatile Class>*>(
-          l, fname);
-      register_nonvolatile_member_function<
-          const std::shared_ptr<volatile Class>*>(l, fname);
+  /// Get current generation of the provider cache.
+  size_t provider_cache_generation() const { return cache_.stats.generation; }
 
-      register_nonconst_member_function<std::shared_ptr<const volatile Class>*>(
-          l, fname);
-      register_nonconst_member_function<
-          const std::shared_ptr<const volatile Class>*>(l, fname);
+  /**
+   * @brief Set time to live of the cached value of a variable.
+   *
+   * By default a cached value lives until the generation changes.
+   * If ttl is not positive, the variable is never cached.
+   * Also applies to the shared cache: values put by this object expire after
+   * ttl, and values put by others are used within ttl since they were put.
+   */
+  void set_provider_cache_ttl(const std::string& name, clock_t::duration ttl) {
+    cache_.ttls[name] = cache_ttl{ttl, clock_t::time_point::min()};
+  }
 
-      register_nonvolatile_member_function<
-          std::shared_ptr<const volatile Class>*>(l, fname);
-      register_nonvolatile_member_function<
-          const std::shared_ptr<const volatile Class>*>(l, fname);
+  /// Remove the time to live of a variable, then it lives as the default.
+  void unset_provider_cache_ttl(const std::string& name) {
+    cache_.ttls.erase(name);
+  }
 
-      register_nonvolatile_member_function<std::unique_ptr<volatile Class>*>(
-          l, fname);
-      register_nonvolatile_member_function<
-          const std::unique_ptr<volatile Class>*>(l, fname);
+  /// Get statistics of the provider cache.
+  provider_cache_stats get_provider_cache_stats() const {
+    return cache_.stats;
+  }
 
-      register_nonconst_member_function<std::unique_ptr<const volatile Class>*>(
-          l, fname);
-      register_nonconst_member_function<
-          const std::unique_ptr<const volatile Class>*>(l, fname);
+  /**
+   * @brief Set whether treat a failure of the provider as nil instead of
+   * raising an error, and remember the miss.
+   *
+   * If enabled, a variable failed to provide (provide returns false) is
+   * treated as nil. Misses (failed or nil) are remembered in the provider
+   * cache if enabled, until the generation changes or their TTL expires, so
+   * the provider won't be called again for them.
+   */
+  void set_negative_provider_cache(bool enable) { cache_.negative = enable; }
 
-      register_nonvolatile_member_function<
-          std::unique_ptr<const volatile Class>*>(l, fname);
-      register_nonvolatile_member_function<
-          const std::unique_ptr<const volatile Class>*>(l, fname);
+  /// Whether misses are treated as nil and remembered.
+  bool negative_provider_cache() const { return cache_.negative; }
 
-#endif
-    }
+  /**
+   * @brief Set whether count provider calls, misses and failures for each
+   * variable name. Disabled by default since it costs a hash of the name for
+   * each provider call.
+   */
+  void enable_provider_name_stats(bool enable = true) {
+    cache_.name_stats_enabled = enable;
   }
-};
-
-template <typename Class, typename Return, typename... Args>
-struct luaw::registrar<Return (Class::*)(Args...) const> {
-  template <typename MemberFunction>
-  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
-    using Basic = luaw::registrar<Return (Class::*)(Args...)>;
 
-    Basic::template register_member_function<Class*>(l, fname, mf);
-    Basic::template register_member_function<const Class*>(l, fname, mf);
+  /// Get statistics of provider calls for each variable name.
+  const std::unordered_map<std::string, provider_name_stats>&
+  get_provider_name_stats() const {
+    return cache_.name_stats;
+  }
 
-#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+  /// Clear statistics of provider calls for each variable name.
+  void clear_provider_name_stats() { cache_.name_stats.clear(); }
 
-    Basic::template register_nonvolatile_member_function<volatile Class*>(
-        l, fname);
-    Basic::template register_nonvolatile_member_function<const volatile Class*>(
-        l, fname);
+  /**
+   * @brief Share a cache of provided values with other custom_luaw instances,
+   * maybe in other threads.
+   *
+   * The shared cache is consulted after the provider cache (if enabled) and
+   * before the provider. Plain values (boolean, number, string) provided by
+   * the provider are put into it. Set nullptr to stop sharing.
+   * TTLs of this object apply to it too (see set_provider_cache_ttl), and
+   * values put before this object's generation changed last time are not
+   * used by this object.
+   */
+  void set_shared_provider_cache(std::shared_ptr<shared_provider_cache> c) {
+    shared_ = shared_cache{std::move(c), nullptr, 0, shared_.since};
+  }
 
-#endif
+  /// Get the shared cache of provided values, maybe nullptr.
+  const std::shared_ptr<shared_provider_cache>& shared_provider_cache_ptr()
+      const {
+    return shared_.cache;
+  }
 
-    // Do not support nested smart pointers, which is meaningless!
-    // DO NOT support top-level volatile for smart pointers!
-    if PEACAML_LUAW_IF_CONSTEXPR (!luaw_detail::is_std_shared_ptr<
-                                      Class>::value &&
-                                  !luaw_detail::is_std_unique_ptr<
-                                      Class>::value) {
-      Basic::template register_member_function<std::shared_ptr<Class>*>(
-          l, fname, mf);
-      Basic::template register_member_function<const std::shared_ptr<Class>*>(
-          l, fname, mf);
-      Basic::template register_member_function<std::shared_ptr<const Class>*>(
-          l, fname, mf);
-      Basic::template register_member_function<
-          const std::shared_ptr<const Class>*>(l, fname, mf);
+  /**
+   * @brief Prefetch values of global variables a Lua function may read, before
+   * running it.
+   *
+   * Names are found by get_free_globals, and only those missing in _G and the
+   * provider cache are requested. Standard libraries to be loaded by
+   * lazy_load_libs are not missing. If the provider has the batch provide, it is
+   * called once with all names, and should push exactly one value for each
+   * name in order (nil if not found). Else if the provider has provide_async,
+   * all fetches are started before waiting for any of them, so they run
+   * concurrently, and it fails if any value is missing (an invalid future or
+   * a future throwing exception), but only after all futures started are
+   * destroyed, which waits for their tasks if made by std::async. Otherwise
+   * provide is called for each name, whose failures are ignored here since
+   * the variable may not be used at all.
+   * Prefetched values are put into the provider cache if enabled, otherwise
+   * kept until clear_prefetched.
+   *
+   * @param [in] idx Index of the function on stack.
+   * @param [in] disable_log Whether print a log when exception occurs.
+   * @return Whether succeeded.
+   */
+  bool prefetch(int idx = -1, bool disable_log = false) {
+    if (!provider()) {
+      if (!disable_log) log_error("Need install provider");
+      return false;
+    }
+    bool                     failed = false;
+    std::vector<std::string> names  = get_free_globals(idx, &failed);
+    if (failed) {
+      if (!disable_log) log_error("Failed to find globals of the function");
+      return false;
+    }
+    return __prefetch_names(names, disable_log);
+  }
 
-      Basic::template register_member_function<std::unique_ptr<Class>*>(
-          l, fname, mf);
-      Basic::template register_member_function<const std::unique_ptr<Class>*>(
-          l, fname, mf);
-      Basic::template register_member_function<std::unique_ptr<const Class>*>(
-          l, fname, mf);
-      Basic::template register_member_function<
-          const std::unique_ptr<const Class>*>(l, fname, mf);
+  /// Release the prefetched values not in the provider cache.
+  void clear_prefetched() {
+    if (cache_.prefetched == LUA_NOREF) return;
+    luaL_unref(L(), LUA_REGISTRYINDEX, cache_.prefetched);
+    cache_.prefetched = LUA_NOREF;
+  }
 
-#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
-      // for low-level volatile
+  /**
+   * @brief Evaluate a Lua expression after prefetching variables it may read.
+   *
+   * Prefetched values not in the provider cache are released after the
+   * evaluation. If the compiled chunk cache for eval is enabled, global names
+   * found in the chunk are memoized along with it. Same as eval<T> else.
+   * @sa prefetch
+   */
+  template <typename T>
+  T prefetch_eval(const char* expr,
+                  bool        disable_log = false,
+                  bool*       failed      = nullptr) {
+    PEACALM_LUAW_ASSERT(expr);
+    auto   _g  = make_guarder();
+    int    sz  = gettop();
+    size_t len = strlen(expr);
+    if (__load_expr(expr, len, expr) != LUA_OK) {
+      if (failed) *failed = true;
+      if (!disable_log) log_error_in_stack();
+      return T();
+    }
+    if (!__prefetch_expr(expr, len, disable_log)) {
+      clear_prefetched();
+      if (failed) *failed = true;
+      return T();
+    }
+    int retcode = lua_pcall(L(), 0, LUA_MULTRET, 0);
+    clear_prefetched();
+    if (retcode != LUA_OK) {
+      if (failed) *failed = true;
+      if (!disable_log) log_error_in_stack();
+      return T();
+    }
+    PEACALM_LUAW_ASSERT(gettop() >= sz);
+    if (gettop() <= sz && !std::is_same<std::decay_t<T>, std::tuple<>>::value &&
+        !std::is_same<std::decay_t<T>, void>::value) {
+      if (failed) *failed = true;
+      if (!disable_log) log_error("No return");
+      return T();
+    }
+    return convertor_for_return<std::decay_t<T>>::to(
+        *this, sz + 1, disable_log, failed);
+  }
+  template <typename T>
+  T prefetch_eval(const std::string& expr,
+                  bool               disable_log = false,
+                  bool*              failed      = nullptr) {
+    return prefetch_eval<T>(expr.c_str(), disable_log, failed);
+  }
 
-      Basic::template register_nonvolatile_member_function<
-          std::shared_ptr<volatile Class>*>(l, fname);
-      Basic::template register_nonvolatile_member_function<
-          const std::shared_ptr<volatile Class>*>(l, fname);
-      Basic::template register_nonvolatile_member_function<
-          std::shared_ptr<const volatile Class>*>(l, fname);
-      Basic::template register_nonvolatile_member_function<
-          const std::shared_ptr<const volatile Class>*>(l, fname);
+private:
+  // Prefetch for the function on top of stack which is loaded from expr, by
+  // global names memoized in the compiled chunk cache if enabled.
+  bool __prefetch_expr(const char* expr, size_t len, bool disable_log) {
+    if (!provider()) {
+      if (!disable_log) log_error("Need install provider");
+      return false;
+    }
+    luaw_detail::chunk_cache*                       c = get_eval_cache();
+    std::shared_ptr<const std::vector<std::string>> memo;
+    if (c) memo = c->free_globals(expr, len);
+    if (memo) return __prefetch_names(*memo, disable_log);
+    bool                     failed = false;
+    std::vector<std::string> names  = get_free_globals(-1, &failed);
+    if (failed) {
+      if (!disable_log) log_error("Failed to find globals of the function");
+      return false;
+    }
+    if (c) c->free_globals(expr, len, names);
+    return __prefetch_names(names, disable_log);
+  }
 
-      Basic::template register_nonvolatile_member_function<
-          std::unique_ptr<volatile Class>*>(l, fname);
-      Basic::template register_nonvolatile_member_function<
-          const std::unique_ptr<volatile Class>*>(l, fname);
-      Basic::template register_nonvolatile_member_function<
-          std::unique_ptr<const volatile Class>*>(l, fname);
-      Basic::template register_nonvolatile_member_function<
-          const std::unique_ptr<const volatile Class>*>(l, fname);
+  // Prefetch values of given global names which are missing.
+  bool __prefetch_names(const std::vector<std::string>& names,
+                        bool                            disable_log) {
+    auto                     _g = make_guarder();
+    std::vector<const char*> missing;
+    pushglobaltable();
+    for (const auto& name : names) {
+      pushstring(name.c_str());
+      bool exists = lua_rawget(L(), -2) != LUA_TNIL ||
+                    (lazy_libs_ && is_lazy_lib_name(name.c_str()));
+      pop();
+      if (!exists && !(provider_cache_enabled() && cached(name.c_str())) &&
+          !(shared_.cache &&
+            fresh_shared(name.c_str(), name.data(), name.size()))) {
+        missing.push_back(name.c_str());
+      }
+    }
+    pop();
+    if (missing.empty()) return true;
+    using tag = std::conditional_t<
+        luaw_detail::has_batch_provide<provider_type>::value,
+        prefetch_by_batch,
+        std::conditional_t<luaw_detail::has_async_provide<provider_type>::value,
+                           prefetch_by_async,
+                           prefetch_by_name>>;
+    return __prefetch(missing, disable_log, tag{});
+  }
+
+  struct prefetch_by_batch {};
+  struct prefetch_by_async {};
+  struct prefetch_by_name {};
+
+  // Prefetch by the batch provide.
+  bool __prefetch(const std::vector<const char*>& names,
+                  bool                            disable_log,
+                  prefetch_by_batch) {
+    if (!checkstack(static_cast<int>(names.size()) + 3)) {
+      if (!disable_log) log_error("Too many variables to prefetch");
+      return false;
+    }
+    int sz = gettop();
+    if (!provider_->provide(*this, names)) {
+      if (!disable_log) log_error("Batch provide failed");
+      return false;
+    }
+    int diff = gettop() - sz;
+    if (diff != static_cast<int>(names.size())) {
+      if (!disable_log) {
+        std::string msg = "Batch provide should push " +
+                          std::to_string(names.size()) + " values, given " +
+                          std::to_string(diff);
+        log_error(msg.c_str());
+      }
+      return false;
+    }
+    for (size_t i = 0; i < names.size(); ++i) {
+      pushvalue(sz + 1 + static_cast<int>(i));
+      put_prefetched(names[i]);
+    }
+    return true;
+  }
+
+  // Prefetch by provide_async. Values are pushed in order once ready.
+  // It's not fail-fast: after a failure, it returns when all futures started
+  // are destroyed, and futures made by std::async wait for their tasks then.
+  bool __prefetch(const std::vector<const char*>& names,
+                  bool                            disable_log,
+                  prefetch_by_async) {
+    using future_t =
+        decltype(provider_->provide_async(std::declval<const char*>()));
+    using value_t = std::decay_t<decltype(std::declval<future_t&>().get())>;
+    std::vector<future_t> futures;
+    futures.reserve(names.size());
+    for (const char* name : names) {
+      futures.push_back(provider_->provide_async(name));
+      if (!futures.back().valid()) {
+        if (!disable_log) {
+          log_error((std::string("Provide failed: ") + name).c_str());
+        }
+        return false;
+      }
+    }
+    for (size_t i = 0; i < names.size(); ++i) {
+      value_t v{};
+      if (!get_future(futures[i], v)) {
+        if (!disable_log) {
+          log_error((std::string("Provide failed: ") + names[i]).c_str());
+        }
+        return false;
+      }
+      push(std::move(v));
+      put_prefetched(names[i]);
+    }
+    return true;
+  }
 
-#endif
+  // Exceptions must not go through Lua, so get the value outside of it.
+  template <typename Future, typename T>
+  static bool get_future(Future& f, T& v) {
+    try {
+      v = f.get();
+      return true;
+    } catch (...) { return false; }
+  }
+
+  // Prefetch by provide one by one.
+  bool __prefetch(const std::vector<const char*>& names,
+                  bool                            disable_log,
+                  prefetch_by_name) {
+    for (const char* name : names) {
+      pushstring(name);
+      int  sz = gettop();
+      bool ok = provide(L(), sz, name);
+      count_provide(L(), name, ok, gettop() - sz);
+      if (!ok && cache_.negative) {
+        settop(sz);
+        pushnil();
+        ok = true;
+      }
+      if (ok && gettop() == sz + 1) put_prefetched(name);
+      settop(sz - 1);
     }
+    return true;
   }
-};
 
-template <typename Class, typename Return, typename... Args>
-struct luaw::registrar<Return (Class::*)(Args...) volatile> {
-  template <typename MemberFunction>
-  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
-    using Basic = luaw::registrar<Return (Class::*)(Args...)>;
+  // Pop the value on top of stack and keep it as prefetched value of "name".
+  void put_prefetched(const char* name) {
+    if (isnil(-1)) {
+      if (cache_.negative && provider_cache_enabled()) {
+        pushstring(name);
+        put_negative(L(), gettop(), name);
+        pop();
+      }
+      pop();
+      return;
+    }
+    pushstring(name);
+    if (shared_.cache) {
+      pushvalue(-2);
+      put_in_shared(L(), gettop() - 1, name);
+      pop();
+    }
+    if (provider_cache_enabled()) {
+      pushvalue(-2);
+      put_in_cache(L(), gettop() - 1, name);
+      pop(3);
+      return;
+    }
+    if (cache_.prefetched == LUA_NOREF) {
+      newtable();
+      cache_.prefetched = luaL_ref(L(), LUA_REGISTRYINDEX);
+    }
+    lua_rawgeti(L(), LUA_REGISTRYINDEX, cache_.prefetched);
+    lua_insert(L(), -3);
+    lua_insert(L(), -3);
+    lua_rawset(L(), -3);
+    pop();
+  }
 
-    Basic::template register_member_function<Class*>(l, fname, mf);
-    Basic::template register_nonconst_member_function<const Class*>(l, fname);
+  // Whether the cache has an unexpired value of "name".
+  bool cached(const char* name) {
+    lua_rawgeti(L(), LUA_REGISTRYINDEX, cache_.ref);
+    bool hit = lua_getfield(L(), -1, name) != LUA_TNIL;
+    pop(2);
+    return hit && (cache_.ttls.empty() || !expired(name));
+  }
 
-#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+  // Push the prefetched value of given name (at index "kidx") and return true
+  // if found, otherwise push nothing and return false.
+  bool find_prefetched(lua_State* L, int kidx) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, cache_.prefetched);
+    lua_pushvalue(L, kidx);
+    if (lua_rawget(L, -2) != LUA_TNIL) {
+      lua_remove(L, -2);
+      return true;
+    }
+    lua_pop(L, 2);
+    return false;
+  }
 
-    Basic::template register_member_function<volatile Class*>(l, fname, mf);
-    Basic::template register_nonconst_member_function<const volatile Class*>(
-        l, fname);
+private:
+  // Push the cached value of given name (at index "kidx") and return true if
+  // hit, otherwise push nothing and return false.
+  bool find_in_cache(lua_State* L, int kidx, const char* name) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, cache_.ref);
+    lua_pushvalue(L, kidx);
+    if (lua_rawget(L, -2) != LUA_TNIL) {
+      if (cache_.ttls.empty() || !name || !expired(name)) {
+        lua_remove(L, -2);
+        ++cache_.stats.hits;
+        if (lua_touserdata(L, -1) == negative_sentinel()) {
+          lua_pop(L, 1);
+          lua_pushnil(L);
+          ++cache_.stats.negative_hits;
+        }
+        return true;
+      }
+      ++cache_.stats.expired;
+    }
+    lua_pop(L, 2);
+    ++cache_.stats.misses;
+    return false;
+  }
 
-#endif
+  bool expired(const char* name) {
+    auto it = cache_.ttls.find(name);
+    return it != cache_.ttls.end() && clock_t::now() >= it->second.expire_at;
+  }
 
-    // Do not support nested smart pointers, which is meaningless!
-    // DO NOT support top-level volatile for smart pointers!
-    if PEACAML_LUAW_IF_CONSTEXPR (!luaw_detail::is_std_shared_ptr<
-                                      Class>::value &&
-                                  !luaw_detail::is_std_unique_ptr<
-                                      Class>::value) {
-      Basic::template register_member_function<std::shared_ptr<Class>*>(
-          l, fname, mf);
-      Basic::template register_member_function<const std::shared_ptr<Class>*>(
-          l, fname, mf);
+  // Cache the value on top of stack by given name (at index "kidx").
+  void put_in_cache(lua_State* L, int kidx, const char* name) {
+    if (lua_isnil(L, -1)) return;
+    if (!cache_.ttls.empty() && name) {
+      auto it = cache_.ttls.find(name);
+      if (it != cache_.ttls.end()) {
+        if (it->second.ttl <= clock_t::duration::zero()) return;
+        it->second.expire_at = clock_t::now() + it->second.ttl;
+      }
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, cache_.ref);
+    lua_pushvalue(L, kidx);
+    lua_pushvalue(L, -3);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+  }
 
-      Basic::template register_nonconst_member_function<
-          std::shared_ptr<const Class>*>(l, fname);
-      Basic::template register_nonconst_member_function<
-          const std::shared_ptr<const Class>*>(l, fname);
+  // A unique light userdata cached as value of variables remembered as nil.
+  static void* negative_sentinel() {
+    static const char sentinel = 0;
+    return (void*)&sentinel;
+  }
 
-      Basic::template register_member_function<std::unique_ptr<Class>*>(
-          l, fname, mf);
-      Basic::template register_member_function<const std::unique_ptr<Class>*>(
-          l, fname, mf);
+  // Remember the variable (name at index "kidx") as nil in the cache.
+  void put_negative(lua_State* L, int kidx, const char* name) {
+    lua_pushlightuserdata(L, negative_sentinel());
+    put_in_cache(L, kidx, name);
+    lua_pop(L, 1);
+  }
 
-      Basic::template register_nonconst_member_function<
-          std::unique_ptr<const Class>*>(l, fname);
-      Basic::template register_nonconst_member_function<
-          const std::unique_ptr<const Class>*>(l, fname);
+  // Count a call of the per-name provide which pushed "diff" values.
+  void count_provide(lua_State* L, const char* name, bool ok, int diff) {
+    if (!cache_.name_stats_enabled || !name) return;
+    auto& st = cache_.name_stats[name];
+    ++st.calls;
+    if (!ok) {
+      ++st.failures;
+    } else if (diff == 1 && lua_isnil(L, -1)) {
+      ++st.misses;
+    }
+  }
 
-#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
-      // for low-level volatile
+  // Reload the snapshot of the shared cache only if it's changed.
+  const shared_provider_cache::snapshot_t& shared_snapshot() {
+    uint64_t v = shared_.cache->version();
+    if (!shared_.snapshot || v != shared_.version) {
+      shared_.version  = v;
+      shared_.snapshot = shared_.cache->snapshot();
+    }
+    return shared_.snapshot;
+  }
+
+  // Get the TTL of "name", or nullptr if not set.
+  const cache_ttl* find_ttl(const char* name) const {
+    if (cache_.ttls.empty() || !name) return nullptr;
+    auto it = cache_.ttls.find(name);
+    return it == cache_.ttls.end() ? nullptr : &it->second;
+  }
+
+  // Get the shared value of "name" (as C string for TTL, and as "s" of "len"
+  // bytes for lookup), or nullptr if not found or stale for this object.
+  const shared_provider_cache::value* fresh_shared(const char* name,
+                                                  const char* s,
+                                                  size_t      len) {
+    const cache_ttl* ttl = find_ttl(name);
+    if (ttl && ttl->ttl <= clock_t::duration::zero()) return nullptr;
+    const shared_provider_cache::value* v =
+        shared_provider_cache::find(*shared_snapshot(), s, len);
+    if (v && shared_is_fresh(*v, ttl)) return v;
+    // Maybe put recently and not published yet
+    if (shared_.cache->find_pending(s, len, shared_.pending) &&
+        shared_is_fresh(shared_.pending, ttl)) {
+      return &shared_.pending;
+    }
+    return nullptr;
+  }
 
-      Basic::template register_member_function<
-          std::shared_ptr<volatile Class>*>(l, fname, mf);
-      Basic::template register_member_function<
-          const std::shared_ptr<volatile Class>*>(l, fname, mf);
+  // Whether shared value "v" is not stale for this object.
+  bool shared_is_fresh(const shared_provider_cache::value& v,
+                       const cache_ttl*                    ttl) const {
+    if (v.put_at < shared_.since) return false;
+    if (ttl || v.expire_at != clock_t::time_point::max()) {
+      const auto now = clock_t::now();
+      if (now >= v.expire_at) return false;
+      if (ttl && now - v.put_at >= ttl->ttl) return false;
+    }
+    return true;
+  }
+
+  // Push the shared value of given name (at index "kidx") and return true if
+  // found and not stale, otherwise push nothing and return false.
+  bool find_in_shared(lua_State* L, int kidx, const char* name) {
+    size_t      len;
+    const char* s = lua_tolstring(L, kidx, &len);
+    const shared_provider_cache::value* v = fresh_shared(name, s, len);
+    if (!v) return false;
+    shared_provider_cache::push(L, *v);
+    return true;
+  }
+
+  // Put the value on top of stack into the shared cache by "name" (at index
+  // "kidx") if it's plain and the name could be cached.
+  void put_in_shared(lua_State* L, int kidx, const char* name) {
+    const cache_ttl*             ttl = find_ttl(name);
+    shared_provider_cache::value v;
+    if (ttl && ttl->ttl <= clock_t::duration::zero()) return;
+    if (!shared_provider_cache::to_value(L, -1, v)) return;
+    if (ttl) v.expire_at = clock_t::now() + ttl->ttl;
+    size_t      len;
+    const char* s = lua_tolstring(L, kidx, &len);
+    shared_.cache->put(std::string(s, len), v);
+  }
+
+  // Release the provider cache, prefetched values and interned IDs referenced
+  // in LUA_REGISTRYINDEX.
+  void release_refs() {
+    if (L()) {
+      luaL_unref(L(), LUA_REGISTRYINDEX, cache_.ref);
+      luaL_unref(L(), LUA_REGISTRYINDEX, cache_.prefetched);
+      luaL_unref(L(), LUA_REGISTRYINDEX, ids_.ref);
+    }
+    cache_.ref        = LUA_NOREF;
+    cache_.prefetched = LUA_NOREF;
+    ids_.ref          = LUA_NOREF;
+  }
 
-      Basic::template register_nonconst_member_function<
-          std::shared_ptr<const volatile Class>*>(l, fname);
-      Basic::template register_nonconst_member_function<
-          const std::shared_ptr<const volatile Class>*>(l, fname);
+  // Get ID of the name at index "idx" of L, intern it if not yet.
+  var_id_t intern(lua_State* L, int idx) {
+    idx = lua_absindex(L, idx);
+    if (ids_.ref == LUA_NOREF) {
+      lua_newtable(L);
+      ids_.ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ids_.ref);
+    lua_pushvalue(L, idx);
+    if (lua_rawget(L, -2) == LUA_TNUMBER) {
+      var_id_t id = static_cast<var_id_t>(lua_tointeger(L, -1));
+      lua_pop(L, 2);
+      return id;
+    }
+    lua_pop(L, 1);
+    size_t      len;
+    const char* s  = lua_tolstring(L, idx, &len);
+    var_id_t    id = static_cast<var_id_t>(ids_.names.size());
+    ids_.names.emplace_back(s, len);
+    lua_pushvalue(L, idx);
+    lua_pushinteger(L, id);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    return id;
+  }
 
-      Basic::template register_member_function<
-          std::unique_ptr<volatile Class>*>(l, fname, mf);
-      Basic::template register_member_function<
-          const std::unique_ptr<volatile Class>*>(l, fname, mf);
+  // Provide the variable whose name is at index "kidx" of L.
+  // Pass this object to the provider directly if working on the same thread,
+  // otherwise (e.g. in a coroutine) a fakeluaw of the thread.
+  bool provide(lua_State* L, int kidx, const char* var_name) {
+    using by_id = luaw_detail::has_id_provide<provider_type>;
+    if (L == this->L()) return provide(*this, kidx, var_name, by_id{});
+    fakeluaw l(L);
+    return provide(l, kidx, var_name, by_id{});
+  }
+  bool provide(luaw& l, int kidx, const char* var_name, std::false_type) {
+    return provider_->provide(l, var_name);
+  }
+  bool provide(luaw& l, int kidx, const char* var_name, std::true_type) {
+    if (lua_type(l.L(), kidx) != LUA_TSTRING) return false;
+    return provider_->provide(l, intern(l.L(), kidx));
+  }
 
-      Basic::template register_nonconst_member_function<
-          std::unique_ptr<const volatile Class>*>(l, fname);
-      Basic::template register_nonconst_member_function<
-          const std::unique_ptr<const volatile Class>*>(l, fname);
+  // The "__index" of _G's metatable is a C closure with "this" as upvalue.
+  // It also loads standard libs if they were to be loaded lazily.
+  void set_globale_metateble() {
+    pushglobaltable();
+    if (!getmetatable(-1)) {
+      newtable();
+    } else {
+      getfield(-1, "__index");
+      if (lua_tocfunction(L(), -1) == lazy_libs_index) lazy_libs_ = true;
+      pop();
+    }
+    pushlightuserdata((void*)this);
+    lua_pushcclosure(L(), _G__index, 1);
+    setfield(-2, "__index");
+    setmetatable(-2);
+    pop();
+  }
 
-#endif
+  static int _G__index(lua_State* L) {
+    pointer_t p = (pointer_t)lua_touserdata(L, lua_upvalueindex(1));
+    if (!p) {
+      return luaL_error(L, "Pointer 'this' not found");
+    } else if (!p->provider()) {
+      return luaL_error(L, "Need install provider");
+    } else {
+      if (p->lazy_libs_ && lazy_load_lib(L, 2)) return 1;
+      const char* name  = lua_tostring(L, 2);
+      const bool  cache = p->provider_cache_enabled();
+      if (cache && p->find_in_cache(L, 2, name)) return 1;
+      if (p->cache_.prefetched != LUA_NOREF && p->find_prefetched(L, 2)) {
+        return 1;
+      }
+      const bool shared = p->shared_.cache && lua_type(L, 2) == LUA_TSTRING;
+      if (shared && p->find_in_shared(L, 2, name)) {
+        if (cache) p->put_in_cache(L, 2, name);
+        return 1;
+      }
+      int  sz = lua_gettop(L);
+      bool ok = p->provide(L, 2, name);
+      p->count_provide(L, name, ok, lua_gettop(L) - sz);
+      if (!ok) {
+        if (!p->cache_.negative) {
+          return luaL_error(L, "Provide failed: %s", name);
+        }
+        lua_settop(L, sz);
+        lua_pushnil(L);
+      }
+      int diff = lua_gettop(L) - sz;
+      if (diff != 1) {
+        return luaL_error(L, "Should push exactly one value, given %d", diff);
+      }
+      if (lua_isnil(L, -1)) {
+        if (cache && p->cache_.negative) p->put_negative(L, 2, name);
+        return 1;
+      }
+      if (cache) p->put_in_cache(L, 2, name);
+      if (shared) p->put_in_shared(L, 2, name);
     }
+    return 1;
   }
 };
 
-template <typename Class, typename Return, typename... Args>
-struct luaw::registrar<Return (Class::*)(Args...) const volatile> {
-  template <typename MemberFunction>
-  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
-    using Basic = luaw::registrar<Return (Class::*)(Args...)>;
-
-    Basic::template register_member_function<Class*>(l, fname, mf);
-    Basic::template register_member_function<const Class*>(l, fname, mf);
-
-#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
+/**
+ * @brief Member registrations of classes recorded once, which can be installed
+ * into many states cheaply.
+ *
+ * The registrations are run once on a private recording state, then the
+ * entries of every object type (raw pointers, smart pointers, and their cv-
+ * variants) are flattened into a list owned by the binding. Installing into a
+ * state writes these entries into presized member tables, where getters,
+ * setters and member functions are referred by lightuserdata without creating
+ * any closure or userdata. Member functions are made into closures at first
+ * access in each state.
+ *
+ * Only member registrations are recorded (register_member, register_member_ptr,
+ * register_member_ref, register_static_member, dynamic members, and their
+ * variants). Other changes made to the recording state such as globals or
+ * constructors by register_ctor are not installed.
+ *
+ * Each state installed keeps a reference to the binding's data, so the binding
+ * object itself can be destructed earlier.
+ *
+ * Function objects recorded (e.g. lambdas registered as member functions,
+ * getters or setters) are shared by all states installed rather than copied
+ * per state. So they are called concurrently if those states are used by
+ * different threads, e.g. states of a luaw_pool, and must be thread-safe to
+ * call, e.g. stateless or only reading what they captured.
+ *
+ * Member functions are recorded only if they have the shape made by luaw: a C
+ * function without upvalues, or with one upvalue which is a lightuserdata or a
+ * full userdata read only by its address, or a callable object whose "__call"
+ * reads itself only by its address. The full userdata is referred by a
+ * lightuserdata in installed states. Other entries are skipped and reported.
+ */
+class luaw::class_binding {
+  struct entry {
+    std::string         name;  // member name, empty for dynamic members
+    int                 field;
+    int                 type;  // LUA_TBOOLEAN/LUA_TNUMBER/LUA_TLIGHTUSERDATA
+    lua_integer_t       i;     // value of boolean or number
+    const bound_member* b;
+  };
 
-    Basic::template register_member_function<volatile Class*>(l, fname, mf);
-    Basic::template register_member_function<const volatile Class*>(
-        l, fname, mf);
+  struct type_entries {
+    void*              key;  // (void*)(&typeid(ObjectType))
+    std::vector<entry> index, newindex, dynamic;
+  };
 
-#endif
+  struct impl {
+    luaw                     recorder;
+    std::deque<bound_member> members;  // stable addresses
+    std::vector<type_entries> types;
+    size_t                   size = 0;
 
-    // Do not support nested smart pointers, which is meaningless!
-    // DO NOT support top-level volatile for smart pointers!
-    if PEACAML_LUAW_IF_CONSTEXPR (!luaw_detail::is_std_shared_ptr<
-                                      Class>::value &&
-                                  !luaw_detail::is_std_unique_ptr<
-                                      Class>::value) {
-      Basic::template register_member_function<std::shared_ptr<Class>*>(
-          l, fname, mf);
-      Basic::template register_member_function<const std::shared_ptr<Class>*>(
-          l, fname, mf);
-      Basic::template register_member_function<std::shared_ptr<const Class>*>(
-          l, fname, mf);
-      Basic::template register_member_function<
-          const std::shared_ptr<const Class>*>(l, fname, mf);
+    impl() : recorder(luaw::opt{}.ignore_libs().register_exfunctions(false)) {}
+  };
 
-      Basic::template register_member_function<std::unique_ptr<Class>*>(
-          l, fname, mf);
-      Basic::template register_member_function<const std::unique_ptr<Class>*>(
-          l, fname, mf);
-      Basic::template register_member_function<std::unique_ptr<const Class>*>(
-          l, fname, mf);
-      Basic::template register_member_function<
-          const std::unique_ptr<const Class>*>(l, fname, mf);
+  std::shared_ptr<const impl> impl_;
 
-#if PEACALM_LUAW_SUPPORT_VOLATILE_OBJECT
-      // for low-level volatile
+public:
+  /// An empty binding installing nothing.
+  class_binding() {}
 
-      Basic::template register_member_function<
-          std::shared_ptr<volatile Class>*>(l, fname, mf);
-      Basic::template register_member_function<
-          const std::shared_ptr<volatile Class>*>(l, fname, mf);
-      Basic::template register_member_function<
-          std::shared_ptr<const volatile Class>*>(l, fname, mf);
-      Basic::template register_member_function<
-          const std::shared_ptr<const volatile Class>*>(l, fname, mf);
+  /**
+   * @brief Record member registrations.
+   *
+   * @param [in] define Callback to make registrations on the given luaw.
+   * @param [in] disable_log Whether to print a log when some registered
+   * entries can't be recorded.
+   * @param [out] failed Will be set whether some entries can't be recorded,
+   * they are skipped.
+   */
+  explicit class_binding(const std::function<void(luaw&)>& define,
+                         bool  disable_log = false,
+                         bool* failed      = nullptr) {
+    auto p = std::make_shared<impl>();
+    define(p->recorder);
+    bool ok = record(*p, disable_log);
+    if (failed) *failed = !ok;
+    impl_ = std::move(p);
+  }
 
-      Basic::template register_member_function<
-          std::unique_ptr<volatile Class>*>(l, fname, mf);
-      Basic::template register_member_function<
-          const std::unique_ptr<volatile Class>*>(l, fname, mf);
-      Basic::template register_member_function<
-          std::unique_ptr<const volatile Class>*>(l, fname, mf);
-      Basic::template register_member_function<
-          const std::unique_ptr<const volatile Class>*>(l, fname, mf);
+  /// Whether records anything.
+  bool valid() const { return impl_ && impl_->size > 0; }
 
-#endif
+  /// Number of recorded entries of all object types.
+  size_t size() const { return impl_ ? impl_->size : 0; }
+
+  /**
+   * @brief Install the recorded members into a state.
+   *
+   * Recorded entries take the place of members registered with the same name
+   * before, as registering again does. Installing a binding more than once is
+   * harmless.
+   */
+  void install(luaw& l) const {
+    if (!impl_) return;
+    auto       _g = l.make_guarder();
+    lua_State* L  = l.L();
+    anchor(L);
+    for (const type_entries& t : impl_->types) {
+      l.touchtb(t.key, LUA_REGISTRYINDEX);
+      install_members(L, luaw::member_info_fields::member_index, t.index);
+      install_members(L, luaw::member_info_fields::member_newindex, t.newindex);
+      for (const entry& e : t.dynamic) {
+        if (e.type == LUA_TBOOLEAN) {
+          lua_pushboolean(L, static_cast<int>(e.i));
+        } else {
+          luaw::push_bound_function(L, e.b);
+        }
+        lua_rawseti(L, -2, e.field);
+      }
+      l.pop();
     }
   }
-};
 
-#if PEACALM_LUAW_SUPPORT_CPP17
-// for member functions with noexcept-specification
+private:
+  // Keep the data alive as long as the state by a full userdata in registry.
+  void anchor(lua_State* L) const {
+    void* key = const_cast<impl*>(impl_.get());
+    lua_pushlightuserdata(L, key);
+    if (lua_rawget(L, LUA_REGISTRYINDEX) != LUA_TNIL) {
+      lua_pop(L, 1);
+      return;
+    }
+    lua_pop(L, 1);
+    using holder_t = std::shared_ptr<const impl>;
+    lua_pushlightuserdata(L, key);
+    new (lua_newuserdatauv(L, sizeof(holder_t), 0)) holder_t(impl_);
+    lua_newtable(L);
+    lua_pushcfunction(L, [](lua_State* L) -> int {
+      static_cast<holder_t*>(lua_touserdata(L, 1))->~holder_t();
+      return 0;
+    });
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+  }
 
-template <typename Class, typename Return, typename... Args>
-struct luaw::registrar<Return (Class::*)(Args...) noexcept> {
-  template <typename MemberFunction>
-  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
-    using Basic = luaw::registrar<Return (Class::*)(Args...)>;
-    Basic::template register_member(l, fname, mf);
+  // Write entries into the member table "field" of the table on top of stack.
+  static void install_members(lua_State*                L,
+                              int                       field,
+                              const std::vector<entry>& entries) {
+    if (entries.empty()) return;
+    if (lua_rawgeti(L, -1, field) != LUA_TTABLE) {
+      lua_pop(L, 1);
+      lua_createtable(L, 0, static_cast<int>(entries.size()));
+      lua_pushvalue(L, -1);
+      lua_rawseti(L, -3, field);
+    }
+    for (const entry& e : entries) {
+      if (e.type == LUA_TBOOLEAN) {
+        lua_pushboolean(L, static_cast<int>(e.i));
+      } else if (e.type == LUA_TNUMBER) {
+        lua_pushinteger(L, e.i);
+      } else {
+        lua_pushlightuserdata(L, const_cast<bound_member*>(e.b));
+      }
+      luaw::put_member_entry(L, e.name.c_str());
+    }
+    lua_pop(L, 1);
   }
-};
 
-template <typename Class, typename Return, typename... Args>
-struct luaw::registrar<Return (Class::*)(Args...) const noexcept> {
-  template <typename MemberFunction>
-  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
-    using Basic = luaw::registrar<Return (Class::*)(Args...) const>;
-    Basic::template register_member(l, fname, mf);
+  // Flatten the per-type member info tables in the recording state.
+  static bool record(impl& p, bool disable_log) {
+    lua_State* L  = p.recorder.L();
+    bool       ok = true;
+    lua_pushnil(L);
+    while (lua_next(L, LUA_REGISTRYINDEX)) {
+      if (lua_islightuserdata(L, -2) && lua_istable(L, -1)) {
+        type_entries t{lua_touserdata(L, -2), {}, {}, {}};
+        ok &= record_members(
+            p, L, luaw::member_info_fields::member_index, t.index, disable_log);
+        ok &= record_members(p,
+                             L,
+                             luaw::member_info_fields::member_newindex,
+                             t.newindex,
+                             disable_log);
+        for (int field : {luaw::member_info_fields::dynamic_member_getter,
+                          luaw::member_info_fields::dynamic_member_setter}) {
+          lua_rawgeti(L, -1, field);
+          entry e{"", field, LUA_TNIL, 0, nullptr};
+          if (!lua_isnil(L, -1)) {
+            if (record_entry(p, L, e) && e.type != LUA_TNUMBER) {
+              t.dynamic.push_back(std::move(e));
+            } else {
+              ok = false;
+              if (!disable_log) log_error("Can't record dynamic member.");
+            }
+          }
+          lua_pop(L, 1);
+        }
+        p.size += t.index.size() + t.newindex.size() + t.dynamic.size();
+        if (!t.index.empty() || !t.newindex.empty() || !t.dynamic.empty()) {
+          p.types.push_back(std::move(t));
+        }
+      }
+      lua_pop(L, 1);
+    }
+    return ok;
+  }
+
+  // Record the member table "field" of the table on top of stack.
+  static bool record_members(impl&               p,
+                             lua_State*          L,
+                             int                 field,
+                             std::vector<entry>& entries,
+                             bool                disable_log) {
+    bool ok = true;
+    if (lua_rawgeti(L, -1, field) == LUA_TTABLE) {
+      lua_pushnil(L);
+      while (lua_next(L, -2)) {
+        if (lua_type(L, -2) != LUA_TSTRING) {  // not a member
+          lua_pop(L, 1);
+          continue;
+        }
+        size_t      len;
+        const char* name = lua_tolstring(L, -2, &len);
+        entry       e{std::string(name, len), field, LUA_TNIL, 0, nullptr};
+        if (record_entry(p, L, e)) {
+          entries.push_back(std::move(e));
+        } else {
+          ok = false;
+          if (!disable_log) {
+            log_error(("Can't record member: " + e.name).c_str());
+          }
+        }
+        lua_pop(L, 1);
+      }
+    }
+    lua_pop(L, 1);
+    return ok;
+  }
+
+  // Record the entry on top of stack.
+  static bool record_entry(impl& p, lua_State* L, entry& e) {
+    switch (lua_type(L, -1)) {
+      case LUA_TBOOLEAN:
+        e.type = LUA_TBOOLEAN;
+        e.i    = lua_toboolean(L, -1);
+        return true;
+      case LUA_TNUMBER:
+        e.type = LUA_TNUMBER;
+        e.i    = lua_tointeger(L, -1);
+        return true;
+      case LUA_TTABLE: {  // getter or setter
+        lua_rawgeti(L, -1, luaw::accessor_function);
+        lua_rawgeti(L, -2, luaw::accessor_data);
+        bound_member b{bound_member::accessor,
+                       lua_tocfunction(L, -2),
+                       lua_touserdata(L, -1)};
+        bool by_address = !lua_isuserdata(L, -1) || by_address_only(L, false);
+        lua_pop(L, 2);
+        return by_address && add(p, e, b);
+      }
+      case LUA_TFUNCTION: {
+        bound_member b{bound_member::function, lua_tocfunction(L, -1), nullptr};
+        if (lua_getupvalue(L, -1, 2)) {  // at most one upvalue
+          lua_pop(L, 1);
+          return false;
+        }
+        if (lua_getupvalue(L, -1, 1)) {
+          b.data          = lua_touserdata(L, -1);
+          bool by_address = lua_islightuserdata(L, -1) ||
+                            (lua_isuserdata(L, -1) && by_address_only(L, false));
+          lua_pop(L, 1);
+          if (!by_address) return false;
+        }
+        return add(p, e, b);
+      }
+      case LUA_TUSERDATA: {  // callable object
+        if (!by_address_only(L, true)) return false;
+        luaL_getmetafield(L, -1, "__call");
+        bound_member b{bound_member::callable,
+                       lua_tocfunction(L, -1),
+                       lua_touserdata(L, -2)};
+        lua_pop(L, 1);
+        return add(p, e, b);
+      }
+      default:
+        return false;
+    }
   }
-};
 
-template <typename Class, typename Return, typename... Args>
-struct luaw::registrar<Return (Class::*)(Args...) volatile noexcept> {
-  template <typename MemberFunction>
-  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
-    using Basic = luaw::registrar<Return (Class::*)(Args...) volatile>;
-    Basic::template register_member(l, fname, mf);
+  // Whether the full userdata on top of stack could be referred by a
+  // lightuserdata of its address, as data pushed by luaw: it has no user
+  // values set, and its metatable, if any, has no fields but "__gc" (and
+  // "__call" which is required for callable objects). So it's not checked by
+  // luaL_checkudata or reached by lua_getiuservalue.
+  static bool by_address_only(lua_State* L, bool callable) {
+    if (lua_getiuservalue(L, -1, 1) != LUA_TNONE && !lua_isnil(L, -1)) {
+      lua_pop(L, 1);
+      return false;
+    }
+    lua_pop(L, 1);
+    if (!lua_getmetatable(L, -1)) return !callable;
+    bool ok       = true;
+    bool has_call = false;
+    lua_pushnil(L);
+    while (ok && lua_next(L, -2)) {
+      const char* k = lua_type(L, -2) == LUA_TSTRING ? lua_tostring(L, -2) : "";
+      if (strcmp(k, "__call") == 0) {
+        has_call = lua_iscfunction(L, -1);
+        ok       = has_call;
+      } else {
+        ok = strcmp(k, "__gc") == 0;
+      }
+      lua_pop(L, 1);
+    }
+    if (!ok) lua_pop(L, 1);  // lua_next stopped early, the key is left
+    lua_pop(L, 1);
+    return ok && has_call == callable;
   }
-};
 
-template <typename Class, typename Return, typename... Args>
-struct luaw::registrar<Return (Class::*)(Args...) const volatile noexcept> {
-  template <typename MemberFunction>
-  static void register_member(luaw& l, const char* fname, MemberFunction mf) {
-    using Basic = luaw::registrar<Return (Class::*)(Args...) const volatile>;
-    Basic::template register_member(l, fname, mf);
+  static bool add(impl& p, entry& e, const bound_member& b) {
+    if (!b.fn) return false;  // not a C function
+    p.members.push_back(b);
+    e.type = LUA_TLIGHTUSERDATA;
+    e.b    = &p.members.back();
+    return true;
   }
 };
 
-#endif
-
-// @}
-
-////////////////////////////////////////////////////////////////////////////////
-
-namespace luaw_detail {
-template <typename T>
-struct __is_ptr : std::false_type {};
-template <typename T>
-struct __is_ptr<T*> : std::true_type {};
-template <typename T>
-struct __is_ptr<std::shared_ptr<T>> : std::true_type {};
-template <typename T, typename D>
-struct __is_ptr<std::unique_ptr<T, D>> : std::true_type {};
-template <typename T>
-struct is_ptr : __is_ptr<typename std::decay<T>::type> {};
-}  // namespace luaw_detail
-
 /**
- * @brief A Lua wrapper with custom variable provider.
- *
- * Derived from luaw, it can contain a user defined variable provider.
- * When a global variable used in some expression does not exist in Lua,
- * then it will seek the variable from the provider.
- *
- * The underlying provider type should implement a member function:
- *
- * * `bool provide(peacalm::luaw* l, const char* vname);`
+ * @brief A pool of initialized Lua states lent out by RAII handles, to avoid
+ * creating a state (loading libs, registering functions and classes) for each
+ * request.
  *
- * In this member function, it should push exactly one value whose name is
- * vname onto the stack of L then return true. Otherwise return false if vname
- * is illegal or vname doesn't have a correct value.
+ * Each state is created by the factory then warmed up by the warmup callback
+ * once, after which a baseline of _G is recorded. When a handle returns a
+ * state, the stack is cleared, _G is restored to the baseline (shallowly:
+ * globals added are removed, globals reassigned or removed are restored, but
+ * tables modified in place are not), and a bounded step of garbage
+ * collection runs.
+ * For custom_luaw, per-request values are released on return too: prefetched
+ * values and values in the provider cache (see clear_provider_cache). Other
+ * states of the object are kept: the provider, provider cache settings and
+ * statistics, interned variable IDs, and the shared provider cache, whose
+ * values outlive requests by design (limit them by TTLs if needed).
+ * A state moved out of its handle, or replaced (e.g. by luaw::reset), is
+ * dropped instead of being returned.
+ * Checking out and returning are thread-safe, but a state should be used by
+ * one thread at a time. The pool must outlive all its handles.
  *
- * @tparam VariableProviderPointer Should be a raw pointer type or
- * std::shared_ptr or std::unique_ptr.
+ * @tparam Luaw Type of states, luaw or a derived type like custom_luaw.
  */
-template <typename VariableProviderPointer>
-class custom_luaw : public luaw {
-  using base_t     = luaw;
-  using provider_t = VariableProviderPointer;
-  static_assert(luaw_detail::is_ptr<provider_t>::value,
-                "VariableProviderPointer should be pointer type");
-  using pointer_t      = custom_luaw*;
-  provider_t provider_ = nullptr;
+template <typename Luaw = luaw>
+class luaw_pool {
+public:
+  using luaw_type = Luaw;
+  using factory_t = std::function<std::unique_ptr<Luaw>()>;
+  using warmup_t  = std::function<void(Luaw&)>;
+
+private:
+  struct entry {
+    std::unique_ptr<Luaw> l;
+    int                   baseline = LUA_NOREF;
+  };
 
 public:
-  template <typename... Args>
-  custom_luaw(Args&&... args) : base_t(std::forward<Args>(args)...) {
-    set_globale_metateble();
+  /// RAII handle of a state checked out from the pool.
+  class handle {
+  public:
+    handle() {}
+    handle(const handle&)            = delete;
+    handle& operator=(const handle&) = delete;
+    handle(handle&& h) : pool_(h.pool_), e_(std::move(h.e_)) {
+      h.pool_ = nullptr;
+    }
+    handle& operator=(handle&& h) {
+      if (this != &h) {
+        reset();
+        pool_   = h.pool_;
+        e_      = std::move(h.e_);
+        h.pool_ = nullptr;
+      }
+      return *this;
+    }
+    ~handle() { reset(); }
+
+    /// Return the state to the pool in advance.
+    void reset() {
+      if (pool_ && e_) pool_->give_back(std::move(e_));
+      pool_ = nullptr;
+    }
+
+    bool  valid() const { return e_ != nullptr; }
+    Luaw* get() const { return e_ ? e_->l.get() : nullptr; }
+    Luaw& operator*() const { return *get(); }
+    Luaw* operator->() const { return get(); }
+
+  private:
+    friend class luaw_pool;
+    handle(luaw_pool* pool, std::unique_ptr<entry>&& e)
+        : pool_(pool), e_(std::move(e)) {}
+
+    luaw_pool*             pool_ = nullptr;
+    std::unique_ptr<entry> e_;
+  };
+
+  /**
+   * @brief Create a pool with "capacity" states initialized.
+   *
+   * @param [in] capacity Max number of idle states kept by the pool.
+   * @param [in] warmup Called once for each new state, e.g. to register
+   * functions and classes.
+   * @param [in] factory Create a new state, by default Luaw's default
+   * constructor.
+   */
+  explicit luaw_pool(size_t    capacity,
+                     warmup_t  warmup  = nullptr,
+                     factory_t factory = nullptr)
+      : capacity_(capacity),
+        warmup_(std::move(warmup)),
+        factory_(std::move(factory)) {
+    idle_.reserve(capacity_);
+    for (size_t i = 0; i < capacity_; ++i) idle_.push_back(create());
   }
 
-  // delete copy
-  custom_luaw(const custom_luaw&)            = delete;
-  custom_luaw& operator=(const custom_luaw&) = delete;
+  luaw_pool(const luaw_pool&)            = delete;
+  luaw_pool& operator=(const luaw_pool&) = delete;
 
-  // support move
-  custom_luaw(custom_luaw&& l)
-      : base_t(std::move(l)), provider_(std::move(l.provider_)) {
-    set_globale_metateble();
+  /**
+   * @brief Check out a state. A new state is created if none idle.
+   */
+  handle acquire() {
+    std::unique_ptr<entry> e;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (!idle_.empty()) {
+        e = std::move(idle_.back());
+        idle_.pop_back();
+      }
+    }
+    if (!e) e = create();
+    return handle(this, std::move(e));
   }
-  custom_luaw& operator=(custom_luaw&& r) {
-    base_t::operator=(std::move(r));
-    provider_ = std::move(r.provider_);
-    set_globale_metateble();
-    return *this;
+
+  /// Max number of idle states kept.
+  size_t capacity() const { return capacity_; }
+
+  /// Number of idle states now.
+  size_t idle() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return idle_.size();
   }
 
-  // provider getter and setter
-  void              provider(const provider_t& p) { provider_ = p; }
-  void              provider(provider_t&& p) { provider_ = std::move(p); }
-  const provider_t& provider() const { return provider_; }
-  provider_t&       provider() { return provider_; }
+  /// Number of states created in total.
+  size_t created() const { return created_.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Set the size of garbage collection step (in KB) run on each
+   * return. 0 means a basic step, negative means no collection.
+   */
+  void gc_step_kb(int kb) { gc_step_kb_ = kb; }
+  int  gc_step_kb() const { return gc_step_kb_; }
 
 private:
-  bool provide(lua_State* L, const char* var_name) {
-    fakeluaw l(L);
-    return provider() && provider()->provide(l, var_name);
+  std::unique_ptr<entry> create() {
+    auto e = std::make_unique<entry>();
+    e->l   = factory_ ? factory_() : std::make_unique<Luaw>();
+    if (warmup_) warmup_(*e->l);
+    e->l->settop(0);
+    e->baseline = snapshot_globals(e->l->L());
+    // Mark the state as the entry's, since a replaced state may be at the same
+    // address.
+    lua_pushlightuserdata(e->l->L(), e.get());
+    lua_rawsetp(e->l->L(), LUA_REGISTRYINDEX, this);
+    created_.fetch_add(1, std::memory_order_relaxed);
+    return e;
+  }
+
+  void give_back(std::unique_ptr<entry>&& e) {
+    // Drop it if the state is moved out or replaced.
+    lua_State* L = e->l ? e->l->L() : nullptr;
+    if (!L) return;
+    lua_settop(L, 0);
+    lua_rawgetp(L, LUA_REGISTRYINDEX, this);
+    const bool marked = lua_touserdata(L, -1) == e.get();
+    lua_pop(L, 1);
+    if (!marked) return;
+    release_request_values(*e->l, 0);
+    restore_globals(L, e->baseline);
+    if (gc_step_kb_ >= 0) lua_gc(L, LUA_GCSTEP, gc_step_kb_);
+    std::lock_guard<std::mutex> lock(mu_);
+    if (idle_.size() < capacity_) idle_.push_back(std::move(e));
   }
 
-  void set_globale_metateble() {
-    pushglobaltable();
-    if (!getmetatable(-1)) { newtable(); }
-    pushcfunction(_G__index);
-    setfield(-2, "__index");
-    setmetatable(-2);
-    pop();
-    pushlightuserdata((void*)this);
-    setfield(LUA_REGISTRYINDEX, "this");
+  // Release per-request values of custom_luaw. Nothing for other types.
+  template <typename T>
+  static auto release_request_values(T& l, int)
+      -> decltype(l.clear_prefetched(), l.clear_provider_cache(), void()) {
+    l.clear_prefetched();
+    l.clear_provider_cache();
   }
+  template <typename T>
+  static void release_request_values(T&, long) {}
 
-  static int _G__index(lua_State* L) {
-    const char* name = lua_tostring(L, 2);
-    lua_getfield(L, LUA_REGISTRYINDEX, "this");
-    pointer_t p = (pointer_t)lua_touserdata(L, -1);
-    if (!p) {
-      return luaL_error(L, "Pointer 'this' not found");
-    } else if (!p->provider()) {
-      return luaL_error(L, "Need install provider");
-    } else {
-      int sz = lua_gettop(L);
-      if (!p->provide(L, name)) {
-        return luaL_error(L, "Provide failed: %s", name);
+  // Copy _G shallowly into a new table referenced in LUA_REGISTRYINDEX.
+  static int snapshot_globals(lua_State* L) {
+    lua_newtable(L);
+    lua_pushglobaltable(L);
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+      lua_pushvalue(L, -2);
+      lua_insert(L, -2);
+      lua_rawset(L, -5);
+    }
+    lua_pop(L, 1);
+    return luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+
+  // Restore _G to the baseline table.
+  static void restore_globals(lua_State* L, int baseline) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, baseline);
+    lua_pushglobaltable(L);
+    // Remove added globals and restore reassigned ones. Assigning existing
+    // fields (including nil) during traversal is allowed.
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+      lua_pushvalue(L, -2);
+      lua_rawget(L, -5);
+      if (!lua_rawequal(L, -1, -2)) {
+        lua_pushvalue(L, -3);
+        lua_insert(L, -2);
+        lua_rawset(L, -5);
+      } else {
+        lua_pop(L, 1);
       }
-      int diff = lua_gettop(L) - sz;
-      if (diff != 1) {
-        return luaL_error(L, "Should push exactly one value, given %d", diff);
+      lua_pop(L, 1);
+    }
+    // Restore removed globals.
+    lua_pushnil(L);
+    while (lua_next(L, -3)) {
+      lua_pushvalue(L, -2);
+      lua_rawget(L, -4);
+      if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        lua_pushvalue(L, -2);
+        lua_insert(L, -2);
+        lua_rawset(L, -4);
+      } else {
+        lua_pop(L, 2);
       }
     }
-    return 1;
+    lua_pop(L, 2);
   }
+
+  const size_t                        capacity_;
+  warmup_t                            warmup_;
+  factory_t                           factory_;
+  mutable std::mutex                  mu_;
+  std::vector<std::unique_ptr<entry>> idle_;
+  std::atomic<size_t>                 created_{0};
+  int                                 gc_step_kb_ = 0;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -6402,7 +12306,6 @@ private:
 //     void provide(const std::vector<std::string>& vars)
 template <typename Derived>
 class luaw_crtp : public luaw {
-  static const std::unordered_set<std::string> lua_key_words;
   using base_t = luaw;
 
 public:
@@ -6411,7 +12314,7 @@ public:
 
   // Set global variables to Lua
   void prepare(const char* expr) {
-    std::vector<std::string> vars = detect_variable_names(expr);
+    const std::vector<std::string>& vars = detect_variable_names(expr);
     static_cast<Derived*>(this)->provide(vars);
   }
   void prepare(const std::string& expr) { prepare(expr.c_str()); }
@@ -6476,144 +12379,115 @@ public:
 
   //////////////////////////////////////////////////////////////////////////////
 
-  // Detect variable names in a lua script
-  std::vector<std::string> detect_variable_names(
+  /**
+   * @brief Detect names of global variables a Lua script may read.
+   *
+   * Names are found by analyzing bytecode of the compiled script (see
+   * get_free_globals), which is memoized per script in a bounded LRU cache.
+   * Names of tables and functions already in _G (e.g. standard libraries) are
+   * excluded, so are standard libraries to be loaded by lazy_load_libs.
+   * Returns empty if the script can't be compiled.
+   *
+   * The result refers to the memo, so it's valid until the next call.
+   * Detecting a script memoized without changes of the excluded names
+   * allocates nothing.
+   */
+  const std::vector<std::string>& detect_variable_names(
       const std::string& expr) const {
     return detect_variable_names(expr.c_str());
   }
-  std::vector<std::string> detect_variable_names(const char* expr) const {
-    if (!expr || *expr == 0) return std::vector<std::string>{};
-    std::unordered_set<std::string> ret, ud;  // ud: user defined
-    std::string                     name;
-    bool                            found = false;
-    for (const char* s = expr; *s;) {
-      if (found) {
-        if (std::isalnum(*s) || *s == '_') {
-          name += *s++;
-        } else if (*s == '(') {
-          name.clear();
-          found = false;
-          ++s;
-        } else {
-          if (!lua_key_words.count(name) && !ud.count(name)) {
-            const char* t = s;
-            while (std::isspace(*t)) ++t;
-            if (*t == '.') {
-              if (t[1] == '.') {
-                ret.insert(name);
-              } else {
-                // package or table
-              }
-            } else if (*t == '=' && t[1] != '=') {
-              // user defined var
-              ud.insert(name);
-            } else {
-              ret.insert(name);
-            }
-          }
-          name.clear();
-          found = false;
-          if (*s == '.') {
-            if (s[1] == '.') {
-              s += 2;
-            } else {
-              while (isalnum(*s) || *s == '_' || *s == '.') ++s;
-            }
-          } else if (*s == '-' && s[1] == '-') {
-            // code comment
-          } else {
-            ++s;
-          }
-        }
-      } else {  // not found variable name
-        if (isalpha(*s) || *s == '_') {
-          found = true;
-          name += *s++;
-        } else if (*s == '-' && s[1] == '-') {  // code comments
-          bool single_line_comment = false;
-          if (s[2] == '[') {
-            if (s[3] == '[') {
-              s += 4;
-              while (*s && !(*s == ']' && s[1] == ']')) ++s;
-              if (*s) s += 2;
-            } else if (s[3] == '=') {
-              int         cnt = 1;  // count of consecutive "="
-              const char* t   = s + 4;
-              while (*t && *t == '=') {
-                ++cnt;
-                ++t;
-              }
-              if (*t == '[') {
-                s = t + 1;
-                while (*s) {
-                  if (*s != ']') {
-                    ++s;
-                    continue;
-                  }
-                  if (s[1] == '=') {
-                    int         cnt2 = 1;
-                    const char* t2   = s + 2;
-                    while (*t2 && *t2 == '=') ++cnt2, ++t2;
-                    if (cnt2 == cnt && *t2 == ']') {
-                      s = t2 + 1;
-                      break;
-                    }
-                    s = t2;
-                    continue;
-                  }
-                  ++s;
-                }
-              } else {
-                single_line_comment = true;
-              }
-            } else {
-              single_line_comment = true;
-            }
-          } else {
-            single_line_comment = true;
-          }
-          if (single_line_comment) {
-            s += 2;
-            while (*s != '\n') ++s;
-            ++s;
-          }
-        } else if (*s == '[' && s[1] == '[') {  // multi line string
-          s += 2;
-          while (*s && !(*s == ']' && s[1] == ']')) ++s;
-          if (*s) s += 2;
-        } else if (*s == '\'' || *s == '\"') {  // one line string
-          char target = *s;
-          while (true) {
-            ++s;
-            if (*s == 0) break;
-            if (*s == target) {
-              int cnt = 0;  // count of consecutive "\"
-              while (s[-cnt - 1] == '\\') ++cnt;
-              if (~cnt & 1) {
-                ++s;
-                break;
-              }
-            }
-          }
-        } else {
-          ++s;
-        }
+  const std::vector<std::string>& detect_variable_names(
+      const char* expr) const {
+    static const std::vector<std::string> empty;
+    if (!expr || *expr == 0) return empty;
+    names_entry& e    = memoized_names(expr);
+    lua_State*   L    = this->L();
+    const bool   lazy = this->lazy_libs_enabled();
+    bool         diff = false;
+    lua_pushglobaltable(L);
+    for (size_t i = 0; i < e.names.size(); ++i) {
+      const std::string& name = e.names[i];
+      lua_pushlstring(L, name.data(), name.size());
+      int type = lua_rawget(L, -2);
+      lua_pop(L, 1);
+      const bool excluded =
+          type == LUA_TTABLE || type == LUA_TFUNCTION ||
+          (type == LUA_TNIL && lazy && is_lazy_lib_name(name.c_str()));
+      if (excluded != e.excluded[i]) {
+        e.excluded[i] = excluded;
+        diff          = true;
+      }
+    }
+    lua_pop(L, 1);
+    if (diff) {
+      e.detected.clear();
+      for (size_t i = 0; i < e.names.size(); ++i) {
+        if (!e.excluded[i]) e.detected.push_back(e.names[i]);
       }
     }
-    if (!name.empty() && !lua_key_words.count(name) && !ud.count(name)) {
-      ret.insert(name);
+    return e.detected;
+  }
+
+private:
+  static constexpr size_t names_memo_capacity = 1024;
+
+  using names_lru_t = std::list<const std::string*>;
+
+  // Global names a script may read, and those not excluded last time.
+  struct names_entry {
+    std::vector<std::string> names;
+    std::vector<std::string> detected;
+    std::vector<bool>        excluded;  // whether names[i] is excluded
+    names_lru_t::iterator    pos;
+  };
+
+  // Script -> global names it may read.
+  mutable std::unordered_map<std::string, names_entry> names_memo_;
+  mutable names_lru_t names_lru_;  // most recently used first
+  mutable std::string names_key_;  // buffer for lookup
+
+  // Find the memoized names of a script, or analyze and memoize them, evicting
+  // the least recently used ones if full.
+  names_entry& memoized_names(const char* expr) const {
+    names_key_.assign(expr);
+    auto it = names_memo_.find(names_key_);
+    if (it != names_memo_.end()) {
+      names_lru_.splice(names_lru_.begin(), names_lru_, it->second.pos);
+      return it->second;
+    }
+    while (names_memo_.size() >= names_memo_capacity) {
+      auto old = names_memo_.find(*names_lru_.back());
+      names_lru_.pop_back();
+      names_memo_.erase(old);
+    }
+    names_entry e;
+    e.names    = analyze_free_globals(expr);
+    e.detected = e.names;
+    e.excluded.assign(e.names.size(), false);
+    it = names_memo_.emplace(names_key_, std::move(e)).first;
+    names_lru_.push_front(&it->first);
+    it->second.pos = names_lru_.begin();
+    return it->second;
+  }
+
+  std::vector<std::string> analyze_free_globals(const char* expr) const {
+    lua_State*  L = this->L();
+    std::string chunk;
+    if (luaL_loadstring(L, expr) != LUA_OK) {
+      lua_pop(L, 1);
+      return std::vector<std::string>{};
+    }
+    bool ok =
+        lua_dump(L, luaw_detail::bytecode::string_writer, &chunk, 1) == 0;
+    lua_pop(L, 1);
+    luaw_detail::bytecode::free_globals fg;
+    if (!ok || !fg.analyze(chunk.data(), chunk.size())) {
+      return std::vector<std::string>{};
     }
-    return std::vector<std::string>(ret.begin(), ret.end());
+    return fg.result();
   }
 };
 
-template <typename Derived>
-const std::unordered_set<std::string> luaw_crtp<Derived>::lua_key_words{
-    "nil",      "true",  "false",    "and",   "or",     "not",
-    "if",       "then",  "elseif",   "else",  "end",    "for",
-    "do",       "while", "repeat",   "until", "return", "break",
-    "continue", "goto",  "function", "in",    "local"};
-
 // Usage examples of luaw_crtp
 // VariableProviderType should implement member function:
 // `void provide(const std::vector<std::string> &vars, peacalm::luaw* l);`
@@ -0,0 +1,66 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef PEACALM_LUAW_TEST_TEMP_DIR_H_
+#define PEACALM_LUAW_TEST_TEMP_DIR_H_
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace luaw_test {
+
+// Remove a directory and everything in it.
+inline void remove_dir(const std::string& dir) {
+  if (DIR* d = ::opendir(dir.c_str())) {
+    while (struct dirent* e = ::readdir(d)) {
+      std::string name = e->d_name;
+      if (name == "." || name == "..") continue;
+      std::string path = dir + "/" + name;
+      struct stat st;
+      if (::lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        remove_dir(path);
+      } else {
+        std::remove(path.c_str());
+      }
+    }
+    ::closedir(d);
+  }
+  ::rmdir(dir.c_str());
+}
+
+// A temporary directory named by "prefix" under /tmp, removed with everything
+// in it on destruction. Its path is "." if failed to create.
+struct temp_dir {
+  std::string path;
+
+  explicit temp_dir(const std::string& prefix) {
+    std::string tmpl = "/tmp/" + prefix + "XXXXXX";
+    path             = ::mkdtemp(&tmpl[0]) ? tmpl : ".";
+  }
+  ~temp_dir() {
+    if (path != ".") remove_dir(path);
+  }
+
+  temp_dir(const temp_dir&)            = delete;
+  temp_dir& operator=(const temp_dir&) = delete;
+};
+
+}  // namespace luaw_test
+
+#endif  // PEACALM_LUAW_TEST_TEMP_DIR_H_
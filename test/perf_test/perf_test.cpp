@@ -14,9 +14,15 @@
 
 #include <gtest/gtest.h>
 
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <future>
 #include <initializer_list>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #if defined(ENABLE_MYOSTREAM_WATCH)
 #include <myostream.h>
@@ -31,6 +37,7 @@
 #endif
 
 #include "peacalm/luaw.h"
+#include "temp_dir.h"
 
 using namespace peacalm;
 
@@ -66,6 +73,44 @@ struct provider {
   }
 };
 
+struct batch_provider : provider {
+  using provider::provide;
+
+  bool provide(luaw& l, const std::vector<const char*>& vnames) {
+    for (const char* v : vnames) l.push(v[0] - 'a' + 1);
+    return true;
+  }
+};
+
+// Provides by dense variable IDs, values are backed by a flat array.
+struct id_provider {
+  std::vector<int> values;
+
+  bool provide(luaw& l, uint32_t vid) {
+    if (vid >= values.size()) return false;
+    l.push(values[vid]);
+    return true;
+  }
+};
+
+// Simulates a backend taking 1ms for each fetch.
+struct slow_provider : provider {
+  bool provide(luaw& l, const char* vname) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return provider::provide(l, vname);
+  }
+};
+
+struct slow_async_provider : slow_provider {
+  std::future<int> provide_async(const char* vname) {
+    int v = vname[0] - 'a' + 1;
+    return std::async(std::launch::async, [v]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      return v;
+    });
+  }
+};
+
 const char* expr =
     "return a + b - c * d + e / f * g ^ h - x * p - q * n / s + v - m + c ^ k";
 const int rep = 10000;
@@ -105,6 +150,173 @@ TEST(custom_luaw, re_init_nolib_eval) {
   watch(ret);
 }
 
+TEST(luaw, set_number_eval_rows) {
+  luaw l(luaw::opt{}.ignore_libs().register_exfunctions(false));
+  std::vector<std::vector<double>> columns(26, std::vector<double>(rep));
+  for (int c = 0; c < 26; ++c) {
+    for (int r = 0; r < rep; ++r) columns[c][r] = c + 1 + r % 3;
+  }
+  std::vector<double> ret(rep);
+  for (int r = 0; r < rep; ++r) {
+    for (int c = 0; c < 26; ++c) {
+      l.set_number(std::string{char('a' + c)}, columns[c][r]);
+    }
+    ret[r] = l.eval_double(expr);
+  }
+  watch(ret.back());
+}
+
+TEST(luaw, eval_batch_rows) {
+  luaw l(luaw::opt{}.ignore_libs().register_exfunctions(false));
+  std::vector<std::vector<double>> columns(26, std::vector<double>(rep));
+  for (int c = 0; c < 26; ++c) {
+    for (int r = 0; r < rep; ++r) columns[c][r] = c + 1 + r % 3;
+  }
+  std::vector<luaw::batch_column> input;
+  for (int c = 0; c < 26; ++c) {
+    input.emplace_back(std::string{char('a' + c)}, columns[c]);
+  }
+  std::vector<double> ret = l.eval_batch<double>(expr, input);
+  watch(ret.back());
+}
+
+#if PEACALM_LUAW_SUPPORT_CPP17
+// Expressions are slices of a larger buffer, like rules in a file
+TEST(luaw, eval_cache_copy_slices) {
+  luaw        l;
+  std::string rules = std::string(expr) + ";" + expr;
+  l.enable_eval_cache();
+  l.set_integer("a", 1);
+  for (char c = 'b'; c <= 'z'; ++c) l.set_integer(std::string{c}, c - 'a' + 1);
+  double ret;
+  for (int i = 0; i < rep; ++i) {
+    ret = l.eval_double(rules.substr(0, strlen(expr)));
+  }
+  watch(ret);
+}
+
+TEST(luaw, eval_cache_string_view_slices) {
+  luaw        l;
+  std::string rules = std::string(expr) + ";" + expr;
+  l.enable_eval_cache();
+  l.set_integer("a", 1);
+  for (char c = 'b'; c <= 'z'; ++c) l.set_integer(std::string{c}, c - 'a' + 1);
+  double ret;
+  for (int i = 0; i < rep; ++i) {
+    ret = l.eval_double(std::string_view(rules).substr(0, strlen(expr)));
+  }
+  watch(ret);
+}
+#endif
+
+TEST(luaw, eval_string_big_payload) {
+  luaw l;
+  l.enable_eval_cache();
+  l.set_string("payload", std::string(4096, 'x'));
+  size_t ret = 0;
+  for (int i = 0; i < rep; ++i) ret += l.eval_string("return payload").size();
+  watch(ret);
+}
+
+TEST(luaw, eval_string_view_big_payload) {
+  luaw l;
+  l.enable_eval_cache();
+  l.set_string("payload", std::string(4096, 'x'));
+  size_t ret = 0;
+  for (int i = 0; i < rep; ++i) {
+    ret += l.eval_string_view("return payload").size();
+  }
+  watch(ret);
+}
+
+TEST(luaw, set_and_clear_globals_eval_cache) {
+  luaw l;
+  l.enable_eval_cache();
+  double ret;
+  for (int i = 0; i < rep; ++i) {
+    for (int c = 0; c < 26; ++c) {
+      l.set_number(std::string{char('a' + c)}, c + 1 + i % 3);
+    }
+    ret = l.eval_double(expr);
+    for (int c = 0; c < 26; ++c) l.set_nil(std::string{char('a' + c)});
+  }
+  watch(ret);
+}
+
+TEST(luaw, eval_with_env_eval_cache) {
+  luaw l;
+  l.enable_eval_cache();
+  std::unordered_map<std::string, double> bindings;
+  double                                  ret;
+  for (int i = 0; i < rep; ++i) {
+    for (int c = 0; c < 26; ++c) {
+      bindings[std::string{char('a' + c)}] = c + 1 + i % 3;
+    }
+    ret = l.eval_with_env<double>(expr, bindings);
+  }
+  watch(ret);
+}
+
+// A temporary directory for files of loading tests, removed at exit.
+const luaw_test::temp_dir tmp("luaw_perf_test_");
+const std::string         bytecode_cache_dir = tmp.path + "/bytecode_cache";
+
+// A big script file for loading tests.
+const char* big_script_file() {
+  static const std::string fname = tmp.path + "/luaw_perf_test_big_script.lua";
+  static bool              init  = [] {
+    std::ofstream f(fname, std::ios::out | std::ios::trunc);
+    for (int i = 0; i < 2000; ++i) {
+      f << "function f" << i << "(a, b)\n"
+        << "  local t = {x = a, y = b, s = 'str" << i << "'}\n"
+        << "  if t.x > t.y then return t.x * " << i << " end\n"
+        << "  return t.y + " << i << "\n"
+        << "end\n";
+    }
+    f << "return f1999(1, 2)\n";
+    return true;
+  }();
+  (void)init;
+  return fname.c_str();
+}
+
+TEST(luaw, loadfile_no_bytecode_cache) {
+  const char* fname = big_script_file();
+  luaw        l;
+  int         ret = 0;
+  for (int i = 0; i < rep / 100; ++i) {
+    ret += l.loadfile(fname);
+    l.pop();
+  }
+  watch(ret);
+}
+
+TEST(luaw, loadfile_bytecode_cache_cold) {
+  const char* fname = big_script_file();
+  luaw        l;
+  l.enable_bytecode_cache(bytecode_cache_dir);
+  std::string cfile = l.get_bytecode_cache_file(fname);
+  int         ret   = 0;
+  for (int i = 0; i < rep / 100; ++i) {
+    std::remove(cfile.c_str());
+    ret += l.loadfile(fname);
+    l.pop();
+  }
+  watch(ret, l.get_bytecode_cache_stats().misses);
+}
+
+TEST(luaw, loadfile_bytecode_cache_warm) {
+  const char* fname = big_script_file();
+  luaw        l;
+  l.enable_bytecode_cache(bytecode_cache_dir);
+  int ret = 0;
+  for (int i = 0; i < rep / 100; ++i) {
+    ret += l.loadfile(fname);
+    l.pop();
+  }
+  watch(ret, l.get_bytecode_cache_stats().hits);
+}
+
 TEST(custom_luaw, re_init_preload_eval) {
   double ret;
   for (int i = 0; i < rep; ++i) {
@@ -115,6 +327,39 @@ TEST(custom_luaw, re_init_preload_eval) {
   watch(ret);
 }
 
+TEST(custom_luaw, re_init_lazy_load_eval) {
+  double ret;
+  for (int i = 0; i < rep; ++i) {
+    custom_luaw<std::unique_ptr<provider>> l(luaw::opt{}.lazy_load_libs());
+    l.provider(std::make_unique<provider>(false));
+    ret = l.eval_double(expr);
+  }
+  watch(ret);
+}
+
+TEST(custom_luaw, re_init_lazy_load_eval_with_lib) {
+  double ret;
+  for (int i = 0; i < rep; ++i) {
+    custom_luaw<std::unique_ptr<provider>> l(luaw::opt{}.lazy_load_libs());
+    l.provider(std::make_unique<provider>(false));
+    ret = l.eval_double("return math.max(a, b) + c");
+  }
+  watch(ret);
+}
+
+TEST(custom_luaw, pool_eval) {
+  using clw = custom_luaw<std::unique_ptr<provider>>;
+  luaw_pool<clw> pool(1, [](clw& l) {
+    l.provider(std::make_unique<provider>(false));
+  });
+  double ret;
+  for (int i = 0; i < rep; ++i) {
+    auto l = pool.acquire();
+    ret    = l->eval_double(expr);
+  }
+  watch(ret, pool.created());
+}
+
 TEST(custom_luaw, re_init_custom_load_eval) {
   double ret;
   for (int i = 0; i < rep; ++i) {
@@ -154,6 +399,293 @@ TEST(custom_luaw, eval_cache) {
   watch(ret);
 }
 
+TEST(custom_luaw, eval_no_cache_with_compiled_chunk_cache) {
+  custom_luaw<std::unique_ptr<provider>> l;
+  l.provider(std::make_unique<provider>(false));
+  l.enable_eval_cache();
+  double ret;
+  for (int i = 0; i < rep; ++i) { ret = l.eval_double(expr); }
+  watch(ret);
+}
+
+TEST(custom_luaw, eval_cache_with_compiled_chunk_cache) {
+  custom_luaw<std::unique_ptr<provider>> l;
+  l.provider(std::make_unique<provider>(true));
+  l.enable_eval_cache();
+  double ret;
+  for (int i = 0; i < rep; ++i) { ret = l.eval_double(expr); }
+  watch(ret);
+}
+
+TEST(custom_luaw, eval_provider_cache) {
+  custom_luaw<std::unique_ptr<provider>> l;
+  l.provider(std::make_unique<provider>(false));
+  l.enable_provider_cache();
+  l.enable_eval_cache();
+  double ret;
+  for (int i = 0; i < rep; ++i) {
+    // New batch of requests every 100 evaluations
+    if (i % 100 == 0) l.bump_provider_cache_generation();
+    ret = l.eval_double(expr);
+  }
+  watch(ret, l.get_provider_cache_stats().hits);
+}
+
+TEST(custom_luaw, prefetch_eval_batch_provider) {
+  custom_luaw<std::unique_ptr<batch_provider>> l;
+  l.provider(std::make_unique<batch_provider>());
+  l.enable_eval_cache();
+  double ret;
+  for (int i = 0; i < rep; ++i) { ret = l.prefetch_eval<double>(expr); }
+  watch(ret);
+}
+
+TEST(custom_luaw, eval_id_provider) {
+  custom_luaw<std::unique_ptr<id_provider>> l;
+  l.provider(std::make_unique<id_provider>());
+  for (int i = 0; i < 26; ++i) {
+    l.provider()->values.resize(l.var_id(std::string(1, 'a' + i)) + 1, i + 1);
+  }
+  l.enable_eval_cache();
+  double ret;
+  for (int i = 0; i < rep; ++i) { ret = l.eval_double(expr); }
+  watch(ret);
+}
+
+TEST(custom_luaw, eval_slow_provider) {
+  custom_luaw<std::unique_ptr<slow_provider>> l;
+  l.provider(std::make_unique<slow_provider>());
+  l.enable_eval_cache();
+  double ret;
+  for (int i = 0; i < rep / 100; ++i) { ret = l.eval_double(expr); }
+  watch(ret);
+}
+
+TEST(custom_luaw, prefetch_eval_async_provider) {
+  custom_luaw<std::unique_ptr<slow_async_provider>> l;
+  l.provider(std::make_unique<slow_async_provider>());
+  l.enable_eval_cache();
+  double ret;
+  for (int i = 0; i < rep / 100; ++i) { ret = l.prefetch_eval<double>(expr); }
+  watch(ret);
+}
+
+TEST(custom_luaw, eval_negative_provider_cache) {
+  custom_luaw<std::unique_ptr<provider>> l;
+  l.provider(std::make_unique<provider>(false));
+  l.enable_provider_cache();
+  l.set_negative_provider_cache(true);
+  l.enable_eval_cache();
+  double ret;
+  for (int i = 0; i < rep; ++i) {
+    ret = l.eval_double("return (opt1 or 0) + (opt2 or 0) + a");
+  }
+  watch(ret, l.get_provider_cache_stats().negative_hits);
+}
+
+TEST(custom_luaw, eval_shared_provider_cache) {
+  auto c = std::make_shared<shared_provider_cache>();
+  custom_luaw<std::unique_ptr<provider>> l;
+  l.provider(std::make_unique<provider>(false));
+  l.set_shared_provider_cache(c);
+  l.enable_eval_cache();
+  double ret;
+  for (int i = 0; i < rep; ++i) { ret = l.eval_double(expr); }
+  watch(ret, c->size());
+}
+
+TEST(custom_luaw, compiled_expr_eval_no_cache) {
+  custom_luaw<std::unique_ptr<provider>> l;
+  l.provider(std::make_unique<provider>(false));
+  auto   e = l.compile(expr);
+  double ret;
+  for (int i = 0; i < rep; ++i) { ret = e.eval<double>(); }
+  watch(ret);
+}
+
+TEST(custom_luaw, compiled_expr_eval_cache) {
+  custom_luaw<std::unique_ptr<provider>> l;
+  l.provider(std::make_unique<provider>(true));
+  auto   e = l.compile(expr);
+  double ret;
+  for (int i = 0; i < rep; ++i) { ret = e.eval<double>(); }
+  watch(ret);
+}
+
+TEST(custom_luaw, native_expr_eval_no_cache) {
+  custom_luaw<std::unique_ptr<provider>> l;
+  l.provider(std::make_unique<provider>(false));
+  auto   e = l.compile_native(expr);
+  double ret;
+  for (int i = 0; i < rep; ++i) { ret = e.eval<double>(); }
+  watch(ret, e.is_native());
+}
+
+TEST(custom_luaw, native_expr_eval_cache) {
+  custom_luaw<std::unique_ptr<provider>> l;
+  l.provider(std::make_unique<provider>(true));
+  auto   e = l.compile_native(expr);
+  double ret;
+  for (int i = 0; i < rep; ++i) { ret = e.eval<double>(); }
+  watch(ret, e.is_native());
+}
+
+TEST(luaw, native_expr_bind_rows) {
+  luaw l(luaw::opt{}.ignore_libs().register_exfunctions(false));
+  auto             e = l.compile_native(expr);
+  std::vector<int> slots;
+  for (int c = 0; c < 26; ++c) {
+    slots.push_back(e.slot(std::string{char('a' + c)}));
+  }
+  std::vector<double> ret(rep);
+  for (int r = 0; r < rep; ++r) {
+    for (int c = 0; c < 26; ++c) {
+      if (slots[c] >= 0) e.bind(slots[c], double(c + 1 + r % 3));
+    }
+    ret[r] = e.eval<double>();
+  }
+  watch(ret.back(), e.is_native());
+}
+
+TEST(luaw, native_expr_eval_columns) {
+  luaw l(luaw::opt{}.ignore_libs().register_exfunctions(false));
+  std::vector<std::vector<double>> columns(26, std::vector<double>(rep));
+  for (int c = 0; c < 26; ++c) {
+    for (int r = 0; r < rep; ++r) columns[c][r] = c + 1 + r % 3;
+  }
+  std::vector<luaw::batch_column> input;
+  for (int c = 0; c < 26; ++c) {
+    input.emplace_back(std::string{char('a' + c)}, columns[c]);
+  }
+  auto                e = l.compile_native(expr);
+  std::vector<double> ret(rep);
+  bool                simd = e.eval_columns(input, ret.data());
+  watch(ret.back(), simd);
+}
+
+std::vector<std::string> small_exprs() {
+  std::vector<std::string> ret;
+  for (int i = 0; i < 100; ++i) {
+    std::string a{char('a' + i % 26)}, b{char('a' + (i * 7 + 3) % 26)};
+    ret.push_back("return " + a + " * " + std::to_string(i) + " + " + b);
+  }
+  return ret;
+}
+
+TEST(custom_luaw, eval_many_exprs) {
+  custom_luaw<std::unique_ptr<provider>> l;
+  l.provider(std::make_unique<provider>(true));
+  auto   exprs = small_exprs();
+  double ret   = 0;
+  for (int i = 0; i < rep / 10; ++i) {
+    for (const auto& e : exprs) ret += l.eval_double(e);
+  }
+  watch(ret);
+}
+
+TEST(custom_luaw, eval_many_exprs_fused) {
+  custom_luaw<std::unique_ptr<provider>> l;
+  l.provider(std::make_unique<provider>(true));
+  auto   e   = l.compile_fused(small_exprs());
+  double ret = 0;
+  for (int i = 0; i < rep / 10; ++i) {
+    for (double v : e.eval_all<double>()) ret += v;
+  }
+  watch(ret);
+}
+
+struct bound_obj {
+  int    a = 1, b = 2, c = 3, d = 4;
+  double x = 1.5;
+  int    sum() const { return a + b + c + d; }
+  void   inc() { ++a; }
+};
+
+void register_bound_obj(luaw& l) {
+  l.register_member("a", &bound_obj::a);
+  l.register_member("b", &bound_obj::b);
+  l.register_member("c", &bound_obj::c);
+  l.register_member("d", &bound_obj::d);
+  l.register_member("x", &bound_obj::x);
+  l.register_member("sum", &bound_obj::sum);
+  l.register_member("inc", &bound_obj::inc);
+}
+
+TEST(luaw, member_access) {
+  luaw l;
+  register_bound_obj(l);
+  bound_obj o;
+  l.set("o", &o);
+  l.set("rep", rep);
+  double ret =
+      l.eval_double("local s = 0 for i = 1, rep do o.a = o.b "
+                    "s = s + o.a + o.c + o.x + o:sum() end return s");
+  watch(ret);
+}
+
+struct static_obj {
+  int    a = 1, b = 2, c = 3, d = 4;
+  double x = 1.5;
+};
+
+namespace peacalm {
+template <>
+struct luaw::static_members<static_obj> {
+  static constexpr auto value() {
+    return std::make_tuple(luaw::static_member("a", &static_obj::a),
+                           luaw::static_member("b", &static_obj::b),
+                           luaw::static_member("c", &static_obj::c),
+                           luaw::static_member("d", &static_obj::d),
+                           luaw::static_member("x", &static_obj::x));
+  }
+};
+}  // namespace peacalm
+
+TEST(luaw, static_member_access) {
+  luaw       l;
+  static_obj o;
+  l.set("o", &o);
+  l.set("rep", rep);
+  double ret = l.eval_double(
+      "local s = 0 for i = 1, rep do o.a = o.b "
+      "s = s + o.a + o.c + o.x end return s");
+  watch(ret);
+}
+
+TEST(luaw, register_members_per_state) {
+  size_t ret = 0;
+  for (int i = 0; i < rep / 10; ++i) {
+    luaw l(luaw::opt{}.ignore_libs());
+    register_bound_obj(l);
+    ret += l.gettop();
+  }
+  watch(ret);
+}
+
+TEST(luaw, class_binding_install) {
+  luaw::class_binding b(register_bound_obj);
+  size_t              ret = 0;
+  for (int i = 0; i < rep / 10; ++i) {
+    luaw l(luaw::opt{}.ignore_libs());
+    b.install(l);
+    ret += l.gettop();
+  }
+  watch(ret);
+}
+
+TEST(luaw, class_binding_member_access) {
+  luaw::class_binding b(register_bound_obj);
+  luaw                l;
+  b.install(l);
+  bound_obj o;
+  l.set("o", &o);
+  l.set("rep", rep);
+  double ret =
+      l.eval_double("local s = 0 for i = 1, rep do o.a = o.b "
+                    "s = s + o.a + o.c + o.x + o:sum() end return s");
+  watch(ret);
+}
+
 TEST(luaw_has_provider, eval_cache) {
   luaw_has_provider<std::unique_ptr<provider>> l;
   l.provider(std::make_unique<provider>(true));
@@ -162,6 +694,13 @@ TEST(luaw_has_provider, eval_cache) {
   watch(ret);
 }
 
+TEST(luaw_has_provider, detect_variable_names) {
+  luaw_has_provider<std::unique_ptr<provider>> l;
+  size_t                                       ret = 0;
+  for (int i = 0; i < rep; ++i) { ret += l.detect_variable_names(expr).size(); }
+  watch(ret);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
@@ -0,0 +1,115 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+
+#include "main.h"
+
+namespace {
+
+// A mock of slow backend. Each fetch waits until "expected" fetches are in
+// flight (or timeout), so all fetches succeed quickly only if they run
+// concurrently.
+struct mock_backend {
+  std::mutex              mu;
+  std::condition_variable cv;
+  int                     in_flight = 0;
+  int                     expected  = 0;
+  bool                    timeout   = false;
+
+  double fetch(const std::string &name) {
+    std::unique_lock<std::mutex> lock(mu);
+    ++in_flight;
+    cv.notify_all();
+    if (!cv.wait_for(lock, std::chrono::seconds(2), [this]() {
+          return in_flight >= expected;
+        })) {
+      timeout = true;
+    }
+    if (name == "bad") throw std::runtime_error("backend error");
+    return name[0] - 'a' + 1;
+  }
+};
+
+struct async_provider {
+  mock_backend               backend;
+  std::map<std::string, int> sync_calls;
+
+  std::future<double> provide_async(const char *vname) {
+    if (strcmp(vname, "none") == 0) return std::future<double>{};
+    std::string name = vname;
+    return std::async(std::launch::async,
+                      [this, name]() { return backend.fetch(name); });
+  }
+
+  bool provide(luaw &l, const char *vname) {
+    ++sync_calls[vname];
+    l.push(100);
+    return true;
+  }
+};
+
+using clw = custom_luaw<std::unique_ptr<async_provider>>;
+
+}  // namespace
+
+TEST(async_provider, concurrent_prefetch) {
+  clw l;
+  l.provider(std::make_unique<async_provider>());
+  l.provider()->backend.expected = 4;
+  l.set_integer("x", 10);
+
+  EXPECT_EQ(l.prefetch_eval<double>("return a + b * c - d + x"),
+            1 + 2 * 3 - 4 + 10);
+  EXPECT_FALSE(l.provider()->backend.timeout);
+  EXPECT_EQ(l.provider()->backend.in_flight, 4);
+  EXPECT_TRUE(l.provider()->sync_calls.empty());
+
+  // Released after evaluation
+  EXPECT_EQ(l.eval_int("return a"), 100);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(async_provider, fail_fast) {
+  clw l;
+  l.provider(std::make_unique<async_provider>());
+  l.provider()->backend.expected = 1;
+
+  bool failed = false;
+  EXPECT_EQ(l.prefetch_eval<double>("return a + none", true, &failed), 0);
+  EXPECT_TRUE(failed);
+  EXPECT_EQ(l.provider()->backend.in_flight, 1);
+
+  failed = false;
+  EXPECT_EQ(l.prefetch_eval<double>("return bad + b", true, &failed), 0);
+  EXPECT_TRUE(failed);
+  EXPECT_TRUE(l.provider()->sync_calls.empty());
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(async_provider, with_provider_cache) {
+  clw l;
+  l.provider(std::make_unique<async_provider>());
+  l.enable_provider_cache();
+  l.provider()->backend.expected = 2;
+
+  EXPECT_EQ(l.prefetch_eval<double>("return a + b"), 3);
+  EXPECT_EQ(l.prefetch_eval<double>("return a * b"), 2);
+  EXPECT_EQ(l.provider()->backend.in_flight, 2);
+  EXPECT_EQ(l.get_provider_cache_stats().hits, 4);
+  EXPECT_TRUE(l.provider()->sync_calls.empty());
+}
@@ -0,0 +1,210 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include <dirent.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include "main.h"
+#include "temp_dir.h"
+
+namespace {
+
+const char*               script_name = "luaw_bytecode_cache_test.lua";
+const luaw_test::temp_dir tmp("luaw_bytecode_cache_test_");
+const std::string         cache_dir   = tmp.path + "/cache";
+const std::string         script_file = tmp.path + "/" + script_name;
+
+void write_file(const std::string& fname, const std::string& content) {
+  std::ofstream f(fname, std::ios::out | std::ios::binary | std::ios::trunc);
+  f << content;
+}
+
+std::string read_file(const std::string& fname) {
+  std::ifstream f(fname, std::ios::in | std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(f),
+                     std::istreambuf_iterator<char>());
+}
+
+}  // namespace
+
+TEST(bytecode_cache, load_from_cache) {
+  write_file(script_file, "a = 1\nb = a + 1\nreturn a + b\n");
+  {
+    luaw l;
+    EXPECT_FALSE(l.bytecode_cache_enabled());
+    EXPECT_TRUE(l.enable_bytecode_cache(cache_dir));
+    EXPECT_TRUE(l.bytecode_cache_enabled());
+    std::remove(l.get_bytecode_cache_file(script_file).c_str());
+
+    EXPECT_EQ(l.dofile(script_file), LUA_OK);
+    EXPECT_EQ(l.to_int(-1), 3);
+    l.pop();
+    auto s = l.get_bytecode_cache_stats();
+    EXPECT_EQ(s.hits, 0);
+    EXPECT_EQ(s.misses, 1);
+    EXPECT_EQ(s.writes, 1);
+    EXPECT_FALSE(read_file(l.get_bytecode_cache_file(script_file)).empty());
+  }
+  {
+    // A new state loads the bytecode
+    luaw l;
+    EXPECT_TRUE(l.enable_bytecode_cache(cache_dir));
+    EXPECT_EQ(l.dofile(script_file.c_str()), LUA_OK);
+    EXPECT_EQ(l.to_int(-1), 3);
+    EXPECT_EQ(l.get_int("b"), 2);
+    l.pop();
+    EXPECT_EQ(l.loadfile(script_file), LUA_OK);
+    EXPECT_TRUE(l.isfunction(-1));
+    l.pop();
+    auto s = l.get_bytecode_cache_stats();
+    EXPECT_EQ(s.hits, 2);
+    EXPECT_EQ(s.misses, 0);
+    EXPECT_EQ(s.writes, 0);
+
+    l.disable_bytecode_cache();
+    EXPECT_FALSE(l.bytecode_cache_enabled());
+    EXPECT_EQ(l.get_bytecode_cache_stats().hits, 0);
+    EXPECT_EQ(l.dofile(script_file), LUA_OK);
+    EXPECT_EQ(l.to_int(-1), 3);
+    l.pop();
+  }
+}
+
+TEST(bytecode_cache, source_changed) {
+  write_file(script_file, "return 1");
+  luaw l;
+  EXPECT_TRUE(l.enable_bytecode_cache(cache_dir));
+  EXPECT_EQ(l.dofile(script_file), LUA_OK);
+  EXPECT_EQ(l.to_int(-1), 1);
+  l.pop();
+
+  write_file(script_file, "return 22");
+  EXPECT_EQ(l.dofile(script_file), LUA_OK);
+  EXPECT_EQ(l.to_int(-1), 22);
+  l.pop();
+  EXPECT_EQ(l.get_bytecode_cache_stats().hits, 0);
+  EXPECT_EQ(l.get_bytecode_cache_stats().misses, 2);
+
+  EXPECT_EQ(l.dofile(script_file), LUA_OK);
+  EXPECT_EQ(l.to_int(-1), 22);
+  l.pop();
+  EXPECT_EQ(l.get_bytecode_cache_stats().hits, 1);
+}
+
+TEST(bytecode_cache, corrupted_cache_file) {
+  write_file(script_file, "return 'abc'");
+  luaw l;
+  EXPECT_TRUE(l.enable_bytecode_cache(cache_dir));
+  EXPECT_EQ(l.dofile(script_file), LUA_OK);
+  l.pop();
+
+  std::string cfile   = l.get_bytecode_cache_file(script_file);
+  std::string content = read_file(cfile);
+  ASSERT_FALSE(content.empty());
+  content.back() ^= 1;
+  write_file(cfile, content);
+  EXPECT_EQ(l.dofile(script_file), LUA_OK);
+  EXPECT_EQ(l.to_string(-1), "abc");
+  l.pop();
+
+  write_file(cfile, content.substr(0, 10));
+  EXPECT_EQ(l.dofile(script_file), LUA_OK);
+  EXPECT_EQ(l.to_string(-1), "abc");
+  l.pop();
+
+  auto s = l.get_bytecode_cache_stats();
+  EXPECT_EQ(s.hits, 0);
+  EXPECT_EQ(s.misses, 3);
+  EXPECT_EQ(s.writes, 3);
+
+  EXPECT_EQ(l.dofile(script_file), LUA_OK);
+  l.pop();
+  EXPECT_EQ(l.get_bytecode_cache_stats().hits, 1);
+}
+
+TEST(bytecode_cache, concurrent_writes) {
+  write_file(script_file, "return 42");
+  std::vector<std::thread> threads;
+  std::vector<int>         results(8, 0);
+  for (size_t i = 0; i < results.size(); ++i) {
+    threads.emplace_back([&results, i] {
+      luaw l;
+      if (!l.enable_bytecode_cache(cache_dir)) return;
+      for (int j = 0; j < 20; ++j) {
+        std::remove(l.get_bytecode_cache_file(script_file).c_str());
+        if (l.dofile(script_file) != LUA_OK) return;
+        results[i] += l.to_int(-1) == 42;
+        l.pop();
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  EXPECT_EQ(results, std::vector<int>(results.size(), 20));
+
+  // No temporary files left
+  luaw l;
+  EXPECT_TRUE(l.enable_bytecode_cache(cache_dir));
+  std::string cfile = l.get_bytecode_cache_file(script_file);
+  std::string cname = cfile.substr(cfile.rfind('/') + 1);
+  DIR*        d     = ::opendir(cache_dir.c_str());
+  ASSERT_TRUE(d);
+  while (struct dirent* e = ::readdir(d)) {
+    EXPECT_EQ(std::string(e->d_name).find(cname + ".tmp"), std::string::npos);
+  }
+  ::closedir(d);
+}
+
+TEST(bytecode_cache, errors) {
+  luaw l;
+  EXPECT_TRUE(l.enable_bytecode_cache(cache_dir));
+
+  // Not exist
+  EXPECT_NE(l.dofile(tmp.path + "/not_exist.lua"), LUA_OK);
+  EXPECT_TRUE(l.isstring(-1));
+  l.pop();
+
+  // Syntax error
+  write_file(script_file, "return 1 +");
+  EXPECT_EQ(l.dofile(script_file), LUA_ERRSYNTAX);
+  EXPECT_TRUE(l.isstring(-1));
+  l.pop();
+
+  // Runtime error
+  write_file(script_file, "local x\nreturn x.y");
+  EXPECT_EQ(l.dofile(script_file), LUA_ERRRUN);
+  std::string err = l.to_string(-1);
+  l.pop();
+  EXPECT_NE(err.find(std::string(script_name) + ":2:"), std::string::npos);
+  EXPECT_EQ(l.dofile(script_file), LUA_ERRRUN);
+  EXPECT_EQ(l.to_string(-1), err);
+  l.pop();
+  EXPECT_EQ(l.get_bytecode_cache_stats().hits, 1);
+
+  // Skip the first line starts with '#', keep line numbers
+  write_file(script_file, "#!/usr/bin/env lua\nlocal x\nreturn x.y");
+  EXPECT_EQ(l.dofile(script_file), LUA_ERRRUN);
+  err = l.to_string(-1);
+  l.pop();
+  EXPECT_NE(err.find(std::string(script_name) + ":3:"), std::string::npos);
+
+  EXPECT_EQ(l.gettop(), 0);
+
+  // Not a directory
+  EXPECT_FALSE(l.enable_bytecode_cache(script_file));
+}
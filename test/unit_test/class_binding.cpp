@@ -0,0 +1,232 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "main.h"
+
+namespace {
+
+struct Account {
+  int                        id      = 1;
+  const int                  version = 3;
+  double                     balance = 10;
+  std::map<std::string, int> attrs;
+
+  double deposit(double v) { return balance += v; }
+  int    get_id() const { return id; }
+};
+
+luaw::class_binding make_binding(std::shared_ptr<int> counter = nullptr) {
+  return luaw::class_binding([counter](luaw& l) {
+    l.register_member("id", &Account::id);
+    l.register_member("version", &Account::version);
+    l.register_member("balance", &Account::balance);
+    l.register_member("deposit", &Account::deposit);
+    l.register_member("get_id", &Account::get_id);
+    l.register_member<int Account::*>(
+        "count",
+        [counter](const volatile Account*) -> int& { return *counter; });
+    l.register_member<int (Account::*)() const>(
+        "twice", [counter](const Account* a) { return a->id * 2; });
+    l.register_dynamic_member(
+        [](const Account* a, const std::string& k) -> int {
+          auto it = a->attrs.find(k);
+          return it == a->attrs.end() ? 0 : it->second;
+        },
+        [](Account* a, const std::string& k, int v) { a->attrs[k] = v; });
+  });
+}
+
+}  // namespace
+
+TEST(class_binding, install) {
+  auto                counter = std::make_shared<int>(0);
+  luaw::class_binding b       = make_binding(counter);
+  EXPECT_TRUE(b.valid());
+  EXPECT_GT(b.size(), 0);
+  EXPECT_FALSE(luaw::class_binding().valid());
+
+  luaw l1, l2;
+  b.install(l1);
+  b.install(l2);
+  b.install(l2);  // harmless
+  EXPECT_EQ(l1.gettop(), 0);
+  EXPECT_EQ(l2.gettop(), 0);
+
+  Account a;
+  for (luaw* l : {&l1, &l2}) {
+    l->set("a", &a);
+    EXPECT_EQ(l->eval_int("a.id = a.id + 1 return a.id"), a.id);
+    EXPECT_EQ(l->eval_int("return a.version"), 3);
+    EXPECT_EQ(l->eval_int("return a:get_id()"), a.id);
+    EXPECT_EQ(l->eval_int("return a:get_id()"), a.id);  // made at first access
+    EXPECT_EQ(l->eval_int("return a:twice()"), a.id * 2);
+    EXPECT_EQ(l->eval_int("a.count = a.count + 1 return a.count"), *counter);
+    EXPECT_EQ(l->eval_int("a.k = a.k + 2 return a.k"), a.attrs["k"]);
+    EXPECT_EQ(l->gettop(), 0);
+  }
+  EXPECT_EQ(a.id, 3);
+  EXPECT_EQ(*counter, 2);
+  EXPECT_EQ(a.attrs["k"], 4);
+  EXPECT_EQ(l1.eval_double("return a:deposit(5)"), 15);
+  EXPECT_EQ(l2.eval_double("return a:deposit(5)"), 20);
+
+  // Objects by value and smart pointers
+  l1.set("v", Account{});
+  EXPECT_EQ(l1.eval_double("v.balance = 1 return v:deposit(2)"), 3);
+  auto s = std::make_shared<Account>();
+  l2.set("s", s);
+  EXPECT_EQ(l2.eval_int("s.id = 9 return s:get_id()"), 9);
+  EXPECT_EQ(s->id, 9);
+}
+
+TEST(class_binding, errors) {
+  luaw l;
+  make_binding(std::make_shared<int>(0)).install(l);
+
+  Account a;
+  l.set("a", &a);
+  EXPECT_NE(l.dostring("a.version = 1"), LUA_OK);
+  EXPECT_NE(l.to_string(-1).find("Const member cannot be modified: version"),
+            std::string::npos);
+  l.pop();
+  EXPECT_NE(l.dostring("a.id = {}"), LUA_OK);
+  l.pop();
+  EXPECT_EQ(a.id, 1);
+
+  const Account ca;
+  l.set("ca", &ca);
+  EXPECT_EQ(l.eval_int("return ca:get_id()"), 1);
+  EXPECT_NE(l.dostring("ca:deposit(1)"), LUA_OK);
+  l.pop();
+  EXPECT_NE(l.dostring("ca.balance = 1"), LUA_OK);
+  l.pop();
+
+  std::shared_ptr<Account> e;
+  l.set("e", &e);
+  EXPECT_NE(l.dostring("return e.id"), LUA_OK);
+  EXPECT_NE(l.to_string(-1).find("Getting member by empty smart ptr."),
+            std::string::npos);
+  l.pop();
+  EXPECT_NE(l.dostring("return e:get_id()"), LUA_OK);
+  l.pop();
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(class_binding, registered_before_and_after) {
+  luaw l;
+  l.register_member<const int Account::*>(
+      "id", [](const Account*) -> int { return 100; });
+  l.register_member<const int Account::*>(
+      "other", [](const Account*) -> int { return 200; });
+  make_binding(std::make_shared<int>(0)).install(l);
+
+  Account a;
+  l.set("a", &a);
+  EXPECT_EQ(l.eval_int("return a.id"), 1);
+  EXPECT_EQ(l.eval_int("return a.other"), 200);
+
+  l.register_member<const int Account::*>(
+      "id", [](const Account*) -> int { return 300; });
+  EXPECT_EQ(l.eval_int("return a.id"), 300);
+}
+
+TEST(class_binding, lifetime) {
+  auto counter = std::make_shared<int>(0);
+  {
+    luaw l;
+    {
+      luaw::class_binding b = make_binding(counter);
+      EXPECT_GT(counter.use_count(), 1);
+      b.install(l);
+    }
+    EXPECT_GT(counter.use_count(), 1);  // kept alive by the state
+    Account a;
+    l.set("a", &a);
+    EXPECT_EQ(l.eval_int("a.count = 5 return a.count + a:twice()"), 7);
+    EXPECT_EQ(*counter, 5);
+  }
+  EXPECT_EQ(counter.use_count(), 1);
+}
+
+TEST(class_binding, unsupported) {
+  bool                failed = false;
+  luaw::class_binding b(
+      [](luaw& l) {
+        l.register_member("id", &Account::id);
+        // A string in the merged member table for __index
+        l.touchtb((void*)(&typeid(Account*)), LUA_REGISTRYINDEX)
+            .touchtb(1)
+            .setkv("bad", "not a member");
+        l.pop(2);
+      },
+      true,
+      &failed);
+  EXPECT_TRUE(failed);
+  EXPECT_TRUE(b.valid());
+
+  luaw l;
+  b.install(l);
+  Account a;
+  l.set("a", &a);
+  EXPECT_EQ(l.eval_int("return a.id"), 1);
+  EXPECT_TRUE(l.eval_bool("return a.bad == nil"));
+}
+
+TEST(class_binding, closure_shape) {
+  bool                failed = false;
+  luaw::class_binding b(
+      [](luaw& l) {
+        l.register_member("id", &Account::id);
+        lua_State*    L = l.L();
+        lua_CFunction f = [](lua_State*) -> int { return 0; };
+        l.touchtb((void*)(&typeid(Account*)), LUA_REGISTRYINDEX).touchtb(1);
+        // Upvalue checked by luaL_checkudata
+        lua_newuserdatauv(L, 8, 0);
+        luaL_newmetatable(L, "luaw_class_binding_test");
+        lua_setmetatable(L, -2);
+        lua_pushcclosure(L, f, 1);
+        lua_setfield(L, -2, "checked");
+        // Upvalue with a user value
+        lua_newuserdatauv(L, 8, 1);
+        lua_pushinteger(L, 1);
+        lua_setiuservalue(L, -2, 1);
+        lua_pushcclosure(L, f, 1);
+        lua_setfield(L, -2, "uservalue");
+        // Callable object with a named metatable
+        lua_newuserdatauv(L, 8, 0);
+        lua_newtable(L);
+        lua_pushcfunction(L, f);
+        lua_setfield(L, -2, "__call");
+        lua_pushstring(L, "callable");
+        lua_setfield(L, -2, "__name");
+        lua_setmetatable(L, -2);
+        lua_setfield(L, -2, "named");
+        l.pop(2);
+      },
+      true,
+      &failed);
+  EXPECT_TRUE(failed);
+  EXPECT_EQ(b.size(), luaw::class_binding([](luaw& l) {
+                        l.register_member("id", &Account::id);
+                      }).size());
+
+  luaw l;
+  b.install(l);
+  Account a;
+  l.set("a", &a);
+  EXPECT_EQ(l.eval_int("return a.id"), 1);
+  EXPECT_TRUE(
+      l.eval_bool("return a.checked == nil and a.uservalue == nil and "
+                  "a.named == nil"));
+}
@@ -0,0 +1,117 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "main.h"
+
+TEST(compile_fused, eval) {
+  luaw l;
+  auto e = l.compile_fused({"return a + b",
+                            "return a * b",
+                            "if a > b then return 'gt' else return 'le' end",
+                            "local c = a - b; return c, 'ignored'",
+                            "x = 1"});
+  EXPECT_TRUE(e.valid());
+  EXPECT_EQ(l.gettop(), 0);
+
+  l.set_integer("a", 2);
+  l.set_integer("b", 3);
+  auto t = e.eval<std::tuple<int, int, std::string, int, luaw::luavalueref>>();
+  EXPECT_EQ(std::get<0>(t), 5);
+  EXPECT_EQ(std::get<1>(t), 6);
+  EXPECT_EQ(std::get<2>(t), "le");
+  EXPECT_EQ(std::get<3>(t), -1);
+  EXPECT_TRUE(std::get<4>(t).as_nil());
+  EXPECT_EQ(l.get_int("x"), 1);
+
+  l.set_integer("a", 5);
+  bool failed = true;
+  auto v      = e.eval_all<luaw::luavalueref>(false, &failed);
+  EXPECT_FALSE(failed);
+  EXPECT_EQ(v.size(), 5);
+
+  auto d = l.compile_fused({"return a", "return b", "return a / b"})
+               .eval_all<double>(false, &failed);
+  EXPECT_FALSE(failed);
+  EXPECT_EQ(d, (std::vector<double>{5, 3, 5.0 / 3}));
+
+  // Fused expression could use names that used internally
+  l.set_integer("__luaw_fused", 7);
+  EXPECT_EQ(l.compile_fused({"return __luaw_fused"}).eval<int>(), 7);
+
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(compile_fused, many) {
+  luaw                     l;
+  std::vector<std::string> exprs;
+  std::vector<int>         expected;
+  for (int i = 0; i < 200; ++i) {
+    exprs.push_back("return a + " + std::to_string(i));
+    expected.push_back(1 + i);
+  }
+  auto e = l.compile_fused(exprs);
+  EXPECT_TRUE(e.valid());
+  l.set_integer("a", 1);
+  EXPECT_EQ(e.eval_all<int>(), expected);
+}
+
+TEST(compile_fused, failed) {
+  luaw l;
+  {
+    bool failed = false;
+    auto e = l.compile_fused({"return 1", "return 1 +"}, true, &failed);
+    EXPECT_TRUE(failed);
+    EXPECT_FALSE(e.valid());
+  }
+  {
+    bool failed = false;
+    auto e      = l.compile_fused({"return 1", "return x.y"}, true, &failed);
+    EXPECT_FALSE(failed);
+    EXPECT_TRUE(e.valid());
+    auto v = e.eval_all<int>(true, &failed);
+    EXPECT_TRUE(failed);
+    EXPECT_TRUE(v.empty());
+  }
+  {
+    bool failed = false;
+    auto e      = l.compile_fused({"return 1", "return 'x'"});
+    auto v      = e.eval_all<int>(true, &failed);
+    EXPECT_TRUE(failed);
+    EXPECT_EQ(v, (std::vector<int>{1, 0}));
+  }
+  {
+    // Invalid alone, though valid after fusion which shifts the results
+    bool failed = false;
+    auto e      = l.compile_fused(
+        {"return 1 end, function() return 2", "return 3"}, true, &failed);
+    EXPECT_TRUE(failed);
+    EXPECT_FALSE(e.valid());
+  }
+  {
+    // Valid alone, but not in a function
+    bool failed = false;
+    auto e      = l.compile_fused({"return 1", "return ..."}, true, &failed);
+    EXPECT_TRUE(failed);
+    EXPECT_FALSE(e.valid());
+  }
+  {
+    // empty
+    bool failed = true;
+    auto e      = l.compile_fused({}, true, &failed);
+    EXPECT_TRUE(e.valid());
+    EXPECT_TRUE(e.eval_all<int>(true, &failed).empty());
+    EXPECT_FALSE(failed);
+  }
+  EXPECT_EQ(l.gettop(), 0);
+}
@@ -0,0 +1,95 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "main.h"
+
+TEST(compiled_expr, eval) {
+  luaw l;
+  auto e = l.compile("return a + b");
+  EXPECT_TRUE(e.valid());
+  EXPECT_EQ(l.gettop(), 0);
+
+  l.set_integer("a", 1);
+  l.set_integer("b", 2);
+  EXPECT_EQ(e.eval<int>(), 3);
+  EXPECT_EQ(e.eval<double>(), 3);
+  EXPECT_EQ(e.eval<std::string>(), "3");
+
+  l.set_number("a", 1.5);
+  EXPECT_EQ(e.eval<double>(), 3.5);
+  EXPECT_EQ(l.gettop(), 0);
+
+  // copies share the same compiled function
+  auto e2 = e;
+  EXPECT_EQ(e2.ref_id(), e.ref_id());
+  e.unref();
+  EXPECT_FALSE(e.valid());
+  EXPECT_EQ(e2.eval<double>(), 3.5);
+}
+
+TEST(compiled_expr, eval_complex_type) {
+  luaw l;
+  l.set_integer("a", 1);
+  l.set_integer("b", 2);
+
+  auto e1 = l.compile("return {a, b}");
+  EXPECT_EQ(e1.eval<std::vector<int>>(), (std::vector<int>{1, 2}));
+
+  auto e2 = l.compile("return a, b, a + b");
+  EXPECT_EQ((e2.eval<std::tuple<int, int, int>>()), std::make_tuple(1, 2, 3));
+
+  auto e3 = l.compile(std::string("c = a + b"));
+  e3.eval<void>();
+  EXPECT_EQ(l.get_int("c"), 3);
+
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(compiled_expr, failed) {
+  luaw l;
+  {
+    bool failed = false;
+    auto e      = l.compile("return a +", true, &failed);
+    EXPECT_TRUE(failed);
+    EXPECT_FALSE(e.valid());
+    failed = false;
+    EXPECT_EQ(e.eval<int>(true, &failed), 0);
+    EXPECT_TRUE(failed);
+  }
+  {
+    bool failed = false;
+    auto e      = l.compile("return a.b", true, &failed);
+    EXPECT_FALSE(failed);
+    EXPECT_TRUE(e.valid());
+    EXPECT_EQ(e.eval<int>(true, &failed), 0);
+    EXPECT_TRUE(failed);
+  }
+  {
+    bool failed = false;
+    auto e      = l.compile("a = 1");
+    EXPECT_EQ(e.eval<int>(true, &failed), 0);
+    EXPECT_TRUE(failed);
+    failed = false;
+    e.eval<void>(true, &failed);
+    EXPECT_FALSE(failed);
+  }
+  {
+    luaw::compiled_expr e;
+    bool                failed = false;
+    EXPECT_FALSE(e.valid());
+    EXPECT_EQ(e.eval<int>(true, &failed), 0);
+    EXPECT_TRUE(failed);
+  }
+  EXPECT_EQ(l.gettop(), 0);
+}
@@ -67,8 +67,13 @@ TEST(custom_luaw, eval_failed) {
   {
     custom_luaw<std::unique_ptr<dummy_provider>> l;
     l.provider(std::make_unique<dummy_provider>());
+    // Set upvalue "this" of _G's __index to null
+    l.pushglobaltable();
+    l.getmetatable(-1);
+    l.getfield(-1, "__index");
     lua_pushlightuserdata(l.L(), (void *)0);
-    lua_setfield(l.L(), LUA_REGISTRYINDEX, "this");
+    EXPECT_NE(lua_setupvalue(l.L(), -2, 1), nullptr);
+    l.pop(3);
     bool failed;
     EXPECT_EQ(l.eval_int("return a + b", 0, false, &failed), 0);
     EXPECT_TRUE(failed);
@@ -162,4 +167,31 @@ TEST(custom_luaw, move_ctor) {
   }
 }
 
+struct who_provider {
+  std::vector<luaw *>      ls;
+  std::vector<lua_State *> Ls;
+  bool                     provide(luaw &l, const char *vname) {
+    ls.push_back(&l);
+    Ls.push_back(l.L());
+    l.push(1);
+    return true;
+  }
+};
+
+TEST(custom_luaw, provider_gets_this_or_thread) {
+  custom_luaw<std::unique_ptr<who_provider>> l;
+  l.provider(std::make_unique<who_provider>());
+  EXPECT_EQ(l.eval_int("return a"), 1);
+  ASSERT_EQ(l.provider()->ls.size(), 1);
+  EXPECT_EQ(l.provider()->ls[0], &l);
+
+  // In a coroutine
+  EXPECT_EQ(l.eval_int("local co = coroutine.create(function() return b end)"
+                       " local ok, v = coroutine.resume(co) return v"),
+            1);
+  ASSERT_EQ(l.provider()->ls.size(), 2);
+  EXPECT_NE(l.provider()->ls[1], &l);
+  EXPECT_NE(l.provider()->Ls[1], l.L());
+}
+
 }  // namespace
@@ -0,0 +1,106 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "main.h"
+
+TEST(eval_batch, numbers) {
+  luaw                  l;
+  std::vector<double>   a{1, 2, 3, 4};
+  std::vector<int>      b{10, 20, 30, 40};
+  std::vector<long long> c{100, 200, 300, 400};
+
+  bool failed = true;
+  auto ret    = l.eval_batch<double>(
+      "return a + b + c", {{"a", a}, {"b", b}, {"c", c}}, false, &failed);
+  EXPECT_FALSE(failed);
+  EXPECT_EQ(ret, (std::vector<double>{111, 222, 333, 444}));
+  EXPECT_EQ(l.gettop(), 0);
+
+  // Variables of the last row are left in _G
+  EXPECT_EQ(l.get_double("a"), 4);
+  EXPECT_EQ(l.get_int("b"), 40);
+  EXPECT_TRUE(l.get<luaw::luavalueref>("c").valid());
+  EXPECT_TRUE(l.eval<bool>("return math.type(b) == 'integer'"));
+
+  // By raw pointer
+  auto ret2 = l.eval_batch<int>(std::string("return a * 2"),
+                                {luaw::batch_column("a", a.data(), 2)});
+  EXPECT_EQ(ret2, (std::vector<int>{2, 4}));
+}
+
+TEST(eval_batch, strings) {
+  luaw                     l;
+  std::vector<std::string> s{"x", "y", std::string("a\0b", 3)};
+  std::vector<int>         n{1, 2, 3};
+  auto ret = l.eval_batch<std::string>("return s .. n", {{"s", s}, {"n", n}});
+  EXPECT_EQ(ret,
+            (std::vector<std::string>{"x1", "y2", std::string("a\0b3", 4)}));
+  auto len = l.eval_batch<int>("return #s", {{"s", s}});
+  EXPECT_EQ(len, (std::vector<int>{1, 1, 3}));
+}
+
+TEST(eval_batch, complex_result) {
+  luaw                l;
+  std::vector<double> a{1, 2};
+  auto ret = l.eval_batch<std::tuple<int, int>>("return a, a * a", {{"a", a}});
+  EXPECT_EQ(ret.size(), 2);
+  EXPECT_EQ(ret[0], std::make_tuple(1, 1));
+  EXPECT_EQ(ret[1], std::make_tuple(2, 4));
+
+  auto v = l.eval_batch<std::vector<int>>("return {a, a + 1}", {{"a", a}});
+  EXPECT_EQ(v, (std::vector<std::vector<int>>{{1, 2}, {2, 3}}));
+}
+
+TEST(eval_batch, failed) {
+  luaw l;
+  {
+    std::vector<double> a{1, 2}, b{1};
+    bool                failed = false;
+    auto ret = l.eval_batch<int>("return a + b", {{"a", a}, {"b", b}}, true,
+                                 &failed);
+    EXPECT_TRUE(failed);
+    EXPECT_TRUE(ret.empty());
+  }
+  {
+    std::vector<double> a{1, 2};
+    bool                failed = false;
+    auto ret = l.eval_batch<int>("return a +", {{"a", a}}, true, &failed);
+    EXPECT_TRUE(failed);
+    EXPECT_TRUE(ret.empty());
+  }
+  {
+    // The 2nd row fails
+    std::vector<std::string> a{"1", "x", "3"};
+    bool                     failed = false;
+    auto ret = l.eval_batch<int>("return a + 1", {{"a", a}}, true, &failed);
+    EXPECT_TRUE(failed);
+    EXPECT_EQ(ret, (std::vector<int>{2, 0, 4}));
+  }
+  {
+    // No return
+    std::vector<double> a{1, 2};
+    bool                failed = false;
+    auto ret = l.eval_batch<int>("b = a", {{"a", a}}, true, &failed);
+    EXPECT_TRUE(failed);
+    EXPECT_EQ(ret, (std::vector<int>{0, 0}));
+  }
+  {
+    // No columns, no rows
+    bool failed = true;
+    auto ret    = l.eval_batch<int>("return 1", {}, true, &failed);
+    EXPECT_FALSE(failed);
+    EXPECT_TRUE(ret.empty());
+  }
+  EXPECT_EQ(l.gettop(), 0);
+}
@@ -0,0 +1,166 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "main.h"
+
+TEST(eval_cache, disabled_by_default) {
+  luaw l;
+  EXPECT_FALSE(l.eval_cache_enabled());
+  EXPECT_EQ(l.eval_int("return 1 + 2"), 3);
+  auto s = l.get_eval_cache_stats();
+  EXPECT_EQ(s.capacity, 0);
+  EXPECT_EQ(s.size, 0);
+  EXPECT_EQ(s.hits, 0);
+  EXPECT_EQ(s.misses, 0);
+  EXPECT_EQ(s.evictions, 0);
+}
+
+TEST(eval_cache, hit_and_miss) {
+  luaw l;
+  l.enable_eval_cache(8);
+  EXPECT_TRUE(l.eval_cache_enabled());
+
+  l.set_integer("a", 1);
+  l.set_integer("b", 2);
+  EXPECT_EQ(l.eval_int("return a + b"), 3);
+  EXPECT_EQ(l.get_eval_cache_stats().misses, 1);
+  EXPECT_EQ(l.get_eval_cache_stats().hits, 0);
+
+  // The cached chunk reads current values of globals
+  l.set_integer("a", 10);
+  EXPECT_EQ(l.eval_int("return a + b"), 12);
+  EXPECT_EQ(l.eval<long>("return a + b"), 12);
+  EXPECT_EQ(l.eval_string("return a + b"), "12");
+  auto s = l.get_eval_cache_stats();
+  EXPECT_EQ(s.capacity, 8);
+  EXPECT_EQ(s.size, 1);
+  EXPECT_EQ(s.hits, 3);
+  EXPECT_EQ(s.misses, 1);
+  EXPECT_EQ(s.evictions, 0);
+
+  EXPECT_EQ(l.gettop(), 0);
+
+  // Multiple returns
+  EXPECT_EQ((l.eval<std::tuple<int, int>>("return a, b")),
+            std::make_tuple(10, 2));
+  EXPECT_EQ((l.eval<std::tuple<int, int>>("return a, b")),
+            std::make_tuple(10, 2));
+  EXPECT_EQ(l.get_eval_cache_stats().size, 2);
+
+  // eval_c_str leaves the result in stack
+  EXPECT_STREQ(l.eval_c_str("return 'str'"), "str");
+  EXPECT_STREQ(l.eval_c_str("return 'str'"), "str");
+  EXPECT_EQ(l.gettop(), 2);
+  l.cleartop();
+  EXPECT_EQ(l.get_eval_cache_stats().size, 3);
+}
+
+TEST(eval_cache, compile_error_not_cached) {
+  luaw l;
+  l.enable_eval_cache();
+  bool failed = false;
+  EXPECT_EQ(l.eval_int("return 1 +", 0, true, &failed), 0);
+  EXPECT_TRUE(failed);
+  failed = false;
+  EXPECT_EQ(l.eval_int("return 1 +", 0, true, &failed), 0);
+  EXPECT_TRUE(failed);
+  auto s = l.get_eval_cache_stats();
+  EXPECT_EQ(s.size, 0);
+  EXPECT_EQ(s.hits, 0);
+  EXPECT_EQ(s.misses, 2);
+
+  // Runtime error, the chunk is still cached
+  failed = false;
+  EXPECT_EQ(l.eval_int("return x.y", 0, true, &failed), 0);
+  EXPECT_TRUE(failed);
+  failed = false;
+  EXPECT_EQ(l.eval_int("return x.y", 0, true, &failed), 0);
+  EXPECT_TRUE(failed);
+  s = l.get_eval_cache_stats();
+  EXPECT_EQ(s.size, 1);
+  EXPECT_EQ(s.hits, 1);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(eval_cache, lru_eviction) {
+  luaw l;
+  l.enable_eval_cache(2);
+  EXPECT_EQ(l.eval_int("return 1"), 1);
+  EXPECT_EQ(l.eval_int("return 2"), 2);
+  EXPECT_EQ(l.eval_int("return 1"), 1);  // "return 1" is most recently used
+  EXPECT_EQ(l.eval_int("return 3"), 3);  // evict "return 2"
+  auto s = l.get_eval_cache_stats();
+  EXPECT_EQ(s.size, 2);
+  EXPECT_EQ(s.hits, 1);
+  EXPECT_EQ(s.misses, 3);
+  EXPECT_EQ(s.evictions, 1);
+
+  EXPECT_EQ(l.eval_int("return 1"), 1);
+  EXPECT_EQ(l.get_eval_cache_stats().hits, 2);
+  EXPECT_EQ(l.eval_int("return 2"), 2);
+  EXPECT_EQ(l.get_eval_cache_stats().misses, 4);
+  EXPECT_EQ(l.get_eval_cache_stats().evictions, 2);
+
+  // Shrink
+  l.enable_eval_cache(1);
+  s = l.get_eval_cache_stats();
+  EXPECT_EQ(s.capacity, 1);
+  EXPECT_EQ(s.size, 1);
+  EXPECT_EQ(s.evictions, 3);
+
+  // Zero capacity caches nothing
+  l.enable_eval_cache(0);
+  EXPECT_EQ(l.eval_int("return 1"), 1);
+  EXPECT_EQ(l.get_eval_cache_stats().size, 0);
+}
+
+TEST(eval_cache, clear_and_disable) {
+  luaw l;
+  l.enable_eval_cache();
+  EXPECT_EQ(l.eval_int("return 1"), 1);
+  EXPECT_EQ(l.eval_int("return 2"), 2);
+  EXPECT_EQ(l.get_eval_cache_stats().size, 2);
+  l.clear_eval_cache();
+  EXPECT_TRUE(l.eval_cache_enabled());
+  EXPECT_EQ(l.get_eval_cache_stats().size, 0);
+  EXPECT_EQ(l.eval_int("return 1"), 1);
+  EXPECT_EQ(l.get_eval_cache_stats().misses, 3);
+
+  l.disable_eval_cache();
+  EXPECT_FALSE(l.eval_cache_enabled());
+  EXPECT_EQ(l.eval_int("return 1"), 1);
+  EXPECT_EQ(l.get_eval_cache_stats().misses, 0);
+  lua_gc(l.L(), LUA_GCCOLLECT);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(eval_cache, shared_by_state) {
+  luaw l;
+  l.enable_eval_cache();
+  {
+    fakeluaw f(l.L());
+    EXPECT_TRUE(f.eval_cache_enabled());
+    EXPECT_EQ(f.eval_int("return 1"), 1);
+  }
+  {
+    auto sub = l.make_subluaw();
+    EXPECT_TRUE(sub.eval_cache_enabled());
+    EXPECT_EQ(sub.eval_int("return 1"), 1);
+  }
+  EXPECT_EQ(l.eval_int("return 1"), 1);
+  auto s = l.get_eval_cache_stats();
+  EXPECT_EQ(s.size, 1);
+  EXPECT_EQ(s.hits, 2);
+  EXPECT_EQ(s.misses, 1);
+}
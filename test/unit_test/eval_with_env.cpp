@@ -0,0 +1,243 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "main.h"
+
+namespace {
+
+struct dummy_provider {
+  bool provide(luaw &l, const char *vname) {
+    l.push(100);
+    return true;
+  }
+};
+
+// Provides "x" by evaluating the same expression against another env.
+struct nested_provider {
+  int depth = 0;
+  bool provide(luaw &l, const char *vname) {
+    if (strcmp(vname, "x") != 0 || depth > 0) return false;
+    ++depth;
+    int v = l.eval_with_env<int>("return x + y",
+                                 std::map<std::string, int>{{"x", 100},
+                                                            {"y", 200}});
+    --depth;
+    l.push(v);
+    return true;
+  }
+};
+
+}  // namespace
+
+TEST(eval_with_env, env_table) {
+  luaw l;
+  l.set_integer("a", 1);
+  l.dostring("env = {a = 10, b = 20}");
+  l.gseek("env");
+  EXPECT_EQ(l.eval_with_env<int>("return a + b", -1), 30);
+  EXPECT_EQ(l.eval_with_env<int>(std::string("return a"), -1), 10);
+
+  // Assignments go into the env
+  EXPECT_EQ(l.eval_with_env<int>("c = a * 2; return c", -1), 20);
+  EXPECT_EQ(l.eval_int("return env.c"), 20);
+  EXPECT_TRUE(l.eval_bool("return c == nil"));
+  l.pop();
+  EXPECT_EQ(l.gettop(), 0);
+
+  // Globals are not accessible from a plain env table
+  l.newtable();
+  bool failed = false;
+  EXPECT_EQ(l.eval_with_env<int>("return math.abs(-1)", -1, true, &failed), 0);
+  EXPECT_TRUE(failed);
+  l.pop();
+  EXPECT_EQ(l.gettop(), 0);
+
+  // Globals are accessible from an env table made by push_env_table
+  l.push_env_table();
+  EXPECT_EQ(l.eval_with_env<int>("return math.abs(-a)", -1), 1);
+  EXPECT_EQ(l.eval_with_env<int>("a = 5; return a", -1), 5);
+  EXPECT_EQ(l.get_int("a"), 1);
+  l.pop();
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(eval_with_env, bindings) {
+  luaw l;
+  l.set_integer("a", 1);
+  std::map<std::string, int> m{{"a", 2}, {"b", 3}};
+  EXPECT_EQ(l.eval_with_env<int>("return a + b", m), 5);
+  EXPECT_EQ(l.eval_with_env<int>(std::string("return a * b"), m), 6);
+
+  std::unordered_map<std::string, double> um{{"x", 1.5}};
+  EXPECT_EQ(l.eval_with_env<double>("y = x * 2; return math.max(x, y)", um),
+            3);
+  EXPECT_TRUE(l.eval_bool("return y == nil"));
+  EXPECT_EQ(l.eval_int("return a"), 1);
+
+  auto ret = l.eval_with_env<std::tuple<int, std::string>>(
+      "return a, s", std::map<std::string, std::string>{{"s", "hi"}});
+  EXPECT_EQ(std::get<0>(ret), 1);
+  EXPECT_EQ(std::get<1>(ret), "hi");
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(eval_with_env, with_eval_cache) {
+  luaw l;
+  l.enable_eval_cache(8);
+  l.set_integer("a", 1);
+  EXPECT_EQ(l.eval_int("return a"), 1);
+  EXPECT_EQ(l.eval_with_env<int>("return a",
+                                 std::map<std::string, int>{{"a", 2}}),
+            2);
+  EXPECT_EQ(l.eval_with_env<int>("return a",
+                                 std::map<std::string, int>{{"a", 3}}),
+            3);
+  // The cached chunk runs against _G again
+  EXPECT_EQ(l.eval_int("return a"), 1);
+  EXPECT_EQ(l.get_eval_cache_stats().misses, 1);
+  EXPECT_EQ(l.get_eval_cache_stats().hits, 3);
+
+  // Restored after failure
+  bool failed = false;
+  EXPECT_EQ(l.eval_with_env<int>(
+                "return a.b", std::map<std::string, int>{{"a", 2}}, true,
+                &failed),
+            0);
+  EXPECT_TRUE(failed);
+  l.set_integer("a", 4);
+  EXPECT_EQ(l.eval_int("return a"), 4);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(eval_with_env, compiled_expr) {
+  luaw l;
+  l.set_integer("a", 1);
+  auto e = l.compile("return a + 1");
+  l.push_env_table();
+  l.push(10);
+  l.setfield(-2, "a");
+  EXPECT_EQ(e.eval_with_env<int>(-1), 11);
+  l.pop();
+  EXPECT_EQ(e.eval<int>(), 2);
+
+  bool failed = false;
+  EXPECT_EQ(luaw::compiled_expr().eval_with_env<int>(-1, true, &failed), 0);
+  EXPECT_TRUE(failed);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(eval_with_env, compile_fused) {
+  luaw l;
+  l.set_integer("a", 1);
+  l.set_integer("b", 2);
+  auto e = l.compile_fused({"return a", "return b", "return a + b"});
+  l.push_env_table();
+  l.push(10);
+  l.setfield(-2, "a");
+  auto ret = e.eval_with_env<std::tuple<int, int, int>>(-1);
+  EXPECT_EQ(std::get<0>(ret), 10);
+  EXPECT_EQ(std::get<1>(ret), 2);
+  EXPECT_EQ(std::get<2>(ret), 12);
+
+  // Restored after failure
+  l.push(true);
+  l.setfield(-2, "a");
+  bool failed = false;
+  e.eval_with_env<std::tuple<int, int, int>>(-1, true, &failed);
+  EXPECT_TRUE(failed);
+  l.pop();
+  EXPECT_EQ(e.eval_all<int>(), (std::vector<int>{1, 2, 3}));
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(eval_with_env, failures) {
+  luaw l;
+  std::map<std::string, int> m{{"a", 1}};
+  bool                       failed = false;
+  EXPECT_EQ(l.eval_with_env<int>("return a +", m, true, &failed), 0);
+  EXPECT_TRUE(failed);
+  failed = false;
+  EXPECT_EQ(l.eval_with_env<int>("a = 1", m, true, &failed), 0);
+  EXPECT_TRUE(failed);
+  failed = false;
+  l.eval_with_env<void>("a = 1", m, true, &failed);
+  EXPECT_FALSE(failed);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(eval_with_env, custom_luaw) {
+  custom_luaw<std::unique_ptr<dummy_provider>> l;
+  l.provider(std::make_unique<dummy_provider>());
+  std::map<std::string, int>  m{{"a", 1}};
+  EXPECT_EQ(l.eval_with_env<int>("return a + b", m), 101);
+  EXPECT_EQ(l.eval_int("return a"), 100);
+}
+
+TEST(eval_with_env, nested_same_expr) {
+  for (bool cache : {false, true}) {
+    custom_luaw<std::unique_ptr<nested_provider>> l;
+    l.provider(std::make_unique<nested_provider>());
+    if (cache) l.enable_eval_cache();
+    std::map<std::string, int> m{{"y", 1}};
+    // "x" is provided by evaluating "return x + y" with x = 100, y = 200
+    EXPECT_EQ(l.eval_with_env<int>("return x + y", m), 301);
+    EXPECT_EQ(l.eval_with_env<int>("return x + y",
+                                   std::map<std::string, int>{{"y", 2}}),
+              302);
+    EXPECT_EQ(l.gettop(), 0);
+  }
+}
+
+TEST(eval_with_env, functions_keep_env) {
+  for (bool cache : {false, true}) {
+    luaw l;
+    if (cache) l.enable_eval_cache();
+    l.set_integer("a", 1);
+    const char *expr = "return function() return a end";
+    auto        f2   = l.eval_with_env<luaw::function<int()>>(
+        expr, std::map<std::string, int>{{"a", 2}});
+    auto f3 = l.eval_with_env<luaw::function<int()>>(
+        expr, std::map<std::string, int>{{"a", 3}});
+    EXPECT_EQ(f2(), 2);
+    EXPECT_EQ(f3(), 3);
+    EXPECT_EQ(l.eval<luaw::function<int()>>(expr)(), 1);
+
+    auto e = l.compile(expr);
+    l.push_env_table();
+    l.push(4);
+    l.setfield(-2, "a");
+    auto f4 = e.eval_with_env<luaw::function<int()>>(-1);
+    l.pop();
+    EXPECT_EQ(f4(), 4);
+    EXPECT_EQ(f2(), 2);
+    EXPECT_EQ(e.eval<luaw::function<int()>>()(), 1);
+    EXPECT_EQ(l.gettop(), 0);
+  }
+}
+
+TEST(eval_with_env, compiled_expr_not_chunk) {
+  luaw l;
+  l.dostring("local u = 1; f = function() return u + a end");
+  l.gseek("f");
+  luaw::compiled_expr e(l.L(), -1);
+  l.pop();
+  l.set_integer("a", 1);
+  EXPECT_EQ(e.eval<int>(), 2);
+  l.push_env_table();
+  bool failed = false;
+  EXPECT_EQ(e.eval_with_env<int>(-1, true, &failed), 0);
+  EXPECT_TRUE(failed);
+  l.pop();
+  EXPECT_EQ(l.gettop(), 0);
+}
@@ -0,0 +1,170 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include <future>
+
+#include "main.h"
+
+namespace {
+
+struct counting_provider {
+  std::map<std::string, int> calls;
+  bool                       provide(luaw &l, const char *vname) {
+    ++calls[vname];
+    l.push(1);
+    return true;
+  }
+};
+
+struct batch_provider : counting_provider {
+  using counting_provider::provide;
+
+  std::vector<std::string> batch;
+  bool provide(luaw &l, const std::vector<const char *> &vnames) {
+    for (const char *v : vnames) {
+      batch.push_back(v);
+      l.push(1);
+    }
+    return true;
+  }
+};
+
+// Only single letters are fetched, others get an invalid future.
+struct async_provider : counting_provider {
+  std::future<double> provide_async(const char *vname) {
+    if (strlen(vname) != 1) return std::future<double>{};
+    std::promise<double> p;
+    p.set_value(1);
+    return p.get_future();
+  }
+};
+
+struct vars_provider {
+  std::vector<std::string> vars;
+  void provide(const std::vector<std::string> &v, luaw &l) {
+    vars = v;
+    for (const auto &name : v) l.set_integer(name, 1);
+  }
+};
+
+}  // namespace
+
+TEST(lazy_load_libs, load_on_first_access) {
+  luaw l(luaw::opt{}.lazy_load_libs());
+  // Base lib is loaded
+  EXPECT_TRUE(l.eval_bool("return type(print) == 'function'"));
+  EXPECT_TRUE(
+      l.eval_bool("return rawget(_G, 'math') == nil and rawget(_G, 'table') "
+                  "== nil and rawget(_G, 'string') == nil"));
+
+  EXPECT_EQ(l.eval_int("return math.max(1, 3, 2)"), 3);
+  EXPECT_TRUE(l.eval_bool("return rawget(_G, 'math') == math"));
+  EXPECT_EQ(l.eval_string("return table.concat({'a', 'b'}, ',')"), "a,b");
+  EXPECT_TRUE(l.eval_bool("return utf8 ~= nil and os ~= nil"));
+  EXPECT_TRUE(l.eval_bool("return rawget(_G, 'io') == nil"));
+
+  // Unknown names are still nil
+  EXPECT_TRUE(l.eval_bool("return x == nil"));
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(lazy_load_libs, string_methods) {
+  luaw l(luaw::opt{}.lazy_load_libs());
+  EXPECT_EQ(l.eval_string("return ('ab'):rep(2)"), "abab");
+  EXPECT_TRUE(l.eval_bool("return rawget(_G, 'string') ~= nil"));
+  EXPECT_EQ(l.eval_string("return ('ab'):upper()"), "AB");
+  EXPECT_EQ(l.eval_string("return string.lower('AB')"), "ab");
+}
+
+TEST(lazy_load_libs, string_arithmetic) {
+  luaw l(luaw::opt{}.lazy_load_libs());
+  EXPECT_EQ(l.eval_int("return '10' + 1"), 11);
+  EXPECT_TRUE(l.eval_bool("return rawget(_G, 'string') ~= nil"));
+  EXPECT_EQ(l.eval_double("return '2' * 1.5"), 3);
+
+  for (const char* expr : {"return '10' - 1",
+                           "return 2 * '4.5'",
+                           "return '7' % 4",
+                           "return '3' ^ 2",
+                           "return '9' / 3",
+                           "return '9' // 2",
+                           "return -'9'"}) {
+    luaw lazy(luaw::opt{}.lazy_load_libs());
+    luaw eager;
+    EXPECT_EQ(lazy.eval_double(expr), eager.eval_double(expr)) << expr;
+  }
+
+  luaw l2(luaw::opt{}.lazy_load_libs());
+  bool failed = false;
+  EXPECT_EQ(l2.eval_int("return 'x' + 1", 0, true, &failed), 0);
+  EXPECT_TRUE(failed);
+  EXPECT_EQ(l2.gettop(), 0);
+}
+
+TEST(lazy_load_libs, require) {
+  luaw l(luaw::opt{}.lazy_load_libs());
+  EXPECT_TRUE(l.eval_bool("return require('math') == math"));
+  luaw l2(luaw::opt{}.lazy_load_libs());
+  EXPECT_TRUE(l2.eval_bool("local m = require('math'); return m == math"));
+  EXPECT_TRUE(l2.eval_bool("return package.loaded.math == math"));
+  EXPECT_TRUE(l2.eval_bool("return coroutine == require('coroutine')"));
+}
+
+TEST(lazy_load_libs, custom_luaw) {
+  custom_luaw<std::unique_ptr<counting_provider>> l(
+      luaw::opt{}.lazy_load_libs());
+  l.provider(std::make_unique<counting_provider>());
+  EXPECT_EQ(l.eval_int("return math.floor(a + 0.5) + #string.rep('x', b)"), 2);
+  EXPECT_EQ(l.provider()->calls,
+            (std::map<std::string, int>{{"a", 1}, {"b", 1}}));
+
+  auto l2 = std::move(l);
+  EXPECT_EQ(l2.eval_int("return #table.pack(c, d)"), 2);
+  EXPECT_EQ(l2.provider()->calls.size(), 4);
+}
+
+TEST(lazy_load_libs, prefetch) {
+  const char *expr =
+      "return math.floor(a) + #string.rep('x', b) + #table.pack()";
+  {
+    custom_luaw<std::unique_ptr<batch_provider>> l(
+        luaw::opt{}.lazy_load_libs());
+    l.provider(std::make_unique<batch_provider>());
+    l.enable_provider_cache();
+    l.set_negative_provider_cache(true);
+    EXPECT_EQ(l.prefetch_eval<int>(expr), 2);
+    EXPECT_EQ(l.provider()->batch, (std::vector<std::string>{"a", "b"}));
+    EXPECT_TRUE(l.provider()->calls.empty());
+  }
+  {
+    custom_luaw<std::unique_ptr<async_provider>> l(
+        luaw::opt{}.lazy_load_libs());
+    l.provider(std::make_unique<async_provider>());
+    bool failed = true;
+    EXPECT_EQ(l.prefetch_eval<int>(expr, false, &failed), 2);
+    EXPECT_FALSE(failed);
+    EXPECT_TRUE(l.provider()->calls.empty());
+    EXPECT_EQ(l.gettop(), 0);
+  }
+}
+
+TEST(lazy_load_libs, luaw_crtp) {
+  luaw_is_provider<vars_provider> l(luaL_newstate());
+  l.lazy_load_libs();
+  const char *expr = "return math.floor(a) + #string.rep('x', b)";
+  EXPECT_EQ(l.detect_variable_names(expr),
+            (std::vector<std::string>{"a", "b"}));
+  EXPECT_EQ(l.auto_eval_int(expr), 2);
+  EXPECT_EQ(l.provider().vars, (std::vector<std::string>{"a", "b"}));
+}
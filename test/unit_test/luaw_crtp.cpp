@@ -55,9 +55,10 @@ TEST(luaw_crtp, detect_variable_names_eval) {
   EXPECT_EQ(toset(l.detect_variable_names(
                 "a = [[str 'str' \"haha\"]]; b = '2'; return a .. b .. c")),
             toset({"c"}));
+  // Invalid syntax
   EXPECT_EQ(toset(l.detect_variable_names(
                 "[[str 'str' \"haha\"]]; b = '2'; return a .. b .. c")),
-            toset({"a", "c"}));
+            toset({}));
   EXPECT_EQ(toset(l.detect_variable_names("return a..b .. c")),
             toset({"a", "b", "c"}));
   EXPECT_EQ(toset(l.detect_variable_names("return a .. b .. c")),
@@ -106,9 +107,70 @@ TEST(luaw_crtp, detect_variable_names_eval) {
   EXPECT_EQ(toset(l.detect_variable_names("return a + (b * c)")),
             toset({"a", "b", "c"}));
   EXPECT_EQ(toset(l.detect_variable_names("return a + f(b * c)")),
-            toset({"a", "b", "c"}));
+            toset({"a", "f", "b", "c"}));
   EXPECT_EQ(toset(l.detect_variable_names("return a + math.pi")), toset({"a"}));
-  EXPECT_EQ(toset(l.detect_variable_names("return a + b.c.d")), toset({"a"}));
+  EXPECT_EQ(toset(l.detect_variable_names("return a + b.c.d")),
+            toset({"a", "b"}));
+
+  // Locals, table constructors and method calls
+  EXPECT_EQ(toset(l.detect_variable_names("local x = 1; return x + y")),
+            toset({"y"}));
+  EXPECT_EQ(toset(l.detect_variable_names("local t = {k = v, w}; return t.k")),
+            toset({"v", "w"}));
+  EXPECT_EQ(toset(l.detect_variable_names("return s:upper() .. t")),
+            toset({"s", "t"}));
+  EXPECT_EQ(toset(l.detect_variable_names("return string.format('%d', n)")),
+            toset({"n"}));
+  EXPECT_EQ(toset(l.detect_variable_names(
+                "local function f(x) return x + k end return f(j)")),
+            toset({"j", "k"}));
+
+  // Memoized, but functions and tables set later are excluded
+  EXPECT_EQ(toset(l.detect_variable_names("return g(a)")), toset({"g", "a"}));
+  l.dostring("function g(x) return x end");
+  EXPECT_EQ(toset(l.detect_variable_names("return g(a)")), toset({"a"}));
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(luaw_crtp, detect_variable_names_many_constants) {
+  luaw_is_provider<vprovider> l;
+
+  // Globals whose constant indices are greater than 255
+  std::string expr = "local t = {";
+  for (int i = 0; i < 300; ++i) expr += "'k" + std::to_string(i) + "', ";
+  expr += "} w = 1 return #t + a + b + w";
+  EXPECT_EQ(toset(l.detect_variable_names(expr)), toset({"a", "b"}));
+  EXPECT_EQ(l.auto_eval_int(expr.c_str()), 303);
+
+  // Names longer than 40 bytes
+  const std::string name(50, 'x');
+  EXPECT_EQ(toset(l.detect_variable_names("return a + " + name)),
+            toset({"a", name}));
+  EXPECT_EQ(l.auto_eval_int("return a + " + name), 2);
+}
+
+TEST(luaw_crtp, detect_variable_names_memo) {
+  luaw_is_provider<vprovider> l;
+  using v = std::vector<std::string>;
+
+  // Repeated detections return the memoized result
+  const v &r = l.detect_variable_names("return a + f");
+  EXPECT_EQ(r, (v{"a", "f"}));
+  EXPECT_EQ(&l.detect_variable_names("return a + f"), &r);
+
+  // Excluded names follow changes of _G
+  l.dostring("function f() end");
+  EXPECT_EQ(l.detect_variable_names("return a + f"), v{"a"});
+  l.dostring("f = nil");
+  EXPECT_EQ(l.detect_variable_names("return a + f"), (v{"a", "f"}));
+
+  // The memo is bounded, least recently used ones are evicted
+  for (int i = 0; i < 2000; ++i) {
+    std::string expr = "return x" + std::to_string(i);
+    EXPECT_EQ(l.detect_variable_names(expr), v{"x" + std::to_string(i)});
+  }
+  EXPECT_EQ(l.detect_variable_names("return a + f"), (v{"a", "f"}));
+  EXPECT_EQ(l.gettop(), 0);
 }
 
 TEST(luaw_is_provider, auto_eval) {
@@ -0,0 +1,168 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include <thread>
+
+#include "main.h"
+
+namespace {
+
+struct point {
+  int x = 0;
+};
+
+struct const_provider {
+  bool provide(luaw &l, const char *vname) {
+    l.push(7);
+    return true;
+  }
+};
+
+struct counting_provider {
+  int  calls = 0;
+  bool provide(luaw &l, const char *vname) {
+    l.push(++calls);
+    return true;
+  }
+};
+
+}  // namespace
+
+TEST(luaw_pool, checkout_and_return) {
+  int warmups = 0;
+
+  luaw_pool<> pool(2, [&](luaw &l) {
+    ++warmups;
+    l.register_member("x", &point::x);
+    l.set_integer("base", 1);
+  });
+  EXPECT_EQ(warmups, 2);
+  EXPECT_EQ(pool.capacity(), 2);
+  EXPECT_EQ(pool.idle(), 2);
+  EXPECT_EQ(pool.created(), 2);
+
+  lua_State *L = nullptr;
+  {
+    auto h = pool.acquire();
+    EXPECT_TRUE(h.valid());
+    EXPECT_EQ(pool.idle(), 1);
+    L = h->L();
+    point p;
+    h->set("p", &p);
+    EXPECT_EQ(h->eval_int("p.x = 3; return p.x + base"), 4);
+    EXPECT_EQ(p.x, 3);
+    h->set_integer("base", 10);
+    h->set_integer("tmp", 1);
+    h->set_nil("print");
+    h->push(1);
+  }
+  EXPECT_EQ(pool.idle(), 2);
+
+  // Restored to the baseline
+  auto h1 = pool.acquire();
+  auto h2 = pool.acquire();
+  luaw &l = h1->L() == L ? *h1 : *h2;
+  EXPECT_EQ(l.gettop(), 0);
+  EXPECT_EQ(l.get_int("base"), 1);
+  EXPECT_TRUE(l.eval_bool("return tmp == nil and p == nil"));
+  EXPECT_TRUE(l.eval_bool("return type(print) == 'function'"));
+  EXPECT_EQ(pool.idle(), 0);
+
+  // Create more if none idle, but keep at most capacity
+  {
+    auto h3 = pool.acquire();
+    EXPECT_EQ(pool.created(), 3);
+    EXPECT_EQ(warmups, 3);
+    EXPECT_EQ(h3->get_int("base"), 1);
+  }
+  EXPECT_EQ(pool.idle(), 1);
+  h1.reset();
+  EXPECT_FALSE(h1.valid());
+  auto h4 = std::move(h2);
+  EXPECT_FALSE(h2.valid());
+  h4 = pool.acquire();
+  EXPECT_TRUE(h4.valid());
+  EXPECT_EQ(pool.idle(), 2);
+}
+
+TEST(luaw_pool, custom_luaw_and_threads) {
+  using clw = custom_luaw<std::unique_ptr<const_provider>>;
+  luaw_pool<clw> pool(
+      2,
+      [](clw &l) { l.provider(std::make_unique<const_provider>()); },
+      []() { return std::make_unique<clw>(luaw::opt{}.lazy_load_libs()); });
+  pool.gc_step_kb(-1);
+  EXPECT_EQ(pool.gc_step_kb(), -1);
+
+  std::atomic<int>         errors{0};
+  std::vector<std::thread> workers;
+  for (int t = 0; t < 4; ++t) {
+    workers.emplace_back([&]() {
+      for (int i = 0; i < 50; ++i) {
+        auto h = pool.acquire();
+        if (h->eval_int("local old = rawget(_G, 'g'); g = a; return old == "
+                        "nil and math.max(g, 1) or -1") != 7) {
+          ++errors;
+        }
+      }
+    });
+  }
+  for (auto &w : workers) w.join();
+  EXPECT_EQ(errors, 0);
+  EXPECT_EQ(pool.idle(), 2);
+}
+
+TEST(luaw_pool, custom_luaw_request_values) {
+  using clw = custom_luaw<std::unique_ptr<counting_provider>>;
+  luaw_pool<clw> pool(1, [](clw &l) {
+    l.provider(std::make_unique<counting_provider>());
+    l.enable_provider_cache();
+  });
+  {
+    auto h = pool.acquire();
+    EXPECT_EQ(h->eval_int("return a + a"), 2);
+    EXPECT_EQ(h->prefetch_eval<int>("return b"), 2);
+  }
+  // Provided again in the next request, the cache is still enabled
+  {
+    auto h = pool.acquire();
+    EXPECT_TRUE(h->provider_cache_enabled());
+    EXPECT_EQ(h->eval_int("return a + a"), 6);
+    EXPECT_EQ(h->get_provider_cache_stats().generation, 0);
+  }
+  EXPECT_EQ(pool.created(), 1);
+}
+
+TEST(luaw_pool, state_moved_out) {
+  luaw_pool<> pool(1);
+  {
+    auto h = pool.acquire();
+    luaw l(std::move(*h));
+    EXPECT_EQ(h->L(), nullptr);
+    EXPECT_EQ(l.eval_int("return 1"), 1);
+  }  // Dropped
+  EXPECT_EQ(pool.idle(), 0);
+  {
+    auto h = pool.acquire();
+    EXPECT_EQ(pool.created(), 2);
+    h->reset();  // Replaced by a new state
+  }
+  EXPECT_EQ(pool.idle(), 0);
+  {
+    auto h = pool.acquire();
+    EXPECT_EQ(h->eval_int("return 1"), 1);
+  }
+  EXPECT_EQ(pool.idle(), 1);
+  EXPECT_EQ(pool.created(), 3);
+}
@@ -0,0 +1,99 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "main.h"
+
+namespace {
+
+struct Inner {
+  int v = 7;
+};
+
+struct Obj {
+  int         i    = 1;
+  std::string s    = "s";
+  Obj*        next = nullptr;
+  Inner       in;
+};
+
+}  // namespace
+
+TEST(member_accessor, get_and_set) {
+  luaw l;
+  l.register_member("i", &Obj::i);
+  l.register_member("s", &Obj::s);
+  l.register_member("next", &Obj::next);
+  l.register_member_ref("in", &Obj::in);
+  l.register_member_ptr("pi", &Obj::i);
+  l.register_member("v", &Inner::v);
+
+  Obj o, o2;
+  o.next = &o2;
+  l.set("o", &o);
+  EXPECT_EQ(l.eval_int("o.i = o.i + 1 return o.i"), 2);
+  EXPECT_EQ(o.i, 2);
+  EXPECT_EQ(l.eval_string("o.s = o.s .. 't' return o.s"), "st");
+  EXPECT_EQ(o.s, "st");
+  EXPECT_EQ(l.eval_int("o.next.i = 5 return o.next.i"), 5);
+  EXPECT_EQ(o2.i, 5);
+  EXPECT_EQ(l.eval<int*>("return o.pi"), &o.i);
+  EXPECT_EQ(l.eval_int("o.in.v = o.in.v + 1 return o.in.v"), 8);
+  EXPECT_EQ(o.in.v, 8);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(member_accessor, errors_propagate) {
+  luaw l;
+  l.register_member("i", &Obj::i);
+
+  Obj o;
+  l.set("o", &o);
+  EXPECT_NE(l.dostring("o.i = 'x'"), LUA_OK);
+  EXPECT_NE(l.to_string(-1).find("argument conversion failed"),
+            std::string::npos);
+  l.pop();
+  EXPECT_EQ(o.i, 1);
+
+  // Caught by pcall in Lua
+  EXPECT_FALSE(l.eval_bool("return pcall(function() o.i = {} end)"));
+  EXPECT_EQ(l.eval_int("return o.i"), 1);
+
+  std::shared_ptr<Obj> s;
+  l.set("s", &s);
+  EXPECT_NE(l.dostring("return s.i"), LUA_OK);
+  EXPECT_NE(l.to_string(-1).find("Getting member by empty smart ptr."),
+            std::string::npos);
+  l.pop();
+  EXPECT_NE(l.dostring("s.i = 1"), LUA_OK);
+  EXPECT_NE(l.to_string(-1).find("Setting member by empty smart ptr."),
+            std::string::npos);
+  l.pop();
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(member_accessor, accessor_destructed) {
+  auto counter = std::make_shared<int>(0);
+  {
+    luaw l;
+    l.register_member<int Obj::*>(
+        "c", [counter](const volatile Obj*) -> int& { return *counter; });
+    EXPECT_GT(counter.use_count(), 1);
+
+    Obj o;
+    l.set("o", &o);
+    EXPECT_EQ(l.eval_int("o.c = 3 return o.c"), 3);
+    EXPECT_EQ(*counter, 3);
+  }
+  EXPECT_EQ(counter.use_count(), 1);
+}
@@ -0,0 +1,473 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include <cmath>
+
+#include "main.h"
+
+namespace {
+
+// Check the native result is the same as Lua's, including subtype.
+void check_same_as_lua(luaw& l, const std::string& expr) {
+  auto e = l.compile_native(expr);
+  EXPECT_TRUE(e.is_native()) << expr;
+  auto native = e.eval<luaw::luavalueref>();
+  auto lua    = l.eval<luaw::luavalueref>(expr);
+  native.pushvalue();
+  lua.pushvalue();
+  EXPECT_EQ(lua_type(l.L(), -2), lua_type(l.L(), -1)) << expr;
+  EXPECT_EQ(l.isinteger(-2), l.isinteger(-1)) << expr;
+  bool nan = l.isnumber(-1) && l.to_double(-1) != l.to_double(-1);
+  EXPECT_TRUE(nan || lua_rawequal(l.L(), -2, -1)) << expr;
+  l.pop(2);
+}
+
+}  // namespace
+
+TEST(native_expr, same_as_lua) {
+  luaw l;
+  l.set_integer("a", 7);
+  l.set_integer("b", -2);
+  l.set_number("x", 2.5);
+  l.set_boolean("t", true);
+  l.set_integer("big", 9007199254740993);
+  l.set_integer("maxi", std::numeric_limits<long long>::max());
+  l.set_integer("mini", std::numeric_limits<long long>::min());
+
+  for (const char* expr : {"return 1 + 2",
+                           "return 1 + 2.0",
+                           "return 7 // 2",
+                           "return -7 // 2",
+                           "return 7 % -2",
+                           "return -7 % 2",
+                           "return 7.5 // 2",
+                           "return -7.5 % 2",
+                           "return 5.5 % -2",
+                           "return 1 // 0.0",
+                           "return 2 ^ 10",
+                           "return 2 ^ -1",
+                           "return -2 ^ 2",
+                           "return 2 ^ 3 ^ 2",
+                           "return 7 / 2",
+                           "return 4 / 2",
+                           "return a + b * x",
+                           "return a * b",
+                           "return a // b",
+                           "return a % b",
+                           "return maxi + 1",
+                           "return mini // -1",
+                           "return mini % -1",
+                           "return -mini",
+                           "return 1 == 1.0",
+                           "return big < 9007199254740992.0",
+                           "return big > 9007199254740992.0",
+                           "return big == 9007199254740992.0",
+                           "return big <= 2^53",
+                           "return maxi < 2^63",
+                           "return mini <= -2^63",
+                           "return nil == false",
+                           "return t and a or b",
+                           "return false or nil",
+                           "return not nil",
+                           "return not 0",
+                           "return IF(a > b, 1, 2)",
+                           "return IF(a < b, 1, x > 3, 2, 3.0)",
+                           "return a + b;",
+                           "return (a)",
+                           "return a ~= 1",
+                           "return 0x10 + 1e1",
+                           "return 0xff",
+                           "return .5",
+                           "return 3 -- comment\n + 1",
+                           "return c",
+                           "return - -b",
+                           "return -x",
+                           "return not a == b",
+                           "return 1 < 2 == true",
+                           "return a >= 7 and a <= 7",
+                           "return 0/0 ~= 0/0",
+                           "return -0.0",
+                           "return 1e400",
+                           "return 3 % -1"}) {
+    check_same_as_lua(l, expr);
+  }
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(native_expr, not_native) {
+  luaw l;
+  for (const char* expr : {"return a .. b",
+                           "return a.b",
+                           "return a:b()",
+                           "return f(a)",
+                           "return IF(a, 'x', 1)",
+                           "return a << 1",
+                           "return 1, 2",
+                           "return #a",
+                           "return a --[[x]] + 1",
+                           "a = 1"}) {
+    auto e = l.compile_native(expr);
+    EXPECT_TRUE(e.valid()) << expr;
+    EXPECT_FALSE(e.is_native()) << expr;
+  }
+
+  // Fall back to Lua
+  l.set_integer("a", 1);
+  l.set_string("b", "x");
+  EXPECT_EQ(l.compile_native("return a .. b").eval<std::string>(), "1x");
+  EXPECT_EQ(l.compile_native("return math.max(a, 3)").eval<int>(), 3);
+
+  // IF is overwritten
+  l.dostring("IF = function(a, b, c) return 10 end");
+  auto e = l.compile_native("return IF(a, 1, 2)");
+  EXPECT_FALSE(e.is_native());
+  EXPECT_EQ(e.eval<int>(), 10);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(native_expr, bind) {
+  luaw l;
+  auto e = l.compile_native("return a + b * c");
+  EXPECT_TRUE(e.is_native());
+  EXPECT_EQ(e.slot_count(), 3);
+  EXPECT_EQ(e.slot_name(0), "a");
+  EXPECT_EQ(e.slot("b"), 1);
+  EXPECT_EQ(e.slot("c"), 2);
+  EXPECT_EQ(e.slot("d"), -1);
+
+  // Unbound slots are got from global variables
+  l.set_integer("a", 1);
+  l.set_integer("b", 2);
+  l.set_integer("c", 3);
+  EXPECT_EQ(e.eval<int>(), 7);
+
+  e.bind(0, 10);
+  e.bind("c", 0.5);
+  EXPECT_FALSE(e.bind("d", 1));
+  EXPECT_EQ(e.eval<double>(), 11);
+  EXPECT_EQ(e.eval<std::string>(), "11.0");
+  EXPECT_EQ(l.get_int("a"), 1);
+
+  e.unbind(0);
+  EXPECT_EQ(e.eval<double>(), 2);
+  e.unbind_all();
+  EXPECT_EQ(e.eval<int>(), 7);
+
+  // Copies could be bound separately
+  auto e2 = e;
+  e2.bind("a", 100);
+  EXPECT_EQ(e.eval<int>(), 7);
+  EXPECT_EQ(e2.eval<int>(), 106);
+
+  auto b = l.compile_native("return IF(p, 1, 2)");
+  b.bind("p", false);
+  EXPECT_EQ(b.eval<int>(), 2);
+  b.bind("p", true);
+  EXPECT_EQ(b.eval<int>(), 1);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(native_expr, fallback_at_runtime) {
+  luaw l;
+  auto e = l.compile_native("return a + b");
+  EXPECT_TRUE(e.is_native());
+
+  // String variables are evaluated by Lua
+  l.set_string("a", "10");
+  l.set_integer("b", 1);
+  EXPECT_EQ(e.eval<int>(), 11);
+
+  // Bound values are set to global variables when falling back
+  e.bind("b", 2);
+  EXPECT_EQ(e.eval<int>(), 12);
+  EXPECT_EQ(l.get_int("b"), 2);
+
+  // Errors are raised by Lua
+  bool failed = false;
+  l.set_boolean("a", true);
+  EXPECT_EQ(e.eval<int>(true, &failed), 0);
+  EXPECT_TRUE(failed);
+
+  auto d = l.compile_native("return a // b");
+  d.bind("a", 1);
+  d.bind("b", 0);
+  failed = false;
+  EXPECT_EQ(d.eval<int>(true, &failed), 0);
+  EXPECT_TRUE(failed);
+
+  // and/or are short-circuit evaluated
+  auto s = l.compile_native("return b ~= 0 and a // b or 0");
+  s.bind("a", 1);
+  s.bind("b", 0);
+  failed = true;
+  EXPECT_EQ(s.eval<int>(false, &failed), 0);
+  EXPECT_FALSE(failed);
+
+  // Compile error
+  failed = false;
+  auto f = l.compile_native("return a +", true, &failed);
+  EXPECT_TRUE(failed);
+  EXPECT_FALSE(f.valid());
+  EXPECT_FALSE(f.is_native());
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(native_expr, custom_luaw) {
+  // Provide "v<n>" as n, fail for names starting with 'x', nil for others.
+  struct provider {
+    bool provide(luaw& l, const char* vname) {
+      if (vname[0] == 'x') return false;
+      if (vname[0] == 'v') {
+        l.push(atoi(vname + 1));
+      } else {
+        l.pushnil();
+      }
+      return true;
+    }
+  };
+  custom_luaw<provider*> l;
+  provider               p;
+  l.provider(&p);
+  auto e = l.compile_native("return v1 + v2 * v3 - (w or 0)");
+  EXPECT_TRUE(e.is_native());
+  EXPECT_EQ(e.eval<int>(), 7);
+  EXPECT_EQ(e.eval<int>(), 7);
+  EXPECT_EQ(l.eval<int>("return v1 + v2 * v3 - (w or 0)"), 7);
+
+  // Provider failures are reported, not raised
+  auto x      = l.compile_native("return v1 + x1");
+  bool failed = false;
+  EXPECT_TRUE(x.is_native());
+  EXPECT_EQ(x.eval<int>(true, &failed), 0);
+  EXPECT_TRUE(failed);
+  failed = false;
+  EXPECT_EQ(l.eval<int>("return v1 + x1", true, &failed), 0);
+  EXPECT_TRUE(failed);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(native_expr, fallback_fetch_once) {
+  // Provide "s" as a string, others as their length, and count calls.
+  struct provider {
+    int  calls = 0;
+    bool provide(luaw& l, const char* vname) {
+      ++calls;
+      if (strcmp(vname, "s") == 0) {
+        l.push("10");
+      } else {
+        l.push(static_cast<int>(strlen(vname)));
+      }
+      return true;
+    }
+  };
+  custom_luaw<provider*> l;
+  provider               p;
+  l.provider(&p);
+  auto e = l.compile_native("return vv + s");
+  EXPECT_TRUE(e.is_native());
+  EXPECT_EQ(e.eval<int>(), 12);
+  EXPECT_EQ(p.calls, 2);
+  EXPECT_EQ(e.eval<int>(), 12);
+  EXPECT_EQ(p.calls, 4);
+
+  // Values handed to Lua are not left in _G
+  l.pushglobaltable();
+  lua_pushstring(l.L(), "vv");
+  EXPECT_EQ(lua_rawget(l.L(), -2), LUA_TNIL);
+  lua_pushstring(l.L(), "s");
+  EXPECT_EQ(lua_rawget(l.L(), -3), LUA_TNIL);
+  l.pop(3);
+
+  std::vector<int> a{1, 2};
+  EXPECT_EQ(e.eval_columns({{"vv", a}}), (std::vector<double>{11, 12}));
+  EXPECT_EQ(p.calls, 6);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(native_expr, if_overwritten) {
+  luaw l;
+  auto e = l.compile_native("return IF(a, 1, 2)");
+  EXPECT_TRUE(e.is_native());
+  l.set_boolean("a", true);
+  EXPECT_EQ(e.eval<int>(), 1);
+  l.dostring("IF = function() return 3 end");
+  EXPECT_EQ(e.eval<int>(), 3);
+  EXPECT_EQ(e.eval_columns({{"a", std::vector<double>{1, 2}}}),
+            (std::vector<double>{3, 3}));
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(native_expr, eval_columns) {
+  luaw l;
+  const size_t        rows = 1000;
+  std::vector<double> a(rows), b(rows), c(rows);
+  for (size_t i = 0; i < rows; ++i) {
+    a[i] = (static_cast<int>(i * 7919 % 1000) - 500) / 37.0;
+    b[i] = static_cast<int>(i % 13) - 6;
+    c[i] = i % 17 == 0 ? 0.0 : (static_cast<int>(i % 11) - 5) * 0.25;
+  }
+  std::vector<luaw::batch_column> columns{{"a", a}, {"b", b}, {"c", c}};
+  l.set_integer("k", 3);
+
+  for (const char* expr :
+       {"return a + b - c * a / b + c ^ k - a ^ 2",
+        "return a // b + a % b - -c + a // c + b % c",
+        "return a ^ 0.5 + b ^ c",
+        "return IF(a > b, a, b < c, c * 2, 7)",
+        "return a > 0 and b or c",
+        "return (a >= b) == (b <= c) and 1 or 2",
+        "return not (a > b) and 3 or 4",
+        "return IF(a == b, 1, a ~= c, 2, 3) + k / 2 + 2 ^ 53",
+        "return a < 0 and b > 0 and a * b or 0",
+        "return 9007199254740993 + a",
+        "return (a > 0 and 7 or 8) // 2.0 + IF(b < 0, 3, c) * 2.5",
+        "return -IF(a > b, 0, 2) * 0.5 + (a < c and -3 or 3) * c",
+        "return k",
+        "return a"}) {
+    auto e = l.compile_native(expr);
+    EXPECT_TRUE(e.is_native()) << expr;
+    bool failed   = true;
+    auto expected = l.eval_batch<double>(expr, columns, false, &failed);
+    EXPECT_FALSE(failed) << expr;
+    std::vector<double> ret(rows);
+    EXPECT_TRUE(e.eval_columns(columns, ret.data(), false, &failed)) << expr;
+    EXPECT_FALSE(failed) << expr;
+    for (size_t i = 0; i < rows; ++i) {
+      if (std::isnan(expected[i])) {
+        EXPECT_TRUE(std::isnan(ret[i])) << expr << " at row " << i;
+      } else {
+        EXPECT_EQ(expected[i], ret[i]) << expr << " at row " << i;
+      }
+    }
+  }
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(native_expr, signed_zero) {
+  luaw l;
+  l.set_boolean("t", true);
+  l.set_boolean("f", false);
+  EXPECT_TRUE(std::signbit(l.compile_native("return -(f and 1 or 0.0)")
+                               .eval<double>()));
+  EXPECT_FALSE(std::signbit(l.compile_native("return -(t and 0 or 1.0)")
+                                .eval<double>()));
+
+  std::vector<double>             a{-1, 0, 1, 2, -0.0};
+  std::vector<luaw::batch_column> columns{{"a", a}};
+  for (const char* expr : {"return -(a > 0 and 1 or 0.0)",
+                           "return -(a > 0 and 0 or 0.0)",
+                           "return -IF(a > 0, 0, 0.0)",
+                           "return -IF(a > 1, a, a > 0, 0, 0.0)",
+                           "return -(a > 0 and 0.0 or 0)",
+                           "return -(a * 0)",
+                           "return -a"}) {
+    auto e        = l.compile_native(expr);
+    bool failed   = true;
+    auto expected = l.eval_batch<double>(expr, columns, false, &failed);
+    EXPECT_FALSE(failed) << expr;
+    std::vector<double> ret(a.size());
+    EXPECT_TRUE(e.eval_columns(columns, ret.data(), false, &failed)) << expr;
+    EXPECT_FALSE(failed) << expr;
+    for (size_t i = 0; i < a.size(); ++i) {
+      EXPECT_EQ(expected[i], ret[i]) << expr << " at row " << i;
+      EXPECT_EQ(std::signbit(expected[i]), std::signbit(ret[i]))
+          << expr << " at row " << i;
+    }
+  }
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(native_expr, eval_columns_row_by_row) {
+  luaw                     l;
+  std::vector<double>      a{1, 2, 3};
+  std::vector<int>         b{10, 20, 30};
+  std::vector<std::string> s{"1", "x", "3"};
+
+  // Integer columns are evaluated row by row
+  auto e      = l.compile_native("return a + b // 3");
+  bool failed = true;
+  std::vector<double> ret(3);
+  EXPECT_FALSE(e.eval_columns({{"a", a}, {"b", b}}, ret.data(), false, &failed));
+  EXPECT_FALSE(failed);
+  EXPECT_EQ(ret, (std::vector<double>{4, 8, 13}));
+
+  // Types of results are different in rows
+  EXPECT_EQ(l.compile_native("return a > 1 and a").eval_columns({{"a", a}},
+                                                                 true,
+                                                                 &failed),
+            (std::vector<double>{0, 2, 3}));
+  EXPECT_FALSE(failed);
+
+  // Integer division by zero
+  EXPECT_EQ(l.compile_native("return IF(a > 1, 1, 2) // 0")
+                .eval_columns({{"a", a}}, true, &failed),
+            (std::vector<double>{0, 0, 0}));
+  EXPECT_TRUE(failed);
+
+  // Not native, and the failed row
+  EXPECT_EQ(l.compile_native("return a + #s").eval_columns(
+                {{"a", a}, {"s", s}}, true, &failed),
+            (std::vector<double>{2, 3, 4}));
+  EXPECT_FALSE(failed);
+  EXPECT_EQ(l.compile_native("return s + a").eval_columns(
+                {{"a", a}, {"s", s}}, true, &failed),
+            (std::vector<double>{2, 0, 6}));
+  EXPECT_TRUE(failed);
+
+  // Different sizes
+  std::vector<double> a2{1, 2};
+  EXPECT_FALSE(e.eval_columns({{"a", a}, {"b", a2}}, ret.data(), true, &failed));
+  EXPECT_TRUE(failed);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(native_expr, eval_columns_custom_luaw) {
+  // Provide "k" as 2, fail for names starting with 'x', nil for others.
+  struct provider {
+    bool provide(luaw& l, const char* vname) {
+      if (vname[0] == 'x') return false;
+      if (strcmp(vname, "k") == 0) {
+        l.push(2);
+      } else {
+        l.pushnil();
+      }
+      return true;
+    }
+  };
+  custom_luaw<provider*> l;
+  provider               p;
+  l.provider(&p);
+  std::vector<double> a{1, 2, 3};
+  std::vector<int>    b{10, 20, 30};
+
+  bool failed = true;
+  EXPECT_EQ(l.compile_native("return a * k").eval_columns(
+                {{"a", a}}, false, &failed),
+            (std::vector<double>{2, 4, 6}));
+  EXPECT_FALSE(failed);
+
+  // Column by column
+  EXPECT_EQ(l.compile_native("return a * x").eval_columns(
+                {{"a", a}}, true, &failed),
+            (std::vector<double>{0, 0, 0}));
+  EXPECT_TRUE(failed);
+
+  // Row by row
+  failed = false;
+  EXPECT_EQ(l.compile_native("return b * x").eval_columns(
+                {{"b", b}}, true, &failed),
+            (std::vector<double>{0, 0, 0}));
+  EXPECT_TRUE(failed);
+  EXPECT_EQ(l.gettop(), 0);
+}
@@ -0,0 +1,120 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "main.h"
+
+namespace {
+
+// Provides 1 for "a" and "b", nil for "n", fails for others.
+struct optional_provider {
+  std::map<std::string, int> calls;
+  bool                       provide(luaw &l, const char *vname) {
+    ++calls[vname];
+    if (strcmp(vname, "a") == 0 || strcmp(vname, "b") == 0) {
+      l.push(1);
+    } else if (strcmp(vname, "n") == 0) {
+      l.pushnil();
+    } else {
+      return false;
+    }
+    return true;
+  }
+};
+
+using clw = custom_luaw<std::unique_ptr<optional_provider>>;
+
+}  // namespace
+
+TEST(negative_provider_cache, treat_failure_as_nil) {
+  clw l;
+  l.provider(std::make_unique<optional_provider>());
+  EXPECT_FALSE(l.negative_provider_cache());
+  bool failed = false;
+  l.eval_int("return opt or a", 0, true, &failed);
+  EXPECT_TRUE(failed);
+
+  l.set_negative_provider_cache(true);
+  EXPECT_TRUE(l.negative_provider_cache());
+  EXPECT_EQ(l.eval_int("return opt or a", 0, false, &failed), 1);
+  EXPECT_FALSE(failed);
+  // Not remembered without the provider cache
+  EXPECT_EQ(l.eval_int("return opt or a"), 1);
+  EXPECT_EQ(l.provider()->calls["opt"], 3);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(negative_provider_cache, remember_misses) {
+  clw l;
+  l.provider(std::make_unique<optional_provider>());
+  l.enable_provider_cache();
+  l.set_negative_provider_cache(true);
+
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(l.eval_bool("return opt == nil and n == nil and a == 1"));
+  }
+  EXPECT_EQ(l.provider()->calls["opt"], 1);
+  EXPECT_EQ(l.provider()->calls["n"], 1);
+  EXPECT_EQ(l.provider()->calls["a"], 1);
+  auto st = l.get_provider_cache_stats();
+  EXPECT_EQ(st.hits, 6);
+  EXPECT_EQ(st.negative_hits, 4);
+  // Not in _G
+  EXPECT_TRUE(l.eval_bool("return rawget(_G, 'opt') == nil"));
+
+  // Prefetch skips remembered misses
+  l.provider()->calls.clear();
+  EXPECT_EQ(l.prefetch_eval<int>("return (opt or 0) + (x or 0) + b"), 1);
+  EXPECT_EQ(l.prefetch_eval<int>("return (opt or 0) + (x or 0) + b"), 1);
+  EXPECT_EQ(l.provider()->calls,
+            (std::map<std::string, int>{{"x", 1}, {"b", 1}}));
+
+  // Forgotten in a new generation
+  l.bump_provider_cache_generation();
+  EXPECT_TRUE(l.eval_bool("return opt == nil"));
+  EXPECT_EQ(l.provider()->calls["opt"], 1);
+
+  // And by TTL
+  l.set_provider_cache_ttl("n", std::chrono::milliseconds(0));
+  EXPECT_TRUE(l.eval_bool("return n == nil and n == nil"));
+  EXPECT_EQ(l.provider()->calls["n"], 2);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(negative_provider_cache, name_stats) {
+  clw l;
+  l.provider(std::make_unique<optional_provider>());
+  EXPECT_TRUE(l.get_provider_name_stats().empty());
+  l.eval_bool("return a and n");
+  EXPECT_TRUE(l.get_provider_name_stats().empty());
+
+  l.enable_provider_name_stats();
+  l.set_negative_provider_cache(true);
+  l.eval_bool("return a == b and n == nil and opt == nil and opt == nil");
+  l.prefetch_eval<bool>("return x");
+  const auto &st = l.get_provider_name_stats();
+  EXPECT_EQ(st.at("a").calls, 1);
+  EXPECT_EQ(st.at("a").misses, 0);
+  EXPECT_EQ(st.at("n").calls, 1);
+  EXPECT_EQ(st.at("n").misses, 1);
+  EXPECT_EQ(st.at("opt").calls, 2);
+  EXPECT_EQ(st.at("opt").failures, 2);
+  EXPECT_EQ(st.at("x").calls, 2);  // In prefetch and evaluation
+  EXPECT_EQ(st.at("x").failures, 2);
+
+  l.clear_provider_name_stats();
+  EXPECT_TRUE(l.get_provider_name_stats().empty());
+  l.enable_provider_name_stats(false);
+  l.eval_bool("return a");
+  EXPECT_TRUE(l.get_provider_name_stats().empty());
+}
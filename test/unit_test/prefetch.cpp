@@ -0,0 +1,215 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "main.h"
+
+namespace {
+
+std::vector<std::string> free_globals(luaw &l, const char *expr) {
+  EXPECT_EQ(l.loadstring(expr), LUA_OK);
+  bool failed = true;
+  auto ret    = l.get_free_globals(-1, &failed);
+  EXPECT_FALSE(failed);
+  l.pop();
+  return ret;
+}
+
+// Provides 1 for each single lowercase letter, nil for others.
+struct per_name_provider {
+  std::map<std::string, int> calls;
+  bool                       provide(luaw &l, const char *vname) {
+    ++calls[vname];
+    if (strlen(vname) != 1 || vname[0] < 'a' || vname[0] > 'z') return false;
+    l.push(1);
+    return true;
+  }
+};
+
+struct batch_provider : per_name_provider {
+  using per_name_provider::provide;
+
+  int                      batch_calls = 0;
+  std::vector<std::string> last_batch;
+  bool                     push_less = false;
+  bool provide(luaw &l, const std::vector<const char *> &vnames) {
+    ++batch_calls;
+    last_batch.assign(vnames.begin(), vnames.end());
+    for (size_t i = 0; i < vnames.size(); ++i) {
+      if (push_less && i == 0) continue;
+      if (strlen(vnames[i]) == 1) {
+        l.push(static_cast<int>(i) + 10);
+      } else {
+        l.pushnil();
+      }
+    }
+    return true;
+  }
+};
+
+}  // namespace
+
+TEST(prefetch, free_globals) {
+  luaw l;
+  using v = std::vector<std::string>;
+  EXPECT_EQ(free_globals(l, "return a + b * a"), (v{"a", "b"}));
+  EXPECT_EQ(free_globals(l, "return 'a' .. \"b\""), v{});
+  EXPECT_EQ(free_globals(l, "x = a; return x + y"), (v{"a", "y"}));
+  EXPECT_EQ(free_globals(l, "local t = {a = b}; return t.a + c.d"),
+            (v{"b", "c"}));
+  EXPECT_EQ(free_globals(l,
+                         "local function f(x) return function() return x + p "
+                         "end end return f(q)() + math.abs(r)"),
+            (v{"q", "math", "r", "p"}));
+  // Assigned in a nested function
+  EXPECT_EQ(free_globals(l, "local function f() g = 1 end f() return g + h"),
+            v{"h"});
+  // Long names, and names with constant indices greater than 255
+  const std::string name(50, 'n');
+  EXPECT_EQ(free_globals(l, ("return a + " + name).c_str()), (v{"a", name}));
+  EXPECT_EQ(free_globals(l, (name + " = 1 return " + name + " + b").c_str()),
+            v{"b"});
+  std::string expr = "local t = {";
+  for (int i = 0; i < 300; ++i) expr += "'k" + std::to_string(i) + "', ";
+  expr += "} w = 1 return #t + a + b.c + w";
+  EXPECT_EQ(free_globals(l, expr.c_str()), (v{"a", "b"}));
+  // Not globals
+  EXPECT_EQ(free_globals(l, "local _ENV = {z = 1}; return z"), v{});
+  EXPECT_EQ(free_globals(l, "local a, b = 1, 2; return a + b"), v{});
+
+  // Closures whose first upvalue is not _ENV
+  l.dostring(
+      "local t = {x = 1} function f1() return t.x + y end "
+      "local a = 1 function f2() return a end "
+      "function f3() return t.x + a + z.w end");
+  for (auto &c : {std::make_pair("f1", v{"y"}),
+                  std::make_pair("f2", v{}),
+                  std::make_pair("f3", v{"z"})}) {
+    l.getglobal(c.first);
+    bool failed = true;
+    EXPECT_EQ(l.get_free_globals(-1, &failed), c.second);
+    EXPECT_FALSE(failed);
+    l.pop();
+  }
+
+  // Not a Lua function
+  l.push(1);
+  bool failed = false;
+  EXPECT_TRUE(l.get_free_globals(-1, &failed).empty());
+  EXPECT_TRUE(failed);
+  l.pop();
+  lua_pushcfunction(l.L(), [](lua_State *) { return 0; });
+  EXPECT_TRUE(l.get_free_globals(-1, &failed).empty());
+  EXPECT_TRUE(failed);
+  l.pop();
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(prefetch, batch_provider) {
+  custom_luaw<std::unique_ptr<batch_provider>> l;
+  l.provider(std::make_unique<batch_provider>());
+  l.set_integer("g", 100);
+
+  EXPECT_EQ(l.prefetch_eval<int>("return a + b + g + a"), 10 + 11 + 100 + 10);
+  EXPECT_EQ(l.provider()->batch_calls, 1);
+  EXPECT_EQ(l.provider()->last_batch, (std::vector<std::string>{"a", "b"}));
+  EXPECT_TRUE(l.provider()->calls.empty());
+
+  // Released after evaluation
+  EXPECT_EQ(l.eval_int("return a"), 1);
+  EXPECT_EQ(l.provider()->calls["a"], 1);
+
+  // Nil is not prefetched, so provided again by name when read
+  bool failed = false;
+  EXPECT_EQ(l.prefetch_eval<int>("return xy", true, &failed), 0);
+  EXPECT_TRUE(failed);
+  EXPECT_EQ(l.provider()->calls["xy"], 1);
+
+  // Pushing wrong number of values fails fast
+  l.provider()->push_less = true;
+  EXPECT_EQ(l.prefetch_eval<int>(std::string("return a + b"), true, &failed),
+            0);
+  EXPECT_TRUE(failed);
+  EXPECT_EQ(l.provider()->calls["a"], 1);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(prefetch, eval_cache) {
+  custom_luaw<std::unique_ptr<batch_provider>> l;
+  l.provider(std::make_unique<batch_provider>());
+  l.enable_eval_cache(1);
+
+  // Global names are memoized with the cached chunk
+  for (int i = 1; i <= 3; ++i) {
+    EXPECT_EQ(l.prefetch_eval<int>("return a + b"), 10 + 11);
+    EXPECT_EQ(l.provider()->batch_calls, i);
+    EXPECT_EQ(l.provider()->last_batch, (std::vector<std::string>{"a", "b"}));
+  }
+  EXPECT_EQ(l.get_eval_cache_stats().hits, 2);
+
+  // Evicted by another expression, then analyzed again
+  EXPECT_EQ(l.prefetch_eval<int>("return c * d"), 10 * 11);
+  EXPECT_EQ(l.provider()->last_batch, (std::vector<std::string>{"c", "d"}));
+  EXPECT_EQ(l.prefetch_eval<int>("return b - a"), 10 - 11);
+  EXPECT_EQ(l.provider()->last_batch, (std::vector<std::string>{"b", "a"}));
+  EXPECT_EQ(l.get_eval_cache_stats().evictions, 2);
+
+  l.clear_eval_cache();
+  EXPECT_EQ(l.prefetch_eval<int>("return b - a"), 10 - 11);
+  l.disable_eval_cache();
+  EXPECT_EQ(l.prefetch_eval<int>("return b - a"), 10 - 11);
+  EXPECT_EQ(l.provider()->batch_calls, 7);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(prefetch, per_name_provider) {
+  custom_luaw<std::unique_ptr<per_name_provider>> l;
+  l.provider(std::make_unique<per_name_provider>());
+
+  bool failed = true;
+  EXPECT_EQ(l.prefetch_eval<int>("if a then return a + b end return xy", false,
+                                 &failed),
+            2);
+  EXPECT_FALSE(failed);
+  EXPECT_EQ(l.provider()->calls["a"], 1);
+  EXPECT_EQ(l.provider()->calls["b"], 1);
+  // Failure of prefetching an unused variable is ignored
+  EXPECT_EQ(l.provider()->calls["xy"], 1);
+
+  // Syntax error
+  EXPECT_EQ(l.prefetch_eval<int>("return a +", true, &failed), 0);
+  EXPECT_TRUE(failed);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(prefetch, with_provider_cache) {
+  custom_luaw<std::unique_ptr<batch_provider>> l;
+  l.provider(std::make_unique<batch_provider>());
+  l.enable_provider_cache();
+
+  EXPECT_EQ(l.prefetch_eval<int>("return a + b"), 21);
+  EXPECT_EQ(l.get_provider_cache_stats().hits, 2);
+
+  // Cached values are not prefetched again
+  EXPECT_EQ(l.prefetch_eval<int>("return a + b + c"), 10 + 11 + 10);
+  EXPECT_EQ(l.provider()->batch_calls, 2);
+  EXPECT_EQ(l.provider()->last_batch, std::vector<std::string>{"c"});
+  EXPECT_EQ(l.prefetch_eval<int>("return a + c"), 20);
+  EXPECT_EQ(l.provider()->batch_calls, 2);
+  EXPECT_TRUE(l.provider()->calls.empty());
+
+  l.bump_provider_cache_generation();
+  EXPECT_EQ(l.prefetch_eval<int>("return a + c"), 10 + 11);
+  EXPECT_EQ(l.provider()->batch_calls, 3);
+  EXPECT_EQ(l.gettop(), 0);
+}
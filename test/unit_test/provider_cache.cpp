@@ -0,0 +1,124 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include <thread>
+
+#include "main.h"
+
+namespace {
+
+// Provides current value of a counter for any variable but "none".
+struct counting_provider {
+  int                        value = 1;
+  std::map<std::string, int> calls;
+  bool                       provide(luaw &l, const char *vname) {
+    ++calls[vname];
+    if (strcmp(vname, "none") == 0) {
+      l.pushnil();
+    } else {
+      l.push(value);
+    }
+    return true;
+  }
+};
+
+using clw = custom_luaw<std::unique_ptr<counting_provider>>;
+
+}  // namespace
+
+TEST(provider_cache, disabled_by_default) {
+  clw l;
+  l.provider(std::make_unique<counting_provider>());
+  EXPECT_FALSE(l.provider_cache_enabled());
+  EXPECT_EQ(l.eval_int("return a + a"), 2);
+  EXPECT_EQ(l.provider()->calls["a"], 2);
+  EXPECT_EQ(l.get_provider_cache_stats().hits, 0);
+}
+
+TEST(provider_cache, hit_and_generation) {
+  clw l;
+  l.provider(std::make_unique<counting_provider>());
+  l.enable_provider_cache();
+  EXPECT_TRUE(l.provider_cache_enabled());
+
+  EXPECT_EQ(l.eval_int("return a + a + b"), 3);
+  EXPECT_EQ(l.provider()->calls["a"], 1);
+  EXPECT_EQ(l.provider()->calls["b"], 1);
+  auto s = l.get_provider_cache_stats();
+  EXPECT_EQ(s.hits, 1);
+  EXPECT_EQ(s.misses, 2);
+  EXPECT_EQ(s.generation, 0);
+
+  // Not in _G
+  EXPECT_TRUE(l.eval_bool("return rawget(_G, 'a') == nil"));
+
+  // Stale until a new generation
+  l.provider()->value = 10;
+  EXPECT_EQ(l.eval_int("return a"), 1);
+  EXPECT_EQ(l.bump_provider_cache_generation(), 1);
+  EXPECT_EQ(l.provider_cache_generation(), 1);
+  EXPECT_EQ(l.eval_int("return a + a"), 20);
+  EXPECT_EQ(l.provider()->calls["a"], 2);
+
+  // Nil is not cached
+  EXPECT_TRUE(l.eval_bool("return none == nil and none == nil"));
+  EXPECT_EQ(l.provider()->calls["none"], 2);
+
+  // Globals are not affected
+  l.set_integer("a", 5);
+  EXPECT_EQ(l.eval_int("return a"), 5);
+
+  l.disable_provider_cache();
+  EXPECT_FALSE(l.provider_cache_enabled());
+  EXPECT_EQ(l.get_provider_cache_stats().hits, 0);
+  EXPECT_EQ(l.eval_int("return b + b"), 20);
+  EXPECT_EQ(l.provider()->calls["b"], 3);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(provider_cache, ttl) {
+  clw l;
+  l.provider(std::make_unique<counting_provider>());
+  l.enable_provider_cache();
+  l.set_provider_cache_ttl("a", std::chrono::milliseconds(20));
+  l.set_provider_cache_ttl("v", std::chrono::milliseconds(0));
+
+  EXPECT_EQ(l.eval_int("return a + a + b + v + v"), 5);
+  EXPECT_EQ(l.provider()->calls["a"], 1);
+  EXPECT_EQ(l.provider()->calls["v"], 2);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  l.provider()->value = 2;
+  EXPECT_EQ(l.eval_int("return a + b"), 3);
+  EXPECT_EQ(l.provider()->calls["a"], 2);
+  EXPECT_EQ(l.provider()->calls["b"], 1);
+  EXPECT_EQ(l.get_provider_cache_stats().expired, 1);
+
+  l.unset_provider_cache_ttl("v");
+  EXPECT_EQ(l.eval_int("return v + v"), 4);
+  EXPECT_EQ(l.provider()->calls["v"], 3);
+}
+
+TEST(provider_cache, move) {
+  clw l;
+  l.provider(std::make_unique<counting_provider>());
+  l.enable_provider_cache();
+  EXPECT_EQ(l.eval_int("return a"), 1);
+  clw l2(std::move(l));
+  EXPECT_FALSE(l.provider_cache_enabled());
+  EXPECT_TRUE(l2.provider_cache_enabled());
+  EXPECT_EQ(l2.eval_int("return a"), 1);
+  EXPECT_EQ(l2.provider()->calls["a"], 1);
+  EXPECT_EQ(l2.get_provider_cache_stats().hits, 1);
+}
@@ -1956,4 +1956,53 @@ TEST(register_member, change_member_function_type) {
   EXPECT_EQ(l.eval<int>("return o:getb()"), 1);
 }
 
+TEST(register_member, register_after_metatable_created) {
+  luaw l;
+  l.register_member("i", &Obj::i);
+
+  // Metatables are created, then the objects are released
+  Obj o(10);
+  l.set("p", &o);
+  l.set("o", Obj(20));
+  EXPECT_EQ(l.eval<int>("return p.i + o.i"), 30);
+  l.dostring("p = nil o = nil collectgarbage()");
+
+  // Members registered after metatables are created
+  l.register_member("geti", &Obj::geti);
+  l.register_member("dm", &Obj::dm);
+  l.set("p", &o);
+  l.set("o", Obj(20));
+  EXPECT_EQ(l.eval<int>("return p:geti() + o:geti()"), 30);
+  EXPECT_EQ(l.dostring("p.dm = {a = 1} o.dm = {b = 2}"), LUA_OK);
+  EXPECT_EQ(o.dm.at("a"), 1);
+  EXPECT_EQ(l.eval<double>("return o.dm.b"), 2);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(register_member, register_after_object_pushed) {
+  luaw l;
+  l.register_member("i", &Obj::i);
+  Obj o(10);
+  l.set("p", &o);
+  l.set("o", Obj(20));
+  auto sp = std::make_shared<Obj>(30);
+  l.set("sp", sp);
+  EXPECT_EQ(l.eval<int>("return p.i + o.i + sp.i"), 60);
+  EXPECT_TRUE(l.eval<bool>("return p.plusby == nil and o.plusby == nil"));
+
+  // Visible to objects already pushed, by __index and __newindex
+  l.register_member("plusby", &Obj::plusby);
+  l.register_member("dm", &Obj::dm);
+  EXPECT_EQ(l.eval<int>("return p:plusby(1) + o:plusby(2) + sp:plusby(3)"),
+            66);
+  EXPECT_EQ(o.i, 11);
+  EXPECT_EQ(sp->i, 33);
+  EXPECT_EQ(l.dostring("p.dm = {a = 1} o.dm = {b = 2} sp.dm = {c = 3}"),
+            LUA_OK);
+  EXPECT_EQ(o.dm.at("a"), 1);
+  EXPECT_EQ(sp->dm.at("c"), 3);
+  EXPECT_EQ(l.eval<double>("return o.dm.b"), 2);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
 }  // namespace
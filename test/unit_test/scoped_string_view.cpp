@@ -0,0 +1,114 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "main.h"
+
+TEST(scoped_string_view, eval) {
+  luaw l;
+  {
+    auto s = l.eval_string_view("return string.rep('ab', 3)");
+    EXPECT_EQ(l.gettop(), 0);
+    EXPECT_TRUE(s.in_lua());
+    EXPECT_EQ(s.size(), 6);
+    EXPECT_EQ(s.str(), "ababab");
+    EXPECT_STREQ(s.c_str(), "ababab");
+
+    // Still valid after garbage collection
+    lua_gc(l.L(), LUA_GCCOLLECT);
+    EXPECT_EQ(s.str(), "ababab");
+
+    auto s2 = s;
+    s       = l.eval_string_view(std::string("return 'x'"));
+    lua_gc(l.L(), LUA_GCCOLLECT);
+    EXPECT_EQ(s.str(), "x");
+    EXPECT_EQ(s2.str(), "ababab");
+  }
+
+  // Embedded zeros
+  auto z = l.eval_string_view("return 'a\\0b'");
+  EXPECT_EQ(z.size(), 3);
+  EXPECT_EQ(z.str(), std::string("a\0b", 3));
+
+  // Numbers are converted, but not in Lua stack
+  l.set_integer("i", 12);
+  EXPECT_EQ(l.eval_string_view("return i").str(), "12");
+  EXPECT_TRUE(l.eval_bool("return math.type(i) == 'integer'"));
+
+  bool failed = false;
+  auto d = l.eval_string_view("return {}", "def", true, &failed);
+  EXPECT_TRUE(failed);
+  EXPECT_FALSE(d.in_lua());
+  EXPECT_EQ(d.str(), "def");
+  d = l.eval_string_view("return nil", "def", true, &failed);
+  EXPECT_FALSE(failed);
+  EXPECT_EQ(d.str(), "def");
+  d = l.eval_string_view("return x.y", "def", true, &failed);
+  EXPECT_TRUE(failed);
+  EXPECT_EQ(d.str(), "def");
+  d = l.eval_string_view("x = 1", "def", true, &failed);
+  EXPECT_TRUE(failed);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(scoped_string_view, get_and_to) {
+  luaw l;
+  l.set_string("s", "hello");
+  l.set_number("n", 1.5);
+
+  bool failed = true, exists = false;
+  auto s = l.get_string_view("s", "", false, &failed, &exists);
+  EXPECT_FALSE(failed);
+  EXPECT_TRUE(exists);
+  EXPECT_EQ(l.gettop(), 0);
+  l.set_nil("s");
+  lua_gc(l.L(), LUA_GCCOLLECT);
+  EXPECT_EQ(s.str(), "hello");
+
+  EXPECT_EQ(l.get_string_view(std::string("n")).str(), "1.5");
+  EXPECT_TRUE(l.eval_bool("return math.type(n) == 'float'"));
+  EXPECT_EQ(l.get_string_view("none", "def", false, &failed, &exists).str(),
+            "def");
+  EXPECT_FALSE(failed);
+  EXPECT_FALSE(exists);
+
+  l.push(10);
+  auto t = l.to_string_view(-1);
+  EXPECT_TRUE(l.isinteger(-1));
+  l.pop();
+  EXPECT_EQ(t.str(), "10");
+
+  l.newtable();
+  EXPECT_TRUE(l.to_string_view(-1, "", true, &failed).empty());
+  EXPECT_TRUE(failed);
+  l.pop();
+
+  // By convertor
+  auto v = l.eval<std::vector<luaw::scoped_string_view>>("return {'a', 'bc'}");
+  ASSERT_EQ(v.size(), 2);
+  EXPECT_EQ(v[0].str(), "a");
+  EXPECT_EQ(v[1].str(), "bc");
+  auto tp = l.eval<std::tuple<luaw::scoped_string_view, int>>("return 'x', 1");
+  EXPECT_EQ(std::get<0>(tp).str(), "x");
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+#if PEACALM_LUAW_SUPPORT_CPP17
+TEST(scoped_string_view, view) {
+  luaw             l;
+  auto             s = l.eval_string_view(std::string_view("return 'abc'"));
+  std::string_view v = s;
+  EXPECT_EQ(v, "abc");
+  EXPECT_EQ(s.view().substr(1), "bc");
+}
+#endif
@@ -0,0 +1,239 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include <atomic>
+#include <thread>
+
+#include "main.h"
+
+namespace {
+
+std::atomic<int> provide_calls{0};
+
+struct plain_provider {
+  bool provide(luaw &l, const char *vname) {
+    ++provide_calls;
+    if (strcmp(vname, "i") == 0) {
+      l.push(1);
+    } else if (strcmp(vname, "f") == 0) {
+      l.push(0.5);
+    } else if (strcmp(vname, "s") == 0) {
+      l.push(std::string("a\0b", 3));
+    } else if (strcmp(vname, "b") == 0) {
+      l.push(true);
+    } else if (strcmp(vname, "t") == 0) {
+      l.newtable();
+    } else {
+      return false;
+    }
+    return true;
+  }
+};
+
+using clw = custom_luaw<std::unique_ptr<plain_provider>>;
+
+}  // namespace
+
+TEST(shared_provider_cache, share_between_states) {
+  auto c = std::make_shared<shared_provider_cache>();
+  clw  l1, l2;
+  l1.provider(std::make_unique<plain_provider>());
+  l2.provider(std::make_unique<plain_provider>());
+  l1.set_shared_provider_cache(c);
+  l2.set_shared_provider_cache(c);
+  EXPECT_EQ(l2.shared_provider_cache_ptr(), c);
+
+  provide_calls = 0;
+  EXPECT_TRUE(l1.eval_bool(
+      "return i == 1 and f == 0.5 and #s == 3 and b and type(t) == 'table'"));
+  EXPECT_EQ(provide_calls, 5);
+  EXPECT_EQ(c->size(), 4);  // Table is not plain
+
+  EXPECT_TRUE(l2.eval_bool(
+      "return math.type(i) == 'integer' and math.type(f) == 'float' and s == "
+      "'a\\0b' and b == true"));
+  EXPECT_EQ(provide_calls, 5);
+  EXPECT_TRUE(l2.eval_bool("return type(t) == 'table'"));
+  EXPECT_EQ(provide_calls, 6);
+
+  // Writes are seen by readers
+  uint64_t v = c->version();
+  shared_provider_cache::value x;
+  x.type   = LUA_TNUMBER;
+  x.is_int = true;
+  x.i      = 10;
+  c->put("i", x);
+  EXPECT_GT(c->version(), v);
+  EXPECT_EQ(l1.eval_int("return i"), 10);
+  c->erase("i");
+  EXPECT_EQ(l1.eval_int("return i"), 1);
+  EXPECT_EQ(provide_calls, 7);
+  c->clear();
+  EXPECT_EQ(c->size(), 0);
+
+  // Stop sharing
+  l2.set_shared_provider_cache(nullptr);
+  EXPECT_EQ(l2.eval_int("return i"), 1);
+  EXPECT_EQ(provide_calls, 8);
+  EXPECT_EQ(c->size(), 0);
+  EXPECT_EQ(l1.gettop(), 0);
+  EXPECT_EQ(l2.gettop(), 0);
+}
+
+TEST(shared_provider_cache, with_provider_cache_and_prefetch) {
+  auto c = std::make_shared<shared_provider_cache>();
+  clw  l1, l2;
+  l1.provider(std::make_unique<plain_provider>());
+  l2.provider(std::make_unique<plain_provider>());
+  l1.set_shared_provider_cache(c);
+  l2.set_shared_provider_cache(c);
+  l2.enable_provider_cache();
+
+  provide_calls = 0;
+  EXPECT_EQ(l1.prefetch_eval<double>("return i + f"), 1.5);
+  EXPECT_EQ(provide_calls, 2);
+  EXPECT_EQ(c->size(), 2);
+  EXPECT_EQ(l2.prefetch_eval<double>("return i + f"), 1.5);
+  EXPECT_EQ(provide_calls, 2);
+  EXPECT_EQ(l2.get_provider_cache_stats().misses, 2);
+  c->clear();
+  EXPECT_EQ(l2.eval_double("return i + f"), 1.5);
+  EXPECT_EQ(l2.get_provider_cache_stats().hits, 2);
+  EXPECT_EQ(provide_calls, 2);
+}
+
+TEST(shared_provider_cache, ttl_and_generation) {
+  auto c = std::make_shared<shared_provider_cache>();
+  clw  l1, l2;
+  l1.provider(std::make_unique<plain_provider>());
+  l2.provider(std::make_unique<plain_provider>());
+  l1.set_shared_provider_cache(c);
+  l2.set_shared_provider_cache(c);
+
+  // Never cached
+  provide_calls = 0;
+  l1.set_provider_cache_ttl("i", std::chrono::milliseconds(0));
+  EXPECT_EQ(l1.eval_int("return i"), 1);
+  EXPECT_EQ(c->size(), 0);
+  EXPECT_EQ(l2.eval_int("return i"), 1);
+  EXPECT_EQ(c->size(), 1);
+  EXPECT_EQ(l1.eval_int("return i"), 1);  // Not read from the shared cache
+  EXPECT_EQ(provide_calls, 3);
+
+  // Expire by the TTL of the writer
+  provide_calls = 0;
+  l1.set_provider_cache_ttl("f", std::chrono::milliseconds(20));
+  EXPECT_EQ(l1.eval_double("return f"), 0.5);
+  EXPECT_EQ(l2.eval_double("return f"), 0.5);
+  EXPECT_EQ(provide_calls, 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  EXPECT_EQ(l2.eval_double("return f"), 0.5);
+  EXPECT_EQ(provide_calls, 2);
+  EXPECT_EQ(l2.eval_double("return f"), 0.5);  // Put by l2 without TTL
+  EXPECT_EQ(provide_calls, 2);
+
+  // Expire by the TTL of the reader
+  provide_calls = 0;
+  l2.set_provider_cache_ttl("b", std::chrono::milliseconds(20));
+  EXPECT_TRUE(l1.eval_bool("return b"));
+  EXPECT_TRUE(l2.eval_bool("return b"));
+  EXPECT_EQ(provide_calls, 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  EXPECT_TRUE(l1.eval_bool("return b"));
+  EXPECT_EQ(provide_calls, 1);
+  EXPECT_TRUE(l2.eval_bool("return b"));
+  EXPECT_EQ(provide_calls, 2);
+
+  // Values put before a new generation are stale for the reader
+  provide_calls = 0;
+  EXPECT_EQ(l1.eval_string("return s"), std::string("a\0b", 3));
+  EXPECT_EQ(provide_calls, 1);
+  l2.bump_provider_cache_generation();
+  EXPECT_EQ(l2.eval_string("return s"), std::string("a\0b", 3));
+  EXPECT_EQ(provide_calls, 2);
+  EXPECT_EQ(l2.eval_string("return s"), std::string("a\0b", 3));
+  EXPECT_EQ(l1.eval_string("return s"), std::string("a\0b", 3));
+  EXPECT_EQ(provide_calls, 2);
+  EXPECT_EQ(l1.gettop(), 0);
+  EXPECT_EQ(l2.gettop(), 0);
+}
+
+TEST(shared_provider_cache, multi_threads) {
+  auto c = std::make_shared<shared_provider_cache>();
+  {
+    clw l;
+    l.provider(std::make_unique<plain_provider>());
+    l.set_shared_provider_cache(c);
+    EXPECT_EQ(l.eval_int("return i + i"), 2);
+  }
+  provide_calls = 0;
+  std::atomic<int>         errors{0};
+  std::vector<std::thread> workers;
+  for (int t = 0; t < 4; ++t) {
+    workers.emplace_back([&, t]() {
+      clw l;
+      l.provider(std::make_unique<plain_provider>());
+      l.set_shared_provider_cache(c);
+      for (int k = 0; k < 200; ++k) {
+        if (l.eval_double("return i + f", 0, true) != 1.5) ++errors;
+        if (t == 0 && k % 50 == 0) c->erase("f");
+      }
+    });
+  }
+  for (auto &w : workers) w.join();
+  EXPECT_EQ(errors, 0);
+  EXPECT_EQ(c->size(), 2);
+  // Only "f" may be provided, after erased
+  EXPECT_LE(provide_calls, 4 * 4);
+}
+
+TEST(shared_provider_cache, pending_values) {
+  auto                         c = std::make_shared<shared_provider_cache>();
+  shared_provider_cache::value x;
+  x.type   = LUA_TNUMBER;
+  x.is_int = true;
+  for (int k = 0; k < 100; ++k) {
+    x.i = k;
+    c->put("v" + std::to_string(k), x);
+  }
+  EXPECT_EQ(c->size(), 100);
+  EXPECT_TRUE(c->has_pending());
+  EXPECT_LT(c->snapshot()->size(), 100);
+
+  // Pending values are seen by readers
+  clw l;
+  l.provider(std::make_unique<plain_provider>());
+  l.set_shared_provider_cache(c);
+  provide_calls = 0;
+  EXPECT_EQ(l.eval_int("return v99 + v0"), 99);
+  EXPECT_EQ(provide_calls, 0);
+
+  // Put again while pending
+  x.i = -1;
+  c->put("v99", x);
+  EXPECT_EQ(c->size(), 100);
+  EXPECT_EQ(l.eval_int("return v99"), -1);
+
+  c->erase("v99");
+  EXPECT_EQ(c->size(), 99);
+  EXPECT_EQ(l.eval_int("return v99", 0, true), 0);
+  EXPECT_EQ(provide_calls, 1);
+
+  c->flush();
+  EXPECT_FALSE(c->has_pending());
+  EXPECT_EQ(c->snapshot()->size(), 99);
+  EXPECT_EQ(l.eval_int("return v98"), 98);
+  EXPECT_EQ(provide_calls, 1);
+  EXPECT_EQ(l.gettop(), 0);
+}
@@ -0,0 +1,107 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "main.h"
+
+namespace {
+
+struct Point {
+  double      x = 1;
+  double      y = 2;
+  const int   id = 7;
+  std::string tag = "p";
+
+  double norm2() const { return x * x + y * y; }
+};
+
+}  // namespace
+
+namespace peacalm {
+template <>
+struct luaw::static_members<Point> {
+  static constexpr auto value() {
+    return std::make_tuple(luaw::static_member("x", &Point::x),
+                           luaw::static_member("y", &Point::y),
+                           luaw::static_member("id", &Point::id),
+                           luaw::static_member("tag", &Point::tag));
+  }
+};
+}  // namespace peacalm
+
+TEST(static_members, hash) {
+  constexpr auto m = luaw::static_member("x", &Point::x);
+  static_assert(m.size == 1, "");
+  static_assert(m.hash == luaw_detail::fnv1a32("x", 1), "");
+  EXPECT_NE(luaw_detail::fnv1a32("x", 1), luaw_detail::fnv1a32("y", 1));
+}
+
+TEST(static_members, get_and_set) {
+  luaw  l;
+  Point p;
+  l.set("p", &p);
+  EXPECT_EQ(l.eval_double("return p.x + p.y"), 3);
+  EXPECT_EQ(l.eval_int("return p.id"), 7);
+  EXPECT_EQ(l.eval_string("p.tag = p.tag .. 'q' return p.tag"), "pq");
+  EXPECT_EQ(p.tag, "pq");
+  EXPECT_EQ(l.eval_double("p.x = 3 return p.x"), 3);
+  EXPECT_EQ(p.x, 3);
+  EXPECT_TRUE(l.eval_bool("return p.z == nil"));
+
+  // Const members and const objects
+  EXPECT_NE(l.dostring("p.id = 1"), LUA_OK);
+  EXPECT_NE(l.to_string(-1).find("Const member cannot be modified: id"),
+            std::string::npos);
+  l.pop();
+  const Point cp;
+  l.set("cp", &cp);
+  EXPECT_EQ(l.eval_double("return cp.y"), 2);
+  EXPECT_NE(l.dostring("cp.y = 1"), LUA_OK);
+  l.pop();
+
+  // Conversion failure
+  EXPECT_NE(l.dostring("p.x = {}"), LUA_OK);
+  l.pop();
+  EXPECT_EQ(p.x, 3);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(static_members, userdata_and_smart_ptr) {
+  luaw l;
+  l.set("p", Point{});
+  EXPECT_EQ(l.eval_double("p.y = 5 return p.x + p.y"), 6);
+
+  auto s = std::make_shared<Point>();
+  l.set("s", s);
+  EXPECT_EQ(l.eval_double("s.x = 4 return s.x"), 4);
+  EXPECT_EQ(s->x, 4);
+
+  std::shared_ptr<Point> e;
+  l.set("e", &e);
+  EXPECT_NE(l.dostring("return e.x"), LUA_OK);
+  l.pop();
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(static_members, with_registered_members) {
+  luaw l;
+  l.register_member("norm2", &Point::norm2);
+  // Static members are found first
+  l.register_member<const double Point::*>(
+      "x", [](const Point*) -> double { return 100; });
+
+  Point p;
+  l.set("p", &p);
+  EXPECT_EQ(l.eval_double("return p:norm2()"), 5);
+  EXPECT_EQ(l.eval_double("return p.x"), 1);
+}
@@ -0,0 +1,134 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "main.h"
+
+namespace {
+
+// Expressions in a larger buffer, none of them is NUL-terminated.
+const char rules[] = "return 1 + 2;return a * 2;return 'x' .. ;";
+
+}  // namespace
+
+TEST(string_view, loadstring_with_length) {
+  luaw l;
+  EXPECT_EQ(l.dostring(rules, 12), LUA_OK);
+  EXPECT_EQ(l.to_int(-1), 3);
+  l.pop();
+
+  EXPECT_EQ(l.loadstring(rules, 12, "=rule1"), LUA_OK);
+  EXPECT_TRUE(l.isfunction(-1));
+  l.pop();
+
+  // Syntax error, default chunk name is the beginning of the buffer
+  EXPECT_EQ(l.loadstring(rules + 26, 15), LUA_ERRSYNTAX);
+  std::string err = l.to_string(-1);
+  l.pop();
+  EXPECT_EQ(err.find("[string \"return 'x' .. ;\"]:1:"), 0);
+
+  EXPECT_EQ(l.loadstring(rules + 26, 15, "=rule3"), LUA_ERRSYNTAX);
+  err = l.to_string(-1);
+  l.pop();
+  EXPECT_EQ(err.find("rule3:1:"), 0);
+
+  // Long expressions get the same chunk name as loadstring
+  std::string s = "return 1 + + 2 -- " + std::string(100, 'x');
+  EXPECT_EQ(l.loadstring(s.c_str()), LUA_ERRSYNTAX);
+  std::string err1 = l.to_string(-1);
+  l.pop();
+  EXPECT_EQ(l.loadstring(s.data(), s.size()), LUA_ERRSYNTAX);
+  std::string err2 = l.to_string(-1);
+  l.pop();
+  EXPECT_EQ(err1, err2);
+
+  EXPECT_EQ(l.dostring(rules, 0), LUA_OK);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(string_view, embedded_zeros) {
+  luaw l;
+  std::string s("a\0b", 3);
+  l.set("s", s);
+  EXPECT_EQ(l.eval_int("return #s"), 3);
+
+  l.set_string("t", s.data(), 2);
+  EXPECT_EQ(l.eval_int("return #t"), 2);
+  l.set_string("t", s);
+  EXPECT_EQ(l.eval_int("return #t"), 3);
+
+  EXPECT_EQ(l.dostring(std::string("return 1\0abc", 12)), LUA_ERRSYNTAX);
+  l.pop();
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+#if PEACALM_LUAW_SUPPORT_CPP17
+
+TEST(string_view, eval) {
+  luaw l;
+  l.set_integer("a", 5);
+  std::string_view r1(rules, 12), r2(rules + 13, 12), r3(rules + 26, 15);
+
+  EXPECT_EQ(l.eval_int(r1), 3);
+  EXPECT_EQ(l.eval_double(r2), 10);
+  EXPECT_EQ(l.eval<int>(r2), 10);
+  EXPECT_EQ(l.eval_with_env<int>(r2, std::map<std::string, int>{{"a", 1}}),
+            2);
+
+  bool failed = false;
+  EXPECT_EQ(l.eval_string(r3, "def", true, &failed), "def");
+  EXPECT_TRUE(failed);
+
+  auto e = l.compile(r2);
+  EXPECT_TRUE(e.valid());
+  EXPECT_EQ(e.eval<int>(), 10);
+
+  EXPECT_EQ(l.loadstring(r1), LUA_OK);
+  l.pop();
+  EXPECT_EQ(l.dostring(r2, "=rule2"), LUA_OK);
+  EXPECT_EQ(l.to_int(-1), 10);
+  l.pop();
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(string_view, eval_cache) {
+  luaw l;
+  l.enable_eval_cache();
+  l.set_integer("a", 5);
+  std::string_view r2(rules + 13, 12);
+  EXPECT_EQ(l.eval_int(r2), 10);
+  EXPECT_EQ(l.eval_int("return a * 2"), 10);
+  EXPECT_EQ(l.eval_int(std::string("return a * 2")), 10);
+  EXPECT_EQ(l.get_eval_cache_stats().misses, 1);
+  EXPECT_EQ(l.get_eval_cache_stats().hits, 2);
+}
+
+TEST(string_view, push_and_set) {
+  luaw             l;
+  std::string_view v(rules + 7, 5);  // "1 + 2"
+  l.set("v", v);
+  EXPECT_EQ(l.get_string("v"), "1 + 2");
+  l.set_string("w", v.substr(0, 1));
+  EXPECT_EQ(l.get_string("w"), "1");
+
+  l.newtable();
+  l.setkv(std::string_view("key_abc", 3), v);
+  l.setkv<std::string>(std::string_view("str"), "abc");
+  EXPECT_EQ(l.seek("key").to_string(), "1 + 2");
+  l.pop();
+  EXPECT_EQ(l.seek("str").to_string(), "abc");
+  l.pop(2);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+#endif
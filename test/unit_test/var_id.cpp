@@ -0,0 +1,110 @@
+// Copyright (c) 2023-2024 Li Shuangquan. All Rights Reserved.
+//
+// Licensed under the MIT License (the "License"); you may not use this file
+// except in compliance with the License. You may obtain a copy of the License
+// at
+//
+//   http://opensource.org/licenses/MIT
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "main.h"
+
+namespace {
+
+// Values are backed by a flat array indexed by variable IDs.
+struct id_provider {
+  std::vector<int>      values;
+  std::vector<uint32_t> requested;
+
+  bool provide(luaw &l, uint32_t vid) {
+    requested.push_back(vid);
+    if (vid >= values.size()) return false;
+    l.push(values[vid]);
+    return true;
+  }
+};
+
+// Provides by ID if both implemented.
+struct both_provider : id_provider {
+  using id_provider::provide;
+  bool provide(luaw &l, const char *vname) {
+    l.push(-1);
+    return true;
+  }
+};
+
+using clw = custom_luaw<std::unique_ptr<id_provider>>;
+
+}  // namespace
+
+TEST(var_id, intern) {
+  clw l;
+  EXPECT_EQ(l.var_count(), 0);
+  EXPECT_EQ(l.var_name(0), nullptr);
+  EXPECT_EQ(l.var_id("a"), 0);
+  EXPECT_EQ(l.var_id(std::string("b")), 1);
+  EXPECT_EQ(l.var_id("a"), 0);
+  EXPECT_EQ(l.var_id(std::string("a\0b", 3)), 2);
+  EXPECT_EQ(l.var_count(), 3);
+  EXPECT_STREQ(l.var_name(1), "b");
+  EXPECT_EQ(l.var_name(3), nullptr);
+  EXPECT_EQ(l.gettop(), 0);
+
+  // Names got before stay valid while more names are interned
+  const char* b = l.var_name(1);
+  for (int i = 0; i < 1000; ++i) l.var_id("v" + std::to_string(i));
+  EXPECT_EQ(l.var_count(), 1003);
+  EXPECT_EQ(l.var_name(1), b);
+  EXPECT_STREQ(b, "b");
+
+  clw l2(std::move(l));
+  EXPECT_EQ(l2.var_id("b"), 1);
+  EXPECT_EQ(l2.var_count(), 1003);
+}
+
+TEST(var_id, provide_by_id) {
+  clw l;
+  l.provider(std::make_unique<id_provider>());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(l.var_id(std::string(1, 'a' + i)), i);
+    l.provider()->values.push_back(i + 1);
+  }
+
+  EXPECT_EQ(l.eval_int("return a + b * c"), 7);
+  EXPECT_EQ(l.provider()->requested, (std::vector<uint32_t>{0, 1, 2}));
+
+  // Unknown names are interned when provided
+  bool failed = false;
+  EXPECT_EQ(l.eval_int("return x", 0, true, &failed), 0);
+  EXPECT_TRUE(failed);
+  EXPECT_EQ(l.provider()->requested.back(), 3);
+  EXPECT_STREQ(l.var_name(3), "x");
+  l.provider()->values.push_back(10);
+  EXPECT_EQ(l.eval_int("return x"), 10);
+
+  // In coroutine
+  EXPECT_EQ(l.eval_int("return coroutine.wrap(function() return a + x end)()"),
+            11);
+
+  // With provider cache and prefetch
+  l.enable_provider_cache();
+  l.provider()->requested.clear();
+  EXPECT_EQ(l.prefetch_eval<int>("return b + c + b"), 8);
+  EXPECT_EQ(l.eval_int("return b + c"), 5);
+  EXPECT_EQ(l.provider()->requested, (std::vector<uint32_t>{1, 2}));
+  EXPECT_EQ(l.var_count(), 4);
+  EXPECT_EQ(l.gettop(), 0);
+}
+
+TEST(var_id, prefer_id) {
+  custom_luaw<std::unique_ptr<both_provider>> l;
+  l.provider(std::make_unique<both_provider>());
+  l.provider()->values = {5};
+  EXPECT_EQ(l.eval_int("return a"), 5);
+  EXPECT_EQ(l.var_id("a"), 0);
+}